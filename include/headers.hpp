@@ -12,6 +12,7 @@
 #include "definitions.hpp"
 #include "system/draw/draw.hpp"
 #include "system/draw/external_font.hpp"
+#include "system/draw/yuv_texture.hpp"
 #include "system/util/change_setting.hpp"
 #include "system/util/error.hpp"
 #include "system/util/explorer.hpp"
@@ -30,6 +31,7 @@
 #include "system/util/swkbd.hpp"
 #include "system/util/util.hpp"
 #include "system/util/libctru_wrapper.hpp"
+#include "system/util/light_lock.hpp"
 #include "variables.hpp"
 #include "scene_switcher.hpp"
 #include "types.hpp"
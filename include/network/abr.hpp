@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+#include <map>
+
+// automatic quality selection ("Auto" in the quality selector of the video player)
+// the quality is chosen from the throughput measured by the stream downloader and from how much of the frame time the video decoder uses
+// the throughput estimate is kept across videos so that the next one can start at a sensible quality
+
+// `qualities` : the p values that can be played, sorted in ascending order
+// `video_bitrates` : bits per second of each quality (0 or missing if unknown), `audio_bitrate` likewise
+// `max_quality` : the highest quality the video decoder of the console can be expected to handle
+struct AbrStreamSet {
+	std::vector<int> qualities;
+	std::map<int, int> video_bitrates;
+	int audio_bitrate = 0;
+	int max_quality = 360;
+};
+
+// the quality to start a playback with
+int abr_choose_initial_quality(const AbrStreamSet &streams);
+// called when a playback starts, nothing is switched for a while after it
+void abr_start_playback();
+
+// `bytes_per_ms` : NetworkStreamDownloader::get_bandwidth_estimate(), ignored if 0
+void abr_report_throughput(double bytes_per_ms);
+// for each decoded video frame, the time the decoder waited for output space must not be included
+void abr_report_video_frame(double decode_time, double frame_time);
+
+// the quality to switch to, or `cur_quality` to stay
+// meant to be called at key frames so that the playback restarts at the same picture
+int abr_next_quality(int cur_quality, const AbrStreamSet &streams);
@@ -0,0 +1,24 @@
+#pragma once
+#include <3ds.h>
+
+// the shared view of whether network requests can currently succeed
+// fed by the wifi state, the connectivity check and the results of opening connections, so that the background requesters
+// wait during an outage instead of failing and retrying in a loop, and resume as soon as the connection is back
+
+#define CONNECTIVITY_BACKOFF_MIN_MS 250
+#define CONNECTIVITY_BACKOFF_MAX_MS 30000
+
+// the link state from the wifi state in the shared memory, a transition to up lifts the backoff immediately
+void connectivity_set_link_up(bool up);
+// while the app is suspended (sleep, HOME menu), see network_lifecycle.hpp : not usable, and the failures are not counted
+// the backoff is lifted when it's resumed
+void connectivity_set_suspended(bool suspended);
+// the result of an attempt to reach a server (a connection or the connectivity check)
+void connectivity_report_success();
+void connectivity_report_failure();
+
+// false while the link is down or waiting out the backoff after failures
+bool connectivity_is_usable();
+// returns true as soon as it is usable, false if it's still not after `timeout_ns`
+bool connectivity_wait_until_usable(s64 timeout_ns);
+int connectivity_get_consecutive_failures();
@@ -0,0 +1,70 @@
+#pragma once
+#include "system/platform.hpp"
+
+// the decisions of NetworkStreamDownloader (network_downloader.hpp) that only depend on the state of the streams :
+// how far ahead to read, which block to request next, how many blocks at once and how the request size follows the throughput
+// nothing here touches the network, a lock or any 3ds api, so that tools/downloader_sim runs exactly this code against recorded or synthetic links
+
+struct DownloadPolicy {
+	static constexpr u64 BLOCK_SIZE = 0x20000; // 128 KiB
+	static constexpr u64 MAX_REQUEST_BLOCKS = 16; // 2 MiB
+	static constexpr u64 MAX_FORWARD_READ_BLOCKS = 100;
+	static constexpr u64 MIN_FORWARD_READ_BLOCKS = 4;
+	static constexpr double MIN_FORWARD_SECONDS = 15;
+	static constexpr double MAX_FORWARD_SECONDS = 90;
+	static constexpr double ENOUGH_LINK_SPEED_RATIO = 4; // if the link is this many times faster than the bitrate, MIN_FORWARD_SECONDS is enough
+	static constexpr double BANDWIDTH_EWMA_WEIGHT = 0.3;
+	static constexpr u64 CATCH_UP_REQUEST_BLOCKS = 8; // 1 MiB, requested in a single streamed range request when the block at the read head is missing
+};
+
+// the blocks of one stream as the decisions see them
+class DownloadBlockMap {
+public :
+	virtual ~DownloadBlockMap () = default;
+	// the first block in [from, limit) that is not present, or `limit` if all of them are
+	virtual u64 find_missing_block(u64 from, u64 limit) const = 0;
+	virtual bool is_block_present(u64 block) const = 0;
+	// reserved by a worker that is downloading it
+	virtual bool is_block_in_flight(u64 block) const = 0;
+	// readable without the network (the disk cache)
+	virtual bool is_block_cached(u64) const { return false; }
+};
+
+// adaptive request size : one block right after a seek, grows while the measured throughput is stable
+struct DownloadRequestSizing {
+	u64 request_block_num = 1;
+	u64 min_request_block_num = 1; // a larger value trades the startup latency for fewer wakeups of the wifi
+	double last_throughput = 0; // bytes per millisecond of the last range request
+	double bandwidth_estimate = 0; // EWMA of the throughput of range requests in bytes per millisecond
+};
+
+// a snapshot of a ready, range-requested stream
+struct DownloadPolicyStream {
+	const DownloadBlockMap *blocks = NULL;
+	u64 len = 0;
+	u64 block_num = 0;
+	u64 read_head = 0;
+	double bitrate = 0; // bytes per second of playback, 0 if unknown
+	u64 forward_read_blocks = 0; // download_policy_forward_read_blocks()
+	u64 bulk_read_end = 0; // see NetworkStream::bulk_read_end
+	bool local_file = false;
+};
+
+// how many blocks ahead of the read head should be prefetched, based on the bitrate and the measured link speed
+// `fixed_forward_read_blocks` : NetworkStream::max_forward_read_blocks, `paused_forward_seconds` : 0 unless the playback is paused
+u64 download_policy_forward_read_blocks(double bitrate, double bandwidth_estimate, u64 fixed_forward_read_blocks, double paused_forward_seconds,
+	bool memory_budget_over, bool data_saver);
+
+// the first block in the prefetch window that is neither present nor in flight, and how much is downloaded ahead of the read head
+// (in seconds if `margin_in_seconds`, otherwise in percents of the stream length), false if nothing in the window needs downloading
+bool download_policy_find_next_block(const DownloadPolicyStream &stream, bool margin_in_seconds, u64 *block, double *margin);
+
+// how many consecutive blocks from `block` to request at once, `catching_up` is set if it's a streamed catch-up request of the read head
+// resets the request size of `sizing` if `block` is right at the read head (just after a seek or at startup)
+u64 download_policy_request_block_num(const DownloadPolicyStream &stream, u64 block, DownloadRequestSizing &sizing, bool *catching_up);
+
+// updates the request size and the bandwidth estimate with the throughput (bytes per millisecond) of a completed range request
+void download_policy_on_throughput(DownloadRequestSizing &sizing, double measured_throughput);
+
+// whether less than `safe_margin_seconds` of it is downloaded ahead of the read head (never if it's downloaded up to the end)
+bool download_policy_is_starving(const DownloadPolicyStream &stream, double safe_margin_seconds);
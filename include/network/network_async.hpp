@@ -0,0 +1,27 @@
+#pragma once
+#include <functional>
+#include "network/network_io.hpp"
+#include "network/network_scheduler.hpp"
+
+// non-blocking counterparts of Access_http_get()/Access_http_post()
+// every request is driven by a single event loop thread (network_async_thread_func), so issuing many of them doesn't cost any extra stack
+// with NETWORK_FRAMEWORK_LIBCURL, up to NETWORK_ASYNC_MAX_CONCURRENT requests are in flight at once through a curl multi handle
+// (multiplexed over HTTP/2 when the server supports it), with the other frameworks they are processed one by one on the loop thread
+// a pending request starts once network_scheduler.hpp allows its traffic class, so a held back one doesn't delay the ones queued after it
+
+#define NETWORK_ASYNC_MAX_CONCURRENT 6
+
+// called on the event loop thread when the request finishes (or fails), so it must not block
+// the result is finalized right after the callback returns
+typedef std::function<void (NetworkResult &result)> NetworkAsyncCallback;
+
+// return the id of the request, which can be passed to network_async_cancel()
+int network_async_get(const std::string &url, const std::map<std::string, std::string> &request_headers, const NetworkAsyncCallback &callback,
+	NetworkTrafficClass traffic_class = NetworkTrafficClass::INTERACTIVE);
+int network_async_post(const std::string &url, const std::map<std::string, std::string> &request_headers, const std::string &body,
+	const NetworkAsyncCallback &callback, NetworkTrafficClass traffic_class = NetworkTrafficClass::INTERACTIVE);
+// the callback of a cancelled request is never called (unless it's already running)
+void network_async_cancel(int id);
+
+void network_async_thread_func(void *arg);
+void network_async_thread_exit_request();
@@ -1,84 +1,151 @@
 #pragma once
-#include "network_downloader.hpp"
+#include "network/network_stream.hpp"
+#include "system/util/light_lock.hpp"
 #include "types.hpp"
 #include <vector>
 #include <set>
 #include <deque>
+#include <atomic>
 
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libavformat/avformat.h"
 #include "libswresample/swresample.h"
+#include "libavutil/opt.h"
 }
 
 namespace network_decoder_ {
 	/*
-		internal queue used to buffer the raw output of decoded images
-		thread-safe when one thread only pushes and the other thread pops
+		lock-free queue used to buffer the raw output of decoded images
+		thread-safe when one thread only pushes (get_next_pushed(), push(), clear()) and the other thread only pops (get_next_poped(), pop())
+		the slot of the last popped element is not overwritten until the next pop(), so the consumer can keep using it until then
 	*/
 	template <typename T> class output_buffer {
 		size_t num = 0;
 		std::vector<T> buffer;
-		volatile size_t head = 0; // the index of the element in the buffer which the next pushed element should go in
-		volatile size_t tail = 0; // the index of the element in the buffer which should be poped next
+		std::atomic<size_t> head{0}; // the index of the element in the buffer which the next pushed element should go in, written only by the producer
+		std::atomic<size_t> tail{0}; // the index of the element in the buffer which should be poped next, written only by the consumer
 		
+		size_t next(size_t index) const { return index == num ? 0 : index + 1; }
 		public :
 		void init(const std::vector<T> &buffer_init) {
 			num = buffer_init.size() - 1;
 			buffer = buffer_init;
-			head = tail = 0;
+			head.store(0, std::memory_order_relaxed);
+			tail.store(0, std::memory_order_relaxed);
 		}
 		std::vector<T> deinit() {
 			auto res = buffer;
 			buffer.clear();
 			num = 0;
-			head = tail = 0;
+			head.store(0, std::memory_order_relaxed);
+			tail.store(0, std::memory_order_relaxed);
 			return res;
 		}
 		// get the size of the queue
-		size_t size() {
-			if (head >= tail) return head - tail;
-			else return head + num + 1 - tail;
+		size_t size() const {
+			size_t cur_head = head.load(std::memory_order_acquire);
+			size_t cur_tail = tail.load(std::memory_order_acquire);
+			if (cur_head >= cur_tail) return cur_head - cur_tail;
+			else return cur_head + num + 1 - cur_tail;
 		}
-		bool full() {
+		bool full() const {
 			return size() == num;
 		}
-		bool empty() {
+		bool empty() const {
 			return size() == 0;
 		}
-		T get_next_pushed() {
-			if (full()) return NULL;
-			return buffer[head];
+		// the slot the next pushed element should be written to, NULL if the queue is full
+		T *get_next_pushed() {
+			size_t cur_head = head.load(std::memory_order_relaxed);
+			if (next(cur_head) == tail.load(std::memory_order_acquire)) return NULL;
+			return &buffer[cur_head];
 		}
+		// publishes the slot returned by get_next_pushed()
 		bool push() {
-			if (full()) return false;
-			head = (head == num ? 0 : head + 1);
+			size_t cur_head = head.load(std::memory_order_relaxed);
+			if (next(cur_head) == tail.load(std::memory_order_acquire)) return false;
+			head.store(next(cur_head), std::memory_order_release);
 			return true;
 		}
-		T get_next_poped() {
-			if (empty()) return NULL;
-			return buffer[tail];
+		// the slot of the element to be popped next, NULL if the queue is empty
+		T *get_next_poped() {
+			size_t cur_tail = tail.load(std::memory_order_relaxed);
+			if (cur_tail == head.load(std::memory_order_acquire)) return NULL;
+			return &buffer[cur_tail];
 		}
 		bool pop() {
-			if (empty()) return false;
-			tail = (tail == num ? 0 : tail + 1);
+			size_t cur_tail = tail.load(std::memory_order_relaxed);
+			if (cur_tail == head.load(std::memory_order_acquire)) return false;
+			tail.store(next(cur_tail), std::memory_order_release);
 			return true;
 		}
+		// called by the producer while the consumer is not popping
 		void clear() {
-			head = tail;
+			head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+		}
+	};
+	/*
+		output_buffer whose consumer and producer can sleep until the other side makes progress
+		the events are only signaled while the other side is actually waiting, so pushing and popping don't make a service call normally
+	*/
+	template <typename T> class blocking_output_buffer : public output_buffer<T> {
+		LightEventFlag pushed_event{RESET_ONESHOT};
+		LightEventFlag poped_event{RESET_ONESHOT};
+		std::atomic<bool> consumer_waiting{false};
+		std::atomic<bool> producer_waiting{false};
+		
+		// returns true if `ready` became true within timeout_ns
+		template <typename F> bool wait(LightEventFlag &event, std::atomic<bool> &waiting, s64 timeout_ns, F ready) {
+			if (ready()) return true;
+			waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in push()/pop() so that the wakeup is never lost
+			if (!ready()) event.wait(timeout_ns);
+			waiting.store(false, std::memory_order_relaxed);
+			return ready();
+		}
+		void notify(LightEventFlag &event, std::atomic<bool> &waiting) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiting.load(std::memory_order_relaxed)) event.signal();
+		}
+		public :
+		bool push() {
+			bool res = output_buffer<T>::push();
+			if (res) notify(pushed_event, consumer_waiting);
+			return res;
+		}
+		bool pop() {
+			bool res = output_buffer<T>::pop();
+			if (res) notify(poped_event, producer_waiting);
+			return res;
+		}
+		// for the consumer : false on timeout
+		bool wait_not_empty(s64 timeout_ns) {
+			return wait(pushed_event, consumer_waiting, timeout_ns, [this] () { return !this->empty(); });
+		}
+		// for the producer : false on timeout
+		bool wait_not_full(s64 timeout_ns) {
+			return wait(poped_event, producer_waiting, timeout_ns, [this] () { return !this->full(); });
 		}
 	};
 }
 
 class NetworkDecoder;
 
+// a position a seek can start decoding from (a keyframe or the start of a fragment)
+struct SeekIndexEntry {
+	double time; // seconds, in the stream's own timeline
+	u64 pos; // byte offset in the stream
+};
+
 class NetworkDecoderFFmpegData {
 private :
 	static constexpr int VIDEO = 0;
 	static constexpr int AUDIO = 1;
 	static constexpr int BOTH = 0;
 	
-	Result_with_string init_(int type, AVMediaType expected_codec_type, NetworkDecoder *parent_decoder);
+	Result_with_string init_(int type, AVMediaType expected_codec_type, NetworkDecoder *parent_decoder, const NetworkDecoderFFmpegData *shared_codecs);
+	void find_stream_info(int type);
 	AVStream *get_stream(int type) { return format_context[video_audio_seperate ? type : BOTH]->streams[stream_index[type]]; }
 public :
 	bool video_audio_seperate = false;
@@ -89,15 +156,31 @@ public :
 	int stream_index[2] = {0, 0};
 	AVCodecContext *decoder_context[2] = {NULL, NULL};
 	SwrContext *swr_context = NULL;
+	int audio_output_sample_rate = 0; // what swr_context outputs
+	int audio_output_ch = 0;
 	const AVCodec *codec[2] = {NULL, NULL};
 	bool audio_only = false;
 	NetworkDecoder *parent_decoder = NULL;
+	std::vector<SeekIndexEntry> seek_index[2]; // sorted by time, empty if unknown (e.g. livestreams)
+	bool stream_info_found[2] = {false, false};
+	// decoder_context[type] (and swr_context for the audio) belongs to another NetworkDecoderFFmpegData, so deinit() doesn't free it
+	bool codec_borrowed[2] = {false, false};
 	
-	Result_with_string init(NetworkStream *video_stream, NetworkStream *audio_stream, NetworkDecoder *parent_decoder);
-	Result_with_string init(NetworkStream *both_stream, NetworkDecoder *parent_decoder);
+	// `shared_codecs` : if not NULL, its decoder contexts are used instead of creating new ones as long as the codec parameters are the same
+	// (the codec state then carries over from the previous fragment of a livestream, and the stream info probing is skipped)
+	Result_with_string init(NetworkStream *video_stream, NetworkStream *audio_stream, NetworkDecoder *parent_decoder, const NetworkDecoderFFmpegData *shared_codecs = NULL);
+	Result_with_string init(NetworkStream *both_stream, NetworkDecoder *parent_decoder, const NetworkDecoderFFmpegData *shared_codecs = NULL);
+	// moves the ownership of the decoder contexts of `data` to this, `data` keeps using them
+	void take_codecs(NetworkDecoderFFmpegData &data);
 	void deinit(bool deinit_stream);
+	// replaces only the video stream, the old one should have been freed with deinit_video() (only if video_audio_seperate)
+	Result_with_string init_video(NetworkStream *video_stream);
+	void deinit_video();
 	Result_with_string reinit();
 	double get_duration();
+	// bytes held by the demuxers (AVIO buffers, contexts, seek index) and the decoder contexts owned by this, the stream data is not included
+	// the codec state is an estimate from the frame size as ffmpeg doesn't tell the size of its internal buffers
+	u64 get_memory_usage();
 };
 
 class NetworkDecoder {
@@ -115,27 +198,104 @@ private :
 	int stream_index[2] = {0, 0};
 	AVCodecContext *decoder_context[2] = {NULL, NULL};
 	SwrContext *swr_context = NULL;
+	int audio_output_sample_rate = 0;
+	int audio_output_ch = 0;
 	const AVCodec *codec[2] = {NULL, NULL};
 	bool audio_only = false;
 	
 	std::deque<AVPacket *> packet_buffer[2];
-	network_decoder_::output_buffer<AVFrame *> video_tmp_frames;
-	network_decoder_::output_buffer<u8 *> video_mvd_tmp_frames;
-	u8 *mvd_frame = NULL; // internal buffer written directly by the mvd service
+	// video read-ahead : while video_demux_enabled, only the demux thread reads video packets (see demux_video_ahead())
+	LightMutex packet_buffer_lock; // packet_buffer, video_demux_queued_bytes and video_demux_eof are shared with the demux thread
+	LightMutex video_demux_lock; // held while av_read_frame() runs on the video demuxer, and by pause_video_demux()
+	LightEventFlag video_packet_event{RESET_ONESHOT}; // signaled when the demux thread queues a video packet or reaches the end
+	LightEventFlag video_packet_consumed_event{RESET_ONESHOT}; // signaled when a queued video packet is taken
+	u64 video_demux_queued_bytes = 0;
+	volatile bool video_demux_eof = false;
+	network_decoder_::blocking_output_buffer<AVFrame *> video_tmp_frames;
+	// a frame of the mvd service with what's known about it when it came out
+	struct MvdFrame {
+		u8 *data;
+		double pts;
+		int width, height; // the size it was rendered at, smaller than the video if scaled down
+	};
+	network_decoder_::blocking_output_buffer<MvdFrame> video_mvd_tmp_frames;
+	u8 *mvd_frame = NULL; // written by the mvd service when the output buffers can't take the frame (or aren't in linear memory)
+	bool mvd_direct_output = false; // video_mvd_tmp_frames are in linear memory and the mvd service renders straight into them
+	u8 *mvd_packet = NULL; // linear memory reused for every packet sent to the mvd service, grown when needed
+	size_t mvd_packet_size = 0;
 	u8 *sw_video_output_tmp = NULL;
-	Handle buffered_pts_list_lock; // lock of buffered_pts_list
-	std::multiset<double> buffered_pts_list; // used for HW decoder to determine the pts when outputting a frame
+	// recycled objects so that reading and decoding packets don't allocate in steady state
+	std::vector<AVPacket *> packet_pool; // unreferenced packets
+	LightMutex packet_pool_lock; // the audio and video packets can be read from different threads (see prepare_packet())
+	// the converted samples are written into a linear memory arena of AUDIO_BUFFER_NUM slots so that the speaker can play them without copying
+	u8 *audio_buffer_arena = NULL;
+	int audio_buffer_slot_size = 0; // decided from the frame size of the audio codec when first needed
+	std::vector<int> audio_buffer_free_slots; // used as a stack
+	AVFrame *audio_frame = NULL;
+	std::vector<SeekIndexEntry> seek_index[2];
+	// the pts of the packets given to the mvd service whose frames haven't come out yet, sorted, only touched by the decoding thread
+	// frames come out in the presentation order, so each one takes the smallest (the reorder window is much smaller than this)
+	static constexpr int MVD_PENDING_PTS_MAX = 32;
+	double mvd_pending_pts[MVD_PENDING_PTS_MAX];
+	int mvd_pending_pts_num = 0;
 	bool mvd_first = false;
+	int frame_skip_level = 0; // 0 : decode everything, 1 : skip non-reference frames, 2 : also skip the loop filter entirely
+	// the software decoder holds frames back (reordering, and one per thread with frame threading) : they're taken out at the end of the stream
+	bool video_frames_held = false; // packets have been sent since the last flush or drain
+	bool video_draining = false; // the NULL packet has been sent
 	
 	Result_with_string init_output_buffer(bool);
+	void deinit_output_buffer();
+	u8 *reserve_mvd_packet(size_t size);
+	void update_frame_skip_level(double packet_pos);
+	Result_with_string drain_video(int *width, int *height, bool *key_frame, double *cur_pos);
 	Result_with_string read_packet(int type);
+	// reads the next packet of `type` right away if none is queued, unless the demux thread does it
+	void refill_packet_buffer(int type);
+	AVPacket *peek_packet(int type); // the first queued packet of `type`, NULL if none
+	void pop_packet(int type); // recycles the first queued packet of `type`
+	size_t get_queued_packet_num(int type) {
+		packet_buffer_lock.lock();
+		size_t res = packet_buffer[type].size();
+		packet_buffer_lock.unlock();
+		return res;
+	}
+	void clear_packet_buffer(int type);
+	bool video_demux_active() { return video_demux_enabled && video_audio_seperate && !audio_only; }
+	// waits until the demux thread queues a video packet, reaches the end or is interrupted, true if a packet is queued
+	bool wait_for_video_packet();
+	AVPacket *get_packet();
+	void recycle_packet(AVPacket *packet);
+	u8 *get_audio_buffer(int size);
+	double prefetch_seek_target(int type, double time);
+	void add_mvd_pending_pts(double pts);
 	Result_with_string mvd_decode(int *width, int *height);
 	AVStream *get_stream(int type) { return format_context[video_audio_seperate ? type : BOTH]->streams[stream_index[type]]; }
 public :
 	bool hw_decoder_enabled = false;
+	// the number of threads FFmpeg is asked to use for the software video decoding, set before the decoder contexts are created
+	// only takes effect if the FFmpeg libraries are built with thread support
+	int sw_decoder_thread_num = 1;
+	int sw_decoder_active_thread_num = 1; // what FFmpeg actually uses
+	// the decoded audio is resampled down to this rate (0 : as it is) and/or mixed down to mono, set before the decoder contexts are created
+	int audio_output_max_sample_rate = 0;
+	bool audio_output_mono = false;
+	volatile double audio_resample_time = 0; // ms spent in swr_convert() for the last audio packet, included in the time of decode_audio()
 	volatile bool interrupt = false;
 	volatile bool need_reinit = false;
+	// set while a thread calls demux_video_ahead() (separate streams only), then waiting for the video data never holds up the audio decoding
+	volatile bool video_demux_enabled = false;
+	// a read of this stream gives up instead of waiting for the data, so that pause_video_demux() doesn't wait for the network
+	NetworkStream * volatile video_demux_pause_stream = NULL;
 	volatile bool ready = false;
+	volatile double network_wait_time = 0; // total time (ms) spent waiting for the stream data to arrive, for profiling
+	// the current audio position (seconds, -1 if unknown) set by the player, used to skip frames when the software decoder falls behind
+	volatile double playback_pos = -1;
+	// the mvd service scales the frames down to at most this size (rounded up to 16), 0 for the size of the video
+	// e.g. the size the frames are drawn at, as the decoding itself is the same and the output, the tiling and the textures get smaller
+	volatile int mvd_output_max_width = 0;
+	volatile int mvd_output_max_height = 0;
+	volatile int skipped_frame_num = 0;
 	double timestamp_offset = 0;
 	const char *get_network_waiting_status() {
 		if (network_stream[VIDEO] && network_stream[VIDEO]->network_waiting_status) return network_stream[VIDEO]->network_waiting_status;
@@ -148,6 +308,10 @@ public :
 	Result_with_string init(bool request_hw_decoder); // should be called after the call of change_ffmpeg_data()
 	void deinit();
 	void clear_buffer();
+	// drops the codec state, needed when the next packets don't follow the previous ones and the decoder contexts are kept (livestream fragments)
+	void flush_codecs();
+	// switches to the video stream of `data` leaving the audio as it is, for changing the quality without stopping the playback
+	Result_with_string change_video_stream(const NetworkDecoderFFmpegData &data, bool request_hw_decoder);
 	
 	struct VideoFormatInfo {
 		int width;
@@ -162,6 +326,8 @@ public :
 		int bitrate;
 		int sample_rate;
 		int ch;
+		int output_sample_rate; // of the samples given by decode_audio(), which the speaker should be inited with
+		int output_ch;
 		std::string format_name;
 		double duration;
 	};
@@ -174,6 +340,23 @@ public :
 		INTERRUPTED
 	};
 	DecodeType next_decode_type();
+	// for decoding the audio and the video from different threads instead of following next_decode_type(), only if the two are separate streams
+	// reads a packet of `type` (AUDIO or VIDEO) if none is buffered yet, false if the stream has no more packets (or the read was interrupted)
+	bool prepare_packet(DecodeType type);
+	// whether the data for the next `seconds` of playback from the current read position is already downloaded in every stream
+	bool is_buffered_ahead(double seconds);
+	// seconds of playback downloaded contiguously from the current read position, the least of the streams (-1 if none of them is downloaded by blocks)
+	double get_buffered_seconds_ahead();
+	
+	// called repeatedly by the demux thread : reads a video packet into the queue unless it already holds
+	// VIDEO_DEMUX_AHEAD_SECONDS or VIDEO_DEMUX_AHEAD_BYTES, returns false if there was nothing to do
+	bool demux_video_ahead();
+	// sleeps until a queued video packet is taken (or `timeout_ns` passes), for the demux thread after demux_video_ahead() returned false
+	void wait_for_video_demux_space(s64 timeout_ns) { video_packet_consumed_event.wait(timeout_ns); }
+	// keeps the demux thread off the video demuxer until resume_video_demux(), needed around anything that seeks or replaces the demuxers
+	// can be nested, and the calling thread can still read packets itself meanwhile
+	void pause_video_demux();
+	void resume_video_demux() { video_demux_lock.unlock(); }
 	
 	
 	// decode the previously read video packet
@@ -182,12 +365,24 @@ public :
 	
 	// decode the previously read audio packet
 	Result_with_string decode_audio(int *size, u8 **data, double *cur_pos);
+	// gives back the buffer decode_audio() stored in *data (NULL is ignored), must be called from the decoding thread
+	// the buffer is in linear memory, so it can be given to Util_speaker_add_buffer() as it is
+	void free_audio_buffer(u8 *buffer);
 	
 	// get the previously decoded video frame raw data
 	// the pointer stored in *data should NOT be freed
-	Result_with_string get_decoded_video_frame(int width, int height, u8** data, double *cur_pos);
+	// `frame_width`, `frame_height` : if not NULL, set to the size of the frame (smaller than width x height if scaled down by the mvd service)
+	Result_with_string get_decoded_video_frame(int width, int height, u8** data, double *cur_pos, int *frame_width = NULL, int *frame_height = NULL);
+	// sleep until get_decoded_video_frame() has a frame to return (or decode_video() has space to output to), false on timeout
+	bool wait_for_decoded_video_frame(s64 timeout_ns);
+	bool wait_for_video_output_space(s64 timeout_ns);
 	
 	// seek both audio and video
 	Result_with_string seek(s64 microseconds);
+	// serves a short forward seek from the packets already demuxed : returns true (with the packets before the target dropped) if the queue
+	// holds a key frame at most SEEK_IN_QUEUE_MAX_KEYFRAME_DISTANCE seconds before `microseconds`, the demuxers are left untouched
+	bool seek_within_queue(s64 microseconds);
+	// seek only the video, to the first key frame at or after the position
+	Result_with_string seek_video(s64 microseconds);
 };
 
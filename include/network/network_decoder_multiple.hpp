@@ -12,7 +12,11 @@
 class NetworkMultipleDecoder {
 private :
 	static constexpr int MAX_CACHE_FRAGMENTS_NUM = 10;
+	static constexpr int MIN_CACHE_FRAGMENTS_NUM = 2; // fragments from seq_using kept even while the memory budget is exceeded
 	static constexpr int MAX_LIVESTREAM_RETRY = 2;
+	static constexpr int LIVESTREAM_PREFETCH_FRAGMENTS_NUM = 3; // fragments downloaded at once by the initer, including the one being inited
+	static constexpr int LOW_LATENCY_MAX_FRAGMENTS_AHEAD = 2; // fragments buffered from seq_using in the low latency mode
+	static constexpr int LIVESTREAM_DVR_WINDOW = 60 * 60 * 12; // seconds behind the live edge that YouTube keeps available
 	volatile bool initer_stop_request = true;
 	volatile bool initer_exit_request = false;
 	volatile bool initer_stopping = false;
@@ -33,12 +37,22 @@ private :
 	NetworkDecoder decoder;
 	Handle fragments_lock;
 	std::map<int, NetworkDecoderFFmpegData> fragments;
+	std::map<int, u64> fragment_memory; // what each entry of `fragments` is accounted as in the memory budget
+	// livestreams : owns the decoder contexts of the first fragment, which the following fragments keep using as long as the codec doesn't change
+	// so that there is no codec init (nor the loss of its delayed frames) at every fragment boundary
+	NetworkDecoderFFmpegData shared_codecs;
+	u64 shared_codecs_memory = 0;
 	std::map<int, int> error_count;
+	// livestream fragments whose download has been started ahead of their init, guarded by fragments_lock
+	// (started by the initer thread, or by seek() so that the target fragment doesn't wait for the fragment being inited)
+	std::map<int, std::vector<NetworkStream *> > prefetched_fragments;
 	int fragment_len = -1;
 	NetworkStreamDownloader *downloader = NULL;
 	NetworkSessionList video_session_list;
 	NetworkSessionList audio_session_list;
 	NetworkSessionList both_session_list;
+	NetworkSessionList head_poll_session_list; // used by the initer thread
+	double last_head_poll_time = 0;
 	
 	volatile int seq_buffered_head = 0;
 	
@@ -49,11 +63,51 @@ private :
 	volatile double duration_first_fragment = 0; // for some reason, the first fragment of a livestream differs in length from other fragments
 	
 	void recalc_buffered_head();
+	// fragments_lock must be held (or the initer thread must be stopped) when calling these
+	void add_fragment(int seq, const NetworkDecoderFFmpegData &data);
+	void erase_fragment(int seq);
+	void evict_fragments();
+	int get_max_fragments_ahead() { return low_latency ? LOW_LATENCY_MAX_FRAGMENTS_AHEAD : MAX_CACHE_FRAGMENTS_NUM; }
+	// updates seq_head with a one byte request instead of waiting for the next fragment, for the low latency mode
+	void poll_live_head();
+	// fragments_lock must be held when calling these two
+	void prefetch_fragment(int seq);
+	// `all` : otherwise only the ones that can no longer be used
+	void cancel_prefetched_fragments(bool all);
+	
+	// the next video opened by preopen() while the current one is still playing, guarded by preopen_lock
+	LightMutex preopen_lock;
+	NetworkDecoderFFmpegData preopened;
+	bool has_preopened = false;
+	std::vector<NetworkStream *> preopening_streams; // the streams preopen() is opening right now
+	std::string preopened_video_url;
+	std::string preopened_audio_url;
+	bool preopened_hw_decoder = false;
+	std::string preopened_disk_cache_id;
+	bool preopened_burst_download = false;
+	// preopen_lock must be held when calling these
+	void discard_preopened();
+	void abort_preopening();
+	// moves the preopened data into `data` if it was opened for exactly these urls and the current decoder settings, otherwise discards it
+	bool take_preopened(const std::string &video_url, const std::string &audio_url, bool request_hw_decoder, NetworkDecoderFFmpegData &data,
+		std::vector<NetworkStream *> &streams);
 public :
 	volatile bool &hw_decoder_enabled = decoder.hw_decoder_enabled;
+	const int &sw_decoder_active_thread_num = decoder.sw_decoder_active_thread_num;
 	volatile bool &interrupt = decoder.interrupt;
 	volatile bool &need_reinit = decoder.need_reinit;
 	volatile const bool &ready = decoder.ready;
+	volatile const double &network_wait_time = decoder.network_wait_time;
+	volatile const double &audio_resample_time = decoder.audio_resample_time;
+	volatile double &playback_pos = decoder.playback_pos;
+	volatile int &mvd_output_max_width = decoder.mvd_output_max_width;
+	volatile int &mvd_output_max_height = decoder.mvd_output_max_height;
+	volatile const int &skipped_frame_num = decoder.skipped_frame_num;
+	std::string disk_cache_id; // video id used to look up the disk cache, set before init() (empty to disable the disk cache)
+	bool burst_download = false; // set before init(), fetches the streams in a few large requests so that the wifi can idle in between
+	// set before init(), livestreams only : only a couple of fragments are buffered and seq_head is polled
+	// so that the player can keep up with the live edge (see get_live_edge_lag())
+	bool low_latency = false;
 	const char *get_network_waiting_status() { return decoder.get_network_waiting_status(); }
 	
 	NetworkMultipleDecoder ();
@@ -62,6 +116,16 @@ public :
 	// pass fragment_len == -1 if it's not a livestream
 	Result_with_string init(std::string video_url, std::string audio_url, NetworkStreamDownloader &downloader, int fragment_len, bool adjust_timestamp, bool request_hw_decoder);
 	Result_with_string init(std::string both_url, NetworkStreamDownloader &downloader, int fragment_len, bool adjust_timestamp, bool request_hw_decoder);
+	// replaces the video stream with `video_url` keeping the audio stream (and its downloaded data) and the decoder state of the audio
+	// the new video starts from the first key frame at or after `pos` (seconds), only if can_decode_concurrently()
+	// the video decoding must be stopped while this is called, and the playback has to be reinited on failure
+	Result_with_string change_video(std::string video_url, bool request_hw_decoder, double pos);
+	// opens the streams of the video likely to be played next (not a livestream) while the current one is still playing
+	// so that the init() for the same urls only has to set up the output : pass the same url twice for a single stream
+	// can be called from any thread, fails if the decoder settings of the current video (thread num, audio output) wouldn't fit
+	Result_with_string preopen(std::string video_url, std::string audio_url, NetworkStreamDownloader &downloader, bool request_hw_decoder,
+		std::string disk_cache_id, bool burst_download);
+	void cancel_preopen();
 	
 	void livestream_initer_thread_func();
 	void request_thread_exit() { initer_exit_request = true; }
@@ -73,16 +137,25 @@ public :
 	
 	double get_duration() { return duration_first_fragment + (fragment_len != -1 ? std::min(seq_num - 1, (int) seq_head) * fragment_len : 0); }
 	double get_forward_buffer() { return fragment_len == -1 ? 0 : (seq_buffered_head - seq_using - 1) * fragment_len; }
+	// the number of fragments the one being decoded is behind the latest one, 0 if not a livestream
+	int get_live_edge_lag() { return is_livestream ? std::max(0, seq_head - seq_using) : 0; }
+	// livestream fragment index : fragment `seq` covers [get_fragment_start(seq), get_fragment_start(seq + 1))
+	double get_fragment_start(int seq) { return seq <= 0 ? 0 : duration_first_fragment + (seq - 1) * fragment_len; }
+	int get_fragment_at(double timestamp) { return timestamp < duration_first_fragment ? 0 : (int) ((timestamp - duration_first_fragment) / fragment_len) + 1; }
+	// the oldest fragment that can still be downloaded
+	int get_dvr_window_start() { return std::max(0, seq_head - LIVESTREAM_DVR_WINDOW / std::max(1, fragment_len)); }
+	// the position to seek to in order to play `fragments_behind` fragments behind the latest one
+	double get_live_edge_pos(int fragments_behind) { return get_fragment_start(std::max(0, seq_head - fragments_behind)); }
 	double get_timestamp_from_bar_pos(double pos) {
 		pos = std::min(1.0, std::max(0.0, pos));
 		double duration = get_duration();
-		if (is_livestream && !adjust_timestamp) return duration - std::min<double>(duration, 60 * 60 * 12) * (1 - pos);
+		if (is_livestream && !adjust_timestamp) return duration - std::min<double>(duration, LIVESTREAM_DVR_WINDOW) * (1 - pos);
 		else return duration * pos;
 	}
 	double get_bar_pos_from_timestamp(double timestamp) {
 		double duration = get_duration();
 		double res;
-		if (is_livestream && !adjust_timestamp) res = 1 - (duration - timestamp) / std::min<double>(duration, 60 * 60 * 12);
+		if (is_livestream && !adjust_timestamp) res = 1 - (duration - timestamp) / std::min<double>(duration, LIVESTREAM_DVR_WINDOW);
 		else res = timestamp / duration;
 		return std::max(0.0, std::min(1.0, res));
 	}
@@ -92,6 +165,16 @@ public :
 	// the switch to the next sequence is done inside this function
 	using DecodeType = NetworkDecoder::DecodeType;
 	DecodeType next_decode_type();
+	// whether the audio and the video can be decoded from different threads with prepare_packet() (separate streams, not a livestream)
+	bool can_decode_concurrently() { return inited && video_audio_seperate && !is_livestream; }
+	bool prepare_packet(DecodeType type) { return decoder.prepare_packet(type); }
+	// lets a separate thread read the video packets ahead with demux_video_ahead(), so that waiting for the video data never
+	// stalls the audio decoding, only if can_decode_concurrently() (call with false before deinit())
+	void set_video_demux_enabled(bool enabled) { decoder.video_demux_enabled = enabled && can_decode_concurrently(); }
+	bool demux_video_ahead() { return decoder.demux_video_ahead(); }
+	void wait_for_video_demux_space(s64 timeout_ns) { decoder.wait_for_video_demux_space(timeout_ns); }
+	bool is_buffered_ahead(double seconds) { return decoder.is_buffered_ahead(seconds); }
+	double get_buffered_seconds_ahead() { return decoder.get_buffered_seconds_ahead(); }
 	
 	// decode the previously read video packet
 	// decoded image is stored internally and can be acquired via get_decoded_video_frame()
@@ -105,13 +188,16 @@ public :
 		auto res = decoder.decode_audio(size, data, cur_pos);
 		return res;
 	}
+	void free_audio_buffer(u8 *buffer) { decoder.free_audio_buffer(buffer); }
 	
 	// get the previously decoded video frame raw data
 	// the pointer stored in *data should NOT be freed
-	Result_with_string get_decoded_video_frame(int width, int height, u8** data, double *cur_pos) {
-		auto res = decoder.get_decoded_video_frame(width, height, data, cur_pos);
+	Result_with_string get_decoded_video_frame(int width, int height, u8** data, double *cur_pos, int *frame_width = NULL, int *frame_height = NULL) {
+		auto res = decoder.get_decoded_video_frame(width, height, data, cur_pos, frame_width, frame_height);
 		return res;
 	}
+	bool wait_for_decoded_video_frame(s64 timeout_ns) { return decoder.wait_for_decoded_video_frame(timeout_ns); }
+	bool wait_for_video_output_space(s64 timeout_ns) { return decoder.wait_for_video_output_space(timeout_ns); }
 	
 	// seek both audio and video
 	// TODO : implement this
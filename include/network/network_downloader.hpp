@@ -1,77 +1,82 @@
 #pragma once
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <3ds.h>
 #include "network/network_io.hpp"
+#include "network/network_stream.hpp"
+#include "network/network_scheduler.hpp"
 
-// one instance per one url (once constructed, the url is not changeable)
-struct NetworkStream {
-	static constexpr u64 BLOCK_SIZE = 0x40000; // 256 KiB
-	static constexpr u64 MAX_CACHE_BLOCKS = 12 * 1000 * 1000 / BLOCK_SIZE;
-	
-	u64 block_num = 0;
-	std::string url;
-	Handle downloaded_data_lock; // std::map needs locking when searching and inserting at the same time
-	std::map<u64, std::vector<u8> > downloaded_data;
-	bool whole_download = false;
-	NetworkSessionList *session_list = NULL;
-	
-	// anything above here is not supposed to be used from outside network_downloader.cpp and network_downloader.hpp
-	u64 len = 0;
-	volatile bool ready = false;
-	volatile bool suspend_request = false;
-	volatile bool quit_request = false;
-	volatile bool error = false;
-	volatile u64 read_head = 0;
-	const char * volatile network_waiting_status = NULL;
-	bool disable_interrupt = false;
-	// used for livestreams
-	int seq_head = -1;
-	int seq_id = -1;
-	bool livestream_eof = false;
-	bool livestream_private = false;
-	
-	// if `whole_download` is true, it will not use Range request but download the whole content at once (used for livestreams)
-	NetworkStream (std::string url, bool whole_download, NetworkSessionList *session_list);
-	
-	double get_download_percentage();
-	std::vector<double> get_buffering_progress_bar(int res_len);
-	
-	// check if the data of the current stream of range [start, start + size) is already downloaded and available
-	bool is_data_available(u64 start, u64 size);
-	
-	// this function must only be called when is_data_available(start, size) returns true
-	// returns the data of the stream of range [start, start + size)
-	std::vector<u8> get_data(u64 start, u64 size);
-	
-	// this function is supposed to be called from NetworkStreamDownloader::*
-	void set_data(u64 block, const std::vector<u8> &data);
-};
-
-
-// each instance of this class is paired with one downloader thread
+// each instance of this class is shared by up to WORKER_NUM downloader threads
 // it owns NetworkStream instances, and the one with the least margin (as in proportion to the length of the entire stream) is the target of next downloading
+// each worker reserves the block it is downloading, so several range requests for the same stream can be in flight at once
 class NetworkStreamDownloader {
+public :
+	static constexpr int WORKER_NUM = 2;
+	static constexpr int MAX_INSTANCES = 2; // the video player and the offline downloader
 private :
 	static constexpr u64 BLOCK_SIZE = NetworkStream::BLOCK_SIZE;
-	static constexpr u64 MAX_FORWARD_READ_BLOCKS = 50;
+	// the tuning of the prefetch window and the request size is in download_policy.hpp
+	static constexpr u64 MAX_PIPELINED_REQUESTS = 4; // sslc only : a multi-block read is split into this many range requests sent back to back
+	static constexpr int MAX_TRANSIENT_RETRIES = 6;
+	static constexpr u64 RETRY_BACKOFF_MIN_MS = 250; // doubled for each consecutive failure
+	static constexpr u64 RETRY_BACKOFF_MAX_MS = 4000;
+	static constexpr s64 IDLE_WAIT_TIMEOUT_NS = 200000000; // 200 ms
 	static constexpr const char * USER_AGENT = "Mozilla/5.0 (Linux; Android 11; Pixel 3a) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/83.0.4103.101 Mobile Safari/537.36";
 	
 	Handle streams_lock;
-	std::vector<NetworkStream *> streams;
+	Handle wakeup_event; // sticky event, signaled when a stream is added or is read, cleared before each scan
+	std::vector<NetworkStream *> streams; // the active ones, which each iteration of the workers scans
+	std::vector<NetworkStream *> retired_streams; // quit but still being downloaded by a worker, deleted once it's done
+	std::set<NetworkSessionList *> session_lists_in_use; // a session list must not be used by two workers at the same time
+	int worker_num = 0;
+	int worker_slot_base = -1; // the index of the first per-worker session list assigned to this instance
+	std::function<void ()> url_expired_handler;
 	
 	bool thread_exit_reqeusted = false;
+	volatile double paused_forward_seconds = 0; // if not 0, the prefetch window of every stream is capped to this many seconds
+	NetworkTrafficClass traffic_class = NetworkTrafficClass::PLAYBACK;
+	
+	// whether any stream has less than its safe_margin_seconds downloaded ahead, streams_lock must be held
+	bool is_starving(const std::vector<u64> &read_heads);
+	// moves the quit streams out of `streams` and deletes the retired ones no worker uses anymore, streams_lock must be held
+	void reclaim_quit_streams();
+	// how many blocks ahead of the read head should be prefetched (download_policy_forward_read_blocks())
+	u64 get_forward_read_blocks(NetworkStream *stream);
+	// returns true if the block was found in the disk cache and stored in the stream
+	bool load_block_from_disk_cache(NetworkStream *stream, u64 block, std::vector<u8> &buffer);
+	// reads `block_num` blocks from the SD card file the stream points to, returns false on failure
+	bool load_blocks_from_source(NetworkStream *stream, u64 block, u64 block_num, std::vector<u8> &buffer);
 public :
 	NetworkStreamDownloader ();
 	
 	// the pointer must be one that has been new-ed : it will be deleted once quit_request is made
 	void add_stream(NetworkStream *stream);
 	
-	void request_thread_exit() { thread_exit_reqeusted = true; }
+	void request_thread_exit() { thread_exit_reqeusted = true; svcSignalEvent(wakeup_event); }
+	// while the playback is paused, only this many seconds are kept downloaded ahead so that the bandwidth goes to the rest of the app
+	// 0 to go back to the usual window
+	void set_paused_forward_seconds(double seconds) { paused_forward_seconds = seconds; svcSignalEvent(wakeup_event); }
+	// the class of the requests of the workers, only a PLAYBACK one reports its starving streams to network_scheduler.hpp
+	// must be set before the downloader threads are started
+	void set_traffic_class(NetworkTrafficClass traffic_class) { this->traffic_class = traffic_class; }
+	// the best throughput estimate (bytes per millisecond) among the streams, 0 if nothing has been measured yet
+	double get_bandwidth_estimate();
 	void delete_all();
 	
+	// googlevideo urls expire after several hours : a stream whose range request is refused keeps its blocks and waits for a new url
+	// `handler` is called on a downloader thread each time a stream gets into that state, so it should only queue the work
+	// must be set before the downloader threads are started
+	void set_url_expired_handler(std::function<void ()> handler) { url_expired_handler = handler; }
+	// the urls the expired streams were constructed with
+	std::vector<std::string> get_expired_urls();
+	// swaps `new_url` into the expired streams constructed with `old_url` and resumes them, an empty `new_url` errors them out instead
+	void replace_expired_url(const std::string &old_url, const std::string &new_url);
+	
+	// can be called from at most WORKER_NUM threads at the same time
 	void downloader_thread();
 };
 // 'arg' should be a pointer to an instance of NetworkStreamDownloader
+// multiple threads can be started with the same instance to download blocks in parallel
 void network_downloader_thread(void *arg);
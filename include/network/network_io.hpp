@@ -2,8 +2,10 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <functional>
 #include <3ds.h>
 #include <curl/curl.h>
+#include "network/network_stats.hpp"
 
 #define NETWORK_FRAMEWORK_HTTPC 0
 #define NETWORK_FRAMEWORK_SSLC 1
@@ -18,6 +20,7 @@ struct NetworkResult {
 	std::string status_message;
 	std::vector<u8> data;
 	std::map<std::string, std::string> response_headers;
+	NetworkTiming timing;
 	
 	bool status_code_is_success() { return status_code / 100 == 2; }
 	std::string get_header(std::string key);
@@ -30,34 +33,66 @@ struct NetworkSession {
 	int sockfd = -1;
 	sslcContext sslc_context;
 	std::string host_name;
+	double dns_time = 0; // in milliseconds, measured when opened
+	double connect_time = 0;
 	
 	void open(std::string host_name);
 	void close();
 };
+// connections are not owned by a session list : sslc sessions are borrowed from a process-wide pool keyed by host for each request,
+// and all curl handles share one connection cache, DNS cache and TLS session cache, so a connection opened by one thread is reused by the others
 struct NetworkSessionList { // one instance per thread
 private :
 	void deinit(); // will be called for each instance when the app exits
 public :
-	CURL* curl = NULL;
 	// should not be used from outside network_io.cpp
-	std::map<std::string, NetworkSession> sessions; 
+	CURL* curl = NULL;
 	std::vector<u8> *buffer;
 	
 	bool inited = false;
+	u32 lifecycle_generation = 0; // the network_lifecycle_get_generation() of the last request
 	
 	// this function does NOT perform any network/socket related operations
 	void init();
-	void close_sessions();
 	
 	static void at_exit();
 };
 
 NetworkResult Access_http_get(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers, bool follow_redirect = true);
+// receives the response body piece by piece as it arrives, content_length is -1 if the server didn't tell it
+// returning false aborts the transfer (the result will be marked as failed)
+typedef std::function<bool (const u8 *data, size_t size, s64 content_length)> NetworkDataSink;
+// same as Access_http_get() except that the body of the final response is passed to the sink instead of being stored in NetworkResult::data
+NetworkResult Access_http_get_streaming(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers,
+	const NetworkDataSink &sink, bool follow_redirect = true);
+// sends all the requests on one keep-alive connection without waiting for each response (HTTP/1.1 pipelining) and returns the results in order
+// meant for consecutive range requests to the same URL : redirects are not followed, and a request the server didn't answer is marked as failed
+// on_response is called with the index and the result as soon as each response is complete, returning false gives up on the rest
+// only the sslc framework pipelines, with the other ones the requests are simply performed one by one
+std::vector<NetworkResult> Access_http_get_pipelined(NetworkSessionList &session_list, const std::string &url,
+	const std::vector<std::map<std::string, std::string> > &request_headers_list, const std::function<bool (size_t, NetworkResult &)> &on_response = nullptr);
 NetworkResult Access_http_post(NetworkSessionList &session_list, const std::string &url, const std::map<std::string, std::string> &request_headers,
 	const std::string &body);
+// same as Access_http_post() except that the response body is passed to the sink (see Access_http_get_streaming())
+NetworkResult Access_http_post_streaming(NetworkSessionList &session_list, const std::string &url, const std::map<std::string, std::string> &request_headers,
+	const std::string &body, const NetworkDataSink &sink);
+// opens a connection to the host of `url` (DNS lookup and TLS handshake) and leaves it idle, so that the next request to the host starts right away
+// does nothing if an idle connection to the host already exists (sslc) or with httpc, which never reuses connections
+// with libcurl, a one byte range request to `url` is made because that's the only way a connection ends up in the shared cache
+void Access_prewarm_connection(NetworkSessionList &session_list, const std::string &url);
+// closes the idle sslc sessions, and makes the next request of each curl handle open a new connection (see network_lifecycle.hpp)
+void network_close_idle_connections();
 
 std::string url_get_host_name(const std::string &url);
 
+// used by network_async.cpp, which drives its own curl handles
+// applies the options every curl handle of the app uses, including the shared connection/DNS/TLS session caches
+// the header callback stores the (lowercased) headers into the std::map<std::string, std::string> set with CURLOPT_HEADERDATA
+void network_curl_setup_handle(CURL *curl);
+// fills the timing from curl's own measurements of the last transfer
+void network_curl_get_timing(CURL *curl, NetworkTiming &timing);
+std::map<std::string, std::string> network_get_default_request_headers();
+
 #define HTTP_STATUS_CODE_OK 200
 #define HTTP_STATUS_CODE_NO_CONTENT 204
 #define HTTP_STATUS_CODE_PARTIAL_CONTENT 206
@@ -0,0 +1,15 @@
+#pragma once
+#include <3ds.h>
+
+// follows the APT sleep and HOME menu events for the network code
+// the sockets don't survive them : on suspend, the idle connections are closed and the requesters are held back (see connectivity.hpp)
+// so that what fails meanwhile is retried instead of erroring out, and on resume the main hosts are connected again in the background
+
+// called from the main thread after aptInit()
+void network_lifecycle_init();
+void network_lifecycle_exit();
+
+// `handler` is run by an async task after each resume, e.g. to prewarm the hosts of the streams being played
+void network_lifecycle_add_resume_handler(void (*handler)());
+// incremented on each suspend, a connection opened before the last change must not be reused
+u32 network_lifecycle_get_generation();
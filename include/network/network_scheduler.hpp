@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <3ds.h>
+
+// coordinates the requests of the whole app over the single wifi link
+// every request has a traffic class, there's a cap on the requests in flight to one host, and while a stream being played is about to
+// run dry (see network_scheduler_set_starving()), the thumbnails and the speculative traffic hold back so that the bandwidth goes to it
+// the blocking requests (Access_http_*()) wait for their turn in network_io.cpp, network_async.cpp starts its pending requests when they are allowed to
+
+enum class NetworkTrafficClass {
+	PLAYBACK, // the streams of the video being played, never held back
+	INTERACTIVE, // what the user is waiting for : pages, api calls, comment continuations (the default)
+	VISIBLE_THUMBNAIL, // thumbnails of the items on the screen
+	PREFETCH, // anything speculative : off-screen thumbnails, the streams of the next video, offline downloads
+	NUM
+};
+
+#define NETWORK_SCHEDULER_MAX_PER_HOST 4 // PLAYBACK requests are counted but not capped
+#define NETWORK_SCHEDULER_STARVING_THUMBNAILS 1 // VISIBLE_THUMBNAIL requests in flight allowed while a stream is starving (PREFETCH : none)
+// a blocking request doesn't wait longer than this, so that a stream starving for a long time (slow link) only slows the rest down
+#define NETWORK_SCHEDULER_MAX_WAIT_MS 10000
+
+// sets the traffic class of the blocking requests the current thread makes until it goes out of scope
+class NetworkTrafficClassScope {
+	NetworkTrafficClass prev;
+public :
+	explicit NetworkTrafficClassScope (NetworkTrafficClass traffic_class);
+	NetworkTrafficClassScope (const NetworkTrafficClassScope &) = delete;
+	NetworkTrafficClassScope &operator = (const NetworkTrafficClassScope &) = delete;
+	~NetworkTrafficClassScope ();
+};
+NetworkTrafficClass network_scheduler_get_thread_class();
+
+// whether a request of `traffic_class` to `host` would be allowed to start right now
+bool network_scheduler_can_start(NetworkTrafficClass traffic_class, const std::string &host);
+// takes the slot if it's allowed, returns false otherwise without waiting
+bool network_scheduler_try_acquire(NetworkTrafficClass traffic_class, const std::string &host);
+// waits until it's allowed (at most NETWORK_SCHEDULER_MAX_WAIT_MS) and takes the slot
+void network_scheduler_acquire(NetworkTrafficClass traffic_class, const std::string &host);
+// must be called once for each acquired slot when the request is done
+void network_scheduler_release(NetworkTrafficClass traffic_class, const std::string &host);
+
+// reported by each playback downloader after every scan : `starving` if a stream has less than its safety margin downloaded ahead
+// lower classes are held back while any source is starving
+void network_scheduler_set_starving(const void *source, bool starving);
+bool network_scheduler_is_starving();
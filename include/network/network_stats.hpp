@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <3ds.h>
+
+// time spent in each phase of a request, in milliseconds (-1 : not measured by the framework in use)
+// dns/connect/tls are 0 when an already open connection is reused
+struct NetworkTiming {
+	double dns = -1;
+	double connect = -1; // TCP connect, excluding dns
+	double tls = -1; // TLS handshake
+	double first_byte = -1; // from the start of the request to the first byte of the response
+	double total = -1;
+	u64 bytes = 0; // received body size
+};
+
+struct NetworkHostStats {
+	std::string host;
+	int request_num = 0; // within the recent samples
+	double latency_p50 = 0; // time to first byte
+	double latency_p95 = 0;
+	double throughput = 0; // bytes per millisecond while transferring bodies
+	NetworkTiming last;
+};
+
+// the most recent NETWORK_STATS_SAMPLES requests are kept in a ring buffer
+#define NETWORK_STATS_SAMPLES 128
+
+void network_stats_record(const std::string &host, const NetworkTiming &timing);
+// the total of NetworkTiming::bytes of all the requests recorded since the app started (as received, before any decompression)
+u64 network_stats_get_session_bytes();
+// sorted by the number of recent requests
+std::vector<NetworkHostStats> network_stats_get();
@@ -0,0 +1,155 @@
+#pragma once
+#include <vector>
+#include <set>
+#include <string>
+#include "system/platform.hpp"
+#include "network/download_policy.hpp"
+#include "network/stream_source.hpp"
+#include "system/util/light_lock.hpp"
+#include "system/util/memory_pressure.hpp"
+
+struct NetworkSessionList;
+
+struct NetworkStream;
+// returns the index of the block to be evicted when the cache is full, called with downloaded_data_lock held
+// downloaded_blocks is guaranteed to be non-empty
+typedef u64 (*NetworkStreamEvictionPolicy)(const NetworkStream &stream);
+// evicts the first block if it's behind the read head, otherwise the last block
+u64 network_stream_eviction_policy_simple(const NetworkStream &stream);
+// keeps `back_buffer_size` bytes behind the read head and the areas around recent seek targets, and evicts the block farthest from them
+u64 network_stream_eviction_policy_seek_aware(const NetworkStream &stream);
+
+// side cache holding the first blocks of streams that are likely to be played next (filled by stream_prefetcher.cpp)
+// a NetworkStream constructed with exactly the same url takes over the blocks, so that playback can start without waiting for the network
+#define NETWORK_STREAM_PREFETCH_CACHE_MAX_SIZE ((u64) 3 * 1000 * 1000)
+// returns false if the block didn't fit in the budget
+bool network_stream_prefetch_cache_store(const std::string &url, u64 stream_len, u64 block, const u8 *data, size_t size);
+bool network_stream_prefetch_cache_has(const std::string &url, u64 block);
+void network_stream_prefetch_cache_clear();
+// the shed handler of the stream blocks : frees the pooled spare blocks, and the prefetch side cache under CRITICAL pressure
+void network_stream_shed_memory(MemoryPressure level);
+
+// one instance per one url (once constructed, the url only changes by redirects and by NetworkStreamDownloader::replace_expired_url())
+struct NetworkStream {
+	static constexpr u64 BLOCK_SIZE = DownloadPolicy::BLOCK_SIZE;
+	static constexpr u64 MAX_CACHE_BLOCKS = 12 * 1000 * 1000 / BLOCK_SIZE;
+	static constexpr u64 MIN_CACHE_BLOCKS = 2 * 1000 * 1000 / BLOCK_SIZE; // blocks are evicted down to this while the memory budget is exceeded
+	static constexpr u64 MAX_REQUEST_BLOCKS = DownloadPolicy::MAX_REQUEST_BLOCKS;
+	static constexpr u64 DEFAULT_BACK_BUFFER_SIZE = 3 * 1000 * 1000;
+	static constexpr double DEFAULT_SAFE_MARGIN_SECONDS = 8;
+	static constexpr size_t MAX_RECENT_SEEK_TARGETS = 4;
+	
+	u64 block_num = 0;
+	std::string url;
+	LightMutex downloaded_data_lock; // the block table needs locking when searching and inserting at the same time
+	// downloaded_data[i] : BLOCK_SIZE bytes buffer holding the i-th block taken from the block pool, or NULL if not downloaded
+	std::vector<u8 *> downloaded_data;
+	std::set<u64> downloaded_blocks; // indices of non-NULL entries of downloaded_data, used to decide which block to evict
+	// bit i is set while downloaded_data[i] is non-NULL, readable without downloaded_data_lock
+	// when it has to grow, a larger copy replaces it and the old one is kept until the destruction, so a lock-free reader never sees a freed array
+	std::vector<u32> * volatile present_bits = NULL;
+	std::vector<std::vector<u32> *> present_bits_generations;
+	// the whole response body of a whole_download stream, which downloaded_data points into instead of to pool blocks
+	std::vector<u8> whole_data;
+	LightEventFlag data_arrival_event{RESET_ONESHOT}; // signaled when a block is stored or the state (ready, error) of the stream changes
+	Handle downloader_wakeup_event = 0; // set by NetworkStreamDownloader::add_stream()
+	bool whole_download = false;
+	NetworkSessionList *session_list = NULL;
+	StreamSource *source = NULL; // owned, if not NULL the blocks are read from it instead of being downloaded from `url`
+	std::string disk_cache_key; // if not empty, downloaded blocks are also stored in and loaded from the disk cache (see stream_disk_cache.hpp)
+	u64 max_forward_read_blocks = 0; // if not 0, the prefetch window is fixed to this many blocks regardless of the bitrate
+	
+	// anything above here is not supposed to be used from outside network_downloader.cpp and network_downloader.hpp
+	u64 len = 0;
+	volatile bool ready = false;
+	volatile bool suspend_request = false;
+	volatile bool quit_request = false;
+	volatile bool error = false;
+	volatile u64 read_head = 0;
+	const char * volatile network_waiting_status = NULL;
+	bool disable_interrupt = false;
+	// used for livestreams
+	int seq_head = -1;
+	int seq_id = -1;
+	bool livestream_eof = false;
+	bool livestream_private = false;
+	// blocks currently being downloaded by one of the downloader workers, protected by NetworkStreamDownloader::streams_lock
+	std::set<u64> blocks_in_flight;
+	// a range request that failed mid-way doesn't kill the stream : the completed blocks are kept and the rest is requested again after a backoff
+	// protected by NetworkStreamDownloader::streams_lock
+	std::string origin_url; // the url given to the constructor, requested again after a failure in case the redirected location went stale
+	int transient_failure_num = 0; // consecutive failed requests, the stream errors out when it exceeds NetworkStreamDownloader::MAX_TRANSIENT_RETRIES
+	u64 retry_time = 0; // osGetTime() before which no new request is made for this stream
+	volatile bool url_expired = false; // the server refused a range request, nothing is downloaded until the url is replaced
+	// adaptive request size (see download_policy.hpp), min_request_block_num is set before add_stream()
+	// protected by NetworkStreamDownloader::streams_lock
+	DownloadRequestSizing sizing;
+	volatile double bitrate = 0; // bytes per second of playback, set by the decoder once the container is opened (0 if unknown)
+	// while less than this many seconds are downloaded ahead of the read head, the lower traffic classes are held back (see network_scheduler.hpp)
+	double safe_margin_seconds = DEFAULT_SAFE_MARGIN_SECONDS;
+	// eviction
+	NetworkStreamEvictionPolicy eviction_policy = network_stream_eviction_policy_seek_aware;
+	u64 back_buffer_size = DEFAULT_BACK_BUFFER_SIZE;
+	std::vector<u64> recent_seek_targets; // protected by downloaded_data_lock
+	volatile u64 cache_hit_num = 0; // number of reads that could be served from the cache right away
+	volatile u64 cache_miss_num = 0; // number of reads that had to wait for the network
+	// byte position that is about to be read (e.g. the keyframe a seek is heading to), downloaded before anything else, -1 if none
+	volatile s64 prefetch_target = -1;
+	// the data up to this byte position is known to be read through in one go (the moov box of a non-fragmented mp4)
+	// so a request starting from the read head before it covers all of it instead of DownloadPolicy::CATCH_UP_REQUEST_BLOCKS
+	volatile u64 bulk_read_end = 0;
+	
+	// if `whole_download` is true, it will not use Range request but download the whole content at once (used for livestreams)
+	NetworkStream (std::string url, bool whole_download, NetworkSessionList *session_list);
+	// a stream read from `source` (taken over), `url` only identifies it
+	NetworkStream (std::string url, StreamSource *source);
+	~NetworkStream ();
+	
+	double get_download_percentage();
+	std::vector<double> get_buffering_progress_bar(int res_len);
+	
+	// moves the blocks of the same url in the prefetch cache into this stream, called from the constructor
+	void adopt_prefetched_blocks();
+	
+	// check if the data of the current stream of range [start, start + size) is already downloaded and available
+	bool is_data_available(u64 start, u64 size);
+	
+	// copies the data of the stream of range [start, start + size) directly into `buf` without any intermediate allocation
+	// returns false if some part of the range is (no longer) available, in which case the content of `buf` is unspecified
+	bool get_data(u64 start, u64 size, u8 *buf);
+	
+	// blocks until new data arrives or the state of the stream changes, or `timeout_ns` passes
+	// spurious wakeups may happen, so the caller should check the condition again after this returns
+	void wait_for_data(s64 timeout_ns);
+	// wakes up the idle downloader threads, should be called when the read head moves to another block
+	void notify_downloader();
+	
+	// should be called when the read head jumps (e.g. seeking), the area around `pos` will be less likely to be evicted
+	void record_seek(u64 pos);
+	
+	// frees the blocks entirely before `pos`, used by sequential readers that never seek back
+	void discard_data_before(u64 pos);
+	
+	// read from a StreamSource without any network access : a url starting with '/' is a path on the SD card (e.g. a video saved for offline playback)
+	bool is_local_file() const { return source; }
+	
+	// downloaded_data_lock must be held when calling this
+	bool is_block_downloaded(u64 block) { return block < downloaded_data.size() && downloaded_data[block]; }
+	
+	// lock-free queries on present_bits : the answer may be outdated by the time it's used, so get_data() checks again under the lock
+	bool is_block_present(u64 block) const;
+	// the first block in [from, limit) that is not present, or `limit` if all of them are
+	u64 find_missing_block(u64 from, u64 limit) const;
+	// the number of present blocks in [from, to)
+	u64 count_present_blocks(u64 from, u64 to) const;
+	
+	// this function is supposed to be called from NetworkStreamDownloader::*
+	// `size` must be BLOCK_SIZE except for the last block of the stream
+	void set_data(u64 block, const u8 *data, size_t size);
+	// takes the content of `data` (left empty) as the whole stream without copying, `block_num` must be already set accordingly
+	void set_whole_data(std::vector<u8> &data);
+private :
+	// downloaded_data_lock must be held when calling these
+	void free_block(u64 block);
+	void set_block_present(u64 block, bool present);
+};
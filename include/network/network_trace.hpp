@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include "network/network_stats.hpp"
+#include "network/network_scheduler.hpp"
+
+// per-request timing and size records of a playback written to DEF_MAIN_DIR + "profile/net_*.csv", so that the link conditions of a session
+// can be replayed by tools/downloader_sim to compare downloader changes fairly (wifi conditions never repeat on the hardware)
+// the records are buffered in memory and written by the misc tasks thread, so recording never touches the SD card
+// nothing is recorded unless var_network_trace is set when the playback starts
+// every request of the app is recorded while running (Access_http_*() and network_async.cpp), the traffic class tells the streams apart
+
+// starts a new file named after the video id, a trace already running is stopped first
+void network_trace_start(const std::string &video_id);
+void network_trace_stop();
+// `start_time` : milliseconds of svcGetSystemTick() when the request was sent, `status_code` is -1 for a failed request
+// does nothing unless a trace is running
+void network_trace_record(const std::string &host, NetworkTrafficClass traffic_class, double start_time, int status_code, const NetworkTiming &timing);
+
+// called from the misc tasks thread (TASK_FLUSH_NETWORK_TRACE)
+void network_trace_flush();
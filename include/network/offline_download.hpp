@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <3ds.h>
+
+// videos saved for offline playback live in DEF_MAIN_DIR + "offline/" as <video id>.mp4
+// the list of saved videos is kept in DEF_MAIN_DIR + "offline_videos.json" so that they can be played without any network access
+struct OfflineVideo {
+	std::string id;
+	std::string title;
+	std::string author_name;
+	std::string length_text;
+	int duration_ms = 0;
+	int quality = 0; // the p value of the saved video stream (360, 480...)
+	u64 size = 0;
+};
+
+struct OfflineDownloadRequest {
+	OfflineVideo video;
+	std::string video_stream_url;
+	std::string audio_stream_url;
+};
+
+struct OfflineDownloadStatus {
+	std::string downloading_id; // empty if nothing is being downloaded
+	double progress = 0; // downloaded percentage of the current video
+	int queued_num = 0; // excluding the one being downloaded
+};
+
+// the streams are downloaded at full speed into temporary files, and then muxed into a single mp4 file without re-encoding
+void offline_download_enqueue(const OfflineDownloadRequest &request);
+bool offline_download_is_queued(const std::string &id); // true if it's being downloaded or waiting in the queue
+OfflineDownloadStatus offline_download_get_status();
+
+std::vector<OfflineVideo> offline_get_videos();
+bool offline_video_exists(const std::string &id);
+bool offline_get_video(const std::string &id, OfflineVideo *video);
+// returns the path of the mp4 file, which can be directly passed to NetworkMultipleDecoder::init() as a url
+std::string offline_get_video_path(const std::string &id);
+// deletes the file and the entry
+void offline_erase_video(const std::string &id);
+
+void offline_download_thread_func(void *arg);
+void offline_download_thread_exit_request();
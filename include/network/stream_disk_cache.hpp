@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include "system/platform.hpp"
+
+// second cache tier for NetworkStream living on the SD card (DEF_MAIN_DIR + "stream_cache/")
+// each block is stored as a separate file, and the least recently used ones are deleted once the total size exceeds STREAM_DISK_CACHE_MAX_SIZE
+#define STREAM_DISK_CACHE_MAX_SIZE ((u64) 64 * 1000 * 1000)
+
+// returns a key identifying the stream of `stream_url` of the video `video_id`, or an empty string if it can't be determined
+std::string stream_disk_cache_make_key(const std::string &video_id, const std::string &stream_url);
+
+// returns the total length of the stream recorded by stream_disk_cache_set_len(), or 0 if unknown
+u64 stream_disk_cache_get_len(const std::string &key);
+void stream_disk_cache_set_len(const std::string &key, u64 len);
+
+bool stream_disk_cache_has_block(const std::string &key, u64 block);
+// reads exactly `size` bytes of the block into `buf`, returns false if the block is not cached or reading failed
+bool stream_disk_cache_load(const std::string &key, u64 block, u8 *buf, u64 size);
+// does nothing if the block is already cached
+void stream_disk_cache_store(const std::string &key, u64 block, const u8 *data, u64 size);
+
+// writes the LRU index to the SD card, does nothing if it hasn't changed
+void stream_disk_cache_save_index();
@@ -0,0 +1,16 @@
+#pragma once
+#include <vector>
+#include <string>
+
+// warms the first STREAM_PREFETCHER_BLOCKS blocks of the streams of the video that is likely to be played next into the prefetch cache of network_downloader.hpp
+#define STREAM_PREFETCHER_BLOCKS 4
+
+// replaces the previous request, the urls already in the prefetch cache are skipped
+void stream_prefetcher_request(const std::vector<std::string> &urls);
+// stops the current request after the block being downloaded
+void stream_prefetcher_cancel();
+// opens a connection to each host of the urls ahead of the first request (see Access_prewarm_connection()), done before any prefetching
+void stream_prefetcher_prewarm(const std::vector<std::string> &urls);
+
+void stream_prefetcher_thread_func(void *arg);
+void stream_prefetcher_thread_exit_request();
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "system/platform.hpp"
+#include "types.hpp"
+
+// where the blocks of a NetworkStream come from when they are not downloaded over HTTP
+// the downloader workers read a source in runs of up to NetworkStream::MAX_REQUEST_BLOCKS blocks, a source never touches the network
+// a source is only used by one worker at a time (the blocks being read are reserved), so implementations don't need locking
+class StreamSource {
+public :
+	virtual ~StreamSource () {}
+	// called once before the first read, `len` receives the total length of the stream
+	virtual Result_with_string open(u64 *len) = 0;
+	// reads exactly `size` bytes from `offset` into `buf`
+	virtual Result_with_string read(u64 offset, u8 *buf, u32 size) = 0;
+	virtual std::string get_description() const = 0; // for logging
+};
+
+// a file on the SD card (e.g. a video saved for offline playback)
+class FileStreamSource : public StreamSource {
+	std::string dir_path;
+	std::string file_name;
+public :
+	FileStreamSource (const std::string &path);
+	Result_with_string open(u64 *len) override;
+	Result_with_string read(u64 offset, u8 *buf, u32 size) override;
+	std::string get_description() const override { return dir_path + file_name; }
+};
+
+// data already in memory, which is taken over without copying
+class MemoryStreamSource : public StreamSource {
+	std::vector<u8> data;
+public :
+	MemoryStreamSource (std::vector<u8> &&data) : data(std::move(data)) {}
+	Result_with_string open(u64 *len) override;
+	Result_with_string read(u64 offset, u8 *buf, u32 size) override;
+	std::string get_description() const override { return "memory (" + std::to_string(data.size()) + " bytes)"; }
+};
+
+// the source for `url` : a FileStreamSource for a path starting with '/', NULL for anything else (fetched by the downloader over HTTP)
+StreamSource *stream_source_create(const std::string &url);
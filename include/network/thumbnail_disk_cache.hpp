@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <3ds.h>
+
+// encoded thumbnails kept on the SD card (DEF_MAIN_DIR + "thumbnail_cache/") so that icons and thumbnails seen before don't need to be downloaded again after a restart
+// each thumbnail is stored as a file named after the hash of its url, and one index file (hash, size, last use) is loaded on the first access
+// the least recently used ones are deleted once the total size exceeds THUMBNAIL_DISK_CACHE_MAX_SIZE
+#define THUMBNAIL_DISK_CACHE_MAX_SIZE ((u64) 6 * 1000 * 1000)
+
+bool thumbnail_disk_cache_has(const std::string &url);
+// returns false if `url` is not cached or reading failed
+bool thumbnail_disk_cache_load(const std::string &url, std::vector<u8> &data);
+// does nothing if `url` is already cached
+void thumbnail_disk_cache_store(const std::string &url, const std::vector<u8> &data);
+
+// writes the index to the SD card, does nothing if it hasn't changed
+void thumbnail_disk_cache_save_index();
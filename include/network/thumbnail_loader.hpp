@@ -1,6 +1,8 @@
 #pragma once
 #include "types.hpp"
 #include "scene_switcher.hpp"
+#include "system/util/memory_pressure.hpp"
+#include <functional>
 
 enum class ThumbnailType {
 	DEFAULT,
@@ -10,7 +12,9 @@ enum class ThumbnailType {
 };
 
 // returns the 'handle' of the thumbnail
-int thumbnail_request(const std::string &url, SceneType scene_id, int priority, ThumbnailType type = ThumbnailType::DEFAULT);
+// `draw_size` : the width of the rectangle it's drawn in (in pixels), the smallest variant of video thumbnails and channel icons
+// that covers it is requested instead of `url` (the smallest one in the data saver mode), 0 to request `url` as it is
+int thumbnail_request(const std::string &url, SceneType scene_id, int priority, ThumbnailType type = ThumbnailType::DEFAULT, int draw_size = 0);
 void thumbnail_cancel_request(int handle);
 void thumbnail_cancel_requests(const std::vector<int> &handles);
 void thumbnail_set_priority(int handle, int priority);
@@ -22,8 +26,46 @@ bool thumbnail_is_available(const std::string &url);
 bool thumbnail_is_available(int handle);
 
 bool thumbnail_draw(int handle, int x_offset, int y_offset, int x_len, int y_len);
+// draws only the rectangle (src_x, src_y, src_w, src_h) of the image (in pixels of the original image), used for storyboard sprite sheets
+bool thumbnail_draw_part(int handle, int x_offset, int y_offset, int x_len, int y_len, int src_x, int src_y, int src_w, int src_h);
 
 
+// keeps the thumbnails of the items around the displayed ones of a list requested
+// the requested range leans towards the direction the list is scrolling, and the requests that go out of it are cancelled
+// not thread-safe : it should be used while holding whatever lock protects the list
+class ThumbnailListRequester {
+	int max_request_num;
+	int request_l = 0;
+	int request_r = 0;
+	float velocity = 0; // smoothed, in items per frame
+public :
+	ThumbnailListRequester (int max_request_num) : max_request_num(max_request_num) {}
+	
+	// takes effect on the next update(), which cancels the requests that no longer fit
+	void set_max_request_num(int num) { max_request_num = num; }
+	
+	// `displayed_l`, `displayed_r` : the range of the items currently displayed
+	// `scroll_velocity` : how many items per frame the list is scrolling down (negative when scrolling up)
+	// `handle_of(i)` : the handle of the thumbnail of the i-th item, which is overwritten with the result of `request(i)` or -1
+	// `request(i)` : requests the thumbnail of the i-th item and returns the handle
+	void update(int item_num, int displayed_l, int displayed_r, float scroll_velocity,
+		const std::function<int &(int)> &handle_of, const std::function<int (int)> &request);
+	// cancels the requests made through this
+	void cancel_all(const std::function<int &(int)> &handle_of);
+	// for when items have been inserted, removed or moved since the last update(), `handle_of(i)` being the handle of the item now at i
+	// the handles of the items that moved out of the requested range are cancelled, the ones that moved into it are requested by the next update()
+	void on_items_changed(int item_num, const std::function<int &(int)> &handle_of);
+	// forgets the requests without cancelling them, for when the caller has already cancelled them all
+	void reset() {
+		request_l = request_r = 0;
+		velocity = 0;
+	}
+};
+
+// shed handlers (see memory_pressure.hpp) : the encoded thumbnails that are not requested, and the textures of the scenes in the background
+// (reloaded when their scene is shown again : while the memory is running out, only the thumbnails of the active scene are loaded)
+void thumbnail_shed_cache(MemoryPressure level);
+void thumbnail_shed_textures(MemoryPressure level);
 
 void thumbnail_downloader_thread_func(void *arg);
 void thumbnail_downloader_thread_exit_request(void);
@@ -5,6 +5,8 @@
 bool video_is_playing(void);
 void video_draw_playing_bar();
 void video_update_playing_bar(Hid_info key, Intent *intent);
+// the small video in the top screen of the other scenes, to be called after Draw_screen_ready(0, ...)
+void video_draw_mini_player();
 
 void video_set_linear_filter_enabled(bool enabled);
 void video_set_show_debug_info(bool show);
@@ -16,6 +18,10 @@ bool VideoPlayer_query_running_flag(void);
 
 void VideoPlayer_resume(std::string arg);
 
+// to be called after VideoPlayer_init(), the following VideoPlayer_resume(session.url) continues the session from its position
+struct PlayerSession;
+void VideoPlayer_restore_session(const PlayerSession &session);
+
 void VideoPlayer_suspend(void);
 
 void VideoPlayer_init(void);
@@ -1,8 +1,25 @@
 #pragma once
 
-void add_cpu_limit(int limit);
+// the time limit of core 1 (APT_SetAppCpuTimeLimit) is decided by a governor from the requests below and the state of the video decoder
+// - SYSTEM_APPLET requests (e.g. the software keyboard) are always honored
+// - NETWORK_WAIT requests (the decoder waiting for the stream) are honored because nothing is being decoded meanwhile
+// - DEFAULT requests (parsing, background downloads...) are ignored while the decoder is falling behind
+//   in that case the most generous request is applied instead, so that the playback gets the whole share it asked for
+enum class CpuLimitReason {
+	DEFAULT,
+	NETWORK_WAIT,
+	SYSTEM_APPLET
+};
+
+void add_cpu_limit(int limit, CpuLimitReason reason = CpuLimitReason::DEFAULT);
 
 // there must have been corresponding adding
-void remove_cpu_limit(int limit);
+void remove_cpu_limit(int limit, CpuLimitReason reason = CpuLimitReason::DEFAULT);
+
+// called by the video decoder for every frame (all in milliseconds)
+// frame_time is the target interval, interval is the actual time elapsed from the previous frame
+void cpu_limit_report_video_frame(double decode_time, double interval, double frame_time);
+// true if the governor currently considers the decoder to be short of cpu time
+bool cpu_limit_decoder_is_demanding();
 
 int get_cpu_limit();
@@ -1,5 +1,6 @@
 #pragma once
 #include "types.hpp"
+#include "system/util/memory_stats.hpp"
 
 double Draw_query_frametime(void);
 
@@ -9,16 +10,23 @@ Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic
 
 Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic_width, int pic_height, int parse_start_width, int parse_start_height, int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format);
 
+// makes the image show the top-left pic_width x pic_height pixels of the texture, for when the texture data was written by other means
+void Draw_c2d_image_set_area(Image_data* c2d_image, int pic_width, int pic_height);
+
 void Draw_c2d_image_set_filter(Image_data* c2d_image, bool filter);
 
-Result_with_string Draw_c2d_image_init(Image_data* c2d_image,int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format);
+// the texture is accounted to `mem_tag` (memory_stats.hpp), Draw_c2d_image_free() must be given the same tag
+Result_with_string Draw_c2d_image_init(Image_data* c2d_image,int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format, MemoryTag mem_tag = MemoryTag::OTHER);
 
-void Draw_c2d_image_free(Image_data c2d_image);
+void Draw_c2d_image_free(Image_data c2d_image, MemoryTag mem_tag = MemoryTag::OTHER);
 
-void Draw(std::string text, float x, float y, float text_size_x, float text_size_y, int abgr8888);
+void Draw(const std::string &text, float x, float y, float text_size_x, float text_size_y, int abgr8888);
 
-float Draw_get_width(std::string text, float text_size_x, float text_size_y);
+float Draw_get_width(const std::string &text, float text_size_x, float text_size_y);
 float Draw_get_width_one(const std::string &character, float text_size_x);
+// Draw_get_width_one() for each of `chars` (from Exfont_text_decode()), served from a per-codepoint cache
+struct Exfont_char;
+void Draw_get_widths(const Exfont_char *chars, int num, float text_size_x, float *out_widths);
 float Draw_get_height(std::string text, float text_size_x, float text_size_y);
 
 void Draw_x_centered(std::string text, float x0, float x1, float y, float text_size_x, float text_size_y, int abgr8888);
@@ -30,6 +38,9 @@ Result_with_string Draw_load_texture(std::string file_name, int sheet_map_num, C
 
 void Draw_touch_pos(void);
 
+// whether the touch position drawn by the last Draw_touch_pos() differs from the current one
+bool Draw_is_touch_pos_outdated(void);
+
 void Draw_top_ui(void);
 
 void Draw_bot_ui(void);
@@ -56,6 +67,9 @@ void Draw_exit(void);
 
 void Draw_frame_ready(void);
 
+// waits for the next frame without drawing anything
+void Draw_skip_frame(void);
+
 void Draw_screen_ready(int screen_num, int abgr8888);
 
 void Draw_apply_draw(void);
@@ -0,0 +1,11 @@
+#pragma once
+#include "types.hpp"
+
+// ETC1 (4 bpp) encoder for the textures that don't need to be exact (thumbnails), sampled by the GPU as GPU_ETC1
+// tuned for speed rather than quality : the codeword table and the pixel indices are chosen with the clamping to 0 - 255 ignored
+
+#define ETC1_BLOCK_SIZE 8 // bytes per 4x4 block
+
+// `pixels` : 4x4 BGR565 pixels in row-major order
+// `out` : the block in the byte order of the GPU (the 64-bit word of the specification, little endian)
+void Draw_etc1_encode_block(const u16* pixels, u8* out);
@@ -14,6 +14,9 @@ bool Exfont_is_unloading_external_font(void);
 
 bool Exfont_is_loaded_system_font(int system_font_num);
 
+// changes whenever a font is loaded or unloaded, so that cached widths can be invalidated
+u32 Exfont_get_loaded_fonts_generation(void);
+
 bool Exfont_is_loading_system_font(void);
 
 bool Exfont_is_unloading_system_font(void);
@@ -30,12 +33,27 @@ void Exfont_request_load_system_font(void);
 
 void Exfont_request_unload_system_font(void);
 
+// a character of a text : its codepoint and its bytes in the text
+struct Exfont_char {
+	u32 code;
+	u32 offset;
+	u32 size;
+};
+
+// decodes the UTF-8 `text` into at most `max_chars` characters (stopping at a null character, invalid bytes are skipped) and returns the number of them
+int Exfont_text_decode(const char *text, size_t size, Exfont_char *out_chars, int max_chars);
+
+// reverses each run of right-to-left characters
+void Exfont_text_sort_chars(Exfont_char *chars, int num);
+
 void Exfont_text_sort(std::string *source_part_string, int characters);
 
+// the same as Exfont_text_decode() but every character is copied into a std::string
 void Exfont_text_parse(std::string sorce_string, std::string part_string[], int max_loop, int* out_element);
 
 void Exfont_draw_external_fonts(std::string string, float texture_x, float texture_y, float texture_size_x, float texture_size_y, int abgr8888, float* out_width, float* out_height);
 float Exfont_get_width_one(const std::string &character, float texture_size_x);
+float Exfont_get_width_code(u32 code, float texture_size_x);
 float Exfont_get_width(std::string in_string, float texture_size_x);
 
 Result_with_string Exfont_load_exfont(int exfont_num);
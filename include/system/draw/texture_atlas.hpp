@@ -0,0 +1,24 @@
+#pragma once
+#include "types.hpp"
+
+// small BGR565 images (thumbnails, icons) packed into shared 512x512 textures instead of one power of two texture each
+// each page is split into shelves of slots of the same size (rounded up to 8x8 tiles), which are freed one by one
+// drawing images from the same page one after another doesn't need a texture switch
+// the images can also be stored as ETC1 (4 bpp instead of 16), in pages of their own
+
+// whether an image of this size goes into the atlas
+bool Draw_atlas_fits(int pic_width, int pic_height);
+
+// `buf` : pic_width x pic_height BGR565 pixels in row-major order
+// `c2d_image` is set up to draw the image and must be freed with Draw_atlas_free() (not Draw_c2d_image_free())
+Result_with_string Draw_atlas_add(Image_data* c2d_image, u8* buf, int pic_width, int pic_height);
+
+// the image with its border encoded to ETC1 for Draw_atlas_add_etc1(), Draw_atlas_etc1_size() bytes allocated with malloc()
+// NULL if it doesn't fit in the atlas or out of memory, takes a while (meant to be run on a worker thread)
+u8* Draw_atlas_encode_etc1(u8* buf, int pic_width, int pic_height);
+u32 Draw_atlas_etc1_size(int pic_width, int pic_height);
+
+// `etc1_data` : from Draw_atlas_encode_etc1() for the same size, e.g. saved and loaded again
+Result_with_string Draw_atlas_add_etc1(Image_data* c2d_image, const u8* etc1_data, int pic_width, int pic_height);
+
+void Draw_atlas_free(Image_data c2d_image);
@@ -0,0 +1,29 @@
+#pragma once
+#include "types.hpp"
+
+// yuv420p frames drawn by the GPU : the planes are uploaded as L8 textures and the fragment combiner converts them to RGB while drawing
+// (BT.709 limited range, the same as what Y2R is configured for)
+
+struct Yuv_image_data {
+	C3D_Tex planes[3]; // Y, U, V (U and V are half the size of Y)
+	int width = 0; // the area drawn by Draw_yuv_texture()
+	int height = 0;
+	bool initialized = false;
+};
+
+Result_with_string Draw_yuv_image_init(Yuv_image_data* yuv_image, int tex_size_x, int tex_size_y);
+
+void Draw_yuv_image_free(Yuv_image_data* yuv_image);
+
+void Draw_yuv_image_set_filter(Yuv_image_data* yuv_image, bool filter);
+
+// width and height must be multiples of 16 and fit in the textures
+Result_with_string Draw_yuv_set_texture_data(Yuv_image_data* yuv_image, u8* yuv420p, int width, int height);
+
+// crops the drawn area to pic_width x pic_height (e.g. the frame without the padding of the decoder)
+void Draw_yuv_image_set_area(Yuv_image_data* yuv_image, int pic_width, int pic_height);
+
+// must be called between Draw_screen_ready() and Draw_apply_draw(), the citro2d state is restored afterwards
+void Draw_yuv_texture(Yuv_image_data* yuv_image, float x, float y, float x_size, float y_size);
+
+void Draw_yuv_exit(void);
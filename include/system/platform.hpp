@@ -0,0 +1,40 @@
+#pragma once
+// the few things the decoding path (network_decoder.cpp, network_stream.cpp, download_policy.cpp and the headers they include)
+// takes from the system directly, so that it also builds on a PC for tools/decoder_bench and tools/downloader_sim
+// _WIN32 selects the host side like in the youtube parser, the 3ds side is just libctru
+#ifdef _WIN32
+#	include <stddef.h>
+#	include <stdint.h>
+#	include <chrono>
+#	include <thread>
+	typedef uint8_t u8;
+	typedef uint16_t u16;
+	typedef uint32_t u32;
+	typedef uint64_t u64;
+	typedef int8_t s8;
+	typedef int16_t s16;
+	typedef int32_t s32;
+	typedef int64_t s64;
+	typedef s32 Result;
+	typedef u32 Handle; // never a valid one on the host
+	// same values as libctru's, for LightEventFlag
+	typedef enum {
+		RESET_ONESHOT = 0,
+		RESET_STICKY = 1,
+		RESET_PULSE = 2,
+	} ResetType;
+
+	// ticks of a monotonic clock, svcGetSystemTick() on the 3ds
+	inline u64 platform_get_tick() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static constexpr double PLATFORM_TICKS_PER_MSEC = 1000000.0;
+	inline void platform_sleep_ns(s64 ns) { std::this_thread::sleep_for(std::chrono::nanoseconds(ns)); }
+#else
+#	include <3ds.h>
+	inline u64 platform_get_tick() { return svcGetSystemTick(); }
+	static constexpr double PLATFORM_TICKS_PER_MSEC = CPU_TICKS_PER_MSEC;
+	inline void platform_sleep_ns(s64 ns) { svcSleepThread(ns); }
+#endif
+
+inline double platform_get_time_ms() { return platform_get_tick() / PLATFORM_TICKS_PER_MSEC; }
@@ -0,0 +1,42 @@
+#pragma once
+#include <3ds.h>
+
+// which core each thread of the app is created on
+// the mapping is looked up from a table per hardware model (Old/New 3DS) and placement profile (var_thread_placement)
+// so that different mappings can be compared without touching the code creating the threads
+
+enum class ThreadRole {
+	MENU_WORKER,
+	MENU_CHECK_CONNECTIVITY,
+	MENU_UPDATE,
+	MENU_SEND_APP_INFO,
+	THUMBNAIL_DOWNLOADER,
+	ASYNC_TASK, // the first async task worker
+	ASYNC_TASK_WORKER, // the other ones
+	MISC_TASKS,
+	OFFLINE_DOWNLOAD,
+	OFFLINE_STREAM_DOWNLOADER,
+	NETWORK_ASYNC,
+	VIDEO_DECODE,
+	VIDEO_CONVERT,
+	STREAM_DOWNLOADER,
+	LIVESTREAM_INITER,
+	STREAM_PREFETCHER,
+	AUDIO_DECODE, // only used on New 3DS, where the audio gets its own thread in the 480p mode
+	PAGE_PARSER, // the metadata half of a watch page, parsed alongside the streams (in the same thread if this is the core of the caller)
+	VIDEO_DEMUX, // reads the video packets ahead of the decoder, mostly waiting for the network
+	TELEMETRY, // only if enabled, see system/util/telemetry.hpp
+
+	NUM
+};
+
+#define THREAD_PLACEMENT_DEFAULT 0
+#define THREAD_PLACEMENT_DECODER_ISOLATED 1 // nothing else is put on the core the video decoder runs on
+#define THREAD_PLACEMENT_BACKGROUND_ON_SYS_CORE 2 // network and other background threads go to core 1, whose share is limited by APT_SetAppCpuTimeLimit()
+#define THREAD_PLACEMENT_NUM 3
+
+// according to var_thread_placement, which is only read once at startup
+int thread_placement_get_core(ThreadRole role);
+
+// same as threadCreate() except the core, falls back to core 0 if the thread couldn't be created on the specified one
+Thread thread_placement_create_thread(ThreadRole role, ThreadFunc entry_point, void *arg, size_t stack_size, int prio, bool detached);
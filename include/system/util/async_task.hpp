@@ -1,12 +1,43 @@
 #pragma once
 
+// tasks are run by a small pool of worker threads (ASYNC_TASK_WORKER_NUM) spread over the app cores
+// each worker has its own queue per priority, and an idle worker steals tasks from the others
+// two tasks with the same function never run at the same time, so a task function doesn't need to be reentrant
+// tasks queued with the same token are run one by one, in the order they are queued within the same priority
+// a PREFETCH task never takes the last idle worker, so INTERACTIVE work doesn't wait for speculative work to finish
+// a function registered with async_task_set_max_concurrency() is the exception to the two rules above
+
+#define ASYNC_TASK_WORKER_NUM 2
+
 using AsyncTaskFuncType = void (*) (void *);
 
+enum class AsyncTaskPriority {
+	INTERACTIVE, // the user is waiting for it (opening a page, loading more items...)
+	VISIBLE, // fills in what is shown, but wasn't explicitly asked for
+	PREFETCH // speculative
+};
+#define ASYNC_TASK_PRIORITY_NUM 3
+
+// 0 means no token
+using AsyncTaskToken = int;
+AsyncTaskToken async_task_create_token();
+
+// lets up to `max_running` tasks of `func` run at the same time (so it must be reentrant), they are not ordered within their token either :
+// neither waiting for the other tasks of the token nor waited for by them, the token is still used for the cancellation
+void async_task_set_max_concurrency(AsyncTaskFuncType func, int max_running);
+
 // remove all tasks where the specified function is to be run
 void remove_all_async_tasks_with_type(AsyncTaskFuncType func);
 
 // add a new task
-void queue_async_task(AsyncTaskFuncType func, void *arg);
+// if deadline_ms is not 0 and the task hasn't started within deadline_ms after being queued, it's dropped without being run
+void queue_async_task(AsyncTaskFuncType func, void *arg, AsyncTaskPriority priority = AsyncTaskPriority::VISIBLE, AsyncTaskToken token = 0,
+	int deadline_ms = 0);
+
+// remove all the queued tasks with the token, the running one (if any) is notified through async_task_cancel_requested()
+void async_task_cancel(AsyncTaskToken token);
+// called from inside a task : true if the token of the task has been cancelled since it started
+bool async_task_cancel_requested();
 
 // check if a task with the specified function is queued and/or running
 // 0 : not running
@@ -14,5 +45,15 @@ void queue_async_task(AsyncTaskFuncType func, void *arg);
 // 2 : running
 int is_async_task_running(AsyncTaskFuncType func);
 
+// how long the tasks waited in the queue before starting, for profiling
+struct AsyncTaskWaitStats {
+	int started_num = 0;
+	int expired_num = 0; // dropped because of the deadline
+	double wait_avg_ms = 0;
+	double wait_max_ms = 0;
+	double wait_last_ms = 0;
+};
+AsyncTaskWaitStats async_task_get_wait_stats(AsyncTaskPriority priority);
+
 void async_task_thread_exit_request();
-void async_task_thread_func(void *arg); // a thread running this function should be created 
+void async_task_thread_func(void *arg); // a thread running this function should be created, it starts the other workers by itself
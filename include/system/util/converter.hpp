@@ -18,4 +18,21 @@ Result_with_string Util_converter_bgr888_rotate_90_degree(u8* bgr888, u8** rotat
 
 Result_with_string Util_converter_bgr888_to_yuv420p(u8* bgr888, u8** yuv420p, int width, int height);
 
+// y2r must be initialized with Util_converter_y2r_init() (and not with y2rInit()) before using the Util_converter_y2r_* functions
+Result_with_string Util_converter_y2r_init(void);
+
+void Util_converter_y2r_exit(void);
+
+// whether y2r is initialized (the video player keeps it initialized while playing)
+bool Util_converter_y2r_is_initialized(void);
+
 Result_with_string Util_converter_y2r_yuv420p_to_bgr565(u8* yuv420p, u8** bgr565, int width, int height, bool texture_format);
+
+// converts straight into an RGB565 tiled texture of texture_width pixels wide (in linear memory), so that no copy is needed afterwards
+// width and height must be multiples of 8
+Result_with_string Util_converter_y2r_yuv420p_to_texture(u8* yuv420p, u8* texture, int width, int height, int texture_width);
+
+// the same as Util_converter_y2r_yuv420p_to_texture() but on the CPU (ARMv6 SIMD, see converter_armv6.s)
+// width and height must be multiples of 8 and yuv420p must be 4 byte aligned
+Result_with_string Util_converter_yuv420p_to_texture_armv6(u8* yuv420p, u8* texture, int width, int height, int texture_width);
+
@@ -1,4 +1,10 @@
 #pragma once
+#include <string>
+#include <vector>
+
+// the SD card archive is opened once and kept open, and the files read piece by piece (local streams, caches) stay open for a while
+// Util_file_save_to_file() with delete_old_file writes into a temporary file first and renames it,
+// so a crash while saving leaves either the old or the new file, never a truncated one
 
 Result_with_string Util_file_save_to_file(std::string file_name, std::string dir_path, u8* write_data, int size, bool delete_old_file);
 
@@ -15,3 +21,50 @@ Result_with_string Util_file_check_file_size(std::string file_name, std::string
 Result_with_string Util_file_check_file_exist(std::string file_name, std::string dir_path);
 
 Result_with_string Util_file_read_dir(std::string dir_path, int* num_of_detected, std::string file_and_dir_name[], int name_num_of_array, std::string type[], int type_num_of_array);
+
+struct FileDirEntry
+{
+	std::string name;
+	std::string type; // "hidden", "dir", "file", "read only" or "unknown"
+	u64 size = 0; // comes with the entry, no file has to be opened for it
+};
+#ifndef _WIN32 // the host builds of the tools only provide the plain file functions above
+// a directory read page by page, so that a directory of thousands of files can be shown (or given up on) before it has been read through
+#define FILE_DIR_READ_BATCH 32 // entries per FSDIR_Read()
+class DirectoryReader {
+	Handle handle = 0;
+	std::vector<FS_DirectoryEntry> batch;
+public :
+	DirectoryReader () = default;
+	DirectoryReader (const DirectoryReader &) = delete;
+	DirectoryReader &operator = (const DirectoryReader &) = delete;
+	~DirectoryReader () { close(); }
+	
+	Result_with_string open(const std::string &dir_path);
+	// appends up to `max_num` entries to `entries` and returns how many, 0 once the directory has been read through
+	int read(std::vector<FileDirEntry> &entries, int max_num = FILE_DIR_READ_BATCH);
+	void close();
+	bool is_open() const { return handle != 0; }
+};
+
+// a file on the SD card kept open while it's written piece by piece, the pieces are gathered into writes of FILE_WRITE_BUFFER_SIZE
+#define FILE_WRITE_BUFFER_SIZE (256 * 1024)
+class BufferedFileWriter {
+	Handle handle = 0;
+	u64 pos = 0;
+	std::vector<u8> buffer;
+	std::string path;
+public :
+	BufferedFileWriter () = default;
+	BufferedFileWriter (const BufferedFileWriter &) = delete;
+	BufferedFileWriter &operator = (const BufferedFileWriter &) = delete;
+	~BufferedFileWriter () { close(); }
+	
+	// `append` : write after what the file already has, otherwise it's emptied
+	Result_with_string open(const std::string &file_name, const std::string &dir_path, bool append);
+	Result_with_string write(const u8 *data, u32 size);
+	Result_with_string flush();
+	Result_with_string close();
+	bool is_open() const { return handle != 0; }
+};
+#endif
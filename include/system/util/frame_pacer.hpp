@@ -0,0 +1,21 @@
+#pragma once
+#include <3ds.h>
+
+// lets background work that shares a core with the UI thread run in the idle part of a frame
+// the main thread runs at the lowest priority of the app, so a background thread on its core that starts a long job
+// in the middle of a frame delays the frame until the job is done
+// the UI thread reports when it wakes up for a frame (after the VBlank) and when it's done with it (when it starts waiting again)
+
+void frame_pacer_init();
+
+// called by the UI thread (Draw_frame_ready() and Draw_skip_frame() do)
+void frame_pacer_frame_start();
+void frame_pacer_ui_done();
+
+// whether the UI thread is between frame_pacer_frame_start() and frame_pacer_ui_done()
+bool frame_pacer_is_ui_busy();
+// time (ms) until the next VBlank is expected
+double frame_pacer_get_remaining_time();
+// waits until the UI thread is done with its frame and at least `needed_ms` is left before the next VBlank, `timeout_ns` at most
+// returns false on timeout
+bool frame_pacer_wait_for_budget(double needed_ms, s64 timeout_ns);
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+
+// per-frame playback records written to DEF_MAIN_DIR + "profile/" as csv so that builds and settings can be compared offline
+// the records are buffered in memory and written by the misc tasks thread, so recording never touches the SD card
+// nothing is recorded unless var_video_frame_profiling is set when the playback starts
+
+struct FrameProfileRecord {
+	double pts = 0; // seconds
+	double decode_time = 0; // all the times are in milliseconds
+	double convert_time = 0;
+	double copy_time = 0;
+	double av_drift = 0; // video pts - audio position, positive if the video is ahead
+	double network_wait_time = 0; // the time the decoder waited for the stream since the previous frame
+	bool late = false; // shown later than one frame after its pts
+	bool skipped = false; // not drawn at all
+};
+
+// starts a new file named after the video id, a playback already being profiled is stopped first
+void frame_profiler_start(const std::string &video_id);
+void frame_profiler_stop();
+bool frame_profiler_is_running();
+void frame_profiler_record(const FrameProfileRecord &record);
+
+// called from the misc tasks thread (TASK_FLUSH_FRAME_PROFILE)
+void frame_profiler_flush();
@@ -8,4 +8,7 @@ void Util_hid_query_key_state(Hid_info* out_key_state);
 
 void Util_hid_key_flag_reset(void);
 
+// the velocity (pixels per ms, positive if moving down) of the current or last touch over its samples in the last `window_ms` ms before its latest one
+double Util_hid_get_touch_velocity_y(double window_ms);
+
 void Util_hid_scan_hid_thread(void* arg);
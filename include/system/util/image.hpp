@@ -1,3 +1,7 @@
 #pragma once
 
-u8 *Image_decode(u8 *input, size_t input_len, int* width, int* height);
+// returns *width x *height pixels in BGR565 format, should be freed
+// `max_width` : if not 0, the image is cropped to the center `max_width` pixels horizontally
+// `max_aspect` : if not 0, the image is cropped to the center `width * max_aspect` rows when it's taller than that
+// the cropping is done while converting, so it costs nothing
+u8 *Image_decode(u8 *input, size_t input_len, int* width, int* height, int max_width = 0, double max_aspect = 0);
@@ -0,0 +1,57 @@
+#pragma once
+#include <3ds.h>
+#include <string>
+
+// times the individual kernels over fixed inputs, so that an optimization of one of them can be checked on real hardware without playing anything
+// started from the stats tab of the settings and run on the misc tasks thread (TASK_KERNEL_BENCHMARK)
+// the inputs are in romfs:/benchmark/ : a 320x180 jpeg thumbnail, a watch page json, transform plans in the format of js_cache/ and video titles
+// (the 640x368 yuv420p frame is pseudo random data, generated the same way every time)
+// each kernel is run KERNEL_BENCHMARK_RUNS times after a warm-up run, and the min/median/max of svcGetSystemTick() per call are
+// shown in the stats tab and written to DEF_MAIN_DIR + "profile/kernels_*.csv"
+
+#define KERNEL_BENCHMARK_RUNS 15
+
+// X(id, name)
+#define KERNEL_BENCHMARK_LIST(X) \
+	X(Y2R_BGR565, "y2r yuv420p->bgr565") \
+	X(Y2R_TEXTURE, "y2r yuv420p->texture") \
+	X(C_BGR565, "C yuv420p->bgr565") \
+	X(ASM_BGR565, "asm yuv420p->bgr565") \
+	X(ASM_BGR888, "asm yuv420p->bgr888") \
+	X(ARMV6_TEXTURE, "armv6 yuv420p->texture") \
+	X(SET_TEXTURE_DATA, "Draw_set_texture_data") \
+	X(IMAGE_DECODE, "Image_decode jpeg") \
+	X(TRUNCATE_STR, "truncate_str") \
+	X(DRAW_GET_WIDTH, "Draw_get_width") \
+	X(JSON_PARSE, "json11 watch page") \
+	X(DEOBFUSCATE_SIGNATURE, "deobfuscate signature") \
+	X(MODIFY_NPARAM, "modify nparam")
+
+enum class BenchmarkKernel {
+#define KERNEL_BENCHMARK_ENUM(id, name) id,
+	KERNEL_BENCHMARK_LIST(KERNEL_BENCHMARK_ENUM)
+#undef KERNEL_BENCHMARK_ENUM
+	NUM
+};
+
+struct KernelBenchmarkResult {
+	enum class State {
+		NOT_RUN,
+		SKIPPED, // an input is missing or the kernel failed
+		DONE
+	};
+	State state = State::NOT_RUN;
+	u64 min_ticks = 0; // per call
+	u64 median_ticks = 0;
+	u64 max_ticks = 0;
+};
+
+void kernel_benchmark_request();
+bool kernel_benchmark_is_running();
+const char *kernel_benchmark_get_name(BenchmarkKernel kernel);
+KernelBenchmarkResult kernel_benchmark_get_result(BenchmarkKernel kernel);
+// e.g. "1234.5 / 1250.0 / 1302.8 us", "-" if not run yet
+std::string kernel_benchmark_format_result(BenchmarkKernel kernel);
+
+// called from the misc tasks thread
+void kernel_benchmark_run();
@@ -1,4 +1,9 @@
 #pragma once
+#include "system/util/memory_stats.hpp"
 
 void *linearAlloc_concurrent(size_t size);
 void linearFree_concurrent(void *ptr);
+// same as above and the block is accounted to `tag` in memory_stats.hpp
+// a block must be freed with the tag it was allocated with
+void *linearAlloc_concurrent(size_t size, MemoryTag tag);
+void linearFree_concurrent(void *ptr, MemoryTag tag);
@@ -0,0 +1,109 @@
+#pragma once
+#include "system/platform.hpp"
+
+#ifdef _WIN32 // host build of tools/decoder_bench : the same interface on top of the standard library
+#	include <mutex>
+#	include <condition_variable>
+class LightMutex {
+	std::recursive_mutex mutex;
+public :
+	LightMutex () = default;
+	LightMutex (const LightMutex &) = delete;
+	LightMutex &operator = (const LightMutex &) = delete;
+	
+	void lock() { mutex.lock(); }
+	bool try_lock() { return mutex.try_lock(); }
+	void unlock() { mutex.unlock(); }
+};
+
+class LightEventFlag {
+	std::mutex mutex;
+	std::condition_variable cond;
+	ResetType reset_type;
+	bool signaled = false;
+public :
+	explicit LightEventFlag (ResetType reset_type) : reset_type(reset_type) {}
+	LightEventFlag (const LightEventFlag &) = delete;
+	LightEventFlag &operator = (const LightEventFlag &) = delete;
+	
+	void signal() {
+		std::lock_guard<std::mutex> guard(mutex);
+		signaled = true;
+		if (reset_type == RESET_ONESHOT) cond.notify_one();
+		else cond.notify_all();
+	}
+	void clear() {
+		std::lock_guard<std::mutex> guard(mutex);
+		signaled = false;
+	}
+	void wait() {
+		std::unique_lock<std::mutex> guard(mutex);
+		cond.wait(guard, [this] () { return signaled; });
+		if (reset_type == RESET_ONESHOT) signaled = false;
+	}
+	// returns false on timeout
+	bool wait(s64 timeout_ns) {
+		std::unique_lock<std::mutex> guard(mutex);
+		if (!cond.wait_for(guard, std::chrono::nanoseconds(timeout_ns), [this] () { return signaled; })) return false;
+		if (reset_type == RESET_ONESHOT) signaled = false;
+		return true;
+	}
+};
+#else
+
+// a mutex on top of libctru's RecursiveLock : unlike svc mutexes, an uncontended acquire and release don't enter the kernel
+// recursive like the svc mutexes it replaces, so a thread may acquire it again while holding it
+// zero-initialized state is valid (initialized on the first use), so it can be a static used from any initialization order
+class LightMutex {
+	RecursiveLock lock_ = {};
+	int state = 0; // 0 : not initialized, 1 : being initialized, 2 : ready
+	
+	void init_if_needed() {
+		if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) == 2) return;
+		int expected = 0;
+		if (__atomic_compare_exchange_n(&state, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			RecursiveLock_Init(&lock_);
+			__atomic_store_n(&state, 2, __ATOMIC_RELEASE);
+		} else while (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != 2) svcSleepThread(100000);
+	}
+public :
+	LightMutex () = default;
+	LightMutex (const LightMutex &) = delete;
+	LightMutex &operator = (const LightMutex &) = delete;
+	
+	void lock() {
+		init_if_needed();
+		RecursiveLock_Lock(&lock_);
+	}
+	bool try_lock() {
+		init_if_needed();
+		return RecursiveLock_TryLock(&lock_) == 0;
+	}
+	void unlock() { RecursiveLock_Unlock(&lock_); }
+};
+
+// an event on top of libctru's LightEvent : signaling it while nobody waits and waiting on it while it's signaled don't enter the kernel
+class LightEventFlag {
+	LightEvent event;
+public :
+	explicit LightEventFlag (ResetType reset_type) { LightEvent_Init(&event, reset_type); }
+	LightEventFlag (const LightEventFlag &) = delete;
+	LightEventFlag &operator = (const LightEventFlag &) = delete;
+	
+	void signal() { LightEvent_Signal(&event); }
+	void clear() { LightEvent_Clear(&event); }
+	void wait() { LightEvent_Wait(&event); }
+	// returns false on timeout
+	bool wait(s64 timeout_ns) { return LightEvent_WaitTimeout(&event, timeout_ns) == 0; }
+};
+#endif
+
+// holds the mutex for its scope
+class LightMutexGuard {
+	LightMutex &mutex;
+public :
+	explicit LightMutexGuard (LightMutex &mutex) : mutex(mutex) { mutex.lock(); }
+	LightMutexGuard (const LightMutexGuard &) = delete;
+	LightMutexGuard &operator = (const LightMutexGuard &) = delete;
+	~LightMutexGuard () { mutex.unlock(); }
+};
@@ -1,18 +1,36 @@
 ﻿#pragma once
 
+// leveled logging : the arguments of a level above LOG_LEVEL are never evaluated, so the strings are only built for lines that are kept
+// (the call still has to compile, so disabled lines don't rot like commented-out ones do)
+// build with e.g. `make LOG_LEVEL=3` to compile the traces in
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_DEBUG 2
+#define LOG_LEVEL_TRACE 3
+#ifndef LOG_LEVEL
+#	define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define Util_log_at_level(level, ...) do { if (LOG_LEVEL >= (level)) Util_log_save(__VA_ARGS__); } while (0)
+#define Util_log_error(...) Util_log_at_level(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define Util_log_info(...) Util_log_at_level(LOG_LEVEL_INFO, __VA_ARGS__)
+#define Util_log_debug(...) Util_log_at_level(LOG_LEVEL_DEBUG, __VA_ARGS__)
+// traces come from per-read/per-block paths and would flush everything else out of the ring, so even when compiled in they're only recorded while the log is shown
+#define Util_log_trace(...) do { if (LOG_LEVEL >= LOG_LEVEL_TRACE && Util_log_query_log_show_flag()) Util_log_save(__VA_ARGS__); } while (0)
+
 void Util_log_init(void);
 
 bool Util_log_query_log_show_flag(void);
 
 void Util_log_set_log_show_flag(bool flag);
 
-int Util_log_save(std::string type, std::string text);
+int Util_log_save(const std::string &type, const std::string &text);
 
-int Util_log_save(std::string type, std::string text, int result);
+int Util_log_save(const std::string &type, const std::string &text, int result);
 
-void Util_log_add(int add_log_num, std::string add_text);
+void Util_log_add(int add_log_num, const std::string &add_text);
 
-void Util_log_add(int add_log_num, std::string add_text, int result);
+void Util_log_add(int add_log_num, const std::string &add_text, int result);
 
 void Util_log_main(Hid_info key);
 
@@ -0,0 +1,27 @@
+#pragma once
+#include "system/platform.hpp"
+#include "system/util/memory_pressure.hpp"
+
+// one memory budget shared by the large caches of the app
+// each cache reports what it holds and, while the total is over the budget, evicts its own entries down to the minimum it needs to work
+// so a cache that grows doesn't have to know about the others
+
+enum class MemoryBudgetUser {
+	STREAM_BLOCKS, // the blocks of NetworkStream and the prefetch side cache (including the data of livestream fragments)
+	LIVESTREAM_FRAGMENTS, // the demuxer side of the cached livestream fragments : AVIO buffers and the codec state they own
+	THUMBNAIL_CACHE, // encoded thumbnails kept by thumbnail_loader.cpp
+	PAGE_RESULTS, // parsed pages kept by the scenes (system/util/result_cache.hpp), roughly estimated
+	NUM,
+};
+
+// `bytes` : negative to release
+void memory_budget_add(MemoryBudgetUser user, s64 bytes);
+u64 memory_budget_get_usage(MemoryBudgetUser user);
+u64 memory_budget_get_total_usage();
+// lowered while the memory is running out
+u64 memory_budget_get_limit();
+// whether the total would be over the budget after allocating `extra` more bytes
+bool memory_budget_is_over(u64 extra = 0);
+// the shed handler of the budget : halves it under MODERATE pressure and takes it to 0 under CRITICAL,
+// so that every cache evicts down to its minimum the next time it checks
+void memory_budget_shed(MemoryPressure level);
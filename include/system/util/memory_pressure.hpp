@@ -0,0 +1,30 @@
+#pragma once
+#include "system/platform.hpp"
+
+// tells the caches when the heap or the linear memory is running out, so that they give back what they can before allocations start failing
+// the level is read from the free memory every second (memory_pressure_check()), and raised at once by whoever sees an allocation fail
+// the shed handlers are run on an async task, never on the thread that reported, so a handler can take whatever lock it needs
+
+enum class MemoryPressure {
+	NONE, // back to normal, a handler that lowered a limit restores it
+	MODERATE, // drop what's not in use, the handlers are run in order until the level is back to NONE
+	CRITICAL, // keep only what is needed right now, every handler is run
+};
+
+// the order the handlers are run in : the cheapest to get back first
+enum class MemoryShedPriority {
+	STREAM_SPARE_BLOCKS, // the pooled stream blocks nothing uses, and the prefetch side cache under CRITICAL pressure
+	THUMBNAIL_CACHE, // encoded thumbnails that are not on the screen, reloaded from the disk cache or the network
+	PAGE_RESULTS, // cached pages of the scenes, parsed again when they're shown
+	THUMBNAIL_TEXTURES, // decoded thumbnails of the scenes in the background
+	MEMORY_BUDGET, // the budget of the stream blocks and livestream fragments
+};
+
+using MemoryShedHandler = void (*) (MemoryPressure level);
+void memory_pressure_add_handler(MemoryShedHandler handler, MemoryShedPriority priority);
+
+// an allocation failed : `level` is usually CRITICAL
+void memory_pressure_report(MemoryPressure level);
+// reads the free memory and runs the handlers if needed, called periodically by the menu worker thread
+void memory_pressure_check();
+MemoryPressure memory_pressure_get_level();
@@ -0,0 +1,34 @@
+#pragma once
+#include "system/platform.hpp"
+
+// where the heap and the linear memory go, per subsystem, with the high-water mark of each since the last reset
+// only what the app allocates itself is tagged : the allocations made inside FFmpeg, citro2d or libctru end up in the untagged rest
+// (memory_stats_get_untagged_heap()) so the tags always add up to at most the real usage
+
+enum class MemoryTag {
+	THUMBNAILS, // thumbnail textures and texture atlas pages, and the encoded thumbnails cached by thumbnail_loader.cpp
+	VIDEO_TEXTURES, // the textures the video frames are converted into (RGB565 tiles or YUV planes)
+	STREAM_BLOCKS, // the blocks of NetworkStream, the prefetch side cache and the cached livestream fragments
+	DECODER, // buffers handed to the hardware decoder/converter and the audio arena of network_decoder.cpp
+	PAGE_RESULTS, // parsed pages kept by the scenes (system/util/result_cache.hpp), roughly estimated
+	TEXT, // glyph buffers of the text layout cache in draw.cpp
+	OTHER,
+	NUM,
+};
+
+struct MemoryTagUsage {
+	u64 heap = 0;
+	u64 heap_peak = 0;
+	u64 linear = 0;
+	u64 linear_peak = 0;
+};
+
+// `bytes` : negative to release
+void memory_stats_add_heap(MemoryTag tag, s64 bytes);
+void memory_stats_add_linear(MemoryTag tag, s64 bytes);
+MemoryTagUsage memory_stats_get(MemoryTag tag);
+// the part of the heap in use that no tag accounts for (FFmpeg, the parser's temporaries, the scenes...)
+u64 memory_stats_get_untagged_heap();
+// high-water marks restart from the current usage (done at the start of each benchmark scenario)
+void memory_stats_reset_peaks();
+const char *memory_stats_get_tag_name(MemoryTag tag);
@@ -0,0 +1,48 @@
+#pragma once
+#include "system/platform.hpp"
+#include <string>
+
+// always-on counters and gauges, cheap enough to be updated from any thread on hot paths (a single atomic operation)
+// counters only go up from the startup, gauges are set to the current value of something
+// shown in the stats tab of the settings and written to the log by metrics_dump_to_log()
+
+// X(id, is_gauge, name)
+#define METRICS_LIST(X) \
+	X(STREAM_BYTES, false, "stream bytes") \
+	X(THUMBNAIL_BYTES, false, "thumbnail bytes") \
+	X(PAGE_BYTES, false, "page/api bytes") \
+	X(HTTP_REQUESTS, false, "http requests") \
+	X(HTTP_FAILURES, false, "http failures") \
+	X(HTTP_RETRIES, false, "http retries") \
+	X(THUMBNAIL_CACHE_HITS, false, "thumbnail cache hits") \
+	X(THUMBNAIL_CACHE_MISSES, false, "thumbnail cache misses") \
+	X(BLOCK_CACHE_HITS, false, "stream block hits") \
+	X(BLOCK_CACHE_MISSES, false, "stream block misses") \
+	X(JS_CACHE_HITS, false, "js_cache hits") \
+	X(JS_CACHE_MISSES, false, "js_cache misses") \
+	X(PAGE_CACHE_HITS, false, "page cache hits") \
+	X(PAGE_CACHE_MISSES, false, "page cache misses") \
+	X(NEED_REINIT_EVENTS, false, "need_reinit events") \
+	X(DECODER_REINITS, false, "decoder reinits") \
+	X(FRAMES_DROPPED, false, "frames dropped") \
+	X(ASYNC_TASKS_PENDING, true, "async tasks pending") \
+	X(THUMBNAIL_CACHE_ENTRIES, true, "thumbnail cache entries")
+
+enum class Metric {
+#define METRICS_ENUM(id, is_gauge, name) id,
+	METRICS_LIST(METRICS_ENUM)
+#undef METRICS_ENUM
+	NUM
+};
+
+extern s64 metrics_values[(int) Metric::NUM];
+
+inline void metrics_add(Metric metric, s64 delta = 1) { __atomic_fetch_add(&metrics_values[(int) metric], delta, __ATOMIC_RELAXED); }
+inline void metrics_set(Metric metric, s64 value) { __atomic_store_n(&metrics_values[(int) metric], value, __ATOMIC_RELAXED); }
+inline s64 metrics_get(Metric metric) { return __atomic_load_n(&metrics_values[(int) metric], __ATOMIC_RELAXED); }
+
+const char *metrics_get_name(Metric metric);
+bool metrics_is_gauge(Metric metric);
+// e.g. "12.3 MB" for the byte counters
+std::string metrics_format_value(Metric metric);
+void metrics_dump_to_log();
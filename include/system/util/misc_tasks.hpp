@@ -5,6 +5,13 @@
 #define TASK_RELOAD_STRING_RESOURCE 2
 #define TASK_SAVE_HISTORY 3
 #define TASK_SAVE_SUBSCRIPTION 4
+#define TASK_FLUSH_FRAME_PROFILE 5
+#define TASK_KERNEL_BENCHMARK 6
+#define TASK_SAVE_SUBSCRIPTION_FEED 7
+#define TASK_DUMP_TRACE 8
+#define TASK_SAVE_BENCHMARK_REPORT 9
+#define TASK_SAVE_PLAYER_SESSION 10
+#define TASK_FLUSH_NETWORK_TRACE 11
 
 void misc_tasks_request(int type);
 void misc_tasks_thread_func(void *);
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// scripted playback benchmark, started by L + R + START in the video player
+// each scenario plays a video at a fixed quality for a fixed time with seeks spread evenly over it,
+// and the summary of all the scenarios is written to DEF_MAIN_DIR + "profile/benchmark_*.csv" to compare releases, models and network frameworks
+// the scenarios are read from DEF_MAIN_DIR + "benchmark.txt" if it exists, one per line :
+//   <url> <quality> <seconds to play> [<seek position in seconds> ...]
+// lines starting with '#' are ignored, the built-in list is used otherwise
+
+struct PlaybackBenchmarkScenario {
+	std::string url;
+	int quality = 360;
+	double play_seconds = 30;
+	std::vector<double> seek_positions;
+};
+
+bool playback_benchmark_start(); // false if there's no scenario
+void playback_benchmark_stop(); // aborts, the scenarios done so far are still reported
+bool playback_benchmark_is_running();
+// NULL when not running
+const PlaybackBenchmarkScenario *playback_benchmark_current();
+// e.g. "benchmark 2/4 : 360p", to be shown while running
+std::string playback_benchmark_get_status();
+
+// events of the current scenario, called by the video player
+void playback_benchmark_on_scenario_started(); // right after the video was requested
+void playback_benchmark_on_page_loaded();
+void playback_benchmark_on_seek_requested();
+void playback_benchmark_on_frame(bool dropped, bool late, double decode_time, double convert_time); // from the convert thread
+void playback_benchmark_sample_memory();
+
+bool playback_benchmark_is_page_loaded();
+bool playback_benchmark_is_seek_pending();
+double playback_benchmark_time_since_start(); // seconds since on_scenario_started()
+double playback_benchmark_time_since_first_frame(); // seconds, -1 before the first frame
+double playback_benchmark_time_since_seek(); // seconds since the pending seek was requested
+
+// moves on to the next scenario, `error` is empty if it completed normally
+// the report is written (TASK_SAVE_BENCHMARK_REPORT) after the last one
+void playback_benchmark_finish_scenario(const std::string &error);
+
+// called from the misc tasks thread
+void playback_benchmark_save_report();
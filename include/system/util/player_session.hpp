@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include "youtube_parser/parser.hpp"
+
+// the video being played, saved every now and then so that the next launch (even after a crash) continues it where it was left
+// the page is saved too, without the suggestions, comments and captions, so that the playback can start before the page is parsed again
+struct PlayerSession {
+	std::string url;
+	double position = 0; // seconds
+	int video_p_value = 360;
+	bool audio_only_mode = false;
+	bool auto_quality_mode = false;
+	YouTubeVideoDetail video_info; // not playable if the stream urls have expired
+};
+
+// only what's needed to start the playback and to show the general tab of `video_info` is kept, written by the misc tasks thread
+void player_session_update(const std::string &url, double position, int video_p_value, bool audio_only_mode, bool auto_quality_mode,
+	const YouTubeVideoDetail &video_info);
+// nothing to continue (the playback ended)
+void player_session_clear();
+void save_player_session();
+// false if there's no session
+bool load_player_session(PlayerSession &session);
@@ -0,0 +1,126 @@
+#pragma once
+#include <3ds.h>
+#include <list>
+#include <memory>
+#include <string>
+#include "system/util/memory_budget.hpp"
+#include "system/util/memory_pressure.hpp"
+#include "system/util/metrics.hpp"
+
+extern std::string var_lang_content;
+
+// parsed pages (search results, channels, video pages) kept so that going back to one shows it at once
+// keyed by the url and the content language, as the same url gives another page after the language is changed
+// an entry is FRESH for `fresh_ms` after it's stored, then STALE until `max_age_ms` : it can still be shown right away, but should be reloaded meanwhile
+// (a page that is useless once it gets old, like a video page whose stream urls expire, should just have fresh_ms == max_age_ms)
+// what the entries take according to `estimate_size` is counted in the memory budget, and the least recently used ones are dropped while it's over
+// the entries are shared snapshots : get() returning a std::shared_ptr is a pointer copy (the page can then be copied outside of the user's lock),
+// and modify() changes an entry in place only if nobody else holds it, it's copied first otherwise
+// not thread-safe, each user guards it with its own lock
+template<typename T> class ResultCache {
+public:
+	enum class State {
+		MISSING,
+		FRESH,
+		STALE,
+	};
+	using EstimateSizeFuncType = size_t (*) (const T &);
+private:
+	struct Entry {
+		std::string key;
+		std::shared_ptr<T> value;
+		u64 stored_time;
+		size_t size;
+	};
+	int fresh_ms;
+	int max_age_ms;
+	size_t max_num;
+	EstimateSizeFuncType estimate_size;
+	std::list<Entry> entries; // most recently used first
+	
+	static std::string get_key(const std::string &url) { return var_lang_content + " " + url; }
+	typename std::list<Entry>::iterator find(const std::string &url) {
+		std::string key = get_key(url);
+		auto itr = entries.begin();
+		while (itr != entries.end() && itr->key != key) itr++;
+		if (itr != entries.end() && osGetTime() - itr->stored_time >= (u64) max_age_ms) {
+			drop(itr);
+			return entries.end();
+		}
+		return itr;
+	}
+	void drop(typename std::list<Entry>::iterator itr) {
+		memory_budget_add(MemoryBudgetUser::PAGE_RESULTS, -(s64) itr->size);
+		entries.erase(itr);
+	}
+	void store(const std::string &url, const std::shared_ptr<T> &value, u64 stored_time) {
+		size_t size = estimate_size(*value);
+		while (entries.size() && (entries.size() >= max_num || memory_budget_is_over(size))) drop(--entries.end());
+		entries.push_front({get_key(url), value, stored_time, size});
+		memory_budget_add(MemoryBudgetUser::PAGE_RESULTS, size);
+	}
+public:
+	ResultCache (int fresh_ms, int max_age_ms, size_t max_num, EstimateSizeFuncType estimate_size) :
+		fresh_ms(fresh_ms), max_age_ms(max_age_ms), max_num(max_num), estimate_size(estimate_size) {}
+	~ResultCache () { clear(); }
+	
+	State peek(const std::string &url) {
+		auto itr = find(url);
+		if (itr == entries.end()) return State::MISSING;
+		return osGetTime() - itr->stored_time < (u64) fresh_ms ? State::FRESH : State::STALE;
+	}
+	// `res` is left as it is if MISSING
+	State get(const std::string &url, std::shared_ptr<const T> &res) {
+		State state = peek(url);
+		metrics_add(state == State::MISSING ? Metric::PAGE_CACHE_MISSES : Metric::PAGE_CACHE_HITS);
+		if (state != State::MISSING) {
+			entries.splice(entries.begin(), entries, find(url));
+			res = entries.front().value;
+		}
+		return state;
+	}
+	State get(const std::string &url, T &res) {
+		std::shared_ptr<const T> snapshot;
+		State state = get(url, snapshot);
+		if (snapshot) res = *snapshot;
+		return state;
+	}
+	// a newly loaded page
+	void put(const std::string &url, std::shared_ptr<T> value) {
+		erase(url);
+		store(url, value, osGetTime());
+	}
+	void put(const std::string &url, const T &value) { put(url, std::make_shared<T>(value)); }
+	// more of a page that has been put (e.g. loading more items), which doesn't make it any fresher
+	void update(const std::string &url, std::shared_ptr<T> value) {
+		auto itr = find(url);
+		if (itr == entries.end()) return put(url, value);
+		u64 stored_time = itr->stored_time;
+		drop(itr);
+		store(url, value, stored_time);
+	}
+	void update(const std::string &url, const T &value) { update(url, std::make_shared<T>(value)); }
+	// the same for a change made in place by `func(T &)`, nothing is done if the page isn't cached
+	template<typename Func> void modify(const std::string &url, Func func) {
+		auto itr = find(url);
+		if (itr == entries.end()) return;
+		if (itr->value.use_count() > 1) itr->value = std::make_shared<T>(*itr->value);
+		func(*itr->value);
+		size_t size = estimate_size(*itr->value);
+		memory_budget_add(MemoryBudgetUser::PAGE_RESULTS, (s64) size - (s64) itr->size);
+		itr->size = size;
+	}
+	void erase(const std::string &url) {
+		auto itr = find(url);
+		if (itr != entries.end()) drop(itr);
+	}
+	void clear() {
+		while (entries.size()) drop(entries.begin());
+	}
+	// for the shed handler of the user : only the most recently used entry is kept under MODERATE pressure, nothing under CRITICAL
+	void shed(MemoryPressure level) {
+		if (level == MemoryPressure::NONE) return;
+		size_t keep_num = level == MemoryPressure::MODERATE ? 1 : 0;
+		while (entries.size() > keep_num) drop(--entries.end());
+	}
+};
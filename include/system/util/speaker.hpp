@@ -3,10 +3,28 @@
 
 void Util_speaker_init(int play_ch, int music_ch, int sample_rate);
 
-Result_with_string Util_speaker_add_buffer(int play_ch, int music_ch, u8* buffer, int size, double pts);
-
+// called with the buffer (and the argument given with it) once ndsp doesn't need it anymore
+typedef void (*Util_speaker_release_func)(u8 *buffer, void *arg);
+
+// the buffer is not copied : it must be in linear memory and stay valid until `release` is called (from a later Util_speaker_* call)
+// size is (the number of samples per channel) * 2
+// fails (the queue is full) while the queued buffers already last for the target latency, see Util_speaker_set_target_latency()
+Result_with_string Util_speaker_add_buffer(int play_ch, u8* buffer, int size, double pts, Util_speaker_release_func release, void *release_arg);
+
+// the media time being played (-1 if nothing is), cheap and never going backwards until the buffers are cleared
+// updated from the ndsp callback every ndsp frame and interpolated with the system tick in between
+double Util_speaker_clock_now(int play_ch);
+// same as Util_speaker_clock_now(), `sample_rate` is the one given to Util_speaker_init()
 double Util_speaker_get_current_timestamp(int play_ch, int sample_rate);
 
+// plays faster (and higher) than `sample_rate` by `speed`, the timestamps stay in the media time
+// Util_speaker_init() resets it
+void Util_speaker_set_speed(int play_ch, int sample_rate, double speed);
+
+// how far ahead of the playback the buffers are queued (200 ms unless set), it grows by itself each time the queue runs dry
+// until Util_speaker_init() resets it to this value
+void Util_speaker_set_target_latency(int play_ch, double latency_s);
+
 void Util_speaker_clear_buffer(int play_ch);
 
 void Util_speaker_pause(int play_ch);
@@ -1,7 +1,47 @@
 #pragma once
 
-#define LOCALIZED(id) get_string_resource(#id)
+// every id in romfs/gfx/msg/string_resources_*.txt, resolved into an index at compile time (an unknown id doesn't compile)
+// the ids are only ever pasted (SR_##id), so the ones that are also macro names (THREAD_PLACEMENT_DEFAULT etc.) are not expanded
+#define STRING_RESOURCE_IDS(X) \
+	X(TEST) X(ON) X(OFF) X(AUTO_QUALITY) \
+	X(ENABLED) X(DISABLED) X(CANCEL) X(OK) \
+	X(URL) X(SETTINGS) X(WATCH_HISTORY) X(REMOVE_HISTORY_ITEM) \
+	X(REMOVE_ALL_HISTORY) X(REMOVE_ALL_HISTORY_CONFIRM) X(ALL_HISTORY_REMOVED) X(SECONDS) \
+	X(LANG_EN) X(LANG_JA) X(GENERAL) X(SUGGESTIONS) \
+	X(COMMENTS) X(CAPTIONS) X(PLAYBACK) X(PLAYLIST) \
+	X(RELOAD) X(VIDEO) X(BUFFERING_PROGRESS) X(READING_STREAM) \
+	X(SEEKING) X(SEEK_REINITING) X(LOADING) X(EMPTY) \
+	X(COMMENTS_DISABLED) X(NO_COMMENTS) X(SHOW_MORE) X(SHOW_REPLIES) \
+	X(SHOW_MORE_REPLIES) X(FOLD_REPLIES) X(CAPTION_BASE_LANGUAGES) X(CAPTION_TRANSLATION) \
+	X(SELECT_LANGUAGE) X(NO_CAPTION) X(HW_DECODER) X(WAITING_STATUS) \
+	X(CPU_LIMIT) X(FORWARD_BUFFER) X(VIDEOS) X(INFO) \
+	X(CHANNEL_DESCRIPTION) X(YOUTUBE_LIKE) X(YOUTUBE_DISLIKE) X(SUBSCRIBE) \
+	X(SUBSCRIBED) X(UNSUBSCRIBE) X(SUBSCRIBED_CHANNELS) X(SUBSCRIPTION) \
+	X(NEW_VIDEOS) X(NO_VIDEOS) X(NO_RESULTS) X(SEARCH_HINT) \
+	X(GOTO_SEARCH) X(EXIT_APP) X(ABOUT) X(EXIT_CONFIRM) \
+	X(NOT_A_YOUTUBE_URL) X(MY_VIEW_COUNT_WITH_NUMBER) X(BY_LAST_WATCH_TIME) X(BY_MY_VIEW_COUNT) \
+	X(PLAYLIST_SHORT) X(SETTINGS_DISPLAY_UI) X(SETTINGS_DATA) X(SETTINGS_ADVANCED) \
+	X(UI_LANGUAGE) X(CONTENT_LANGUAGE) X(LCD_BRIGHTNESS) X(TIME_TO_TURN_OFF_LCD) \
+	X(NEVER_TURN_OFF) X(ECO_MODE) X(FULL_SCREEN_MODE) X(MINI_PLAYER) X(DARK_THEME) \
+	X(FLASH) X(LINEAR_FILTER) X(AUDIO_OUTPUT) X(AUDIO_OUTPUT_ORIGINAL) \
+	X(AUDIO_OUTPUT_32KHZ_MONO) X(AUDIO_ONLY_LOW_POWER) X(LIVESTREAM_LOW_LATENCY) X(NETWORK_FRAMEWORK) \
+	X(RESTART_TO_APPLY) X(VIDEO_FRAME_PROFILING) X(NETWORK_TRACE) X(SW_DECODER_THREADS) X(YUV_CONVERTER) \
+	X(KERNEL_BENCHMARK) X(THREADS) X(THREAD_PLACEMENT) X(THREAD_PLACEMENT_DEFAULT) \
+	X(THREAD_PLACEMENT_DECODER_ISOLATED) X(THREAD_PLACEMENT_BACKGROUND_ON_SYS_CORE) X(VIDEO_SHOW_DEBUG_INFO) X(STREAM_DISK_CACHE) \
+	X(SAVE_OFFLINE) X(SAVING_OFFLINE) X(OFFLINE_QUEUED) X(SAVED_OFFLINE) \
+	X(DATA_SAVER) X(DATA_USED_THIS_SESSION) X(SETTINGS_STATS) X(WRITE_STATS_TO_LOG) \
+	X(COMPRESSED_THUMBNAILS)
+
+enum class StringResourceId {
+#define STRING_RESOURCE_ENUM(id) SR_##id,
+	STRING_RESOURCE_IDS(STRING_RESOURCE_ENUM)
+#undef STRING_RESOURCE_ENUM
+	NUM
+};
+
+#define LOCALIZED(id) get_string_resource(StringResourceId::SR_##id)
 #define LOCALIZED_ENABLED_STATUS(cond) ((cond) ? LOCALIZED(ENABLED) : LOCALIZED(DISABLED))
 
-std::string get_string_resource(std::string id);
+// the reference stays valid until the language is switched twice
+const std::string &get_string_resource(StringResourceId id);
 Result_with_string load_string_resources(std::string lang);
@@ -1,6 +1,8 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <time.h>
+#include "youtube_parser/parser.hpp"
 
 struct SubscriptionChannel {
 	std::string id;
@@ -16,3 +18,18 @@ bool subscription_is_subscribed(const std::string &id);
 void subscription_subscribe(const SubscriptionChannel &channel);
 void subscription_unsubscribe(const std::string &id);
 std::vector<SubscriptionChannel> get_subscribed_channels();
+
+// the recent uploads of the subscribed channels, cached on the SD card so that the feed can be shown before it's refreshed
+struct SubscriptionFeedVideo {
+	std::string channel_id;
+	YouTubeVideoSuccinct video;
+	time_t publish_time; // estimated from the relative date text ("3 days ago") at the time it was fetched
+};
+void load_subscription_feed();
+void save_subscription_feed();
+// used as If-None-Match when the channel page is fetched next time
+std::string subscription_feed_get_etag(const std::string &channel_id);
+// merges the videos on the freshly fetched channel page into the cached feed of the channel
+void subscription_feed_merge(const std::string &channel_id, const std::string &etag, const std::vector<YouTubeVideoSuccinct> &videos, time_t fetch_time);
+// newest first, only of the channels currently subscribed
+std::vector<SubscriptionFeedVideo> subscription_feed_get();
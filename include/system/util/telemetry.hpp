@@ -0,0 +1,35 @@
+#pragma once
+
+// opt-in live metrics for soak tests : while var_telemetry_host (settings.txt only) is set, the latest values are sent
+// as a UDP datagram to var_telemetry_host:var_telemetry_port every TELEMETRY_INTERVAL_MS from a thread of its own
+// the datagram (little endian) :
+//   "YTM", version (u8), sequence number (u32), ms since the exporter started (u32), metric num (u16), reserved (u16),
+//   then a float per metric in the order of TelemetryMetric, -1 for an unknown value
+// the collector should read the metric num from the header, new metrics are only added at the end
+
+#define TELEMETRY_INTERVAL_MS 250
+#define TELEMETRY_VERSION 0
+
+enum class TelemetryMetric {
+	BUFFER_AHEAD, // seconds downloaded ahead of the playback
+	BANDWIDTH, // KB/s, the download throughput estimate
+	FRAMES, // frames decoded in the interval, including the dropped ones
+	DROPPED_FRAMES, // in the interval
+	DECODE_TIME, // ms, averaged over the frames of the interval
+	CONVERT_TIME, // ms, averaged over the frames shown in the interval
+	CPU_LIMIT, // %, of the system core given to the app
+	HEAP_USED, // KB
+	LINEAR_FREE, // KB
+
+	NUM
+};
+
+// should be called after load_settings() (and socInit()), nothing is started if no host is set
+void telemetry_init();
+void telemetry_exit();
+bool telemetry_is_enabled();
+
+// the metrics sampled by the player, the rest are sampled by the exporter itself
+void telemetry_set(TelemetryMetric metric, float value);
+// from the convert thread
+void telemetry_on_frame(bool dropped, double decode_time, double convert_time);
@@ -0,0 +1,27 @@
+#pragma once
+#include "system/platform.hpp"
+
+// timeline profiler : scoped zones recorded into per-thread rings and dumped as Chrome trace json (chrome://tracing, ui.perfetto.dev)
+// to DEF_MAIN_DIR + "profile/trace_*.json"
+// recording only happens between trace_start() and trace_stop(), which the video player calls along with the frame profiler (var_video_frame_profiling)
+// each ring keeps the last TRACE_RING_SIZE zones of its thread, so the dump shows the end of the capture
+
+// `name` must outlive the capture (pass a string literal), only the pointer is recorded
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_CONCAT_(a, b) a##b
+
+extern bool trace_capturing;
+
+void trace_start();
+void trace_stop(); // also requests the dump (TASK_DUMP_TRACE)
+void trace_record(const char *name, u64 start_tick, u64 end_tick);
+// called from the misc tasks thread
+void trace_dump();
+
+struct TraceZone {
+	const char *name;
+	u64 start_tick;
+	TraceZone (const char *name) : name(name), start_tick(trace_capturing ? platform_get_tick() : 0) {}
+	~TraceZone () { if (start_tick && trace_capturing) trace_record(name, start_tick, platform_get_tick()); }
+};
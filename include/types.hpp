@@ -1,6 +1,10 @@
 #pragma once
 #include <string>
-#include "citro2d.h"
+#ifdef _WIN32 // host builds of the tools, which only use Result_with_string
+#	include <sys/types.h>
+#else
+#	include "citro2d.h"
+#endif
 
 struct Result_with_string
 {
@@ -9,11 +13,13 @@ struct Result_with_string
 	uint code = 0;
 };
 
+#ifndef _WIN32
 struct Image_data
 {
 	C2D_Image c2d;
 	Tex3DS_SubTexture* subtex = NULL;
 };
+#endif
 
 struct Hid_info
 {
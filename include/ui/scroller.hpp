@@ -2,6 +2,7 @@
 #include <utility>
 #include <deque>
 #include "types.hpp"
+#include "ui/ui_common.hpp"
 
 class VerticalScroller {
 	// area of the scroller
@@ -18,8 +19,10 @@ class VerticalScroller {
 	int first_touch_x = -1;
 	int first_touch_y = -1;
 	int touch_frames = 0;
-	std::deque<int> touch_moves;
-	float inertia = 0;
+	u64 last_update_tick = 0;
+	float touch_velocity = 0; // px/ms, positive if the touch is moving down
+	float inertia = 0; // px/ms
+	float inertia_remainder = 0; // the part of the inertia movement below a pixel
 	float selected_darkness = 0;
 	bool grabbed = false;
 	bool scrolling = false;
@@ -46,6 +49,8 @@ public :
 	float selected_overlap_darkness() { return selected_darkness; }
 	bool is_selecting() { return grabbed && !scrolling; }
 	int get_offset() { return offset; }
+	// how many pixels per frame (at 60 fps) the content is moving up (negative when moving down), including the inertia
+	float get_scroll_velocity() { return (scrolling ? -touch_velocity : inertia) * SCROLL_FRAME_MS; }
 	void scroll(float amount) {
 		float scroll_max = std::max<float>(0, content_height - (y_r - y_l));
 		offset = std::max(0.0f, std::min<float>(scroll_max, offset + amount));
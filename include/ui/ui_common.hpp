@@ -14,6 +14,13 @@
 #define DPAD_SCROLL_SPEED1 9
 #define DPAD_SCROLL_SPEED1_THRESHOLD 120
 
+// the touch scroll works in time rather than frames so that it moves at the same speed while the frame rate drops
+#define SCROLL_FRAME_MS (1000.0 / 60) // the values below were tuned per frame at 60 fps
+#define SCROLL_MAX_STEP_MS 100 // longer gaps between updates (e.g. the scene was suspended) count as this
+#define SCROLL_VELOCITY_WINDOW_MS 50 // the inertia starts with the velocity of the touch over this period before releasing
+#define SCROLL_INERTIA_MIN_START (8 / SCROLL_FRAME_MS) // px/ms
+#define SCROLL_INERTIA_FRICTION (0.1 / (SCROLL_FRAME_MS * SCROLL_FRAME_MS)) // px/ms^2
+
 namespace UI {
 	template<class CallArg> struct FlexibleString {
 		enum class Type {
@@ -4,6 +4,7 @@
 #include <deque>
 #include <functional>
 #include "view.hpp"
+#include "ui/ui_common.hpp"
 
 class ScrollView : public FixedSizeView {
 protected :
@@ -16,8 +17,10 @@ protected :
 	double content_height = 0;
 	
 	int touch_frames = 0;
-	std::deque<int> touch_moves;
-	float inertia = 0;
+	u64 last_update_tick = 0;
+	float touch_velocity = 0; // px/ms, positive if the touch is moving down
+	float inertia = 0; // px/ms
+	float inertia_remainder = 0; // the part of the inertia movement below a pixel
 	float selected_darkness = 0;
 	bool grabbed = false;
 	bool scrolling = false;
@@ -88,7 +91,8 @@ public :
 		}
 		double y_offset = y0 - offset;
 		for (auto view : views) {
-			if (scrolling) view->on_scroll();
+			// the children out of the area can't be held
+			if (scrolling && y_offset < y1 && y_offset + view->get_height() > 0) view->on_scroll();
 			view->update(key, x0, y_offset);
 			y_offset += view->get_height() + margin;
 		}
@@ -105,6 +109,8 @@ public :
 	float selected_overlap_darkness() const { return selected_darkness; }
 	bool is_selecting() const { return grabbed && !scrolling; }
 	int get_offset() const { return offset; }
+	// how many pixels per frame (at 60 fps) the content is moving up (negative when moving down), including the inertia
+	float get_scroll_velocity() const { return (scrolling ? -touch_velocity : inertia) * SCROLL_FRAME_MS; }
 	void set_offset(double offset) { this->offset = offset; }
 	void scroll(float amount) {
 		float scroll_max = std::max<float>(0, content_height - (y1 - y0));
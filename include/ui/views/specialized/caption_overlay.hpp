@@ -2,7 +2,10 @@
 #include <functional>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <limits>
 #include "system/util/util.hpp"
+#include "system/draw/external_font.hpp"
 #include "youtube_parser/parser.hpp"
 #include "ui/ui_common.hpp"
 #include "../view.hpp"
@@ -13,12 +16,45 @@
 struct CaptionOverlayView : public FixedSizeView {
 private :
 	static constexpr int OVERLAY_SIDE_MARGIN = 3;
+	static constexpr int MAX_LINES_PER_PIECE = 10;
+	// the timeline : pieces sorted by start_time, their contents packed into one string
 	struct CaptionPiece {
 		float start_time;
 		float end_time;
-		std::vector<std::string> lines; // wrapped
+		u32 content_offset;
+		u32 content_size;
 	};
 	std::vector<CaptionPiece> caption_data;
+	std::vector<float> end_time_prefix_max; // end_time_prefix_max[i] = max(caption_data[0..i].end_time), monotonic so that it can be binary-searched
+	std::string contents;
+	// wrapping is done lazily and only the lines of the pieces currently shown are kept
+	mutable std::vector<std::pair<size_t, std::vector<std::string> > > wrapped_cache;
+	// what is shown, laid out once and drawn as it is while cur_timestamp stays in [shown_from, shown_until]
+	// (no piece starts or ends in between)
+	mutable std::vector<std::string> shown_lines;
+	mutable std::vector<float> shown_widths;
+	mutable float shown_from = 1;
+	mutable float shown_until = 0; // empty range : nothing laid out yet
+	mutable u32 shown_fonts_generation = 0;
+	
+	std::vector<std::string> wrap_piece(size_t index) const {
+		const auto &piece = caption_data[index];
+		auto begin = contents.begin() + piece.content_offset;
+		auto end = begin + piece.content_size;
+		
+		std::vector<std::string> cur_lines;
+		auto itr = begin;
+		while (itr != end) {
+			if (cur_lines.size() >= MAX_LINES_PER_PIECE) break;
+			auto next_itr = std::find(itr, end, '\n');
+			auto tmp = truncate_str(std::string(itr, next_itr), CAPTION_OVERLAY_MAX_WIDTH, MAX_LINES_PER_PIECE - cur_lines.size(), 0.5, 0.5);
+			cur_lines.insert(cur_lines.end(), tmp.begin(), tmp.end());
+			
+			if (next_itr != end) itr = std::next(next_itr);
+			else break;
+		}
+		return cur_lines;
+	}
 public :
 	using CallBackFuncType = std::function<void (const CaptionOverlayView &)>;
 	
@@ -31,58 +67,84 @@ public :
 	
 	CaptionOverlayView *set_caption_data(const std::vector<YouTubeVideoDetail::CaptionPiece> &caption_data) { // mandatory
 		this->caption_data.clear();
-		for (auto caption_piece : caption_data) {
+		this->end_time_prefix_max.clear();
+		this->contents.clear();
+		this->wrapped_cache.clear();
+		this->shown_from = 1;
+		this->shown_until = 0;
+		
+		size_t contents_size = 0;
+		for (const auto &caption_piece : caption_data) contents_size += caption_piece.content.size();
+		this->caption_data.reserve(caption_data.size());
+		this->contents.reserve(contents_size);
+		for (const auto &caption_piece : caption_data) {
 			auto &cur_content = caption_piece.content;
 			if (cur_content == "" || cur_content == "\n") continue;
 			
 			CaptionPiece cur_piece;
 			cur_piece.start_time = caption_piece.start_time;
 			cur_piece.end_time = caption_piece.end_time;
-			
-			std::vector<std::string> cur_lines;
-			auto itr = cur_content.begin();
-			while (itr != cur_content.end()) {
-				if (cur_lines.size() >= 10) break;
-				auto next_itr = std::find(itr, cur_content.end(), '\n');
-				auto tmp = truncate_str(std::string(itr, next_itr), CAPTION_OVERLAY_MAX_WIDTH, 10 - cur_lines.size(), 0.5, 0.5);
-				cur_lines.insert(cur_lines.end(), tmp.begin(), tmp.end());
-				
-				if (next_itr != cur_content.end()) itr = std::next(next_itr);
-				else break;
-			}
-			cur_piece.lines = cur_lines;
+			cur_piece.content_offset = this->contents.size();
+			cur_piece.content_size = cur_content.size();
+			this->contents += cur_content;
 			
 			this->caption_data.push_back(cur_piece);
 		}
+		// events are usually already in order, so this is almost free
+		std::stable_sort(this->caption_data.begin(), this->caption_data.end(),
+			[] (const CaptionPiece &a, const CaptionPiece &b) { return a.start_time < b.start_time; });
+		
+		this->end_time_prefix_max.reserve(this->caption_data.size());
+		for (const auto &piece : this->caption_data)
+			this->end_time_prefix_max.push_back(end_time_prefix_max.size() ? std::max(end_time_prefix_max.back(), piece.end_time) : piece.end_time);
 		return this;
 	}
 	
-	void draw_() const override {
-		int start_pos;
-		{
-			int l = -1;
-			int r = caption_data.size();
-			while (r - l > 1) {
-				int m = l + ((r - l) >> 1);
-				if (caption_data[m].end_time < cur_timestamp) l = m;
-				else r = m;
-			}
-			start_pos = r;
-		}
+	void layout_shown() const {
+		// the first piece that may still be shown
+		size_t start_pos = std::lower_bound(end_time_prefix_max.begin(), end_time_prefix_max.end(), cur_timestamp) - end_time_prefix_max.begin();
+		
+		shown_from = cur_timestamp;
+		shown_until = std::numeric_limits<float>::infinity();
+		std::vector<std::pair<size_t, std::vector<std::string> > > new_wrapped_cache;
 		std::vector<std::string> lines;
-		for (size_t i = start_pos; i < caption_data.size() && caption_data[i].start_time < cur_timestamp; i++) {
-			auto &cur_lines = caption_data[i].lines;
+		size_t i = start_pos;
+		for (; i < caption_data.size() && caption_data[i].start_time < cur_timestamp; i++) {
+			if (caption_data[i].end_time < cur_timestamp) continue; // an earlier piece that overlaps with a longer one
+			shown_until = std::min(shown_until, caption_data[i].end_time);
+			
+			std::vector<std::string> cur_lines;
+			bool found = false;
+			for (auto &cached : wrapped_cache) if (cached.first == i) {
+				cur_lines.swap(cached.second);
+				found = true;
+				break;
+			}
+			if (!found) cur_lines = wrap_piece(i);
 			lines.insert(lines.end(), cur_lines.begin(), cur_lines.end());
+			new_wrapped_cache.push_back({i, std::move(cur_lines)});
 		}
+		if (i < caption_data.size()) shown_until = std::min(shown_until, caption_data[i].start_time); // the next piece to start
+		wrapped_cache.swap(new_wrapped_cache);
 		while (lines.size() && lines.back() == "") lines.pop_back();
 		
-		float start_y = 240 - 10 - DEFAULT_FONT_INTERVAL * lines.size();
-		for (size_t i = 0; i < lines.size(); i++) {
-			float width = Draw_get_width(lines[i], 0.5, 0.5);
+		shown_widths.clear();
+		for (auto &line : lines) shown_widths.push_back(Draw_get_width(line, 0.5, 0.5));
+		shown_lines.swap(lines);
+		shown_fonts_generation = Exfont_get_loaded_fonts_generation();
+	}
+	
+	void draw_() const override {
+		if (cur_timestamp < shown_from || cur_timestamp > shown_until || shown_fonts_generation != Exfont_get_loaded_fonts_generation())
+			layout_shown();
+		
+		float start_y = 240 - 10 - DEFAULT_FONT_INTERVAL * shown_lines.size();
+		for (size_t i = 0; i < shown_lines.size(); i++) {
+			float width = shown_widths[i];
 			
 			Draw_texture(var_square_image[0], 0xBB000000, (400 - width) / 2 - OVERLAY_SIDE_MARGIN, start_y + i * DEFAULT_FONT_INTERVAL,
 				width + OVERLAY_SIDE_MARGIN * 2, DEFAULT_FONT_INTERVAL);
-			Draw(lines[i], (400 - width) / 2, start_y + i * DEFAULT_FONT_INTERVAL - 2, 0.5, 0.5, (u32) -1);
+			Draw(shown_lines[i], (400 - width) / 2, start_y + i * DEFAULT_FONT_INTERVAL - 2, 0.5, 0.5, (u32) -1);
 		}
 	}
 	void update_(Hid_info key) override {}
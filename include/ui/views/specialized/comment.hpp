@@ -6,6 +6,7 @@
 #include "ui/ui_common.hpp"
 #include "../view.hpp"
 #include "system/util/string_resource.hpp"
+#include "system/draw/external_font.hpp"
 
 #define COMMENT_ICON_SIZE 48
 #define REPLY_ICON_SIZE 32
@@ -13,7 +14,14 @@
 
 struct CommentView : public FixedWidthView {
 private :
-	std::vector<std::string> content_lines;
+	// wrapped content is only a cache of get_yt_comment_object().content : it can be dropped with unload_content() and is rebuilt on demand
+	mutable std::vector<std::string> content_lines;
+	mutable bool content_loaded = false;
+	mutable size_t content_line_num = 0;
+	// the wrapping depends on the fonts, so the lines are wrapped again once they change
+	mutable u32 content_fonts_generation = 0;
+	// get_height() is asked for every frame by the lists and the thumbnail loading, so it's kept until invalidate_height()
+	mutable float height_cache = -1;
 	bool icon_holding = false;
 	bool show_more_holding = false;
 	bool fold_replies_holding = false;
@@ -27,27 +35,30 @@ private :
 	float left_height() const { return get_icon_size() + SMALL_MARGIN; }
 	float right_height() const {
 		float res = DEFAULT_FONT_INTERVAL * (1 + lines_shown);
-		if (lines_shown < content_lines.size()) res += SMALL_MARGIN + DEFAULT_FONT_INTERVAL; // "Show more"
+		if (lines_shown < content_line_num) res += SMALL_MARGIN + DEFAULT_FONT_INTERVAL; // "Show more"
 		return res;
 	}
 public :
 	using GetYTCommentObjectFuncType = std::function<YouTubeVideoDetail::Comment &(const CommentView &)>;
 	using CallBackFuncType = std::function<void (const CommentView &)>;
 	using CallBackFuncTypeModifiable = std::function<void (CommentView &)>;
+	using WrapContentFuncType = std::function<std::vector<std::string> (const CommentView &)>;
 	
-	size_t lines_shown = 0; // 3 + 50n
+	mutable size_t lines_shown = 0; // 3 + 50n, call invalidate_height() after changing it or replies_shown
 	size_t replies_shown = 0;
 	bool is_reply = false;
 	volatile bool is_loading_replies = false;
 	
 	GetYTCommentObjectFuncType get_yt_comment_object_func;
 	YouTubeVideoDetail::Comment &get_yt_comment_object() const { return get_yt_comment_object_func(*this); }
+	WrapContentFuncType wrap_content_func;
 	CallBackFuncType on_author_icon_pressed_func;
 	CallBackFuncTypeModifiable on_load_more_replies_pressed_func;
 	
 	int author_icon_handle = -1;
 	
 	std::vector<CommentView *> replies;
+	CommentView *parent = NULL; // the comment this is a reply to, its height includes this one
 	
 	CommentView (double x0, double y0, double width) : View(x0, y0), FixedWidthView(x0, y0, width) {}
 	virtual ~CommentView () {}
@@ -59,6 +70,7 @@ public :
 		}
 		replies.clear();
 		replies_shown = 0;
+		invalidate_height();
 	}
 	void reset_holding_status_() override {
 		icon_holding = false;
@@ -67,14 +79,31 @@ public :
 		show_more_replies_holding = false;
 		for (auto reply_view : replies) reply_view->reset_holding_status();
 	}
+	void invalidate_height() const {
+		height_cache = -1;
+		if (parent) parent->invalidate_height();
+	}
+	void rewrap_if_fonts_changed() const {
+		if (content_fonts_generation == Exfont_get_loaded_fonts_generation() || !wrap_content_func) return;
+		content_fonts_generation = Exfont_get_loaded_fonts_generation();
+		content_lines = wrap_content_func(*this);
+		content_loaded = true;
+		content_line_num = content_lines.size();
+		lines_shown = std::min(std::max<size_t>(lines_shown, 3), content_line_num);
+		invalidate_height();
+	}
 	float get_height() const override {
+		rewrap_if_fonts_changed();
+		for (size_t i = 0; i < replies_shown; i++) replies[i]->rewrap_if_fonts_changed();
+		if (height_cache >= 0) return height_cache;
+		
 		float main_height = std::max(left_height(), right_height());
 		float reply_height = 0;
 		if (replies_shown) reply_height += SMALL_MARGIN + DEFAULT_FONT_INTERVAL + SMALL_MARGIN; // fold replies
 		for (size_t i = 0; i < replies_shown; i++) reply_height += replies[i]->get_height();
 		if (get_yt_comment_object().has_more_replies() || replies_shown < replies.size()) reply_height += SMALL_MARGIN + DEFAULT_FONT_INTERVAL; // load more replies
 		
-		return main_height + reply_height + SMALL_MARGIN; // add margin between comments
+		return height_cache = main_height + reply_height + SMALL_MARGIN; // add margin between comments
 	}
 	float get_self_height() { return std::max(left_height(), right_height()); }
 	void on_scroll() override {
@@ -98,9 +127,33 @@ public :
 	
 	CommentView *set_content_lines(const std::vector<std::string> &content_lines) { // mandatory
 		this->content_lines = content_lines;
+		this->content_loaded = true;
+		this->content_line_num = content_lines.size();
 		this->lines_shown = std::min<size_t>(3, content_lines.size());
+		this->content_fonts_generation = Exfont_get_loaded_fonts_generation();
+		invalidate_height();
+		return this;
+	}
+	CommentView *set_wrap_content(WrapContentFuncType wrap_content_func) { // needed for unload_content()
+		this->wrap_content_func = wrap_content_func;
 		return this;
 	}
+	bool is_content_loaded() const { return content_loaded; }
+	void load_content() const {
+		rewrap_if_fonts_changed();
+		if (content_loaded || !wrap_content_func) return;
+		content_lines = wrap_content_func(*this);
+		content_loaded = true;
+		content_lines.resize(content_line_num); // wrapping is deterministic, so this should be no-op
+	}
+	// frees the wrapped lines of this comment and its replies while keeping the layout (height) unchanged
+	void unload_content() {
+		if (content_loaded && wrap_content_func) {
+			std::vector<std::string>().swap(content_lines);
+			content_loaded = false;
+		}
+		for (auto reply_view : replies) reply_view->unload_content();
+	}
 	CommentView *set_get_yt_comment_object(GetYTCommentObjectFuncType get_yt_comment_object_func) { // mandatory
 		this->get_yt_comment_object_func = get_yt_comment_object_func;
 		return this;
@@ -115,6 +168,11 @@ public :
 	}
 	CommentView *set_is_reply(bool is_reply) {
 		this->is_reply = is_reply;
+		invalidate_height();
+		return this;
+	}
+	CommentView *set_parent(CommentView *parent) {
+		this->parent = parent;
 		return this;
 	}
 	
@@ -1,6 +1,7 @@
 #pragma once
 #include "view.hpp"
 #include <vector>
+#include <algorithm>
 
 struct VerticalListView : public FixedWidthView {
 public :
@@ -10,6 +11,64 @@ public :
 	std::vector<View *> views;
 	std::vector<int> draw_order;
 	double margin = 0.0;
+	// a virtualized list keeps the heights and offsets of its children and only touches the visible ones every frame
+	// the layout is rebuilt when the number of children changes, visible children (and a few others per frame) are re-measured,
+	// call invalidate_layout() after replacing children or changing their heights in other ways
+	bool is_virtualized = false;
+private :
+	static constexpr size_t LAYOUT_CHECK_PER_FRAME = 8; // number of children re-measured every frame apart from the visible ones
+	mutable std::vector<float> child_heights;
+	mutable std::vector<float> child_offsets; // child_offsets[i] : the top of views[i] relative to y0, child_offsets[views.size()] : the total height plus margin
+	mutable bool layout_valid = false;
+	mutable size_t layout_check_index = 0;
+	mutable std::pair<int, int> visible_range = {0, 0}; // [first, last) drawn or updated the last time
+	
+	void rebuild_offsets(size_t from) const {
+		child_offsets[0] = 0;
+		for (size_t i = from; i < views.size(); i++) child_offsets[i + 1] = child_offsets[i] + child_heights[i] + margin;
+	}
+	void ensure_layout() const {
+		if (layout_valid && child_heights.size() == views.size()) return;
+		child_heights.resize(views.size());
+		child_offsets.resize(views.size() + 1);
+		for (size_t i = 0; i < views.size(); i++) child_heights[i] = views[i]->get_height();
+		rebuild_offsets(0);
+		layout_valid = true;
+	}
+	// re-measures views[l, r) and fixes the offsets after them if any height has changed
+	void remeasure(size_t l, size_t r) const {
+		size_t changed = views.size();
+		for (size_t i = l; i < r; i++) {
+			float cur_height = views[i]->get_height();
+			if (cur_height != child_heights[i]) {
+				child_heights[i] = cur_height;
+				changed = std::min(changed, i);
+			}
+		}
+		if (changed < views.size()) rebuild_offsets(changed);
+	}
+	// [first, last) of the children that are on the screen when the list is at `y_top`
+	std::pair<int, int> get_visible_range(double y_top) const {
+		// the first child whose bottom (y_top + child_offsets[i + 1] - margin) is >= 0
+		int first = std::lower_bound(child_offsets.begin() + 1, child_offsets.end(), margin - y_top) - child_offsets.begin() - 1;
+		// the first child whose top is >= 240
+		int last = std::lower_bound(child_offsets.begin(), child_offsets.end() - 1, 240 - y_top) - child_offsets.begin();
+		return {first, std::max(first, last)};
+	}
+	std::pair<int, int> refresh_layout(double y_top) const {
+		ensure_layout();
+		if (views.size()) {
+			size_t check_num = std::min(LAYOUT_CHECK_PER_FRAME, views.size());
+			if (layout_check_index >= views.size()) layout_check_index = 0;
+			size_t check_end = std::min(views.size(), layout_check_index + check_num);
+			remeasure(layout_check_index, check_end);
+			layout_check_index = check_end;
+		}
+		auto range = get_visible_range(y_top);
+		remeasure(range.first, range.second);
+		return visible_range = get_visible_range(y_top);
+	}
+public :
 	
 	void reset_holding_status_() override {
 		for (auto view : views) view->reset_holding_status();
@@ -20,7 +79,9 @@ public :
 			delete view;
 		}
 		views.clear();
+		invalidate_layout();
 	}
+	void invalidate_layout() { layout_valid = false; }
 	
 	// direct access to `views` is also allowed
 	// this is just for method chaining mainly used immediately after the construction of the view
@@ -34,20 +95,38 @@ public :
 	}
 	VerticalListView *set_margin(double margin) {
 		this->margin = margin;
+		invalidate_layout();
+		return this;
+	}
+	VerticalListView *set_is_virtualized(bool is_virtualized) {
+		this->is_virtualized = is_virtualized;
+		invalidate_layout();
 		return this;
 	}
 	
 	float get_height() const override {
+		if (is_virtualized) {
+			ensure_layout();
+			return views.size() ? child_offsets.back() - margin : 0;
+		}
 		float res = 0;
 		for (auto view : views) res += view->get_height();
 		res += std::max((int) views.size() - 1, 0) * margin;
 		return res;
 	}
 	void on_scroll() override {
+		if (is_virtualized) {
+			// children that weren't on the screen aren't being held
+			for (int i = visible_range.first; i < std::min<int>(visible_range.second, views.size()); i++) views[i]->on_scroll();
+			return;
+		}
 		for (auto view : views) view->on_scroll();
 	}
 	void draw_() const override {
-		if (!draw_order.size()) {
+		if (is_virtualized && !draw_order.size()) {
+			auto range = refresh_layout(y0);
+			for (int i = range.first; i < range.second; i++) views[i]->draw(x0, y0 + child_offsets[i]);
+		} else if (!draw_order.size()) {
 			double y_offset = y0;
 			for (auto view : views) {
 				double y_bottom = y_offset + view->get_height();
@@ -61,6 +140,12 @@ public :
 		}
 	}
 	void update_(Hid_info key) override {
+		if (is_virtualized) {
+			auto range = refresh_layout(y0);
+			// a child's callback may change `views`
+			for (int i = range.first; i < range.second && i < (int) views.size(); i++) views[i]->update(key, x0, y0 + child_offsets[i]);
+			return;
+		}
 		double y_offset = y0;
 		for (auto view : views) {
 			double y_bottom = y_offset + view->get_height();
@@ -69,6 +154,12 @@ public :
 		}
 	}
 	std::pair<int, int> get_displayed_range(int offset) {
+		if (is_virtualized) {
+			ensure_layout();
+			auto range = get_visible_range(offset);
+			if (range.first >= range.second) return {0, -1};
+			return {range.first, range.second - 1};
+		}
 		int cur_y = offset;
 		int l = views.size(), r = 0;
 		for (int i = 0; i < (int) views.size(); i++) {
@@ -29,6 +29,10 @@ public :
 	
 	const static std::function<u32 (const View &)> STANDARD_BACKGROUND;
 	
+	// in eco mode the screens are redrawn only when something has changed
+	// views call this whenever their appearance changes outside of a touch press, move or release (which always trigger a redraw)
+	static void set_needs_redraw() { var_need_reflesh = true; }
+	
 	virtual View *set_on_view_released(std::function<void (View &view)> on_view_released) {
 		this->on_view_released = on_view_released;
 		return this;
@@ -42,6 +46,7 @@ public :
 		return this;
 	}
 	virtual View *set_is_visible(bool is_visible) {
+		if (this->is_visible != is_visible) set_needs_redraw();
 		this->is_visible = is_visible;
 		return this;
 	}
@@ -89,16 +94,23 @@ public :
 	virtual void update_(Hid_info key) = 0;
 	void update(Hid_info key) {
 		if (is_touchable) {
+			double prev_touch_darkness = touch_darkness;
 			bool inside_view = key.touch_x >= x0 && key.touch_x < x0 + get_width() &&
 				key.touch_y >= y0 && key.touch_y < y0 + get_height();
 			if (inside_view && (key.p_touch || view_holding_time)) {
 				view_holding_time++;
 				if (!scrolled) touch_darkness = std::min(1.0, touch_darkness + TOUCH_DARKNESS_SPEED);
 				else touch_darkness = std::max(0.0, touch_darkness - TOUCH_DARKNESS_SPEED);
-				for (auto on_long_hold : on_long_holds) if (on_long_hold.first == view_holding_time)
+				for (auto on_long_hold : on_long_holds) if (on_long_hold.first == view_holding_time) {
 					on_long_hold.second(*this);
+					set_needs_redraw();
+				}
 			} else touch_darkness = std::max(0.0, touch_darkness - TOUCH_DARKNESS_SPEED);
-			if (key.touch_x == -1 && view_holding_time && on_view_released) on_view_released(*this);
+			if (touch_darkness != prev_touch_darkness) set_needs_redraw();
+			if (key.touch_x == -1 && view_holding_time && on_view_released) {
+				on_view_released(*this);
+				set_needs_redraw();
+			}
 			if (!inside_view) view_holding_time = 0;
 			update_(key);
 		}
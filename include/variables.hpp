@@ -10,12 +10,30 @@ extern bool var_flash_mode;
 extern bool var_wifi_enabled;
 extern bool var_high_resolution_mode;
 extern bool var_history_enabled;
+extern bool var_stream_disk_cache_enabled;
 extern int var_network_framework;
 extern int var_network_framework_changed;
+extern int var_thread_placement;
+extern int var_thread_placement_changed;
 extern bool var_show_fps;
 extern bool var_full_screen_mode;
+extern bool var_video_mini_player; // the video keeps playing in a corner of the top screen of the other scenes
 extern bool var_video_show_debug_info;
+extern bool var_video_frame_profiling;
+extern bool var_network_trace; // per-request records of each playback for tools/downloader_sim (network_trace.hpp)
+extern int var_video_sw_decoder_threads;
+extern int var_video_yuv_converter; // 0 : Y2R, 1 : GPU (fragment combiner), 2 : CPU (ARMv6 SIMD), for software-decoded frames
 extern bool var_video_linear_filter;
+extern int var_audio_output_mode; // 0 : as decoded, 1 : 32 kHz, 2 : 32 kHz mono
+extern bool var_audio_only_low_power;
+extern bool var_livestream_low_latency; // the audio-only playback uses the smallest audio stream and turns the screens off sooner
+extern int var_paused_forward_buffer_seconds; // how far ahead the video is downloaded while paused, 0 for no limit
+extern bool var_data_saver; // low qualities and the smallest audio, small thumbnails, no speculative loading
+extern bool var_thumbnail_etc1; // the thumbnails in the texture atlas are compressed to ETC1, from the next loaded ones
+extern std::string var_telemetry_host; // see system/util/telemetry.hpp, empty for disabled
+extern int var_telemetry_port;
+extern bool var_low_power_playing; // set by the video player while playing in the low power audio-only mode
+extern bool var_screens_off; // turned off by the afk timer
 extern u8 var_wifi_state;
 extern u8 var_wifi_signal;
 extern u8 var_battery_charge;
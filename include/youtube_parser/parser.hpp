@@ -2,6 +2,10 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <utility>
 
 struct YouTubeChannelSuccinct {
 	std::string name;
@@ -26,25 +30,63 @@ struct YouTubePlaylistSuccinct {
 	std::string thumbnail_url;
 };
 
+// only the member for `type` is constructed, so a list of them doesn't carry two empty structs of strings per item
 struct YouTubeSuccinctItem {
-	// TODO : use union or std::variant
 	enum {
 		VIDEO,
 		CHANNEL,
 		PLAYLIST
 	} type;
-	YouTubeVideoSuccinct video;
-	YouTubeChannelSuccinct channel;
-	YouTubePlaylistSuccinct playlist;
+	union {
+		YouTubeVideoSuccinct video;
+		YouTubeChannelSuccinct channel;
+		YouTubePlaylistSuccinct playlist;
+	};
 	
-	YouTubeSuccinctItem () = default;
-	YouTubeSuccinctItem (YouTubeVideoSuccinct video) : type(VIDEO), video(video) {}
-	YouTubeSuccinctItem (YouTubeChannelSuccinct channel) : type(CHANNEL), channel(channel) {}
-	YouTubeSuccinctItem (YouTubePlaylistSuccinct playlist) : type(PLAYLIST), playlist(playlist) {}
+	YouTubeSuccinctItem () : type(VIDEO), video() {}
+	YouTubeSuccinctItem (YouTubeVideoSuccinct video) : type(VIDEO), video(std::move(video)) {}
+	YouTubeSuccinctItem (YouTubeChannelSuccinct channel) : type(CHANNEL), channel(std::move(channel)) {}
+	YouTubeSuccinctItem (YouTubePlaylistSuccinct playlist) : type(PLAYLIST), playlist(std::move(playlist)) {}
+	YouTubeSuccinctItem (const YouTubeSuccinctItem &other) : type(other.type) { construct_from(other); }
+	YouTubeSuccinctItem (YouTubeSuccinctItem &&other) : type(other.type) { construct_from(std::move(other)); }
+	YouTubeSuccinctItem &operator = (const YouTubeSuccinctItem &other) {
+		if (this != &other) {
+			destroy();
+			type = other.type;
+			construct_from(other);
+		}
+		return *this;
+	}
+	YouTubeSuccinctItem &operator = (YouTubeSuccinctItem &&other) {
+		if (this != &other) {
+			destroy();
+			type = other.type;
+			construct_from(std::move(other));
+		}
+		return *this;
+	}
+	~YouTubeSuccinctItem () { destroy(); }
 	
-	std::string get_url() const { return type == VIDEO ? video.url : type == CHANNEL ? channel.url : playlist.url; }
-	std::string get_thumbnail_url() const { return type == VIDEO ? video.thumbnail_url : type == CHANNEL ? channel.icon_url : playlist.thumbnail_url; }
-	std::string get_name() const { return type == VIDEO ? video.title : type == CHANNEL ? channel.name : playlist.title; }
+	const std::string &get_url() const { return type == VIDEO ? video.url : type == CHANNEL ? channel.url : playlist.url; }
+	const std::string &get_thumbnail_url() const { return type == VIDEO ? video.thumbnail_url : type == CHANNEL ? channel.icon_url : playlist.thumbnail_url; }
+	const std::string &get_name() const { return type == VIDEO ? video.title : type == CHANNEL ? channel.name : playlist.title; }
+private:
+	void destroy() {
+		if (type == VIDEO) video.~YouTubeVideoSuccinct();
+		else if (type == CHANNEL) channel.~YouTubeChannelSuccinct();
+		else playlist.~YouTubePlaylistSuccinct();
+	}
+	// `type` must already be set to other.type
+	void construct_from(const YouTubeSuccinctItem &other) {
+		if (type == VIDEO) new (&video) YouTubeVideoSuccinct(other.video);
+		else if (type == CHANNEL) new (&channel) YouTubeChannelSuccinct(other.channel);
+		else new (&playlist) YouTubePlaylistSuccinct(other.playlist);
+	}
+	void construct_from(YouTubeSuccinctItem &&other) {
+		if (type == VIDEO) new (&video) YouTubeVideoSuccinct(std::move(other.video));
+		else if (type == CHANNEL) new (&channel) YouTubeChannelSuccinct(std::move(other.channel));
+		else new (&playlist) YouTubePlaylistSuccinct(std::move(other.playlist));
+	}
 };
 
 
@@ -57,10 +99,20 @@ struct YouTubeSearchResult {
 	std::string continue_key;
 	
 	bool has_continue() const { return continue_token != "" && continue_key != ""; }
+	// appends what youtube_continue_search() returned (unless it failed)
+	void append(YouTubeSearchResult &&more) {
+		results.insert(results.end(), std::make_move_iterator(more.results.begin()), std::make_move_iterator(more.results.end()));
+		estimated_result_num = more.estimated_result_num;
+		continue_token = more.continue_token;
+	}
 };
 YouTubeSearchResult youtube_parse_search(std::string url);
-// takes the previous result, returns the new result with both old items and new items
+// takes the previous result, returns only the new items along with the updated continuation state, to be given to prev_result.append()
 YouTubeSearchResult youtube_continue_search(const YouTubeSearchResult &prev_result);
+// query autocompletion, split so that the caller can download it through network_async_get() and drop stale requests
+std::string youtube_get_search_suggestions_url(const std::string &query);
+// an empty vector if the response is invalid
+std::vector<std::string> youtube_parse_search_suggestions(const std::string &response);
 
 
 struct YouTubeVideoDetail {
@@ -70,7 +122,15 @@ struct YouTubeVideoDetail {
 	std::string description;
 	YouTubeChannelSuccinct author;
 	std::string audio_stream_url;
+	std::string smallest_audio_stream_url; // the one with the lowest bitrate, used by the low power audio-only playback
+	std::string cheapest_audio_stream_url; // the one with the codec cheapest to decode (AAC-LC if any), then the lowest bitrate
+	// the `codecs` of the mime types of the three above, e.g. "mp4a.40.2" for AAC-LC or "mp4a.40.5" for HE-AAC
+	std::string audio_stream_codec;
+	std::string smallest_audio_stream_codec;
+	std::string cheapest_audio_stream_codec;
 	std::map<int, std::string> video_stream_urls; // first : video size (144p, 240p, 360p ...)
+	std::map<int, int> video_stream_bitrates; // bits per second as advertised, 0 if not given
+	int audio_stream_bitrate = 0;
 	std::string both_stream_url;
 	int duration_ms;
 	bool is_livestream;
@@ -110,6 +170,19 @@ struct YouTubeVideoDetail {
 	using Caption = std::vector<CaptionPiece>;
 	std::map<std::pair<std::string, std::string>, Caption> caption_data;
 	
+	// seek bar previews : sprite sheets of cols x rows frames of width x height, one frame every interval_ms
+	struct Storyboard {
+		int width = 0;
+		int height = 0;
+		int frame_num = 0;
+		int cols = 0;
+		int rows = 0;
+		int interval_ms = 0;
+		std::vector<std::string> sheet_urls;
+		bool is_valid() const { return width > 0 && height > 0 && frame_num > 0 && cols > 0 && rows > 0 && interval_ms > 0 && sheet_urls.size(); }
+	};
+	Storyboard storyboard;
+	
 	std::vector<YouTubeSuccinctItem> suggestions;
 	struct Playlist {
 		std::string id;
@@ -144,9 +217,36 @@ struct YouTubeVideoDetail {
 	bool has_more_comments() const { return comment_continue_type != -1; }
 	bool needs_timestamp_adjusting() const { return is_livestream && livestream_type == LivestreamType::PREMIERE; }
 	bool is_playable() const { return playability_status == "OK" && (both_stream_url != "" || (audio_stream_url != "" && video_stream_urls.size())); }
+	// append what youtube_video_page_load_more_suggestions() and youtube_video_page_load_more_comments() returned (unless they failed)
+	void append_suggestions(YouTubeVideoDetail &&more) {
+		suggestions.insert(suggestions.end(), std::make_move_iterator(more.suggestions.begin()), std::make_move_iterator(more.suggestions.end()));
+		suggestions_continue_token = more.suggestions_continue_token;
+	}
+	void append_comments(YouTubeVideoDetail &&more) {
+		comments.insert(comments.end(), std::make_move_iterator(more.comments.begin()), std::make_move_iterator(more.comments.end()));
+		comment_continue_token = more.comment_continue_token;
+		comment_continue_type = more.comment_continue_type;
+	}
 };
 // this function does not load comments; call youtube_video_page_load_more_comments() if necessary
-YouTubeVideoDetail youtube_parse_video_page(std::string url);
+// pass add_to_history = false when the page is loaded speculatively and may never be watched
+// `on_streams_extracted` : if given, called from the calling thread with the result filled only with the stream related fields
+// as soon as they are extracted, while the rest of the page is still being parsed
+YouTubeVideoDetail youtube_parse_video_page(std::string url, bool add_to_history = true,
+	std::function<void (const YouTubeVideoDetail &)> on_streams_extracted = nullptr);
+// adds the video to the watch history, called by youtube_parse_video_page() unless add_to_history is false
+void youtube_video_page_add_to_history(const YouTubeVideoDetail &detail);
+// finds out the current player js and makes sure its transform plans are in memory and in js_cache/
+// meant to be run in the background at startup so that the first playback after YouTube rotates the player doesn't have to analyze it
+bool youtube_prepare_player_js();
+// the signature and n-param transforms on their own, for the kernel benchmark (see system/util/kernel_benchmark.hpp)
+// `plans` is in the format of js_cache/, NULL is returned if it's invalid
+struct YouTubeTransformPlans;
+YouTubeTransformPlans *youtube_load_transform_plans(const std::string &plans);
+void youtube_free_transform_plans(YouTubeTransformPlans *plans);
+std::string youtube_deobfuscate_signature(const YouTubeTransformPlans *plans, const std::string &signature);
+std::string youtube_modify_nparam(const YouTubeTransformPlans *plans, const std::string &n_param);
+// these two return only the new items along with the updated continuation state, to be given to prev_result.append_*()
 YouTubeVideoDetail youtube_video_page_load_more_suggestions(const YouTubeVideoDetail &prev_result);
 YouTubeVideoDetail youtube_video_page_load_more_comments(const YouTubeVideoDetail &prev_result);
 YouTubeVideoDetail::Comment youtube_video_page_load_more_replies(const YouTubeVideoDetail::Comment &comment);
@@ -170,12 +270,23 @@ struct YouTubeChannelDetail {
 	std::string continue_key;
 	
 	bool has_continue() const { return continue_token != "" && continue_key != ""; }
+	// appends what youtube_channel_page_continue() returned (unless it failed)
+	void append(YouTubeChannelDetail &&more) {
+		videos.insert(videos.end(), std::make_move_iterator(more.videos.begin()), std::make_move_iterator(more.videos.end()));
+		continue_token = more.continue_token;
+	}
 };
 YouTubeChannelDetail youtube_parse_channel_page(std::string url);
-// takes the previous result, returns the new result with both old items and new items
+// the two halves of youtube_parse_channel_page(), for callers that download the page by themselves (e.g. through network_async_get())
+// returns an empty string if the url is not a channel url
+std::string youtube_get_channel_page_url(std::string url);
+YouTubeChannelDetail youtube_parse_channel_page_html(const std::string &url_original, const std::string &html);
+// takes the previous result, returns only the new videos along with the updated continuation state, to be given to prev_result.append()
 YouTubeChannelDetail youtube_channel_page_continue(const YouTubeChannelDetail &prev_result);
 
 void youtube_change_content_language(std::string language_code);
+// headers the parser sends along with every request
+std::map<std::string, std::string> youtube_get_request_headers();
 
 // util function
 std::string youtube_get_video_thumbnail_url_by_id(const std::string &id);
@@ -24,6 +24,9 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
 #include <limits>
 
 namespace json11 {
@@ -246,22 +249,119 @@ static const Json & static_null() {
     return json_null;
 }
 
+/* * * * * * * * * * * * * * * * * * * *
+ * Arena
+ */
+
+// a plain pointer is enough for the chain of arenas of a thread
+#ifdef _MSC_VER
+static __declspec(thread) JsonArena *current_arena = nullptr;
+#else
+static __thread JsonArena *current_arena = nullptr;
+#endif
+
+JsonArena::JsonArena(size_t block_size, size_t max_size) : block_size(block_size), max_size(max_size), outer(current_arena) {
+    current_arena = this;
+}
+
+JsonArena::~JsonArena() {
+    assert(live_num == 0); // a Json allocated here outlives the arena
+    assert(current_arena == this);
+    current_arena = outer;
+    while (blocks) {
+        Block *next = blocks->next;
+        std::free(blocks);
+        blocks = next;
+    }
+}
+
+JsonArena *JsonArena::current() { return current_arena; }
+
+static inline uintptr_t align_up(const char *ptr, size_t align) {
+    return (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~static_cast<uintptr_t>(align - 1);
+}
+
+bool JsonArena::has_room(size_t size) const {
+    if (reserved < max_size)
+        return true;
+    return head && align_up(head, alignof(std::max_align_t)) + size <= reinterpret_cast<uintptr_t>(end);
+}
+
+void *JsonArena::allocate(size_t size, size_t align) {
+    uintptr_t aligned = align_up(head, align);
+    if (!head || aligned + size > reinterpret_cast<uintptr_t>(end)) {
+        // the rest of the current block is abandoned, values are small compared to the blocks
+        size_t new_block_size = std::max(block_size, sizeof(Block) + size + align);
+        Block *block = static_cast<Block *>(std::malloc(new_block_size));
+        if (!block)
+            return nullptr;
+        block->next = blocks;
+        blocks = block;
+        reserved += new_block_size;
+        head = reinterpret_cast<char *>(block + 1);
+        end = reinterpret_cast<char *>(block) + new_block_size;
+        aligned = align_up(head, align);
+    }
+    head = reinterpret_cast<char *>(aligned + size);
+    live_num++;
+    return reinterpret_cast<void *>(aligned);
+}
+
+/* ArenaAllocator
+ *
+ * The allocator given to allocate_shared() for the values made in an arena : the control block of the
+ * shared_ptr and the value end up in one bump allocation, and freeing it is only bookkeeping.
+ */
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    JsonArena *arena;
+
+    explicit ArenaAllocator(JsonArena *arena) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t n) {
+        void *res = arena->allocate(n * sizeof(T), alignof(T));
+        if (!res)
+            std::abort(); // as the default allocator does without exceptions
+        return static_cast<T *>(res);
+    }
+    void deallocate(T *, size_t) { arena->deallocate(); }
+
+    template <typename U>
+    bool operator == (const ArenaAllocator<U> &other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator != (const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+// an upper bound of the size of the control block allocate_shared() places in front of a value
+static const size_t shared_ptr_overhead = 8 * sizeof(void *);
+
+template <typename T, typename... Args>
+static std::shared_ptr<JsonValue> make_value(Args&&... args) {
+    JsonArena *arena = current_arena;
+    if (arena && arena->has_room(sizeof(T) + shared_ptr_overhead))
+        return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+    return make_shared<T>(std::forward<Args>(args)...);
+}
+
 /* * * * * * * * * * * * * * * * * * * *
  * Constructors
  */
 
 Json::Json() noexcept                  : m_ptr(statics().null) {}
 Json::Json(std::nullptr_t) noexcept    : m_ptr(statics().null) {}
-Json::Json(double value)               : m_ptr(make_shared<JsonDouble>(value)) {}
-Json::Json(int value)                  : m_ptr(make_shared<JsonInt>(value)) {}
+Json::Json(double value)               : m_ptr(make_value<JsonDouble>(value)) {}
+Json::Json(int value)                  : m_ptr(make_value<JsonInt>(value)) {}
 Json::Json(bool value)                 : m_ptr(value ? statics().t : statics().f) {}
-Json::Json(const string &value)        : m_ptr(make_shared<JsonString>(value)) {}
-Json::Json(string &&value)             : m_ptr(make_shared<JsonString>(move(value))) {}
-Json::Json(const char * value)         : m_ptr(make_shared<JsonString>(value)) {}
-Json::Json(const Json::array &values)  : m_ptr(make_shared<JsonArray>(values)) {}
-Json::Json(Json::array &&values)       : m_ptr(make_shared<JsonArray>(move(values))) {}
-Json::Json(const Json::object &values) : m_ptr(make_shared<JsonObject>(values)) {}
-Json::Json(Json::object &&values)      : m_ptr(make_shared<JsonObject>(move(values))) {}
+Json::Json(const string &value)        : m_ptr(make_value<JsonString>(value)) {}
+Json::Json(string &&value)             : m_ptr(make_value<JsonString>(move(value))) {}
+Json::Json(const char * value)         : m_ptr(make_value<JsonString>(value)) {}
+Json::Json(const Json::array &values)  : m_ptr(make_value<JsonArray>(values)) {}
+Json::Json(Json::array &&values)       : m_ptr(make_value<JsonArray>(move(values))) {}
+Json::Json(const Json::object &values) : m_ptr(make_value<JsonObject>(values)) {}
+Json::Json(Json::object &&values)      : m_ptr(make_value<JsonObject>(move(values))) {}
 
 /* * * * * * * * * * * * * * * * * * * *
  * Accessors
@@ -743,6 +843,16 @@ Json Json::parse(const string &in, string &err, JsonParse strategy) {
     return result;
 }
 
+// Documented in json11.hpp
+Json Json::parse_at(const string &in, std::string::size_type &pos, string &err, JsonParse strategy) {
+    JsonParser parser { in, pos, err, false, strategy };
+    Json result = parser.parse_json(0);
+    if (parser.failed)
+        return Json();
+    pos = parser.i;
+    return result;
+}
+
 // Documented in json11.hpp
 vector<Json> Json::parse_multi(const string &in,
                                std::string::size_type &parser_stop_pos,
@@ -76,6 +76,51 @@ enum JsonParse {
 
 class JsonValue;
 
+/* JsonArena
+ *
+ * Monotonic allocator for the values of Json objects. While a JsonArena is alive, the Json values
+ * constructed on its thread (including by Json::parse) are bump-allocated out of its blocks instead
+ * of the heap, and the blocks are all freed at once when it's destroyed, so that a parse doesn't
+ * leave thousands of small holes in the heap. Arenas nest : the innermost one is used.
+ *
+ * Every Json created in its scope must be gone before the arena is (declare it before them), only
+ * what's copied out of them (std::string etc.) may outlive it. Once `max_size` bytes are in use,
+ * further values are allocated on the heap as usual.
+ * Only the value nodes go to the arena : the std::string/std::vector/std::map storage inside them
+ * still comes from the heap.
+ */
+class JsonArena final {
+public:
+    explicit JsonArena(size_t block_size = 64 * 1024, size_t max_size = 4 * 1024 * 1024);
+    ~JsonArena();
+    JsonArena(const JsonArena &) = delete;
+    JsonArena &operator = (const JsonArena &) = delete;
+
+    // false once `max_size` is reached and `size` bytes don't fit in the current block
+    bool has_room(size_t size) const;
+    // nullptr only if the heap is out of memory
+    void *allocate(size_t size, size_t align);
+    void deallocate() { live_num--; }
+    // the bytes taken from the heap for the blocks
+    size_t reserved_size() const { return reserved; }
+
+    // the innermost arena of the current thread, or nullptr
+    static JsonArena *current();
+
+private:
+    struct Block {
+        Block *next;
+    };
+    Block *blocks = nullptr;
+    char *head = nullptr;
+    char *end = nullptr;
+    const size_t block_size;
+    const size_t max_size;
+    size_t reserved = 0;
+    size_t live_num = 0;
+    JsonArena *outer;
+};
+
 class Json final {
 public:
     // Types
@@ -174,6 +219,12 @@ public:
             return nullptr;
         }
     }
+    // Parse the value starting at `pos` of `in`, ignoring whatever follows it (no copy of the value's text is made).
+    // On success, `pos` is set just past the parsed value.
+    static Json parse_at(const std::string & in,
+                         std::string::size_type & pos,
+                         std::string & err,
+                         JsonParse strategy = JsonParse::STANDARD);
     // Parse multiple objects, concatenated or separated by whitespace
     static std::vector<Json> parse_multi(
         const std::string & in,
@@ -0,0 +1,111 @@
+#include "headers.hpp"
+#include "network/abr.hpp"
+
+#define LOG_STR "net/abr"
+#define THROUGHPUT_SMOOTHING 0.2 // weight of the latest report in the moving average
+#define DECODE_LOAD_SMOOTHING 0.05 // same for the ratio of the decode time to the frame time
+#define MIN_DECODE_FRAMES 60 // frames decoded before the decode load is trusted
+#define ABR_MIN_SWITCH_INTERVAL_MS 20000 // a switch reinits the playback, so don't do it often
+#define START_MARGIN 1.5 // the throughput must be this many times the bitrate of the quality to start with
+#define UP_MARGIN 2.0 // ... to switch up to
+#define DOWN_MARGIN 1.1 // the quality is lowered if the throughput gets below this many times its bitrate
+#define UP_DECODE_LOAD 0.5 // the decoder must be at most this busy to switch up
+#define DOWN_DECODE_LOAD 0.9 // the quality is lowered if the decoder gets this busy
+#define DEFAULT_QUALITY 360 // when nothing has been measured yet
+
+namespace {
+	double throughput = 0; // bytes per millisecond, 0 if unknown
+	double decode_load = 0;
+	int decode_frames = 0;
+	double last_switch_time = 0;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+// rough bitrates of the H.264 streams of YouTube for the formats that don't advertise one
+static int nominal_video_bitrate(int quality) {
+	if (quality <= 144) return 110000;
+	if (quality <= 240) return 250000;
+	if (quality <= 360) return 500000;
+	return 1000000;
+}
+// bytes per millisecond needed to play `quality` in real time
+static double required_throughput(const AbrStreamSet &streams, int quality) {
+	auto itr = streams.video_bitrates.find(quality);
+	int video_bitrate = itr != streams.video_bitrates.end() && itr->second > 0 ? itr->second : nominal_video_bitrate(quality);
+	return (double) (video_bitrate + streams.audio_bitrate) / 8 / 1000;
+}
+
+int abr_choose_initial_quality(const AbrStreamSet &streams) {
+	if (!streams.qualities.size()) return DEFAULT_QUALITY;
+	lock();
+	double cur_throughput = throughput;
+	release();
+
+	int res = streams.qualities[0];
+	for (auto quality : streams.qualities) {
+		if (quality > streams.max_quality) break;
+		if (cur_throughput > 0 ? required_throughput(streams, quality) * START_MARGIN <= cur_throughput : quality <= DEFAULT_QUALITY) res = quality;
+	}
+	Util_log_save(LOG_STR, "initial : " + std::to_string(res) + "p (throughput " + std::to_string(cur_throughput * 8).substr(0, 6) + " kbps)");
+	return res;
+}
+void abr_start_playback() {
+	lock();
+	decode_load = 0;
+	decode_frames = 0;
+	last_switch_time = get_time_ms();
+	release();
+}
+
+void abr_report_throughput(double bytes_per_ms) {
+	if (bytes_per_ms <= 0) return;
+	lock();
+	if (throughput > 0) throughput += (bytes_per_ms - throughput) * THROUGHPUT_SMOOTHING;
+	else throughput = bytes_per_ms;
+	release();
+}
+void abr_report_video_frame(double decode_time, double frame_time) {
+	if (frame_time <= 0) return;
+	lock();
+	double cur_load = decode_time / frame_time;
+	decode_load = decode_frames ? decode_load * (1 - DECODE_LOAD_SMOOTHING) + cur_load * DECODE_LOAD_SMOOTHING : cur_load;
+	decode_frames++;
+	release();
+}
+
+int abr_next_quality(int cur_quality, const AbrStreamSet &streams) {
+	auto cur_itr = std::find(streams.qualities.begin(), streams.qualities.end(), cur_quality);
+	if (cur_itr == streams.qualities.end()) return cur_quality;
+
+	lock();
+	double cur_time = get_time_ms();
+	int res = cur_quality;
+	if (cur_time - last_switch_time >= ABR_MIN_SWITCH_INTERVAL_MS && decode_frames >= MIN_DECODE_FRAMES) {
+		bool network_short = throughput > 0 && required_throughput(streams, cur_quality) * DOWN_MARGIN > throughput;
+		if ((network_short || decode_load > DOWN_DECODE_LOAD) && cur_itr != streams.qualities.begin()) res = *(cur_itr - 1);
+		else if (cur_itr + 1 != streams.qualities.end() && *(cur_itr + 1) <= streams.max_quality && throughput > 0 &&
+			required_throughput(streams, *(cur_itr + 1)) * UP_MARGIN <= throughput && decode_load < UP_DECODE_LOAD) res = *(cur_itr + 1);
+	}
+	if (res != cur_quality) {
+		Util_log_save(LOG_STR, std::to_string(cur_quality) + "p -> " + std::to_string(res) + "p (throughput " + std::to_string(throughput * 8).substr(0, 6) +
+			" kbps, decode load " + std::to_string(decode_load).substr(0, 4) + ")");
+		last_switch_time = cur_time;
+	}
+	release();
+	return res;
+}
@@ -0,0 +1,106 @@
+#include "headers.hpp"
+#include "network/connectivity.hpp"
+
+namespace {
+	Handle resource_lock;
+	Handle usable_event; // sticky, signaled while usable
+	bool lock_initialized = false;
+	
+	bool link_up = true; // optimistic until the first system info update
+	bool suspended = false;
+	int consecutive_failures = 0;
+	u64 next_attempt_time = 0; // osGetTime()
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+		svcCreateEvent(&usable_event, RESET_STICKY);
+		svcSignalEvent(usable_event);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+static bool is_usable_wo_lock() {
+	return link_up && !suspended && osGetTime() >= next_attempt_time;
+}
+static void update_event_wo_lock() {
+	if (is_usable_wo_lock()) svcSignalEvent(usable_event);
+	else svcClearEvent(usable_event);
+}
+
+void connectivity_set_link_up(bool up) {
+	lock();
+	if (up && !link_up) {
+		Util_log_save("connectivity", "link up");
+		consecutive_failures = 0;
+		next_attempt_time = 0;
+	} else if (!up && link_up) Util_log_save("connectivity", "link down");
+	link_up = up;
+	update_event_wo_lock();
+	release();
+}
+void connectivity_set_suspended(bool value) {
+	lock();
+	suspended = value;
+	if (!suspended) {
+		consecutive_failures = 0;
+		next_attempt_time = 0;
+	}
+	update_event_wo_lock();
+	release();
+}
+void connectivity_report_success() {
+	lock();
+	if (consecutive_failures) Util_log_save("connectivity", "recovered after " + std::to_string(consecutive_failures) + " failures");
+	consecutive_failures = 0;
+	next_attempt_time = 0;
+	update_event_wo_lock();
+	release();
+}
+void connectivity_report_failure() {
+	lock();
+	if (suspended) { // the sockets were just killed, it says nothing about the connection
+		release();
+		return;
+	}
+	consecutive_failures++;
+	u64 backoff = CONNECTIVITY_BACKOFF_MIN_MS << std::min(consecutive_failures - 1, 16);
+	next_attempt_time = osGetTime() + std::min<u64>(backoff, CONNECTIVITY_BACKOFF_MAX_MS);
+	update_event_wo_lock();
+	release();
+}
+
+bool connectivity_is_usable() {
+	lock();
+	bool res = is_usable_wo_lock();
+	release();
+	return res;
+}
+bool connectivity_wait_until_usable(s64 timeout_ns) {
+	u64 deadline = osGetTime() + timeout_ns / 1000000;
+	while (true) {
+		lock();
+		u64 now = osGetTime();
+		bool usable = is_usable_wo_lock();
+		// the event is not signaled when the backoff simply runs out, so wake up by then
+		s64 wait_ms = now >= deadline ? 0 : deadline - now;
+		if (link_up && next_attempt_time > now) wait_ms = std::min<s64>(wait_ms, next_attempt_time - now);
+		if (!usable) svcClearEvent(usable_event);
+		release();
+		
+		if (usable) return true;
+		if (now >= deadline) return false;
+		svcWaitSynchronization(usable_event, wait_ms * 1000000);
+	}
+}
+int connectivity_get_consecutive_failures() {
+	lock();
+	int res = consecutive_failures;
+	release();
+	return res;
+}
@@ -0,0 +1,97 @@
+#include "network/download_policy.hpp"
+#include <algorithm>
+
+// definitions for constants that are passed by reference (std::min, std::max)
+constexpr u64 DownloadPolicy::BLOCK_SIZE;
+constexpr u64 DownloadPolicy::MAX_REQUEST_BLOCKS;
+constexpr u64 DownloadPolicy::MAX_FORWARD_READ_BLOCKS;
+constexpr u64 DownloadPolicy::MIN_FORWARD_READ_BLOCKS;
+constexpr double DownloadPolicy::MIN_FORWARD_SECONDS;
+constexpr double DownloadPolicy::MAX_FORWARD_SECONDS;
+constexpr u64 DownloadPolicy::CATCH_UP_REQUEST_BLOCKS;
+
+#define BLOCK_SIZE DownloadPolicy::BLOCK_SIZE
+
+u64 download_policy_forward_read_blocks(double bitrate, double bandwidth_estimate, u64 fixed_forward_read_blocks, double paused_forward_seconds,
+	bool memory_budget_over, bool data_saver) {
+
+	// reading far ahead would only evict the blocks just downloaded
+	if (memory_budget_over) return DownloadPolicy::MIN_FORWARD_READ_BLOCKS;
+	u64 res;
+	if (fixed_forward_read_blocks) res = fixed_forward_read_blocks;
+	else if (bitrate <= 0 || bandwidth_estimate <= 0) res = DownloadPolicy::MAX_FORWARD_READ_BLOCKS;
+	else {
+		// the slower the link is compared to the bitrate, the longer we buffer ahead
+		double link_speed_ratio = bandwidth_estimate * 1000 / bitrate;
+		double forward_seconds = DownloadPolicy::MIN_FORWARD_SECONDS * DownloadPolicy::ENOUGH_LINK_SPEED_RATIO / link_speed_ratio;
+		forward_seconds = std::max(DownloadPolicy::MIN_FORWARD_SECONDS, std::min(DownloadPolicy::MAX_FORWARD_SECONDS, forward_seconds));
+		if (data_saver) forward_seconds = DownloadPolicy::MIN_FORWARD_SECONDS; // less is thrown away when the playback is stopped early
+		res = forward_seconds * bitrate / BLOCK_SIZE + 1;
+		res = std::max(DownloadPolicy::MIN_FORWARD_READ_BLOCKS, std::min(DownloadPolicy::MAX_FORWARD_READ_BLOCKS, res));
+	}
+	if (paused_forward_seconds > 0) {
+		u64 paused_res = bitrate > 0 ? (u64) (paused_forward_seconds * bitrate / BLOCK_SIZE) + 1 : DownloadPolicy::MIN_FORWARD_READ_BLOCKS;
+		res = std::min(res, std::max(DownloadPolicy::MIN_FORWARD_READ_BLOCKS, paused_res));
+	}
+	return res;
+}
+
+bool download_policy_find_next_block(const DownloadPolicyStream &stream, bool margin_in_seconds, u64 *block, double *margin) {
+	u64 read_head_block = stream.read_head / BLOCK_SIZE;
+	// the first block in the window that is neither present nor being downloaded
+	u64 window_end = std::min(stream.block_num, read_head_block + stream.forward_read_blocks);
+	u64 first_not_downloaded_block = stream.blocks->find_missing_block(read_head_block, window_end);
+	while (first_not_downloaded_block < window_end && stream.blocks->is_block_in_flight(first_not_downloaded_block))
+		first_not_downloaded_block = stream.blocks->find_missing_block(first_not_downloaded_block + 1, window_end);
+	if (first_not_downloaded_block == window_end) return false; // no need to download this stream for now
+
+	*block = first_not_downloaded_block;
+	if (first_not_downloaded_block == read_head_block) *margin = 0;
+	else if (margin_in_seconds) *margin = (double) (first_not_downloaded_block * BLOCK_SIZE - stream.read_head) / stream.bitrate;
+	else *margin = (double) (first_not_downloaded_block * BLOCK_SIZE - stream.read_head) / stream.len * 100;
+	return true;
+}
+
+u64 download_policy_request_block_num(const DownloadPolicyStream &stream, u64 block, DownloadRequestSizing &sizing, bool *catching_up) {
+	u64 read_head_block = stream.read_head / BLOCK_SIZE;
+	// the block at the read head is missing (just after a seek or at startup) : get the first block as fast as possible
+	if (block == read_head_block || block == read_head_block + 1) {
+		sizing.request_block_num = sizing.min_request_block_num;
+		sizing.last_throughput = 0;
+	}
+	// we already know that many consecutive blocks are needed, so ask for them all at once and
+	// stream the response into the blocks : the first one becomes readable as soon as its own bytes have arrived
+	*catching_up = block == read_head_block;
+	u64 max_block_num = *catching_up ? std::max(sizing.request_block_num, DownloadPolicy::CATCH_UP_REQUEST_BLOCKS) : sizing.request_block_num;
+	if (stream.local_file) max_block_num = DownloadPolicy::CATCH_UP_REQUEST_BLOCKS; // no latency to hide, a run is read at once instead
+	u64 bulk_end_block = (stream.bulk_read_end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if (*catching_up && bulk_end_block > block) max_block_num = std::max(max_block_num, bulk_end_block - block);
+	u64 block_limit = std::min(stream.block_num, read_head_block + stream.forward_read_blocks);
+	u64 res = 1;
+	while (res < max_block_num && block + res < block_limit && !stream.blocks->is_block_present(block + res) &&
+		!stream.blocks->is_block_in_flight(block + res) && !stream.blocks->is_block_cached(block + res))
+		res++;
+	if (res == 1) *catching_up = false;
+	return res;
+}
+
+void download_policy_on_throughput(DownloadRequestSizing &sizing, double measured_throughput) {
+	// grow while the throughput is stable, shrink when it drops sharply
+	if (sizing.last_throughput > 0 && measured_throughput >= sizing.last_throughput * 0.75)
+		sizing.request_block_num = std::min(sizing.request_block_num * 2, DownloadPolicy::MAX_REQUEST_BLOCKS);
+	else if (measured_throughput < sizing.last_throughput * 0.5)
+		sizing.request_block_num = std::max<u64>(sizing.request_block_num / 2, sizing.min_request_block_num);
+	sizing.last_throughput = measured_throughput;
+	if (sizing.bandwidth_estimate > 0) sizing.bandwidth_estimate += (measured_throughput - sizing.bandwidth_estimate) * DownloadPolicy::BANDWIDTH_EWMA_WEIGHT;
+	else sizing.bandwidth_estimate = measured_throughput;
+}
+
+bool download_policy_is_starving(const DownloadPolicyStream &stream, double safe_margin_seconds) {
+	if (stream.bitrate <= 0) return false;
+	u64 read_head_block = stream.read_head / BLOCK_SIZE;
+	u64 safe_end_block = std::min(stream.block_num, read_head_block + (u64) (safe_margin_seconds * stream.bitrate / BLOCK_SIZE) + 1);
+	u64 downloaded_end_block = stream.blocks->find_missing_block(read_head_block, safe_end_block);
+	if (downloaded_end_block == stream.block_num) return false; // downloaded up to the end
+	double margin = std::max(0.0, (double) downloaded_end_block * BLOCK_SIZE - stream.read_head) / stream.bitrate;
+	return margin < safe_margin_seconds;
+}
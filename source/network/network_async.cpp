@@ -0,0 +1,264 @@
+#include "headers.hpp"
+#include "network/network_async.hpp"
+#include "network/network_trace.hpp"
+#include <deque>
+#include <set>
+
+#define IDLE_WAIT_TIMEOUT_MS 100
+#define LOG_STR "net/async"
+
+namespace {
+	struct AsyncRequest {
+		int id;
+		std::string method;
+		std::string url;
+		std::map<std::string, std::string> request_headers;
+		std::string body;
+		NetworkAsyncCallback callback;
+		NetworkTrafficClass traffic_class;
+		std::string host;
+	};
+	struct RunningRequest {
+		AsyncRequest request;
+		NetworkResult result;
+		struct curl_slist *request_headers_list = NULL;
+	};
+
+	std::deque<AsyncRequest> pending_requests;
+	std::set<int> running_ids;
+	std::set<int> cancelled_ids; // ids of the running requests that have been cancelled
+	int next_id = 0;
+	volatile bool should_be_running = true;
+
+	CURLM *curl_multi = NULL;
+	Handle wakeup_event;
+	NetworkSessionList session_list; // only used by the blocking event loop
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+		svcCreateEvent(&wakeup_event, RESET_STICKY);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+// must be called with the lock held
+static void wakeup_wo_lock() {
+	svcSignalEvent(wakeup_event);
+	if (curl_multi) curl_multi_wakeup(curl_multi);
+}
+
+static int enqueue(const std::string &method, const std::string &url, const std::map<std::string, std::string> &request_headers, const std::string &body,
+	const NetworkAsyncCallback &callback, NetworkTrafficClass traffic_class) {
+
+	lock();
+	int id = next_id++;
+	pending_requests.push_back({id, method, url, request_headers, body, callback, traffic_class, url_get_host_name(url)});
+	wakeup_wo_lock();
+	release();
+	return id;
+}
+int network_async_get(const std::string &url, const std::map<std::string, std::string> &request_headers, const NetworkAsyncCallback &callback,
+	NetworkTrafficClass traffic_class) {
+	return enqueue("GET", url, request_headers, "", callback, traffic_class);
+}
+int network_async_post(const std::string &url, const std::map<std::string, std::string> &request_headers, const std::string &body,
+	const NetworkAsyncCallback &callback, NetworkTrafficClass traffic_class) {
+	return enqueue("POST", url, request_headers, body, callback, traffic_class);
+}
+void network_async_cancel(int id) {
+	if (id < 0) return;
+	lock();
+	bool found = false;
+	for (auto itr = pending_requests.begin(); itr != pending_requests.end(); itr++) if (itr->id == id) {
+		pending_requests.erase(itr);
+		found = true;
+		break;
+	}
+	if (!found && running_ids.count(id)) {
+		cancelled_ids.insert(id);
+		wakeup_wo_lock();
+	}
+	release();
+}
+// takes the first pending request network_scheduler.hpp allows to start, returns false if there's none
+// if `acquire`, the slot is taken here and must be released when it finishes, otherwise Access_http_*() takes it
+static bool pop_request(AsyncRequest &request, bool acquire) {
+	bool res = false;
+	lock();
+	for (auto itr = pending_requests.begin(); itr != pending_requests.end(); itr++) {
+		if (acquire ? !network_scheduler_try_acquire(itr->traffic_class, itr->host) : !network_scheduler_can_start(itr->traffic_class, itr->host)) continue;
+		request = *itr;
+		pending_requests.erase(itr);
+		running_ids.insert(request.id);
+		res = true;
+		break;
+	}
+	release();
+	return res;
+}
+// returns true if the request has been cancelled while running
+static bool mark_finished(int id) {
+	lock();
+	bool res = cancelled_ids.count(id);
+	cancelled_ids.erase(id);
+	running_ids.erase(id);
+	release();
+	return res;
+}
+
+
+// curl multi event loop
+static size_t curl_receive_data_callback_func(char *in_ptr, size_t, size_t len, void *user_data) {
+	std::vector<u8> *out = (std::vector<u8> *) user_data;
+	out->insert(out->end(), in_ptr, in_ptr + len);
+	return len;
+}
+static void start_curl_request(std::map<CURL *, RunningRequest *> &running, const AsyncRequest &request) {
+	RunningRequest *cur = new RunningRequest();
+	cur->request = request;
+
+	CURL *curl = curl_easy_init();
+	network_curl_setup_handle(curl);
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_receive_data_callback_func);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &cur->result.data);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &cur->result.response_headers);
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+	// libcurl doesn't copy CURLOPT_POSTFIELDS, so point at our own copy
+	if (request.method == "POST") curl_easy_setopt(curl, CURLOPT_POSTFIELDS, cur->request.body.c_str());
+	curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+
+	auto request_headers = request.request_headers;
+	for (auto header : network_get_default_request_headers()) if (!request_headers.count(header.first)) request_headers[header.first] = header.second;
+	for (auto i : request_headers) cur->request_headers_list = curl_slist_append(cur->request_headers_list, (i.first + ": " + i.second).c_str());
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, cur->request_headers_list);
+
+	running[curl] = cur;
+	curl_multi_add_handle(curl_multi, curl);
+}
+static void finish_curl_request(std::map<CURL *, RunningRequest *> &running, CURL *curl, CURLcode curl_code, bool deliver) {
+	RunningRequest *cur = running[curl];
+	running.erase(curl);
+	network_scheduler_release(cur->request.traffic_class, cur->request.host);
+
+	if (mark_finished(cur->request.id)) deliver = false;
+	if (deliver) {
+		NetworkResult &res = cur->result;
+		if (curl_code == CURLE_OK) {
+			long status_code;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status_code);
+			res.status_code = status_code;
+
+			char *redirected_url;
+			curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &redirected_url);
+			res.redirected_url = redirected_url;
+			network_curl_get_timing(curl, res.timing);
+			network_stats_record(cur->request.host, res.timing);
+			network_trace_record(cur->request.host, cur->request.traffic_class, svcGetSystemTick() / CPU_TICKS_PER_MSEC - std::max(0.0, res.timing.total),
+				res.status_code, res.timing);
+		} else {
+			res.fail = true;
+			res.error = curl_easy_strerror(curl_code);
+			res.redirected_url = cur->request.url;
+		}
+		cur->request.callback(res);
+		res.finalize();
+	}
+
+	curl_multi_remove_handle(curl_multi, curl);
+	curl_easy_cleanup(curl);
+	curl_slist_free_all(cur->request_headers_list);
+	delete cur;
+}
+static void run_curl_event_loop() {
+	lock();
+	curl_multi = curl_multi_init();
+	curl_multi_setopt(curl_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	release();
+
+	std::map<CURL *, RunningRequest *> running;
+	while (should_be_running) {
+		// drop the cancelled ones
+		std::vector<CURL *> cancelled;
+		lock();
+		for (auto i : running) if (cancelled_ids.count(i.second->request.id)) cancelled.push_back(i.first);
+		release();
+		for (auto curl : cancelled) finish_curl_request(running, curl, CURLE_OK, false);
+
+		AsyncRequest request;
+		while (running.size() < NETWORK_ASYNC_MAX_CONCURRENT && pop_request(request, true)) start_curl_request(running, request);
+
+		int running_num;
+		curl_multi_perform(curl_multi, &running_num);
+
+		CURLMsg *msg;
+		int msg_left;
+		while ((msg = curl_multi_info_read(curl_multi, &msg_left))) if (msg->msg == CURLMSG_DONE)
+			finish_curl_request(running, msg->easy_handle, msg->data.result, true);
+
+		// woken up by curl_multi_wakeup() when a new request comes
+		curl_multi_poll(curl_multi, NULL, 0, IDLE_WAIT_TIMEOUT_MS, NULL);
+	}
+
+	std::vector<CURL *> remaining;
+	for (auto i : running) remaining.push_back(i.first);
+	for (auto curl : remaining) finish_curl_request(running, curl, CURLE_OK, false);
+
+	lock();
+	curl_multi_cleanup(curl_multi);
+	curl_multi = NULL;
+	release();
+}
+
+// for the other frameworks, which only offer blocking calls
+static void run_blocking_event_loop() {
+	session_list.init();
+
+	while (should_be_running) {
+		AsyncRequest request;
+		lock();
+		svcClearEvent(wakeup_event);
+		release();
+		if (!pop_request(request, false)) {
+			svcWaitSynchronization(wakeup_event, (s64) IDLE_WAIT_TIMEOUT_MS * 1000000);
+			continue;
+		}
+		NetworkResult result;
+		NetworkTrafficClassScope traffic_class_scope(request.traffic_class);
+		// httpc transfers run on the system core and would otherwise starve the UI
+		if (var_network_framework == NETWORK_FRAMEWORK_HTTPC) add_cpu_limit(30);
+		if (request.method == "POST") result = Access_http_post(session_list, request.url, request.request_headers, request.body);
+		else result = Access_http_get(session_list, request.url, request.request_headers);
+		if (var_network_framework == NETWORK_FRAMEWORK_HTTPC) remove_cpu_limit(30);
+
+		if (!mark_finished(request.id)) request.callback(result);
+		result.finalize();
+	}
+}
+
+void network_async_thread_func(void *arg) {
+	(void) arg;
+
+	lock(); // makes sure the event is created
+	release();
+
+	if (var_network_framework == NETWORK_FRAMEWORK_LIBCURL) run_curl_event_loop();
+	else run_blocking_event_loop();
+
+	Util_log_save(LOG_STR, "Thread exit.");
+	threadExit(0);
+}
+void network_async_thread_exit_request() {
+	should_be_running = false;
+	lock();
+	wakeup_wo_lock();
+	release();
+}
@@ -1,16 +1,31 @@
-#include "headers.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
+#include "definitions.hpp"
 #include "network/network_decoder.hpp"
-#include "network/network_downloader.hpp"
+#include "system/util/log.hpp"
+#include "system/util/libctru_wrapper.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/metrics.hpp"
+#include "system/cpu_limit.hpp"
 
 // mostly stolen from decoder.cpp
+// everything 3ds specific other than the mvd service goes through system/platform.hpp and light_lock.hpp,
+// so this also builds on a PC for tools/decoder_bench (_WIN32, the mvd service parts are left out)
 
+#ifdef _WIN32
+static void memcpy_asm(u8 *dst, u8 *src, int size) { memcpy(dst, src, size); }
+#else
 extern "C" void memcpy_asm(u8*, u8*, int);
+#endif
 
 void NetworkDecoderFFmpegData::deinit(bool deinit_stream) {
 	for (int type = 0; type < 2; type++) {
 		delete opaque[type];
 		opaque[type] = NULL;
-		avcodec_free_context(&decoder_context[type]);
+		if (!codec_borrowed[type]) avcodec_free_context(&decoder_context[type]);
+		decoder_context[type] = NULL;
 		if (io_context[type]) av_freep(&io_context[type]->buffer);
 		av_freep(&io_context[type]);
 		avformat_close_input(&format_context[type]);
@@ -19,17 +34,90 @@ void NetworkDecoderFFmpegData::deinit(bool deinit_stream) {
 			network_stream[type] = NULL;
 		}
 	}
-	swr_free(&swr_context);
+	if (!codec_borrowed[AUDIO]) swr_free(&swr_context);
+	swr_context = NULL;
+	codec_borrowed[VIDEO] = codec_borrowed[AUDIO] = false;
+	stream_info_found[VIDEO] = stream_info_found[AUDIO] = false;
+}
+void NetworkDecoderFFmpegData::take_codecs(NetworkDecoderFFmpegData &data) {
+	for (int type = 0; type < 2; type++) {
+		if (!data.decoder_context[type] || data.codec_borrowed[type]) continue;
+		decoder_context[type] = data.decoder_context[type];
+		codec[type] = data.codec[type];
+		codec_borrowed[type] = false;
+		data.codec_borrowed[type] = true;
+	}
+	if (data.codec_borrowed[AUDIO]) {
+		swr_context = data.swr_context;
+		audio_output_sample_rate = data.audio_output_sample_rate;
+		audio_output_ch = data.audio_output_ch;
+	}
+}
+void NetworkDecoderFFmpegData::deinit_video() {
+	delete opaque[VIDEO];
+	opaque[VIDEO] = NULL;
+	if (!codec_borrowed[VIDEO]) avcodec_free_context(&decoder_context[VIDEO]);
+	decoder_context[VIDEO] = NULL;
+	codec_borrowed[VIDEO] = false;
+	stream_info_found[VIDEO] = false;
+	if (io_context[VIDEO]) av_freep(&io_context[VIDEO]->buffer);
+	av_freep(&io_context[VIDEO]);
+	avformat_close_input(&format_context[VIDEO]);
+	if (network_stream[VIDEO]) network_stream[VIDEO]->quit_request = true;
+	network_stream[VIDEO] = NULL;
+	codec[VIDEO] = NULL;
+	seek_index[VIDEO].clear();
 }
 
+#define STREAM_WAIT_TIMEOUT_NS 50000000 // 50 ms
+// software decoder output buffer (in frames)
+#define SW_OUTPUT_BUFFER_SIZE 11
+#define SW_OUTPUT_BUFFER_SIZE_SMALL_FRAME 24
+#define SMALL_FRAME_PIXELS (426 * 240)
+#define PACKET_POOL_MAX 64 // more than enough for the packets buffered at once, the rest are freed
+#define AUDIO_BUFFER_SIZE 0x6000 // enough for a 120 ms opus frame in stereo
+#define AUDIO_RESAMPLE_FILTER_SIZE 8 // instead of 32, audible only in the high frequencies the speakers barely play anyway
+#define AUDIO_RESAMPLE_PHASE_SHIFT 6 // instead of 10
+#define AUDIO_BUFFER_NUM 72 // the speaker queue (60) + the decoded audio queue of the player (8) + the one being decoded, with some margin
+// how late (seconds) the next video packet must be compared to the audio to start skipping frames
+#define VIDEO_DEMUX_AHEAD_BYTES 0x100000 // the video packets queued by the demux thread are capped by size and by duration
+#define VIDEO_DEMUX_AHEAD_SECONDS 2.0
+
+#define SEEK_IN_QUEUE_MAX_KEYFRAME_DISTANCE 1.0 // same as the tolerance of the avformat_seek_file() in seek()
+
+#define FRAME_SKIP_THRESHOLD 0.1
+#define FRAME_SKIP_HEAVY_THRESHOLD 0.5
+
 static int read_network_stream(void *opaque, u8 *buf, int buf_size_) { // size or AVERROR_EOF
 	NetworkDecoder *decoder = ((std::pair<NetworkDecoder *, NetworkStream *> *) opaque)->first;
 	NetworkStream *stream = ((std::pair<NetworkDecoder *, NetworkStream *> *) opaque)->second;
 	size_t buf_size = buf_size_;
 	
-	// Util_log_save("dec", "read " + std::to_string(stream->read_head) + " " + std::to_string(buf_size_) + " " + std::to_string(stream->len));
+	Util_log_trace("dec", "read " + std::to_string(stream->read_head) + " " + std::to_string(buf_size_) + " " + std::to_string(stream->len));
 	bool cpu_limited = false;
-	while (!stream->ready || !stream->is_data_available(stream->read_head, std::min<u64>(buf_size, stream->len - stream->read_head))) {
+	bool waited = false; // whether we had to wait for the data to arrive (cache miss)
+	double wait_start_time = 0;
+	while (true) {
+		if (stream->ready) {
+			size_t read_size = std::min<u64>(buf_size, stream->len - stream->read_head);
+			// copy straight from the block cache into the AVIO buffer, this fails if the data is not downloaded yet
+			if (stream->get_data(stream->read_head, read_size, buf)) {
+				if (cpu_limited) {
+					cpu_limited = false;
+					remove_cpu_limit(25, CpuLimitReason::NETWORK_WAIT);
+				}
+				stream->network_waiting_status = NULL;
+				if (waited) decoder->network_wait_time += platform_get_time_ms() - wait_start_time;
+				if (waited) stream->cache_miss_num++;
+				else stream->cache_hit_num++;
+				metrics_add(waited ? Metric::BLOCK_CACHE_MISSES : Metric::BLOCK_CACHE_HITS);
+				u64 prev_block = stream->read_head / NetworkStream::BLOCK_SIZE;
+				stream->read_head += read_size;
+				if (stream->read_head / NetworkStream::BLOCK_SIZE != prev_block) stream->notify_downloader();
+				if (!read_size) return AVERROR_EOF;
+				return read_size;
+			}
+		}
 		if (stream->ready && stream->read_head >= stream->len) {
 			Util_log_save("dec", "read beyond eof : " + std::to_string(stream->read_head) + " " + std::to_string(stream->len));
 			goto fail; // beyond the eof
@@ -37,39 +125,31 @@ static int read_network_stream(void *opaque, u8 *buf, int buf_size_) { // size o
 		if (!stream->disable_interrupt && decoder->interrupt) {
 			Util_log_save("dec", "read interrupt");
 			decoder->need_reinit = true;
+			metrics_add(Metric::NEED_REINIT_EVENTS);
 			goto fail;
 		}
-		stream->network_waiting_status = "Reading stream";
+		if (stream == decoder->video_demux_pause_stream) goto fail; // pause_video_demux() is waiting for this read to end
+		stream->network_waiting_status = stream->url_expired ? "Refreshing stream url" : "Reading stream";
+		if (!waited) wait_start_time = platform_get_time_ms();
+		waited = true;
 		if (!cpu_limited) {
 			cpu_limited = true;
-			add_cpu_limit(25);
+			add_cpu_limit(25, CpuLimitReason::NETWORK_WAIT);
 		}
-		usleep(20000);
+		// woken up as soon as the downloader stores a block, the timeout is for checking `interrupt`
+		stream->wait_for_data(STREAM_WAIT_TIMEOUT_NS);
 		if (stream->error || stream->quit_request) {
 			Util_log_save("dec", "read dead stream : " + std::string(stream->error ? "error" : "quitted"));
 			usleep(100000);
 			goto fail;
 		}
 	}
-	if (cpu_limited) {
-		cpu_limited = false;
-		remove_cpu_limit(25);
-	}
-	stream->network_waiting_status = NULL;
-	
-	{
-		auto tmp = stream->get_data(stream->read_head, std::min<u64>(buf_size, stream->len - stream->read_head));
-		size_t read_size = tmp.size();
-		stream->read_head += read_size;
-		memcpy(buf, &tmp[0], read_size);
-		if (!read_size) return AVERROR_EOF;
-		return read_size;
-	}
 	
 	fail :
+	if (waited) decoder->network_wait_time += platform_get_time_ms() - wait_start_time;
 	if (cpu_limited) {
 		cpu_limited = false;
-		remove_cpu_limit(25);
+		remove_cpu_limit(25, CpuLimitReason::NETWORK_WAIT);
 	}
 	stream->network_waiting_status = NULL;
 	return AVERROR_EOF;
@@ -82,7 +162,7 @@ static int64_t seek_network_stream(void *opaque, s64 offset, int whence) { // si
 	
 	while (!stream->ready) {
 		stream->network_waiting_status = "Reading stream (init, seek)";
-		usleep(20000);
+		stream->wait_for_data(STREAM_WAIT_TIMEOUT_NS);
 		if (stream->error || stream->quit_request) {
 			stream->network_waiting_status = NULL;
 			return -1;
@@ -91,7 +171,7 @@ static int64_t seek_network_stream(void *opaque, s64 offset, int whence) { // si
 	stream->network_waiting_status = NULL;
 	
 	if (whence == AVSEEK_SIZE) {
-		// Util_log_save("dec", "inquire size : " + std::to_string(stream->len));
+		Util_log_trace("dec", "inquire size : " + std::to_string(stream->len));
 		return stream->len;
 	}
 	
@@ -100,17 +180,190 @@ static int64_t seek_network_stream(void *opaque, s64 offset, int whence) { // si
 	else if (whence == SEEK_CUR) new_pos = stream->read_head + offset;
 	else if (whence == SEEK_END) new_pos = stream->len + offset;
 	
-	// Util_log_save("dec", "seek " + std::to_string(new_pos) + " " + std::to_string(stream->len));
+	Util_log_trace("dec", "seek " + std::to_string(new_pos) + " " + std::to_string(stream->len));
 	
 	if (new_pos > stream->len) return -1;
 	
+	// small forward skips are part of normal demuxing
+	if (new_pos < stream->read_head || new_pos >= stream->read_head + NetworkStream::BLOCK_SIZE) stream->record_seek(new_pos);
 	stream->read_head = new_pos;
+	stream->notify_downloader();
 	
 	return stream->read_head;
 }
 
-#define NETWORK_BUFFER_SIZE 0x10000
-Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expected_codec_type, NetworkDecoder *parent_decoder) {
+#define SEEK_INDEX_MIN_INTERVAL 1.0 // seconds, entries closer than this to the previous one are dropped to keep the index small
+#define SIDX_SEARCH_BOX_NUM 16 // top-level boxes looked through for the sidx box
+#define SIDX_MAX_SIZE 0x100000
+#define MOOV_SEARCH_BOX_NUM 4 // ftyp, moov or ftyp, (free), mdat, moov
+
+static u32 read_u32_be(const u8 *data) { return (u32) data[0] << 24 | (u32) data[1] << 16 | (u32) data[2] << 8 | data[3]; }
+static u64 read_u64_be(const u8 *data) { return (u64) read_u32_be(data) << 32 | read_u32_be(data + 4); }
+// fragmented mp4 (DASH) : each reference in the sidx box is a fragment that starts with a keyframe
+// only the data already in the cache (read by the demuxer when opening the stream) is used, this never waits for the network
+static std::vector<SeekIndexEntry> parse_sidx(NetworkStream *stream) {
+	std::vector<SeekIndexEntry> res;
+	u64 box_pos = 0;
+	u8 header[16];
+	for (int i = 0; i < SIDX_SEARCH_BOX_NUM && box_pos + 8 <= stream->len; i++) {
+		if (!stream->get_data(box_pos, 8, header)) return res;
+		u64 box_size = read_u32_be(header);
+		u64 header_size = 8;
+		if (box_size == 1) {
+			if (!stream->get_data(box_pos, 16, header)) return res;
+			box_size = read_u64_be(header + 8);
+			header_size = 16;
+		}
+		if (box_size < header_size) return res; // 0 (up to the end) or broken
+		if (!memcmp(header + 4, "moof", 4) || !memcmp(header + 4, "mdat", 4)) return res; // no sidx before the media data
+		if (!memcmp(header + 4, "sidx", 4)) {
+			if (box_size > SIDX_MAX_SIZE) return res;
+			std::vector<u8> box(box_size);
+			if (!stream->get_data(box_pos, box_size, &box[0])) return res;
+			const u8 *cur = &box[header_size];
+			const u8 *end = &box[0] + box_size;
+			if (end - cur < 12) return res;
+			int version = cur[0];
+			u32 timescale = read_u32_be(cur + 8);
+			cur += 12;
+			u64 earliest_time, first_offset;
+			if (version == 0) {
+				if (end - cur < 8) return res;
+				earliest_time = read_u32_be(cur);
+				first_offset = read_u32_be(cur + 4);
+				cur += 8;
+			} else {
+				if (end - cur < 16) return res;
+				earliest_time = read_u64_be(cur);
+				first_offset = read_u64_be(cur + 8);
+				cur += 16;
+			}
+			if (end - cur < 4 || !timescale) return res;
+			int reference_num = cur[2] << 8 | cur[3];
+			cur += 4;
+			
+			u64 pos = box_pos + box_size + first_offset;
+			u64 time = earliest_time;
+			for (int j = 0; j < reference_num && end - cur >= 12; j++, cur += 12) {
+				u32 reference = read_u32_be(cur);
+				if (reference >> 31) return std::vector<SeekIndexEntry>(); // points to another sidx box, not used by YouTube
+				if (read_u32_be(cur + 8) >> 31) res.push_back({(double) time / timescale, pos}); // starts with a SAP
+				pos += reference & 0x7FFFFFFF;
+				time += read_u32_be(cur + 4);
+			}
+			return res;
+		}
+		box_pos += box_size;
+	}
+	return res;
+}
+// non-fragmented mp4 (itag 18) : the moov box holds the sample tables of the whole video, several MB for a long one
+// once its range is known, the downloader fetches it in a single request while the demuxer reads it, instead of block by block
+static void request_moov_at_once(AVIOContext *io_context, NetworkStream *stream) {
+	u64 box_pos = 0;
+	u8 header[16];
+	for (int i = 0; i < MOOV_SEARCH_BOX_NUM && (!stream->ready || box_pos + 8 <= stream->len); i++) {
+		if (avio_seek(io_context, box_pos, SEEK_SET) < 0 || avio_read(io_context, header, 8) != 8) break;
+		u64 box_size = read_u32_be(header);
+		u64 header_size = 8;
+		if (box_size == 1) {
+			if (avio_read(io_context, header + 8, 8) != 8) break;
+			box_size = read_u64_be(header + 8);
+			header_size = 16;
+		}
+		if (box_size < header_size) break; // 0 (up to the end) or broken
+		if (!memcmp(header + 4, "moof", 4)) break; // fragmented, the moov is small
+		if (!memcmp(header + 4, "moov", 4)) {
+			Util_log_save("decoder", "moov : " + std::to_string(box_pos) + " + " + std::to_string(box_size));
+			stream->bulk_read_end = box_pos + box_size;
+			stream->notify_downloader();
+			break;
+		}
+		box_pos += box_size;
+	}
+	avio_seek(io_context, 0, SEEK_SET);
+}
+// the demuxer's own sample index, which is complete for non-fragmented mp4 (the whole moov is read when opening)
+static std::vector<SeekIndexEntry> get_demuxer_seek_index(AVStream *stream) {
+	std::vector<SeekIndexEntry> res;
+	double time_base = av_q2d(stream->time_base);
+	int entry_num = avformat_index_get_entries_count(stream);
+	for (int i = 0; i < entry_num; i++) {
+		const AVIndexEntry *entry = avformat_index_get_entry(stream, i);
+		if (!entry || !(entry->flags & AVINDEX_KEYFRAME) || entry->pos < 0) continue;
+		double time = entry->timestamp * time_base;
+		if (res.size() && time < res.back().time + SEEK_INDEX_MIN_INTERVAL) continue;
+		res.push_back({time, (u64) entry->pos});
+	}
+	return res;
+}
+
+// whether a decoder context opened for `context` can decode the stream of `params` as it is
+static bool is_codec_compatible(const AVCodecContext *context, const AVCodecParameters *params) {
+	return context->codec_id == params->codec_id && context->width == params->width && context->height == params->height &&
+		context->sample_rate == params->sample_rate && context->channels == params->channels && context->extradata_size == params->extradata_size &&
+		(!params->extradata_size || !memcmp(context->extradata, params->extradata, params->extradata_size));
+}
+// the container of what we stream is known from the mime type in the url, which saves the probing (and its reads) in avformat_open_input()
+static const AVInputFormat *get_known_input_format(const std::string &url) {
+	if (url.find("mime=video%2Fmp4") != std::string::npos || url.find("mime=audio%2Fmp4") != std::string::npos) return av_find_input_format("mp4");
+	return NULL;
+}
+// whether the header told everything the decoder and the player need, in which case avformat_find_stream_info() is not needed
+// (a fragmented mp4 doesn't tell the frame rate, for example)
+static bool has_complete_codec_parameters(const AVFormatContext *context) {
+	for (size_t i = 0; i < context->nb_streams; i++) {
+		const AVStream *stream = context->streams[i];
+		const AVCodecParameters *params = stream->codecpar;
+		if (params->codec_id == AV_CODEC_ID_NONE || !params->extradata_size) return false;
+		if (params->codec_type == AVMEDIA_TYPE_VIDEO && (params->width <= 0 || params->height <= 0 || stream->avg_frame_rate.num <= 0 || stream->avg_frame_rate.den <= 0))
+			return false;
+		if (params->codec_type == AVMEDIA_TYPE_AUDIO && (params->sample_rate <= 0 || params->channels <= 0)) return false;
+	}
+	return true;
+}
+// a failure is not fatal, the parameters from the header are used as they are
+void NetworkDecoderFFmpegData::find_stream_info(int type) {
+	int index = video_audio_seperate ? type : BOTH;
+	if (stream_info_found[index]) return;
+	int ffmpeg_result = avformat_find_stream_info(format_context[index], NULL);
+	if (ffmpeg_result < 0) Util_log_save("decoder", "avformat_find_stream_info() failed " + std::to_string(ffmpeg_result));
+	stream_info_found[index] = true;
+}
+
+// the AVIO buffer : a read larger than it bypasses it (avio_read() copies straight from read_network_stream() into the packet),
+// so it's sized for about IO_BUFFER_SECONDS of the stream, the audio packets are small and its reads are kept cheap
+#define NETWORK_BUFFER_SIZE 0x10000 // if the bitrate is unknown
+#define AUDIO_NETWORK_BUFFER_SIZE 0x4000
+#define MIN_NETWORK_BUFFER_SIZE 0x8000
+#define MAX_NETWORK_BUFFER_SIZE 0x40000
+#define IO_BUFFER_SECONDS 0.25
+// bytes per second, from the previous opening or from the `clen` (size) and `dur` (seconds) parameters of googlevideo urls, 0 if unknown
+static double get_bitrate_hint(const NetworkStream *stream) {
+	if (stream->bitrate > 0) return stream->bitrate;
+	auto get_param = [&] (const char *name) {
+		std::string pattern = std::string("&") + name + "=";
+		auto pos = stream->url.find(pattern);
+		if (pos == std::string::npos) pos = stream->url.find(std::string("?") + name + "=");
+		return pos == std::string::npos ? 0.0 : strtod(stream->url.c_str() + pos + pattern.size(), NULL);
+	};
+	double len = stream->len ? stream->len : get_param("clen");
+	double duration = get_param("dur");
+	return len > 0 && duration > 0 ? len / duration : 0;
+}
+static int get_network_buffer_size(const NetworkStream *stream, bool audio_only) {
+	if (audio_only) return AUDIO_NETWORK_BUFFER_SIZE;
+	double bitrate = get_bitrate_hint(stream);
+	if (bitrate <= 0) return NETWORK_BUFFER_SIZE;
+	int size = std::min<double>(bitrate * IO_BUFFER_SECONDS, MAX_NETWORK_BUFFER_SIZE);
+	return std::max(MIN_NETWORK_BUFFER_SIZE, (size + 0xFFF) & ~0xFFF);
+}
+// limits of avformat_find_stream_info() once the container is known, enough for the frame rate estimation
+#define FAST_OPEN_PROBE_SIZE 0x40000
+#define FAST_OPEN_ANALYZE_DURATION (AV_TIME_BASE / 2)
+Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expected_codec_type, NetworkDecoder *parent_decoder,
+	const NetworkDecoderFFmpegData *shared_codecs) {
+	
 	Result_with_string result;
 	int ffmpeg_result;
 	
@@ -118,14 +371,15 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 		network_stream[type]->read_head = 0;
 		
 		opaque[type] = new std::pair<NetworkDecoder *, NetworkStream *>(parent_decoder, network_stream[type]);
-		unsigned char *buffer = (unsigned char *) av_malloc(NETWORK_BUFFER_SIZE);
+		int buffer_size = get_network_buffer_size(network_stream[type], video_audio_seperate && type == AUDIO);
+		unsigned char *buffer = (unsigned char *) av_malloc(buffer_size);
 		if (!buffer) {
 			result.error_description = "network buffer allocation failed";
 			result.code = DEF_ERR_OUT_OF_MEMORY;
 			result.string = DEF_ERR_OUT_OF_MEMORY_STR;
 			return result;
 		}
-		io_context[type] = avio_alloc_context(buffer, NETWORK_BUFFER_SIZE, 0, opaque[type], read_network_stream, NULL, seek_network_stream);
+		io_context[type] = avio_alloc_context(buffer, buffer_size, 0, opaque[type], read_network_stream, NULL, seek_network_stream);
 		if (!io_context[type]) {
 			result.error_description = "IO context allocation failed";
 			result.code = DEF_ERR_OUT_OF_MEMORY;
@@ -140,16 +394,29 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 			return result;
 		}
 		format_context[type]->pb = io_context[type];
-		ffmpeg_result = avformat_open_input(&format_context[type], "yay", NULL, NULL);
+		const AVInputFormat *input_format = get_known_input_format(network_stream[type]->url);
+		if (input_format) {
+			format_context[type]->probesize = FAST_OPEN_PROBE_SIZE;
+			format_context[type]->max_analyze_duration = FAST_OPEN_ANALYZE_DURATION;
+		}
+		AVDictionary *options = NULL;
+		if (input_format && !video_audio_seperate && !network_stream[type]->whole_download) {
+			if (!network_stream[type]->is_local_file()) request_moov_at_once(io_context[type], network_stream[type]);
+			// the edit list pass makes a second copy of the sample index, which for a long video is the largest allocation of the player
+			// the only edit of itag 18 is the audio priming of a few ms, which the plain start time handles well enough
+			av_dict_set(&options, "advanced_editlist", "0", 0);
+		}
+		ffmpeg_result = avformat_open_input(&format_context[type], "yay", input_format, &options);
+		av_dict_free(&options);
 		if (ffmpeg_result != 0) {
 			result.error_description = "avformat_open_input() failed " + std::to_string(ffmpeg_result);
 			goto fail;
 		}
-		ffmpeg_result = avformat_find_stream_info(format_context[type], NULL);
-		if (!format_context[type]) {
-			result.error_description = "avformat_find_stream_info() failed " + std::to_string(ffmpeg_result);
-			goto fail;
-		}
+		// the codec parameters in the header are enough if the decoder contexts are reused or if nothing is missing
+		if (input_format && has_complete_codec_parameters(format_context[type])) stream_info_found[type] = true;
+		if (!shared_codecs) find_stream_info(type);
+		if (format_context[type]->duration > 0)
+			network_stream[type]->bitrate = network_stream[type]->len / ((double) format_context[type]->duration / AV_TIME_BASE);
 		if (video_audio_seperate) {
 			if (format_context[type]->nb_streams != 1) {
 				result.error_description = "nb_streams != 1 : " + std::to_string(format_context[type]->nb_streams);
@@ -178,6 +445,19 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 		}
 	} else stream_index[type] = 0;
 	
+	if (shared_codecs && shared_codecs->decoder_context[type] && is_codec_compatible(shared_codecs->decoder_context[type], get_stream(type)->codecpar)) {
+		decoder_context[type] = shared_codecs->decoder_context[type];
+		codec[type] = shared_codecs->codec[type];
+		codec_borrowed[type] = true;
+		if (type == AUDIO) {
+			swr_context = shared_codecs->swr_context;
+			audio_output_sample_rate = shared_codecs->audio_output_sample_rate;
+			audio_output_ch = shared_codecs->audio_output_ch;
+		}
+		return result;
+	}
+	if (shared_codecs) find_stream_info(type); // the codec changed in the middle of the livestream
+	
 	codec[type] = avcodec_find_decoder(get_stream(type)->codecpar->codec_id);
 	if(!codec[type]) {
 		result.error_description = "avcodec_find_decoder() failed";
@@ -197,11 +477,27 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 	}
 
 	if ((video_audio_seperate ? (type == VIDEO) : (type == BOTH))) decoder_context[type]->lowres = 0; // <-------
+	if (type == VIDEO && parent_decoder->sw_decoder_thread_num > 1) {
+		// frame threading gives the most with the usual single-slice streams, slice threading is used if the stream has several slices
+		decoder_context[type]->thread_count = parent_decoder->sw_decoder_thread_num;
+		decoder_context[type]->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	}
 	ffmpeg_result = avcodec_open2(decoder_context[type], codec[type], NULL);
 	if (ffmpeg_result != 0) {
 		result.error_description = "avcodec_open2() failed " + std::to_string(ffmpeg_result);
 		goto fail;
 	}
+	if (!network_stream[video_audio_seperate ? type : BOTH]->whole_download) {
+		// the sidx box can't be attributed to a track if the video and the audio are muxed together
+		if (video_audio_seperate) seek_index[type] = parse_sidx(network_stream[type]);
+		if (!seek_index[type].size()) seek_index[type] = get_demuxer_seek_index(get_stream(type));
+	}
+	if (type == VIDEO) {
+		// FFmpeg silently falls back to a single thread if it is built without thread support (as the bundled one is)
+		parent_decoder->sw_decoder_active_thread_num = decoder_context[type]->active_thread_type ? decoder_context[type]->thread_count : 1;
+		if (parent_decoder->sw_decoder_thread_num > 1 && parent_decoder->sw_decoder_active_thread_num <= 1)
+			Util_log_save("decoder", "requested " + std::to_string(parent_decoder->sw_decoder_thread_num) + " decoder threads, but FFmpeg uses only one");
+	}
 	
 	if (type == AUDIO) {
 		swr_context = swr_alloc();
@@ -209,12 +505,21 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 			result.error_description = "swr_alloc() failed ";
 			goto fail;
 		}
-		if (!swr_alloc_set_opts(swr_context, av_get_default_channel_layout(decoder_context[AUDIO]->channels), AV_SAMPLE_FMT_S16, decoder_context[AUDIO]->sample_rate,
-			av_get_default_channel_layout(decoder_context[AUDIO]->channels), decoder_context[AUDIO]->sample_fmt, decoder_context[AUDIO]->sample_rate, 0, NULL))
+		int in_sample_rate = decoder_context[AUDIO]->sample_rate;
+		int max_sample_rate = parent_decoder->audio_output_max_sample_rate;
+		audio_output_sample_rate = max_sample_rate > 0 ? std::min(in_sample_rate, max_sample_rate) : in_sample_rate;
+		audio_output_ch = parent_decoder->audio_output_mono ? 1 : decoder_context[AUDIO]->channels;
+		if (!swr_alloc_set_opts(swr_context, av_get_default_channel_layout(audio_output_ch), AV_SAMPLE_FMT_S16, audio_output_sample_rate,
+			av_get_default_channel_layout(decoder_context[AUDIO]->channels), decoder_context[AUDIO]->sample_fmt, in_sample_rate, 0, NULL))
 		{
 			result.error_description = "swr_alloc_set_opts() failed ";
 			goto fail;
 		}
+		if (audio_output_sample_rate != in_sample_rate) {
+			// the Old 3DS spends noticeable time in the default filter
+			av_opt_set_int(swr_context, "filter_size", AUDIO_RESAMPLE_FILTER_SIZE, 0);
+			av_opt_set_int(swr_context, "phase_shift", AUDIO_RESAMPLE_PHASE_SHIFT, 0);
+		}
 
 		ffmpeg_result = swr_init(swr_context);
 		if (ffmpeg_result != 0) {
@@ -230,7 +535,9 @@ Result_with_string NetworkDecoderFFmpegData::init_(int type, AVMediaType expecte
 	return result;
 }
 
-Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *video_stream, NetworkStream *audio_stream, NetworkDecoder *parent_decoder) {
+Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *video_stream, NetworkStream *audio_stream, NetworkDecoder *parent_decoder,
+	const NetworkDecoderFFmpegData *shared_codecs) {
+	
 	Result_with_string result;
 	
 	video_audio_seperate = video_stream != audio_stream;
@@ -238,13 +545,13 @@ Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *video_stream, N
 	network_stream[AUDIO] = audio_stream;
 	this->parent_decoder = parent_decoder;
 	
-	result = init_(VIDEO, AVMEDIA_TYPE_VIDEO, parent_decoder);
+	result = init_(VIDEO, AVMEDIA_TYPE_VIDEO, parent_decoder, shared_codecs);
 	if (result.code != 0) {
 		result.error_description = "[video] " + result.error_description;
 		return result;
 	}
 	
-	result = init_(AUDIO, AVMEDIA_TYPE_AUDIO, parent_decoder);
+	result = init_(AUDIO, AVMEDIA_TYPE_AUDIO, parent_decoder, shared_codecs);
 	if (result.code != 0) {
 		result.error_description = "[audio] " + result.error_description;
 		return result;
@@ -252,8 +559,21 @@ Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *video_stream, N
 	
 	return result;
 }
-Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *both_stream, NetworkDecoder *parent_decoder) {
-	return init(both_stream, both_stream, parent_decoder);
+Result_with_string NetworkDecoderFFmpegData::init(NetworkStream *both_stream, NetworkDecoder *parent_decoder, const NetworkDecoderFFmpegData *shared_codecs) {
+	return init(both_stream, both_stream, parent_decoder, shared_codecs);
+}
+Result_with_string NetworkDecoderFFmpegData::init_video(NetworkStream *video_stream) {
+	Result_with_string result;
+	if (!video_audio_seperate) {
+		result.code = DEF_ERR_OTHER;
+		result.string = DEF_ERR_OTHER_STR;
+		result.error_description = "the video is muxed with the audio";
+		return result;
+	}
+	network_stream[VIDEO] = video_stream;
+	result = init_(VIDEO, AVMEDIA_TYPE_VIDEO, parent_decoder, NULL);
+	if (result.code != 0) result.error_description = "[video] " + result.error_description;
+	return result;
 }
 Result_with_string NetworkDecoderFFmpegData::reinit() {
 	deinit(false);
@@ -262,25 +582,45 @@ Result_with_string NetworkDecoderFFmpegData::reinit() {
 double NetworkDecoderFFmpegData::get_duration() {
 	return (double) format_context[video_audio_seperate ? AUDIO : BOTH]->duration / AV_TIME_BASE;
 }
+#define AUDIO_CODEC_STATE_ESTIMATE 0x10000
+u64 NetworkDecoderFFmpegData::get_memory_usage() {
+	u64 res = 0;
+	for (int type = 0; type < 2; type++) {
+		if (io_context[type]) res += sizeof(AVIOContext) + io_context[type]->buffer_size;
+		if (format_context[type]) res += sizeof(AVFormatContext) + format_context[type]->nb_streams * sizeof(AVStream);
+		res += seek_index[type].size() * sizeof(SeekIndexEntry);
+		if (decoder_context[type] && !codec_borrowed[type]) {
+			AVCodecContext *context = decoder_context[type];
+			if (context->codec_type == AVMEDIA_TYPE_VIDEO) // the reference frames and the one being decoded
+				res += (u64) context->width * context->height * 3 / 2 * (std::max(context->refs, 1) + 1);
+			else res += AUDIO_CODEC_STATE_ESTIMATE;
+		}
+	}
+	return res;
+}
 
 
 
 void NetworkDecoder::deinit() {
 	ready = false;
 	
+	packet_buffer_lock.lock();
 	for (int type = 0; type < 2; type++) {
 		for (auto i : packet_buffer[type]) av_packet_free(&i);
 		packet_buffer[type].clear();
 	}
-	// for HW decoder
-	for (auto i : video_mvd_tmp_frames.deinit()) free(i);
-	linearFree_concurrent(mvd_frame);
-	mvd_frame = NULL;
-	buffered_pts_list.clear();
-	// for SW decoder
-	for (auto i : video_tmp_frames.deinit()) av_frame_free(&i);
-	free(sw_video_output_tmp);
-	sw_video_output_tmp = NULL;
+	video_demux_queued_bytes = 0;
+	video_demux_eof = false;
+	packet_buffer_lock.unlock();
+	for (auto i : packet_pool) av_packet_free(&i);
+	packet_pool.clear();
+	// the speaker must have given back all the buffers by now
+	linearFree_concurrent(audio_buffer_arena, MemoryTag::DECODER);
+	audio_buffer_arena = NULL;
+	audio_buffer_slot_size = 0;
+	audio_buffer_free_slots.clear();
+	av_frame_free(&audio_frame);
+	deinit_output_buffer();
 	
 	// ffmpeg data should not be freed, but to prevent accesses to them, we set NULLs here
 	for (int type = 0; type < 2; type++) {
@@ -294,6 +634,24 @@ void NetworkDecoder::deinit() {
 	swr_context = NULL;
 }
 
+void NetworkDecoder::deinit_output_buffer() {
+	// for HW decoder
+	for (auto i : video_mvd_tmp_frames.deinit()) {
+		if (mvd_direct_output) linearFree_concurrent(i.data, MemoryTag::DECODER);
+		else free(i.data);
+	}
+	mvd_direct_output = false;
+	linearFree_concurrent(mvd_frame, MemoryTag::DECODER);
+	mvd_frame = NULL;
+	linearFree_concurrent(mvd_packet, MemoryTag::DECODER);
+	mvd_packet = NULL;
+	mvd_packet_size = 0;
+	mvd_pending_pts_num = 0;
+	// for SW decoder
+	for (auto i : video_tmp_frames.deinit()) av_frame_free(&i);
+	free(sw_video_output_tmp);
+	sw_video_output_tmp = NULL;
+}
 Result_with_string NetworkDecoder::init_output_buffer(bool is_mvd) {
 	Result_with_string result;
 	int width, height;
@@ -305,22 +663,38 @@ Result_with_string NetworkDecoder::init_output_buffer(bool is_mvd) {
 	if (height % 16) height += 16 - height % 16;
 	if (is_mvd) {
 		std::vector<u8 *> init(11);
+		// the mvd service can only write to linear memory : if the buffers fit there, frames never have to be copied out of mvd_frame
+		mvd_direct_output = true;
 		for (auto &i : init) {
-			i = (u8 *) malloc(width * height * 2);
+			i = (u8 *) linearAlloc_concurrent(width * height * 2, MemoryTag::DECODER);
 			if (!i) {
-				result.error_description = "malloc() failed while preallocating ";
-				goto fail;
+				mvd_direct_output = false;
+				break;
+			}
+		}
+		if (!mvd_direct_output) {
+			Util_log_save("decoder", "not enough linear memory for the mvd output buffers, frames will be copied");
+			for (auto &i : init) {
+				linearFree_concurrent(i, MemoryTag::DECODER);
+				i = (u8 *) malloc(width * height * 2);
+				if (!i) {
+					result.error_description = "malloc() failed while preallocating ";
+					goto fail;
+				}
 			}
 		}
-		video_mvd_tmp_frames.init(init);
+		std::vector<MvdFrame> frames;
+		for (auto i : init) frames.push_back({i, 0, 0, 0});
+		video_mvd_tmp_frames.init(frames);
 		
-		mvd_frame = (u8 *) linearAlloc_concurrent(width * height * 2);
+		mvd_frame = (u8 *) linearAlloc_concurrent(width * height * 2, MemoryTag::DECODER);
 		if (!mvd_frame) {
 			result.error_description = "malloc() failed while preallocating ";
 			goto fail;
 		}
 	} else {
-		std::vector<AVFrame *> init(11);
+		// small frames are cheap to keep, so decode further ahead to absorb the slow ones
+		std::vector<AVFrame *> init(width * height <= SMALL_FRAME_PIXELS ? SW_OUTPUT_BUFFER_SIZE_SMALL_FRAME : SW_OUTPUT_BUFFER_SIZE);
 		for (auto &i : init) {
 			i = av_frame_alloc();
 			if (!i) {
@@ -347,11 +721,12 @@ Result_with_string NetworkDecoder::init_output_buffer(bool is_mvd) {
 Result_with_string NetworkDecoder::init(bool request_hw_decoder) {
 	Result_with_string result;
 	
+#ifdef _WIN32
+	request_hw_decoder = false; // no mvd service on the host
+#endif
 	hw_decoder_enabled = request_hw_decoder;
 	interrupt = false;
 	
-	svcCreateMutex(&buffered_pts_list_lock, false);
-	
 	if (!audio_only) {
 		result = init_output_buffer(request_hw_decoder);
 		if (result.code != 0) {
@@ -360,6 +735,7 @@ Result_with_string NetworkDecoder::init(bool request_hw_decoder) {
 		}
 	}
 	mvd_first = true;
+	video_frames_held = video_draining = false;
 	ready = true;
 	return result;
 }
@@ -368,6 +744,7 @@ Result_with_string NetworkDecoder::change_ffmpeg_data(const NetworkDecoderFFmpeg
 	
 	interrupt = false;
 	
+	bool same_video_codec = decoder_context[VIDEO] && decoder_context[VIDEO] == data.decoder_context[VIDEO];
 	video_audio_seperate = data.video_audio_seperate;
 	for (int type = 0; type < 2; type++) {
 		network_stream[type] = data.network_stream[type];
@@ -379,19 +756,74 @@ Result_with_string NetworkDecoder::change_ffmpeg_data(const NetworkDecoderFFmpeg
 		codec[type] = data.codec[type];
 	}
 	swr_context = data.swr_context;
+	audio_output_sample_rate = data.audio_output_sample_rate;
+	audio_output_ch = data.audio_output_ch;
 	audio_only = data.audio_only;
+	for (int type = 0; type < 2; type++) seek_index[type] = data.seek_index[type];
 	this->timestamp_offset = timestamp_offset;
+	if (!same_video_codec) { // a fresh decoder context
+		frame_skip_level = 0;
+		video_frames_held = video_draining = false;
+	}
 	
 	return result;
 }
-void NetworkDecoder::clear_buffer() {
-	for (int type = 0; type < 2; type++) {
-		for (auto i : packet_buffer[type]) av_packet_free(&i);
-		packet_buffer[type].clear();
+Result_with_string NetworkDecoder::change_video_stream(const NetworkDecoderFFmpegData &data, bool request_hw_decoder) {
+	Result_with_string result;
+	
+	clear_packet_buffer(VIDEO);
+	deinit_output_buffer();
+	
+	network_stream[VIDEO] = data.network_stream[VIDEO];
+	opaque[VIDEO] = data.opaque[VIDEO];
+	format_context[VIDEO] = data.format_context[VIDEO];
+	io_context[VIDEO] = data.io_context[VIDEO];
+	stream_index[VIDEO] = data.stream_index[VIDEO];
+	decoder_context[VIDEO] = data.decoder_context[VIDEO];
+	codec[VIDEO] = data.codec[VIDEO];
+	seek_index[VIDEO] = data.seek_index[VIDEO];
+#ifdef _WIN32
+	request_hw_decoder = false;
+#endif
+	hw_decoder_enabled = request_hw_decoder;
+	frame_skip_level = 0;
+	mvd_first = true;
+	video_frames_held = video_draining = false;
+	
+	result = init_output_buffer(request_hw_decoder);
+	if (result.code != 0) result.error_description = "[out buf] " + result.error_description;
+	return result;
+}
+Result_with_string NetworkDecoder::seek_video(s64 microseconds) {
+	Result_with_string result;
+	
+	clear_packet_buffer(VIDEO);
+	video_mvd_tmp_frames.clear();
+	video_tmp_frames.clear();
+	mvd_pending_pts_num = 0;
+	
+	prefetch_seek_target(VIDEO, microseconds / 1000000.0);
+	// the first key frame at or after the position, so that nothing before what's being played has to be decoded
+	int ffmpeg_result = avformat_seek_file(format_context[VIDEO], -1, microseconds, microseconds, microseconds + 10000000, 0);
+	if (ffmpeg_result < 0) {
+		result.code = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS;
+		result.string = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS_STR;
+		result.error_description = "avformat_seek_file() for video failed " + std::to_string(ffmpeg_result);
+		return result;
 	}
+	avcodec_flush_buffers(decoder_context[VIDEO]);
+	video_frames_held = video_draining = false;
+	return read_packet(VIDEO);
+}
+void NetworkDecoder::flush_codecs() {
+	for (int type = 0; type < 2; type++) if (decoder_context[type]) avcodec_flush_buffers(decoder_context[type]);
+	video_frames_held = video_draining = false;
+}
+void NetworkDecoder::clear_buffer() {
+	for (int type = 0; type < 2; type++) clear_packet_buffer(type);
 	video_mvd_tmp_frames.clear();
 	video_tmp_frames.clear();
-	buffered_pts_list.clear();
+	mvd_pending_pts_num = 0;
 }
 
 NetworkDecoder::VideoFormatInfo NetworkDecoder::get_video_info() {
@@ -413,6 +845,8 @@ NetworkDecoder::AudioFormatInfo NetworkDecoder::get_audio_info() {
 	res.bitrate = decoder_context[AUDIO]->bit_rate;
 	res.sample_rate = decoder_context[AUDIO]->sample_rate;
 	res.ch = decoder_context[AUDIO]->channels;
+	res.output_sample_rate = audio_output_sample_rate;
+	res.output_ch = audio_output_ch;
 	res.format_name = codec[AUDIO]->long_name;
 	res.duration = (double) format_context[video_audio_seperate ? AUDIO : BOTH]->duration / AV_TIME_BASE;
 	return res;
@@ -433,11 +867,32 @@ std::vector<std::pair<double, std::vector<double> > > NetworkDecoder::get_buffer
 	}
 	return res;
 }
+AVPacket *NetworkDecoder::get_packet() {
+	packet_pool_lock.lock();
+	AVPacket *res = NULL;
+	if (packet_pool.size()) {
+		res = packet_pool.back();
+		packet_pool.pop_back();
+	}
+	packet_pool_lock.unlock();
+	if (!res) res = av_packet_alloc();
+	return res;
+}
+void NetworkDecoder::recycle_packet(AVPacket *packet) {
+	if (!packet) return;
+	av_packet_unref(packet);
+	packet_pool_lock.lock();
+	bool pooled = packet_pool.size() < PACKET_POOL_MAX;
+	if (pooled) packet_pool.push_back(packet);
+	packet_pool_lock.unlock();
+	if (!pooled) av_packet_free(&packet);
+}
 Result_with_string NetworkDecoder::read_packet(int type) {
+	TRACE_ZONE("read_packet");
 	Result_with_string result;
 	int ffmpeg_result;
 	
-	AVPacket *tmp_packet = av_packet_alloc();
+	AVPacket *tmp_packet = get_packet();
 	if (!tmp_packet) {
 		result.code = DEF_ERR_OUT_OF_MEMORY;
 		result.string = DEF_ERR_OUT_OF_MEMORY_STR;
@@ -445,42 +900,197 @@ Result_with_string NetworkDecoder::read_packet(int type) {
 		return result;
 	}
 	
-	ffmpeg_result = av_read_frame(format_context[type], tmp_packet);
+	{
+		// the demux thread may be reading the video demuxer at the same time
+		bool lock_demuxer = video_audio_seperate && type == VIDEO;
+		if (lock_demuxer) video_demux_lock.lock();
+		ffmpeg_result = av_read_frame(format_context[type], tmp_packet);
+		if (lock_demuxer) video_demux_lock.unlock();
+	}
 	if (ffmpeg_result != 0) {
 		result.error_description = "av_read_frame() failed";
 		goto fail;
 	}
 	{
 		int packet_type = video_audio_seperate ? type : (tmp_packet->stream_index == stream_index[VIDEO] ? VIDEO : AUDIO);
+		packet_buffer_lock.lock();
 		packet_buffer[packet_type].push_back(tmp_packet);
+		if (packet_type == VIDEO) video_demux_queued_bytes += tmp_packet->size;
+		packet_buffer_lock.unlock();
+		if (packet_type == VIDEO) video_packet_event.signal();
 		return result;
 	}
 	
 	fail :
-	av_packet_free(&tmp_packet);
+	recycle_packet(tmp_packet);
 	result.code = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS;
 	result.string = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS_STR;
 	return result;
 }
+void NetworkDecoder::refill_packet_buffer(int type) {
+	if (video_audio_seperate) {
+		if (type == VIDEO && video_demux_active()) return; // the demux thread is on it
+		while (!get_queued_packet_num(type) && read_packet(type).code == 0);
+	} else while (!get_queued_packet_num(type) && read_packet(BOTH).code == 0);
+}
+AVPacket *NetworkDecoder::peek_packet(int type) {
+	packet_buffer_lock.lock();
+	AVPacket *res = packet_buffer[type].size() ? packet_buffer[type][0] : NULL;
+	packet_buffer_lock.unlock();
+	return res;
+}
+void NetworkDecoder::pop_packet(int type) {
+	packet_buffer_lock.lock();
+	AVPacket *packet = NULL;
+	if (packet_buffer[type].size()) {
+		packet = packet_buffer[type][0];
+		packet_buffer[type].pop_front();
+		if (type == VIDEO) video_demux_queued_bytes -= std::min<u64>(video_demux_queued_bytes, packet->size);
+	}
+	packet_buffer_lock.unlock();
+	recycle_packet(packet);
+	if (type == VIDEO) video_packet_consumed_event.signal();
+}
+void NetworkDecoder::clear_packet_buffer(int type) {
+	packet_buffer_lock.lock();
+	for (auto i : packet_buffer[type]) recycle_packet(i);
+	packet_buffer[type].clear();
+	if (type == VIDEO) {
+		video_demux_queued_bytes = 0;
+		video_demux_eof = false;
+	}
+	packet_buffer_lock.unlock();
+	if (type == VIDEO) video_packet_consumed_event.signal();
+}
+bool NetworkDecoder::wait_for_video_packet() {
+	while (video_demux_active() && !get_queued_packet_num(VIDEO) && !video_demux_eof && !interrupt)
+		video_packet_event.wait(STREAM_WAIT_TIMEOUT_NS);
+	refill_packet_buffer(VIDEO); // in case the demux thread has been stopped meanwhile
+	return get_queued_packet_num(VIDEO);
+}
+bool NetworkDecoder::demux_video_ahead() {
+	if (!ready || !video_demux_active() || interrupt || video_demux_eof) return false;
+	if (!video_demux_lock.try_lock()) return false; // paused
+	if (!ready || !format_context[VIDEO]) {
+		video_demux_lock.unlock();
+		return false;
+	}
+	
+	bool read = true;
+	packet_buffer_lock.lock();
+	if (packet_buffer[VIDEO].size()) {
+		double time_base = av_q2d(get_stream(VIDEO)->time_base);
+		double queued_seconds = (packet_buffer[VIDEO].back()->dts - packet_buffer[VIDEO].front()->dts) * time_base;
+		if (video_demux_queued_bytes >= VIDEO_DEMUX_AHEAD_BYTES || queued_seconds >= VIDEO_DEMUX_AHEAD_SECONDS) read = false;
+	}
+	packet_buffer_lock.unlock();
+	
+	if (read && read_packet(VIDEO).code != 0) {
+		// an interrupted or paused read ends the same way as the end of the stream, the seek that follows it makes the demuxer readable again
+		if (!interrupt && !video_demux_pause_stream) {
+			video_demux_eof = true;
+			video_packet_event.signal();
+		}
+		read = false;
+	}
+	video_demux_lock.unlock();
+	return read;
+}
+void NetworkDecoder::pause_video_demux() {
+	video_demux_pause_stream = network_stream[VIDEO];
+	if (video_demux_pause_stream) video_demux_pause_stream->data_arrival_event.signal(); // wake up the read waiting for the data
+	video_demux_lock.lock();
+	video_demux_pause_stream = NULL;
+}
 NetworkDecoder::DecodeType NetworkDecoder::next_decode_type() {
 	if (video_audio_seperate) {
-		for (int type = 0; type < 2; type++) if (!packet_buffer[type].size())
-			read_packet(type);
+		refill_packet_buffer(AUDIO);
+		refill_packet_buffer(VIDEO);
+		// the audio is decoded meanwhile unless there's nothing left of it
+		if (video_demux_active() && !get_queued_packet_num(AUDIO)) wait_for_video_packet();
 	} else {
-		while ((!audio_only && !packet_buffer[VIDEO].size()) || !packet_buffer[AUDIO].size()) {
+		while ((!audio_only && !get_queued_packet_num(VIDEO)) || !get_queued_packet_num(AUDIO)) {
 			Result_with_string result = read_packet(BOTH);
 			if (result.code != 0) break;
 		}
 	}
-	if (!packet_buffer[VIDEO].size() && !packet_buffer[AUDIO].size()) return DecodeType::EoF;
-	if (!packet_buffer[AUDIO].size()) return DecodeType::VIDEO;
-	if (!packet_buffer[VIDEO].size()) return DecodeType::AUDIO;
-	double video_dts = packet_buffer[VIDEO][0]->dts * av_q2d(get_stream(VIDEO)->time_base);
-	double audio_dts = packet_buffer[AUDIO][0]->dts * av_q2d(get_stream(AUDIO)->time_base);
+	AVPacket *video_packet = peek_packet(VIDEO);
+	AVPacket *audio_packet = peek_packet(AUDIO);
+	bool video_pending = video_demux_active() && !video_packet && !video_demux_eof;
+	if (!video_packet && !audio_packet) {
+		if (video_pending) return DecodeType::INTERRUPTED;
+		return video_frames_held && !hw_decoder_enabled ? DecodeType::VIDEO : DecodeType::EoF; // decode_video() drains the decoder first
+	}
+	if (!audio_packet) return DecodeType::VIDEO;
+	if (!video_packet) return DecodeType::AUDIO;
+	double video_dts = video_packet->dts * av_q2d(get_stream(VIDEO)->time_base);
+	double audio_dts = audio_packet->dts * av_q2d(get_stream(AUDIO)->time_base);
 	return video_dts <= audio_dts ? DecodeType::VIDEO : DecodeType::AUDIO;
 }
+bool NetworkDecoder::prepare_packet(DecodeType decode_type) {
+	if (!video_audio_seperate) return false;
+	int type = decode_type == DecodeType::VIDEO ? VIDEO : AUDIO;
+	// at the end of the video stream, decode_video() drains the decoder
+	if (type == VIDEO && video_demux_active()) return wait_for_video_packet() || (video_demux_eof && !interrupt && video_frames_held && !hw_decoder_enabled);
+	if (!get_queued_packet_num(type)) read_packet(type);
+	if (type == VIDEO && !get_queued_packet_num(type)) return video_frames_held && !hw_decoder_enabled;
+	return get_queued_packet_num(type);
+}
+bool NetworkDecoder::is_buffered_ahead(double seconds) {
+	for (int type = 0; type < (video_audio_seperate ? 2 : 1); type++) {
+		NetworkStream *stream = network_stream[video_audio_seperate ? type : BOTH];
+		if (!stream || stream->whole_download || stream->is_local_file() || stream->bitrate <= 0) continue;
+		u64 start = stream->read_head;
+		if (start >= stream->len) continue;
+		u64 size = std::min<u64>(stream->len - start, stream->bitrate * seconds);
+		if (!stream->is_data_available(start, size)) return false;
+	}
+	return true;
+}
+double NetworkDecoder::get_buffered_seconds_ahead() {
+	double res = -1;
+	for (int type = 0; type < (video_audio_seperate ? 2 : 1); type++) {
+		NetworkStream *stream = network_stream[video_audio_seperate ? type : BOTH];
+		if (!stream || stream->whole_download || stream->is_local_file() || stream->bitrate <= 0) continue;
+		u64 start = stream->read_head;
+		if (start >= stream->len) continue;
+		u64 end = std::min(stream->len, stream->find_missing_block(start / NetworkStream::BLOCK_SIZE, stream->block_num) * NetworkStream::BLOCK_SIZE);
+		double seconds = end > start ? (end - start) / stream->bitrate : 0;
+		res = res < 0 ? seconds : std::min(res, seconds);
+	}
+	return res;
+}
+u8 *NetworkDecoder::reserve_mvd_packet(size_t size) {
+	if (size <= mvd_packet_size) return mvd_packet;
+	size_t new_size = std::max<size_t>(size, mvd_packet_size * 2);
+	linearFree_concurrent(mvd_packet, MemoryTag::DECODER);
+	mvd_packet = (u8 *) linearAlloc_concurrent(new_size, MemoryTag::DECODER);
+	mvd_packet_size = mvd_packet ? new_size : 0;
+	return mvd_packet;
+}
 static std::string debug_str = "";
+void NetworkDecoder::add_mvd_pending_pts(double pts) {
+	if (mvd_pending_pts_num == MVD_PENDING_PTS_MAX) { // the oldest ones must be of packets that never came out as frames
+		std::copy(mvd_pending_pts + 1, mvd_pending_pts + mvd_pending_pts_num, mvd_pending_pts);
+		mvd_pending_pts_num--;
+	}
+	int pos = std::upper_bound(mvd_pending_pts, mvd_pending_pts + mvd_pending_pts_num, pts) - mvd_pending_pts;
+	std::copy_backward(mvd_pending_pts + pos, mvd_pending_pts + mvd_pending_pts_num, mvd_pending_pts + mvd_pending_pts_num + 1);
+	mvd_pending_pts[pos] = pts;
+	mvd_pending_pts_num++;
+}
+#ifdef _WIN32
+Result_with_string NetworkDecoder::mvd_decode(int *, int *) { // never called, init() doesn't enable the hardware decoder on the host
+	Result_with_string result;
+	result.code = DEF_ERR_OTHER;
+	result.string = DEF_ERR_OTHER_STR;
+	result.error_description = "no mvd service on this platform";
+	pop_packet(VIDEO);
+	return result;
+}
+#else
 Result_with_string NetworkDecoder::mvd_decode(int *width, int *height) {
+	TRACE_ZONE("mvd_decode");
 	Result_with_string result;
 	
 	*width = decoder_context[VIDEO]->width;
@@ -488,64 +1098,57 @@ Result_with_string NetworkDecoder::mvd_decode(int *width, int *height) {
 	if (*width % 16 != 0) *width += 16 - *width % 16;
 	if (*height % 16 != 0) *height += 16 - *height % 16;
 	
+	// the reported size stays the full one, the frame itself is scaled down (independently in each direction) to fit in mvd_output_max_*
+	auto get_output_size = [] (int size, int max_size) { return max_size > 0 ? std::min(size, std::max(16, (max_size + 15) / 16 * 16)) : size; };
+	int output_width = get_output_size(*width, mvd_output_max_width);
+	int output_height = get_output_size(*height, mvd_output_max_height);
 	MVDSTD_Config config;
-	mvdstdGenerateDefaultConfig(&config, *width, *height, *width, *height, NULL, NULL, NULL);
+	mvdstdGenerateDefaultConfig(&config, *width, *height, output_width, output_height, NULL, NULL, NULL);
 	
 	int offset = 0;
-	int source_offset = 0;
 
-	AVPacket *packet_read = packet_buffer[VIDEO][0];
-	u8 *mvd_packet = (u8 *) linearAlloc_concurrent(packet_read->size);
+	AVPacket *packet_read = peek_packet(VIDEO);
+	u8 *extradata = decoder_context[VIDEO]->extradata;
+	u8 *mvd_packet = reserve_mvd_packet(std::max<size_t>(packet_read->size, mvd_first ? decoder_context[VIDEO]->extradata_size + 3 : 0));
+	if (!mvd_packet) {
+		result.code = DEF_ERR_OUT_OF_LINEAR_MEMORY;
+		result.string = DEF_ERR_OUT_OF_LINEAR_MEMORY_STR;
+		result.error_description = "failed to allocate the mvd packet buffer";
+		pop_packet(VIDEO);
+		return result;
+	}
 	if(mvd_first)
 	{
-		//set extra data
-
-		offset = 0;
-		memset(mvd_packet, 0x0, 0x2);
-		offset += 2;
-		memset(mvd_packet + offset, 0x1, 0x1);
-		offset += 1;
-		memcpy(mvd_packet + offset, decoder_context[VIDEO]->extradata + 8, *(decoder_context[VIDEO]->extradata + 7));
-		offset += *(decoder_context[VIDEO]->extradata + 7);
-
-		result.code = mvdstdProcessVideoFrame(mvd_packet, offset, 0, NULL);
+		//set extra data (sps and pps from the avcC box) with the nal prefix 0x0 0x0 0x1
+		int sps_size = extradata[7];
+		int pps_size = extradata[10 + sps_size];
+		
+		mvd_packet[0] = mvd_packet[1] = 0x0;
+		mvd_packet[2] = 0x1;
+		memcpy(mvd_packet + 3, extradata + 8, sps_size);
+		result.code = mvdstdProcessVideoFrame(mvd_packet, 3 + sps_size, 0, NULL);
 		if (!MVD_CHECKNALUPROC_SUCCESS(result.code)) Util_log_save("mvd", "0 : mvdstdProcessVideoFrame() : " + std::to_string(result.code));
 
-		offset = 0;
-		memset(mvd_packet, 0x0, 0x2);
-		offset += 2;
-		memset(mvd_packet + offset, 0x1, 0x1);
-		offset += 1;
-		memcpy(mvd_packet + offset, decoder_context[VIDEO]->extradata + 11 + *(decoder_context[VIDEO]->extradata + 7), *(decoder_context[VIDEO]->extradata + 10 + *(decoder_context[VIDEO]->extradata + 7)));
-		offset += *(decoder_context[VIDEO]->extradata + 10 + *(decoder_context[VIDEO]->extradata + 7));
-		
-		result.code = mvdstdProcessVideoFrame(mvd_packet, offset, 0, NULL);
+		memcpy(mvd_packet + 3, extradata + 11 + sps_size, pps_size);
+		result.code = mvdstdProcessVideoFrame(mvd_packet, 3 + pps_size, 0, NULL);
 		if (!MVD_CHECKNALUPROC_SUCCESS(result.code)) Util_log_save("mvd", "1 : mvdstdProcessVideoFrame() : " + std::to_string(result.code));
 	}
 	
-	offset = 0;
-	source_offset = 0;
-
-	while(source_offset + 4 < packet_read->size)
-	{
-		//get nal size
-		int size = *((int*)(packet_read->data + source_offset));
-		size = __builtin_bswap32(size);
-		source_offset += 4;
-
-		//set nal prefix 0x0 0x0 0x1
-		memset(mvd_packet + offset, 0x0, 0x2);
-		offset += 2;
-		memset(mvd_packet + offset, 0x1, 0x1);
-		offset += 1;
-
-		//copy raw nal data
-		memcpy(mvd_packet + offset, (packet_read->data + source_offset), size);
-		offset += size;
-		source_offset += size;
+	// the 4 byte nal sizes are replaced in place by the 4 byte start code 0x0 0x0 0x0 0x1, so the packet is copied only once
+	memcpy(mvd_packet, packet_read->data, packet_read->size);
+	while (offset + 4 < packet_read->size) {
+		u32 size = __builtin_bswap32(*((u32 *) (mvd_packet + offset)));
+		mvd_packet[offset + 0] = mvd_packet[offset + 1] = mvd_packet[offset + 2] = 0x0;
+		mvd_packet[offset + 3] = 0x1;
+		if (size > (u32) (packet_read->size - offset - 4)) break; // broken packet, let the decoder handle what we have
+		offset += 4 + size;
 	}
+	offset = std::min(offset, packet_read->size);
 	
-	config.physaddr_outdata0 = osConvertVirtToPhys(mvd_frame);
+	// render directly into the output buffer if possible, the first frame is written but not pushed (see below)
+	u8 *output = mvd_frame;
+	if (mvd_direct_output && video_mvd_tmp_frames.get_next_pushed()) output = video_mvd_tmp_frames.get_next_pushed()->data;
+	config.physaddr_outdata0 = osConvertVirtToPhys(output);
 	
 	result.code = mvdstdProcessVideoFrame(mvd_packet, offset, 0, NULL);
 	
@@ -556,41 +1159,62 @@ Result_with_string NetworkDecoder::mvd_decode(int *width, int *height) {
 		if (!MVD_CHECKNALUPROC_SUCCESS(result.code)) Util_log_save("mvd", "1 : mvdstdProcessVideoFrame() : " + std::to_string(result.code));
 	}
 
-	if (MVD_CHECKNALUPROC_SUCCESS(result.code)) {
-		double cur_pos;
-		double time_base = av_q2d(get_stream(VIDEO)->time_base);
-		if (packet_read->pts != AV_NOPTS_VALUE) cur_pos = packet_read->pts * time_base;
-		else cur_pos = packet_read->dts * time_base;
-		
-		svcWaitSynchronization(buffered_pts_list_lock, std::numeric_limits<s64>::max());
-		buffered_pts_list.insert(cur_pos + timestamp_offset);
-		svcReleaseMutex(buffered_pts_list_lock);
-	}
+	double packet_pts = (packet_read->pts != AV_NOPTS_VALUE ? packet_read->pts : packet_read->dts) * av_q2d(get_stream(VIDEO)->time_base) + timestamp_offset;
+	if (MVD_CHECKNALUPROC_SUCCESS(result.code)) add_mvd_pending_pts(packet_pts);
 	if (result.code == MVD_STATUS_FRAMEREADY) {
 		result.code = 0;
 		mvdstdRenderVideoFrame(&config, true);
+		GSPGPU_InvalidateDataCache(output, output_width * output_height * 2); // the previous contents may still be cached from the last read
 		
 		if (!mvd_first) { // when changing video, it somehow outputs a frame of previous video, so ignore the first one
-			memcpy_asm(video_mvd_tmp_frames.get_next_pushed(), mvd_frame, (*width * *height * 2) / 32 * 32);
+			MvdFrame *frame = video_mvd_tmp_frames.get_next_pushed();
+			if (output == mvd_frame) memcpy_asm(frame->data, mvd_frame, (output_width * output_height * 2) / 32 * 32);
+			frame->width = output_width;
+			frame->height = output_height;
+			if (mvd_pending_pts_num) {
+				frame->pts = mvd_pending_pts[0];
+				std::copy(mvd_pending_pts + 1, mvd_pending_pts + mvd_pending_pts_num, mvd_pending_pts);
+				mvd_pending_pts_num--;
+			} else {
+				Util_log_save("decoder", "SET EMPTY");
+				frame->pts = packet_pts;
+			}
 			video_mvd_tmp_frames.push();
 		}
 	} else Util_log_save("", "mvdstdProcessVideoFrame()...", result.code);
 	
 	mvd_first = false;
-	linearFree_concurrent(mvd_packet);
-	mvd_packet = NULL;
-	av_packet_free(&packet_read);
-	packet_buffer[VIDEO].pop_front();
-	// refill the packet buffer
-	while (!packet_buffer[VIDEO].size() && read_packet(video_audio_seperate ? VIDEO : BOTH).code == 0);
+	pop_packet(VIDEO);
+	refill_packet_buffer(VIDEO);
 	
 	return result;
 }
+#endif
+// only for the software decoder : the mvd service decodes everything anyway
+void NetworkDecoder::update_frame_skip_level(double packet_pos) {
+	int next_level = frame_skip_level;
+	if (playback_pos < 0) next_level = 0;
+	else {
+		double behind = playback_pos - packet_pos;
+		if (behind > FRAME_SKIP_HEAVY_THRESHOLD) next_level = 2;
+		else if (behind > FRAME_SKIP_THRESHOLD) next_level = std::max(next_level, 1);
+		else if (behind < 0) next_level = 0; // caught up : the frame about to be decoded is still in the future
+	}
+	if (next_level == frame_skip_level) return;
+	
+	Util_log_save("decoder", "frame skip level : " + std::to_string(frame_skip_level) + " -> " + std::to_string(next_level));
+	frame_skip_level = next_level;
+	AVCodecContext *context = decoder_context[VIDEO];
+	context->skip_frame = next_level ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	context->skip_loop_filter = next_level == 2 ? AVDISCARD_ALL : next_level == 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
 Result_with_string NetworkDecoder::decode_video(int *width, int *height, bool *key_frame, double *cur_pos) {
+	TRACE_ZONE("decode_video");
 	Result_with_string result;
 	int ffmpeg_result = 0;
 	
-	AVPacket *packet_read = packet_buffer[VIDEO][0];
+	AVPacket *packet_read = peek_packet(VIDEO);
+	if (!packet_read) return drain_video(width, height, key_frame, cur_pos);
 	*key_frame = (packet_read->flags & AV_PKT_FLAG_KEY);
 	
 	if (hw_decoder_enabled) {
@@ -615,13 +1239,22 @@ Result_with_string NetworkDecoder::decode_video(int *width, int *height, bool *k
 	*width = 0;
 	*height = 0;
 	
+	{
+		double time_base = av_q2d(get_stream(VIDEO)->time_base);
+		s64 packet_ts = packet_read->pts != AV_NOPTS_VALUE ? packet_read->pts : packet_read->dts;
+		if (packet_ts != AV_NOPTS_VALUE) update_frame_skip_level(packet_ts * time_base + timestamp_offset);
+	}
 	
-	AVFrame *cur_frame = video_tmp_frames.get_next_pushed();
+	AVFrame *cur_frame = *video_tmp_frames.get_next_pushed();
 	
 	ffmpeg_result = avcodec_send_packet(decoder_context[VIDEO], packet_read);
 	if(ffmpeg_result == 0) {
+		video_frames_held = true;
 		ffmpeg_result = avcodec_receive_frame(decoder_context[VIDEO], cur_frame);
-		if(ffmpeg_result == 0) {
+		// no frame yet : discarded by the frame skipping, or still in the pipeline (frame threads warming up after init or seek, reordering)
+		if (ffmpeg_result == AVERROR(EAGAIN)) {
+			if (frame_skip_level) skipped_frame_num++;
+		} else if(ffmpeg_result == 0) {
 			*width = cur_frame->width;
 			*height = cur_frame->height;
 			double time_base = av_q2d(get_stream(VIDEO)->time_base);
@@ -638,37 +1271,68 @@ Result_with_string NetworkDecoder::decode_video(int *width, int *height, bool *k
 		goto fail;
 	}
 	
-	av_packet_free(&packet_read);
-	packet_buffer[VIDEO].pop_front();
-	// refill the packet buffer
-	while (!packet_buffer[VIDEO].size() && read_packet(video_audio_seperate ? VIDEO : BOTH).code == 0);
+	pop_packet(VIDEO);
+	refill_packet_buffer(VIDEO);
 	
 	return result;
 	
 	fail:
 	
-	av_packet_free(&packet_read);
-	packet_buffer[VIDEO].pop_front();
-	// refill the packet buffer
-	while (!packet_buffer[VIDEO].size() && read_packet(video_audio_seperate ? VIDEO : BOTH).code == 0);
+	pop_packet(VIDEO);
+	refill_packet_buffer(VIDEO);
 	
 	result.code = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS;
 	result.string = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS_STR;
 	return result;
 }
+// the end of the video stream : gives the frames the software decoder still holds one by one, then flushes it so that it can take packets again
+// (the next fragment of a livestream), returns no frame (width 0) once it's empty
+Result_with_string NetworkDecoder::drain_video(int *width, int *height, bool *key_frame, double *cur_pos) {
+	Result_with_string result;
+	*width = 0;
+	*height = 0;
+	*key_frame = false;
+	if (hw_decoder_enabled || !video_frames_held) return result;
+	if (video_tmp_frames.full()) {
+		result.code = DEF_ERR_NEED_MORE_OUTPUT;
+		return result;
+	}
+	if (!video_draining) {
+		avcodec_send_packet(decoder_context[VIDEO], NULL);
+		video_draining = true;
+	}
+	AVFrame *cur_frame = *video_tmp_frames.get_next_pushed();
+	int ffmpeg_result = avcodec_receive_frame(decoder_context[VIDEO], cur_frame);
+	if (ffmpeg_result == 0) {
+		*width = cur_frame->width;
+		*height = cur_frame->height;
+		double time_base = av_q2d(get_stream(VIDEO)->time_base);
+		if (cur_frame->pts != AV_NOPTS_VALUE) *cur_pos = cur_frame->pts * time_base;
+		else *cur_pos = cur_frame->pkt_dts * time_base;
+		*cur_pos += timestamp_offset;
+		video_tmp_frames.push();
+		return result;
+	}
+	if (ffmpeg_result != AVERROR_EOF) Util_log_save("dec", "draining the video decoder failed", ffmpeg_result);
+	avcodec_flush_buffers(decoder_context[VIDEO]);
+	video_frames_held = video_draining = false;
+	return result;
+}
 Result_with_string NetworkDecoder::decode_audio(int *size, u8 **data, double *cur_pos) {
+	TRACE_ZONE("decode_audio");
 	int ffmpeg_result = 0;
 	Result_with_string result;
 	*size = 0;
 	
-	AVPacket *packet_read = packet_buffer[AUDIO][0];
+	AVPacket *packet_read = peek_packet(AUDIO);
 	
 	double time_base = av_q2d(get_stream(AUDIO)->time_base);
 	if (packet_read->pts != AV_NOPTS_VALUE) *cur_pos = packet_read->pts * time_base;
 	else *cur_pos = packet_read->dts * time_base;
 	*cur_pos += timestamp_offset;
 	
-	AVFrame *cur_frame = av_frame_alloc();
+	if (!audio_frame) audio_frame = av_frame_alloc();
+	AVFrame *cur_frame = audio_frame;
 	if (!cur_frame) {
 		result.error_description = "av_frame_alloc() failed";
 		goto fail;
@@ -678,8 +1342,28 @@ Result_with_string NetworkDecoder::decode_audio(int *size, u8 **data, double *cu
 	if(ffmpeg_result == 0) {
 		ffmpeg_result = avcodec_receive_frame(decoder_context[AUDIO], cur_frame);
 		if(ffmpeg_result == 0) {
-			*data = (u8 *) malloc(cur_frame->nb_samples * 2 * decoder_context[AUDIO]->channels);
-			*size = swr_convert(swr_context, data, cur_frame->nb_samples, (const u8 **) cur_frame->data, cur_frame->nb_samples);
+			// the resampler may output a few more samples than the ratio suggests, from what it held back the last time
+			int out_samples = swr_get_out_samples(swr_context, cur_frame->nb_samples);
+			int needed_size = out_samples * 2 * audio_output_ch;
+			if (out_samples < 0 || needed_size > AUDIO_BUFFER_SIZE) {
+				result.error_description = "audio frame too large : " + std::to_string(cur_frame->nb_samples) + " samples";
+				goto fail;
+			}
+			*data = get_audio_buffer(needed_size);
+			if (!*data) {
+				result.error_description = "linearAlloc() failed";
+				goto fail;
+			}
+			double resample_start = platform_get_time_ms();
+			*size = swr_convert(swr_context, data, out_samples, (const u8 **) cur_frame->data, cur_frame->nb_samples);
+			audio_resample_time = platform_get_time_ms() - resample_start;
+			if (*size < 0) {
+				result.error_description = "swr_convert() failed " + std::to_string(*size);
+				free_audio_buffer(*data);
+				*data = NULL;
+				*size = 0;
+				goto fail;
+			}
 			*size *= 2;
 		} else {
 			result.error_description = "avcodec_receive_frame() failed " + std::to_string(ffmpeg_result);
@@ -690,24 +1374,51 @@ Result_with_string NetworkDecoder::decode_audio(int *size, u8 **data, double *cu
 		goto fail;
 	}
 
-	av_packet_free(&packet_read);
-	packet_buffer[AUDIO].pop_front();
-	while (!packet_buffer[AUDIO].size() && read_packet(video_audio_seperate ? AUDIO : BOTH).code == 0);
-	av_frame_free(&cur_frame);
+	pop_packet(AUDIO);
+	refill_packet_buffer(AUDIO);
+	av_frame_unref(cur_frame);
 	return result;
 	
 	fail:
 	
-	av_packet_free(&packet_read);
-	packet_buffer[AUDIO].pop_front();
-	while (!packet_buffer[AUDIO].size() && read_packet(video_audio_seperate ? AUDIO : BOTH).code == 0);
-	av_frame_free(&cur_frame);
+	pop_packet(AUDIO);
+	refill_packet_buffer(AUDIO);
+	if (cur_frame) av_frame_unref(cur_frame);
 	result.code = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS;
 	result.string = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS_STR;
 	return result;
 }
 
-Result_with_string NetworkDecoder::get_decoded_video_frame(int width, int height, u8** data, double *cur_pos) {
+bool NetworkDecoder::wait_for_decoded_video_frame(s64 timeout_ns) {
+	if (hw_decoder_enabled) return video_mvd_tmp_frames.wait_not_empty(timeout_ns);
+	else return video_tmp_frames.wait_not_empty(timeout_ns);
+}
+bool NetworkDecoder::wait_for_video_output_space(s64 timeout_ns) {
+	if (hw_decoder_enabled) return video_mvd_tmp_frames.wait_not_full(timeout_ns);
+	else return video_tmp_frames.wait_not_full(timeout_ns);
+}
+u8 *NetworkDecoder::get_audio_buffer(int size) {
+	if (!audio_buffer_slot_size) {
+		int frame_size = decoder_context[AUDIO]->frame_size; // 0 if variable
+		audio_buffer_slot_size = frame_size > 0 ? std::min(frame_size * 2 * decoder_context[AUDIO]->channels, AUDIO_BUFFER_SIZE) : AUDIO_BUFFER_SIZE;
+		audio_buffer_arena = (u8 *) linearAlloc_concurrent(AUDIO_BUFFER_NUM * audio_buffer_slot_size, MemoryTag::DECODER);
+		if (audio_buffer_arena) for (int i = AUDIO_BUFFER_NUM - 1; i >= 0; i--) audio_buffer_free_slots.push_back(i);
+		else Util_log_save("decoder", "failed to allocate the audio buffers, falling back to individual allocation");
+	}
+	if (size <= audio_buffer_slot_size && audio_buffer_free_slots.size()) {
+		int slot = audio_buffer_free_slots.back();
+		audio_buffer_free_slots.pop_back();
+		return audio_buffer_arena + slot * audio_buffer_slot_size;
+	}
+	return (u8 *) linearAlloc_concurrent(size, MemoryTag::DECODER); // an unusually large frame or the arena is used up
+}
+void NetworkDecoder::free_audio_buffer(u8 *buffer) {
+	if (!buffer) return;
+	if (audio_buffer_arena && buffer >= audio_buffer_arena && buffer < audio_buffer_arena + AUDIO_BUFFER_NUM * audio_buffer_slot_size)
+		audio_buffer_free_slots.push_back((buffer - audio_buffer_arena) / audio_buffer_slot_size);
+	else linearFree_concurrent(buffer, MemoryTag::DECODER);
+}
+Result_with_string NetworkDecoder::get_decoded_video_frame(int width, int height, u8** data, double *cur_pos, int *frame_width, int *frame_height) {
 	Result_with_string result;
 	
 	if (hw_decoder_enabled) {
@@ -715,26 +1426,22 @@ Result_with_string NetworkDecoder::get_decoded_video_frame(int width, int height
 			result.code = DEF_ERR_NEED_MORE_INPUT;
 			return result;
 		}
-		*data = video_mvd_tmp_frames.get_next_poped(); // it's valid until the next pop() is called
+		MvdFrame *frame = video_mvd_tmp_frames.get_next_poped();
+		*data = frame->data; // it's valid until the next pop() is called
+		*cur_pos = frame->pts;
+		if (frame_width) *frame_width = frame->width;
+		if (frame_height) *frame_height = frame->height;
 		video_mvd_tmp_frames.pop();
-		
-		svcWaitSynchronization(buffered_pts_list_lock, std::numeric_limits<s64>::max());
-		if (!buffered_pts_list.size()) {
-			Util_log_save("decoder", "SET EMPTY");
-		} else {
-			*cur_pos = *buffered_pts_list.begin();
-			buffered_pts_list.erase(buffered_pts_list.begin());
-		}
-		svcReleaseMutex(buffered_pts_list_lock);
 		return result;
 	} else {
 		if (video_tmp_frames.empty()) {
 			result.code = DEF_ERR_NEED_MORE_INPUT;
 			return result;
 		}
-		AVFrame *cur_frame = video_tmp_frames.get_next_poped();
+		AVFrame *cur_frame = *video_tmp_frames.get_next_poped();
 		video_tmp_frames.pop();
-		
+		if (frame_width) *frame_width = width;
+		if (frame_height) *frame_height = height;
 		
 		int cpy_size[2] = { 0, 0, };
 
@@ -759,11 +1466,67 @@ Result_with_string NetworkDecoder::get_decoded_video_frame(int width, int height
 	}
 }
 
+// tells the downloader to fetch the block of the indexed position at or before `time` right away, before the demuxer gets there
+// returns the time of the position used, or `time` itself if the stream has no index
+double NetworkDecoder::prefetch_seek_target(int type, double time) {
+	auto &index = seek_index[type];
+	NetworkStream *stream = network_stream[video_audio_seperate ? type : BOTH];
+	if (!index.size() || !stream) return time;
+	auto itr = std::upper_bound(index.begin(), index.end(), time, [] (double time, const SeekIndexEntry &entry) { return time < entry.time; });
+	if (itr != index.begin()) itr--;
+	stream->record_seek(itr->pos);
+	stream->prefetch_target = itr->pos;
+	stream->notify_downloader();
+	return itr->time;
+}
+bool NetworkDecoder::seek_within_queue(s64 microseconds) {
+	if (audio_only) return false;
+	double target = microseconds / 1000000.0;
+	double video_time_base = av_q2d(get_stream(VIDEO)->time_base);
+	double audio_time_base = av_q2d(get_stream(AUDIO)->time_base);
+	
+	packet_buffer_lock.lock();
+	int keyframe = -1;
+	double keyframe_time = 0;
+	for (size_t i = 0; i < packet_buffer[VIDEO].size(); i++) {
+		AVPacket *packet = packet_buffer[VIDEO][i];
+		double time = (packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) * video_time_base;
+		if (time > target) break;
+		if (packet->flags & AV_PKT_FLAG_KEY) {
+			keyframe = i;
+			keyframe_time = time;
+		}
+	}
+	packet_buffer_lock.unlock();
+	if (keyframe < 0 || target - keyframe_time > SEEK_IN_QUEUE_MAX_KEYFRAME_DISTANCE) return false;
+	
+	for (int i = 0; i < keyframe; i++) pop_packet(VIDEO);
+	// the audio resumes at the key frame, as seek() does it
+	while (true) {
+		AVPacket *packet = peek_packet(AUDIO);
+		if (!packet) {
+			refill_packet_buffer(AUDIO);
+			if (!(packet = peek_packet(AUDIO))) break;
+		}
+		if ((packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts) * audio_time_base >= keyframe_time) break;
+		pop_packet(AUDIO);
+	}
+	video_mvd_tmp_frames.clear();
+	video_tmp_frames.clear();
+	mvd_pending_pts_num = 0;
+	flush_codecs();
+	Util_log_save("decoder", "seek served from the packet queue, key frame at " + std::to_string(keyframe_time));
+	return true;
+}
 Result_with_string NetworkDecoder::seek(s64 microseconds) {
 	Result_with_string result;
 	
 	clear_buffer();
 	
+	// let the downloader fetch the target of both streams in parallel while the demuxer is still looking for it
+	double keyframe_time = prefetch_seek_target(VIDEO, microseconds / 1000000.0);
+	if (video_audio_seperate) prefetch_seek_target(AUDIO, keyframe_time);
+	
 	if (video_audio_seperate) {
 		int ffmpeg_result = avformat_seek_file(format_context[VIDEO], -1, microseconds - 1000000, microseconds, microseconds + 1000000, AVSEEK_FLAG_FRAME); // AVSEEK_FLAG_FRAME <- ?
 		if(ffmpeg_result < 0) {
@@ -773,14 +1536,16 @@ Result_with_string NetworkDecoder::seek(s64 microseconds) {
 			return result;
 		}
 		avcodec_flush_buffers(decoder_context[VIDEO]);
+		video_frames_held = video_draining = false;
 		// refill the next packets
 		result = read_packet(VIDEO);
 		if (result.code != 0) return result;
 		
 		// once successfully sought on video, perform an exact seek on audio
 		double time_base = av_q2d(get_stream(VIDEO)->time_base);
-		if (packet_buffer[VIDEO][0]->pts != AV_NOPTS_VALUE) microseconds = packet_buffer[VIDEO][0]->pts * time_base * 1000000;
-		else microseconds = packet_buffer[VIDEO][0]->dts * time_base * 1000000;
+		AVPacket *first_packet = peek_packet(VIDEO);
+		if (first_packet->pts != AV_NOPTS_VALUE) microseconds = first_packet->pts * time_base * 1000000;
+		else microseconds = first_packet->dts * time_base * 1000000;
 		
 		ffmpeg_result = avformat_seek_file(format_context[AUDIO], -1, microseconds, microseconds, microseconds, AVSEEK_FLAG_FRAME); // AVSEEK_FLAG_FRAME <- ???
 		if(ffmpeg_result < 0) {
@@ -803,7 +1568,8 @@ Result_with_string NetworkDecoder::seek(s64 microseconds) {
 		}
 		if (!audio_only) avcodec_flush_buffers(decoder_context[VIDEO]);
 		avcodec_flush_buffers(decoder_context[AUDIO]);
-		while ((!audio_only && !packet_buffer[VIDEO].size()) || !packet_buffer[AUDIO].size()) {
+		video_frames_held = video_draining = false;
+		while ((!audio_only && !get_queued_packet_num(VIDEO)) || !get_queued_packet_num(AUDIO)) {
 			result = read_packet(BOTH);
 			if (result.code != 0) return result;
 		}
@@ -1,5 +1,10 @@
 #include "network/network_decoder_multiple.hpp"
 #include "headers.hpp"
+#include "network/stream_disk_cache.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/metrics.hpp"
+
+#define AUDIO_OUTPUT_LOW_SAMPLE_RATE 32000 // close to the native rate of the DSP (32728 Hz), see var_audio_output_mode
 
 NetworkMultipleDecoder::NetworkMultipleDecoder() {
 	svcCreateMutex(&fragments_lock, false);
@@ -10,14 +15,20 @@ void NetworkMultipleDecoder::deinit() {
 	
 	inited = false;
 	
+	decoder.video_demux_enabled = false;
+	decoder.pause_video_demux();
 	decoder.deinit();
-	for (auto &i : fragments) i.second.deinit(true);
-	fragments.clear();
-	if (video_audio_seperate) {
-		video_session_list.close_sessions();
-		audio_session_list.close_sessions();
-	} else both_session_list.close_sessions();
-	if (mvd_inited) {
+	decoder.resume_video_demux();
+	while (fragments.size()) erase_fragment(fragments.begin()->first);
+	shared_codecs.deinit(false);
+	memory_budget_add(MemoryBudgetUser::LIVESTREAM_FRAGMENTS, -(s64) shared_codecs_memory);
+	shared_codecs_memory = 0;
+	cancel_prefetched_fragments(true);
+	// the next video is most likely going to use the hardware decoder right away, which spares its (slow) init
+	preopen_lock.lock();
+	bool keep_mvd = has_preopened && preopened_hw_decoder;
+	preopen_lock.unlock();
+	if (mvd_inited && !keep_mvd) {
 		mvdstdExit();
 		mvd_inited = false;
 	}
@@ -39,6 +50,14 @@ void NetworkMultipleDecoder::init_mvd() {
 		else mvd_inited = true;
 	}
 }
+// 4 blocks of audio-only streams are a minute or two, so the wifi is used only for a few seconds in that time
+#define BURST_REQUEST_BLOCKS 4
+#define BURST_FORWARD_READ_BLOCKS 48 // 6 MB, usually the whole audio stream
+static void set_burst_download(NetworkStream *stream) {
+	stream->sizing.min_request_block_num = BURST_REQUEST_BLOCKS;
+	stream->sizing.request_block_num = BURST_REQUEST_BLOCKS;
+	stream->max_forward_read_blocks = BURST_FORWARD_READ_BLOCKS;
+}
 Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::string audio_url, NetworkStreamDownloader &downloader, int fragment_len,
 	bool adjust_timestamp, bool request_hw_decoder) {
 	
@@ -69,6 +88,9 @@ Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::stri
 	this->adjust_timestamp = adjust_timestamp;
 	
 	if (request_hw_decoder) init_mvd();
+	decoder.sw_decoder_thread_num = request_hw_decoder ? 1 : var_video_sw_decoder_threads; // the MVD path doesn't decode with FFmpeg
+	decoder.audio_output_max_sample_rate = var_audio_output_mode != 0 ? AUDIO_OUTPUT_LOW_SAMPLE_RATE : 0;
+	decoder.audio_output_mono = var_audio_output_mode == 2;
 	
 	auto get_base_url = [&] (const std::string &url) {
 		auto erase_start = url.find("&sq=");
@@ -82,9 +104,33 @@ Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::stri
 	int fragment_id = 0;
 	NetworkDecoderFFmpegData tmp_ffmpeg_data;
 	std::vector<NetworkStream *> streams;
-	if (video_audio_seperate) {
+	bool preopened_taken = false;
+	if (!is_livestream) {
+		preopen_lock.lock();
+		// being opened right now : waiting for it is still faster than starting over
+		while (preopening_streams.size() && preopened_video_url == video_url && preopened_audio_url == audio_url) {
+			preopen_lock.unlock();
+			usleep(10000);
+			preopen_lock.lock();
+		}
+		abort_preopening();
+		preopened_taken = take_preopened(video_url, audio_url, request_hw_decoder, tmp_ffmpeg_data, streams);
+		preopen_lock.unlock();
+	}
+	if (preopened_taken) {
+		Util_log_save("net/mul-dec", "using the preopened streams");
+		decoder.interrupt = false;
+	} else if (video_audio_seperate) {
 		NetworkStream *video_stream = new NetworkStream(video_url + url_append, is_livestream, &video_session_list);
 		NetworkStream *audio_stream = new NetworkStream(audio_url + url_append, is_livestream, &audio_session_list);
+		if (!is_livestream) {
+			video_stream->disk_cache_key = stream_disk_cache_make_key(disk_cache_id, video_url);
+			audio_stream->disk_cache_key = stream_disk_cache_make_key(disk_cache_id, audio_url);
+			if (burst_download) {
+				set_burst_download(video_stream);
+				set_burst_download(audio_stream);
+			}
+		}
 		streams = {video_stream, audio_stream};
 		downloader.add_stream(video_stream);
 		downloader.add_stream(audio_stream);
@@ -97,6 +143,8 @@ Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::stri
 		audio_url = get_base_url(audio_stream->url);
 	} else {
 		NetworkStream *both_stream = new NetworkStream(both_url + url_append, is_livestream, &both_session_list);
+		if (!is_livestream) both_stream->disk_cache_key = stream_disk_cache_make_key(disk_cache_id, both_url);
+		if (!is_livestream && burst_download) set_burst_download(both_stream);
 		streams = { both_stream };
 		downloader.add_stream(both_stream);
 		decoder.interrupt = false;
@@ -107,7 +155,12 @@ Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::stri
 		both_url = get_base_url(both_stream->url);
 	}
 	if (result.code != 0) goto cleanup;
-	fragments[fragment_id] = tmp_ffmpeg_data;
+	if (is_livestream) {
+		shared_codecs.take_codecs(tmp_ffmpeg_data);
+		shared_codecs_memory = shared_codecs.get_memory_usage();
+		memory_budget_add(MemoryBudgetUser::LIVESTREAM_FRAGMENTS, shared_codecs_memory);
+	}
+	add_fragment(fragment_id, tmp_ffmpeg_data);
 	result = decoder.change_ffmpeg_data(fragments[fragment_id], adjust_timestamp ? fragment_id * fragment_len : 0);
 	if (result.code != 0) goto cleanup;
 	result = decoder.init(request_hw_decoder);
@@ -134,6 +187,146 @@ Result_with_string NetworkMultipleDecoder::init(std::string video_url, std::stri
 Result_with_string NetworkMultipleDecoder::init(std::string both_url, NetworkStreamDownloader &downloader, int fragment_len, bool adjust_timestamp, bool request_hw_decoder) {
 	return init(both_url, both_url, downloader, fragment_len, adjust_timestamp, request_hw_decoder);
 }
+Result_with_string NetworkMultipleDecoder::change_video(std::string video_url, bool request_hw_decoder, double pos) {
+	Result_with_string result;
+	if (!can_decode_concurrently() || !fragments.count((int) seq_using)) {
+		result.code = DEF_ERR_OTHER;
+		result.string = DEF_ERR_OTHER_STR;
+		result.error_description = "the video stream can't be replaced alone";
+		return result;
+	}
+	
+	if (request_hw_decoder) init_mvd();
+	decoder.sw_decoder_thread_num = request_hw_decoder ? 1 : var_video_sw_decoder_threads;
+	
+	NetworkStream *video_stream = new NetworkStream(video_url, false, &video_session_list);
+	video_stream->disk_cache_key = stream_disk_cache_make_key(disk_cache_id, video_url);
+	downloader->add_stream(video_stream);
+	decoder.interrupt = false;
+	
+	NetworkDecoderFFmpegData &cur_data = fragments[(int) seq_using];
+	NetworkDecoderFFmpegData new_data = cur_data;
+	result = new_data.init_video(video_stream);
+	if (result.code != 0) {
+		new_data.deinit_video();
+		return result;
+	}
+	decoder.pause_video_demux(); // the demux thread may be reading the old video stream
+	result = decoder.change_video_stream(new_data, request_hw_decoder);
+	cur_data.deinit_video();
+	cur_data = new_data;
+	this->video_url = video_url;
+	if (result.code == 0) result = decoder.seek_video(pos * 1000000);
+	decoder.resume_video_demux();
+	return result;
+}
+
+void NetworkMultipleDecoder::abort_preopening() {
+	// the reads of preopen() fail right away, then it frees everything itself
+	for (auto stream : preopening_streams) {
+		stream->error = true;
+		stream->data_arrival_event.signal();
+	}
+	preopening_streams.clear();
+}
+void NetworkMultipleDecoder::discard_preopened() {
+	if (!has_preopened) return;
+	preopened.deinit(true);
+	preopened = NetworkDecoderFFmpegData();
+	has_preopened = false;
+}
+bool NetworkMultipleDecoder::take_preopened(const std::string &video_url, const std::string &audio_url, bool request_hw_decoder,
+	NetworkDecoderFFmpegData &data, std::vector<NetworkStream *> &streams) {
+	
+	if (!has_preopened) return false;
+	if (preopened_video_url != video_url || preopened_audio_url != audio_url || preopened_hw_decoder != request_hw_decoder ||
+		preopened_disk_cache_id != disk_cache_id || preopened_burst_download != burst_download) {
+		Util_log_save("net/mul-dec", "discarding the preopened streams of another video");
+		discard_preopened();
+		return false;
+	}
+	data = preopened;
+	preopened = NetworkDecoderFFmpegData();
+	has_preopened = false;
+	streams = {data.network_stream[0]};
+	if (data.video_audio_seperate) streams.push_back(data.network_stream[1]);
+	for (auto stream : streams) stream->disable_interrupt = false;
+	return true;
+}
+Result_with_string NetworkMultipleDecoder::preopen(std::string video_url, std::string audio_url, NetworkStreamDownloader &downloader, bool request_hw_decoder,
+	std::string disk_cache_id, bool burst_download) {
+	
+	Result_with_string result;
+	// the decoder contexts are created with the settings of the current video
+	if (decoder.sw_decoder_thread_num != (request_hw_decoder ? 1 : var_video_sw_decoder_threads) ||
+		decoder.audio_output_max_sample_rate != (var_audio_output_mode != 0 ? AUDIO_OUTPUT_LOW_SAMPLE_RATE : 0) ||
+		decoder.audio_output_mono != (var_audio_output_mode == 2)) {
+		result.code = DEF_ERR_OTHER;
+		result.string = DEF_ERR_OTHER_STR;
+		result.error_description = "the decoder settings differ from the current video";
+		return result;
+	}
+	
+	preopen_lock.lock();
+	if ((has_preopened || preopening_streams.size()) && preopened_video_url == video_url && preopened_audio_url == audio_url) {
+		preopen_lock.unlock();
+		return result; // already done or being done
+	}
+	discard_preopened();
+	abort_preopening(); // for another video
+	bool seperate = video_url != audio_url;
+	std::vector<NetworkStream *> streams;
+	if (seperate) {
+		if (!video_session_list.inited) video_session_list.init();
+		if (!audio_session_list.inited) audio_session_list.init();
+		streams.push_back(new NetworkStream(video_url, false, &video_session_list));
+		streams.push_back(new NetworkStream(audio_url, false, &audio_session_list));
+	} else {
+		if (!both_session_list.inited) both_session_list.init();
+		streams.push_back(new NetworkStream(video_url, false, &both_session_list));
+	}
+	for (size_t i = 0; i < streams.size(); i++) {
+		streams[i]->disk_cache_key = stream_disk_cache_make_key(disk_cache_id, i ? audio_url : video_url);
+		if (burst_download) set_burst_download(streams[i]);
+		streams[i]->disable_interrupt = true; // the interruptions are for the current playback
+		downloader.add_stream(streams[i]);
+	}
+	preopening_streams = streams;
+	preopened_video_url = video_url;
+	preopened_audio_url = audio_url;
+	preopened_hw_decoder = request_hw_decoder;
+	preopened_disk_cache_id = disk_cache_id;
+	preopened_burst_download = burst_download;
+	preopen_lock.unlock();
+	
+	NetworkDecoderFFmpegData data;
+	if (seperate) result = data.init(streams[0], streams[1], &decoder);
+	else result = data.init(streams[0], &decoder);
+	
+	preopen_lock.lock();
+	bool cancelled = preopening_streams != streams;
+	if (!cancelled) preopening_streams.clear();
+	if (result.code == 0 && !cancelled) {
+		preopened = data;
+		has_preopened = true;
+	} else {
+		data.deinit(false);
+		for (auto stream : streams) stream->quit_request = true;
+		if (result.code == 0) {
+			result.code = DEF_ERR_OTHER;
+			result.string = DEF_ERR_OTHER_STR;
+			result.error_description = "cancelled";
+		}
+	}
+	preopen_lock.unlock();
+	return result;
+}
+void NetworkMultipleDecoder::cancel_preopen() {
+	preopen_lock.lock();
+	discard_preopened();
+	abort_preopening();
+	preopen_lock.unlock();
+}
 
 NetworkMultipleDecoder::DecodeType NetworkMultipleDecoder::next_decode_type() {
 	DecodeType res = decoder.next_decode_type();
@@ -179,19 +372,23 @@ Result_with_string NetworkMultipleDecoder::seek(s64 microseconds) {
 	Result_with_string result;
 	if (need_reinit) { // the initer function should be stopped
 		need_reinit = false;
+		metrics_add(Metric::DECODER_REINITS);
 		result = fragments[(int) seq_using].reinit();
 		if (result.code != 0) {
-			fragments[(int) seq_using].deinit(true);
-			fragments.erase((int) seq_using);
+			erase_fragment((int) seq_using);
 			return result;
 		}
 	}
 	if (is_livestream) {
-		int next_fragment = 0;
-		if (microseconds / 1000000 > duration_first_fragment)
-			next_fragment = (int) ((microseconds / 1000000 - duration_first_fragment) / fragment_len);
-		next_fragment = std::min(next_fragment, (int) seq_head); // just to be safe
+		int next_fragment = get_fragment_at(microseconds / 1000000.0);
+		next_fragment = std::max(get_dvr_window_start(), std::min(next_fragment, (int) seq_head));
+		svcWaitSynchronization(fragments_lock, std::numeric_limits<s64>::max());
 		seq_using = next_fragment;
+		// start downloading the target fragments now, the initer may still be busy with a fragment around the old position
+		int prefetch_end = std::min<int>({next_fragment + LIVESTREAM_PREFETCH_FRAGMENTS_NUM, next_fragment + get_max_fragments_ahead(), seq_num, seq_head + 1});
+		for (int seq = next_fragment; seq < prefetch_end; seq++)
+			if (!fragments.count(seq) && !prefetched_fragments.count(seq)) prefetch_fragment(seq);
+		svcReleaseMutex(fragments_lock);
 		while (!initer_exit_request && !decoder.interrupt) {
 			svcWaitSynchronization(fragments_lock, std::numeric_limits<s64>::max());
 			if (fragments.count((int) seq_using)) break;
@@ -206,16 +403,86 @@ Result_with_string NetworkMultipleDecoder::seek(s64 microseconds) {
 		recalc_buffered_head();
 		decoder.clear_buffer();
 		decoder.change_ffmpeg_data(fragments[(int) seq_using], adjust_timestamp ? seq_using * fragment_len : 0);
+		decoder.flush_codecs();
 		svcReleaseMutex(fragments_lock);
 	} else {
-		decoder.clear_buffer();
-		decoder.change_ffmpeg_data(fragments[(int) seq_using], adjust_timestamp ? seq_using * fragment_len : 0);
 		// trying to seek to a point too close to the end somehow causes ffmpeg to read the entire stream again ?
 		microseconds = std::max(0.0, std::min((double) microseconds, (get_duration() - 2) * 1000000));
-		result = decoder.seek(microseconds);
+		decoder.pause_video_demux();
+		if (!decoder.seek_within_queue(microseconds)) {
+			decoder.clear_buffer();
+			decoder.change_ffmpeg_data(fragments[(int) seq_using], adjust_timestamp ? seq_using * fragment_len : 0);
+			result = decoder.seek(microseconds);
+		}
+		decoder.resume_video_demux();
 	}
 	return result;
 }
+void NetworkMultipleDecoder::add_fragment(int seq, const NetworkDecoderFFmpegData &data) {
+	fragments[seq] = data;
+	u64 memory = fragments[seq].get_memory_usage();
+	fragment_memory[seq] = memory;
+	memory_budget_add(MemoryBudgetUser::LIVESTREAM_FRAGMENTS, memory);
+}
+void NetworkMultipleDecoder::erase_fragment(int seq) {
+	fragments[seq].deinit(true);
+	fragments.erase(seq);
+	memory_budget_add(MemoryBudgetUser::LIVESTREAM_FRAGMENTS, -(s64) fragment_memory[seq]);
+	fragment_memory.erase(seq);
+}
+void NetworkMultipleDecoder::evict_fragments() {
+	while (fragments.size()) {
+		bool over_num = fragments.size() > MAX_CACHE_FRAGMENTS_NUM;
+		bool over_budget = !over_num && fragments.size() > MIN_CACHE_FRAGMENTS_NUM && memory_budget_is_over();
+		if (!over_num && !over_budget) break;
+		int seq = fragments.begin()->first < seq_using ? fragments.begin()->first : std::prev(fragments.end())->first;
+		if (over_budget && seq >= seq_using && seq < seq_using + MIN_CACHE_FRAGMENTS_NUM) break; // needed to keep playing
+		erase_fragment(seq);
+	}
+}
+void NetworkMultipleDecoder::prefetch_fragment(int seq) {
+	std::vector<NetworkStream *> streams;
+	if (video_audio_seperate) {
+		streams.push_back(new NetworkStream(video_url + "&sq=" + std::to_string(seq), is_livestream, is_livestream ? &video_session_list : NULL));
+		streams.push_back(new NetworkStream(audio_url + "&sq=" + std::to_string(seq), is_livestream, is_livestream ? &audio_session_list : NULL));
+	} else streams.push_back(new NetworkStream(both_url + "&sq=" + std::to_string(seq), is_livestream, is_livestream ? &both_session_list : NULL));
+	for (auto stream : streams) {
+		stream->disable_interrupt = true;
+		downloader->add_stream(stream);
+	}
+	prefetched_fragments[seq] = streams;
+}
+void NetworkMultipleDecoder::cancel_prefetched_fragments(bool all) {
+	int cancelled_num = 0;
+	for (auto itr = prefetched_fragments.begin(); itr != prefetched_fragments.end(); ) {
+		int seq = itr->first;
+		if (all || seq < seq_using || seq >= seq_using + get_max_fragments_ahead() || seq >= seq_num) {
+			for (auto stream : itr->second) stream->quit_request = true;
+			itr = prefetched_fragments.erase(itr);
+			cancelled_num++;
+		} else itr++;
+	}
+	if (cancelled_num && !all) Util_log_save("net/live-init", "cancelled " + std::to_string(cancelled_num) + " prefetched fragments");
+}
+#define HEAD_POLL_INTERVAL_MS 2000
+void NetworkMultipleDecoder::poll_live_head() {
+	double cur_time = svcGetSystemTick() / CPU_TICKS_PER_MSEC;
+	if (cur_time - last_head_poll_time < std::min(HEAD_POLL_INTERVAL_MS, fragment_len * 1000)) return;
+	last_head_poll_time = cur_time;
+	
+	if (!head_poll_session_list.inited) head_poll_session_list.init();
+	// the audio one is the smaller if they are separate, only the headers matter anyway
+	std::string url = (video_audio_seperate ? audio_url : both_url) + "&sq=" + std::to_string(seq_head);
+	NetworkTrafficClassScope traffic_class_scope(NetworkTrafficClass::PLAYBACK);
+	auto result = Access_http_get(head_poll_session_list, url, {{"Range", "bytes=0-0"}});
+	if (!result.fail && result.status_code_is_success()) {
+		char *end;
+		auto value = result.get_header("x-head-seqnum");
+		int new_seq_head = strtoll(value.c_str(), &end, 10);
+		if (!*end && value.size() && new_seq_head > seq_head) seq_head = new_seq_head;
+	} else Util_log_save("net/live-init", "head poll failed : " + result.error);
+	result.finalize();
+}
 void NetworkMultipleDecoder::livestream_initer_thread_func() {
 	while (!initer_exit_request) {
 		while (initer_stop_request && !initer_exit_request) {
@@ -230,23 +497,34 @@ void NetworkMultipleDecoder::livestream_initer_thread_func() {
 			continue;
 		}
 		
+		svcWaitSynchronization(fragments_lock, std::numeric_limits<s64>::max());
+		cancel_prefetched_fragments(false); // seq_using may have jumped by a seek
 		int seq_next = seq_using;
 		while (fragments.count(seq_next)) seq_next++;
-		if (seq_next - seq_using >= MAX_CACHE_FRAGMENTS_NUM || seq_next >= seq_num) {
+		if (seq_next - seq_using >= get_max_fragments_ahead() || seq_next >= seq_num ||
+			(seq_next - seq_using >= MIN_CACHE_FRAGMENTS_NUM && memory_budget_is_over())) {
+			svcReleaseMutex(fragments_lock);
+			if (low_latency && seq_next < seq_num) poll_live_head();
 			usleep(10000);
 			continue;
 		}
 		Util_log_save("net/live-init", "next : " + std::to_string(seq_next));
 		
+		// the following fragments are downloaded while this one is being inited, as the init waits for the whole fragment
+		int prefetch_end = std::min<int>({seq_next + LIVESTREAM_PREFETCH_FRAGMENTS_NUM, seq_using + get_max_fragments_ahead(), seq_num, seq_head + 2});
+		for (int seq = seq_next + 1; seq < prefetch_end; seq++)
+			if (!fragments.count(seq) && !prefetched_fragments.count(seq)) prefetch_fragment(seq);
+		if (!prefetched_fragments.count(seq_next)) prefetch_fragment(seq_next);
+		std::vector<NetworkStream *> streams = prefetched_fragments[seq_next];
+		prefetched_fragments.erase(seq_next);
+		svcReleaseMutex(fragments_lock);
+		
 		NetworkDecoderFFmpegData tmp_ffmpeg_data;
 		if (video_audio_seperate) {
-			NetworkStream *video_stream = new NetworkStream(video_url + "&sq=" + std::to_string(seq_next), is_livestream, is_livestream ? &video_session_list : NULL);
-			NetworkStream *audio_stream = new NetworkStream(audio_url + "&sq=" + std::to_string(seq_next), is_livestream, is_livestream ? &audio_session_list : NULL);
-			video_stream->disable_interrupt = audio_stream->disable_interrupt = true;
-			downloader->add_stream(video_stream);
-			downloader->add_stream(audio_stream);
+			NetworkStream *video_stream = streams[0];
+			NetworkStream *audio_stream = streams[1];
 			
-			Result_with_string result = tmp_ffmpeg_data.init(video_stream, audio_stream, &decoder);
+			Result_with_string result = tmp_ffmpeg_data.init(video_stream, audio_stream, &decoder, &shared_codecs);
 			// Util_log_save("debug", "init finish");
 			if (result.code != 0) {
 				if (video_stream->livestream_eof || audio_stream->livestream_eof) {
@@ -272,10 +550,8 @@ void NetworkMultipleDecoder::livestream_initer_thread_func() {
 				if (video_stream->seq_head != -1) seq_head = video_stream->seq_head;
 			}
 		} else {
-			NetworkStream *both_stream = new NetworkStream(both_url + "&sq=" + std::to_string(seq_next), is_livestream, is_livestream ? &both_session_list : NULL);
-			both_stream->disable_interrupt = true;
-			downloader->add_stream(both_stream);
-			Result_with_string result = tmp_ffmpeg_data.init(both_stream, &decoder);
+			NetworkStream *both_stream = streams[0];
+			Result_with_string result = tmp_ffmpeg_data.init(both_stream, &decoder, &shared_codecs);
 			if (result.code == 0) {
 				if (both_stream->seq_head != -1) seq_head = both_stream->seq_head;
 			} else {
@@ -295,16 +571,8 @@ void NetworkMultipleDecoder::livestream_initer_thread_func() {
 		}
 		
 		svcWaitSynchronization(fragments_lock, std::numeric_limits<s64>::max());
-		fragments[seq_next] = tmp_ffmpeg_data;
-		if (fragments.size() > MAX_CACHE_FRAGMENTS_NUM) {
-			if (fragments.begin()->first < seq_using) {
-				fragments.begin()->second.deinit(true);
-				fragments.erase(fragments.begin());
-			} else {
-				std::prev(fragments.end())->second.deinit(true);
-				fragments.erase(std::prev(fragments.end()));
-			}
-		}
+		add_fragment(seq_next, tmp_ffmpeg_data);
+		evict_fragments();
 		recalc_buffered_head();
 		svcReleaseMutex(fragments_lock);
 		
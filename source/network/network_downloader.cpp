@@ -1,191 +1,318 @@
 #include "headers.hpp"
 #include "network/network_downloader.hpp"
 #include "network/network_io.hpp"
-#include <cassert>
+#include "network/connectivity.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/metrics.hpp"
+#include "network/stream_disk_cache.hpp"
 
+// definitions for constants that are passed by reference (std::min, std::max)
+constexpr u64 NetworkStreamDownloader::BLOCK_SIZE;
+constexpr u64 NetworkStreamDownloader::MAX_PIPELINED_REQUESTS;
+constexpr int NetworkStreamDownloader::MAX_TRANSIENT_RETRIES;
+constexpr u64 NetworkStreamDownloader::RETRY_BACKOFF_MIN_MS;
+constexpr u64 NetworkStreamDownloader::RETRY_BACKOFF_MAX_MS;
 
 // --------------------------------
-// NetworkStream implementation
+// NetworkStreamDownloader implementation
 // --------------------------------
 
-NetworkStream::NetworkStream(std::string url, bool whole_download, NetworkSessionList *session_list) : url(url), whole_download(whole_download), session_list(session_list) {
-	svcCreateMutex(&downloaded_data_lock, false);
+NetworkStreamDownloader::NetworkStreamDownloader() {
+	svcCreateMutex(&streams_lock, false);
+	svcCreateEvent(&wakeup_event, RESET_STICKY);
 }
-bool NetworkStream::is_data_available(u64 start, u64 size) {
-	if (!ready) return false;
-	if (start + size > len) return false;
-	u64 end = start + size - 1;
-	u64 start_block = start / BLOCK_SIZE;
-	u64 end_block = end / BLOCK_SIZE;
-	
-	bool res = true;
-	svcWaitSynchronization(downloaded_data_lock, std::numeric_limits<s64>::max());
-	for (u64 block = start_block; block <= end_block; block++) if (!downloaded_data.count(block)) {
-		res = false;
-		break;
+void NetworkStreamDownloader::add_stream(NetworkStream *stream) {
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	stream->downloader_wakeup_event = wakeup_event;
+	streams.push_back(stream);
+	svcReleaseMutex(streams_lock);
+	svcSignalEvent(wakeup_event);
+}
+std::vector<std::string> NetworkStreamDownloader::get_expired_urls() {
+	std::vector<std::string> res;
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	for (auto stream : streams) if (stream->url_expired && !stream->quit_request && !stream->error) res.push_back(stream->origin_url);
+	svcReleaseMutex(streams_lock);
+	return res;
+}
+void NetworkStreamDownloader::replace_expired_url(const std::string &old_url, const std::string &new_url) {
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	for (auto stream : streams) if (stream->url_expired && stream->origin_url == old_url) {
+		if (new_url != "") {
+			stream->url = stream->origin_url = new_url;
+			stream->transient_failure_num = 0;
+			stream->retry_time = 0;
+		} else stream->error = true;
+		stream->url_expired = false;
+		stream->data_arrival_event.signal(); // let the reader see the error
 	}
-	svcReleaseMutex(downloaded_data_lock);
+	svcReleaseMutex(streams_lock);
+	svcSignalEvent(wakeup_event);
+}
+
+u64 NetworkStreamDownloader::get_forward_read_blocks(NetworkStream *stream) {
+	return download_policy_forward_read_blocks(stream->bitrate, stream->sizing.bandwidth_estimate, stream->max_forward_read_blocks, paused_forward_seconds,
+		memory_budget_is_over(), var_data_saver);
+}
+
+namespace {
+	// the blocks of a NetworkStream as download_policy.hpp sees them, streams_lock must be held (blocks_in_flight)
+	class NetworkStreamBlockMap : public DownloadBlockMap {
+		const NetworkStream *stream;
+	public :
+		explicit NetworkStreamBlockMap (const NetworkStream *stream) : stream(stream) {}
+		u64 find_missing_block(u64 from, u64 limit) const override { return stream->find_missing_block(from, limit); }
+		bool is_block_present(u64 block) const override { return stream->is_block_present(block); }
+		bool is_block_in_flight(u64 block) const override { return stream->blocks_in_flight.count(block); }
+		bool is_block_cached(u64 block) const override {
+			return stream->disk_cache_key != "" && stream_disk_cache_has_block(stream->disk_cache_key, block);
+		}
+	};
+}
+// what download_policy.hpp needs of a ready stream, `blocks` must outlive the result
+static DownloadPolicyStream get_policy_stream(const NetworkStream *stream, const NetworkStreamBlockMap &blocks, u64 read_head, u64 forward_read_blocks) {
+	DownloadPolicyStream res;
+	res.blocks = &blocks;
+	res.len = stream->len;
+	res.block_num = stream->block_num;
+	res.read_head = read_head;
+	res.bitrate = stream->bitrate;
+	res.forward_read_blocks = forward_read_blocks;
+	res.bulk_read_end = stream->bulk_read_end;
+	res.local_file = stream->is_local_file();
 	return res;
 }
-std::vector<u8> NetworkStream::get_data(u64 start, u64 size) {
-	if (!ready) return {};
-	if (!size) return {};
-	u64 end = start + size - 1;
-	u64 start_block = start / BLOCK_SIZE;
-	u64 end_block = end / BLOCK_SIZE;
-	std::vector<u8> res;
+
+bool NetworkStreamDownloader::load_block_from_disk_cache(NetworkStream *stream, u64 block, std::vector<u8> &buffer) {
+	u64 len = stream->ready ? stream->len : stream_disk_cache_get_len(stream->disk_cache_key);
+	if (!len || block * BLOCK_SIZE >= len) return false;
+	u64 size = std::min(BLOCK_SIZE, len - block * BLOCK_SIZE);
+	if (buffer.size() < BLOCK_SIZE) buffer.resize(BLOCK_SIZE);
+	if (!stream_disk_cache_load(stream->disk_cache_key, block, buffer.data(), size)) return false;
 	
-	svcWaitSynchronization(downloaded_data_lock, std::numeric_limits<s64>::max());
-	auto itr = downloaded_data.find(start_block);
-	assert(itr != downloaded_data.end());
-	for (u64 block = start_block; block <= end_block; block++) {
-		assert(itr->first == block);
-		u64 cur_l = std::max(start, block * BLOCK_SIZE) - block * BLOCK_SIZE;
-		u64 cur_r = std::min(end + 1, (block + 1) * BLOCK_SIZE) - block * BLOCK_SIZE;
-		res.insert(res.end(), itr->second.begin() + cur_l, itr->second.begin() + cur_r);
-		itr++;
+	if (!stream->ready) {
+		stream->len = len;
+		stream->block_num = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
 	}
-	svcReleaseMutex(downloaded_data_lock);
-	return res;
+	stream->set_data(block, buffer.data(), size);
+	stream->ready = true;
+	return true;
 }
-void NetworkStream::set_data(u64 block, const std::vector<u8> &data) {
-	svcWaitSynchronization(downloaded_data_lock, std::numeric_limits<s64>::max());
-	downloaded_data[block] = data;
-	if (downloaded_data.size() > MAX_CACHE_BLOCKS) { // ensure it doesn't cache too much and run out of memory
-		u64 read_head_block = read_head / BLOCK_SIZE;
-		if (downloaded_data.begin()->first < read_head_block) {
-			// Util_log_save("net/dl", "free " + std::to_string(downloaded_data.begin()->first));
-			downloaded_data.erase(downloaded_data.begin());
-		} else {
-			// Util_log_save("net/dl", "free " + std::to_string(std::prev(downloaded_data.end())->first));
-			downloaded_data.erase(std::prev(downloaded_data.end()));
+
+#define LOG_THREAD_STR "net/dl"
+// the whole run of blocks is read at once : a local source is fast enough that the number of reads is what costs
+bool NetworkStreamDownloader::load_blocks_from_source(NetworkStream *stream, u64 block, u64 block_num, std::vector<u8> &buffer) {
+	if (!stream->ready) {
+		u64 len = 0;
+		Result_with_string result = stream->source->open(&len);
+		if (result.code != 0) {
+			Util_log_save(LOG_THREAD_STR, "failed to open " + stream->source->get_description() + " : " + result.string, result.code);
+			return false;
 		}
+		stream->len = len;
+		stream->block_num = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
 	}
-	svcReleaseMutex(downloaded_data_lock);
+	block_num = std::min(block_num, stream->block_num - std::min(block, stream->block_num));
+	if (!block_num) return true;
+	u64 size = std::min(block_num * BLOCK_SIZE, stream->len - block * BLOCK_SIZE);
+	if (buffer.size() < size) buffer.resize(size);
+	Result_with_string result = stream->source->read(block * BLOCK_SIZE, buffer.data(), size);
+	if (result.code != 0) {
+		Util_log_save(LOG_THREAD_STR, "failed to read " + stream->source->get_description() + " : " + result.string, result.code);
+		return false;
+	}
+	for (u64 i = 0; i < block_num; i++) stream->set_data(block + i, buffer.data() + i * BLOCK_SIZE, std::min(BLOCK_SIZE, size - i * BLOCK_SIZE));
+	stream->ready = true;
+	return true;
 }
-double NetworkStream::get_download_percentage() {
-	svcWaitSynchronization(downloaded_data_lock, std::numeric_limits<s64>::max());
-	double res = (double) downloaded_data.size() * BLOCK_SIZE / len * 100;
-	svcReleaseMutex(downloaded_data_lock);
-	return res;
+
+// one session list per worker as a curl handle can't be shared between threads
+// each instance of NetworkStreamDownloader gets its own WORKER_NUM slots
+static constexpr int MAX_WORKER_SLOTS = NetworkStreamDownloader::WORKER_NUM * NetworkStreamDownloader::MAX_INSTANCES;
+static bool thread_network_session_list_inited[MAX_WORKER_SLOTS];
+static NetworkSessionList thread_network_session_list[MAX_WORKER_SLOTS];
+static int worker_slot_used_num = 0;
+static Handle worker_slot_lock;
+static bool worker_slot_lock_initialized = false;
+static void confirm_thread_network_session_list_inited(int worker_slot) {
+	if (!thread_network_session_list_inited[worker_slot]) {
+		thread_network_session_list_inited[worker_slot] = true;
+		thread_network_session_list[worker_slot].init();
+	}
 }
-std::vector<double> NetworkStream::get_buffering_progress_bar(int res_len) {
-	svcWaitSynchronization(downloaded_data_lock, std::numeric_limits<s64>::max());
-	std::vector<double> res(res_len);
-	auto itr = downloaded_data.begin();
-	for (int i = 0; i < res_len; i++) {
-		u64 l = (u64) len * i / res_len;
-		u64 r = std::min<u64>(len, len * (i + 1) / res_len);
-		while (itr != downloaded_data.end()) {
-			u64 il = itr->first * BLOCK_SIZE;
-			u64 ir = std::min((itr->first + 1) * BLOCK_SIZE, len);
-			if (ir <= l) itr++;
-			else if (il >= r) break;
-			else {
-				res[i] += std::min(ir, r) - std::max(il, l);
-				if (ir >= r) break;
-				else itr++;
-			}
-		}
-		res[i] /= r - l;
-		res[i] *= 100;
+// returns -1 if all the slots are taken
+static int allocate_worker_slot_base() {
+	if (!worker_slot_lock_initialized) {
+		svcCreateMutex(&worker_slot_lock, false);
+		worker_slot_lock_initialized = true;
 	}
-	svcReleaseMutex(downloaded_data_lock);
+	svcWaitSynchronization(worker_slot_lock, std::numeric_limits<s64>::max());
+	int res = -1;
+	if (worker_slot_used_num + NetworkStreamDownloader::WORKER_NUM <= MAX_WORKER_SLOTS) {
+		res = worker_slot_used_num;
+		worker_slot_used_num += NetworkStreamDownloader::WORKER_NUM;
+	}
+	svcReleaseMutex(worker_slot_lock);
 	return res;
 }
 
 
-// --------------------------------
-// NetworkStreamDownloader implementation
-// --------------------------------
-
-NetworkStreamDownloader::NetworkStreamDownloader() {
-	svcCreateMutex(&streams_lock, false);
+// a failure that a retry is likely to fix : no response at all, or a successful one that was cut short
+static bool is_transient_failure(const NetworkResult &result) {
+	return result.status_code == -1 || result.status_code / 100 == 2;
 }
-void NetworkStreamDownloader::add_stream(NetworkStream *stream) {
-	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
-	size_t index = (size_t) -1;
-	for (size_t i = 0; i < streams.size(); i++) if (!streams[i]) {
-		streams[i] = stream;
-		index = i;
-		break;
+// stores the complete blocks at the beginning of a response that was cut short, the incomplete last one is requested again
+static void store_complete_blocks(NetworkStream *stream, u64 first_block, const u8 *data, size_t size) {
+	for (size_t left = 0; left + NetworkStream::BLOCK_SIZE <= size; left += NetworkStream::BLOCK_SIZE) {
+		u64 block = first_block + left / NetworkStream::BLOCK_SIZE;
+		stream->set_data(block, data + left, NetworkStream::BLOCK_SIZE);
+		if (stream->disk_cache_key != "") stream_disk_cache_store(stream->disk_cache_key, block, data + left, NetworkStream::BLOCK_SIZE);
 	}
-	if (index == (size_t) -1) {
-		index = streams.size();
-		streams.push_back(stream);
-	}
-	svcReleaseMutex(streams_lock);
 }
 
-static bool thread_network_session_list_inited = false;
-static NetworkSessionList thread_network_session_list;
-static void confirm_thread_network_session_list_inited() {
-	if (!thread_network_session_list_inited) {
-		thread_network_session_list_inited = true;
-		thread_network_session_list.init();
+bool NetworkStreamDownloader::is_starving(const std::vector<u64> &read_heads) {
+	for (size_t i = 0; i < streams.size(); i++) {
+		NetworkStream *stream = streams[i];
+		if (stream->quit_request || stream->error || stream->suspend_request || stream->url_expired) continue;
+		if (stream->whole_download || stream->is_local_file()) continue;
+		if (!stream->ready) return true; // starting up, nothing is downloaded yet
+		
+		double safe_margin = stream->safe_margin_seconds;
+		if (paused_forward_seconds) safe_margin = std::min(safe_margin, paused_forward_seconds / 2); // never more than what is kept while paused
+		NetworkStreamBlockMap blocks(stream);
+		if (download_policy_is_starving(get_policy_stream(stream, blocks, read_heads[i], 0), safe_margin)) return true;
 	}
+	return false;
 }
 
-
-#define LOG_THREAD_STR "net/dl"
 void NetworkStreamDownloader::downloader_thread() {
+	NetworkTrafficClassScope traffic_class_scope(traffic_class);
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	int worker_id = worker_num++;
+	// the slots are kept across re-initializations of the same instance
+	if (worker_slot_base == -1) worker_slot_base = allocate_worker_slot_base();
+	int worker_slot = worker_slot_base + worker_id;
+	if (worker_id < WORKER_NUM && worker_slot_base != -1) confirm_thread_network_session_list_inited(worker_slot);
+	svcReleaseMutex(streams_lock);
+	if (worker_id >= WORKER_NUM || worker_slot_base == -1) {
+		Util_log_save(LOG_THREAD_STR, "too many downloader workers, exiting : " + std::to_string(worker_id));
+		return;
+	}
+	
+	std::vector<u8> disk_cache_buffer;
+	std::vector<u8> catch_up_buffer; // the block currently being received by a catch-up request
 	while (!thread_exit_reqeusted) {
 		size_t cur_stream_index = (size_t) -1; // the index of the stream on which we will perform a download in this loop
+		u64 block_reading = 0;
 		svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+		// any change after this point will signal the event again and wake us up
+		svcClearEvent(wakeup_event);
+		reclaim_quit_streams();
 		// back up 'read_head's as those can be changed from another thread
 		std::vector<u64> read_heads(streams.size());
-		for (size_t i = 0; i < streams.size(); i++) if (streams[i]) read_heads[i] = streams[i]->read_head;
+		for (size_t i = 0; i < streams.size(); i++) read_heads[i] = streams[i]->read_head;
+		if (traffic_class == NetworkTrafficClass::PLAYBACK) network_scheduler_set_starving(this, is_starving(read_heads));
 		
 		
+		// the margin is measured in seconds of playback when the bitrates of all the streams are known, otherwise in proportion to the stream length
+		bool margin_in_seconds = true;
+		for (size_t i = 0; i < streams.size(); i++)
+			if (streams[i]->ready && !streams[i]->whole_download && !streams[i]->quit_request && streams[i]->bitrate <= 0) margin_in_seconds = false;
+		std::vector<u64> forward_read_blocks(streams.size());
+		
 		// find the stream to download next
-		double margin_percentage_min = 1000;
+		double margin_min = std::numeric_limits<double>::infinity();
 		for (size_t i = 0; i < streams.size(); i++) {
-			if (!streams[i]) continue;
-			if (streams[i]->quit_request) {
-				delete streams[i];
-				streams[i] = NULL;
-				continue;
-			}
+			if (streams[i]->quit_request) continue; // quit after reclaim_quit_streams()
 			if (streams[i]->error) continue;
 			if (streams[i]->suspend_request) continue;
+			if (streams[i]->retry_time > osGetTime()) continue; // backing off after a failure
+			if (streams[i]->url_expired) continue; // waiting for replace_expired_url()
 			if (!streams[i]->ready) {
+				// the length of the stream is unknown until the first response arrives, so only one request is allowed
+				if (streams[i]->blocks_in_flight.size()) continue;
 				cur_stream_index = i;
+				block_reading = streams[i]->whole_download ? 0 : read_heads[i] / BLOCK_SIZE;
 				break;
 			}
 			if (streams[i]->whole_download) continue; // its entire content should already be downloaded
 			
-			u64 read_head_block = read_heads[i] / BLOCK_SIZE;
-			u64 first_not_downloaded_block = read_head_block;
-			while (first_not_downloaded_block < streams[i]->block_num && streams[i]->downloaded_data.count(first_not_downloaded_block)) {
-				first_not_downloaded_block++;
-				if (first_not_downloaded_block == read_head_block + MAX_FORWARD_READ_BLOCKS) break;
+			s64 prefetch_target = streams[i]->prefetch_target;
+			if (prefetch_target >= 0) {
+				u64 target_block = prefetch_target / BLOCK_SIZE;
+				bool pending = target_block < streams[i]->block_num && !streams[i]->is_block_present(target_block) && !streams[i]->blocks_in_flight.count(target_block);
+				if (pending && margin_min > -1) { // ahead of everything else
+					margin_min = -1;
+					cur_stream_index = i;
+					block_reading = target_block;
+					continue;
+				}
+				if (!pending) streams[i]->prefetch_target = -1; // done or on its way
 			}
-			if (first_not_downloaded_block == streams[i]->block_num) continue; // no need to download this stream for now
 			
-			if (first_not_downloaded_block == read_head_block + MAX_FORWARD_READ_BLOCKS) continue; // no need to download this stream for now
-			
-			double margin_percentage;
-			if (first_not_downloaded_block == read_head_block) margin_percentage = 0;
-			else margin_percentage = (double) (first_not_downloaded_block * BLOCK_SIZE - read_heads[i]) / streams[i]->len * 100;
-			if (margin_percentage_min > margin_percentage) {
-				margin_percentage_min = margin_percentage;
+			forward_read_blocks[i] = get_forward_read_blocks(streams[i]);
+			NetworkStreamBlockMap blocks(streams[i]);
+			u64 next_block;
+			double margin;
+			if (!download_policy_find_next_block(get_policy_stream(streams[i], blocks, read_heads[i], forward_read_blocks[i]), margin_in_seconds, &next_block, &margin))
+				continue; // no need to download this stream for now
+			if (margin_min > margin) {
+				margin_min = margin;
 				cur_stream_index = i;
+				block_reading = next_block;
 			}
 		}
 		
+		// decide how many consecutive blocks to request at once
+		u64 block_reading_num = 1;
+		bool catching_up = false;
+		if (cur_stream_index != (size_t) -1 && streams[cur_stream_index]->ready && !streams[cur_stream_index]->whole_download) {
+			NetworkStream *stream = streams[cur_stream_index];
+			NetworkStreamBlockMap blocks(stream);
+			block_reading_num = download_policy_request_block_num(get_policy_stream(stream, blocks, read_heads[cur_stream_index], forward_read_blocks[cur_stream_index]),
+				block_reading, stream->sizing, &catching_up);
+		}
+		
 		if (cur_stream_index == (size_t) -1) {
 			svcReleaseMutex(streams_lock);
-			usleep(20000);
+			// the timeout is only a safety net for state changes that don't signal the event
+			svcWaitSynchronization(wakeup_event, IDLE_WAIT_TIMEOUT_NS);
 			continue;
 		}
 		NetworkStream *cur_stream = streams[cur_stream_index];
+		// a request would only fail and error the stream out : wait for the connection to come back instead
+		if (!cur_stream->is_local_file() && !connectivity_is_usable()) {
+			svcReleaseMutex(streams_lock);
+			connectivity_wait_until_usable(IDLE_WAIT_TIMEOUT_NS);
+			continue;
+		}
+		// reserve the blocks so that other workers pick the next one
+		for (u64 i = 0; i < block_reading_num; i++) cur_stream->blocks_in_flight.insert(block_reading + i);
+		NetworkSessionList *cur_session_list = &thread_network_session_list[worker_slot];
+		if (cur_stream->session_list && !session_lists_in_use.count(cur_stream->session_list)) {
+			cur_session_list = cur_stream->session_list;
+			session_lists_in_use.insert(cur_session_list);
+		}
+		std::string cur_url = cur_stream->url;
 		svcReleaseMutex(streams_lock);
 		
-		// whole download
-		if (cur_stream->whole_download) {
-			confirm_thread_network_session_list_inited();
-			auto result = Access_http_get(cur_stream->session_list ? *cur_stream->session_list : thread_network_session_list, cur_stream->url, {});
-			cur_stream->url = result.redirected_url;
+		std::string redirected_url = cur_url;
+		double measured_throughput = -1;
+		bool transient_failure = false; // set instead of cur_stream->error when the request is worth retrying
+		bool url_expired = false;
+		// a refused range request of a ready stream means its url has expired, anything else is fatal
+		auto fail_request = [&] (const NetworkResult &result) {
+			if (cur_stream->ready && !cur_stream->whole_download && result.status_code == HTTP_STATUS_CODE_FORBIDDEN) url_expired = true;
+			else cur_stream->error = true;
+		};
+		if (cur_stream->is_local_file()) {
+			if (!load_blocks_from_source(cur_stream, block_reading, block_reading_num, disk_cache_buffer)) cur_stream->error = true;
+		// second cache tier on the SD card
+		} else if (!cur_stream->whole_download && cur_stream->disk_cache_key != "" && load_block_from_disk_cache(cur_stream, block_reading, disk_cache_buffer)) {
+			Util_log_trace("net/dl", "disk cache hit : " + std::to_string(block_reading));
+		} else if (cur_stream->whole_download) { // whole download
+			auto result = Access_http_get(*cur_session_list, cur_url, {});
+			redirected_url = result.redirected_url;
 			
 			if (!result.fail && result.status_code_is_success() && result.data.size()) {
 				{ // acquire necessary headers
@@ -208,11 +335,7 @@ void NetworkStreamDownloader::downloader_thread() {
 				if (!cur_stream->error) {
 					cur_stream->len = result.data.size();
 					cur_stream->block_num = (cur_stream->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
-					for (size_t i = 0; i < result.data.size(); i += BLOCK_SIZE) {
-						size_t left = i;
-						size_t right = std::min<size_t>(i + BLOCK_SIZE, result.data.size());
-						cur_stream->set_data(i / BLOCK_SIZE, std::vector<u8>(result.data.begin() + left, result.data.begin() + right));
-					}
+					cur_stream->set_whole_data(result.data); // the response buffer becomes the blocks as it is
 					cur_stream->ready = true;
 				}
 			} else {
@@ -231,26 +354,119 @@ void NetworkStreamDownloader::downloader_thread() {
 				}
 			}
 			result.finalize();
-		} else {
-			u64 block_reading = read_heads[cur_stream_index] / BLOCK_SIZE;
-			if (cur_stream->ready) {
-				while (block_reading < cur_stream->block_num && cur_stream->downloaded_data.count(block_reading)) block_reading++;
-				if (block_reading == cur_stream->block_num) { // something unexpected happened
-					Util_log_save(LOG_THREAD_STR, "unexpected error (trying to read beyond the end of the stream)");
-					cur_stream->error = true;
-					continue;
+		} else if (catching_up) {
+			Util_log_trace("net/dl", "catch up : " + std::to_string(block_reading) + " x" + std::to_string(block_reading_num));
+			
+			u64 start = block_reading * BLOCK_SIZE;
+			u64 end = std::min((block_reading + block_reading_num) * BLOCK_SIZE, cur_stream->len);
+			u64 expected_len = end - start;
+			
+			u64 received_len = 0;
+			catch_up_buffer.clear();
+			catch_up_buffer.reserve(BLOCK_SIZE);
+			u64 request_start_time = osGetTime();
+			auto result = Access_http_get_streaming(*cur_session_list, cur_url,
+				{{"Range", "bytes=" + std::to_string(start) + "-" + std::to_string(end - 1)}},
+				[&] (const u8 *data, size_t size, s64 content_length) {
+					// an error page or a server ignoring the range must never end up in the blocks
+					if (content_length != (s64) expected_len || received_len + size > expected_len) return false;
+					while (size) {
+						size_t cur_size = std::min<size_t>(size, BLOCK_SIZE - catch_up_buffer.size());
+						catch_up_buffer.insert(catch_up_buffer.end(), data, data + cur_size);
+						received_len += cur_size;
+						data += cur_size;
+						size -= cur_size;
+						if (catch_up_buffer.size() == BLOCK_SIZE || received_len == expected_len) {
+							u64 block = block_reading + (received_len - 1) / BLOCK_SIZE;
+							cur_stream->set_data(block, catch_up_buffer.data(), catch_up_buffer.size());
+							if (cur_stream->disk_cache_key != "") stream_disk_cache_store(cur_stream->disk_cache_key, block, catch_up_buffer.data(), catch_up_buffer.size());
+							catch_up_buffer.clear();
+							cur_stream->data_arrival_event.signal(); // the reader may be waiting for exactly this block
+						}
+					}
+					return true;
+				});
+			u64 request_time = std::max<u64>(1, osGetTime() - request_start_time);
+			redirected_url = result.redirected_url;
+			
+			if (result.fail || received_len != expected_len) {
+				// the blocks completed before the failure are kept, the rest will simply be requested again
+				if (result.fail) Util_log_save("net/dl", "access failed : " + result.error);
+				else Util_log_save(LOG_THREAD_STR, "size discrepancy : " + std::to_string(expected_len) + " -> " + std::to_string(received_len));
+				if (is_transient_failure(result)) transient_failure = true;
+				else fail_request(result);
+			} else measured_throughput = (double) expected_len / request_time;
+			result.finalize();
+		} else if (var_network_framework == NETWORK_FRAMEWORK_SSLC && cur_stream->ready && block_reading_num > 1) {
+			// pipeline several smaller range requests instead of a single large one :
+			// it costs the same single round trip, but the first blocks become available as soon as their own response arrives
+			u64 request_num = std::min(block_reading_num, MAX_PIPELINED_REQUESTS);
+			u64 blocks_per_request = (block_reading_num + request_num - 1) / request_num;
+			std::vector<std::map<std::string, std::string> > request_headers_list;
+			std::vector<std::pair<u64, u64> > request_blocks; // (first block, number of blocks)
+			for (u64 block = block_reading; block < block_reading + block_reading_num; block += blocks_per_request) {
+				u64 cur_num = std::min(blocks_per_request, block_reading + block_reading_num - block);
+				u64 start = block * BLOCK_SIZE;
+				u64 end = std::min((block + cur_num) * BLOCK_SIZE, cur_stream->len);
+				request_headers_list.push_back({{"Range", "bytes=" + std::to_string(start) + "-" + std::to_string(end - 1)}});
+				request_blocks.push_back({block, cur_num});
+			}
+			
+			u64 request_start_time = osGetTime();
+			u64 received_len = 0;
+			auto results = Access_http_get_pipelined(*cur_session_list, cur_url, request_headers_list, [&] (size_t i, NetworkResult &result) {
+				u64 first_block = request_blocks[i].first;
+				u64 expected_len = std::min((first_block + request_blocks[i].second) * BLOCK_SIZE, cur_stream->len) - first_block * BLOCK_SIZE;
+				if (result.fail) {
+					Util_log_save("net/dl", "access failed : " + result.error);
+					if (is_transient_failure(result)) transient_failure = true;
+					else fail_request(result);
+					return false;
+				}
+				if (result.status_code / 100 == 3) { // the rest will be requested again to the new location
+					redirected_url = result.get_header("Location");
+					return false;
 				}
+				if (result.data.size() != expected_len) {
+					Util_log_save(LOG_THREAD_STR, "size discrepancy : " + std::to_string(expected_len) + " -> " + std::to_string(result.data.size()));
+					if (result.status_code_is_success() && result.data.size() < expected_len) {
+						store_complete_blocks(cur_stream, first_block, result.data.data(), result.data.size());
+						transient_failure = true;
+					} else fail_request(result);
+					return false;
+				}
+				for (u64 j = 0; j < request_blocks[i].second; j++) {
+					size_t left = j * BLOCK_SIZE;
+					size_t right = std::min<size_t>(left + BLOCK_SIZE, result.data.size());
+					cur_stream->set_data(first_block + j, &result.data[left], right - left);
+					if (cur_stream->disk_cache_key != "") stream_disk_cache_store(cur_stream->disk_cache_key, first_block + j, &result.data[left], right - left);
+				}
+				received_len += expected_len;
+				return true;
+			});
+			u64 request_time = std::max<u64>(1, osGetTime() - request_start_time);
+			// on_response isn't called for the requests the connection failed before answering
+			// the blocks of the later ones are simply requested again, but nothing at all means the access failed
+			if (!cur_stream->error && redirected_url == cur_url && !received_len && results.size() && results[0].fail) {
+				Util_log_save("net/dl", "access failed : " + results[0].error);
+				if (is_transient_failure(results[0])) transient_failure = true;
+				else fail_request(results[0]);
 			}
-			// Util_log_save("net/dl", "dl next : " + std::to_string(cur_stream_index) + " " + std::to_string(block_reading));
+			for (auto &result : results) result.finalize();
+			if (!cur_stream->error && !transient_failure && received_len) measured_throughput = (double) received_len / request_time;
+		} else {
+			Util_log_trace("net/dl", "dl next : " + std::to_string(cur_stream_index) + " " + std::to_string(block_reading));
 			
 			u64 start = block_reading * BLOCK_SIZE;
-			u64 end = cur_stream->ready ? std::min((block_reading + 1) * BLOCK_SIZE, cur_stream->len) : (block_reading + 1) * BLOCK_SIZE;
+			u64 end = cur_stream->ready ? std::min((block_reading + block_reading_num) * BLOCK_SIZE, cur_stream->len) : (block_reading + 1) * BLOCK_SIZE;
 			u64 expected_len = end - start;
 			
 			
-			auto result = Access_http_get(cur_stream->session_list ? *cur_stream->session_list : thread_network_session_list, cur_stream->url,
+			u64 request_start_time = osGetTime();
+			auto result = Access_http_get(*cur_session_list, cur_url,
 				{{"Range", "bytes=" + std::to_string(start) + "-" + std::to_string(end - 1)}});
-			cur_stream->url = result.redirected_url;
+			u64 request_time = std::max<u64>(1, osGetTime() - request_start_time);
+			redirected_url = result.redirected_url;
 			
 			if (!result.fail) {
 				if (!cur_stream->ready) {
@@ -269,29 +485,99 @@ void NetworkStreamDownloader::downloader_thread() {
 				}
 				if (cur_stream->ready && result.data.size() != expected_len) {
 					Util_log_save(LOG_THREAD_STR, "size discrepancy : " + std::to_string(expected_len) + " -> " + std::to_string(result.data.size()));
-					cur_stream->error = true;
-					result.finalize();
-					continue;
+					if (result.status_code_is_success() && result.data.size() < expected_len) {
+						store_complete_blocks(cur_stream, block_reading, result.data.data(), result.data.size());
+						transient_failure = true;
+					} else fail_request(result);
+				} else if (!cur_stream->ready) {
+					cur_stream->set_data(block_reading, result.data.data(), result.data.size());
+					cur_stream->ready = true;
+					if (cur_stream->disk_cache_key != "") {
+						stream_disk_cache_set_len(cur_stream->disk_cache_key, cur_stream->len);
+						stream_disk_cache_store(cur_stream->disk_cache_key, block_reading, result.data.data(), result.data.size());
+					}
+				} else {
+					measured_throughput = (double) expected_len / request_time;
+					for (u64 i = 0; i < block_reading_num; i++) {
+						size_t left = i * BLOCK_SIZE;
+						size_t right = std::min<size_t>(left + BLOCK_SIZE, result.data.size());
+						cur_stream->set_data(block_reading + i, &result.data[left], right - left);
+						if (cur_stream->disk_cache_key != "") stream_disk_cache_store(cur_stream->disk_cache_key, block_reading + i, &result.data[left], right - left);
+					}
 				}
-				cur_stream->set_data(block_reading, result.data);
-				cur_stream->ready = true;
 			} else {
 				Util_log_save("net/dl", "access failed : " + result.error);
-				cur_stream->error = true;
+				if (is_transient_failure(result)) transient_failure = true;
+				else fail_request(result);
 			}
 			result.finalize();
 		}
+		
+		svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+		// a request cut off by a sleep or the HOME menu is retried once the app is resumed, without counting it
+		if (transient_failure && !connectivity_is_usable()) {
+			Util_log_save(LOG_THREAD_STR, "failed while the connection is unusable, retrying later");
+			redirected_url = cur_stream->origin_url;
+		} else if (transient_failure) {
+			cur_stream->transient_failure_num++;
+			if (cur_stream->transient_failure_num > MAX_TRANSIENT_RETRIES) {
+				Util_log_save(LOG_THREAD_STR, "giving up after " + std::to_string(MAX_TRANSIENT_RETRIES) + " retries");
+				cur_stream->error = true;
+			} else {
+				u64 backoff = std::min(RETRY_BACKOFF_MIN_MS << (cur_stream->transient_failure_num - 1), RETRY_BACKOFF_MAX_MS);
+				Util_log_save(LOG_THREAD_STR, "retrying in " + std::to_string(backoff) + " ms");
+				metrics_add(Metric::HTTP_RETRIES);
+				cur_stream->retry_time = osGetTime() + backoff;
+				redirected_url = cur_stream->origin_url; // the redirected location may be what failed, so resolve it again
+			}
+		} else if (!cur_stream->error) cur_stream->transient_failure_num = 0;
+		bool notify_url_expired = url_expired && !cur_stream->url_expired;
+		if (notify_url_expired) {
+			Util_log_save(LOG_THREAD_STR, "url expired");
+			cur_stream->url_expired = true;
+			redirected_url = cur_stream->origin_url;
+		}
+		if (cur_stream->url == cur_url) cur_stream->url = redirected_url; // unless replace_expired_url() swapped in a new one meanwhile
+		for (u64 i = 0; i < block_reading_num; i++) cur_stream->blocks_in_flight.erase(block_reading + i);
+		if (measured_throughput >= 0) download_policy_on_throughput(cur_stream->sizing, measured_throughput);
+		// the stream might have become ready or errored out, so wake up the reader
+		cur_stream->data_arrival_event.signal();
+		if (cur_session_list != &thread_network_session_list[worker_slot]) session_lists_in_use.erase(cur_session_list);
+		svcReleaseMutex(streams_lock);
+		if (notify_url_expired && url_expired_handler) url_expired_handler();
 	}
 	Util_log_save(LOG_THREAD_STR, "Exit, deiniting...");
-	for (auto stream : streams) if (stream) {
-		stream->quit_request = true;
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	for (auto stream : streams) stream->quit_request = true;
+	svcReleaseMutex(streams_lock);
+	if (traffic_class == NetworkTrafficClass::PLAYBACK) network_scheduler_set_starving(this, false);
+}
+double NetworkStreamDownloader::get_bandwidth_estimate() {
+	double res = 0;
+	svcWaitSynchronization(streams_lock, std::numeric_limits<s64>::max());
+	for (auto stream : streams) if (!stream->quit_request) res = std::max(res, stream->sizing.bandwidth_estimate);
+	svcReleaseMutex(streams_lock);
+	return res;
+}
+void NetworkStreamDownloader::reclaim_quit_streams() {
+	// a quit stream leaves the scanned list at once, but is deleted only after the workers still downloading it are done
+	auto quit_begin = std::stable_partition(streams.begin(), streams.end(), [] (NetworkStream *stream) { return !stream->quit_request; });
+	retired_streams.insert(retired_streams.end(), quit_begin, streams.end());
+	streams.erase(quit_begin, streams.end());
+	for (size_t i = 0; i < retired_streams.size(); ) {
+		if (retired_streams[i]->blocks_in_flight.size()) i++;
+		else {
+			delete retired_streams[i];
+			retired_streams[i] = retired_streams.back();
+			retired_streams.pop_back();
+		}
 	}
 }
 void NetworkStreamDownloader::delete_all() {
-	for (auto &stream : streams) {
-		delete stream;
-		stream = NULL;
-	}
+	for (auto stream : streams) delete stream;
+	for (auto stream : retired_streams) delete stream;
+	streams.clear();
+	retired_streams.clear();
 }
 
 
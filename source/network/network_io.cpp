@@ -1,7 +1,16 @@
 #include "headers.hpp"
 #include "network/network_io.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/metrics.hpp"
+#include "network/connectivity.hpp"
+#include "network/network_lifecycle.hpp"
+#include "network/network_scheduler.hpp"
+#include "network/network_trace.hpp"
 #include <cassert>
 #include <deque>
+#include <functional>
+#include <zlib.h>
+#include <strings.h>
 
 #include <fcntl.h>
 
@@ -14,6 +23,153 @@
 
 static volatile bool exiting = false;
 
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+#define SSLC_OPEN_ATTEMPTS 3
+#define SSLC_OPEN_WAIT_TIMEOUT_NS 3000000000LL // how long a request waits for an outage to end before it fails
+
+// process-wide pool of idle sslc sessions, a request borrows one for the host and gives it back when done
+#define MAX_IDLE_SESSIONS 8
+static std::deque<NetworkSession> idle_sessions; // the back is the most recently used one
+static Handle session_pool_lock;
+static bool session_pool_lock_initialized = false;
+
+static void session_pool_lock_acquire() {
+	if (!session_pool_lock_initialized) {
+		svcCreateMutex(&session_pool_lock, false);
+		session_pool_lock_initialized = true;
+	}
+	svcWaitSynchronization(session_pool_lock, std::numeric_limits<s64>::max());
+}
+static bool session_pool_borrow(const std::string &host_name, NetworkSession &session) {
+	bool res = false;
+	session_pool_lock_acquire();
+	for (auto itr = idle_sessions.rbegin(); itr != idle_sessions.rend(); itr++) if (itr->host_name == host_name) {
+		session = *itr;
+		idle_sessions.erase(std::next(itr).base());
+		res = true;
+		break;
+	}
+	svcReleaseMutex(session_pool_lock);
+	return res;
+}
+static bool session_pool_has(const std::string &host_name) {
+	session_pool_lock_acquire();
+	bool res = std::any_of(idle_sessions.begin(), idle_sessions.end(), [&] (const NetworkSession &session) { return session.host_name == host_name; });
+	svcReleaseMutex(session_pool_lock);
+	return res;
+}
+static void session_pool_give_back(NetworkSession &session) {
+	if (!session.inited || session.fail || exiting) {
+		session.close();
+		return;
+	}
+	NetworkSession evicted;
+	session_pool_lock_acquire();
+	idle_sessions.push_back(session);
+	if (idle_sessions.size() > MAX_IDLE_SESSIONS) {
+		evicted = idle_sessions.front();
+		idle_sessions.pop_front();
+	}
+	svcReleaseMutex(session_pool_lock);
+	evicted.close();
+}
+static void session_pool_close_all() {
+	session_pool_lock_acquire();
+	for (auto &session : idle_sessions) session.close();
+	idle_sessions.clear();
+	svcReleaseMutex(session_pool_lock);
+}
+
+// one share handle for all the curl handles
+static CURLSH *curl_share = NULL;
+static Handle curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void curl_share_lock_func(CURL *, curl_lock_data data, curl_lock_access, void *) {
+	svcWaitSynchronization(curl_share_locks[data], std::numeric_limits<s64>::max());
+}
+static void curl_share_unlock_func(CURL *, curl_lock_data data, void *) {
+	svcReleaseMutex(curl_share_locks[data]);
+}
+static CURLSH *get_curl_share() {
+	session_pool_lock_acquire();
+	if (!curl_share) {
+		for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) svcCreateMutex(&curl_share_locks[i], false);
+		curl_share = curl_share_init();
+		curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, curl_share_lock_func);
+		curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, curl_share_unlock_func);
+		curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	}
+	svcReleaseMutex(session_pool_lock);
+	return curl_share;
+}
+
+// resolved addresses are cached so that reconnecting to a host (after a redirect or a dropped keep-alive) doesn't wait for a DNS round trip
+// getaddrinfo() doesn't tell us the TTL of the record, so a fixed one is used
+#define DNS_CACHE_TTL_MS (5 * 60 * 1000)
+#define DNS_CACHE_MAX_SIZE 32
+struct DNSCacheEntry {
+	std::vector<struct sockaddr_in> addrs;
+	u64 expire_time;
+};
+static std::map<std::string, DNSCacheEntry> dns_cache;
+static Handle dns_cache_lock;
+static bool dns_cache_lock_initialized = false;
+
+static void dns_cache_lock_acquire() {
+	if (!dns_cache_lock_initialized) {
+		svcCreateMutex(&dns_cache_lock, false);
+		dns_cache_lock_initialized = true;
+	}
+	svcWaitSynchronization(dns_cache_lock, std::numeric_limits<s64>::max());
+}
+static void dns_cache_invalidate(const std::string &host_name) {
+	dns_cache_lock_acquire();
+	dns_cache.erase(host_name);
+	svcReleaseMutex(dns_cache_lock);
+}
+// *cached is set to true if the result came from the cache
+static bool resolve_host(const std::string &host_name, std::vector<struct sockaddr_in> &addrs, bool *cached) {
+	u64 cur_time = osGetTime();
+	*cached = false;
+	dns_cache_lock_acquire();
+	auto itr = dns_cache.find(host_name);
+	if (itr != dns_cache.end()) {
+		if (itr->second.expire_time > cur_time) {
+			addrs = itr->second.addrs;
+			*cached = true;
+		} else dns_cache.erase(itr);
+	}
+	svcReleaseMutex(dns_cache_lock);
+	if (*cached) return true;
+	
+	struct addrinfo hints;
+	struct addrinfo *resaddr = NULL;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	
+	// Util_log_save("sslc", "Resolving hostname...");
+	
+	if (getaddrinfo(host_name.c_str(), "443", &hints, &resaddr) != 0) {
+		Util_log_save("sslc", "getaddrinfo() failed.");
+		return false;
+	}
+	addrs.clear();
+	for (struct addrinfo *cur = resaddr; cur; cur = cur->ai_next) if (cur->ai_addrlen == sizeof(struct sockaddr_in))
+		addrs.push_back(*(struct sockaddr_in *) cur->ai_addr);
+	freeaddrinfo(resaddr);
+	if (!addrs.size()) return false;
+	
+	dns_cache_lock_acquire();
+	if (dns_cache.size() >= DNS_CACHE_MAX_SIZE) dns_cache.clear(); // only a handful of hosts are used in practice
+	dns_cache[host_name] = {addrs, cur_time + DNS_CACHE_TTL_MS};
+	svcReleaseMutex(dns_cache_lock);
+	return true;
+}
+
 void NetworkSession::open(std::string host_name) {
 	static const int SOCKET_BUFFER_MAX_SIZE = 0x8000;
 	
@@ -21,8 +177,10 @@ void NetworkSession::open(std::string host_name) {
 	
 	Result ret = 0;
 	
-	struct addrinfo hints;
-	struct addrinfo *resaddr = NULL;
+	double open_start_time;
+	std::vector<struct sockaddr_in> addrs;
+	bool cached;
+	bool connected = false;
 	
 	sockfd = socket(AF_INET, SOCK_STREAM, 0);
 	if (sockfd == -1) {
@@ -32,29 +190,30 @@ void NetworkSession::open(std::string host_name) {
 	// expand socket buffer size
 	setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER_MAX_SIZE, sizeof(int));
 	
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	
-	// Util_log_save("sslc", "Resolving hostname...");
-	
-	if (getaddrinfo(host_name.c_str(), "443", &hints, &resaddr) != 0) {
-		Util_log_save("sslc", "getaddrinfo() failed.");
-		goto fail;
-	}
+	open_start_time = get_time_ms();
+	if (!resolve_host(host_name, addrs, &cached)) goto fail;
+	dns_time = get_time_ms() - open_start_time;
 	
 	// Util_log_save("sslc", "Connecting to the server...");
 	
-	struct addrinfo *resaddr_cur;
-	for (resaddr_cur = resaddr; resaddr_cur; resaddr_cur = resaddr_cur->ai_next) {
-		if (connect(sockfd, resaddr_cur->ai_addr, resaddr_cur->ai_addrlen) == 0) break;
+	for (auto &addr : addrs) if (connect(sockfd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+		connected = true;
+		break;
+	}
+	if (!connected && cached) { // the cached addresses might be stale
+		dns_cache_invalidate(host_name);
+		if (!resolve_host(host_name, addrs, &cached)) goto fail;
+		for (auto &addr : addrs) if (connect(sockfd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+			connected = true;
+			break;
+		}
 	}
-	freeaddrinfo(resaddr);
 	
-	if (!resaddr_cur) {
+	if (!connected) {
 		Util_log_save("sslc", "Failed to connect.");
 		goto fail;
 	}
+	connect_time = get_time_ms() - open_start_time - dns_time;
 	
 	// Util_log_save("sslc", "Running sslc setup...");
 	
@@ -96,12 +255,11 @@ void NetworkSessionList::init() {
 	
 	deinit_list.push_back(this);
 }
-void NetworkSessionList::close_sessions() {
-	for (auto &session : sessions) session.second.close();
-}
 void NetworkSessionList::deinit() {
-	close_sessions();
-	sessions.clear();
+	if (curl) {
+		curl_easy_cleanup(curl);
+		curl = NULL;
+	}
 	
 	delete buffer;
 	buffer = NULL;
@@ -112,6 +270,11 @@ void NetworkSessionList::at_exit() {
 	for (auto session_list : deinit_list) session_list->deinit();
 	deinit_list.clear();
 	exiting = true;
+	session_pool_close_all();
+	if (curl_share) {
+		curl_share_cleanup(curl_share);
+		curl_share = NULL;
+	}
 }
 
 
@@ -142,132 +305,349 @@ static std::string remove_leading_whitespaces(std::string str) {
 struct ResponseHeader {
 	int status_code = -1;
 	std::string status_message;
-	std::map<std::string, std::string> headers;
+	std::map<std::string, std::string> headers; // keys are lowercased
+	// the ones perform_http_request() itself needs, picked up while parsing
+	s64 content_length = -1;
+	bool chunked = false;
+	bool connection_close = false;
+	std::string content_encoding;
 };
-static ResponseHeader parse_header(std::string header) {
+static bool header_name_is(const char *name, size_t name_len, const char *target) {
+	return strlen(target) == name_len && !strncasecmp(name, target, name_len);
+}
+static const char *skip_spaces(const char *begin, const char *end) {
+	while (begin < end && *begin == ' ') begin++;
+	return begin;
+}
+// parses the header in place in a single pass : no per-line copies, only the map entries are allocated
+static ResponseHeader parse_header(const char *begin, const char *end) {
 	ResponseHeader res;
-	std::vector<std::string> header_lines;
-	{
-		std::vector<std::string> header_lines_tmp = {""};
-		for (auto c : header) {
-			if (c == '\n') header_lines_tmp.push_back("");
-			else header_lines_tmp.back().push_back(c);
-		}	
-		for (auto line : header_lines_tmp) {
-			if (line.size() && line.back() == '\r') line.pop_back();
-			if (!line.size()) continue;
-			header_lines.push_back(line);
-		}
-	}
-	// parse status line
-	{
-		if (!header_lines.size()) {
-			Util_log_save("http", "Empty header");
-			return res;
-		}
-		const std::string &status_line = header_lines[0];
-		if (status_line.substr(0, 8) != "HTTP/1.1" && status_line.substr(0, 8) != "HTTP/1.0") {
-			Util_log_save("http", "Invalid status line : " + status_line);
-			return res;
+	bool status_line_parsed = false;
+	for (const char *line = begin; line < end; ) {
+		const char *line_end = (const char *) memchr(line, '\n', end - line);
+		if (!line_end) line_end = end;
+		const char *next_line = line_end + (line_end < end);
+		if (line_end > line && line_end[-1] == '\r') line_end--;
+		if (line_end == line) { // empty line
+			line = next_line;
+			continue;
 		}
-		size_t head = 8;
-		while (head < status_line.size() && isspace(status_line[head])) head++;
-		char *end;
-		res.status_code = strtol(status_line.c_str() + head, &end, 10);
-		if (end == status_line.c_str() + head) {
-			Util_log_save("http", "failed to parse status code in the status line: " + status_line);
-			res.status_code = -1;
-			return res;
+		
+		if (!status_line_parsed) {
+			status_line_parsed = true;
+			if (line_end - line < 8 || (strncmp(line, "HTTP/1.1", 8) && strncmp(line, "HTTP/1.0", 8))) {
+				Util_log_save("http", "Invalid status line : " + std::string(line, line_end));
+				return res;
+			}
+			const char *head = line + 8;
+			while (head < line_end && isspace(*head)) head++;
+			int status_code = 0;
+			const char *digits_start = head;
+			while (head < line_end && isdigit(*head)) status_code = status_code * 10 + (*head++ - '0');
+			if (head == digits_start) {
+				Util_log_save("http", "failed to parse status code in the status line: " + std::string(line, line_end));
+				return res;
+			}
+			res.status_code = status_code;
+			while (head < line_end && isspace(*head)) head++;
+			res.status_message.assign(head, line_end);
+			line = next_line;
+			continue;
 		}
-		head = end - status_line.c_str();
-		while (head < status_line.size() && isspace(status_line[head])) head++;
-		res.status_message = status_line.c_str() + head;
-		header_lines.erase(header_lines.begin());
-	}
-	for (auto line : header_lines) {
-		auto colon = std::find(line.begin(), line.end(), ':');
-		if (colon == line.end()) {
-			Util_log_save("http", "Header line without a colon, ignoring : " + line);
+		
+		const char *colon = (const char *) memchr(line, ':', line_end - line);
+		if (!colon) {
+			Util_log_save("http", "Header line without a colon, ignoring : " + std::string(line, line_end));
+			line = next_line;
 			continue;
 		}
-		auto key = remove_leading_whitespaces(std::string(line.begin(), colon));
-		auto value = remove_leading_whitespaces(std::string(colon + 1, line.end()));
-		res.headers[key] = value;
+		const char *key = skip_spaces(line, colon);
+		size_t key_len = colon - key;
+		const char *value = skip_spaces(colon + 1, line_end);
+		size_t value_len = line_end - value;
+		
+		if (header_name_is(key, key_len, "Content-Length")) {
+			s64 length = 0;
+			const char *head = value;
+			while (head < line_end && isdigit(*head)) length = length * 10 + (*head++ - '0');
+			if (head != value) res.content_length = length;
+		} else if (header_name_is(key, key_len, "Transfer-Encoding")) res.chunked = value_len == 7 && !strncasecmp(value, "chunked", 7);
+		else if (header_name_is(key, key_len, "Connection")) res.connection_close = value_len == 5 && !strncasecmp(value, "close", 5);
+		else if (header_name_is(key, key_len, "Content-Encoding")) res.content_encoding.assign(value, value_len);
+		
+		std::string lowercase_key(key, key_len);
+		for (auto &c : lowercase_key) c = tolower(c);
+		res.headers[lowercase_key].assign(value, value_len);
+		line = next_line;
 	}
 	return res;
 }
-struct ChunkProcessor {
-	std::string result;
-	std::deque<char> buffer;
-	int size = -1;
-	int size_size = -1;
-	bool error = false;
+// receives the body of a response and either stores it in NetworkResult::data or passes it to the sink
+// a gzip-encoded body is inflated on the fly, so neither of them ever sees the compressed data
+struct BodyWriter {
+	NetworkResult &result;
+	const NetworkDataSink *sink;
+	CURL *curl = NULL; // if set, the status code, the content length and the encoding are queried on the first write
+	int status_code = -1;
+	s64 content_length = -1; // of the decoded body, -1 if unknown
+	bool aborted = false;
+	std::string error;
+	double start_time = get_time_ms(); // for NetworkResult::timing
 	
-	int parse_hex(std::string str) {
-		int res = 0;
-		for (auto c : str) {
-			res *= 16;
-			if (isdigit(c)) res += c - '0';
-			else if (c >= 'A' && c <= 'F') res += c - 'A' + 10;
-			else if (c >= 'a' && c <= 'f') res += c - 'a' + 10;
-			else {
-				Util_log_save("hex", "unexpected char '" + std::string(1, c) + "' in " + str);
-				error = true;
-				return -1;
-			}
+	bool gzip = false;
+	z_stream zstream;
+	std::vector<u8> inflate_buffer;
+	
+	BodyWriter (NetworkResult &result, const NetworkDataSink *sink) : result(result), sink(sink) {}
+	~BodyWriter () {
+		if (gzip) inflateEnd(&zstream);
+	}
+	
+	void set_content_length(s64 length) {
+		if (length > 0 && !use_sink()) result.data.reserve(length); // for a compressed body, it's still a lower bound
+		content_length = gzip ? -1 : length;
+	}
+	// must be called before set_content_length()
+	void set_content_encoding(std::string encoding) {
+		for (auto &c : encoding) c = tolower(c);
+		if (encoding != "gzip" || gzip) return;
+		memset(&zstream, 0, sizeof(zstream));
+		if (inflateInit2(&zstream, 16 + MAX_WBITS) != Z_OK) { // 16 : expect the gzip header
+			Util_log_save("http", "inflateInit2() failed");
+			return;
 		}
-		return res;
+		inflate_buffer.resize(0x4000);
+		gzip = true;
+	}
+	// the body of a redirect response is not what the caller asked for
+	bool use_sink() { return sink && status_code / 100 != 3; }
+	bool output(const u8 *data, size_t size) {
+		if (!size) return true;
+		if (use_sink()) {
+			if (!(*sink)(data, size, content_length)) {
+				aborted = true;
+				error = "aborted by the sink";
+				return false;
+			}
+		} else result.data.insert(result.data.end(), data, data + size);
+		return true;
 	}
-	void try_to_parse_size() {
-		size_t pos = 0;
-		for (; pos + 1 < buffer.size(); pos++) if (buffer[pos] == '\r' && buffer[pos + 1] == '\n') break;
-		if (pos + 1 >= buffer.size()) size = size_size = -1;
-		else {
-			size_size = pos;
-			size = parse_hex(std::string(buffer.begin(), buffer.begin() + size_size));
+	bool write(const u8 *data, size_t size) {
+		if (curl && status_code == -1) {
+			long code;
+			curl_off_t length;
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+			status_code = code;
+			// the header callback has already stored all the headers
+			if (result.response_headers.count("content-encoding")) set_content_encoding(result.response_headers["content-encoding"]);
+			if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK) length = -1;
+			set_content_length(length);
 		}
+		if (!size) return true;
+		result.timing.bytes += size;
+		if (!gzip) return output(data, size);
+		
+		zstream.next_in = (Bytef *) data;
+		zstream.avail_in = size;
+		while (zstream.avail_in) {
+			zstream.next_out = &inflate_buffer[0];
+			zstream.avail_out = inflate_buffer.size();
+			int ret = inflate(&zstream, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END) {
+				Util_log_save("http", "inflate() failed : ", ret);
+				aborted = true;
+				error = "failed to decode the gzip body";
+				return false;
+			}
+			if (!output(&inflate_buffer[0], inflate_buffer.size() - zstream.avail_out)) return false;
+			if (ret == Z_STREAM_END) break; // anything after the end is garbage
+		}
+		return true;
+	}
+};
+
+// decodes a chunked body directly from the receive buffer, passing the chunk contents to output without copying them
+struct ChunkProcessor {
+	std::function<bool (const u8 *, size_t)> output;
+	enum class State {
+		SIZE,
+		EXTENSION, // chunk extensions after ';' are ignored
+		SIZE_LF,
+		DATA,
+		DATA_CR,
+		DATA_LF,
+		TRAILER_LINE_START,
+		TRAILER_LINE,
+		FINAL_LF,
+		DONE
+	};
+	State state = State::SIZE;
+	u32 size = 0;
+	int size_digits = 0;
+	u32 remaining = 0;
+	
+	static int hex_value(u8 c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		return -1;
+	}
+	int fail(const char *message, u8 c) {
+		Util_log_save("http-chunk", std::string(message) + " : ", (int) c);
+		return -1;
 	}
 	
 	// -1 : error
 	// 0 : not the end
-	// 1 : end reached
-	template<class T> int push(const T &str) {
-		buffer.insert(buffer.end(), str.begin(), str.end());
-		if (size == -1) {
-			try_to_parse_size();
-			if (error) return -1;
-			if (size == -1) return 0;
-		}
-		while ((int) buffer.size() >= size_size + 2 + size + 2) {
-			{
-				auto tmp = std::string(buffer.begin() + size_size + 2 + size, buffer.begin() + size_size + 2 + size + 2);
-				if (tmp != "\r\n") {
-					Util_log_save("http-chunk", "expected \\r\\n after chunk content end : " + std::to_string(tmp[0]) + " " + std::to_string(tmp[1]));
-					return -1;
-				}
+	// 1 : end reached, *consumed is set to the number of bytes that belonged to this body (the rest is the next pipelined response)
+	int push(const u8 *data, size_t data_size, size_t *consumed) {
+		const u8 *begin = data;
+		const u8 *end = data + data_size;
+		*consumed = data_size;
+		while (data < end) {
+			if (state == State::DATA) {
+				u32 cur_size = std::min<size_t>(remaining, end - data);
+				if (!output(data, cur_size)) return -1;
+				data += cur_size;
+				remaining -= cur_size;
+				if (!remaining) state = State::DATA_CR;
+				continue;
 			}
-			result.insert(result.end(), buffer.begin() + size_size + 2, buffer.begin() + size_size + 2 + size);
-			buffer.erase(buffer.begin(), buffer.begin() + size_size + 2 + size + 2);
-			// Util_log_save("http-chunk", "read chunk size : " + std::to_string(size));
-			if (size == 0) {
-				if (buffer.size()) {
-					Util_log_save("http-chunk", "trailing data : " + std::string(buffer.begin(), buffer.end()));
-					return -1;
+			u8 c = *data++;
+			switch (state) {
+				case State::SIZE : {
+					int value = hex_value(c);
+					if (value >= 0) {
+						if (++size_digits > 8) return fail("chunk size too large", c);
+						size = size * 16 + value;
+					} else if (c == ';') state = State::EXTENSION;
+					else if (c == '\r') state = State::SIZE_LF;
+					else return fail("unexpected char in chunk size", c);
+					break;
 				}
-				return 1;
+				case State::EXTENSION :
+					if (c == '\r') state = State::SIZE_LF;
+					break;
+				case State::SIZE_LF :
+					if (c != '\n' || !size_digits) return fail("malformed chunk size line", c);
+					// Util_log_save("http-chunk", "read chunk size : " + std::to_string(size));
+					if (size) {
+						remaining = size;
+						state = State::DATA;
+					} else state = State::TRAILER_LINE_START;
+					break;
+				case State::DATA_CR :
+					if (c != '\r') return fail("expected \\r\\n after chunk content end", c);
+					state = State::DATA_LF;
+					break;
+				case State::DATA_LF :
+					if (c != '\n') return fail("expected \\r\\n after chunk content end", c);
+					size = 0;
+					size_digits = 0;
+					state = State::SIZE;
+					break;
+				case State::TRAILER_LINE_START :
+					state = c == '\r' ? State::FINAL_LF : State::TRAILER_LINE;
+					break;
+				case State::TRAILER_LINE :
+					if (c == '\n') state = State::TRAILER_LINE_START;
+					break;
+				case State::FINAL_LF :
+					if (c != '\n') return fail("expected \\n at the end of the chunked body", c);
+					state = State::DONE;
+					*consumed = data - begin;
+					return 1;
+				default :
+					break;
 			}
-			try_to_parse_size();
-			if (error) return -1;
-			if (size == -1) break;
 		}
-		return 0;
+		return state == State::DONE ? 1 : 0;
 	}
 };
-static bool perform_http_request(NetworkSession &session, const std::string &request_content, std::vector<u8> &buffer, NetworkResult &result) {
-	if (session.fail) return false;
+// parses one response out of the bytes received from the session
+struct ResponseReader {
+	BodyWriter &body_writer;
+	ResponseHeader response_header;
+	std::string header_content;
+	ChunkProcessor chunk_processor;
+	s64 content_length = -1;
+	s64 content_received = 0;
+	bool header_end_encountered = false;
+	bool chunked = false;
+	bool done = false;
+	bool error = false;
+	
+	ResponseReader (BodyWriter &body_writer) : body_writer(body_writer) {
+		chunk_processor.output = [this] (const u8 *data, size_t size) { return this->body_writer.write(data, size); };
+	}
+	
+	// returns the number of bytes that belong to this response
+	size_t feed(const u8 *data, size_t size) {
+		if (body_writer.result.timing.first_byte < 0) body_writer.result.timing.first_byte = get_time_ms() - body_writer.start_time;
+		size_t header_consumed = 0;
+		if (!header_end_encountered) {
+			size_t prev_size = header_content.size();
+			header_content.append((const char *) data, size);
+			auto end_pos = header_content.find("\r\n\r\n", prev_size >= 3 ? prev_size - 3 : 0);
+			if (end_pos == std::string::npos) return size;
+			// Util_log_save("http", "header end, size: " + std::to_string(end_pos + 4));
+			response_header = parse_header(header_content.data(), header_content.data() + end_pos + 4);
+			header_end_encountered = true;
+			body_writer.status_code = response_header.status_code;
+			if (response_header.content_encoding.size()) body_writer.set_content_encoding(response_header.content_encoding);
+			// the body starts in the middle of what has just been fed
+			header_consumed = end_pos + 4 - prev_size;
+			data += header_consumed;
+			size -= header_consumed;
+			if (response_header.content_length != -1) {
+				// Util_log_save("http", "content length : " + std::to_string(response_header.content_length));
+				content_length = response_header.content_length;
+				body_writer.set_content_length(content_length);
+			} else if (response_header.status_code == HTTP_STATUS_CODE_NO_CONTENT) {
+				content_length = 0;
+			} else if (response_header.chunked) {
+				// Util_log_save("http-chunk", "start chunk-transfer");
+				chunked = true;
+			} else {
+				Util_log_save("http", "Neither Content-Length nor Transfer-Encoding: chunked is specified");
+				error = true;
+				return header_consumed;
+			}
+			if (content_length == 0) {
+				done = true;
+				return header_consumed;
+			}
+		}
+		if (chunked) {
+			size_t consumed;
+			int push_res = chunk_processor.push(data, size, &consumed);
+			if (push_res == -1) {
+				Util_log_save("http", "push failed");
+				error = true;
+			} else if (push_res == 1) done = true;
+			return header_consumed + consumed;
+		} else {
+			size_t cur_size = std::min<s64>(size, content_length - content_received);
+			content_received += cur_size;
+			if (!body_writer.write(data, cur_size)) error = true;
+			else if (content_received == content_length) done = true;
+			return header_consumed + cur_size;
+		}
+	}
+};
+
+// sends all the requests at once (HTTP/1.1 pipelining) and reads the responses in order
+// on_response (if any) is called as soon as each response is complete, returning false stops reading the rest
+// returns the number of responses successfully read, the results after that are left untouched
+static size_t perform_http_requests(NetworkSession &session, const std::vector<std::string> &request_contents, std::vector<u8> &buffer,
+	const std::vector<NetworkResult *> &results, const std::vector<BodyWriter *> &body_writers, const std::function<bool (size_t)> &on_response = nullptr) {
+	
+	if (session.fail) return 0;
 	
 	static constexpr int TIMEOUT_MS = 1000 * 15;
 	
+	size_t response_read = 0;
+	NetworkResult &first_result = *results[0];
 	{
 		Result lictru_res = 0;
 		TickCounter clock;
@@ -276,14 +656,14 @@ static bool perform_http_request(NetworkSession &session, const std::string &req
 		
 		// Util_log_save("sslc", "Starting the TLS connection...");
 		
-
+		double tls_start_time = get_time_ms();
 		while (!exiting) {
 			lictru_res = sslcStartConnection(&session.sslc_context, NULL, NULL);
 			if ((unsigned int) lictru_res == 0xD840B807) {
 				// Util_log_save("sslc", "sslcStartConnection would block");
 				usleep(5000);
 				if (osTickCounterRead(&clock) >= TIMEOUT_MS) {
-					result.error = "StartConnection Timeout";
+					first_result.error = "StartConnection Timeout";
 					Util_log_save("sslc", "sslcStartConnection timed out");
 					goto fail;
 				}
@@ -292,17 +672,20 @@ static bool perform_http_request(NetworkSession &session, const std::string &req
 				goto fail;
 			} else break;
 		}
-		if (exiting) return false;
+		if (exiting) return 0;
+		first_result.timing.tls = get_time_ms() - tls_start_time; // negligible if the session has already done the handshake
 		
 		osTickCounterUpdate(&clock);
 		
+		std::string request_content;
+		for (auto &content : request_contents) request_content += content;
 		size_t total_sent_size = 0;
 		while (!exiting && total_sent_size < request_content.size()) {
 			lictru_res = sslcWrite(&session.sslc_context, (u8 *) request_content.c_str() + total_sent_size, request_content.size() - total_sent_size);
 			if ((u32) lictru_res == 0xD840B803) { // would block
 				usleep(3000);
 				if (osTickCounterRead(&clock) >= TIMEOUT_MS) {
-					result.error = "Write Timeout";
+					first_result.error = "Write Timeout";
 					Util_log_save("sslc", "sslcWrite timed out");
 					goto fail;
 				}
@@ -313,121 +696,92 @@ static bool perform_http_request(NetworkSession &session, const std::string &req
 				osTickCounterUpdate(&clock);
 			}
 		}
-		if (exiting) return false;
+		if (exiting) return 0;
 		osTickCounterUpdate(&clock);
 		
 		
-		ResponseHeader response_header;
-		std::string content;
-		ChunkProcessor chunk_processor;
-		int content_length = -1;
-		bool header_end_encountered = false;
-		while (!exiting) {
-			if (content_length != -1 && (int) content.size() >= content_length) break;
-			lictru_res = sslcRead(&session.sslc_context, &buffer[0], buffer.size(), false);
-			
-			if ((u32) lictru_res == 0xD840B802) {
-				// Util_log_save("sslc", "would block");
-				usleep(3000);
-				if (osTickCounterRead(&clock) >= TIMEOUT_MS) {
-					result.error = "Read Timeout";
-					Util_log_save("sslc", "sslcRead timed out");
-					goto fail;
-				}
-			} else if ((u32) lictru_res == 0xD8A0B805) { // probably session expired
-				Util_log_save("sslc", "session expired, reopening...");
-				session.close();
-				session.open(session.host_name);
-				Util_log_save("sslc", "session reopened... fail:" + std::to_string(session.fail));
-				if (!session.fail) return perform_http_request(session, request_content, buffer, result);
-				else goto fail;
-			} else if (R_FAILED(lictru_res)) {
-				Util_log_save("sslc", "sslcRead() failed : ", lictru_res);
-				goto fail;
-			} else {
-				osTickCounterUpdate(&clock);
-				// Util_log_save("sslc", "<= Recv data: " + std::to_string(lictru_res));
-				if (content_length == -1 && header_end_encountered) { // chunked
-					int push_res = chunk_processor.push(std::string(buffer.begin(), buffer.begin() + lictru_res));
-					if (push_res == -1) {
-						Util_log_save("http", "push failed");
+		std::string pending; // received, but belongs to the responses after the current one
+		bool received_anything = false;
+		for (; response_read < results.size(); response_read++) {
+			NetworkResult &result = *results[response_read];
+			ResponseReader reader(*body_writers[response_read]);
+			if (pending.size()) {
+				size_t consumed = reader.feed((const u8 *) pending.data(), pending.size());
+				pending.erase(0, consumed);
+			}
+			while (!exiting && !reader.done && !reader.error) {
+				lictru_res = sslcRead(&session.sslc_context, &buffer[0], buffer.size(), false);
+				
+				if ((u32) lictru_res == 0xD840B802) {
+					// Util_log_save("sslc", "would block");
+					usleep(3000);
+					if (osTickCounterRead(&clock) >= TIMEOUT_MS) {
+						result.error = "Read Timeout";
+						Util_log_save("sslc", "sslcRead timed out");
 						goto fail;
-					} else if (push_res == 1) {
-						content = std::move(chunk_processor.result);
-						content_length = content.size();
-						break;
 					}
+				} else if ((u32) lictru_res == 0xD8A0B805) { // probably session expired
+					if (received_anything) goto fail; // part of the body might have already been passed to the sink
+					Util_log_save("sslc", "session expired, reopening...");
+					session.close();
+					session.open(session.host_name);
+					Util_log_save("sslc", "session reopened... fail:" + std::to_string(session.fail));
+					if (!session.fail) return perform_http_requests(session, request_contents, buffer, results, body_writers, on_response);
+					else goto fail;
+				} else if (R_FAILED(lictru_res)) {
+					Util_log_save("sslc", "sslcRead() failed : ", lictru_res);
+					goto fail;
 				} else {
-					content.insert(content.end(), buffer.begin(), buffer.begin() + lictru_res);
-					if (!header_end_encountered) {
-						auto end_pos = content.find("\r\n\r\n", std::max<int>((int) content.size() - lictru_res - 3, 0));
-						if (end_pos != std::string::npos) {
-							// Util_log_save("http", "header end, size: " + std::to_string(end_pos + 4));
-							response_header = parse_header(content.substr(0, end_pos + 4));
-							header_end_encountered = true;
-							if (response_header.headers.count("Content-Length")) {
-								content = content.substr(end_pos + 4, content.size());
-								// Util_log_save("http", "content length : " + response_header.headers["Content-Length"]);
-								content_length = stoll(response_header.headers["Content-Length"]); // TODO : error handling
-							} else if (response_header.status_code == HTTP_STATUS_CODE_NO_CONTENT) {
-								content = content.substr(end_pos + 4, content.size());
-								content_length = 0;
-								break;
-							} else if (response_header.headers.count("Transfer-Encoding") && response_header.headers["Transfer-Encoding"] == "chunked") {
-								// Util_log_save("http-chunk", "start chunk-transfer");
-								int push_res = chunk_processor.push(content.substr(end_pos + 4, content.size()));
-								if (push_res == -1) {
-									Util_log_save("http", "push failed");
-									goto fail;
-								} else if (push_res == 1) {
-									content = chunk_processor.result;
-									content_length = content.size();
-									break;
-								}
-							} else {
-								Util_log_save("http", "Neither Content-Length nor Transfer-Encoding: chunked is specified");
-								goto fail;
-							}
-						}
-					}
+					osTickCounterUpdate(&clock);
+					// Util_log_save("sslc", "<= Recv data: " + std::to_string(lictru_res));
+					received_anything = true;
+					size_t consumed = reader.feed(&buffer[0], lictru_res);
+					pending.append(buffer.begin() + consumed, buffer.begin() + lictru_res);
 				}
 			}
+			if (exiting) return response_read;
+			if (reader.error) {
+				if (reader.body_writer.aborted) result.error = reader.body_writer.error;
+				goto fail;
+			}
+			
+			// for (auto i : reader.response_header.headers) Util_log_save("sslc", "header " + i.first + ": " + i.second);
+			// Util_log_save("http", "status code : " + std::to_string(reader.response_header.status_code));
+			result.status_code = reader.response_header.status_code;
+			result.status_message = reader.response_header.status_message;
+			result.response_headers = std::move(reader.response_header.headers);
+			result.timing.total = get_time_ms() - reader.body_writer.start_time;
+			if (response_read) result.timing.dns = result.timing.connect = result.timing.tls = 0;
+			bool go_on = !on_response || on_response(response_read);
+			if (reader.response_header.connection_close) {
+				// Util_log_save("http", "Connection: Close specified, closing...");
+				session.close();
+				return response_read + 1; // the rest of the requests are discarded by the server
+			}
+			if (!go_on) {
+				if (response_read + 1 < results.size()) session.fail = true; // the remaining responses are still on the wire
+				return response_read + 1;
+			}
 		}
-		if (exiting) return false;
-		
-		// for (auto i : response_header.headers) Util_log_save("sslc", "header " + i.first + ": " + i.second);
-		// Util_log_save("http", "status code : " + std::to_string(response_header.status_code));
-		if (content_length != (int) content.size()) {
-			Util_log_save("http", "content size          : ", content_length);
-			Util_log_save("http", "content size (actual): ", (unsigned int) content.size());
-			goto fail;
-		}
-		result.data = std::vector<u8> (content.begin(), content.end());
-		result.status_code = response_header.status_code;
-		result.status_message = response_header.status_message;
-		for (auto header : response_header.headers) {
-			auto key = header.first;
-			for (auto &c : key) c = tolower(c);
-			result.response_headers[key] = header.second;
-		}
-		auto connection_header = result.get_header("Connection");
-		for (auto &c : connection_header) c = tolower(c);
-		if (connection_header == "close") {
-			// Util_log_save("http", "Connection: Close specified, closing...");
-			session.close();
+		if (pending.size()) {
+			Util_log_save("http", "trailing data after the response : ", (unsigned int) pending.size());
+			session.fail = true;
 		}
-		return true;
+		return response_read;
 	}
 	
 	fail :
 	// prevent session resumption 
 	session.fail = true;
-	return false;
+	return response_read;
+}
+static bool perform_http_request(NetworkSession &session, const std::string &request_content, std::vector<u8> &buffer, NetworkResult &result, BodyWriter &body_writer) {
+	return perform_http_requests(session, {request_content}, buffer, {&result}, {&body_writer}) == 1;
 }
 
 static size_t curl_receive_data_callback_func(char *in_ptr, size_t, size_t len, void *user_data) {
-	std::vector<u8> *out = (std::vector<u8> *) user_data;
-	out->insert(out->end(), in_ptr, in_ptr + len);
+	BodyWriter *out = (BodyWriter *) user_data;
+	if (!out->write((const u8 *) in_ptr, len)) return 0; // makes curl_easy_perform() fail with CURLE_WRITE_ERROR
 	
 	// Util_log_save("curl", "received : " + std::to_string(len));
 	return len;
@@ -460,10 +814,96 @@ int curl_set_socket_options(void *, curl_socket_t sockfd, curlsocktype purpose)
 }
  
 
-static NetworkResult access_http_internal(NetworkSessionList &session_list, const std::string &method, const std::string &url,
-	std::map<std::string, std::string> request_headers, const std::string &body, bool follow_redirect) {
+void network_curl_get_timing(CURL *curl, NetworkTiming &timing) {
+	double namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0, size = 0;
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &size);
+	// curl reports the time elapsed since the start for each phase
+	timing.dns = namelookup * 1000;
+	timing.connect = std::max(0.0, connect - namelookup) * 1000;
+	timing.tls = appconnect > 0 ? std::max(0.0, appconnect - connect) * 1000 : 0;
+	timing.first_byte = starttransfer * 1000;
+	timing.total = total * 1000;
+	timing.bytes = size;
+}
+void network_curl_setup_handle(CURL *curl) {
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 102400L);
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_receive_headers_callback_func);
+	curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, curl_set_socket_options);
+	curl_easy_setopt(curl, CURLOPT_SHARE, get_curl_share());
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L); // prefer an existing HTTP/2 connection to opening a new one
+	curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, (long) (DNS_CACHE_TTL_MS / 1000));
+	curl_easy_setopt(curl, CURLOPT_SSL_SESSIONID_CACHE, 1L); // shared through curl_share, so a new connection can resume a TLS session
+	// curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+}
+std::map<std::string, std::string> network_get_default_request_headers() {
+	static const std::string DEFAULT_USER_AGENT = "Mozilla/5.0 (Linux; Android 11; Pixel 3a) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/83.0.4103.101 Mobile Safari/537.36";
+	return {
+		{"Accept", "*/*"},
+		{"Connection", "Keep-Alive"},
+		{"User-Agent", DEFAULT_USER_AGENT}
+	};
+}
+
+static void add_default_request_headers(std::map<std::string, std::string> &request_headers) {
+	static const std::map<std::string, std::string> default_headers = network_get_default_request_headers();
+	for (auto header : default_headers) if (!request_headers.count(header.first)) request_headers[header.first] = header.second;
+	// pages and innertube responses are large text that compresses well, but ranged (media) requests must stay as they are
+	if (!request_headers.count("Range") && !request_headers.count("Accept-Encoding")) request_headers["Accept-Encoding"] = "gzip";
+}
+// borrows an idle session to the host from the pool, or opens a new one
+static bool get_sslc_session(const std::string &host_name, NetworkSession &session, NetworkResult &res) {
+	if (session_pool_borrow(host_name, session)) {
+		res.timing.dns = res.timing.connect = 0;
+		return true;
+	}
+	// Util_log_save("net-io", "init : " + host_name);
+	// the retries wait for the shared backoff, which ends early when the connection comes back
+	for (int i = 0; i < SSLC_OPEN_ATTEMPTS; i++) {
+		if (!connectivity_wait_until_usable(SSLC_OPEN_WAIT_TIMEOUT_NS)) break;
+		session.open(host_name);
+		if (session.inited) {
+			connectivity_report_success();
+			break;
+		}
+		connectivity_report_failure();
+		Util_log_save("sslc", "failed to init session : " + std::to_string(i));
+		if (i + 1 < SSLC_OPEN_ATTEMPTS) metrics_add(Metric::HTTP_RETRIES);
+	}
+	if (!session.inited) {
+		res.fail = true;
+		res.error = connectivity_is_usable() ? "failed to init session for " + host_name : "no connection";
+		return false;
+	}
+	res.timing.dns = session.dns_time;
+	res.timing.connect = session.connect_time;
+	return true;
+}
+static std::string build_sslc_request(const std::string &method, const std::string &url, std::map<std::string, std::string> request_headers,
+	const std::string &body) {
+	
+	request_headers["Host"] = url_get_host_name(url);
+	if (method == "POST") request_headers["Content-Length"] = std::to_string(body.size());
+	
+	auto page_url = get_page_url(url);
+	std::string request_content = method + " " + page_url + " HTTP/1.1\r\n";
+	for (auto header : request_headers) request_content += header.first + ": " + header.second + "\r\n";
+	request_content += "\r\n";
+	request_content += body;
+	return request_content;
+}
+
+static NetworkResult access_http_internal_untimed(NetworkSessionList &session_list, const std::string &method, const std::string &url,
+	std::map<std::string, std::string> request_headers, const std::string &body, bool follow_redirect, const NetworkDataSink *sink) {
 	
 	NetworkResult res;
+	BodyWriter body_writer(res, sink);
 	
 	if (!session_list.inited) {
 		res.fail = true;
@@ -477,45 +917,15 @@ static NetworkResult access_http_internal(NetworkSessionList &session_list, cons
 		return res;
 	}
 	
-	static const std::string DEFAULT_USER_AGENT = "Mozilla/5.0 (Linux; Android 11; Pixel 3a) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/83.0.4103.101 Mobile Safari/537.36";
-	static const std::map<std::string, std::string> default_headers = {
-		{"Accept", "*/*"},
-		{"Connection", "Keep-Alive"},
-		{"User-Agent", DEFAULT_USER_AGENT}
-	};
-	for (auto header : default_headers) if (!request_headers.count(header.first)) request_headers[header.first] = header.second;
+	add_default_request_headers(request_headers);
 	
 	if (var_network_framework == NETWORK_FRAMEWORK_SSLC) {
-		auto host_name = url_get_host_name(url);
-		request_headers["Host"] = host_name;
-		
-		NetworkSession &session_using = session_list.sessions[host_name];
-		if (!session_using.inited || session_using.fail) {
-			// Util_log_save("net-io", "init : " + host_name);
-			session_using.close();
-			for (int i = 0; i < 3; i++) {
-				session_using.open(host_name);
-				if (!session_using.inited) {
-					Util_log_save("sslc", "retrying to init session : " + std::to_string(i));
-					usleep(500000);
-				} else break;
-			}
-			if (!session_using.inited) {
-				res.fail = true;
-				res.error = "failed to init session for " + host_name;
-				return res;
-			}
-		}
-		
-		if (method == "POST") request_headers["Content-Length"] = std::to_string(body.size());
+		NetworkSession session_using;
+		if (!get_sslc_session(url_get_host_name(url), session_using, res)) return res;
 		
-		auto page_url = get_page_url(url);
-		std::string request_content = method + " " + page_url + " HTTP/1.1\r\n";
-		for (auto header : request_headers) request_content += header.first + ": " + header.second + "\r\n";
-		request_content += "\r\n";
-		request_content += body;
-		
-		if (!perform_http_request(session_using, request_content, *session_list.buffer, res)) res.fail = true;
+		std::string request_content = build_sslc_request(method, url, request_headers, body);
+		if (!perform_http_request(session_using, request_content, *session_list.buffer, res, body_writer)) res.fail = true;
+		session_pool_give_back(session_using);
 		if (exiting) {
 			res.fail = true;
 			res.error = "The app is about to exit";
@@ -544,29 +954,42 @@ static NetworkResult access_http_internal(NetworkSessionList &session_list, cons
 			res.error = "httpcGetResponseStatusCode() failed : " + std::to_string(libctru_res);
 			return res;
 		}
+		res.timing.first_byte = get_time_ms() - body_writer.start_time; // httpc doesn't tell the breakdown of the time until the response header
 		res.status_code = status_code;
+		body_writer.status_code = status_code;
+		{
+			char encoding[0x40] = { 0 };
+			if (httpcGetResponseHeader(&res.context, "Content-Encoding", encoding, sizeof(encoding)) == 0) body_writer.set_content_encoding(encoding);
+			u32 content_size = 0;
+			httpcGetDownloadSizeState(&res.context, NULL, &content_size);
+			body_writer.set_content_length(content_size ? (s64) content_size : -1);
+		}
 		
 		auto &buffer = *session_list.buffer;
 		while (1) {
 			u32 len_read;
 			Result ret = httpcDownloadData(&res.context, &buffer[0], buffer.size(), &len_read);
-			res.data.insert(res.data.end(), buffer.begin(), buffer.begin() + len_read);
+			if (!body_writer.write(&buffer[0], len_read)) {
+				res.fail = true;
+				res.error = body_writer.error;
+				break;
+			}
 			if (ret != (s32) HTTPC_RESULTCODE_DOWNLOADPENDING) break;
 		}
 	} else if (var_network_framework == NETWORK_FRAMEWORK_LIBCURL) {
 		CURL *&curl = session_list.curl;
 		if (!curl) {
 			curl = curl_easy_init();
-			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+			network_curl_setup_handle(curl);
 			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, (long) follow_redirect);
-			curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 102400L);
-			curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
 			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_receive_data_callback_func);
-			curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curl_receive_headers_callback_func);
-			curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, curl_set_socket_options);
-			// curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
 		}
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &res.data);
+		body_writer.curl = curl;
+		// the connections in the shared cache may have been killed by a sleep since this handle was last used
+		u32 generation = network_lifecycle_get_generation();
+		curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, (long) (session_list.lifecycle_generation != generation));
+		session_list.lifecycle_generation = generation;
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body_writer);
 		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &res.response_headers);
 		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
 		if (method == "POST") curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
@@ -587,18 +1010,162 @@ static NetworkResult access_http_internal(NetworkSessionList &session_list, cons
 			curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &redirected_url);
 			res.redirected_url = redirected_url;
 			if (res.redirected_url != url) Util_log_save("curl", "redir : " + res.redirected_url);
+			network_curl_get_timing(curl, res.timing);
+		} else if (body_writer.aborted) {
+			res.fail = true;
+			res.error = body_writer.error;
 		} else Util_log_save("curl", "deep fail");
 		
 		curl_slist_free_all(request_headers_list);
 	}
 	return res;
 }
-NetworkResult Access_http_get(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers, bool follow_redirect) {
+static bool host_ends_with(const std::string &host, const char *suffix) {
+	size_t len = strlen(suffix);
+	return host.size() >= len && !host.compare(host.size() - len, len, suffix);
+}
+// network_stats_record(), network_trace_record() and the counters of system/util/metrics.hpp, the bytes are attributed by the host
+static void record_request(const std::string &url, const NetworkResult &res, double start_time) {
+	std::string host = url_get_host_name(url);
+	network_trace_record(host, network_scheduler_get_thread_class(), start_time, res.fail ? -1 : res.status_code, res.timing);
+	metrics_add(Metric::HTTP_REQUESTS);
+	if (res.fail) {
+		metrics_add(Metric::HTTP_FAILURES);
+		return;
+	}
+	network_stats_record(host, res.timing);
+	Metric bytes_metric = Metric::PAGE_BYTES;
+	if (host_ends_with(host, ".googlevideo.com")) bytes_metric = Metric::STREAM_BYTES;
+	else if (host_ends_with(host, "ytimg.com") || host_ends_with(host, "ggpht.com") || host_ends_with(host, "googleusercontent.com")) bytes_metric = Metric::THUMBNAIL_BYTES;
+	metrics_add(bytes_metric, res.timing.bytes);
+}
+// holds a slot of network_scheduler.hpp in the traffic class of the current thread for its scope
+struct ScheduledRequest {
+	NetworkTrafficClass traffic_class = network_scheduler_get_thread_class();
+	std::string host;
+	
+	explicit ScheduledRequest (const std::string &url) : host(url_get_host_name(url)) { network_scheduler_acquire(traffic_class, host); }
+	ScheduledRequest (const ScheduledRequest &) = delete;
+	ScheduledRequest &operator = (const ScheduledRequest &) = delete;
+	~ScheduledRequest () { network_scheduler_release(traffic_class, host); }
+};
+static NetworkResult access_http_internal(NetworkSessionList &session_list, const std::string &method, const std::string &url,
+	std::map<std::string, std::string> request_headers, const std::string &body, bool follow_redirect, const NetworkDataSink *sink) {
+	
+	ScheduledRequest scheduled(url); // the time waiting for the turn is not counted
+	double start_time = get_time_ms();
+	NetworkResult res = access_http_internal_untimed(session_list, method, url, request_headers, body, follow_redirect, sink);
+	if (var_network_framework != NETWORK_FRAMEWORK_LIBCURL) res.timing.total = get_time_ms() - start_time;
+	record_request(url, res, start_time);
+	return res;
+}
+// googlevideo redirects the stream urls to an edge node keeping the path (/videoplayback), and every new stream (reinit, livestream fragments...)
+// would pay for the same hop again : remember which host each host + path went to, and send the next requests there directly
+#define REDIRECT_CACHE_TTL_MS (10 * 60 * 1000)
+#define REDIRECT_CACHE_MAX_SIZE 64
+struct RedirectCacheEntry {
+	std::string target; // scheme + host
+	u64 expire_time;
+};
+static std::map<std::string, RedirectCacheEntry> redirect_cache; // key : host + path of the original url
+static Handle redirect_cache_lock;
+static bool redirect_cache_lock_initialized = false;
+
+static void redirect_cache_lock_acquire() {
+	if (!redirect_cache_lock_initialized) {
+		svcCreateMutex(&redirect_cache_lock, false);
+		redirect_cache_lock_initialized = true;
+	}
+	svcWaitSynchronization(redirect_cache_lock, std::numeric_limits<s64>::max());
+}
+// splits "https://host/path?query" into "https://host", "/path" and "?query"
+static bool split_url(const std::string &url, std::string &origin, std::string &path, std::string &query) {
+	auto pos0 = url.find("://");
+	if (pos0 == std::string::npos) return false;
+	auto path_start = url.find('/', pos0 + 3);
+	if (path_start == std::string::npos) path_start = url.size();
+	auto query_start = url.find('?', path_start);
+	if (query_start == std::string::npos) query_start = url.size();
+	origin = url.substr(0, path_start);
+	path = url.substr(path_start, query_start - path_start);
+	query = url.substr(query_start);
+	return true;
+}
+static std::string redirect_cache_key(const std::string &url) {
+	std::string origin, path, query;
+	if (!split_url(url, origin, path, query)) return "";
+	return url_get_host_name(url) + path;
+}
+// returns the url to actually request, which is the url itself if nothing is cached
+static std::string redirect_cache_apply(const std::string &url) {
+	std::string origin, path, query;
+	if (!split_url(url, origin, path, query)) return url;
+	std::string key = url_get_host_name(url) + path;
+	std::string res = url;
+	redirect_cache_lock_acquire();
+	auto itr = redirect_cache.find(key);
+	if (itr != redirect_cache.end()) {
+		if (itr->second.expire_time > osGetTime()) res = itr->second.target + path + query;
+		else redirect_cache.erase(itr);
+	}
+	svcReleaseMutex(redirect_cache_lock);
+	return res;
+}
+static void redirect_cache_store(const std::string &original_url, const std::string &final_url) {
+	std::string origin, path, query;
+	std::string final_origin, final_path, final_query;
+	if (!split_url(original_url, origin, path, query) || !split_url(final_url, final_origin, final_path, final_query)) return;
+	if (origin == final_origin || path != final_path) return; // only plain moves to another host can be replayed
+	redirect_cache_lock_acquire();
+	if (redirect_cache.size() >= REDIRECT_CACHE_MAX_SIZE) redirect_cache.clear();
+	redirect_cache[url_get_host_name(original_url) + path] = {final_origin, osGetTime() + REDIRECT_CACHE_TTL_MS};
+	svcReleaseMutex(redirect_cache_lock);
+}
+static void redirect_cache_invalidate(const std::string &original_url) {
+	std::string key = redirect_cache_key(original_url);
+	redirect_cache_lock_acquire();
+	redirect_cache.erase(key);
+	svcReleaseMutex(redirect_cache_lock);
+}
+
+static NetworkResult access_http_get_internal(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers,
+	bool follow_redirect, const NetworkDataSink *sink) {
+	TRACE_ZONE("Access_http_get");
+	
+	const std::string original_url = url;
+	if (follow_redirect) url = redirect_cache_apply(url);
+	bool use_cached_redirect = url != original_url;
+	
+	// the request can only be made again from the original url if nothing has been passed to the sink yet
+	// (like `received_anything` of the sslc reopen) : a sink that has taken part of a body can't take it again from the start
+	bool sink_received_anything = false;
+	NetworkDataSink counting_sink;
+	if (sink) counting_sink = [&] (const u8 *data, size_t size, s64 content_length) {
+		sink_received_anything = true;
+		return (*sink)(data, size, content_length);
+	};
+	
 	NetworkResult result;
 	while (1) {
-		result = access_http_internal(session_list, "GET", url , request_headers, "", follow_redirect);
+		result = access_http_internal(session_list, "GET", url , request_headers, "", follow_redirect, sink ? &counting_sink : NULL);
+		if (use_cached_redirect && (result.fail || result.status_code / 100 == 4 || result.status_code / 100 == 5)) {
+			// the edge node doesn't serve it (anymore), start again from the original url
+			if (sink_received_anything) { // the caller retries with a fresh sink, which goes to the original url
+				redirect_cache_invalidate(original_url);
+				return result;
+			}
+			Util_log_save("http", "cached redirect failed, retrying with the original url");
+			metrics_add(Metric::HTTP_RETRIES);
+			use_cached_redirect = false;
+			redirect_cache_invalidate(original_url);
+			result.finalize();
+			url = original_url;
+			continue;
+		}
 		if (result.status_code / 100 != 3) {
-			result.redirected_url = url;
+			// curl follows redirects by itself and reports where it ended up
+			if (result.redirected_url == "") result.redirected_url = url;
+			if (follow_redirect && !result.fail && result.status_code_is_success()) redirect_cache_store(original_url, result.redirected_url);
 			return result;
 		}
 		Util_log_save("http", "redir");
@@ -607,22 +1174,100 @@ NetworkResult Access_http_get(NetworkSessionList &session_list, std::string url,
 			return result;
 		}
 		auto new_url = result.get_header("Location");
-		if (var_network_framework == NETWORK_FRAMEWORK_SSLC) {
-			auto old_host = url_get_host_name(url);
-			auto new_host = url_get_host_name(new_url);
-			if (old_host != new_host) {
-				session_list.sessions[old_host].close();
-				session_list.sessions.erase(old_host);
-			}
-		}
 		result.finalize();
 		url = new_url;
 	}
 }
+NetworkResult Access_http_get(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers, bool follow_redirect) {
+	return access_http_get_internal(session_list, url, request_headers, follow_redirect, NULL);
+}
+NetworkResult Access_http_get_streaming(NetworkSessionList &session_list, std::string url, const std::map<std::string, std::string> &request_headers,
+	const NetworkDataSink &sink, bool follow_redirect) {
+	return access_http_get_internal(session_list, url, request_headers, follow_redirect, &sink);
+}
+std::vector<NetworkResult> Access_http_get_pipelined(NetworkSessionList &session_list, const std::string &url,
+	const std::vector<std::map<std::string, std::string> > &request_headers_list, const std::function<bool (size_t, NetworkResult &)> &on_response) {
+	
+	std::vector<NetworkResult> results(request_headers_list.size());
+	if (!results.size()) return results;
+	if (var_network_framework != NETWORK_FRAMEWORK_SSLC || results.size() == 1 || !session_list.inited ||
+		(url.substr(0, 7) != "http://" && url.substr(0, 8) != "https://")) {
+		
+		size_t i = 0;
+		for (; i < results.size(); i++) {
+			results[i] = access_http_internal(session_list, "GET", url, request_headers_list[i], "", false, NULL);
+			results[i].redirected_url = url;
+			if (on_response && !on_response(i, results[i])) break;
+		}
+		for (i++; i < results.size(); i++) {
+			results[i].fail = true;
+			results[i].error = "cancelled";
+			results[i].redirected_url = url;
+		}
+		return results;
+	}
+	
+	ScheduledRequest scheduled(url); // the requests go over one connection, so they take one slot
+	double start_time = get_time_ms();
+	NetworkSession session_using;
+	if (!get_sslc_session(url_get_host_name(url), session_using, results[0])) return results;
+	
+	std::vector<std::string> request_contents;
+	std::vector<NetworkResult *> result_ptrs;
+	std::deque<BodyWriter> body_writers; // never relocates its elements
+	std::vector<BodyWriter *> body_writer_ptrs;
+	for (size_t i = 0; i < results.size(); i++) {
+		auto request_headers = request_headers_list[i];
+		add_default_request_headers(request_headers);
+		request_contents.push_back(build_sslc_request("GET", url, request_headers, ""));
+		result_ptrs.push_back(&results[i]);
+		body_writers.emplace_back(results[i], (const NetworkDataSink *) NULL);
+		body_writer_ptrs.push_back(&body_writers.back());
+	}
+	size_t response_read = perform_http_requests(session_using, request_contents, *session_list.buffer, result_ptrs, body_writer_ptrs, [&] (size_t i) {
+		results[i].redirected_url = url;
+		return !on_response || on_response(i, results[i]);
+	});
+	session_pool_give_back(session_using);
+	for (size_t i = 0; i < results.size(); i++) {
+		results[i].redirected_url = url;
+		if (i >= response_read || exiting) {
+			results[i].fail = true;
+			if (results[i].error == "") results[i].error = exiting ? "The app is about to exit" : "no response for the pipelined request";
+		}
+		record_request(url, results[i], start_time);
+	}
+	return results;
+}
+void Access_prewarm_connection(NetworkSessionList &session_list, const std::string &url) {
+	if (var_network_framework == NETWORK_FRAMEWORK_SSLC) {
+		std::string host_name = url_get_host_name(url);
+		if (session_pool_has(host_name)) return;
+		NetworkSession session;
+		NetworkResult res;
+		if (get_sslc_session(host_name, session, res)) {
+			Util_log_save("net-io", "prewarmed : " + host_name + " (" + std::to_string((int) res.timing.connect) + "ms)");
+			session_pool_give_back(session);
+		}
+	} else if (var_network_framework == NETWORK_FRAMEWORK_LIBCURL) {
+		// a connection opened with CURLOPT_CONNECT_ONLY is never reused, so make a real (minimal) request
+		auto result = access_http_internal(session_list, "GET", url, {{"Range", "bytes=0-0"}}, "", false, NULL);
+		result.finalize();
+	}
+	// httpc : every request opens its own connection anyway
+}
+void network_close_idle_connections() { session_pool_close_all(); }
 NetworkResult Access_http_post(NetworkSessionList &session_list, const std::string &url, const std::map<std::string, std::string> &request_headers,
 	const std::string &data) {
 	
-	auto result = access_http_internal(session_list, "POST", url , request_headers, data, false);
+	auto result = access_http_internal(session_list, "POST", url , request_headers, data, false, NULL);
+	result.redirected_url = url;
+	return result;
+}
+NetworkResult Access_http_post_streaming(NetworkSessionList &session_list, const std::string &url, const std::map<std::string, std::string> &request_headers,
+	const std::string &data, const NetworkDataSink &sink) {
+	
+	auto result = access_http_internal(session_list, "POST", url , request_headers, data, false, &sink);
 	result.redirected_url = url;
 	return result;
 }
@@ -0,0 +1,70 @@
+#include "headers.hpp"
+#include "network/network_lifecycle.hpp"
+#include "network/network_io.hpp"
+#include "network/connectivity.hpp"
+#include "system/util/async_task.hpp"
+
+#define RESUME_HANDLER_MAX 4
+
+static const char *PREWARM_URLS[] = { "https://m.youtube.com/", "https://www.youtube.com/" };
+
+namespace {
+	aptHookCookie apt_hook_cookie;
+	bool hooked = false;
+	volatile u32 generation = 0;
+	volatile bool suspended = false;
+	void (*resume_handlers[RESUME_HANDLER_MAX])();
+	volatile int resume_handler_num = 0; // incremented after the handler is stored, so that on_resume_task() can read it any time
+	NetworkSessionList prewarm_session_list; // only used by on_resume_task(), which never runs twice at the same time
+}
+
+static void on_resume_task(void *) {
+	if (!prewarm_session_list.inited) prewarm_session_list.init();
+	for (auto url : PREWARM_URLS) {
+		if (suspended) return; // suspended again meanwhile
+		Access_prewarm_connection(prewarm_session_list, url);
+	}
+	for (int i = 0; i < resume_handler_num; i++) resume_handlers[i]();
+}
+
+static void on_suspend() {
+	if (suspended) return;
+	suspended = true;
+	generation++;
+	Util_log_save("net/lifecycle", "suspended, closing the idle connections");
+	connectivity_set_suspended(true);
+	network_close_idle_connections();
+}
+static void on_resume() {
+	if (!suspended) return;
+	suspended = false;
+	Util_log_save("net/lifecycle", "resumed");
+	// what has been opened in the meantime might already be dead as well
+	network_close_idle_connections();
+	connectivity_set_suspended(false);
+	queue_async_task(on_resume_task, NULL, AsyncTaskPriority::VISIBLE);
+}
+
+// called from the thread handling the APT events, so nothing here blocks for long
+static void apt_hook_func(APT_HookType hook, void *) {
+	if (hook == APTHOOK_ONSUSPEND || hook == APTHOOK_ONSLEEP) on_suspend();
+	else if (hook == APTHOOK_ONRESTORE || hook == APTHOOK_ONWAKEUP) on_resume();
+}
+
+void network_lifecycle_init() {
+	if (hooked) return;
+	aptHook(&apt_hook_cookie, apt_hook_func, NULL);
+	hooked = true;
+}
+void network_lifecycle_exit() {
+	if (!hooked) return;
+	aptUnhook(&apt_hook_cookie);
+	hooked = false;
+}
+
+void network_lifecycle_add_resume_handler(void (*handler)()) {
+	if (resume_handler_num >= RESUME_HANDLER_MAX) return;
+	resume_handlers[resume_handler_num] = handler;
+	resume_handler_num++;
+}
+u32 network_lifecycle_get_generation() { return generation; }
@@ -0,0 +1,99 @@
+#include "headers.hpp"
+#include "network/network_scheduler.hpp"
+#include "system/util/light_lock.hpp"
+#include <map>
+#include <set>
+
+#define WAIT_SLICE_NS 50000000 // 50 ms, the waiters check again at least this often
+#define LOG_STR "net/sched"
+
+namespace {
+	LightMutex resource_lock;
+	// signaled when a slot is released or the starving state changes, only one waiter wakes up so the others rely on WAIT_SLICE_NS
+	LightEventFlag state_change_event{RESET_ONESHOT};
+
+	int class_in_flight[(int) NetworkTrafficClass::NUM];
+	std::map<std::string, int> host_in_flight;
+	std::set<const void *> starving_sources;
+
+	__thread int thread_class = (int) NetworkTrafficClass::INTERACTIVE;
+}
+
+NetworkTrafficClassScope::NetworkTrafficClassScope (NetworkTrafficClass traffic_class) : prev((NetworkTrafficClass) thread_class) {
+	thread_class = (int) traffic_class;
+}
+NetworkTrafficClassScope::~NetworkTrafficClassScope () { thread_class = (int) prev; }
+NetworkTrafficClass network_scheduler_get_thread_class() { return (NetworkTrafficClass) thread_class; }
+
+static bool can_start_wo_lock(NetworkTrafficClass traffic_class, const std::string &host) {
+	if (traffic_class == NetworkTrafficClass::PLAYBACK) return true;
+	auto itr = host_in_flight.find(host);
+	if (itr != host_in_flight.end() && itr->second >= NETWORK_SCHEDULER_MAX_PER_HOST) return false;
+	if (starving_sources.size()) {
+		if (traffic_class == NetworkTrafficClass::PREFETCH) return false;
+		if (traffic_class == NetworkTrafficClass::VISIBLE_THUMBNAIL &&
+			class_in_flight[(int) NetworkTrafficClass::VISIBLE_THUMBNAIL] >= NETWORK_SCHEDULER_STARVING_THUMBNAILS) return false;
+	}
+	return true;
+}
+static void take_slot_wo_lock(NetworkTrafficClass traffic_class, const std::string &host) {
+	class_in_flight[(int) traffic_class]++;
+	host_in_flight[host]++;
+}
+
+bool network_scheduler_can_start(NetworkTrafficClass traffic_class, const std::string &host) {
+	LightMutexGuard guard(resource_lock);
+	return can_start_wo_lock(traffic_class, host);
+}
+bool network_scheduler_try_acquire(NetworkTrafficClass traffic_class, const std::string &host) {
+	LightMutexGuard guard(resource_lock);
+	if (!can_start_wo_lock(traffic_class, host)) return false;
+	take_slot_wo_lock(traffic_class, host);
+	return true;
+}
+void network_scheduler_acquire(NetworkTrafficClass traffic_class, const std::string &host) {
+	u64 deadline = osGetTime() + NETWORK_SCHEDULER_MAX_WAIT_MS;
+	bool waited = false;
+	while (true) {
+		resource_lock.lock();
+		if (can_start_wo_lock(traffic_class, host) || osGetTime() >= deadline) {
+			if (!can_start_wo_lock(traffic_class, host)) Util_log_save(LOG_STR, "gave up waiting for " + host);
+			take_slot_wo_lock(traffic_class, host);
+			resource_lock.unlock();
+			break;
+		}
+		resource_lock.unlock();
+		waited = true;
+		state_change_event.wait(WAIT_SLICE_NS);
+	}
+	// a release might have woken us up instead of a waiter that can start now
+	if (waited) state_change_event.signal();
+}
+void network_scheduler_release(NetworkTrafficClass traffic_class, const std::string &host) {
+	{
+		LightMutexGuard guard(resource_lock);
+		class_in_flight[(int) traffic_class]--;
+		auto itr = host_in_flight.find(host);
+		if (itr != host_in_flight.end() && !--itr->second) host_in_flight.erase(itr);
+	}
+	state_change_event.signal();
+}
+
+void network_scheduler_set_starving(const void *source, bool starving) {
+	bool changed;
+	{
+		LightMutexGuard guard(resource_lock);
+		bool was_starving = starving_sources.size();
+		if (starving) starving_sources.insert(source);
+		else starving_sources.erase(source);
+		changed = was_starving != (bool) starving_sources.size();
+	}
+	if (changed) {
+		Util_log_trace(LOG_STR, starving ? "a stream is starving, holding back the lower classes" : "no stream is starving anymore");
+		state_change_event.signal();
+	}
+}
+bool network_scheduler_is_starving() {
+	LightMutexGuard guard(resource_lock);
+	return starving_sources.size();
+}
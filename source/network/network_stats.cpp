@@ -0,0 +1,85 @@
+#include "headers.hpp"
+#include "network/network_stats.hpp"
+#include <algorithm>
+
+namespace {
+	struct Sample {
+		std::string host;
+		NetworkTiming timing;
+	};
+	Sample samples[NETWORK_STATS_SAMPLES];
+	int sample_head = 0; // next position to write
+	int sample_num = 0;
+	u64 session_bytes = 0;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+void network_stats_record(const std::string &host, const NetworkTiming &timing) {
+	if (host == "") return;
+	lock();
+	samples[sample_head] = {host, timing};
+	sample_head = (sample_head + 1) % NETWORK_STATS_SAMPLES;
+	sample_num = std::min(sample_num + 1, NETWORK_STATS_SAMPLES);
+	session_bytes += timing.bytes;
+	release();
+}
+u64 network_stats_get_session_bytes() {
+	lock();
+	u64 res = session_bytes;
+	release();
+	return res;
+}
+
+static double percentile(std::vector<double> &values, double p) {
+	if (!values.size()) return 0;
+	size_t index = std::min(values.size() - 1, (size_t) (values.size() * p));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+std::vector<NetworkHostStats> network_stats_get() {
+	std::vector<Sample> cur_samples;
+	lock();
+	// from the oldest to the newest
+	for (int i = 0; i < sample_num; i++) cur_samples.push_back(samples[(sample_head - sample_num + i + NETWORK_STATS_SAMPLES) % NETWORK_STATS_SAMPLES]);
+	release();
+
+	std::vector<std::string> hosts;
+	for (auto &sample : cur_samples) if (std::find(hosts.begin(), hosts.end(), sample.host) == hosts.end()) hosts.push_back(sample.host);
+
+	std::vector<NetworkHostStats> res;
+	for (auto &host : hosts) {
+		NetworkHostStats cur;
+		cur.host = host;
+		std::vector<double> latencies;
+		double transfer_time = 0;
+		u64 transfer_bytes = 0;
+		for (auto &sample : cur_samples) if (sample.host == host) {
+			cur.request_num++;
+			cur.last = sample.timing;
+			if (sample.timing.first_byte >= 0) latencies.push_back(sample.timing.first_byte);
+			if (sample.timing.first_byte >= 0 && sample.timing.total >= 0) {
+				transfer_time += sample.timing.total - sample.timing.first_byte;
+				transfer_bytes += sample.timing.bytes;
+			}
+		}
+		cur.latency_p50 = percentile(latencies, 0.5);
+		cur.latency_p95 = percentile(latencies, 0.95);
+		cur.throughput = transfer_time > 0 ? transfer_bytes / transfer_time : 0;
+		res.push_back(cur);
+	}
+	std::stable_sort(res.begin(), res.end(), [] (const NetworkHostStats &a, const NetworkHostStats &b) { return a.request_num > b.request_num; });
+	return res;
+}
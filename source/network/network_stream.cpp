@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <map>
+#include "network/network_stream.hpp"
+#include "network/stream_disk_cache.hpp"
+#include "system/util/memory_budget.hpp"
+#include "types.hpp"
+#include "system/util/log.hpp"
+
+// definitions for constants that are passed by reference (std::min, std::max)
+constexpr u64 NetworkStream::BLOCK_SIZE;
+constexpr u64 NetworkStream::MAX_REQUEST_BLOCKS;
+
+// all streams share one pool of BLOCK_SIZE buffers so that the heap doesn't get fragmented by repeated large allocations
+static constexpr size_t MAX_POOLED_FREE_BLOCKS = NetworkStream::MAX_CACHE_BLOCKS;
+static LightMutex block_pool_lock;
+static std::vector<u8 *> block_pool_free_list;
+
+static void block_pool_lock_acquire() {
+	block_pool_lock.lock();
+}
+static u8 *block_pool_allocate() {
+	u8 *res = NULL;
+	block_pool_lock_acquire();
+	if (block_pool_free_list.size()) {
+		res = block_pool_free_list.back();
+		block_pool_free_list.pop_back();
+	}
+	block_pool_lock.unlock();
+	if (!res) res = (u8 *) malloc(NetworkStream::BLOCK_SIZE);
+	if (res) memory_budget_add(MemoryBudgetUser::STREAM_BLOCKS, NetworkStream::BLOCK_SIZE);
+	else memory_pressure_report(MemoryPressure::CRITICAL);
+	return res;
+}
+static void block_pool_free(u8 *block) {
+	memory_budget_add(MemoryBudgetUser::STREAM_BLOCKS, -(s64) NetworkStream::BLOCK_SIZE);
+	bool keep = memory_pressure_get_level() == MemoryPressure::NONE;
+	block_pool_lock_acquire();
+	if (keep && block_pool_free_list.size() < MAX_POOLED_FREE_BLOCKS) {
+		block_pool_free_list.push_back(block);
+		block = NULL;
+	}
+	block_pool_lock.unlock();
+	free(block);
+}
+
+// prefetch side cache
+namespace {
+	struct PrefetchedStream {
+		std::string url;
+		u64 len;
+		std::map<u64, u8 *> blocks;
+	};
+	std::list<PrefetchedStream> prefetched_streams; // the front is the oldest one
+	u64 prefetch_cache_size = 0;
+	LightMutex prefetch_cache_lock;
+}
+static void prefetch_cache_lock_acquire() {
+	prefetch_cache_lock.lock();
+}
+// prefetch_cache_lock must be held
+static void prefetch_cache_erase(std::list<PrefetchedStream>::iterator itr) {
+	for (auto &block : itr->blocks) {
+		block_pool_free(block.second);
+		prefetch_cache_size -= NetworkStream::BLOCK_SIZE;
+	}
+	prefetched_streams.erase(itr);
+}
+bool network_stream_prefetch_cache_store(const std::string &url, u64 stream_len, u64 block, const u8 *data, size_t size) {
+	prefetch_cache_lock_acquire();
+	auto itr = std::find_if(prefetched_streams.begin(), prefetched_streams.end(), [&] (const PrefetchedStream &stream) { return stream.url == url; });
+	if (itr == prefetched_streams.end()) itr = prefetched_streams.insert(prefetched_streams.end(), PrefetchedStream{url, stream_len, {}});
+	// make room by dropping the oldest streams, but never the one being filled
+	while (prefetch_cache_size + NetworkStream::BLOCK_SIZE > NETWORK_STREAM_PREFETCH_CACHE_MAX_SIZE && prefetched_streams.begin() != itr)
+		prefetch_cache_erase(prefetched_streams.begin());
+	bool res = false;
+	// the side cache is the first to give way to the memory budget
+	if (!itr->blocks.count(block) && prefetch_cache_size + NetworkStream::BLOCK_SIZE <= NETWORK_STREAM_PREFETCH_CACHE_MAX_SIZE &&
+		!memory_budget_is_over(NetworkStream::BLOCK_SIZE)) {
+		u8 *buffer = block_pool_allocate();
+		if (buffer) {
+			memcpy(buffer, data, std::min<size_t>(size, NetworkStream::BLOCK_SIZE));
+			itr->blocks[block] = buffer;
+			prefetch_cache_size += NetworkStream::BLOCK_SIZE;
+			res = true;
+		}
+	}
+	if (!itr->blocks.size()) prefetched_streams.erase(itr);
+	prefetch_cache_lock.unlock();
+	return res;
+}
+bool network_stream_prefetch_cache_has(const std::string &url, u64 block) {
+	prefetch_cache_lock_acquire();
+	bool res = false;
+	for (auto &stream : prefetched_streams) if (stream.url == url) res = stream.blocks.count(block);
+	prefetch_cache_lock.unlock();
+	return res;
+}
+void network_stream_prefetch_cache_clear() {
+	prefetch_cache_lock_acquire();
+	while (prefetched_streams.size()) prefetch_cache_erase(prefetched_streams.begin());
+	prefetch_cache_lock.unlock();
+}
+void network_stream_shed_memory(MemoryPressure level) {
+	if (level == MemoryPressure::NONE) return;
+	if (level == MemoryPressure::CRITICAL) network_stream_prefetch_cache_clear();
+	block_pool_lock_acquire();
+	std::vector<u8 *> blocks;
+	blocks.swap(block_pool_free_list);
+	block_pool_lock.unlock();
+	for (auto block : blocks) free(block);
+}
+
+u64 network_stream_eviction_policy_simple(const NetworkStream &stream) {
+	u64 read_head_block = stream.read_head / NetworkStream::BLOCK_SIZE;
+	if (*stream.downloaded_blocks.begin() < read_head_block) return *stream.downloaded_blocks.begin();
+	else return *std::prev(stream.downloaded_blocks.end());
+}
+u64 network_stream_eviction_policy_seek_aware(const NetworkStream &stream) {
+	u64 read_head = stream.read_head;
+	u64 res = *stream.downloaded_blocks.begin();
+	u64 max_score = 0;
+	for (auto block : stream.downloaded_blocks) {
+		u64 block_l = block * NetworkStream::BLOCK_SIZE;
+		u64 block_r = block_l + NetworkStream::BLOCK_SIZE;
+		u64 score;
+		if (block_r <= read_head) { // behind the read head
+			u64 distance = read_head - block_r;
+			// blocks inside the back buffer are the most valuable, ones beyond it the least
+			score = distance <= stream.back_buffer_size ? distance / 2 : distance * 2;
+		} else score = block_l > read_head ? block_l - read_head : 0;
+		for (auto target : stream.recent_seek_targets) {
+			u64 distance = target < block_l ? block_l - target : (target >= block_r ? target - block_r : 0);
+			score = std::min(score, distance);
+		}
+		if (score >= max_score) {
+			max_score = score;
+			res = block;
+		}
+	}
+	return res;
+}
+
+NetworkStream::NetworkStream(std::string url, bool whole_download, NetworkSessionList *session_list) : url(url), whole_download(whole_download), session_list(session_list), origin_url(url) {
+	if (!whole_download) source = stream_source_create(url);
+	if (!whole_download && !is_local_file()) adopt_prefetched_blocks();
+}
+NetworkStream::NetworkStream(std::string url, StreamSource *source) : url(url), source(source), origin_url(url) {}
+void NetworkStream::adopt_prefetched_blocks() {
+	prefetch_cache_lock_acquire();
+	auto itr = std::find_if(prefetched_streams.begin(), prefetched_streams.end(), [&] (const PrefetchedStream &stream) { return stream.url == url; });
+	if (itr != prefetched_streams.end()) {
+		len = itr->len;
+		block_num = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		downloaded_data.resize(block_num, NULL);
+		for (auto &block : itr->blocks) {
+			if (block.first < block_num) {
+				downloaded_data[block.first] = block.second;
+				downloaded_blocks.insert(block.first);
+				set_block_present(block.first, true);
+			} else block_pool_free(block.second);
+			prefetch_cache_size -= BLOCK_SIZE;
+		}
+		prefetched_streams.erase(itr);
+		ready = true;
+		Util_log_save("net/dl", "adopted " + std::to_string(downloaded_blocks.size()) + " prefetched blocks");
+	}
+	prefetch_cache_lock.unlock();
+}
+NetworkStream::~NetworkStream() {
+	if (cache_hit_num || cache_miss_num)
+		Util_log_debug("net/dl", "cache hit : " + std::to_string(cache_hit_num) + " miss : " + std::to_string(cache_miss_num));
+	for (auto block : downloaded_blocks) free_block(block);
+	downloaded_data.clear();
+	downloaded_blocks.clear();
+	memory_budget_add(MemoryBudgetUser::STREAM_BLOCKS, -(s64) whole_data.size());
+	for (auto bits : present_bits_generations) delete bits;
+	delete source;
+	if (disk_cache_key != "") stream_disk_cache_save_index();
+}
+void NetworkStream::wait_for_data(s64 timeout_ns) {
+	data_arrival_event.wait(timeout_ns);
+}
+void NetworkStream::notify_downloader() {
+#ifndef _WIN32 // the host tools fill the streams themselves
+	if (downloader_wakeup_event) svcSignalEvent(downloader_wakeup_event);
+#endif
+}
+bool NetworkStream::is_data_available(u64 start, u64 size) {
+	if (!ready) return false;
+	if (start + size > len) return false;
+	if (!size) return true;
+	u64 end_block = (start + size - 1) / BLOCK_SIZE;
+	return find_missing_block(start / BLOCK_SIZE, end_block + 1) == end_block + 1;
+}
+bool NetworkStream::is_block_present(u64 block) const {
+	std::vector<u32> *bits = __atomic_load_n(&present_bits, __ATOMIC_ACQUIRE);
+	if (!bits || block >= bits->size() * 32) return false;
+	return __atomic_load_n(&(*bits)[block >> 5], __ATOMIC_RELAXED) >> (block & 31) & 1;
+}
+u64 NetworkStream::find_missing_block(u64 from, u64 limit) const {
+	std::vector<u32> *bits = __atomic_load_n(&present_bits, __ATOMIC_ACQUIRE);
+	u64 bit_num = bits ? bits->size() * 32 : 0;
+	for (u64 block = from; block < limit; ) {
+		if (block >= bit_num) return block;
+		// the missing ones in the word, from `block` on
+		u32 missing = ~__atomic_load_n(&(*bits)[block >> 5], __ATOMIC_RELAXED) & (~0U << (block & 31));
+		if (missing) return std::min(limit, (block & ~(u64) 31) + __builtin_ctz(missing));
+		block = (block & ~(u64) 31) + 32;
+	}
+	return limit;
+}
+u64 NetworkStream::count_present_blocks(u64 from, u64 to) const {
+	std::vector<u32> *bits = __atomic_load_n(&present_bits, __ATOMIC_ACQUIRE);
+	if (!bits) return 0;
+	to = std::min<u64>(to, bits->size() * 32);
+	u64 res = 0;
+	for (u64 block = from; block < to; ) {
+		u64 word_end = std::min(to, (block & ~(u64) 31) + 32);
+		u32 mask = (word_end - block == 32 ? ~0U : ((1U << (word_end - block)) - 1)) << (block & 31);
+		res += __builtin_popcount(__atomic_load_n(&(*bits)[block >> 5], __ATOMIC_RELAXED) & mask);
+		block = word_end;
+	}
+	return res;
+}
+void NetworkStream::set_block_present(u64 block, bool present) {
+	std::vector<u32> *bits = present_bits;
+	if (!bits || block >= bits->size() * 32) {
+		if (!present) return;
+		std::vector<u32> *new_bits = new std::vector<u32>((std::max(block + 1, block_num) + 31) / 32);
+		if (bits) std::copy(bits->begin(), bits->end(), new_bits->begin());
+		present_bits_generations.push_back(new_bits);
+		__atomic_store_n(&present_bits, new_bits, __ATOMIC_RELEASE);
+		bits = new_bits;
+	}
+	if (present) __atomic_fetch_or(&(*bits)[block >> 5], 1U << (block & 31), __ATOMIC_RELEASE);
+	else __atomic_fetch_and(&(*bits)[block >> 5], ~(1U << (block & 31)), __ATOMIC_RELEASE);
+}
+bool NetworkStream::get_data(u64 start, u64 size, u8 *buf) {
+	if (!ready) return false;
+	if (!size) return true;
+	u64 end = start + size - 1;
+	u64 start_block = start / BLOCK_SIZE;
+	u64 end_block = end / BLOCK_SIZE;
+	bool res = true;
+	
+	downloaded_data_lock.lock();
+	for (u64 block = start_block; block <= end_block; block++) {
+		// the block may not be downloaded yet or may have been evicted after is_data_available() was called
+		if (!is_block_downloaded(block)) {
+			res = false;
+			break;
+		}
+		u64 cur_l = std::max(start, block * BLOCK_SIZE) - block * BLOCK_SIZE;
+		u64 cur_r = std::min(end + 1, (block + 1) * BLOCK_SIZE) - block * BLOCK_SIZE;
+		memcpy(buf, downloaded_data[block] + cur_l, cur_r - cur_l);
+		buf += cur_r - cur_l;
+	}
+	downloaded_data_lock.unlock();
+	return res;
+}
+void NetworkStream::set_data(u64 block, const u8 *data, size_t size) {
+	downloaded_data_lock.lock();
+	if (downloaded_data.size() <= block) downloaded_data.resize(std::max<u64>(block + 1, block_num), NULL);
+	if (!downloaded_data[block]) {
+		downloaded_data[block] = block_pool_allocate();
+		if (!downloaded_data[block]) {
+			Util_log_save("net/dl", "failed to allocate block " + std::to_string(block));
+			downloaded_data_lock.unlock();
+			return;
+		}
+		downloaded_blocks.insert(block);
+	}
+	memcpy(downloaded_data[block], data, std::min<size_t>(size, BLOCK_SIZE));
+	set_block_present(block, true); // after the data is in place
+	// ensure it doesn't cache too much and run out of memory
+	if (downloaded_blocks.size() > MAX_CACHE_BLOCKS || (downloaded_blocks.size() > MIN_CACHE_BLOCKS && memory_budget_is_over())) {
+		u64 evicted_block = eviction_policy(*this);
+		Util_log_trace("net/dl", "free " + std::to_string(evicted_block));
+		free_block(evicted_block);
+		downloaded_blocks.erase(evicted_block);
+	}
+	downloaded_data_lock.unlock();
+	data_arrival_event.signal();
+}
+void NetworkStream::set_whole_data(std::vector<u8> &data) {
+	downloaded_data_lock.lock();
+	for (auto block : downloaded_blocks) free_block(block);
+	downloaded_blocks.clear();
+	memory_budget_add(MemoryBudgetUser::STREAM_BLOCKS, (s64) data.size() - (s64) whole_data.size());
+	whole_data.swap(data);
+	downloaded_data.assign(block_num, NULL);
+	for (u64 i = 0; i < block_num && i * BLOCK_SIZE < whole_data.size(); i++) {
+		downloaded_data[i] = whole_data.data() + i * BLOCK_SIZE;
+		downloaded_blocks.insert(i);
+		set_block_present(i, true);
+	}
+	downloaded_data_lock.unlock();
+	data_arrival_event.signal();
+}
+void NetworkStream::free_block(u64 block) {
+	set_block_present(block, false);
+	if (whole_data.empty()) block_pool_free(downloaded_data[block]); // otherwise it's a part of whole_data
+	downloaded_data[block] = NULL;
+}
+void NetworkStream::discard_data_before(u64 pos) {
+	downloaded_data_lock.lock();
+	while (downloaded_blocks.size() && (*downloaded_blocks.begin() + 1) * BLOCK_SIZE <= pos) {
+		u64 block = *downloaded_blocks.begin();
+		free_block(block);
+		downloaded_blocks.erase(downloaded_blocks.begin());
+	}
+	downloaded_data_lock.unlock();
+}
+void NetworkStream::record_seek(u64 pos) {
+	downloaded_data_lock.lock();
+	recent_seek_targets.push_back(pos);
+	if (recent_seek_targets.size() > MAX_RECENT_SEEK_TARGETS) recent_seek_targets.erase(recent_seek_targets.begin());
+	downloaded_data_lock.unlock();
+}
+double NetworkStream::get_download_percentage() {
+	downloaded_data_lock.lock();
+	double res = (double) downloaded_blocks.size() * BLOCK_SIZE / len * 100;
+	downloaded_data_lock.unlock();
+	return res;
+}
+std::vector<double> NetworkStream::get_buffering_progress_bar(int res_len) {
+	// lock-free, the bar is redrawn every frame anyway
+	std::vector<double> res(res_len);
+	for (int i = 0; i < res_len; i++) {
+		u64 l = (u64) len * i / res_len;
+		u64 r = std::min<u64>(len, len * (i + 1) / res_len);
+		if (r <= l) continue;
+		u64 first_block = l / BLOCK_SIZE;
+		u64 last_block = (r - 1) / BLOCK_SIZE;
+		double present = 0;
+		if (first_block == last_block) present = is_block_present(first_block) ? r - l : 0;
+		else {
+			// the blocks at both ends are only partially inside [l, r)
+			if (is_block_present(first_block)) present += (first_block + 1) * BLOCK_SIZE - l;
+			if (is_block_present(last_block)) present += r - last_block * BLOCK_SIZE;
+			present += (double) count_present_blocks(first_block + 1, last_block) * BLOCK_SIZE;
+		}
+		res[i] = present / (r - l) * 100;
+	}
+	return res;
+}
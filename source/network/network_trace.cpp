@@ -0,0 +1,118 @@
+#include "headers.hpp"
+#include "network/network_trace.hpp"
+#include "system/util/misc_tasks.hpp"
+#include <vector>
+
+#define PROFILE_DIR (DEF_MAIN_DIR + "profile/")
+#define FLUSH_RECORD_NUM 100
+#define MAX_BUFFERED_RECORD_NUM 2000 // records are dropped (and counted) if the sd card can't keep up
+#define LOG_STR "net-trace"
+
+namespace {
+	struct TraceRecord {
+		double start_time; // milliseconds since the start of the trace
+		std::string host;
+		NetworkTrafficClass traffic_class;
+		int status_code;
+		NetworkTiming timing;
+	};
+	struct PendingFile {
+		std::string file_name;
+		double start_time = 0;
+		std::vector<TraceRecord> records;
+		bool header_written = false;
+	};
+	// checked without the lock first, every request of the app goes through network_trace_record()
+	volatile bool running = false;
+	int file_cnt = 0;
+	PendingFile cur_file;
+	std::vector<PendingFile> closed_files; // stopped but not completely written yet
+	int dropped_record_num = 0;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static const char *traffic_class_names[(int) NetworkTrafficClass::NUM] = { "playback", "interactive", "thumbnail", "prefetch" };
+
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+void network_trace_start(const std::string &video_id) {
+	lock();
+	if (running) closed_files.push_back(cur_file);
+	cur_file = PendingFile();
+	cur_file.file_name = "net_" + video_id + "_" + std::to_string(var_num_of_app_start) + "_" + std::to_string(file_cnt++) + ".csv";
+	cur_file.start_time = get_time_ms();
+	running = true;
+	release();
+	Util_log_save(LOG_STR, "start : " + cur_file.file_name);
+}
+void network_trace_stop() {
+	lock();
+	if (running) {
+		closed_files.push_back(cur_file);
+		cur_file = PendingFile();
+		running = false;
+	}
+	release();
+	misc_tasks_request(TASK_FLUSH_NETWORK_TRACE);
+}
+void network_trace_record(const std::string &host, NetworkTrafficClass traffic_class, double start_time, int status_code, const NetworkTiming &timing) {
+	if (!running) return;
+	bool need_flush = false;
+	lock();
+	if (running) {
+		if (cur_file.records.size() >= MAX_BUFFERED_RECORD_NUM) dropped_record_num++;
+		else cur_file.records.push_back({std::max(0.0, start_time - cur_file.start_time), host, traffic_class, status_code, timing});
+		need_flush = cur_file.records.size() >= FLUSH_RECORD_NUM;
+	}
+	release();
+	if (need_flush) misc_tasks_request(TASK_FLUSH_NETWORK_TRACE);
+}
+
+static std::string to_csv_line(const TraceRecord &record) {
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%.1f,%s,%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%llu\n", record.start_time, record.host.c_str(),
+		traffic_class_names[(int) record.traffic_class], record.status_code, record.timing.dns, record.timing.connect, record.timing.tls,
+		record.timing.first_byte, record.timing.total, (unsigned long long) record.timing.bytes);
+	return buf;
+}
+static void write_file(PendingFile &file) {
+	std::string data;
+	// keep in sync with the reader of tools/downloader_sim
+	if (!file.header_written) data += "start_ms,host,class,status,dns_ms,connect_ms,tls_ms,first_byte_ms,total_ms,bytes\n";
+	for (auto &record : file.records) data += to_csv_line(record);
+	if (!data.size()) return;
+
+	Result_with_string result = Util_file_save_to_file(file.file_name, PROFILE_DIR, (u8 *) data.c_str(), data.size(), !file.header_written);
+	if (result.code != 0) Util_log_save(LOG_STR, "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+	file.header_written = true;
+}
+void network_trace_flush() {
+	// take the records out so that the requests aren't blocked while writing
+	lock();
+	std::vector<PendingFile> files = closed_files;
+	closed_files.clear();
+	if (running) {
+		files.push_back(cur_file);
+		cur_file.records.clear();
+		cur_file.header_written = true; // written just below
+	}
+	int dropped = dropped_record_num;
+	dropped_record_num = 0;
+	release();
+
+	for (auto &file : files) write_file(file);
+	if (dropped) Util_log_save(LOG_STR, "dropped " + std::to_string(dropped) + " records");
+}
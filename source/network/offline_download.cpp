@@ -0,0 +1,331 @@
+#include "headers.hpp"
+#include "network/offline_download.hpp"
+#include "network/network_downloader.hpp"
+#include "system/thread_placement.hpp"
+#include "json11/json11.hpp"
+#include <deque>
+
+using namespace json11;
+
+#define OFFLINE_DIR (DEF_MAIN_DIR + "offline/")
+#define INDEX_FILE_NAME "offline_videos.json"
+#define INDEX_VERSION 0
+#define TMP_VIDEO_FILE_NAME "video.tmp"
+#define TMP_AUDIO_FILE_NAME "audio.tmp"
+#define MUXER_SESSION 0
+// the whole file is going to be read sequentially, so a small window is enough to keep the link busy
+#define FORWARD_READ_BLOCKS 24
+#define STREAM_WAIT_TIMEOUT_NS 50000000 // 50 ms
+#define LOG_STR "offline"
+
+namespace {
+	std::vector<OfflineVideo> offline_videos;
+	std::deque<OfflineDownloadRequest> requests;
+	std::string downloading_id;
+	volatile double downloading_progress = 0;
+	volatile bool should_be_running = true;
+
+	NetworkStreamDownloader downloader;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+static std::string get_file_name(const std::string &id) { return id + ".mp4"; }
+
+static void load_offline_videos() {
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(INDEX_FILE_NAME, DEF_MAIN_DIR, &file_size);
+	if (result.code != 0) return; // nothing has been saved yet
+
+	char *buf = (char *) malloc(file_size + 1);
+	if (!buf) return;
+	u32 read_size;
+	result = Util_file_load_from_file(INDEX_FILE_NAME, DEF_MAIN_DIR, (u8 *) buf, file_size, &read_size);
+	Util_log_save(LOG_STR, "Util_file_load_from_file()..." + result.string + result.error_description, result.code);
+	if (result.code == 0) {
+		buf[read_size] = '\0';
+
+		std::string error;
+		Json data = Json::parse(buf, error);
+		int version = data["version"] == Json() ? -1 : data["version"].int_value();
+		if (version >= 0) {
+			std::vector<OfflineVideo> loaded_videos;
+			for (auto video : data["videos"].array_items()) {
+				OfflineVideo cur_video;
+				cur_video.id = video["id"].string_value();
+				cur_video.title = video["title"].string_value();
+				cur_video.author_name = video["author_name"].string_value();
+				cur_video.length_text = video["length"].string_value();
+				cur_video.duration_ms = video["duration_ms"].int_value();
+				cur_video.quality = video["quality"].int_value();
+				{
+					auto str = video["size"].string_value();
+					char *end;
+					cur_video.size = strtoull(str.c_str(), &end, 10);
+				}
+				// the file might have been deleted manually
+				if (!youtube_is_valid_video_id(cur_video.id)) Util_log_save(LOG_STR, "invalid item, ignoring...");
+				else if (Util_file_check_file_exist(get_file_name(cur_video.id), OFFLINE_DIR).code != 0) Util_log_save(LOG_STR, "file missing, ignoring " + cur_video.id);
+				else loaded_videos.push_back(cur_video);
+			}
+			lock();
+			offline_videos = loaded_videos;
+			release();
+			Util_log_save(LOG_STR, "loaded " + std::to_string(loaded_videos.size()) + " videos");
+		} else Util_log_save(LOG_STR, "failed to load the list, json err:" + error);
+	}
+	free(buf);
+}
+static void save_offline_videos() {
+	lock();
+	auto backup = offline_videos;
+	release();
+
+	Json::array videos;
+	for (auto video : backup) {
+		videos.push_back(Json::object{
+			{"id", video.id},
+			{"title", video.title},
+			{"author_name", video.author_name},
+			{"length", video.length_text},
+			{"duration_ms", video.duration_ms},
+			{"quality", video.quality},
+			{"size", std::to_string(video.size)} // string value because json11 can't handle 64-bit integers
+		});
+	}
+	std::string data = Json(Json::object{{"version", INDEX_VERSION}, {"videos", videos}}).dump();
+
+	Result_with_string result = Util_file_save_to_file(INDEX_FILE_NAME, DEF_MAIN_DIR, (u8 *) data.c_str(), data.size(), true);
+	Util_log_save(LOG_STR, "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+}
+
+void offline_download_enqueue(const OfflineDownloadRequest &request) {
+	lock();
+	bool found = downloading_id == request.video.id;
+	for (auto &i : requests) if (i.video.id == request.video.id) found = true;
+	if (!found) requests.push_back(request);
+	release();
+}
+bool offline_download_is_queued(const std::string &id) {
+	lock();
+	bool res = downloading_id == id;
+	for (auto &i : requests) if (i.video.id == id) res = true;
+	release();
+	return res;
+}
+OfflineDownloadStatus offline_download_get_status() {
+	OfflineDownloadStatus res;
+	lock();
+	res.downloading_id = downloading_id;
+	res.progress = downloading_progress;
+	res.queued_num = requests.size();
+	release();
+	return res;
+}
+
+std::vector<OfflineVideo> offline_get_videos() {
+	lock();
+	auto res = offline_videos;
+	release();
+	return res;
+}
+bool offline_get_video(const std::string &id, OfflineVideo *video) {
+	bool res = false;
+	lock();
+	for (auto &i : offline_videos) if (i.id == id) {
+		if (video) *video = i;
+		res = true;
+	}
+	release();
+	return res;
+}
+bool offline_video_exists(const std::string &id) { return offline_get_video(id, NULL); }
+std::string offline_get_video_path(const std::string &id) { return OFFLINE_DIR + get_file_name(id); }
+void offline_erase_video(const std::string &id) {
+	lock();
+	std::vector<OfflineVideo> tmp_offline_videos;
+	for (auto &video : offline_videos) if (video.id != id) tmp_offline_videos.push_back(video);
+	offline_videos = tmp_offline_videos;
+	release();
+	Util_file_delete_file(get_file_name(id), OFFLINE_DIR);
+	save_offline_videos();
+}
+
+
+// writes the both streams into the temporary files while they are being downloaded in parallel
+static bool save_streams(NetworkStream *streams[2], const std::string file_names[2]) {
+	const u64 block_size = NetworkStream::BLOCK_SIZE;
+	std::vector<u8> buffer(block_size);
+	u64 pos[2] = {0, 0};
+	BufferedFileWriter writers[2];
+	for (int i = 0; i < 2; i++) {
+		Result_with_string result = writers[i].open(file_names[i], OFFLINE_DIR, false);
+		if (result.code != 0) {
+			Util_log_save(LOG_STR, "BufferedFileWriter::open()..." + result.string + result.error_description, result.code);
+			return false;
+		}
+	}
+
+	while (should_be_running) {
+		bool finished = true;
+		bool progressed = false;
+		for (int i = 0; i < 2; i++) {
+			NetworkStream *stream = streams[i];
+			if (stream->error) {
+				Util_log_save(LOG_STR, "stream error");
+				return false;
+			}
+			if (stream->ready && pos[i] >= stream->len) continue;
+			finished = false;
+			if (!stream->ready) continue;
+
+			u64 size = std::min(block_size, stream->len - pos[i]);
+			if (!stream->get_data(pos[i], size, buffer.data())) continue;
+			Result_with_string result = writers[i].write(buffer.data(), size);
+			if (result.code != 0) {
+				Util_log_save(LOG_STR, "BufferedFileWriter::write()..." + result.string + result.error_description, result.code);
+				return false;
+			}
+			pos[i] += size;
+			stream->read_head = pos[i];
+			stream->discard_data_before(pos[i]); // never read again
+			stream->notify_downloader();
+			progressed = true;
+		}
+		if (finished) {
+			for (int i = 0; i < 2; i++) {
+				Result_with_string result = writers[i].close();
+				if (result.code != 0) {
+					Util_log_save(LOG_STR, "BufferedFileWriter::close()..." + result.string + result.error_description, result.code);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		if (streams[0]->ready && streams[1]->ready)
+			downloading_progress = (double) (pos[0] + pos[1]) / (streams[0]->len + streams[1]->len) * 100;
+		if (!progressed) {
+			for (int i = 0; i < 2; i++) if (!streams[i]->ready || pos[i] < streams[i]->len) {
+				streams[i]->wait_for_data(STREAM_WAIT_TIMEOUT_NS);
+				break;
+			}
+		}
+	}
+	return false;
+}
+static Result_with_string mux_streams(const std::string &output_path) {
+	Result_with_string result;
+	result = Util_muxer_open_audio_file(OFFLINE_DIR + TMP_AUDIO_FILE_NAME, MUXER_SESSION);
+	if (result.code != 0) return result;
+	result = Util_muxer_open_video_file(OFFLINE_DIR + TMP_VIDEO_FILE_NAME, MUXER_SESSION);
+	if (result.code != 0) {
+		Util_muxer_close_audio_file(MUXER_SESSION);
+		return result;
+	}
+	result = Util_muxer_mux(output_path, MUXER_SESSION);
+	Util_muxer_close_audio_file(MUXER_SESSION);
+	Util_muxer_close_video_file(MUXER_SESSION);
+	return result;
+}
+static void process_request(OfflineDownloadRequest request) {
+	Util_log_save(LOG_STR, "start : " + request.video.id);
+	NetworkStream *streams[2] = {
+		new NetworkStream(request.video_stream_url, false, NULL),
+		new NetworkStream(request.audio_stream_url, false, NULL)
+	};
+	const std::string tmp_file_names[2] = { TMP_VIDEO_FILE_NAME, TMP_AUDIO_FILE_NAME };
+	for (auto stream : streams) {
+		stream->max_forward_read_blocks = FORWARD_READ_BLOCKS;
+		stream->eviction_policy = network_stream_eviction_policy_simple;
+		stream->back_buffer_size = 0;
+		downloader.add_stream(stream);
+	}
+
+	bool ok = save_streams(streams, tmp_file_names);
+	// the downloader owns the streams and deletes them
+	for (auto stream : streams) stream->quit_request = true;
+
+	std::string file_name = get_file_name(request.video.id);
+	if (ok) {
+		Util_file_delete_file(file_name, OFFLINE_DIR);
+		Result_with_string result = mux_streams(OFFLINE_DIR + file_name);
+		Util_log_save(LOG_STR, "mux_streams()..." + result.string + result.error_description, result.code);
+		if (result.code != 0) ok = false;
+	}
+	for (int i = 0; i < 2; i++) Util_file_delete_file(tmp_file_names[i], OFFLINE_DIR);
+
+	if (ok) {
+		u64 file_size = 0;
+		Util_file_check_file_size(file_name, OFFLINE_DIR, &file_size);
+		request.video.size = file_size;
+		lock();
+		std::vector<OfflineVideo> tmp_offline_videos;
+		for (auto &video : offline_videos) if (video.id != request.video.id) tmp_offline_videos.push_back(video);
+		tmp_offline_videos.push_back(request.video);
+		offline_videos = tmp_offline_videos;
+		release();
+		save_offline_videos();
+		Util_log_save(LOG_STR, "saved : " + request.video.id + " (" + std::to_string(file_size / 1000) + " KB)");
+	} else {
+		Util_file_delete_file(file_name, OFFLINE_DIR);
+		Util_log_save(LOG_STR, "failed : " + request.video.id);
+	}
+}
+
+void offline_download_thread_func(void *arg) {
+	(void) arg;
+
+	load_offline_videos();
+
+	downloader.set_traffic_class(NetworkTrafficClass::PREFETCH); // never ahead of the video being played or the UI
+	Thread worker_threads[NetworkStreamDownloader::WORKER_NUM];
+	for (int i = 0; i < NetworkStreamDownloader::WORKER_NUM; i++)
+		worker_threads[i] = thread_placement_create_thread(ThreadRole::OFFLINE_STREAM_DOWNLOADER, network_downloader_thread, &downloader, DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, false);
+
+	while (should_be_running) {
+		OfflineDownloadRequest cur_request;
+		bool found = false;
+		lock();
+		if (requests.size()) {
+			cur_request = requests.front();
+			requests.pop_front();
+			downloading_id = cur_request.video.id;
+			downloading_progress = 0;
+			found = true;
+		}
+		release();
+
+		if (!found) {
+			usleep(100000);
+			continue;
+		}
+		process_request(cur_request);
+		lock();
+		downloading_id = "";
+		release();
+	}
+
+	downloader.request_thread_exit();
+	for (int i = 0; i < NetworkStreamDownloader::WORKER_NUM; i++) {
+		threadJoin(worker_threads[i], std::numeric_limits<s64>::max());
+		threadFree(worker_threads[i]);
+	}
+	downloader.delete_all();
+
+	Util_log_save(LOG_STR, "Thread exit.");
+	threadExit(0);
+}
+void offline_download_thread_exit_request() { should_be_running = false; }
@@ -0,0 +1,186 @@
+#include "headers.hpp"
+#include "network/stream_disk_cache.hpp"
+#include <list>
+#include <map>
+#include <set>
+
+#define CACHE_DIR (DEF_MAIN_DIR + "stream_cache/")
+#define INDEX_FILE_NAME "index.txt"
+
+namespace {
+	struct CachedBlock {
+		std::string file_name;
+		u64 size;
+	};
+	std::list<CachedBlock> lru_list; // the front is the least recently used one
+	std::map<std::string, std::list<CachedBlock>::iterator> cached_blocks; // file name -> position in lru_list
+	std::map<std::string, u64> stream_lens;
+	u64 total_size = 0;
+	bool index_loaded = false;
+	bool index_dirty = false;
+	
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+static std::string get_block_file_name(const std::string &key, u64 block) {
+	return key + "_" + std::to_string(block) + ".bin";
+}
+
+// lock must be held
+static void load_index() {
+	if (index_loaded) return;
+	index_loaded = true;
+	
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(INDEX_FILE_NAME, CACHE_DIR, &file_size);
+	if (result.code != 0) return;
+	
+	char *buf = (char *) malloc(file_size + 1);
+	if (!buf) return;
+	u32 read_size;
+	result = Util_file_load_from_file(INDEX_FILE_NAME, CACHE_DIR, (u8 *) buf, file_size, &read_size);
+	if (result.code == 0) {
+		buf[read_size] = '\0';
+		// each line is either "len <key> <length>" or "block <file name> <size>", blocks are ordered from the least recently used one
+		char *line = strtok(buf, "\n");
+		while (line) {
+			char type[8], name[128];
+			unsigned long long value;
+			if (sscanf(line, "%7s %127s %llu", type, name, &value) == 3) {
+				if (!strcmp(type, "len")) stream_lens[name] = value;
+				else if (!strcmp(type, "block") && !cached_blocks.count(name)) {
+					lru_list.push_back({name, value});
+					cached_blocks[name] = std::prev(lru_list.end());
+					total_size += value;
+				}
+			}
+			line = strtok(NULL, "\n");
+		}
+		Util_log_save("net/disk-cache", "loaded index (" + std::to_string(cached_blocks.size()) + " blocks, " + std::to_string(total_size / 1000) + " KB)");
+	}
+	free(buf);
+}
+
+std::string stream_disk_cache_make_key(const std::string &video_id, const std::string &stream_url) {
+	if (video_id == "") return "";
+	auto pos = stream_url.find("?itag=");
+	if (pos == std::string::npos) pos = stream_url.find("&itag=");
+	if (pos == std::string::npos) return "";
+	pos += 6;
+	std::string itag;
+	while (pos < stream_url.size() && isdigit(stream_url[pos])) itag.push_back(stream_url[pos++]);
+	if (itag == "") return "";
+	return video_id + "_" + itag;
+}
+
+u64 stream_disk_cache_get_len(const std::string &key) {
+	lock();
+	load_index();
+	u64 res = stream_lens.count(key) ? stream_lens[key] : 0;
+	release();
+	return res;
+}
+void stream_disk_cache_set_len(const std::string &key, u64 len) {
+	lock();
+	load_index();
+	if (!stream_lens.count(key) || stream_lens[key] != len) {
+		stream_lens[key] = len;
+		index_dirty = true;
+	}
+	release();
+}
+
+bool stream_disk_cache_has_block(const std::string &key, u64 block) {
+	lock();
+	load_index();
+	bool res = cached_blocks.count(get_block_file_name(key, block));
+	release();
+	return res;
+}
+bool stream_disk_cache_load(const std::string &key, u64 block, u8 *buf, u64 size) {
+	std::string file_name = get_block_file_name(key, block);
+	lock();
+	load_index();
+	auto itr = cached_blocks.find(file_name);
+	if (itr == cached_blocks.end() || itr->second->size != size) {
+		release();
+		return false;
+	}
+	// mark as most recently used
+	lru_list.splice(lru_list.end(), lru_list, itr->second);
+	index_dirty = true;
+	release();
+	
+	u32 read_size = 0;
+	Result_with_string result = Util_file_load_from_file(file_name, CACHE_DIR, buf, size, &read_size);
+	if (result.code != 0 || read_size != size) {
+		Util_log_save("net/disk-cache", "failed to read " + file_name + " : " + result.string + result.error_description, result.code);
+		return false;
+	}
+	return true;
+}
+void stream_disk_cache_store(const std::string &key, u64 block, const u8 *data, u64 size) {
+	std::string file_name = get_block_file_name(key, block);
+	lock();
+	load_index();
+	if (cached_blocks.count(file_name)) {
+		release();
+		return;
+	}
+	// make room for the new block
+	std::vector<std::string> files_to_delete;
+	while (lru_list.size() && total_size + size > STREAM_DISK_CACHE_MAX_SIZE) {
+		files_to_delete.push_back(lru_list.front().file_name);
+		total_size -= lru_list.front().size;
+		cached_blocks.erase(lru_list.front().file_name);
+		lru_list.pop_front();
+	}
+	release();
+	
+	for (auto &file : files_to_delete) Util_file_delete_file(file, CACHE_DIR);
+	Result_with_string result = Util_file_save_to_file(file_name, CACHE_DIR, (u8 *) data, size, true);
+	
+	lock();
+	if (result.code == 0 && !cached_blocks.count(file_name)) {
+		lru_list.push_back({file_name, size});
+		cached_blocks[file_name] = std::prev(lru_list.end());
+		total_size += size;
+	} else if (result.code != 0) Util_log_save("net/disk-cache", "failed to write " + file_name + " : " + result.string + result.error_description, result.code);
+	index_dirty = true;
+	release();
+}
+
+void stream_disk_cache_save_index() {
+	lock();
+	if (!index_dirty) {
+		release();
+		return;
+	}
+	// forget the lengths of streams none of whose blocks are cached anymore
+	std::set<std::string> keys_in_use;
+	for (auto &i : lru_list) keys_in_use.insert(i.file_name.substr(0, i.file_name.rfind('_')));
+	for (auto itr = stream_lens.begin(); itr != stream_lens.end(); ) {
+		if (!keys_in_use.count(itr->first)) itr = stream_lens.erase(itr);
+		else itr++;
+	}
+	std::string data;
+	for (auto &i : stream_lens) data += "len " + i.first + " " + std::to_string(i.second) + "\n";
+	for (auto &i : lru_list) data += "block " + i.file_name + " " + std::to_string(i.size) + "\n";
+	index_dirty = false;
+	release();
+	
+	Result_with_string result = Util_file_save_to_file(INDEX_FILE_NAME, CACHE_DIR, (u8 *) data.c_str(), data.size(), true);
+	if (result.code != 0) Util_log_save("net/disk-cache", "failed to save index : " + result.string + result.error_description, result.code);
+}
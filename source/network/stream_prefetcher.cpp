@@ -0,0 +1,121 @@
+#include "headers.hpp"
+#include "network/stream_prefetcher.hpp"
+#include "network/network_downloader.hpp"
+#include "network/network_io.hpp"
+#include "network/network_scheduler.hpp"
+
+#define LOG_STR "net/prefetch"
+
+namespace {
+	std::vector<std::string> requested_urls;
+	std::vector<std::string> prewarm_urls;
+	volatile int request_id = 0; // incremented on every request or cancellation so that the thread notices it between blocks
+	volatile bool should_be_running = true;
+	NetworkSessionList session_list;
+	
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+void stream_prefetcher_request(const std::vector<std::string> &urls) {
+	lock();
+	requested_urls = urls;
+	request_id++;
+	release();
+}
+void stream_prefetcher_prewarm(const std::vector<std::string> &urls) {
+	lock();
+	prewarm_urls.insert(prewarm_urls.end(), urls.begin(), urls.end());
+	release();
+}
+void stream_prefetcher_cancel() {
+	lock();
+	requested_urls.clear();
+	request_id++;
+	release();
+}
+
+// returns false if the stream couldn't be downloaded or the request was superseded
+static bool prefetch_stream(const std::string &url, int cur_request_id) {
+	u64 stream_len = 0;
+	for (u64 block = 0; block < STREAM_PREFETCHER_BLOCKS; block++) {
+		if (!should_be_running || request_id != cur_request_id) return false;
+		if (stream_len && block * NetworkStream::BLOCK_SIZE >= stream_len) break;
+		if (network_stream_prefetch_cache_has(url, block)) continue;
+		
+		u64 start = block * NetworkStream::BLOCK_SIZE;
+		u64 end = start + NetworkStream::BLOCK_SIZE;
+		if (stream_len) end = std::min(end, stream_len);
+		auto result = Access_http_get(session_list, url, {{"Range", "bytes=" + std::to_string(start) + "-" + std::to_string(end - 1)}});
+		bool ok = !result.fail && result.status_code_is_success() && result.data.size();
+		if (ok && !stream_len) {
+			auto content_range_str = result.get_header("Content-Range");
+			char *slash = strchr(content_range_str.c_str(), '/');
+			char *end_ptr;
+			if (slash) stream_len = strtoll(slash + 1, &end_ptr, 10);
+			if (!slash || *end_ptr || !stream_len) {
+				Util_log_save(LOG_STR, "failed to parse Content-Range");
+				ok = false;
+			}
+		}
+		if (ok && result.data.size() != std::min<u64>(NetworkStream::BLOCK_SIZE, stream_len - start)) {
+			Util_log_save(LOG_STR, "size discrepancy : " + std::to_string(result.data.size()));
+			ok = false;
+		}
+		if (ok) ok = network_stream_prefetch_cache_store(url, stream_len, block, result.data.data(), result.data.size());
+		else Util_log_save(LOG_STR, "access failed : " + result.error);
+		result.finalize();
+		if (!ok) return false;
+	}
+	return true;
+}
+
+void stream_prefetcher_thread_func(void *arg) {
+	(void) arg;
+	NetworkTrafficClassScope traffic_class_scope(NetworkTrafficClass::PREFETCH);
+	
+	int done_request_id = 0;
+	while (should_be_running) {
+		lock();
+		int cur_request_id = request_id;
+		std::vector<std::string> urls = requested_urls;
+		std::vector<std::string> cur_prewarm_urls;
+		cur_prewarm_urls.swap(prewarm_urls);
+		release();
+		
+		if (cur_prewarm_urls.size()) {
+			if (!session_list.inited) session_list.init();
+			std::set<std::string> hosts;
+			for (auto &url : cur_prewarm_urls) if (url != "" && hosts.insert(url_get_host_name(url)).second && should_be_running)
+				Access_prewarm_connection(session_list, url);
+		}
+		if (cur_request_id == done_request_id || !urls.size()) {
+			done_request_id = cur_request_id;
+			usleep(50000);
+			continue;
+		}
+		if (!session_list.inited) session_list.init();
+		bool ok = true;
+		for (auto url : urls) if (!prefetch_stream(url, cur_request_id)) {
+			ok = false;
+			break;
+		}
+		if (ok) Util_log_save(LOG_STR, "warmed " + std::to_string(urls.size()) + " streams");
+		done_request_id = cur_request_id;
+	}
+	
+	Util_log_save(LOG_STR, "Thread exit.");
+	threadExit(0);
+}
+void stream_prefetcher_thread_exit_request() { should_be_running = false; }
@@ -0,0 +1,51 @@
+#include <cstring>
+#include "definitions.hpp"
+#include "network/stream_source.hpp"
+#include "system/util/file.hpp"
+
+FileStreamSource::FileStreamSource (const std::string &path) {
+	auto slash = path.rfind('/');
+	dir_path = path.substr(0, slash + 1);
+	file_name = path.substr(slash + 1);
+}
+Result_with_string FileStreamSource::open(u64 *len) {
+	Result_with_string result = Util_file_check_file_size(file_name, dir_path, len);
+	if (result.code == 0 && !*len) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] empty file ";
+	}
+	return result;
+}
+Result_with_string FileStreamSource::read(u64 offset, u8 *buf, u32 size) {
+	u32 read_size = 0;
+	// the read handle stays open between the calls (see file.hpp), so a large read costs a single FSFILE_Read()
+	Result_with_string result = Util_file_load_from_file_with_range(file_name, dir_path, buf, size, offset, &read_size);
+	if (result.code == 0 && read_size != size) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] unexpected eof ";
+	}
+	return result;
+}
+
+Result_with_string MemoryStreamSource::open(u64 *len) {
+	Result_with_string result;
+	*len = data.size();
+	if (!data.size()) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] empty data ";
+	}
+	return result;
+}
+Result_with_string MemoryStreamSource::read(u64 offset, u8 *buf, u32 size) {
+	Result_with_string result;
+	if (offset > data.size() || data.size() - offset < size) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] out of range ";
+	} else memcpy(buf, data.data() + offset, size);
+	return result;
+}
+
+StreamSource *stream_source_create(const std::string &url) {
+	if (url.size() && url[0] == '/') return new FileStreamSource(url);
+	return NULL;
+}
@@ -0,0 +1,169 @@
+#include "headers.hpp"
+#include "network/thumbnail_disk_cache.hpp"
+#include <list>
+#include <map>
+
+#define CACHE_DIR (DEF_MAIN_DIR + "thumbnail_cache/")
+#define INDEX_FILE_NAME "index.txt"
+
+namespace {
+	struct CachedThumbnail {
+		std::string hash;
+		u64 size;
+	};
+	std::list<CachedThumbnail> lru_list; // the front is the least recently used one
+	std::map<std::string, std::list<CachedThumbnail>::iterator> cached_thumbnails; // hash -> position in lru_list
+	u64 total_size = 0;
+	bool index_loaded = false;
+	bool index_dirty = false;
+	
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+// 64 bit FNV-1a in hex, the urls themselves are too long for file names
+static std::string get_hash(const std::string &url) {
+	u64 hash = 0xcbf29ce484222325ULL;
+	for (unsigned char c : url) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) hash);
+	return buf;
+}
+static std::string get_file_name(const std::string &hash) {
+	return hash + ".jpg";
+}
+
+// lock must be held
+static void load_index() {
+	if (index_loaded) return;
+	index_loaded = true;
+	
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(INDEX_FILE_NAME, CACHE_DIR, &file_size);
+	if (result.code != 0) return;
+	
+	char *buf = (char *) malloc(file_size + 1);
+	if (!buf) return;
+	u32 read_size;
+	result = Util_file_load_from_file(INDEX_FILE_NAME, CACHE_DIR, (u8 *) buf, file_size, &read_size);
+	if (result.code == 0) {
+		buf[read_size] = '\0';
+		// each line is "<hash> <size>", ordered from the least recently used one
+		char *line = strtok(buf, "\n");
+		while (line) {
+			char hash[17];
+			unsigned long long size;
+			if (sscanf(line, "%16s %llu", hash, &size) == 2 && !cached_thumbnails.count(hash)) {
+				lru_list.push_back({hash, size});
+				cached_thumbnails[hash] = std::prev(lru_list.end());
+				total_size += size;
+			}
+			line = strtok(NULL, "\n");
+		}
+		Util_log_save("thumb-disk-cache", "loaded index (" + std::to_string(cached_thumbnails.size()) + " thumbnails, " + std::to_string(total_size / 1000) + " KB)");
+	}
+	free(buf);
+}
+
+bool thumbnail_disk_cache_has(const std::string &url) {
+	std::string hash = get_hash(url);
+	lock();
+	load_index();
+	bool res = cached_thumbnails.count(hash);
+	release();
+	return res;
+}
+bool thumbnail_disk_cache_load(const std::string &url, std::vector<u8> &data) {
+	std::string hash = get_hash(url);
+	lock();
+	load_index();
+	auto itr = cached_thumbnails.find(hash);
+	if (itr == cached_thumbnails.end()) {
+		release();
+		return false;
+	}
+	u64 size = itr->second->size;
+	// mark as most recently used
+	lru_list.splice(lru_list.end(), lru_list, itr->second);
+	index_dirty = true;
+	release();
+	
+	data.resize(size);
+	u32 read_size = 0;
+	Result_with_string result = Util_file_load_from_file(get_file_name(hash), CACHE_DIR, data.data(), size, &read_size);
+	if (result.code != 0 || read_size != size) {
+		Util_log_save("thumb-disk-cache", "failed to read " + get_file_name(hash) + " : " + result.string + result.error_description, result.code);
+		// forget it so that it's downloaded and stored again
+		lock();
+		auto itr = cached_thumbnails.find(hash);
+		if (itr != cached_thumbnails.end()) {
+			total_size -= itr->second->size;
+			lru_list.erase(itr->second);
+			cached_thumbnails.erase(itr);
+		}
+		release();
+		data.clear();
+		return false;
+	}
+	return true;
+}
+void thumbnail_disk_cache_store(const std::string &url, const std::vector<u8> &data) {
+	if (!data.size() || data.size() > THUMBNAIL_DISK_CACHE_MAX_SIZE) return;
+	std::string hash = get_hash(url);
+	lock();
+	load_index();
+	if (cached_thumbnails.count(hash)) {
+		release();
+		return;
+	}
+	// make room for the new one
+	std::vector<std::string> files_to_delete;
+	while (lru_list.size() && total_size + data.size() > THUMBNAIL_DISK_CACHE_MAX_SIZE) {
+		files_to_delete.push_back(get_file_name(lru_list.front().hash));
+		total_size -= lru_list.front().size;
+		cached_thumbnails.erase(lru_list.front().hash);
+		lru_list.pop_front();
+	}
+	release();
+	
+	for (auto &file : files_to_delete) Util_file_delete_file(file, CACHE_DIR);
+	Result_with_string result = Util_file_save_to_file(get_file_name(hash), CACHE_DIR, (u8 *) data.data(), data.size(), true);
+	
+	lock();
+	if (result.code == 0 && !cached_thumbnails.count(hash)) {
+		lru_list.push_back({hash, data.size()});
+		cached_thumbnails[hash] = std::prev(lru_list.end());
+		total_size += data.size();
+	} else if (result.code != 0) Util_log_save("thumb-disk-cache", "failed to write " + get_file_name(hash) + " : " + result.string + result.error_description, result.code);
+	index_dirty = true;
+	release();
+}
+
+void thumbnail_disk_cache_save_index() {
+	lock();
+	if (!index_dirty) {
+		release();
+		return;
+	}
+	std::string data;
+	for (auto &i : lru_list) data += i.hash + " " + std::to_string(i.size) + "\n";
+	index_dirty = false;
+	release();
+	
+	Result_with_string result = Util_file_save_to_file(INDEX_FILE_NAME, CACHE_DIR, (u8 *) data.c_str(), data.size(), true);
+	if (result.code != 0) Util_log_save("thumb-disk-cache", "failed to save index : " + result.string + result.error_description, result.code);
+}
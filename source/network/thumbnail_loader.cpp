@@ -1,18 +1,19 @@
 #include "headers.hpp"
-#include "network/network_io.hpp"
+#include "network/network_async.hpp"
 #include "network/thumbnail_loader.hpp"
+#include "network/thumbnail_disk_cache.hpp"
+#include "network/connectivity.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/metrics.hpp"
+#include "system/util/frame_pacer.hpp"
+#include "system/thread_placement.hpp"
+#include "system/draw/texture_atlas.hpp"
 #include <set>
 #include <map>
 #include <queue>
-
-static bool thread_network_session_list_inited = false;
-static NetworkSessionList thread_network_session_list;
-static void confirm_thread_network_session_list_inited() {
-	if (!thread_network_session_list_inited) {
-		thread_network_session_list_inited = true;
-		thread_network_session_list.init();
-	}
-}
+#include <deque>
+#include <list>
+#include <unordered_map>
 
 struct LoadedThumbnail {
 	int image_width;
@@ -20,7 +21,12 @@ struct LoadedThumbnail {
 	int texture_width;
 	int texture_height;
 	Image_data data;
+	bool in_atlas; // data is a slot of the texture atlas (texture_width/height are not meaningful then)
 };
+static void free_thumbnail(const LoadedThumbnail &thumbnail) {
+	if (thumbnail.in_atlas) Draw_atlas_free(thumbnail.data);
+	else Draw_c2d_image_free(thumbnail.data, MemoryTag::THUMBNAILS);
+}
 
 struct Request {
 	std::string url;
@@ -29,16 +35,29 @@ struct Request {
 };
 
 static volatile SceneType active_scene = SceneType::SEARCH;
-static Handle resource_lock;
-static bool lock_initialized = false;
+static LightMutex resource_lock;
 static std::vector<Request> requests;
 static std::queue<int> free_list;
 
-static std::map<std::string, std::vector<u8> > thumbnail_cache;
-static int thumbnail_free_time_cnter = 0; // incremented each time when a thumbnail is freed
-static std::map<std::string, int> thumbnail_free_time;
+static std::unordered_map<std::string, std::vector<u8> > thumbnail_cache;
+// the urls in thumbnail_cache that are not requested now, in the order they were released (the front is evicted first)
+static std::list<std::string> evictable_urls;
+static std::unordered_map<std::string, std::list<std::string>::iterator> evictable_url_pos;
+
+#define THUMBNAIL_CACHE_MAX 1000 // 4 KB * 1000 = 4 MB, usually the memory budget limits it first
+#define THUMBNAIL_MAX_IN_FLIGHT NETWORK_ASYNC_MAX_CONCURRENT
+#define DISK_CACHE_INDEX_SAVE_INTERVAL_MS 10000
+// storyboard sheets are big and only useful while the video is open
+#define IS_PERSISTENT_TYPE(type) ((type) != ThumbnailType::DEFAULT)
+#define DECODE_PACING_TIMEOUT_NS 50000000 // a decode waits at most this long for the idle part of a frame
+#define OUTAGE_WAIT_TIMEOUT_NS 100000000 // the downloaded and cancelled ones are still handled during an outage
+#define ACTIVE_SCENE_PRIORITY 1000000 // added to the priority of the requests from the active scene
+#define VISIBLE_PRIORITY 500 // ThumbnailListRequester gives this to the displayed items, the ones below it are only prefetched
+static double decode_time_avg = 5; // ms, decoding and uploading a thumbnail
 
-#define THUMBNAIL_CACHE_MAX 300 // 4 KB * 300 = 1.2 MB
+// downloads are issued through network_async, and this thread only decodes what has arrived
+static std::map<std::string, int> in_flight_urls; // url -> id of the network_async request
+static std::deque<std::pair<std::string, std::vector<u8> > > downloaded_thumbnails;
 
 
 struct URLStatus {
@@ -46,22 +65,68 @@ struct URLStatus {
 	bool is_loaded = false;
 	LoadedThumbnail data;
 	ThumbnailType type;
+	int priority = 0; // the highest priority of `handles`, the ones from the active scene come first
+	bool pending = false; // whether it's in pending_urls
 };
 static std::map<std::string, URLStatus> requested_urls;
+// the urls neither loaded nor being downloaded, ordered by their priority so that the next one to load is picked without scanning all the requests
+static std::set<std::pair<int, std::string> > pending_urls;
 
 static void lock() {
-	if (!lock_initialized) {
-		svcCreateMutex(&resource_lock, false);
-		lock_initialized = true;
-	}
-	svcWaitSynchronization(lock_initialized, std::numeric_limits<s64>::max());
+	resource_lock.lock();
 }
 static void release() {
-	svcReleaseMutex(lock_initialized);
+	resource_lock.unlock();
+}
+// recalculates the priority of the url and puts it in or out of pending_urls, to be called whenever anything it depends on changes
+static void update_url_wo_lock(const std::string &url) {
+	auto itr = requested_urls.find(url);
+	if (itr == requested_urls.end()) return;
+	URLStatus &url_status = itr->second;
+	if (url_status.pending) pending_urls.erase({url_status.priority, url});
+	url_status.priority = 0;
+	for (auto handle : url_status.handles) {
+		int cur_priority = requests[handle].priority;
+		if (requests[handle].scene == active_scene) cur_priority += ACTIVE_SCENE_PRIORITY;
+		url_status.priority = std::max(url_status.priority, cur_priority);
+	}
+	url_status.pending = !url_status.is_loaded && !in_flight_urls.count(url);
+	if (url_status.pending) pending_urls.insert({url_status.priority, url});
 }
 
-int thumbnail_request(const std::string &url, SceneType scene_id, int priority, ThumbnailType type) {
-	if (url == "") return -1;
+// the url of the smallest variant that is at least `draw_size` pixels wide
+static std::string get_url_for_size(const std::string &url, ThumbnailType type, int draw_size) {
+	if (draw_size <= 0) return url;
+	const std::string video_thumbnail_prefix = "https://i.ytimg.com/vi/";
+	if (type == ThumbnailType::VIDEO_THUMBNAIL && !url.compare(0, video_thumbnail_prefix.size(), video_thumbnail_prefix)) {
+		// widths of the variants offered for every video
+		static const std::pair<int, std::string> variants[] = {{120, "default.jpg"}, {320, "mqdefault.jpg"}, {480, "hqdefault.jpg"}, {640, "sddefault.jpg"}};
+		constexpr int variant_num = sizeof(variants) / sizeof(variants[0]);
+		size_t name_pos = url.find('/', video_thumbnail_prefix.size());
+		if (name_pos == std::string::npos) return url;
+		std::string name = url.substr(name_pos + 1);
+		bool known_variant = false;
+		for (auto &variant : variants) if (name == variant.second) known_variant = true;
+		if (!known_variant) return url; // e.g. hq720.jpg with a signature, which can't be rewritten
+		int index = 0;
+		if (!var_data_saver) while (index + 1 < variant_num && variants[index].first < draw_size) index++; // the smallest one otherwise
+		return url.substr(0, name_pos + 1) + variants[index].second;
+	}
+	if (type == ThumbnailType::ICON) {
+		// channel icons are resized by the server with the "=s<size>" option (e.g. https://yt3.ggpht.com/...=s88-c-k-c0x00ffffff-no-rj)
+		size_t size_pos = url.rfind("=s");
+		if (size_pos == std::string::npos) return url;
+		size_pos += 2;
+		size_t size_end = size_pos;
+		while (size_end < url.size() && isdigit(url[size_end])) size_end++;
+		if (size_end == size_pos) return url;
+		return url.substr(0, size_pos) + std::to_string(draw_size) + url.substr(size_end);
+	}
+	return url;
+}
+int thumbnail_request(const std::string &url_, SceneType scene_id, int priority, ThumbnailType type, int draw_size) {
+	if (url_ == "") return -1;
+	std::string url = get_url_for_size(url_, type, draw_size);
 	int handle;
 	lock();
 	if (free_list.size()) {
@@ -74,7 +139,11 @@ int thumbnail_request(const std::string &url, SceneType scene_id, int priority,
 	}
 	requested_urls[url].handles.insert(handle);
 	requested_urls[url].type = type;
-	thumbnail_free_time.erase(url);
+	update_url_wo_lock(url);
+	if (evictable_url_pos.count(url)) { // on the screen again
+		evictable_urls.erase(evictable_url_pos[url]);
+		evictable_url_pos.erase(url);
+	}
 	release();
 	if (requests.size() > 180) Util_log_save("tloader", "WARNING : request size too large, possible resource leak : " + std::to_string(requests.size()));
 	return handle;
@@ -85,10 +154,17 @@ inline static void thumbnail_cancel_request_wo_lock(int handle) {
 	auto &url_status = requested_urls[url];
 	url_status.handles.erase(handle);
 	if (!url_status.handles.size()) {
-		if (url_status.is_loaded) Draw_c2d_image_free(url_status.data.data);
+		if (url_status.is_loaded) free_thumbnail(url_status.data);
+		if (url_status.pending) pending_urls.erase({url_status.priority, url});
 		requested_urls.erase(url);
-		thumbnail_free_time[url] = ++thumbnail_free_time_cnter;
-	}
+		if (thumbnail_cache.count(url) && !evictable_url_pos.count(url))
+			evictable_url_pos[url] = evictable_urls.insert(evictable_urls.end(), url);
+		// free the slot for the thumbnails still on the screen
+		if (in_flight_urls.count(url)) {
+			network_async_cancel(in_flight_urls[url]);
+			in_flight_urls.erase(url);
+		}
+	} else update_url_wo_lock(url);
 	free_list.push(handle);
 }
 void thumbnail_cancel_request(int handle) {
@@ -106,6 +182,7 @@ void thumbnail_set_priority(int handle, int value) {
 	if (handle == -1) return;
 	lock();
 	requests[handle].priority = value;
+	update_url_wo_lock(requests[handle].url);
 	release();
 }
 void thumbnail_set_priorities(const std::vector<std::pair<int, int> > &priority_list) {
@@ -113,11 +190,21 @@ void thumbnail_set_priorities(const std::vector<std::pair<int, int> > &priority_
 	for (auto i : priority_list) {
 		if (i.first == -1) continue;
 		requests[i.first].priority = i.second;
+		update_url_wo_lock(requests[i.first].url);
 	}
 	release();
 }
 void thumbnail_set_active_scene(SceneType type) {
-	active_scene = type;
+	lock();
+	if (active_scene != type) {
+		active_scene = type;
+		pending_urls.clear();
+		for (auto &i : requested_urls) {
+			i.second.pending = false;
+			update_url_wo_lock(i.first);
+		}
+	}
+	release();
 }
 bool thumbnail_is_available(const std::string &url) {
 	if (url == "") return false;
@@ -132,120 +219,343 @@ bool thumbnail_is_available(int handle) {
 }
 bool thumbnail_draw(int handle, int x_offset, int y_offset, int x_len, int y_len) {
 	if (handle == -1) return false;
-	bool res;
+	bool res = false;
+	C2D_Image image;
+	lock();
+	auto url_status = requested_urls.find(requests[handle].url);
+	if (url_status != requested_urls.end() && url_status->second.is_loaded) {
+		image = url_status->second.data.data.c2d;
+		res = true;
+	}
+	release();
+	// drawn outside the lock, holding it wouldn't protect the texture anyway as the GPU reads it only at the end of the frame
+	if (res) Draw_texture(image, x_offset, y_offset, x_len, y_len);
+	return res;
+}
+bool thumbnail_draw_part(int handle, int x_offset, int y_offset, int x_len, int y_len, int src_x, int src_y, int src_w, int src_h) {
+	if (handle == -1) return false;
+	bool res = false;
 	lock();
 	std::string url = requests[handle].url;
 	if (requested_urls.count(url) && requested_urls[url].is_loaded) {
 		LoadedThumbnail thumbnail = requested_urls[url].data;
-		Draw_texture(thumbnail.data.c2d, x_offset, y_offset, x_len, y_len);
-		res = true;
-	} else res = false;
+		if (src_x >= 0 && src_y >= 0 && src_w > 0 && src_h > 0 && src_x + src_w <= thumbnail.image_width && src_y + src_h <= thumbnail.image_height) {
+			Tex3DS_SubTexture subtex;
+			subtex.width = src_w;
+			subtex.height = src_h;
+			subtex.left = (float) src_x / thumbnail.texture_width;
+			subtex.top = 1.0 - (float) src_y / thumbnail.texture_height;
+			subtex.right = (float) (src_x + src_w) / thumbnail.texture_width;
+			subtex.bottom = 1.0 - (float) (src_y + src_h) / thumbnail.texture_height;
+			C2D_Image image = thumbnail.data.c2d;
+			image.subtex = &subtex;
+			Draw_texture(image, x_offset, y_offset, x_len, y_len);
+			res = true;
+		}
+	}
 	release();
 	return res;
 }
 
-static std::vector<u8> http_get(const std::string &url) {
-	std::vector<u8> res;
+static void cache_thumbnail(const std::string &url, const std::vector<u8> &data) {
 	lock();
-	if (thumbnail_cache.count(url)) res = thumbnail_cache[url];
-	release();
+	while (thumbnail_cache.size() >= THUMBNAIL_CACHE_MAX || (thumbnail_cache.size() && memory_budget_is_over(data.size()))) {
+		if (!evictable_urls.size()) break; // everything in the cache is on the screen
+		std::string erase_url = evictable_urls.front();
+		evictable_urls.pop_front();
+		evictable_url_pos.erase(erase_url);
+		memory_budget_add(MemoryBudgetUser::THUMBNAIL_CACHE, -(s64) thumbnail_cache[erase_url].size());
+		thumbnail_cache.erase(erase_url);
+	}
+	if (thumbnail_cache.count(url)) {
+		memory_budget_add(MemoryBudgetUser::THUMBNAIL_CACHE, -(s64) thumbnail_cache[url].size());
+	}
+	thumbnail_cache[url] = data;
+	memory_budget_add(MemoryBudgetUser::THUMBNAIL_CACHE, data.size());
+	// cancelled while downloading
+	if (!requested_urls.count(url) && !evictable_url_pos.count(url)) evictable_url_pos[url] = evictable_urls.insert(evictable_urls.end(), url);
 	
-	if (res.size()) return res;
+	if (thumbnail_cache.size() >= THUMBNAIL_CACHE_MAX + 10) Util_log_save("tloader", "over caching : " + std::to_string(thumbnail_cache.size()));
+	metrics_set(Metric::THUMBNAIL_CACHE_ENTRIES, thumbnail_cache.size());
 	
-	confirm_thread_network_session_list_inited();
-	if (var_network_framework == NETWORK_FRAMEWORK_HTTPC) add_cpu_limit(30);
-	auto result = Access_http_get(thread_network_session_list, url, {});
-	if (var_network_framework == NETWORK_FRAMEWORK_HTTPC) remove_cpu_limit(30);
-	if (result.fail) Util_log_save("thumb-dl", "access fail : " + result.error);
-	else if (result.data.size()) {
+	release();
+}
+void thumbnail_shed_cache(MemoryPressure level) {
+	if (level == MemoryPressure::NONE) return;
+	lock();
+	size_t erased_num = evictable_urls.size();
+	for (auto &url : evictable_urls) {
+		memory_budget_add(MemoryBudgetUser::THUMBNAIL_CACHE, -(s64) thumbnail_cache[url].size());
+		thumbnail_cache.erase(url);
+	}
+	evictable_urls.clear();
+	evictable_url_pos.clear();
+	metrics_set(Metric::THUMBNAIL_CACHE_ENTRIES, thumbnail_cache.size());
+	release();
+	Util_log_save("tloader", "shed " + std::to_string(erased_num) + " cached thumbnails");
+}
+void thumbnail_shed_textures(MemoryPressure level) {
+	if (level == MemoryPressure::NONE) return;
+	int unloaded_num = 0;
+	lock();
+	for (auto &url_status : requested_urls) {
+		if (!url_status.second.is_loaded || url_status.second.priority >= ACTIVE_SCENE_PRIORITY) continue;
+		free_thumbnail(url_status.second.data);
+		url_status.second.is_loaded = false;
+		update_url_wo_lock(url_status.first);
+		unloaded_num++;
+	}
+	release();
+	Util_log_save("tloader", "shed " + std::to_string(unloaded_num) + " thumbnail textures");
+}
+
+static NetworkTrafficClass get_traffic_class(int priority) {
+	return priority >= ACTIVE_SCENE_PRIORITY + VISIBLE_PRIORITY ? NetworkTrafficClass::VISIBLE_THUMBNAIL : NetworkTrafficClass::PREFETCH;
+}
+static void start_download(const std::string &url, NetworkTrafficClass traffic_class) {
+	lock();
+	in_flight_urls[url] = -1;
+	update_url_wo_lock(url);
+	int id = network_async_get(url, {}, [url] (NetworkResult &result) {
+		if (result.fail) Util_log_save("thumb-dl", "access fail : " + result.error);
 		lock();
-		if (thumbnail_cache.size() >= THUMBNAIL_CACHE_MAX) {
-			std::string erase_url;
-			int min_time = 1000000000;
-			for (auto &item : thumbnail_cache) {
-				if (!thumbnail_free_time.count(item.first)) continue;
-				int cur_time = thumbnail_free_time[item.first];
-				if (min_time > cur_time) {
-					min_time = cur_time;
-					erase_url = item.first;
-				}
-			}
-			if (erase_url != "") thumbnail_cache.erase(erase_url);
-		}
-		thumbnail_cache[url] = result.data;
-		
-		if (thumbnail_cache.size() >= THUMBNAIL_CACHE_MAX + 10) Util_log_save("tloader", "over caching : " + std::to_string(thumbnail_cache.size()));
-		
+		in_flight_urls.erase(url);
+		if (!result.fail && result.data.size()) downloaded_thumbnails.push_back({url, std::move(result.data)});
+		else update_url_wo_lock(url); // to be retried
 		release();
+	}, traffic_class);
+	if (in_flight_urls.count(url)) in_flight_urls[url] = id; // the lock is held, so the callback can't have erased it
+	release();
+}
+
+#define FAST_SCROLL_VELOCITY 0.5 // items per frame at which the requested range leans the most
+#define MAX_SCROLL_LEAN 0.4 // at most this much of the requested items outside the displayed range is moved ahead
+#define DATA_SAVER_SPARE_REQUESTS 4 // in the data saver mode, only this many items outside the displayed range are requested
+
+void ThumbnailListRequester::update(int item_num, int displayed_l, int displayed_r, float scroll_velocity,
+	const std::function<int &(int)> &handle_of, const std::function<int (int)> &request) {
+	
+	velocity += (scroll_velocity - velocity) * 0.3;
+	float lean = std::max(-1.0f, std::min(1.0f, velocity / (float) FAST_SCROLL_VELOCITY)) * MAX_SCROLL_LEAN;
+	int request_num = var_data_saver ? std::min(max_request_num, displayed_r - displayed_l + DATA_SAVER_SPARE_REQUESTS) : max_request_num;
+	int spare = std::max(0, request_num - (displayed_r - displayed_l));
+	int target_l = std::max(0, displayed_l - (int) (spare * (0.5 - lean)));
+	int target_r = std::min(item_num, target_l + request_num);
+	target_l = std::max(0, target_r - request_num);
+	
+	// transition from [request_l, request_r) to [target_l, target_r)
+	for (int i = request_l; i < request_r; i++) if (i < target_l || i >= target_r) {
+		int &handle = handle_of(i);
+		thumbnail_cancel_request(handle);
+		handle = -1;
+	}
+	// (an item without a handle inside the old range is one that on_items_changed() moved there)
+	for (int i = target_l; i < target_r; i++) if (i < request_l || i >= request_r || handle_of(i) == -1) handle_of(i) = request(i);
+	request_l = target_l;
+	request_r = target_r;
+	
+	// the items ahead are needed sooner than the ones behind at the same distance
+	std::vector<std::pair<int, int> > priority_list;
+	for (int i = target_l; i < target_r; i++) {
+		int dist;
+		if (i < displayed_l) dist = (displayed_l - i) * (lean > 0.1 ? 2 : 1);
+		else if (i >= displayed_r) dist = (i - displayed_r + 1) * (lean < -0.1 ? 2 : 1);
+		else dist = 0;
+		priority_list.push_back({handle_of(i), VISIBLE_PRIORITY - dist});
+	}
+	thumbnail_set_priorities(priority_list);
+}
+void ThumbnailListRequester::cancel_all(const std::function<int &(int)> &handle_of) {
+	for (int i = request_l; i < request_r; i++) {
+		int &handle = handle_of(i);
+		thumbnail_cancel_request(handle);
+		handle = -1;
+	}
+	reset();
+}
+void ThumbnailListRequester::on_items_changed(int item_num, const std::function<int &(int)> &handle_of) {
+	request_l = std::min(request_l, item_num);
+	request_r = std::min(request_r, item_num);
+	for (int i = 0; i < item_num; i++) if (i < request_l || i >= request_r) {
+		int &handle = handle_of(i);
+		if (handle != -1) {
+			thumbnail_cancel_request(handle);
+			handle = -1;
+		}
+	}
+}
+
+// how much of each pixel is inside the circle inscribed in a `w` x `h` icon (0 - 255), only used by the thumbnail thread
+static const std::vector<u8> &get_icon_mask(int w, int h) {
+	static std::map<std::pair<int, int>, std::vector<u8> > masks;
+	auto &mask = masks[{w, h}];
+	if (!mask.size()) {
+		mask.resize(w * h);
+		float radius = (float) h / 2;
+		for (int i = 0; i < h; i++) for (int j = 0; j < w; j++) {
+			float distance = std::hypot(radius - (i + 0.5), radius - (j + 0.5));
+			float proportion = std::max(0.0f, std::min(1.0f, radius + 0.5f - distance));
+			mask[i * w + j] = proportion * 255 + 0.5;
+		}
 	}
-	result.finalize();
-	return result.data;
+	return mask;
+}
+
+// thumbnails already encoded to ETC1 (var_thumbnail_etc1) are kept on the SD card as well, so that they are uploaded without decoding the jpeg again
+// "ETC1", u16 width, u16 height, then the blocks of Draw_atlas_encode_etc1()
+#define ETC1_HEADER_SIZE 8
+#define CAN_BE_ETC1(type) ((type) == ThumbnailType::VIDEO_THUMBNAIL || (type) == ThumbnailType::ICON)
+static std::string get_etc1_cache_key(const std::string &url, ThumbnailType type) {
+	// the background color of the icons is baked in
+	if (type == ThumbnailType::ICON) return url + (var_night_mode ? "#etc1-dark" : "#etc1-light");
+	return url + "#etc1";
+}
+static bool load_etc1_thumbnail(const std::string &url, ThumbnailType type, LoadedThumbnail *loaded) {
+	std::vector<u8> data;
+	if (!thumbnail_disk_cache_load(get_etc1_cache_key(url, type), data)) return false;
+	if (data.size() < ETC1_HEADER_SIZE || memcmp(&data[0], "ETC1", 4)) return false;
+	u16 w, h;
+	memcpy(&w, &data[4], 2);
+	memcpy(&h, &data[6], 2);
+	if (!Draw_atlas_fits(w, h) || data.size() != ETC1_HEADER_SIZE + Draw_atlas_etc1_size(w, h)) return false;
+	if (Draw_atlas_add_etc1(&loaded->data, &data[ETC1_HEADER_SIZE], w, h).code != 0) return false;
+	loaded->image_width = loaded->texture_width = w;
+	loaded->image_height = loaded->texture_height = h;
+	loaded->in_atlas = true;
+	return true;
+}
+static void store_etc1_thumbnail(const std::string &url, ThumbnailType type, const u8 *etc1_data, int w, int h) {
+	std::vector<u8> data(ETC1_HEADER_SIZE + Draw_atlas_etc1_size(w, h));
+	u16 w16 = w, h16 = h;
+	memcpy(&data[0], "ETC1", 4);
+	memcpy(&data[4], &w16, 2);
+	memcpy(&data[6], &h16, 2);
+	memcpy(&data[ETC1_HEADER_SIZE], etc1_data, data.size() - ETC1_HEADER_SIZE);
+	thumbnail_disk_cache_store(get_etc1_cache_key(url, type), data);
+}
+static void set_loaded_thumbnail(const std::string &url, const LoadedThumbnail &loaded) {
+	lock();
+	if (requested_urls.count(url)) { // in case the request is cancelled while downloading
+		requested_urls[url].is_loaded = true;
+		requested_urls[url].data = loaded;
+		update_url_wo_lock(url);
+	} else free_thumbnail(loaded);
+	release();
 }
 
 static bool should_be_running = true;
 void thumbnail_downloader_thread_func(void *arg) {
+	double last_index_save_time = 0;
 	while (should_be_running) {
 		const std::string *next_url_ = NULL;
 		ThumbnailType next_type = ThumbnailType::DEFAULT;
+		NetworkTrafficClass next_traffic_class = NetworkTrafficClass::PREFETCH;
+		std::string next_url;
+		std::vector<u8> encoded_data;
+		bool downloaded = false;
 		lock();
-		{
+		if (downloaded_thumbnails.size()) {
+			// several downloads finish around the same time, so decode the most wanted one first
+			auto next_itr = downloaded_thumbnails.begin();
 			int max_priority = -1;
-			for (auto &i : requested_urls) {
-				if (i.second.is_loaded) continue;
-				int cur_url_priority = 0;
-				for (auto handle : i.second.handles) {
-					int cur_priority = requests[handle].priority;
-					if (requests[handle].scene == active_scene) cur_priority += 1000000;
-					cur_url_priority = std::max(cur_url_priority, cur_priority);
-				}
+			for (auto itr = downloaded_thumbnails.begin(); itr != downloaded_thumbnails.end(); itr++) {
+				auto url_status = requested_urls.find(itr->first);
+				int cur_url_priority = url_status == requested_urls.end() ? std::numeric_limits<int>::max() : // only cached, costs nothing
+					url_status->second.priority;
 				if (max_priority < cur_url_priority) {
 					max_priority = cur_url_priority;
-					next_url_ = &i.first;
-					next_type = i.second.type;
+					next_itr = itr;
 				}
 			}
+			next_url = next_itr->first;
+			encoded_data = std::move(next_itr->second);
+			downloaded_thumbnails.erase(next_itr);
+			downloaded = true;
+			if (requested_urls.count(next_url)) next_type = requested_urls[next_url].type;
+		} else if (in_flight_urls.size() < THUMBNAIL_MAX_IN_FLIGHT) {
+			// the thumbnails of the scenes in the background wait while the memory is running out
+			if (pending_urls.size() && (pending_urls.rbegin()->first >= ACTIVE_SCENE_PRIORITY || memory_pressure_get_level() == MemoryPressure::NONE)) {
+				next_url_ = &pending_urls.rbegin()->second;
+				next_url = *next_url_;
+				next_type = requested_urls[next_url].type;
+				next_traffic_class = get_traffic_class(pending_urls.rbegin()->first);
+				if (thumbnail_cache.count(next_url)) encoded_data = thumbnail_cache[next_url];
+			}
 		}
-		std::string next_url;
-		if (next_url_) next_url = *next_url_;
 		release();
 		
-		if (!next_url_) {
-			usleep(50000);
-			continue;
+		if (!downloaded) {
+			if (!next_url_) {
+				double cur_time = osGetTime();
+				if (cur_time - last_index_save_time >= DISK_CACHE_INDEX_SAVE_INTERVAL_MS) {
+					thumbnail_disk_cache_save_index();
+					last_index_save_time = cur_time;
+				}
+				usleep(20000);
+				continue;
+			}
+			if (!encoded_data.size() && var_thumbnail_etc1 && CAN_BE_ETC1(next_type)) {
+				LoadedThumbnail loaded;
+				if (load_etc1_thumbnail(next_url, next_type, &loaded)) {
+					metrics_add(Metric::THUMBNAIL_CACHE_HITS);
+					set_loaded_thumbnail(next_url, loaded);
+					continue;
+				}
+			}
+			if (!encoded_data.size() && IS_PERSISTENT_TYPE(next_type) && thumbnail_disk_cache_load(next_url, encoded_data))
+				cache_thumbnail(next_url, encoded_data);
+			if (!encoded_data.size()) {
+				// the failed downloads are retried right away, so don't start them while the network is known to be down
+				if (!connectivity_wait_until_usable(OUTAGE_WAIT_TIMEOUT_NS)) continue;
+				// held back (see network_scheduler.hpp) : don't fill the in-flight slots with requests that can't start
+				if (!network_scheduler_can_start(next_traffic_class, url_get_host_name(next_url))) {
+					usleep(20000);
+					continue;
+				}
+				metrics_add(Metric::THUMBNAIL_CACHE_MISSES);
+				start_download(next_url, next_traffic_class);
+				continue;
+			}
+			metrics_add(Metric::THUMBNAIL_CACHE_HITS); // in memory or on the SD card
+		} else {
+			lock();
+			bool still_requested = requested_urls.count(next_url);
+			release();
+			cache_thumbnail(next_url, encoded_data);
+			if (IS_PERSISTENT_TYPE(next_type)) thumbnail_disk_cache_store(next_url, encoded_data);
+			if (!still_requested) continue; // cancelled while downloading
 		}
 		// Util_log_save("thumb-dl", "size:" + std::to_string(requests.size()));
-		auto encoded_data = http_get(next_url);
+		
+		// this thread outranks the UI thread, so a decode that starts in the middle of a frame holds the frame back until it's done
+		if (thread_placement_get_core(ThreadRole::THUMBNAIL_DOWNLOADER) == 0)
+			frame_pacer_wait_for_budget(decode_time_avg, DECODE_PACING_TIMEOUT_NS);
+		TickCounter decode_counter;
+		osTickCounterStart(&decode_counter);
 		
 		int w, h;
-		u8 *decoded_data = Image_decode(&encoded_data[0], encoded_data.size(), &w, &h);
+		// video thumbnails : default.jpg is offered in 4:3, so crop to 16:9
+		// channel banners : crop to 1024 to fit in the maximum texture size
+		u8 *decoded_data = Image_decode(&encoded_data[0], encoded_data.size(), &w, &h, next_type == ThumbnailType::VIDEO_BANNER ? 1024 : 0,
+			next_type == ThumbnailType::VIDEO_THUMBNAIL ? 9.0 / 16 : 0);
 		if (decoded_data) {
-			// some special operations on the picture here (it shouldn't be here but...)
-			// for video thumbnail, crop to 16:9
-			if (next_type == ThumbnailType::VIDEO_THUMBNAIL && h > w * 9 / 16 + 1) {
-				int new_h = w * 9 / 16;
-				int vertical_offset = (h - new_h) / 2;
-				memmove(decoded_data, decoded_data + vertical_offset * w * 2, new_h * w * 2);
-				h = new_h;
-			}
-			// channel banner : crop to 1024 to fit in the maximum texture size
-			if (next_type == ThumbnailType::VIDEO_BANNER && w == 1060) {
-				for (int i = 0; i < h; i++) memmove(decoded_data + i * 1024 * 2, decoded_data + (i * 1060 + 18) * 2, 1024 * 2);
-				w = 1024;
-			}
-			// channel icon : round (definitely not the recommended way but we will fill the area outside the circle with white)
+			// channel icon : round (definitely not the recommended way but we will fill the area outside the circle with the background color)
 			if (next_type == ThumbnailType::ICON) {
-				float radius = (float) h / 2;
-				for (int i = 0; i < h; i++) for (int j = 0; j < w; j++) {
-					float distance = std::hypot(radius - (i + 0.5), radius - (j + 0.5));
-					u8 b = decoded_data[(i * w + j) * 2 + 0] & ((1 << 5) - 1);
-					u8 g = (decoded_data[(i * w + j) * 2 + 0] >> 5) | ((decoded_data[(i * w + j) * 2 + 1] & ((1 << 3) - 1)) << 3);
-					u8 r = decoded_data[(i * w + j) * 2 + 1] >> 3;
-					float proportion = std::max(0.0f, std::min(1.0f, radius + 0.5f - distance));
-					b = b * proportion + (var_night_mode ? 0 : ((1 << 5) - 1)) * (1 - proportion);
-					g = g * proportion + (var_night_mode ? 0 : ((1 << 6) - 1)) * (1 - proportion);
-					r = r * proportion + (var_night_mode ? 0 : ((1 << 5) - 1)) * (1 - proportion);
-					decoded_data[(i * w + j) * 2 + 0] = b | g << 5;
-					decoded_data[(i * w + j) * 2 + 1] = g >> 3 | r << 3;
+				const std::vector<u8> &mask = get_icon_mask(w, h);
+				u16 *pixels = (u16 *) decoded_data;
+				u32 back = var_night_mode ? 0 : 0xFFFF;
+				for (int i = 0; i < w * h; i++) {
+					u32 alpha = mask[i];
+					if (alpha == 255) continue;
+					if (alpha == 0) {
+						pixels[i] = back;
+						continue;
+					}
+					u32 pixel = pixels[i];
+					u32 r = ((pixel >> 11) * alpha + (back >> 11) * (255 - alpha)) / 255;
+					u32 g = ((pixel >> 5 & 0x3F) * alpha + (back >> 5 & 0x3F) * (255 - alpha)) / 255;
+					u32 b = ((pixel & 0x1F) * alpha + (back & 0x1F) * (255 - alpha)) / 255;
+					pixels[i] = r << 11 | g << 5 | b;
 				}
 			}
 			
@@ -255,34 +565,49 @@ void thumbnail_downloader_thread_func(void *arg) {
 			while (texture_w < w) texture_w <<= 1;
 			int texture_h = 1;
 			while (texture_h < h) texture_h <<= 1;
+			// storyboards are drawn in parts with thumbnail_draw_part(), which needs the whole texture
+			bool in_atlas = (next_type == ThumbnailType::VIDEO_THUMBNAIL || next_type == ThumbnailType::ICON) && Draw_atlas_fits(w, h);
 			
 			Result_with_string result;
-			result = Draw_c2d_image_init(&result_image, texture_w, texture_h, GPU_RGB565);
-			if (result.code != 0) {
-				Util_log_save("thumb-dl", "out of linearmem");
+			u8 *etc1_data = in_atlas && var_thumbnail_etc1 ? Draw_atlas_encode_etc1(decoded_data, w, h) : NULL;
+			if (etc1_data) {
+				result = Draw_atlas_add_etc1(&result_image, etc1_data, w, h);
+				if (result.code != 0) Util_log_save("thumb-dl", "Draw_atlas_add_etc1() failed");
+				else store_etc1_thumbnail(next_url, next_type, etc1_data, w, h);
+				free(etc1_data);
+				etc1_data = NULL;
+			} else if (in_atlas) {
+				result = Draw_atlas_add(&result_image, decoded_data, w, h);
+				if (result.code != 0) Util_log_save("thumb-dl", "Draw_atlas_add() failed");
 			} else {
-				result = Draw_set_texture_data(&result_image, decoded_data, w, h, texture_w, texture_h, GPU_RGB565);
+				result = Draw_c2d_image_init(&result_image, texture_w, texture_h, GPU_RGB565, MemoryTag::THUMBNAILS);
 				if (result.code != 0) {
-					Util_log_save("thumb-dl", "Draw_set_texture_data() failed");
+					Util_log_save("thumb-dl", "out of linearmem");
 				} else {
-					lock();
-					if (requested_urls.count(next_url)) { // in case the request is cancelled while downloading
-						requested_urls[next_url].is_loaded = true;
-						requested_urls[next_url].data = {w, h, texture_w, texture_h, result_image};
+					result = Draw_set_texture_data(&result_image, decoded_data, w, h, texture_w, texture_h, GPU_RGB565);
+					if (result.code != 0) {
+						Util_log_save("thumb-dl", "Draw_set_texture_data() failed");
+						Draw_c2d_image_free(result_image, MemoryTag::THUMBNAILS);
 					}
-					release();
 				}
 			}
+			if (result.code == 0) {
+				LoadedThumbnail loaded = {w, h, texture_w, texture_h, result_image, in_atlas};
+				set_loaded_thumbnail(next_url, loaded);
+			}
 			free(decoded_data);
 			decoded_data = NULL;
+			osTickCounterUpdate(&decode_counter);
+			decode_time_avg = decode_time_avg * 0.8 + osTickCounterRead(&decode_counter) * 0.2;
 		} else Util_log_save("thumb-dl", "Image_decode() failed");
 	}
 	
 	lock();
-	for (auto i : requested_urls) if (i.second.is_loaded) Draw_c2d_image_free(i.second.data.data);
+	for (auto i : requested_urls) if (i.second.is_loaded) free_thumbnail(i.second.data);
 	requested_urls.clear();
 	release();
 	
+	thumbnail_disk_cache_save_index();
 	Util_log_save("thumb-dl", "Thread exit.");
 	threadExit(0);
 }
@@ -9,15 +9,30 @@
 #include "scenes/subscription.hpp"
 #include "network/network_io.hpp"
 #include "network/thumbnail_loader.hpp"
+#include "network/offline_download.hpp"
+#include "network/network_async.hpp"
+#include "network/connectivity.hpp"
+#include "network/network_lifecycle.hpp"
+#include "network/network_downloader.hpp"
 #include "system/util/async_task.hpp"
 #include "system/util/misc_tasks.hpp"
+#include "system/thread_placement.hpp"
+#include "system/util/frame_pacer.hpp"
+#include "system/util/player_session.hpp"
+#include "system/util/settings.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/memory_pressure.hpp"
+#include "system/util/telemetry.hpp"
+#include "system/util/metrics.hpp"
 #include "ui/colors.hpp"
 // add here
 
+#define LOW_POWER_TIME_TO_TURN_OFF_LCD 10 // seconds, see var_low_power_playing
+
 bool menu_thread_run = false;
 bool menu_check_exit_request = false;
 bool menu_update_available = false;
-Thread menu_worker_thread, menu_check_connectivity_thread, menu_update_thread, thumbnail_downloader_thread, async_task_thread, misc_tasks_thread;
+Thread menu_worker_thread, menu_check_connectivity_thread, menu_update_thread, thumbnail_downloader_thread, async_task_thread, misc_tasks_thread, offline_download_thread, network_async_thread;
 C2D_Image menu_app_icon[4];
 
 static SceneType current_scene;
@@ -25,10 +40,15 @@ static SceneType current_scene;
 void Menu_check_connectivity_thread(void* arg);
 void Menu_worker_thread(void* arg);
 void Menu_update_thread(void* arg);
+static void restore_player_session();
 
 static Result sound_init_result;
 static bool is_new_3ds;
 
+static void prepare_player_js(void *) {
+	Util_log_save(DEF_MENU_INIT_STR, std::string("youtube_prepare_player_js()...") + (youtube_prepare_player_js() ? "ok" : "failed"));
+}
+
 void Menu_init(void)
 {
 	Result_with_string result;
@@ -62,6 +82,7 @@ void Menu_init(void)
 	APT_CheckNew3DS(&is_new_3ds);
 	
 	
+	frame_pacer_init();
 	Util_log_save(DEF_MENU_INIT_STR, "Draw_init()...", Draw_init(var_high_resolution_mode).code);
 	Draw_frame_ready();
 	Draw_screen_ready(0, DEF_DRAW_WHITE);
@@ -71,8 +92,8 @@ void Menu_init(void)
 	Util_hid_init();
 	Util_expl_init();
 	Exfont_init();
-	for (int i = 0; i < DEF_EXFONT_NUM_OF_FONT_NAME; i++)
-		Exfont_set_external_font_request_state(i, true);
+	// only basic latin (which has the unknown glyph) is loaded up front, the other blocks are loaded when they're first drawn
+	Exfont_set_external_font_request_state(0, true);
 
 	for(int i = 0; i < 4; i++)
 		Exfont_set_system_font_request_state(i, true);
@@ -82,38 +103,40 @@ void Menu_init(void)
 	
 	/*
 	if (var_allow_send_app_info)
-		menu_send_app_info_thread = threadCreate(Menu_send_app_info_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, 1, true);
+		menu_send_app_info_thread = thread_placement_create_thread(ThreadRole::MENU_SEND_APP_INFO, Menu_send_app_info_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, true);
 	*/
 
 	result = Draw_load_texture("romfs:/gfx/draw/app_icon.t3x", 60, menu_app_icon, 0, 4);
 	Util_log_save(DEF_MENU_INIT_STR, "Draw_load_texture()..." + result.string + result.error_description, result.code);
 
 	menu_thread_run = true;
-	menu_worker_thread = threadCreate(Menu_worker_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_REALTIME, 1, false);
-	menu_check_connectivity_thread = threadCreate(Menu_check_connectivity_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 1, false);
-	menu_update_thread = threadCreate(Menu_update_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_REALTIME, 1, false);
+	menu_worker_thread = thread_placement_create_thread(ThreadRole::MENU_WORKER, Menu_worker_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_REALTIME, false);
+	menu_check_connectivity_thread = thread_placement_create_thread(ThreadRole::MENU_CHECK_CONNECTIVITY, Menu_check_connectivity_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	menu_update_thread = thread_placement_create_thread(ThreadRole::MENU_UPDATE, Menu_update_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_REALTIME, false);
 	
-	Sem_init();
-	Sem_suspend();
-	VideoPlayer_init();
-	VideoPlayer_suspend();
-	Channel_init();
-	Channel_suspend();
-	About_init();
-	About_suspend();
-	History_init();
-	History_suspend();
-	Subscription_init();
-	Subscription_suspend();
-	// add here
+	// used to be done by Sem_init(), which now runs only when the settings are first shown
+	load_settings();
+	load_string_resources(var_lang);
+	// the other scenes are initialized when they're first shown (see init_scene_if_needed())
 	Search_init(); // first running
 	current_scene = SceneType::SEARCH;
 	
-	thumbnail_downloader_thread = threadCreate(thumbnail_downloader_thread_func, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
-	async_task_thread = threadCreate(async_task_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
-	misc_tasks_thread = threadCreate(misc_tasks_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
+	thumbnail_downloader_thread = thread_placement_create_thread(ThreadRole::THUMBNAIL_DOWNLOADER, thumbnail_downloader_thread_func, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	async_task_thread = thread_placement_create_thread(ThreadRole::ASYNC_TASK, async_task_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	queue_async_task(prepare_player_js, NULL, AsyncTaskPriority::PREFETCH);
+	misc_tasks_thread = thread_placement_create_thread(ThreadRole::MISC_TASKS, misc_tasks_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, false);
+	offline_download_thread = thread_placement_create_thread(ThreadRole::OFFLINE_DOWNLOAD, offline_download_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, false);
+	network_async_thread = thread_placement_create_thread(ThreadRole::NETWORK_ASYNC, network_async_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	network_lifecycle_init();
+	telemetry_init();
+	// the caches give memory back when it's running out, the ones of the scenes register themselves in their init
+	memory_pressure_add_handler(network_stream_shed_memory, MemoryShedPriority::STREAM_SPARE_BLOCKS);
+	memory_pressure_add_handler(thumbnail_shed_cache, MemoryShedPriority::THUMBNAIL_CACHE);
+	memory_pressure_add_handler(thumbnail_shed_textures, MemoryShedPriority::THUMBNAIL_TEXTURES);
+	memory_pressure_add_handler(memory_budget_shed, MemoryShedPriority::MEMORY_BUDGET);
 
 	Menu_get_system_info();
+	restore_player_session();
 
 	Util_log_save(DEF_MENU_INIT_STR, "Initialized");
 }
@@ -121,18 +144,21 @@ void Menu_init(void)
 void Menu_exit(void)
 {
 	Util_log_save(DEF_MENU_EXIT_STR, "Exiting...");
+	metrics_dump_to_log();
 	u64 time_out = 10000000000;
 	Result_with_string result;
 
 	menu_thread_run = false;
+	network_lifecycle_exit();
+	telemetry_exit();
 
-	VideoPlayer_exit();
-	Channel_exit();
+	if (VideoPlayer_query_init_flag()) VideoPlayer_exit();
+	if (Channel_query_init_flag()) Channel_exit();
 	Search_exit();
-	Sem_exit();
-	About_exit();
-	History_exit();
-	Subscription_exit();
+	if (Sem_query_init_flag()) Sem_exit();
+	if (About_query_init_flag()) About_exit();
+	if (History_query_init_flag()) History_exit();
+	if (Subscription_query_init_flag()) Subscription_exit();
 	// add here
 
 	Util_hid_exit();
@@ -142,6 +168,8 @@ void Menu_exit(void)
 	thumbnail_downloader_thread_exit_request();
 	async_task_thread_exit_request();
 	misc_tasks_thread_exit_request();
+	offline_download_thread_exit_request();
+	network_async_thread_exit_request();
 	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(menu_worker_thread, time_out));
 	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(menu_check_connectivity_thread, time_out));
 	// Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(menu_send_app_info_thread, time_out));
@@ -149,6 +177,8 @@ void Menu_exit(void)
 	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(thumbnail_downloader_thread, time_out));
 	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(async_task_thread, time_out));
 	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(misc_tasks_thread, time_out));
+	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(offline_download_thread, time_out));
+	Util_log_save(DEF_MENU_EXIT_STR, "threadJoin()...", threadJoin(network_async_thread, time_out));
 	threadFree(menu_worker_thread);
 	threadFree(menu_check_connectivity_thread);
 	// threadFree(menu_send_app_info_thread);
@@ -156,6 +186,8 @@ void Menu_exit(void)
 	threadFree(thumbnail_downloader_thread);
 	threadFree(async_task_thread);
 	threadFree(misc_tasks_thread);
+	threadFree(offline_download_thread);
+	threadFree(network_async_thread);
 	
 	NetworkSessionList::at_exit();
 
@@ -178,6 +210,45 @@ void Menu_exit(void)
 
 static std::vector<Intent> scene_stack = {{SceneType::SEARCH, ""}};
 
+// initialized in the suspended state as they used to be at startup, so that the startup only waits for the first scene
+static void init_scene_if_needed(SceneType scene)
+{
+	if (scene == SceneType::VIDEO_PLAYER && !VideoPlayer_query_init_flag()) {
+		VideoPlayer_init();
+		VideoPlayer_suspend();
+	} else if (scene == SceneType::CHANNEL && !Channel_query_init_flag()) {
+		Channel_init();
+		Channel_suspend();
+	} else if (scene == SceneType::SETTINGS && !Sem_query_init_flag()) {
+		Sem_init();
+		Sem_suspend();
+	} else if (scene == SceneType::ABOUT && !About_query_init_flag()) {
+		About_init();
+		About_suspend();
+	} else if (scene == SceneType::HISTORY && !History_query_init_flag()) {
+		History_init();
+		History_suspend();
+	} else if (scene == SceneType::SUBSCRIPTION && !Subscription_query_init_flag()) {
+		Subscription_init();
+		Subscription_suspend();
+	}
+	// add here
+}
+
+// the video that was playing when the app was closed (or crashed) is continued, with the search scene under it
+static void restore_player_session()
+{
+	PlayerSession session;
+	if (!load_player_session(session)) return;
+	
+	init_scene_if_needed(SceneType::VIDEO_PLAYER);
+	VideoPlayer_restore_session(session);
+	Search_suspend();
+	scene_stack.push_back({SceneType::VIDEO_PLAYER, session.url});
+	current_scene = SceneType::VIDEO_PLAYER;
+	VideoPlayer_resume(session.url);
+}
+
 bool Menu_main(void)
 {
 	if (sound_init_result != 0 || !is_new_3ds) {
@@ -249,6 +320,7 @@ bool Menu_main(void)
 		
 		current_scene = scene_stack.back().next_scene;
 		std::string arg = scene_stack.back().arg;
+		init_scene_if_needed(current_scene);
 		
 		if (current_scene == SceneType::VIDEO_PLAYER) VideoPlayer_resume(arg);
 		else if (current_scene == SceneType::SEARCH) Search_resume(arg);
@@ -308,6 +380,7 @@ void Menu_get_system_info(void)
 	var_wifi_signal = osGetWifiStrength();
 	//Get wifi state from shared memory #0x1FF81067
 	var_wifi_state = *(u8 *) 0x1FF81067;
+	connectivity_set_link_up(var_wifi_state == 2);
 	if(var_wifi_state == 2)
 	{
 		if (!var_connect_test_succes)
@@ -400,16 +473,31 @@ void Menu_check_connectivity_thread(void* arg)
 	std::string last_url;
 	http_buffer = (u8*)malloc(0x1000);
 
+	bool prev_link_up = true;
 	while (menu_thread_run)
 	{
+		// checked right away when the wifi comes back, so that the requests waiting for it resume without waiting out the interval
+		bool link_up = *(u8 *) 0x1FF81067 == 2;
+		if (link_up != prev_link_up)
+		{
+			connectivity_set_link_up(link_up);
+			if (link_up)
+				count = 100;
+			prev_link_up = link_up;
+		}
 		if (count >= 100)
 		{
 			count = 0;
-			Util_httpc_dl_data(DEF_CHECK_INTERNET_URL, http_buffer, 0x1000, &dl_size, &status_code, false, 0);
+			status_code = 0;
+			if (link_up)
+				Util_httpc_dl_data(DEF_CHECK_INTERNET_URL, http_buffer, 0x1000, &dl_size, &status_code, false, 0);
 
 			if (status_code == 204)
+			{
 				var_connect_test_succes = true;
-			else
+				connectivity_report_success();
+			}
+			else // not reported as a failure, the check server alone might be unreachable
 				var_connect_test_succes = false;
 		}
 		else
@@ -436,20 +524,30 @@ void Menu_worker_thread(void* arg)
 		if (count >= 20)
 		{
 			Menu_get_system_info();
+			memory_pressure_check();
 			var_need_reflesh = true;
 			count = 0;
 		}
 		
 		var_afk_time += 0.05;
 		
+		// nothing to look at during the low power audio-only playback
+		float time_to_turn_off_lcd = var_low_power_playing ? std::min<float>(var_time_to_turn_off_lcd, LOW_POWER_TIME_TO_TURN_OFF_LCD) : var_time_to_turn_off_lcd;
 		int cur_state;
-		if(var_afk_time > var_time_to_turn_off_lcd) cur_state = 0;
-		else if(var_afk_time > std::max<float>(var_time_to_turn_off_lcd * 0.5, (var_time_to_turn_off_lcd - 10))) cur_state = 1;
+		if(var_afk_time > time_to_turn_off_lcd) cur_state = 0;
+		else if(var_afk_time > std::max<float>(time_to_turn_off_lcd * 0.5, (time_to_turn_off_lcd - 10))) cur_state = 1;
 		else cur_state = 2;
 
 		if (cur_state != prev_state) {
-			if (prev_state == 0) Util_cset_set_screen_state(true, true, true);
-			if (cur_state == 0) Util_cset_set_screen_state(true, true, false);
+			if (prev_state == 0) {
+				Util_cset_set_screen_state(true, true, true);
+				var_screens_off = false;
+				var_need_reflesh = true; // the drawing might have been skipped while the screens were off
+			}
+			if (cur_state == 0) {
+				Util_cset_set_screen_state(true, true, false);
+				var_screens_off = true;
+			}
 			if (cur_state == 1) {
 				result = Util_cset_set_screen_brightness(true, true, 10);
 				if(result.code != 0)
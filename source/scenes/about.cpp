@@ -185,6 +185,7 @@ Intent About_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
@@ -204,7 +205,7 @@ Intent About_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 
 	if (Util_err_query_error_show_flag()) {
@@ -251,7 +252,7 @@ Intent About_draw(void)
 			var_need_reflesh = true;
 		} else consecutive_scroll = 0;
 		
-		if (key.h_touch || key.p_touch) var_need_reflesh = true;
+		if (Draw_is_touch_pos_outdated()) var_need_reflesh = true;
 		if (key.p_select) Util_log_set_log_show_flag(!Util_log_query_log_show_flag());
 	}
 
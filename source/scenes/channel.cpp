@@ -16,12 +16,14 @@
 #include "system/util/async_task.hpp"
 #include "system/util/misc_tasks.hpp"
 #include "system/util/subscription_util.hpp"
+#include "system/util/result_cache.hpp"
 
 #define THUMBNAIL_HEIGHT 54
 #define THUMBNAIL_WIDTH 96
 #define VIDEOS_MARGIN 6
 #define VIDEOS_VERTICAL_INTERVAL (THUMBNAIL_HEIGHT + VIDEOS_MARGIN)
 #define LOAD_MORE_MARGIN 30
+#define LOAD_MORE_AHEAD_ITEMS 8 // the next page is requested when the bottom of the list is this close, so that it's usually there before the user
 #define BANNER_HEIGHT 55
 #define ICON_SIZE 55
 #define TAB_SELECTOR_HEIGHT 20
@@ -33,6 +35,14 @@
 
 #define TAB_NUM 2
 
+#define CHANNEL_PAGE_FRESH_MS (10 * 60 * 1000)
+#define CHANNEL_PAGE_MAX_AGE_MS (12 * 60 * 60 * 1000) // the name, icon and most of the videos rarely change
+#define CHANNEL_PAGE_CACHE_MAX 8
+
+static size_t estimate_channel_detail_size(const YouTubeChannelDetail &detail) {
+	return sizeof(detail) + detail.description.size() + detail.videos.size() * 512;
+}
+
 namespace Channel {
 	bool thread_suspend = false;
 	bool already_init = false;
@@ -44,42 +54,36 @@ namespace Channel {
 	int selected_tab = 0;
 	
 	Handle resource_lock;
+	AsyncTaskToken channel_tasks_token; // for load_channel() and load_channel_more(), which must not overlap
 	std::string cur_channel_url;
 	YouTubeChannelDetail channel_info;
-	std::map<std::string, YouTubeChannelDetail> channel_info_cache;
-	int thumbnail_request_l = 0;
-	int thumbnail_request_r = 0;
+	ResultCache<YouTubeChannelDetail> channel_info_cache(CHANNEL_PAGE_FRESH_MS, CHANNEL_PAGE_MAX_AGE_MS, CHANNEL_PAGE_CACHE_MAX,
+		estimate_channel_detail_size);
+	ThumbnailListRequester thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	std::vector<int> thumbnail_handles;
 	int banner_thumbnail_handle = -1;
 	int icon_thumbnail_handle = -1;
-	std::vector<std::vector<std::string> > wrapped_titles;
+	std::vector<std::vector<std::string> > wrapped_titles; // empty for the ones not wrapped yet (see restore_channel_info())
+	// channel_info is given back while another scene is shown and copied again from channel_info_cache on resume (the scroll position is kept)
+	bool channel_info_released = false;
 };
 using namespace Channel;
 
 static void reset_channel_info() {
-	for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) thumbnail_cancel_request(thumbnail_handles[i]);
+	thumbnail_requester.cancel_all([&] (int i) -> int & { return thumbnail_handles[i]; });
 	thumbnail_handles.clear();
-	thumbnail_request_l = thumbnail_request_r = 0;
 	if (icon_thumbnail_handle != -1) thumbnail_cancel_request(icon_thumbnail_handle), icon_thumbnail_handle = -1;
 	if (banner_thumbnail_handle != -1) thumbnail_cancel_request(banner_thumbnail_handle), banner_thumbnail_handle = -1;
 	channel_info = YouTubeChannelDetail();
 }
 
-void load_channel(void *) {
-	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
-	auto url = cur_channel_url;
-	YouTubeChannelDetail result;
-	bool need_loading = false;
-	if (channel_info_cache.count(url)) result = channel_info_cache[url];
-	else need_loading = true;
-	svcReleaseMutex(resource_lock);
-	
-	if (need_loading) {
-		add_cpu_limit(25);
-		result = youtube_parse_channel_page(url);
-		remove_cpu_limit(25);
-	}
-	
+static void request_header_thumbnails_wo_lock() {
+	if (channel_info.icon_url != "") icon_thumbnail_handle = thumbnail_request(channel_info.icon_url, SceneType::CHANNEL, 1001, ThumbnailType::ICON, ICON_SIZE);
+	if (channel_info.banner_url != "") banner_thumbnail_handle = thumbnail_request(channel_info.banner_url, SceneType::CHANNEL, 1000, ThumbnailType::VIDEO_BANNER);
+}
+
+// shows `result` as the page of `url` unless the user has gone to another channel meanwhile
+static void show_channel_info(const std::string &url, const YouTubeChannelDetail &result) {
 	// wrap and truncate here
 	Util_log_save("channel", "truncate start");
 	std::vector<std::vector<std::string> > new_wrapped_titles(result.videos.size());
@@ -89,51 +93,107 @@ void load_channel(void *) {
 	
 	
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	if (url != cur_channel_url || channel_info_released) { // the cache has it for the resume in the latter case
+		svcReleaseMutex(resource_lock);
+		return;
+	}
+	reset_channel_info(); // a stale copy may be shown
 	channel_info = result;
 	wrapped_titles = new_wrapped_titles;
-	channel_info_cache[url] = result;
 	
 	thumbnail_handles.assign(channel_info.videos.size(), -1);
-	if (channel_info.icon_url != "") icon_thumbnail_handle = thumbnail_request(channel_info.icon_url, SceneType::CHANNEL, 1001, ThumbnailType::ICON);
-	if (channel_info.banner_url != "") banner_thumbnail_handle = thumbnail_request(channel_info.banner_url, SceneType::CHANNEL, 1000, ThumbnailType::VIDEO_BANNER);
+	request_header_thumbnails_wo_lock();
+	// the thumbnails of the first screen go out together with the banner and the icon instead of waiting for the next frame
+	thumbnail_requester.update(channel_info.videos.size(), 0, std::min<int>(channel_info.videos.size(), VIDEO_LIST_Y_HIGH / VIDEOS_VERTICAL_INTERVAL + 1), 0,
+		[&] (int i) -> int & { return thumbnail_handles[i]; },
+		[&] (int i) { return thumbnail_request(channel_info.videos[i].thumbnail_url, SceneType::CHANNEL, 0, ThumbnailType::VIDEO_THUMBNAIL, THUMBNAIL_WIDTH); });
 	var_need_reflesh = true;
 	svcReleaseMutex(resource_lock);
 }
+static void revalidate_channel(void *) {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	auto url = cur_channel_url;
+	svcReleaseMutex(resource_lock);
+	
+	auto result = youtube_parse_channel_page(url);
+	if (result.error != "" || async_task_cancel_requested()) return;
+	
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	channel_info_cache.put(url, result);
+	svcReleaseMutex(resource_lock);
+	show_channel_info(url, result);
+}
 void load_channel_more(void *) {
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
-	auto prev_result = channel_info;
+	// only the continuation state is needed, not the videos already loaded
+	YouTubeChannelDetail prev_result;
+	prev_result.name = channel_info.name;
+	prev_result.url_original = channel_info.url_original;
+	prev_result.continue_token = channel_info.continue_token;
+	prev_result.continue_key = channel_info.continue_key;
 	svcReleaseMutex(resource_lock);
 	
 	auto new_result = youtube_channel_page_continue(prev_result);
 	
 	Util_log_save("channel-c", "truncate start");
-	std::vector<std::vector<std::string> > wrapped_titles_add(new_result.videos.size() - prev_result.videos.size());
-	for (size_t i = prev_result.videos.size(); i < new_result.videos.size(); i++)
-		wrapped_titles_add[i - prev_result.videos.size()] = truncate_str(new_result.videos[i].title, 320 - (THUMBNAIL_WIDTH + 3), 2, 0.5, 0.5);
+	std::vector<std::vector<std::string> > wrapped_titles_add(new_result.videos.size());
+	for (size_t i = 0; i < new_result.videos.size(); i++)
+		wrapped_titles_add[i] = truncate_str(new_result.videos[i].title, 320 - (THUMBNAIL_WIDTH + 3), 2, 0.5, 0.5);
 	Util_log_save("channel-c", "truncate end");
 	
 	
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	if (channel_info_released) { // kept in the cache for the resume
+		if (new_result.error == "")
+			channel_info_cache.modify(prev_result.url_original, [&] (YouTubeChannelDetail &cached) { cached.append(YouTubeChannelDetail(new_result)); });
+		svcReleaseMutex(resource_lock);
+		return;
+	}
 	if (new_result.error != "") channel_info.error = new_result.error;
 	else {
-		channel_info = new_result;
-		channel_info_cache[channel_info.url_original] = channel_info;
+		channel_info_cache.modify(prev_result.url_original, [&] (YouTubeChannelDetail &cached) { cached.append(YouTubeChannelDetail(new_result)); });
+		channel_info.append(std::move(new_result));
 		wrapped_titles.insert(wrapped_titles.end(), wrapped_titles_add.begin(), wrapped_titles_add.end());
 	}
 	thumbnail_handles.resize(channel_info.videos.size(), -1);
 	var_need_reflesh = true;
 	svcReleaseMutex(resource_lock);
 }
+void load_channel(void *) {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	auto url = cur_channel_url;
+	YouTubeChannelDetail result;
+	auto cache_state = channel_info_cache.get(url, result);
+	svcReleaseMutex(resource_lock);
+	
+	if (cache_state == ResultCache<YouTubeChannelDetail>::State::MISSING) {
+		add_cpu_limit(25);
+		result = youtube_parse_channel_page(url);
+		remove_cpu_limit(25);
+		svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+		if (result.error == "") channel_info_cache.put(url, result);
+		svcReleaseMutex(resource_lock);
+	}
+	show_channel_info(url, result);
+	
+	// the old page is shown at once, but it's reloaded in case it has changed since
+	if (cache_state == ResultCache<YouTubeChannelDetail>::State::STALE)
+		queue_async_task(revalidate_channel, NULL, AsyncTaskPriority::VISIBLE, channel_tasks_token);
+	// the first continuation is fetched right behind the page, most channels don't fill the second screen without it
+	// (a cached page already has the continuations that were loaded with it)
+	else if (cache_state == ResultCache<YouTubeChannelDetail>::State::MISSING && !var_data_saver && result.error == "" && result.has_continue())
+		queue_async_task(load_channel_more, NULL, AsyncTaskPriority::PREFETCH, channel_tasks_token);
+}
 static bool send_load_request(std::string url) {
 	if (!is_async_task_running(load_channel)) {
-		remove_all_async_tasks_with_type(load_channel_more);
+		async_task_cancel(channel_tasks_token);
 		
 		svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 		cur_channel_url = url;
 		reset_channel_info();
 		svcReleaseMutex(resource_lock);
 		
-		queue_async_task(load_channel, NULL);
+		queue_async_task(load_channel, NULL, AsyncTaskPriority::INTERACTIVE, channel_tasks_token);
 		return true;
 	} else return false;
 }
@@ -141,7 +201,7 @@ static bool send_load_more_request() {
 	bool res = false;
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 	if (channel_info.videos.size() && channel_info.has_continue()) {
-		queue_async_task(load_channel_more, NULL);
+		queue_async_task(load_channel_more, NULL, AsyncTaskPriority::INTERACTIVE, channel_tasks_token);
 		res = true;
 	}
 	svcReleaseMutex(resource_lock);
@@ -153,9 +213,41 @@ bool Channel_query_init_flag(void) {
 }
 
 
+// suspend : the thumbnails and the parsed page are given back, only the url, the tab and the scroll position are kept
+static void release_channel_info() {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	reset_channel_info();
+	std::vector<std::vector<std::string> >().swap(wrapped_titles);
+	channel_info_released = true;
+	svcReleaseMutex(resource_lock);
+}
+// resume : the page is copied back from the cache, the titles are wrapped when they're drawn so that only the visible ones are
+// false if the cache has dropped it meanwhile
+static bool restore_channel_info() {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	channel_info_released = false;
+	YouTubeChannelDetail result;
+	bool res = cur_channel_url != "" && channel_info_cache.get(cur_channel_url, result) != ResultCache<YouTubeChannelDetail>::State::MISSING;
+	if (res) {
+		channel_info = std::move(result);
+		wrapped_titles.assign(channel_info.videos.size(), {});
+		thumbnail_handles.assign(channel_info.videos.size(), -1);
+		request_header_thumbnails_wo_lock();
+	}
+	svcReleaseMutex(resource_lock);
+	return res;
+}
+
 void Channel_resume(std::string arg)
 {
-	if (arg != "" && arg != cur_channel_url) send_load_request(arg);
+	bool released = channel_info_released;
+	if (arg != "" && arg != cur_channel_url) {
+		channel_info_released = false;
+		send_load_request(arg);
+	} else if (released && !restore_channel_info() && cur_channel_url != "") {
+		videos_scroller.reset();
+		send_load_request(cur_channel_url);
+	}
 	overlay_menu_on_resume();
 	videos_scroller.on_resume();
 	thread_suspend = false;
@@ -165,6 +257,13 @@ void Channel_resume(std::string arg)
 void Channel_suspend(void)
 {
 	thread_suspend = true;
+	release_channel_info();
+}
+
+static void shed_channel_info_cache(MemoryPressure level) {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	channel_info_cache.shed(level);
+	svcReleaseMutex(resource_lock);
 }
 
 void Channel_init(void)
@@ -174,6 +273,8 @@ void Channel_init(void)
 	
 	reset_channel_info();
 	svcCreateMutex(&resource_lock, false);
+	channel_tasks_token = async_task_create_token();
+	memory_pressure_add_handler(shed_channel_info_cache, MemoryShedPriority::PAGE_RESULTS);
 	
 	Channel_resume("");
 	already_init = true;
@@ -345,6 +446,7 @@ Intent Channel_draw(void)
 	channel_info_bak.displayed_l = displayed_l;
 	channel_info_bak.displayed_r = displayed_r;
 	for (int i = displayed_l; i < displayed_r; i++) {
+		if (!wrapped_titles[i].size()) wrapped_titles[i] = truncate_str(channel_info.videos[i].title, 320 - (THUMBNAIL_WIDTH + 3), 2, 0.5, 0.5);
 		channel_info_bak.videos[i] = channel_info.videos[i];
 		channel_info_bak.wrapped_titles[i] = wrapped_titles[i];
 	}
@@ -352,25 +454,9 @@ Intent Channel_draw(void)
 	// thumbnail request update (this should be done while `resource_lock` is locked)
 	if (channel_info.videos.size()) {
 		
-		int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-		int request_target_r = std::min(video_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-		// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-		std::set<int> new_indexes, cancelling_indexes;
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) cancelling_indexes.insert(i);
-		for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) new_indexes.erase(i);
-		for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-		
-		for (auto i : cancelling_indexes) thumbnail_cancel_request(thumbnail_handles[i]), thumbnail_handles[i] = -1;
-		for (auto i : new_indexes) thumbnail_handles[i] = thumbnail_request(channel_info.videos[i].thumbnail_url, SceneType::CHANNEL, 0, ThumbnailType::VIDEO_THUMBNAIL);
-		
-		thumbnail_request_l = request_target_l;
-		thumbnail_request_r = request_target_r;
-		
-		std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-		auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-		for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] = {thumbnail_handles[i], 500 - dist(i)};
-		thumbnail_set_priorities(priority_list);
+		thumbnail_requester.update(video_num, displayed_l, displayed_r, videos_scroller.get_scroll_velocity() / VIDEOS_VERTICAL_INTERVAL,
+			[&] (int i) -> int & { return thumbnail_handles[i]; },
+			[&] (int i) { return thumbnail_request(channel_info.videos[i].thumbnail_url, SceneType::CHANNEL, 0, ThumbnailType::VIDEO_THUMBNAIL, THUMBNAIL_WIDTH); });
 	}
 	svcReleaseMutex(resource_lock);
 	
@@ -384,6 +470,7 @@ Intent Channel_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
@@ -403,7 +490,7 @@ Intent Channel_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 
 	if (Util_err_query_error_show_flag()) {
@@ -418,8 +505,10 @@ Intent Channel_draw(void)
 		content_height += ICON_SIZE + SMALL_MARGIN * 2 + TAB_SELECTOR_HEIGHT;
 		if (selected_tab == 0) {
 			content_height += channel_info_bak.video_num * VIDEOS_VERTICAL_INTERVAL;
-			// load more
-			if (content_height - videos_scroller.get_offset() < VIDEO_LIST_Y_HIGH && !is_async_task_running(load_channel_more) &&
+			// load more, ahead of time unless the last attempt failed (then only when the bottom is reached, as a retry)
+			int left_below = content_height - videos_scroller.get_offset() - VIDEO_LIST_Y_HIGH;
+			if ((left_below < 0 || (channel_info_bak.error == "" && left_below < LOAD_MORE_AHEAD_ITEMS * VIDEOS_VERTICAL_INTERVAL)) &&
+				!is_async_task_running(load_channel_more) &&
 				channel_info_bak.video_num) {
 				send_load_more_request();
 			}
@@ -506,7 +595,7 @@ Intent Channel_draw(void)
 		
 		if (key.p_b) intent.next_scene = SceneType::BACK;
 		
-		if(key.h_touch || key.p_touch)
+		if(Draw_is_touch_pos_outdated())
 			var_need_reflesh = true;
 		if (key.p_select) Util_log_set_log_show_flag(!Util_log_query_log_show_flag());
 	}
@@ -4,6 +4,7 @@
 #include <set>
 #include <map>
 #include <numeric>
+#include <list>
 
 #include "scenes/search.hpp"
 #include "scenes/video_player.hpp"
@@ -14,14 +15,27 @@
 #include "ui/ui.hpp"
 #include "network/thumbnail_loader.hpp"
 #include "network/network_io.hpp"
+#include "network/network_async.hpp"
 #include "system/util/async_task.hpp"
+#include "system/util/result_cache.hpp"
 
 #define SEARCH_BOX_MARGIN 4
 
 #define URL_BUTTON_WIDTH 60
 
 #define MAX_THUMBNAIL_LOAD_REQUEST 25
+#define LOAD_MORE_AHEAD_ITEMS 8 // the next page is requested when the bottom of the list is this close, so that it's usually there before the user
 
+#define SEARCH_RESULT_FRESH_MS (5 * 60 * 1000)
+#define SEARCH_RESULT_MAX_AGE_MS (60 * 60 * 1000)
+#define SEARCH_RESULT_CACHE_MAX 5
+
+#define SUGGESTION_DEBOUNCE_MS 300 // a new query waits this long for another one before it's sent
+#define SUGGESTION_CACHE_MAX 32
+#define SUGGESTION_SERVER_MAX_NUM 10 // a cached list shorter than this has every completion of its query
+#define SUGGESTION_ITEM_HEIGHT (DEFAULT_FONT_INTERVAL + 4)
+
+static size_t estimate_search_result_size(const YouTubeSearchResult &result) { return sizeof(result) + result.results.size() * 512; }
 
 namespace Search {
 	bool thread_suspend = false;
@@ -29,10 +43,12 @@ namespace Search {
 	bool exiting = false;
 	
 	Handle resource_lock;
+	AsyncTaskToken search_tasks_token; // for load_search_results() and load_more_search_results(), which must not overlap
 	std::string cur_search_word = "";
 	YouTubeSearchResult search_result;
-	int thumbnail_request_l = 0;
-	int thumbnail_request_r = 0;
+	ResultCache<YouTubeSearchResult> search_result_cache(SEARCH_RESULT_FRESH_MS, SEARCH_RESULT_MAX_AGE_MS, SEARCH_RESULT_CACHE_MAX,
+		estimate_search_result_size);
+	ThumbnailListRequester thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	bool search_done = false;
 	
 	std::string last_url_input = "https://m.youtube.com/watch?v=";
@@ -54,15 +70,34 @@ namespace Search {
 	TextView *search_box_view;
 	TextView *url_button_view;
 	
-	VerticalListView *result_list_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN);
+	VerticalListView *result_list_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN)->set_is_virtualized(true);
 	View *result_bottom_view = new EmptyView(0, 0, 320, 0);
 	ScrollView *result_view;
+	
+	// query autocompletion, shown as a dropdown under the search box
+	// the keyboard is a system applet that returns only the whole text, so the suggestions are asked for with its middle button
+	// and given back to it as predictive input words the next time it's opened
+	std::map<std::string, std::vector<std::string> > suggestion_cache;
+	std::list<std::string> suggestion_cache_order; // most recently used first
+	std::string suggestion_wanted_query; // the latest query, sent once it stops changing for SUGGESTION_DEBOUNCE_MS
+	u64 suggestion_wanted_time = 0;
+	std::string suggestion_inflight_query;
+	int suggestion_inflight_id = -1;
+	std::vector<std::string> suggestions; // shown in the dropdown
+	std::string suggestion_clicked;
+	bool suggestions_shown = false;
+	VerticalListView *suggestion_list_view;
+	
+	// filled on the network thread, taken by Search_draw()
+	Handle suggestion_received_lock;
+	std::vector<std::pair<std::string, std::string> > suggestion_received; // {query, response}
 };
 using namespace Search;
 
 
 static void load_search_results(void *);
 static void load_more_search_results(void *);
+static void revalidate_search_results(void *);
 
 static void set_loading_bottom_view() {
 	delete result_bottom_view;
@@ -83,10 +118,101 @@ static void update_result_bottom_view() {
 	result_view->set_on_child_drawn(1, [] (const ScrollView &, int) {
 		if (search_result.has_continue() && search_result.error == "") {
 			if (!is_async_task_running(load_search_results) &&
-				!is_async_task_running(load_more_search_results)) queue_async_task(load_more_search_results, NULL);
+				!is_async_task_running(load_more_search_results)) queue_async_task(load_more_search_results, NULL, AsyncTaskPriority::INTERACTIVE, search_tasks_token);
 		}
 	});
 }
+// should be called while `resource_lock` is locked
+static void set_suggestions(const std::vector<std::string> &new_suggestions) {
+	suggestions = new_suggestions;
+	suggestion_list_view->recursive_delete_subviews();
+	for (auto &suggestion : suggestions) {
+		suggestion_list_view->views.push_back((new TextView(0, 0, 320, SUGGESTION_ITEM_HEIGHT))
+			->set_text(suggestion)
+			->set_text_offset(SMALL_MARGIN, -1)
+			->set_get_background_color(View::STANDARD_BACKGROUND)
+			->set_on_view_released([suggestion] (View &) { suggestion_clicked = suggestion; }));
+	}
+	var_need_reflesh = true;
+}
+static bool suggestion_cache_get(const std::string &query, std::vector<std::string> &res) {
+	auto itr = suggestion_cache.find(query);
+	if (itr == suggestion_cache.end()) return false;
+	res = itr->second;
+	suggestion_cache_order.remove(query);
+	suggestion_cache_order.push_front(query);
+	return true;
+}
+static void suggestion_cache_put(const std::string &query, const std::vector<std::string> &suggestions) {
+	if (suggestion_cache.count(query)) suggestion_cache_order.remove(query);
+	suggestion_cache[query] = suggestions;
+	suggestion_cache_order.push_front(query);
+	while (suggestion_cache_order.size() > SUGGESTION_CACHE_MAX) {
+		suggestion_cache.erase(suggestion_cache_order.back());
+		suggestion_cache_order.pop_back();
+	}
+}
+// the completions of the longest cached prefix of `query` that also complete `query`
+// returns true if they are all of them (the cached list wasn't cut by the server), so that nothing needs to be asked
+static bool suggestion_from_prefix(const std::string &query, std::vector<std::string> &res) {
+	if (query.size() < 2) return false;
+	for (size_t len = query.size() - 1; len > 0; len--) {
+		auto itr = suggestion_cache.find(query.substr(0, len));
+		if (itr == suggestion_cache.end()) continue;
+		res.clear();
+		for (auto &suggestion : itr->second) if (suggestion.compare(0, query.size(), query) == 0) res.push_back(suggestion);
+		return itr->second.size() < SUGGESTION_SERVER_MAX_NUM;
+	}
+	return false;
+}
+// should be called while `resource_lock` is locked
+static void request_suggestions(const std::string &query) {
+	suggestions_shown = true;
+	std::vector<std::string> cached;
+	if (suggestion_cache_get(query, cached) || suggestion_from_prefix(query, cached)) {
+		set_suggestions(cached);
+		suggestion_wanted_query = "";
+		return;
+	}
+	set_suggestions(cached); // what the prefixes give meanwhile
+	suggestion_wanted_query = query;
+	suggestion_wanted_time = osGetTime();
+}
+// called every frame while `resource_lock` is locked : sends the wanted query after the debounce and takes the response
+static void update_suggestions() {
+	std::vector<std::pair<std::string, std::string> > received;
+	svcWaitSynchronization(suggestion_received_lock, std::numeric_limits<s64>::max());
+	received.swap(suggestion_received);
+	svcReleaseMutex(suggestion_received_lock);
+	
+	for (auto &response : received) {
+		auto result = youtube_parse_search_suggestions(response.second);
+		suggestion_cache_put(response.first, result);
+		if (response.first == suggestion_inflight_query) {
+			suggestion_inflight_id = -1;
+			suggestion_inflight_query = "";
+			if (suggestions_shown) set_suggestions(result);
+		}
+	}
+	if (suggestion_wanted_query != "" && osGetTime() - suggestion_wanted_time >= SUGGESTION_DEBOUNCE_MS) {
+		// a response for an older query is useless now
+		if (suggestion_inflight_id != -1) network_async_cancel(suggestion_inflight_id);
+		suggestion_inflight_query = suggestion_wanted_query;
+		suggestion_wanted_query = "";
+		std::string query = suggestion_inflight_query;
+		suggestion_inflight_id = network_async_get(youtube_get_search_suggestions_url(query), youtube_get_request_headers(), [query] (NetworkResult &result) {
+			if (result.fail || result.status_code / 100 != 2) {
+				Util_log_save("search/suggest", "failed : " + result.error + " " + std::to_string(result.status_code));
+				return;
+			}
+			svcWaitSynchronization(suggestion_received_lock, std::numeric_limits<s64>::max());
+			suggestion_received.push_back({query, std::string(result.data.begin(), result.data.end())});
+			svcReleaseMutex(suggestion_received_lock);
+			var_need_reflesh = true;
+		});
+	}
+}
+
 static View *result_item_to_view(const YouTubeSuccinctItem &item) {
 	View *res_view;
 	if (item.type == YouTubeSuccinctItem::CHANNEL) {
@@ -109,9 +235,11 @@ static View *result_item_to_view(const YouTubeSuccinctItem &item) {
 		res_view = cur_view;
 	}
 	res_view->set_get_background_color(View::STANDARD_BACKGROUND);
-	res_view->set_on_view_released([item] (View &view) {
-		clicked_url = item.get_url();
-		clicked_is_channel = item.type == YouTubeSuccinctItem::CHANNEL;
+	std::string url = item.get_url();
+	bool is_channel = item.type == YouTubeSuccinctItem::CHANNEL;
+	res_view->set_on_view_released([url, is_channel] (View &view) {
+		clicked_url = url;
+		clicked_is_channel = is_channel;
 	});
 	return res_view;
 }
@@ -125,6 +253,15 @@ static std::pair<int *, std::string *> get_thumbnail_info_from_view(View *view)
 }
 
 
+static std::string get_search_url(const std::string &search_word) {
+	std::string res = "https://m.youtube.com/results?search_query=";
+	for (auto c : search_word) {
+		res.push_back('%');
+		res.push_back("0123456789ABCDEF"[(u8) c / 16]);
+		res.push_back("0123456789ABCDEF"[(u8) c % 16]);
+	}
+	return res;
+}
 static void load_search_results(void *) {
 	// pre-access processing
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
@@ -132,7 +269,7 @@ static void load_search_results(void *) {
 	search_done = false;
 	
 	for (auto view : result_list_view->views) thumbnail_cancel_request(*get_thumbnail_info_from_view(view).first);
-	thumbnail_request_l = thumbnail_request_r = 0;
+	thumbnail_requester.reset();
 	result_list_view->recursive_delete_subviews();
 	set_loading_bottom_view();
 	search_result = YouTubeSearchResult();
@@ -140,15 +277,19 @@ static void load_search_results(void *) {
 	svcReleaseMutex(resource_lock);
 	
 	// actual loading
-	std::string search_url = "https://m.youtube.com/results?search_query=";
-	for (auto c : search_word) {
-		search_url.push_back('%');
-		search_url.push_back("0123456789ABCDEF"[(u8) c / 16]);
-		search_url.push_back("0123456789ABCDEF"[(u8) c % 16]);
+	std::string search_url = get_search_url(search_word);
+	YouTubeSearchResult new_result;
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	auto cache_state = search_result_cache.get(search_url, new_result);
+	svcReleaseMutex(resource_lock);
+	if (cache_state == ResultCache<YouTubeSearchResult>::State::MISSING) {
+		add_cpu_limit(25);
+		new_result = youtube_parse_search(search_url);
+		remove_cpu_limit(25);
+		svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+		if (new_result.error == "") search_result_cache.put(search_url, new_result);
+		svcReleaseMutex(resource_lock);
 	}
-	add_cpu_limit(25);
-	YouTubeSearchResult new_result = youtube_parse_search(search_url);
-	remove_cpu_limit(25);
 	
 	// wrap and truncate here
 	Util_log_save("search", "truncate/view creation start");
@@ -164,10 +305,48 @@ static void load_search_results(void *) {
 	search_done = true;
 	var_need_reflesh = true;
 	svcReleaseMutex(resource_lock);
+	
+	// the old results are shown at once, but they're reloaded in case they have changed since
+	if (cache_state == ResultCache<YouTubeSearchResult>::State::STALE)
+		queue_async_task(revalidate_search_results, NULL, AsyncTaskPriority::VISIBLE, search_tasks_token);
+}
+static void revalidate_search_results(void *) {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	std::string search_word = cur_search_word;
+	size_t shown_result_num = search_result.results.size();
+	svcReleaseMutex(resource_lock);
+	
+	std::string search_url = get_search_url(search_word);
+	YouTubeSearchResult new_result = youtube_parse_search(search_url);
+	if (new_result.error != "" || async_task_cancel_requested()) return;
+	
+	std::vector<View *> new_result_views;
+	for (size_t i = 0; i < new_result.results.size(); i++) new_result_views.push_back(result_item_to_view(new_result.results[i]));
+	
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	search_result_cache.put(search_url, new_result);
+	// keep what is shown if the user has searched something else or loaded more meanwhile
+	if (search_word != cur_search_word || search_result.results.size() != shown_result_num) {
+		svcReleaseMutex(resource_lock);
+		for (auto view : new_result_views) delete view;
+		return;
+	}
+	for (auto view : result_list_view->views) thumbnail_cancel_request(*get_thumbnail_info_from_view(view).first);
+	thumbnail_requester.reset();
+	result_list_view->recursive_delete_subviews();
+	search_result = new_result;
+	result_list_view->views = new_result_views;
+	update_result_bottom_view();
+	var_need_reflesh = true;
+	svcReleaseMutex(resource_lock);
 }
 static void load_more_search_results(void *) {
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
-	auto prev_result = search_result;
+	// only the continuation state is needed, not the results already loaded
+	YouTubeSearchResult prev_result;
+	prev_result.estimated_result_num = search_result.estimated_result_num;
+	prev_result.continue_token = search_result.continue_token;
+	prev_result.continue_key = search_result.continue_key;
 	var_need_reflesh = true;
 	svcReleaseMutex(resource_lock);
 	
@@ -175,14 +354,15 @@ static void load_more_search_results(void *) {
 	
 	Util_log_save("search-c", "truncate/view creation start");
 	std::vector<View *> new_result_views;
-	for (size_t i = prev_result.results.size(); i < new_result.results.size(); i++) new_result_views.push_back(result_item_to_view(new_result.results[i]));
+	for (auto &item : new_result.results) new_result_views.push_back(result_item_to_view(item));
 	Util_log_save("search-c", "truncate/view creation end");
 	
 	
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 	if (new_result.error != "") search_result.error = new_result.error;
 	else {
-		search_result = new_result;
+		search_result_cache.modify(get_search_url(cur_search_word), [&] (YouTubeSearchResult &cached) { cached.append(YouTubeSearchResult(new_result)); });
+		search_result.append(std::move(new_result));
 		result_list_view->views.insert(result_list_view->views.end(), new_result_views.begin(), new_result_views.end());
 	}
 	update_result_bottom_view();
@@ -204,7 +384,6 @@ static void access_input_url(void *) {
 		page_type = youtube_get_page_type(result.redirected_url);
 		url = result.redirected_url;
 		result.finalize();
-		session_list.close_sessions();
 	}
 	
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
@@ -237,12 +416,21 @@ void Search_suspend(void)
 	thread_suspend = true;
 }
 
+static void shed_search_result_cache(MemoryPressure level) {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	search_result_cache.shed(level);
+	svcReleaseMutex(resource_lock);
+}
+
 void Search_init(void)
 {
 	Util_log_save("search/init", "Initializing...");
 	Result_with_string result;
 	
 	svcCreateMutex(&resource_lock, false);
+	svcCreateMutex(&suggestion_received_lock, false);
+	search_tasks_token = async_task_create_token();
+	memory_pressure_add_handler(shed_search_result_cache, MemoryShedPriority::PAGE_RESULTS);
 	
 	search_box_view = (new TextView(0, SEARCH_BOX_MARGIN, 320 - SEARCH_BOX_MARGIN * 3 - URL_BUTTON_WIDTH, RESULT_Y_LOW - SEARCH_BOX_MARGIN * 2));
 	search_box_view->set_text_offset(0, -1);
@@ -275,6 +463,7 @@ void Search_init(void)
 	
 	result_view = (new ScrollView(0, 0, 320, RESULT_Y_HIGH - RESULT_Y_LOW))
 		->set_views({result_list_view, result_bottom_view});
+	suggestion_list_view = new VerticalListView(0, 0, 320);
 	
 	
 	
@@ -288,35 +477,52 @@ void Search_exit(void)
 	thread_suspend = false;
 	exiting = true;
 	
+	if (suggestion_inflight_id != -1) network_async_cancel(suggestion_inflight_id);
+	suggestion_inflight_id = -1;
+	suggestion_inflight_query = "";
+	
 	Util_log_save("search/exit", "Exited.");
 }
 
 static void search() {
 	if (!is_async_task_running(load_search_results)) {
 		SwkbdState keyboard;
-		swkbdInit(&keyboard, SWKBD_TYPE_NORMAL, 2, 32);
+		swkbdInit(&keyboard, SWKBD_TYPE_NORMAL, 3, 32);
 		swkbdSetFeatures(&keyboard, SWKBD_DEFAULT_QWERTY | SWKBD_PREDICTIVE_INPUT);
 		swkbdSetValidation(&keyboard, SWKBD_NOTEMPTY_NOTBLANK, 0, 0);
 		swkbdSetButton(&keyboard, SWKBD_BUTTON_LEFT, LOCALIZED(CANCEL).c_str(), false);
+		swkbdSetButton(&keyboard, SWKBD_BUTTON_MIDDLE, LOCALIZED(SUGGESTIONS).c_str(), true);
 		swkbdSetButton(&keyboard, SWKBD_BUTTON_RIGHT, LOCALIZED(OK).c_str(), true);
 		swkbdSetInitialText(&keyboard, cur_search_word.c_str());
+		// the suggestions shown last are offered as predictive input words
+		SwkbdDictWord words[SUGGESTION_SERVER_MAX_NUM];
+		int word_num = 0;
+		for (auto &suggestion : suggestions) if (word_num < SUGGESTION_SERVER_MAX_NUM) swkbdSetDictWord(&words[word_num++], suggestion.c_str(), suggestion.c_str());
+		if (word_num) swkbdSetDictionary(&keyboard, words, word_num);
 		char search_word[129];
-		add_cpu_limit(40);
+		add_cpu_limit(40, CpuLimitReason::SYSTEM_APPLET);
 		video_set_skip_drawing(true);
 		auto button_pressed = swkbdInputText(&keyboard, search_word, 64);
 		video_set_skip_drawing(false);
-		remove_cpu_limit(40);
+		remove_cpu_limit(40, CpuLimitReason::SYSTEM_APPLET);
 		
-		if (button_pressed == SWKBD_BUTTON_RIGHT) {
+		if (button_pressed == SWKBD_BUTTON_MIDDLE) {
 			svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 			cur_search_word = search_word;
 			search_box_view->set_text(search_word);
 			search_box_view->set_get_text_color([] () { return DEFAULT_TEXT_COLOR; });
+			request_suggestions(search_word);
+			svcReleaseMutex(resource_lock);
+		} else if (button_pressed == SWKBD_BUTTON_RIGHT) {
+			svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+			cur_search_word = search_word;
+			search_box_view->set_text(search_word);
+			search_box_view->set_get_text_color([] () { return DEFAULT_TEXT_COLOR; });
+			suggestions_shown = false;
 			svcReleaseMutex(resource_lock);
 			
-			remove_all_async_tasks_with_type(load_search_results);
-			remove_all_async_tasks_with_type(load_more_search_results);
-			queue_async_task(load_search_results, NULL);
+			async_task_cancel(search_tasks_token);
+			queue_async_task(load_search_results, NULL, AsyncTaskPriority::INTERACTIVE, search_tasks_token);
 		}
 	}
 }
@@ -330,11 +536,11 @@ static void url_input() {
 		swkbdSetButton(&keyboard, SWKBD_BUTTON_RIGHT, LOCALIZED(OK).c_str(), true);
 		swkbdSetInitialText(&keyboard, last_url_input.c_str());
 		char url[256];
-		add_cpu_limit(40);
+		add_cpu_limit(40, CpuLimitReason::SYSTEM_APPLET);
 		video_set_skip_drawing(true);
 		auto button_pressed = swkbdInputText(&keyboard, url, 256 - 1);
 		video_set_skip_drawing(false);
-		remove_cpu_limit(40);
+		remove_cpu_limit(40, CpuLimitReason::SYSTEM_APPLET);
 		
 		if (button_pressed == SWKBD_BUTTON_RIGHT) {
 			svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
@@ -375,12 +581,17 @@ Intent Search_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
 		// (!) : I don't know how to draw textures truncated, so I will just fill the margin with white again
 		svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 		result_view->draw(0, RESULT_Y_LOW);
+		if (suggestions_shown) {
+			Draw_texture(var_square_image[0], DEFAULT_BACK_COLOR, 0, RESULT_Y_LOW, 320, suggestion_list_view->get_height());
+			suggestion_list_view->draw(0, RESULT_Y_LOW);
+		}
 		Draw_texture(var_square_image[0], DEFAULT_BACK_COLOR, 0, 0, 320, RESULT_Y_LOW);
 		top_bar_view->draw();
 		if (toast_view_visible_frames_left > 0) toast_view->draw();
@@ -403,44 +614,27 @@ Intent Search_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	update_suggestions();
 	int result_num = search_result.results.size();
 	if (result_num) {
 		int item_interval = VIDEO_LIST_THUMBNAIL_HEIGHT + SMALL_MARGIN;
+		// the bottom view still triggers it when it's drawn, this just starts earlier
+		int left_below = result_list_view->get_height() - (result_view->get_offset() + RESULT_Y_HIGH - RESULT_Y_LOW);
+		if (left_below < LOAD_MORE_AHEAD_ITEMS * item_interval && search_result.has_continue() && search_result.error == "" &&
+			!is_async_task_running(load_search_results) && !is_async_task_running(load_more_search_results))
+			queue_async_task(load_more_search_results, NULL, AsyncTaskPriority::VISIBLE, search_tasks_token);
 		int displayed_l = std::min(result_num, result_view->get_offset() / item_interval);
 		int displayed_r = std::min(result_num, (result_view->get_offset() + RESULT_Y_HIGH - RESULT_Y_LOW - 1) / item_interval + 1);
-		int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-		int request_target_r = std::min(result_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-		// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-		std::set<int> new_indexes, cancelling_indexes;
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) cancelling_indexes.insert(i);
-		for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) new_indexes.erase(i);
-		for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-		
-		for (auto i : cancelling_indexes) {
-			int &thumbnail_handle = *get_thumbnail_info_from_view(result_list_view->views[i]).first;
-			thumbnail_cancel_request(thumbnail_handle);
-			thumbnail_handle = -1;
-		}
-		for (auto i : new_indexes) {
-			auto tmp = get_thumbnail_info_from_view(result_list_view->views[i]);
-			int &thumbnail_handle = *tmp.first;
-			std::string &thumbnail_url = *tmp.second;
-			ThumbnailType type = dynamic_cast<SuccinctChannelView *>(result_list_view->views[i]) ? ThumbnailType::ICON : ThumbnailType::VIDEO_THUMBNAIL;
-			thumbnail_handle = thumbnail_request(thumbnail_url, SceneType::SEARCH, 0, type);
-		}
-		
-		thumbnail_request_l = request_target_l;
-		thumbnail_request_r = request_target_r;
-		
-		std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-		auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-		for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] = {
-			*get_thumbnail_info_from_view(result_list_view->views[i]).first, 500 - dist(i)};
-		thumbnail_set_priorities(priority_list);
+		thumbnail_requester.update(result_num, displayed_l, displayed_r, result_view->get_scroll_velocity() / item_interval,
+			[&] (int i) -> int & { return *get_thumbnail_info_from_view(result_list_view->views[i]).first; },
+			[&] (int i) {
+				auto tmp = get_thumbnail_info_from_view(result_list_view->views[i]);
+				ThumbnailType type = dynamic_cast<SuccinctChannelView *>(result_list_view->views[i]) ? ThumbnailType::ICON : ThumbnailType::VIDEO_THUMBNAIL;
+				return thumbnail_request(*tmp.second, SceneType::SEARCH, 0, type, type == ThumbnailType::ICON ? CHANNEL_ICON_HEIGHT : VIDEO_LIST_THUMBNAIL_WIDTH);
+			});
 	}
 
 	if (Util_err_query_error_show_flag()) {
@@ -451,7 +645,17 @@ Intent Search_draw(void)
 		update_overlay_menu(&key, &intent, SceneType::SEARCH);
 		
 		top_bar_view->update(key);
-		result_view->update(key, 0, RESULT_Y_LOW);
+		if (suggestions_shown) suggestion_list_view->update(key, 0, RESULT_Y_LOW);
+		else result_view->update(key, 0, RESULT_Y_LOW);
+		if (suggestion_clicked != "") {
+			cur_search_word = suggestion_clicked;
+			search_box_view->set_text(suggestion_clicked);
+			search_box_view->set_get_text_color([] () { return DEFAULT_TEXT_COLOR; });
+			suggestion_clicked = "";
+			suggestions_shown = false;
+			async_task_cancel(search_tasks_token);
+			queue_async_task(load_search_results, NULL, AsyncTaskPriority::INTERACTIVE, search_tasks_token);
+		}
 		if (clicked_url != "") {
 			intent.next_scene = clicked_is_channel ? SceneType::CHANNEL : SceneType::VIDEO_PLAYER;
 			intent.arg = clicked_url;
@@ -488,9 +692,14 @@ Intent Search_draw(void)
 		} else consecutive_scroll = 0;
 		
 		if (key.p_a) search();
-		else if(key.h_touch || key.p_touch) var_need_reflesh = true;
+		else if(Draw_is_touch_pos_outdated()) var_need_reflesh = true;
 		
-		if (key.p_b) intent.next_scene = SceneType::BACK;
+		if (key.p_b) {
+			if (suggestions_shown) {
+				suggestions_shown = false;
+				var_need_reflesh = true;
+			} else intent.next_scene = SceneType::BACK;
+		}
 	}
 	
 	svcReleaseMutex(resource_lock);
@@ -9,8 +9,12 @@
 #include "ui/ui.hpp"
 #include "youtube_parser/parser.hpp"
 #include "system/util/history.hpp"
+#include "system/thread_placement.hpp"
 #include "system/util/misc_tasks.hpp"
 #include "network/thumbnail_loader.hpp"
+#include "network/network_stats.hpp"
+#include "system/util/metrics.hpp"
+#include "system/util/kernel_benchmark.hpp"
 
 namespace Settings {
 	bool thread_suspend = false;
@@ -21,10 +25,16 @@ namespace Settings {
 	int toast_frames_left = 0;
 	
 	OverlayView *popup_view;
-	VerticalListView *main_view;
-	TabView *main_tab_view;
+	VerticalListView *main_view = NULL;
+	TabView *main_tab_view = NULL;
+	// the views are deleted while another scene is shown, and built again with the tab and the scroll positions restored
+	int saved_tab = 0;
+	std::vector<int> saved_tab_offsets;
 	
 	int CONTENT_Y_HIGH = 240;
+	constexpr int STATS_TAB = 3;
+	constexpr int STATS_REFRESH_INTERVAL_MS = 500;
+	u64 last_stats_refresh_time = 0;
 	constexpr int TOP_HEIGHT = MIDDLE_FONT_INTERVAL + SMALL_MARGIN * 2;
 	
 	Thread settings_misc_thread;
@@ -36,8 +46,28 @@ bool Sem_query_init_flag(void) {
 	return already_init;
 }
 
+static void build_views();
+static void release_views() {
+	if (!main_view) return;
+	saved_tab = main_tab_view->selected_tab;
+	saved_tab_offsets.clear();
+	for (auto view : main_tab_view->views) saved_tab_offsets.push_back(dynamic_cast<ScrollView *>(view)->get_offset());
+	popup_view->recursive_delete_subviews();
+	popup_view->set_is_visible(false);
+	main_view->recursive_delete_subviews();
+	delete main_view;
+	main_view = NULL;
+	main_tab_view = NULL;
+}
+
 void Sem_resume(std::string arg)
 {
+	if (!main_view) {
+		build_views();
+		main_tab_view->selected_tab = saved_tab;
+		for (size_t i = 0; i < saved_tab_offsets.size() && i < main_tab_view->views.size(); i++)
+			dynamic_cast<ScrollView *>(main_tab_view->views[i])->set_offset(saved_tab_offsets[i]);
+	}
 	overlay_menu_on_resume();
 	thread_suspend = false;
 	var_need_reflesh = true;
@@ -46,21 +76,11 @@ void Sem_resume(std::string arg)
 void Sem_suspend(void)
 {
 	thread_suspend = true;
+	release_views();
 }
 
-void Sem_init(void)
-{
-	Util_log_save("settings/init", "Initializing...");
-	Result_with_string result;
-	
-	load_settings();
-	load_string_resources(var_lang);
-	
-	popup_view = new OverlayView(0, 0, 320, 240);
-	popup_view->set_is_visible(false);
-	toast_view = new TextView((320 - 150) / 2, 190, 150, DEFAULT_FONT_INTERVAL + SMALL_MARGIN);
-	toast_view->set_is_visible(false);
-	
+// the selectors start at the current values of the settings, so building them again shows the changes made elsewhere as well
+static void build_views() {
 	main_tab_view = (new TabView(0, 0, 320, CONTENT_Y_HIGH - TOP_HEIGHT))
 		->set_stretch_subview(true)
 		->set_views({
@@ -128,6 +148,19 @@ void Sem_init(void)
 								misc_tasks_request(TASK_SAVE_SETTINGS);
 							}
 						}),
+					// mini player
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_video_mini_player)
+						->set_title([](const SelectorView &) { return LOCALIZED(MINI_PLAYER); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_video_mini_player != view.selected_button) {
+								var_video_mini_player = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
 					// Dark theme (plus flash)
 					(new SelectorView(0, 0, 320, 35))
 						->set_texts({
@@ -164,6 +197,53 @@ void Sem_init(void)
 								misc_tasks_request(TASK_SAVE_SETTINGS);
 							}
 						}),
+					// Stream cache on the SD card
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(DISABLED); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ENABLED); }
+						}, var_stream_disk_cache_enabled)
+						->set_title([](const SelectorView &) { return LOCALIZED(STREAM_DISK_CACHE); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_stream_disk_cache_enabled != view.selected_button) {
+								var_stream_disk_cache_enabled = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Data saver, applied from the next video
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_data_saver)
+						->set_title([](const SelectorView &) { return LOCALIZED(DATA_SAVER); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_data_saver != view.selected_button) {
+								var_data_saver = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Thumbnails compressed to ETC1, applied to the thumbnails loaded after the change
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_thumbnail_etc1)
+						->set_title([](const SelectorView &) { return LOCALIZED(COMPRESSED_THUMBNAILS); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_thumbnail_etc1 != view.selected_button) {
+								var_thumbnail_etc1 = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Data received since the app started
+					(new TextView(0, 0, 320, DEFAULT_FONT_INTERVAL + SMALL_MARGIN))
+						->set_text((std::function<std::string ()>) [] () {
+							char buf[32];
+							snprintf(buf, sizeof(buf), "%.1f MB", network_stats_get_session_bytes() / 1000000.0);
+							return LOCALIZED(DATA_USED_THIS_SESSION) + " : " + buf;
+						})
+						->set_text_offset(SMALL_MARGIN, -1),
 					(new EmptyView(0, 0, 320, 10)),
 					// Erase history
 					(new TextView(10, 0, 120, DEFAULT_FONT_INTERVAL + SMALL_MARGIN * 2))
@@ -259,6 +339,46 @@ void Sem_init(void)
 								misc_tasks_request(TASK_SAVE_SETTINGS);
 							}
 						}),
+					// Audio output
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(AUDIO_OUTPUT_ORIGINAL); },
+							(std::function<std::string ()>) []() { return std::string("32 kHz"); },
+							(std::function<std::string ()>) []() { return LOCALIZED(AUDIO_OUTPUT_32KHZ_MONO); }
+						}, var_audio_output_mode)
+						->set_title([](const SelectorView &) { return LOCALIZED(AUDIO_OUTPUT); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_audio_output_mode != view.selected_button) {
+								var_audio_output_mode = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Low power audio-only playback
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_audio_only_low_power)
+						->set_title([](const SelectorView &) { return LOCALIZED(AUDIO_ONLY_LOW_POWER); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_audio_only_low_power != view.selected_button) {
+								var_audio_only_low_power = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Low latency livestreams
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_livestream_low_latency)
+						->set_title([](const SelectorView &) { return LOCALIZED(LIVESTREAM_LOW_LATENCY); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_livestream_low_latency != view.selected_button) {
+								var_livestream_low_latency = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
 					// Network framework
 					(new SelectorView(0, 0, 320, 35))
 						->set_texts({"httpc", "sslc", "libcurl"}, var_network_framework_changed)
@@ -270,6 +390,41 @@ void Sem_init(void)
 								misc_tasks_request(TASK_SAVE_SETTINGS);
 							}
 						}),
+					// Thread placement
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(THREAD_PLACEMENT_DEFAULT); },
+							(std::function<std::string ()>) []() { return LOCALIZED(THREAD_PLACEMENT_DECODER_ISOLATED); },
+							(std::function<std::string ()>) []() { return LOCALIZED(THREAD_PLACEMENT_BACKGROUND_ON_SYS_CORE); }
+						}, var_thread_placement_changed)
+						->set_title([](const SelectorView &view) { return LOCALIZED(THREAD_PLACEMENT) +
+							(var_thread_placement != var_thread_placement_changed ? " (" + LOCALIZED(RESTART_TO_APPLY) + ")" : ""); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_thread_placement_changed != view.selected_button) {
+								var_thread_placement_changed = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Software decoder threads, used from the next playback
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({"1", "2", "3"}, var_video_sw_decoder_threads - 1)
+						->set_title([](const SelectorView &view) { return LOCALIZED(SW_DECODER_THREADS); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_video_sw_decoder_threads != view.selected_button + 1) {
+								var_video_sw_decoder_threads = view.selected_button + 1;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Color conversion of software-decoded frames, applied from the next frame
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({"Y2R", "GPU", "CPU"}, var_video_yuv_converter)
+						->set_title([](const SelectorView &view) { return LOCALIZED(YUV_CONVERTER); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_video_yuv_converter != view.selected_button) {
+								var_video_yuv_converter = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
 					(new EmptyView(0, 0, 320, 10)),
 					// Debug info in the control tab
 					(new SelectorView(0, 0, 320, 35))
@@ -285,14 +440,76 @@ void Sem_init(void)
 								misc_tasks_request(TASK_SAVE_SETTINGS);
 							}
 						}),
+					// Per-frame profiling log
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_video_frame_profiling)
+						->set_title([](const SelectorView &view) { return LOCALIZED(VIDEO_FRAME_PROFILING); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_video_frame_profiling != view.selected_button) {
+								var_video_frame_profiling = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
+					// Per-request network trace log (for tools/downloader_sim)
+					(new SelectorView(0, 0, 320, 35))
+						->set_texts({
+							(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+							(std::function<std::string ()>) []() { return LOCALIZED(ON); }
+						}, var_network_trace)
+						->set_title([](const SelectorView &view) { return LOCALIZED(NETWORK_TRACE); })
+						->set_on_change([](const SelectorView &view) {
+							if (var_network_trace != view.selected_button) {
+								var_network_trace = view.selected_button;
+								misc_tasks_request(TASK_SAVE_SETTINGS);
+							}
+						}),
 					(new EmptyView(0, 0, 320, 10))
-				})
+				}),
+			// Tab #4 : Stats, filled below
+			(new ScrollView(0, 0, 320, 0))
 		}, 0)
 		->set_tab_texts({
 			(std::function<std::string ()>) [] () { return LOCALIZED(SETTINGS_DISPLAY_UI); },
 			(std::function<std::string ()>) [] () { return LOCALIZED(SETTINGS_DATA); },
-			(std::function<std::string ()>) [] () { return LOCALIZED(SETTINGS_ADVANCED); }
+			(std::function<std::string ()>) [] () { return LOCALIZED(SETTINGS_ADVANCED); },
+			(std::function<std::string ()>) [] () { return LOCALIZED(SETTINGS_STATS); }
 		});
+	{
+		ScrollView *stats_view = dynamic_cast<ScrollView *>(main_tab_view->views[STATS_TAB]);
+		for (int i = 0; i < (int) Metric::NUM; i++) {
+			Metric metric = (Metric) i;
+			stats_view->views.push_back((new TextView(0, 0, 320, DEFAULT_FONT_INTERVAL))
+				->set_text((std::function<std::string ()>) [metric] () { return std::string(metrics_get_name(metric)) + " : " + metrics_format_value(metric); })
+				->set_text_offset(SMALL_MARGIN, -1));
+		}
+		stats_view->views.push_back(new EmptyView(0, 0, 320, 10));
+		stats_view->views.push_back((new TextView(10, 0, 150, DEFAULT_FONT_INTERVAL + SMALL_MARGIN * 2))
+			->set_text((std::function<std::string ()>) [] () { return LOCALIZED(WRITE_STATS_TO_LOG); })
+			->set_x_centered(true)
+			->set_text_offset(0, -2)
+			->set_get_background_color(View::STANDARD_BACKGROUND)
+			->set_on_view_released([] (View &view) { metrics_dump_to_log(); }));
+		stats_view->views.push_back(new EmptyView(0, 0, 320, 10));
+		// Kernel benchmark, the results are also written to profile/
+		stats_view->views.push_back((new TextView(10, 0, 200, DEFAULT_FONT_INTERVAL + SMALL_MARGIN * 2))
+			->set_text((std::function<std::string ()>) [] () { return LOCALIZED(KERNEL_BENCHMARK); })
+			->set_x_centered(true)
+			->set_text_offset(0, -2)
+			->set_get_background_color(View::STANDARD_BACKGROUND)
+			->set_on_view_released([] (View &view) { kernel_benchmark_request(); }));
+		for (int i = 0; i < (int) BenchmarkKernel::NUM; i++) {
+			BenchmarkKernel kernel = (BenchmarkKernel) i;
+			stats_view->views.push_back((new TextView(0, 0, 320, DEFAULT_FONT_INTERVAL))
+				->set_text((std::function<std::string ()>) [kernel] () {
+					return std::string(kernel_benchmark_get_name(kernel)) + " : " + kernel_benchmark_format_result(kernel);
+				})
+				->set_text_offset(SMALL_MARGIN, -1));
+		}
+		stats_view->views.push_back(new EmptyView(0, 0, 320, 10));
+	}
 	main_view = (new VerticalListView(0, 0, 320))
 		->set_views({
 			// 'Settings'
@@ -306,11 +523,17 @@ void Sem_init(void)
 			main_tab_view
 		})
 		->set_draw_order({2, 1, 0});
-		
-		
-	// result = Util_load_msg("sapp0_" + var_lang + ".txt", vid_msg, DEF_SEARCH_NUM_OF_MSG);
-	// Util_log_save(DEF_SAPP0_INIT_STR, "Util_load_msg()..." + result.string + result.error_description, result.code);
+}
 
+void Sem_init(void)
+{
+	Util_log_save("settings/init", "Initializing...");
+	
+	popup_view = new OverlayView(0, 0, 320, 240);
+	popup_view->set_is_visible(false);
+	toast_view = new TextView((320 - 150) / 2, 190, 150, DEFAULT_FONT_INTERVAL + SMALL_MARGIN);
+	toast_view->set_is_visible(false);
+	
 	Sem_resume("");
 	already_init = true;
 }
@@ -321,12 +544,9 @@ void Sem_exit(void)
 	thread_suspend = false;
 	exiting = true;
 	
-	save_settings();
+	misc_tasks_request(TASK_SAVE_SETTINGS); // written by the misc thread before it exits
 	
-	main_view->recursive_delete_subviews();
-	delete main_view;
-	main_view = NULL;
-	main_tab_view = NULL;
+	release_views();
 	
 	Util_log_save("settings/exit", "Exited.");
 }
@@ -346,6 +566,11 @@ Intent Sem_draw(void)
 	CONTENT_Y_HIGH = 240;
 	if (video_playing_bar_show) CONTENT_Y_HIGH -= VIDEO_PLAYING_BAR_HEIGHT;
 	main_tab_view->update_y_range(0, CONTENT_Y_HIGH - TOP_HEIGHT);
+	// the counters keep changing while the stats are shown
+	if (main_tab_view->selected_tab == STATS_TAB && osGetTime() >= last_stats_refresh_time + STATS_REFRESH_INTERVAL_MS) {
+		last_stats_refresh_time = osGetTime();
+		var_need_reflesh = true;
+	}
 	
 	if(var_need_reflesh || !var_eco_mode)
 	{
@@ -357,6 +582,7 @@ Intent Sem_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
@@ -378,7 +604,7 @@ Intent Sem_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 	if (--toast_frames_left <= 0) toast_view->set_is_visible(false);
 
@@ -409,7 +635,7 @@ Intent Sem_draw(void)
 		} else consecutive_scroll = 0;
 		
 		if (key.p_b) intent.next_scene = SceneType::BACK;
-		if (key.h_touch || key.p_touch) var_need_reflesh = true;
+		if (Draw_is_touch_pos_outdated()) var_need_reflesh = true;
 		if (key.p_select) Util_log_set_log_show_flag(!Util_log_query_log_show_flag());
 	}
 
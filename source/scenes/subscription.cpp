@@ -4,6 +4,7 @@
 #include <set>
 #include <map>
 #include <numeric>
+#include <memory>
 
 #include "scenes/subscription.hpp"
 #include "system/util/subscription_util.hpp"
@@ -13,9 +14,15 @@
 #include "ui/overlay.hpp"
 #include "network/thumbnail_loader.hpp"
 #include "system/util/misc_tasks.hpp"
+#include "system/util/memory_pressure.hpp"
 #include "system/util/async_task.hpp"
+#include "network/network_async.hpp"
 
 #define MAX_THUMBNAIL_LOAD_REQUEST 30
+// channel pages downloaded but not parsed yet also count, so that they don't pile up in memory when parsing is the bottleneck
+#define FEED_MAX_PENDING_PAGES NETWORK_ASYNC_MAX_CONCURRENT
+#define FEED_WAIT_TIMEOUT_NS 100000000
+#define FEED_VIEW_UPDATE_INTERVAL_MS 1000 // the feed view is updated at most this often while refreshing
 
 #define FEED_RELOAD_BUTTON_HEIGHT 18
 #define TOP_HEIGHT (MIDDLE_FONT_INTERVAL + SMALL_MARGIN * 2)
@@ -29,16 +36,17 @@ namespace Subscription {
 	Handle resource_lock;
 	
 	std::vector<SubscriptionChannel> subscribed_channels;
+	std::vector<std::string> feed_channel_ids; // the channels feed_videos_view was built for
+	std::vector<std::string> feed_video_urls; // the video of each view in feed_videos_view, only touched by the feed tasks
+	AsyncTaskToken feed_tasks_token; // for load_feed_videos() and refresh_subscription_feed(), which must not overlap
 	bool clicked_is_video;
 	std::string clicked_url;
 	
 	int feed_loading_progress = 0;
 	int feed_loading_total = 0;
 	
-	int channel_thumbnail_request_l = 0;
-	int channel_thumbnail_request_r = 0;
-	int video_thumbnail_request_l = 0;
-	int video_thumbnail_request_r = 0;
+	ThumbnailListRequester channel_thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
+	ThumbnailListRequester video_thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	
 	int CONTENT_Y_HIGH = 240; // changes according to whether the video playing bar is drawn or not
 	
@@ -47,123 +55,261 @@ namespace Subscription {
 	ScrollView *channels_tab_view = NULL;
 	VerticalListView *feed_tab_view = NULL;
 	ScrollView *feed_videos_view = NULL;
+	// the views of the channels and the videos are deleted while another scene is shown (the scroll views keep their positions)
+	// the feed is built again on resume, and the feed tasks don't build it meanwhile
+	bool item_views_released = false;
+	bool keep_feed_offset = false; // the next build of the feed is a rebuild after the release
 };
 using namespace Subscription;
 
-static void load_subscription_feed(void *) {
+// the views of the videos already shown are kept with their thumbnails, so that merging a few channels into a long feed doesn't wrap every title again
+static void update_feed_videos() {
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	bool released = item_views_released;
+	svcReleaseMutex(resource_lock);
+	if (released) return;
+	
+	auto feed = subscription_feed_get();
+	std::set<std::string> shown_urls(feed_video_urls.begin(), feed_video_urls.end());
+	std::map<std::string, View *> new_feed_video_views;
+	for (auto &feed_video : feed) {
+		auto video = feed_video.video;
+		if (shown_urls.count(video.url) || new_feed_video_views.count(video.url)) continue;
+		SuccinctVideoView *cur_view = (new SuccinctVideoView(0, 0, 320, VIDEO_LIST_THUMBNAIL_HEIGHT));
+		
+		cur_view->set_title_lines(truncate_str(video.title, VIDEO_TITLE_MAX_WIDTH, 2, 0.5, 0.5));
+		cur_view->set_thumbnail_url(video.thumbnail_url);
+		cur_view->set_auxiliary_lines({video.publish_date, video.views_str});
+		cur_view->set_bottom_right_overlay(video.duration_text);
+		cur_view->set_get_background_color(View::STANDARD_BACKGROUND);
+		cur_view->set_on_view_released([video] (View &view) {
+			clicked_url = video.url;
+			clicked_is_video = true;
+		});
+		
+		new_feed_video_views[video.url] = cur_view;
+	}
+	std::vector<std::string> channel_ids;
+	for (auto &channel : get_subscribed_channels()) channel_ids.push_back(channel.id);
+	
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	if (item_views_released) { // suspended while building
+		svcReleaseMutex(resource_lock);
+		for (auto &i : new_feed_video_views) delete i.second;
+		return;
+	}
+	std::map<std::string, View *> old_feed_video_views;
+	for (size_t i = 0; i < feed_videos_view->views.size(); i++) old_feed_video_views[feed_video_urls[i]] = feed_videos_view->views[i];
+	bool first_build = !feed_videos_view->views.size();
+	std::vector<View *> views;
+	std::vector<std::string> urls;
+	for (auto &feed_video : feed) {
+		const std::string &url = feed_video.video.url;
+		auto &source = old_feed_video_views.count(url) ? old_feed_video_views : new_feed_video_views;
+		auto itr = source.find(url);
+		if (itr == source.end()) continue; // the same video listed twice
+		views.push_back(itr->second);
+		urls.push_back(url);
+		source.erase(itr);
+	}
+	for (auto &i : old_feed_video_views) {
+		thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(i.second)->thumbnail_handle);
+		delete i.second;
+	}
+	feed_videos_view->views = views;
+	feed_video_urls = urls;
+	// the videos kept their thumbnails, only the ones that moved in or out of the requested range are requested or cancelled
+	video_thumbnail_requester.on_items_changed(views.size(),
+		[&] (int i) -> int & { return dynamic_cast<SuccinctVideoView *>(views[i])->thumbnail_handle; });
+	if (first_build && !keep_feed_offset) feed_videos_view->reset();
+	keep_feed_offset = false;
+	feed_channel_ids = channel_ids;
+	svcReleaseMutex(resource_lock);
+	for (auto &i : new_feed_video_views) delete i.second;
+	var_need_reflesh = true;
+}
+static void load_feed_videos(void *) { update_feed_videos(); }
+
+// shared with the network callbacks, which may outlive refresh_subscription_feed() when they're cancelled while running
+struct FetchedChannelPages {
+	Handle lock;
+	Handle event;
+	struct Page {
+		size_t index;
+		bool fail;
+		std::string error;
+		int status_code;
+		std::string etag;
+		std::vector<u8> data;
+	};
+	std::vector<Page> pages;
+	
+	FetchedChannelPages () {
+		svcCreateMutex(&lock, false);
+		svcCreateEvent(&event, RESET_ONESHOT);
+	}
+	~FetchedChannelPages () {
+		svcCloseHandle(lock);
+		svcCloseHandle(event);
+	}
+};
+
+// fetches the channel pages concurrently through network_async_get() while parsing the ones already received
+static void refresh_subscription_feed(void *) {
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
 	auto channels = subscribed_channels;
 	svcReleaseMutex(resource_lock);
 	
 	feed_loading_progress = 0;
 	feed_loading_total = channels.size();
-	std::map<std::pair<int, int>, std::vector<YouTubeVideoSuccinct> > loaded_videos;
-	for (auto channel : channels) {
-		Util_log_save("subsc", "load " + channel.name);
-		add_cpu_limit(35);
-		auto result = youtube_parse_channel_page(channel.url);
-		remove_cpu_limit(35);
-		
-		for (auto video : result.videos) {
-			std::string date_number_str;
-			for (auto c : video.publish_date) if (isdigit(c)) date_number_str.push_back(c);
-			
-			// 1 : seconds
-			char *end;
-			int number = strtoll(date_number_str.c_str(), &end, 10);
-			if (*end) {
-				Util_log_save("subsc", "failed to parse the integer in date : " + video.publish_date);
+	
+	std::shared_ptr<FetchedChannelPages> fetched(new FetchedChannelPages());
+	std::vector<int> request_ids;
+	size_t next = 0;
+	int pending = 0;
+	bool view_outdated = false; // something has been merged since the feed view was last updated
+	u64 last_view_update = osGetTime();
+	while (feed_loading_progress < feed_loading_total && !exiting) {
+		while (next < channels.size() && pending < FEED_MAX_PENDING_PAGES) {
+			size_t index = next++;
+			std::string url = youtube_get_channel_page_url(channels[index].url);
+			if (url == "") {
+				Util_log_save("subsc", "invalid channel url : " + channels[index].url);
+				feed_loading_progress++;
 				continue;
 			}
-			int unit = -1;
-			std::vector<std::vector<std::string> > unit_list = {
-				{"second", "秒"},
-				{"minute", "分"},
-				{"hour", "時間"},
-				{"day", "日"},
-				{"week", "週間"},
-				{"month", "月"},
-				{"year", "年"}
-			};
-			for (size_t i = 0; i < unit_list.size(); i++) {
-				bool matched = false;
-				for (auto pattern : unit_list[i]) if (video.publish_date.find(pattern) != std::string::npos) {
-					matched = true;
-					break;
-				}
-				if (matched) {
-					unit = i;
-					break;
+			auto headers = youtube_get_request_headers();
+			std::string etag = subscription_feed_get_etag(channels[index].id);
+			if (etag != "") headers["If-None-Match"] = etag;
+			
+			pending++;
+			request_ids.push_back(network_async_get(url, headers, [fetched, index] (NetworkResult &result) {
+				FetchedChannelPages::Page page;
+				page.index = index;
+				page.fail = result.fail;
+				page.error = result.error;
+				page.status_code = result.status_code;
+				page.etag = result.get_header("ETag");
+				page.data = std::move(result.data);
+				
+				svcWaitSynchronization(fetched->lock, std::numeric_limits<s64>::max());
+				fetched->pages.push_back(std::move(page));
+				svcReleaseMutex(fetched->lock);
+				svcSignalEvent(fetched->event);
+			}));
+		}
+		
+		std::vector<FetchedChannelPages::Page> pages;
+		svcWaitSynchronization(fetched->lock, std::numeric_limits<s64>::max());
+		pages.swap(fetched->pages);
+		svcReleaseMutex(fetched->lock);
+		if (!pages.size()) {
+			svcWaitSynchronization(fetched->event, FEED_WAIT_TIMEOUT_NS);
+			continue;
+		}
+		
+		for (auto &page : pages) {
+			const SubscriptionChannel &channel = channels[page.index];
+			pending--;
+			feed_loading_progress++;
+			if (page.fail) Util_log_save("subsc", "failed to load " + channel.name + " : " + page.error);
+			else if (page.status_code == 304) Util_log_save("subsc", channel.name + " : not modified");
+			else if (page.status_code / 100 != 2) Util_log_save("subsc", channel.name + " : http " + std::to_string(page.status_code));
+			else {
+				std::string html(page.data.begin(), page.data.end());
+				std::vector<u8>().swap(page.data);
+				
+				add_cpu_limit(35);
+				auto result = youtube_parse_channel_page_html(channel.url, html);
+				remove_cpu_limit(35);
+				
+				if (!result.videos.size()) Util_log_save("subsc", "no videos found for " + channel.name + " : " + result.error);
+				else {
+					subscription_feed_merge(channel.id, page.etag, result.videos, time(NULL));
+					view_outdated = true;
 				}
 			}
-			if (unit == -1) {
-				Util_log_save("subsc", "failed to parse the unit of date : " + video.publish_date);
-				continue;
-			}
-			if (std::pair<int, int>{unit, number} > std::pair<int, int>{5, 2}) continue; // more than 2 months old
-			Util_log_save("subsc", "+ : " + video.title);
-			loaded_videos[{unit, number}].push_back(video);
 		}
-		feed_loading_progress++;
-	}
-	std::vector<View *> new_feed_video_views;
-	for (auto &i : loaded_videos) {
-		for (auto video : i.second) {
-			SuccinctVideoView *cur_view = (new SuccinctVideoView(0, 0, 320, VIDEO_LIST_THUMBNAIL_HEIGHT));
-			
-			cur_view->set_title_lines(truncate_str(video.title, VIDEO_TITLE_MAX_WIDTH, 2, 0.5, 0.5));
-			cur_view->set_thumbnail_url(video.thumbnail_url);
-			cur_view->set_auxiliary_lines({video.publish_date, video.views_str});
-			cur_view->set_bottom_right_overlay(video.duration_text);
-			cur_view->set_get_background_color(View::STANDARD_BACKGROUND);
-			cur_view->set_on_view_released([video] (View &view) {
-				clicked_url = video.url;
-				clicked_is_video = true;
-			});
-			
-			new_feed_video_views.push_back(cur_view);
+		// show what has been merged so far, the last update is done below anyway
+		if (view_outdated && feed_loading_progress < feed_loading_total && osGetTime() - last_view_update >= FEED_VIEW_UPDATE_INTERVAL_MS) {
+			update_feed_videos();
+			view_outdated = false;
+			last_view_update = osGetTime();
 		}
 	}
-	
-	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
-	for (auto view : feed_videos_view->views) thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(view)->thumbnail_handle);
-	feed_videos_view->recursive_delete_subviews();
-	video_thumbnail_request_l = video_thumbnail_request_r = 0;
-	feed_videos_view->views = new_feed_video_views;
-	feed_videos_view->reset();
-	svcReleaseMutex(resource_lock);
+	if (exiting) for (auto id : request_ids) network_async_cancel(id);
+	else {
+		update_feed_videos();
+		misc_tasks_request(TASK_SAVE_SUBSCRIPTION_FEED);
+	}
 }
 
 bool Subscription_query_init_flag(void) {
 	return already_init;
 }
 
+static SuccinctChannelView *make_channel_view(const SubscriptionChannel &channel) {
+	SuccinctChannelView *cur_view = (new SuccinctChannelView(0, 0, 320, CHANNEL_ICON_HEIGHT));
+	cur_view->set_name(channel.name);
+	cur_view->set_auxiliary_lines({channel.subscriber_count_str});
+	cur_view->set_thumbnail_url(channel.icon_url);
+	cur_view->set_get_background_color(View::STANDARD_BACKGROUND);
+	std::string url = channel.url;
+	cur_view->set_on_view_released([url] (View &view) {
+		clicked_url = url;
+		clicked_is_video = false;
+	});
+	return cur_view;
+}
+
+// keyed by the channel id like update_feed_videos() : (un)subscribing to a channel only creates or deletes its view,
+// the others are kept with their icons
 static void update_subscribed_channels(const std::vector<SubscriptionChannel> &new_subscribed_channels) {
+	std::map<std::string, size_t> old_index; // subscribed_channels[i] is shown by channels_tab_view->views[i]
+	for (size_t i = 0; i < subscribed_channels.size(); i++) old_index[subscribed_channels[i].id] = i;
+	std::vector<View *> views;
+	for (auto &channel : new_subscribed_channels) {
+		auto itr = old_index.find(channel.id);
+		// a new url or icon is a new view as they're captured by the view
+		if (itr == old_index.end() || subscribed_channels[itr->second].url != channel.url || subscribed_channels[itr->second].icon_url != channel.icon_url) {
+			views.push_back(make_channel_view(channel));
+			continue;
+		}
+		SuccinctChannelView *view = dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[itr->second]);
+		view->set_name(channel.name);
+		view->set_auxiliary_lines({channel.subscriber_count_str});
+		views.push_back(view);
+		old_index.erase(itr);
+	}
+	for (auto &i : old_index) {
+		SuccinctChannelView *view = dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[i.second]);
+		thumbnail_cancel_request(view->thumbnail_handle);
+		delete view;
+	}
+	channels_tab_view->views = views;
+	channel_thumbnail_requester.on_items_changed(views.size(),
+		[&] (int i) -> int & { return dynamic_cast<SuccinctChannelView *>(views[i])->thumbnail_handle; });
 	subscribed_channels = new_subscribed_channels;
-	
-	// clean up previous views and thumbnail requests
+}
+
+
+static void release_item_views() {
 	for (auto view : channels_tab_view->views)
 		thumbnail_cancel_request(dynamic_cast<SuccinctChannelView *>(view)->thumbnail_handle);
-	channel_thumbnail_request_l = channel_thumbnail_request_r = 0;
-	
+	channel_thumbnail_requester.reset();
 	channels_tab_view->recursive_delete_subviews();
+	std::vector<SubscriptionChannel>().swap(subscribed_channels);
 	
-	// prepare new views
-	for (auto channel : new_subscribed_channels) {
-		SuccinctChannelView *cur_view = (new SuccinctChannelView(0, 0, 320, CHANNEL_ICON_HEIGHT));
-		cur_view->set_name(channel.name);
-		cur_view->set_auxiliary_lines({channel.subscriber_count_str});
-		cur_view->set_thumbnail_url(channel.icon_url);
-		cur_view->set_get_background_color(View::STANDARD_BACKGROUND);
-		cur_view->set_on_view_released([channel] (View &view) {
-			clicked_url = channel.url;
-			clicked_is_video = false;
-		});
-		channels_tab_view->views.push_back(cur_view);
-	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	for (auto view : feed_videos_view->views)
+		thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(view)->thumbnail_handle);
+	video_thumbnail_requester.reset();
+	feed_videos_view->recursive_delete_subviews();
+	std::vector<std::string>().swap(feed_video_urls);
+	item_views_released = true;
+	svcReleaseMutex(resource_lock);
 }
 
-
 void Subscription_resume(std::string arg)
 {
 	(void) arg;
@@ -173,12 +319,33 @@ void Subscription_resume(std::string arg)
 	thread_suspend = false;
 	var_need_reflesh = true;
 	
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	bool feed_released = item_views_released;
+	item_views_released = false;
+	if (feed_released) {
+		std::vector<std::string>().swap(feed_channel_ids); // marks the feed as outdated below
+		keep_feed_offset = true;
+	}
+	svcReleaseMutex(resource_lock);
+	
 	update_subscribed_channels(get_subscribed_channels());
+	// rebuild the feed if a channel has been (un)subscribed since it was built
+	std::vector<std::string> channel_ids;
+	for (auto &channel : subscribed_channels) channel_ids.push_back(channel.id);
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	bool feed_outdated = channel_ids != feed_channel_ids;
+	svcReleaseMutex(resource_lock);
+	// (a load_feed_videos() still running may have found the views released)
+	if (feed_outdated && !is_async_task_running(refresh_subscription_feed) && (feed_released || !is_async_task_running(load_feed_videos)))
+		queue_async_task(load_feed_videos, NULL, AsyncTaskPriority::VISIBLE, feed_tasks_token);
 }
 
 void Subscription_suspend(void)
 {
 	thread_suspend = true;
+	// the views are kept for the next resume unless the memory is running out
+	// (the thumbnails of a scene in the background are shed by thumbnail_shed_textures() anyway)
+	if (memory_pressure_get_level() != MemoryPressure::NONE) release_item_views();
 }
 
 void Subscription_init(void)
@@ -186,6 +353,7 @@ void Subscription_init(void)
 	Util_log_save("subsc/init", "Initializing...");
 	
 	svcCreateMutex(&resource_lock, false);
+	feed_tasks_token = async_task_create_token();
 	
 	channels_tab_view = (new ScrollView(0, 0, 320, 0))->set_margin(SMALL_MARGIN); // height : dummy(set properly by set_stretch_subview(true) on main_tab_view)
 	feed_videos_view = (new ScrollView(0, 0, 320, 0))->set_margin(SMALL_MARGIN);
@@ -194,16 +362,16 @@ void Subscription_init(void)
 			(new TextView(0, 0, 320, FEED_RELOAD_BUTTON_HEIGHT))
 				->set_text((std::function<std::string ()>) [] () {
 					auto res = LOCALIZED(RELOAD);
-					if (is_async_task_running(load_subscription_feed)) res += " (" + std::to_string(feed_loading_progress) + "/" + std::to_string(feed_loading_total) + ")";
+					if (is_async_task_running(refresh_subscription_feed)) res += " (" + std::to_string(feed_loading_progress) + "/" + std::to_string(feed_loading_total) + ")";
 					return res;
 				})
 				->set_text_offset(SMALL_MARGIN, -1)
 				->set_on_view_released([] (View &) {
-					if (!is_async_task_running(load_subscription_feed))
-						queue_async_task(load_subscription_feed, NULL);
+					if (!is_async_task_running(refresh_subscription_feed))
+						queue_async_task(refresh_subscription_feed, NULL, AsyncTaskPriority::INTERACTIVE, feed_tasks_token);
 				})
 				->set_get_background_color([] (const View &view) -> u32 {
-					if (is_async_task_running(load_subscription_feed)) return LIGHT0_BACK_COLOR;
+					if (is_async_task_running(refresh_subscription_feed)) return LIGHT0_BACK_COLOR;
 					return View::STANDARD_BACKGROUND(view);
 				}),
 			(new HorizontalRuleView(0, 0, 320, SMALL_MARGIN))->set_get_background_color([] (const View &) { return DEFAULT_BACK_COLOR; }),
@@ -244,6 +412,7 @@ void Subscription_exit(void)
 	main_tab_view = NULL;
 	feed_tab_view = NULL;
 	feed_videos_view = NULL;
+	feed_video_urls.clear();
 	channels_tab_view = NULL;
 	
 	Util_log_save("subsc/exit", "Exited.");
@@ -274,6 +443,7 @@ Intent Subscription_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
@@ -295,7 +465,7 @@ Intent Subscription_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 
 	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
@@ -306,68 +476,20 @@ Intent Subscription_draw(void)
 		int item_interval = CHANNEL_ICON_HEIGHT + SMALL_MARGIN;
 		int displayed_l = std::min(channels_num, channels_tab_view->get_offset() / item_interval);
 		int displayed_r = std::min(channels_num, (channels_tab_view->get_offset() + CONTENT_Y_HIGH - 1) / item_interval + 1);
-		int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-		int request_target_r = std::min(channels_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-		// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-		std::set<int> new_indexes, cancelling_indexes;
-		for (int i = channel_thumbnail_request_l; i < channel_thumbnail_request_r; i++) cancelling_indexes.insert(i);
-		for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-		for (int i = channel_thumbnail_request_l; i < channel_thumbnail_request_r; i++) new_indexes.erase(i);
-		for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-		
-		for (auto i : cancelling_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[i]);
-			thumbnail_cancel_request(cur_view->thumbnail_handle);
-			cur_view->thumbnail_handle = -1;
-		}
-		for (auto i : new_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[i]);
-			cur_view->thumbnail_handle = thumbnail_request(cur_view->thumbnail_url,
-				SceneType::SUBSCRIPTION, 0, ThumbnailType::ICON);
-		}
-		
-		channel_thumbnail_request_l = request_target_l;
-		channel_thumbnail_request_r = request_target_r;
-		
-		std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-		auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-		for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] =
-			{dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[i])->thumbnail_handle, 500 - dist(i)};
-		thumbnail_set_priorities(priority_list);
+		auto view_at = [&] (int i) { return dynamic_cast<SuccinctChannelView *>(channels_tab_view->views[i]); };
+		channel_thumbnail_requester.update(channels_num, displayed_l, displayed_r, channels_tab_view->get_scroll_velocity() / item_interval,
+			[&] (int i) -> int & { return view_at(i)->thumbnail_handle; },
+			[&] (int i) { return thumbnail_request(view_at(i)->thumbnail_url, SceneType::SUBSCRIPTION, 0, ThumbnailType::ICON, CHANNEL_ICON_HEIGHT); });
 	}
 	int video_num = feed_videos_view->views.size();
 	if (video_num) {
 		int item_interval = VIDEO_LIST_THUMBNAIL_HEIGHT + SMALL_MARGIN;
 		int displayed_l = std::min(video_num, feed_videos_view->get_offset() / item_interval);
 		int displayed_r = std::min(video_num, (feed_videos_view->get_offset() + CONTENT_Y_HIGH - 1) / item_interval + 1);
-		int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-		int request_target_r = std::min(video_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-		// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-		std::set<int> new_indexes, cancelling_indexes;
-		for (int i = video_thumbnail_request_l; i < video_thumbnail_request_r; i++) cancelling_indexes.insert(i);
-		for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-		for (int i = video_thumbnail_request_l; i < video_thumbnail_request_r; i++) new_indexes.erase(i);
-		for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-		
-		for (auto i : cancelling_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctVideoView *>(feed_videos_view->views[i]);
-			thumbnail_cancel_request(cur_view->thumbnail_handle);
-			cur_view->thumbnail_handle = -1;
-		}
-		for (auto i : new_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctVideoView *>(feed_videos_view->views[i]);
-			cur_view->thumbnail_handle = thumbnail_request(cur_view->thumbnail_url,
-				SceneType::SUBSCRIPTION, 0, ThumbnailType::VIDEO_THUMBNAIL);
-		}
-		
-		video_thumbnail_request_l = request_target_l;
-		video_thumbnail_request_r = request_target_r;
-		
-		std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-		auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-		for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] =
-			{dynamic_cast<SuccinctVideoView *>(feed_videos_view->views[i])->thumbnail_handle, 500 - dist(i)};
-		thumbnail_set_priorities(priority_list);
+		auto view_at = [&] (int i) { return dynamic_cast<SuccinctVideoView *>(feed_videos_view->views[i]); };
+		video_thumbnail_requester.update(video_num, displayed_l, displayed_r, feed_videos_view->get_scroll_velocity() / item_interval,
+			[&] (int i) -> int & { return view_at(i)->thumbnail_handle; },
+			[&] (int i) { return thumbnail_request(view_at(i)->thumbnail_url, SceneType::SUBSCRIPTION, 0, ThumbnailType::VIDEO_THUMBNAIL, VIDEO_LIST_THUMBNAIL_WIDTH); });
 	}
 
 	if (Util_err_query_error_show_flag()) {
@@ -400,7 +522,7 @@ Intent Subscription_draw(void)
 			var_need_reflesh = true;
 		} else consecutive_scroll = 0;
 		
-		if(key.h_touch || key.p_touch)
+		if(Draw_is_touch_pos_outdated())
 			var_need_reflesh = true;
 		
 		if (key.p_b) intent.next_scene = SceneType::BACK;
@@ -108,7 +108,7 @@ Intent About_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 
 	if (Util_err_query_error_show_flag()) {
@@ -129,7 +129,7 @@ Intent About_draw(void)
 		
 		if (key.p_b) intent.next_scene = SceneType::BACK;
 		
-		if (key.h_touch || key.p_touch) var_need_reflesh = true;
+		if (Draw_is_touch_pos_outdated()) var_need_reflesh = true;
 		if (key.p_select) Util_log_set_log_show_flag(!Util_log_query_log_show_flag());
 	}
 
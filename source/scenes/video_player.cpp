@@ -11,9 +11,23 @@
 #include "network/network_io.hpp"
 #include "network/network_decoder_multiple.hpp"
 #include "network/thumbnail_loader.hpp"
+#include "network/offline_download.hpp"
+#include "network/stream_prefetcher.hpp"
+#include "network/abr.hpp"
+#include "network/network_lifecycle.hpp"
 #include "system/util/async_task.hpp"
 #include "system/util/misc_tasks.hpp"
+#include "system/util/frame_profiler.hpp"
+#include "network/network_trace.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/playback_benchmark.hpp"
+#include "system/util/telemetry.hpp"
+#include "system/util/metrics.hpp"
+#include "system/util/player_session.hpp"
+#include "system/util/result_cache.hpp"
+#include "system/thread_placement.hpp"
 #include "system/util/util.hpp"
+#include "system/util/light_lock.hpp"
 
 #define NEW_3DS_CPU_LIMIT 50
 #define OLD_3DS_CPU_LIMIT 80
@@ -28,7 +42,42 @@
 #define CONTROL_BUTTON_HEIGHT 20
 
 #define MAX_THUMBNAIL_LOAD_REQUEST 30
+#define MAX_THUMBNAIL_LOAD_REQUEST_PAUSED 60 // the thumbnails further down the lists are loaded while the playback is paused
 #define MAX_RETRY_CNT 5
+#define PREFETCH_BEFORE_END_SECONDS 30 // the next video is prefetched when the current one is this close to the end
+#define PREOPEN_BEFORE_END_SECONDS 20 // the streams of the next video in the playlist are opened when the current one is this close to the end
+#define PLAYER_SESSION_SAVE_INTERVAL_MS 10000 // the position to continue from on the next launch is saved this often
+#define DATA_SAVER_MAX_QUALITY 240 // the highest quality offered in the data saver mode (the lowest available one if none is below it)
+#define PREFETCH_HOLD_FRAMES 20 // holding a suggestion for this many frames prefetches it
+#define NETWORK_STATS_HOSTS_SHOWN 4 // in the debug info
+#define PREFETCH_TASK_DEADLINE_MS 10000 // the user has most likely moved on if it couldn't even start by then
+#define PLAYLIST_PREFETCH_NUM 3 // the pages of this many playlist entries after the current one are parsed ahead
+#define REPLY_LOAD_CONCURRENCY 2 // replies being loaded at once
+#define DECODED_AUDIO_QUEUE_SIZE 8 // audio frames the decode thread can set aside while the speaker queue is full
+#define AUDIO_TARGET_LATENCY_S 0.2 // how much audio the speaker queues ahead at first, pause and seek take effect after about this long
+#define DECODER_WAIT_TIMEOUT_NS 10000000 // the decoding threads wake up at least this often to check the requests
+#define PAUSED_WAIT_TIMEOUT_NS 200000000 // while paused, the decoding threads block on vid_resume_event for up to this long instead
+#define BOTH_STREAM_MAX_DURATION_MS_OLD_3DS (90 * 60 * 1000)
+#define BOTH_STREAM_MAX_DURATION_MS_NEW_3DS (3 * 60 * 60 * 1000)
+#define AUDIO_DECODE_MIN_HEADROOM 0.15 // the audio stream cheapest to decode is preferred when the last playback left less of the decoding core
+#define SEEK_COALESCE_MS 150 // a seek requested this soon after the previous one waits for the requests to stop, then only the last is sought
+#define DEMUX_IDLE_WAIT_NS 50000000 // the demux thread is woken up earlier when the decoder takes a video packet
+#define YUV_TEX_WIDTH 1024 // the Y texture of vid_yuv_image, bigger frames are converted by Y2R regardless of var_video_yuv_converter
+#define YUV_TEX_HEIGHT 512
+#define VIDEO_TEX_SLOT_NUM 3 // one presented, one queued and one being written
+#define PRESENT_EARLY_MARGIN 0.008 // seconds, a queued frame is presented if its pts is at most this far ahead of the audio (half a refresh)
+#define PRESENT_TIMEOUT_MS 100 // the drawing thread stopped drawing the player, the convert thread advances the queue by itself
+#define MAX_CONSECUTIVE_FRAME_DROP 3
+#define MINI_PLAYER_WIDTH 160 // in the bottom right corner of the top screen of the other scenes
+#define MINI_PLAYER_MAX_HEIGHT 120
+#define MINI_PLAYER_MARGIN 4
+#define BUFFER_AHEAD_480P_SECONDS 5 // the 480p playback (re)starts once this much is downloaded past the read position of both streams
+#define BUFFER_AHEAD_TIMEOUT_MS 15000 // starts anyway
+#define FALLBACK_DECODE_TIME_SMOOTHING 0.05 // weight of the latest frame in the moving average of the 480p decode time
+#define FALLBACK_MIN_FRAMES 90 // frames decoded before the average is trusted
+#define VIDEO_SWITCH_LEAD_SECONDS 0.5 // when only the video stream is replaced, it restarts this far ahead of the current position
+#define VIDEO_PAGE_MAX_AGE_MS (20 * 60 * 1000) // never shown stale : the stream urls stop working after a few hours, and are throttled well before that
+#define VIDEO_PAGE_CACHE_MAX 8
 
 #define TAB_GENERAL 0
 #define TAB_COMMENTS 1
@@ -39,6 +88,10 @@
 
 #define TAB_MAX_NUM 6
 
+static size_t estimate_video_detail_size(const YouTubeVideoDetail &detail) {
+	return sizeof(detail) + detail.description.size() + detail.suggestions.size() * 512 + detail.comments.size() * 1024;
+}
+
 namespace VideoPlayer {
 	bool vid_main_run = false;
 	bool vid_thread_run = false;
@@ -53,64 +106,104 @@ namespace VideoPlayer {
 	volatile bool audio_only_mode = false;
 	volatile bool video_skip_drawing = false; // for performance reason, enabled when opening keyboard
 	volatile int video_p_value = 360;
+	volatile bool auto_quality_mode = false; // video_p_value is chosen by network/abr.hpp
+	volatile bool vid_switch_video_request = false; // only the video stream is replaced for the new video_p_value, falls back to vid_change_video_request
 	volatile double seek_at_init_request = -1;
+	bool benchmark_scenario_started = false; // see update_playback_benchmark()
+	size_t benchmark_next_seek = 0;
 	double vid_time[2][320];
 	double vid_copy_time[2] = { 0, 0, };
 	double vid_audio_time = 0;
 	double vid_video_time = 0;
 	double vid_convert_time = 0;
+	double vid_av_drift = 0; // ms, positive if the video is ahead of the audio
 	double vid_frametime = 0;
 	double vid_framerate = 0;
 	int vid_sample_rate = 0;
+	double vid_live_speed = 1.0; // see keep_up_with_live_edge()
 	double vid_duration = 0;
 	double vid_zoom = 1;
 	double vid_x = 0;
 	double vid_y = 15;
 	double vid_current_pos = 0;
 	volatile double vid_seek_pos = 0;
+	volatile u64 vid_seek_request_time = 0; // osGetTime() of the last send_seek_request_wo_lock()
+	u64 vid_last_seek_time = 0; // osGetTime() when the last seek finished, decode thread only
 	double vid_min_time = 0;
 	double vid_max_time = 0;
 	double vid_total_time = 0;
 	double vid_recent_time[90];
 	double vid_recent_total_time = 0;
 	int vid_total_frames = 0;
+	double vid_decode_total_time = 0; // only the frames that were actually decoded, to compare the decoder paths and thread counts
+	int vid_decode_total_frames = 0;
+	double vid_audio_total_time = 0; // same for the audio packets
+	int vid_audio_total_packets = 0;
+	double vid_audio_total_duration = 0; // seconds of audio decoded in vid_audio_total_time
 	int vid_width = 0;
 	int vid_width_org = 0;
 	int vid_height = 0;
 	int vid_height_org = 0;
-	int vid_tex_width[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-	int vid_tex_height[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-	int vid_mvd_image_num = 0; // write the texture alternately to avoid scattering 
+	int vid_tex_width[VIDEO_TEX_SLOT_NUM * 4] = { 0 };
+	int vid_tex_height[VIDEO_TEX_SLOT_NUM * 4] = { 0 };
 	std::string vid_url = "";
 	std::string vid_video_format = "n/a";
 	std::string vid_audio_format = "n/a";
-	Image_data vid_image[8];
+	Image_data vid_image[VIDEO_TEX_SLOT_NUM * 4]; // four tiles of up to 1024x1024 per slot, only the first one is allocated unless the video is bigger
+	Yuv_image_data vid_yuv_image[VIDEO_TEX_SLOT_NUM]; // used instead of vid_image for the slots with vid_image_is_yuv set, allocated on first use
+	bool vid_image_is_yuv[VIDEO_TEX_SLOT_NUM] = { false };
+	bool vid_convert_on_gpu = false; // for the debug info, whether vid_convert_time is the upload for the GPU path or Y2R
 	int icon_thumbnail_handle = -1;
 	C2D_Image vid_banner[2];
 	C2D_Image vid_control[2];
 	Thread vid_decode_thread, vid_convert_thread;
+	Thread vid_audio_decode_thread = NULL; // New 3DS only
+	Thread vid_demux_thread;
 	
 	VerticalScroller scroller[TAB_MAX_NUM];
 	constexpr int CONTENT_Y_HIGH = 240 - TAB_SELECTOR_HEIGHT - VIDEO_PLAYING_BAR_HEIGHT; // the bar is always shown here, so this is a constant
 	VerticalScroller tab_selector_scroller; // special one, it does not actually scroll but handles touch releasing
 	int selected_tab = 0;
 
-	Thread stream_downloader_thread;
+	Thread stream_downloader_thread[NetworkStreamDownloader::WORKER_NUM];
 	NetworkStreamDownloader stream_downloader;
 	
 	Thread livestream_initer_thread;
+	Thread stream_prefetcher_thread;
 	NetworkMultipleDecoder network_decoder;
 	Handle network_decoder_critical_lock; // locked when seeking or deiniting
+	// 480p mode on New 3DS : the audio is decoded by audio_decode_thread while audio_split_active, the decode thread only decodes the video
+	Handle audio_decode_lock; // held by audio_decode_thread while decoding or touching the audio queue, and by the decode thread while seeking
+	volatile bool audio_split_active = false;
+	volatile bool audio_eof = false; // the audio stream has no more packets, only meaningful while audio_split_active
+	volatile bool vid_buffering_ahead = false; // the audio decoding holds off too so that the speaker doesn't start alone
 	
 	Handle small_resource_lock; // locking basically all std::vector, std::string, etc
 	YouTubeVideoDetail cur_video_info;
-	std::map<std::string, YouTubeVideoDetail> video_info_cache;
+	ResultCache<YouTubeVideoDetail> video_info_cache(VIDEO_PAGE_MAX_AGE_MS, VIDEO_PAGE_MAX_AGE_MS, VIDEO_PAGE_CACHE_MAX, estimate_video_detail_size);
+	std::string prefetch_target_url; // the url of the video page being prefetched, empty if none
+	std::string preopen_target_url; // the url of the video whose streams are being opened ahead (see preopen_next_video()), empty if none
+	volatile bool vid_playback_ended = false; // set once by the decode thread when the audio has been played to the end
+	bool pause_policy_active = false; // see update_pause_policy(), only touched by the main thread
+	LightEventFlag vid_resume_event(RESET_STICKY); // cleared while pause_policy_active, the decoding threads with nothing to do wait on it
+	std::set<std::string> prefetched_page_urls; // pages in video_info_cache that were parsed speculatively and haven't been added to the history yet
+	std::vector<std::string> playlist_prefetch_urls; // see prefetch_playlist_pages()
+	std::string playlist_prefetch_id;
+	int playlist_prefetch_generation = 0; // incremented when the list above is replaced
 	int video_retry_left = 0;
+	std::string restored_page_url; // put in video_info_cache from the saved session, parsed again in the background once it's loaded
+	bool player_session_saved = false; // see update_player_session(), only touched by the main thread
+	u64 player_session_save_time = 0;
+	double player_session_saved_pos = -1;
 	
 	std::set<CommentView *> comment_thumbnail_loaded_list;
+	size_t comments_last_page_begin = 0; // index of the first comment of the last loaded page
 	std::vector<std::string> title_lines;
 	float title_font_size;
 	std::vector<std::string> description_lines;
+	// the description and the suggestion/comment views are built from cur_video_info a bit every frame while their tab is shown
+	// (build_pending_views()) instead of all at once in load_video_page() before anything could be shown
+	size_t description_wrap_pos = std::string::npos; // offset in cur_video_info.description of the next line to wrap, npos if all wrapped
 	
 	std::string channel_url_pressed;
 	std::string suggestion_clicked_url; // also used for playlist
@@ -118,15 +211,14 @@ namespace VideoPlayer {
 	int TAB_NUM = 5;
 	
 	// suggestion tab
-	VerticalListView *suggestion_main_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN);
+	VerticalListView *suggestion_main_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN)->set_is_virtualized(true);
 	View *suggestion_bottom_view = new EmptyView(0, 0, 320, 0);
 	ScrollView *suggestion_view;
-	int suggestion_thumbnail_request_l = 0;
-	int suggestion_thumbnail_request_r = 0;
+	ThumbnailListRequester suggestion_thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	
 	// comment tab
 	View *comments_top_view = new EmptyView(0, 0, 320, 4);
-	VerticalListView *comments_main_view = new VerticalListView(0, 0, 320);
+	VerticalListView *comments_main_view = (new VerticalListView(0, 0, 320))->set_is_virtualized(true);
 	View *comments_bottom_view = new EmptyView(0, 0, 320, 0);
 	ScrollView *comment_all_view = NULL;
 	
@@ -142,8 +234,7 @@ namespace VideoPlayer {
 	ScrollView *playlist_list_view;
 	TextView *playlist_title_view;
 	TextView *playlist_author_view;
-	int playlist_thumbnail_request_l = 0;
-	int playlist_thumbnail_request_r = 0;
+	ThumbnailListRequester playlist_thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	
 	// playback tab
 	CustomView *download_progress_view = NULL;
@@ -153,6 +244,9 @@ namespace VideoPlayer {
 };
 using namespace VideoPlayer;
 
+// the tasks reading/writing cur_video_info share this token so that they are run one by one in the order they are queued
+static AsyncTaskToken video_page_token;
+
 static const char * volatile network_waiting_status = NULL;
 const char *get_network_waiting_status() {
 	if (network_waiting_status) return network_waiting_status;
@@ -164,6 +258,10 @@ bool VideoPlayer_query_init_flag(void)
 	return vid_already_init;
 }
 void video_set_skip_drawing(bool skip) { video_skip_drawing = skip; }
+// whether the decoded frames are drawn anywhere, either in the player or in the mini player of the other scenes
+static bool video_frames_visible() {
+	return !video_skip_drawing && !var_screens_off && (!vid_thread_suspend || var_video_mini_player);
+}
 
 // START : functions called from async_task.cpp
 /* -------------------------------------------------------------------------------------------------------------- */
@@ -181,8 +279,14 @@ void video_set_skip_drawing(bool skip) { video_skip_drawing = skip; }
 
 
 static void send_seek_request_wo_lock(double pos);
+static void send_quality_change_request_wo_lock(int new_p_value);
 
 static void load_video_page(void *);
+static void prefetch_video_page(void *);
+static void prefetch_playlist_pages(void *);
+static void refresh_expired_stream_urls(void *);
+static void refresh_restored_video_page(void *);
+static void request_prefetch_wo_lock(const std::string &url);
 static void load_more_comments(void *);
 static void load_more_suggestions(void *);
 static void load_more_replies(void *);
@@ -191,19 +295,28 @@ static void load_caption(void *);
 static void update_suggestion_bottom_view() {
 	delete suggestion_bottom_view;
 	if (cur_video_info.error != "" || cur_video_info.has_more_suggestions() || !cur_video_info.suggestions.size()) {
+		// the data saver mode loads the next page only when asked to
+		bool tap_to_load = var_data_saver && cur_video_info.error == "" && cur_video_info.has_more_suggestions();
 		TextView *bottom_view = (new TextView(0, 0, 320, DEFAULT_FONT_INTERVAL * 2))
 			->set_text(
 				cur_video_info.error != "" ? cur_video_info.error :
-				cur_video_info.has_more_suggestions() ? LOCALIZED(LOADING) :
+				cur_video_info.has_more_suggestions() ? (tap_to_load ? LOCALIZED(SHOW_MORE) : LOCALIZED(LOADING)) :
 				!cur_video_info.suggestions.size() ? LOCALIZED(EMPTY) : "IE")
 			->set_font_size(0.5, DEFAULT_FONT_INTERVAL)
 			->set_x_centered(true)
 			->set_y_centered(false);
 		
+		if (tap_to_load) bottom_view->set_get_background_color(View::STANDARD_BACKGROUND)->set_on_view_released([] (View &view) {
+			if (!is_async_task_running(load_video_page) && !is_async_task_running(load_more_suggestions)) {
+				queue_async_task(load_more_suggestions, &cur_video_info, AsyncTaskPriority::INTERACTIVE, video_page_token);
+				dynamic_cast<TextView &>(view).set_text(LOCALIZED(LOADING));
+			}
+		});
 		suggestion_view->set_on_child_drawn(1, [] (const ScrollView &, int) {
-			if (cur_video_info.has_more_suggestions() && cur_video_info.error == "") {
+			if (var_data_saver) return;
+			if (cur_video_info.has_more_suggestions() && cur_video_info.error == "" && suggestion_main_view->views.size() == cur_video_info.suggestions.size()) {
 				if (!is_async_task_running(load_video_page) &&
-					!is_async_task_running(load_more_suggestions)) queue_async_task(load_more_suggestions, &cur_video_info);
+					!is_async_task_running(load_more_suggestions)) queue_async_task(load_more_suggestions, &cur_video_info, AsyncTaskPriority::INTERACTIVE, video_page_token);
 			}
 		});
 		suggestion_bottom_view = bottom_view;
@@ -222,8 +335,12 @@ static SuccinctVideoView *suggestion_to_view(const YouTubeSuccinctItem &item) {
 		cur_view->set_auxiliary_lines({item.playlist.video_count_str});
 	}
 	cur_view->set_get_background_color(View::STANDARD_BACKGROUND);
-	cur_view->set_on_view_released([item] (View &view) {
-		suggestion_clicked_url = item.get_url();
+	std::string url = item.get_url();
+	cur_view->set_on_view_released([url] (View &view) {
+		suggestion_clicked_url = url;
+	});
+	if (item.type == YouTubeSuccinctItem::VIDEO) cur_view->add_on_long_hold(PREFETCH_HOLD_FRAMES, [url] (View &view) {
+		request_prefetch_wo_lock(url);
 	});
 	cur_view->set_is_playlist(item.type == YouTubeSuccinctItem::PLAYLIST);
 	
@@ -233,20 +350,28 @@ static SuccinctVideoView *suggestion_to_view(const YouTubeSuccinctItem &item) {
 static void update_comment_bottom_view() {
 	delete comments_bottom_view;
 	if (cur_video_info.comments_disabled || cur_video_info.error != "" || cur_video_info.has_more_comments() || !cur_video_info.comments.size()) {
+		bool tap_to_load = var_data_saver && !cur_video_info.comments_disabled && cur_video_info.error == "" && cur_video_info.has_more_comments();
 		TextView *bottom_view = (new TextView(0, 0, 320, DEFAULT_FONT_INTERVAL * 2))
 			->set_text(
 				cur_video_info.comments_disabled ? LOCALIZED(COMMENTS_DISABLED) :
 				cur_video_info.error != "" ? cur_video_info.error :
-				cur_video_info.has_more_comments() ? LOCALIZED(LOADING) :
+				cur_video_info.has_more_comments() ? (tap_to_load ? LOCALIZED(SHOW_MORE) : LOCALIZED(LOADING)) :
 				!cur_video_info.comments.size() ? LOCALIZED(NO_COMMENTS) : "IE")
 			->set_font_size(0.5, DEFAULT_FONT_INTERVAL)
 			->set_x_centered(true)
 			->set_y_centered(false);
 		
+		if (tap_to_load) bottom_view->set_get_background_color(View::STANDARD_BACKGROUND)->set_on_view_released([] (View &view) {
+			if (!is_async_task_running(load_video_page) && !is_async_task_running(load_more_comments)) {
+				queue_async_task(load_more_comments, &cur_video_info, AsyncTaskPriority::INTERACTIVE, video_page_token);
+				dynamic_cast<TextView &>(view).set_text(LOCALIZED(LOADING));
+			}
+		});
 		comment_all_view->set_on_child_drawn(2, [] (const ScrollView &, int) {
-			if (cur_video_info.has_more_comments() && cur_video_info.error == "") {
+			if (var_data_saver) return;
+			if (cur_video_info.has_more_comments() && cur_video_info.error == "" && comments_main_view->views.size() == cur_video_info.comments.size()) {
 				if (!is_async_task_running(load_video_page) &&
-					!is_async_task_running(load_more_comments)) queue_async_task(load_more_comments, &cur_video_info);
+					!is_async_task_running(load_more_comments)) queue_async_task(load_more_comments, &cur_video_info, AsyncTaskPriority::INTERACTIVE, video_page_token);
 			}
 		});
 		comments_bottom_view = bottom_view;
@@ -254,44 +379,438 @@ static void update_comment_bottom_view() {
 	comment_all_view->views[2] = comments_bottom_view;
 }
 #define COMMENT_MAX_LINE_NUM 1000 // this limit exists due to performance reason (TODO : more efficient truncating)
-static CommentView *comment_to_view(const YouTubeVideoDetail::Comment &comment, int comment_index) {
-	auto &cur_content = comment.content;
+#define COMMENT_CONTENT_KEEP_LOW -3000 // wrapped comment lines are kept only for comments within this range of y (relative to the screen top)
+#define COMMENT_CONTENT_KEEP_HIGH 3240
+static std::vector<std::string> wrap_comment_content(const std::string &cur_content, int max_width) {
 	std::vector<std::string> cur_lines;
 	auto itr = cur_content.begin();
 	while (itr != cur_content.end()) {
 		if (cur_lines.size() >= COMMENT_MAX_LINE_NUM) break;
 		auto next_itr = std::find(itr, cur_content.end(), '\n');
-		auto tmp = truncate_str(std::string(itr, next_itr), COMMENT_MAX_WIDTH, COMMENT_MAX_LINE_NUM - cur_lines.size(), 0.5, 0.5);
+		auto tmp = truncate_str(std::string(itr, next_itr), max_width, COMMENT_MAX_LINE_NUM - cur_lines.size(), 0.5, 0.5);
 		cur_lines.insert(cur_lines.end(), tmp.begin(), tmp.end());
 		
 		if (next_itr != cur_content.end()) itr = std::next(next_itr);
 		else break;
 	}
+	return cur_lines;
+}
+static CommentView *comment_to_view(const YouTubeVideoDetail::Comment &comment, int comment_index) {
 	return (new CommentView(0, 0, 320))
-		->set_content_lines(cur_lines)
+		->set_content_lines(wrap_comment_content(comment.content, COMMENT_MAX_WIDTH))
+		->set_wrap_content([] (const CommentView &view) { return wrap_comment_content(view.get_yt_comment_object().content, COMMENT_MAX_WIDTH); })
 		->set_get_yt_comment_object([comment_index](const CommentView &) -> YouTubeVideoDetail::Comment & { return cur_video_info.comments[comment_index]; })
 		->set_on_author_icon_pressed([] (const CommentView &view) { channel_url_pressed = view.get_yt_comment_object().author.url; })
 		->set_on_load_more_replies_pressed([] (CommentView &view) {
-			queue_async_task(load_more_replies, &view);
+			queue_async_task(load_more_replies, &view, AsyncTaskPriority::INTERACTIVE, video_page_token);
 			view.is_loading_replies = true;
 		});
 }
 
+// returns an empty string if the id can't be determined
+static std::string get_video_id(const std::string &url) {
+	auto pos = url.find("?v=");
+	if (pos == std::string::npos) pos = url.find("&v=");
+	if (pos == std::string::npos) return "";
+	return url.substr(pos + 3, 11);
+}
+// the caller must hold small_resource_lock
+static bool can_save_offline() {
+	return cur_video_info.is_playable() && !cur_video_info.is_livestream && cur_video_info.audio_stream_url != "" && cur_video_info.video_stream_urls.size() &&
+		get_video_id(cur_video_info.url) != "";
+}
+static void save_offline() {
+	std::string id = get_video_id(cur_video_info.url);
+	if (!can_save_offline() || offline_video_exists(id) || offline_download_is_queued(id)) return;
+	// the currently selected quality if available, the lowest one otherwise
+	int quality = cur_video_info.video_stream_urls.count((int) video_p_value) ? (int) video_p_value : cur_video_info.video_stream_urls.begin()->first;
+	OfflineDownloadRequest request;
+	request.video.id = id;
+	request.video.title = cur_video_info.title;
+	request.video.author_name = cur_video_info.author.name;
+	request.video.length_text = Util_convert_seconds_to_time((double) cur_video_info.duration_ms / 1000);
+	request.video.duration_ms = cur_video_info.duration_ms;
+	request.video.quality = quality;
+	request.video_stream_url = cur_video_info.video_stream_urls[quality];
+	request.audio_stream_url = cur_video_info.audio_stream_url;
+	offline_download_enqueue(request);
+}
+// the measured cost of each audio codec, kept for the session as it hardly depends on the video
+// shown in the debug stats and used by pick_audio_stream()
+struct AudioCodecCost {
+	double decode_ms = 0; // spent in decode_audio()
+	double duration = 0; // seconds of audio decoded meanwhile
+	double ms_per_second() const { return duration > 0 ? decode_ms / duration : -1; } // -1 if not measured
+};
+static LightMutex audio_codec_costs_lock;
+static std::map<std::string, AudioCodecCost> audio_codec_costs;
+static std::string vid_audio_codec; // of the audio being decoded, "" if unknown (offline videos, the combined stream), guarded by audio_codec_costs_lock
+static double last_decode_load = -1; // the share of the decoding core used by the last playback (video + audio), -1 before the first one
+static std::string cheapest_audio_failed_url; // the video whose cheapest audio stream failed, its usual audio stream is played instead
+
+static double get_audio_codec_cost(const std::string &codec) {
+	LightMutexGuard guard(audio_codec_costs_lock);
+	auto itr = audio_codec_costs.find(codec);
+	return itr == audio_codec_costs.end() ? -1 : itr->second.ms_per_second();
+}
+// {url, codec} of the audio stream to play : the highest bitrate one, or the smallest one if `want_small`
+// replaced by the one cheapest to decode on Old 3DS, where FFmpeg shares the one fast core with the video (unless the data saver wants the
+// smallest one), or when the last playback left less than AUDIO_DECODE_MIN_HEADROOM of the core, unless it has been measured to cost no less
+static std::pair<std::string, std::string> pick_audio_stream(const YouTubeVideoDetail &info, bool want_small) {
+	std::pair<std::string, std::string> res = {info.audio_stream_url, info.audio_stream_codec};
+	if (want_small && info.smallest_audio_stream_url != "") res = {info.smallest_audio_stream_url, info.smallest_audio_stream_codec};
+	std::pair<std::string, std::string> cheapest = {info.cheapest_audio_stream_url, info.cheapest_audio_stream_codec};
+	if (cheapest.first == "" || cheapest.first == res.first || info.url == cheapest_audio_failed_url) return res;
+	if (res.first == "") return cheapest;
+	
+	bool new_3ds = false;
+	APT_CheckNew3DS(&new_3ds);
+	bool low_headroom = last_decode_load > 1 - AUDIO_DECODE_MIN_HEADROOM;
+	if (!low_headroom && (new_3ds || var_data_saver)) return res;
+	double cheapest_cost = get_audio_codec_cost(cheapest.second);
+	double cur_cost = get_audio_codec_cost(res.second);
+	if (cheapest_cost >= 0 && cur_cost >= 0 && cheapest_cost >= cur_cost) return res;
+	return cheapest;
+}
+static std::pair<std::string, std::string> pick_audio_only_stream(const YouTubeVideoDetail &info) {
+	return pick_audio_stream(info, var_audio_only_low_power || var_data_saver);
+}
+static std::string get_audio_only_stream_url(const YouTubeVideoDetail &info) { return pick_audio_only_stream(info).first; }
+// the audio stream played along with a separate video stream
+static std::pair<std::string, std::string> pick_separate_audio_stream(const YouTubeVideoDetail &info) {
+	return pick_audio_stream(info, var_data_saver);
+}
+static std::string get_audio_stream_url(const YouTubeVideoDetail &info) { return pick_separate_audio_stream(info).first; }
+// 360p is played from the combined stream (itag 18) when possible : one connection instead of two
+// its sample index stays in memory during the playback (about 7 MB per hour), which limits the length
+static bool use_both_stream(const YouTubeVideoDetail &info, int quality) {
+	bool new_3ds = false;
+	APT_CheckNew3DS(&new_3ds);
+	return quality == 360 && info.duration_ms <= (new_3ds ? BOTH_STREAM_MAX_DURATION_MS_NEW_3DS : BOTH_STREAM_MAX_DURATION_MS_OLD_3DS) &&
+		info.both_stream_url != "";
+}
+// the stream urls the decoder thread would choose for `info` at `quality` with the current settings (see decode_thread())
+static std::vector<std::string> get_stream_urls_to_play(const YouTubeVideoDetail &info, int quality) {
+	if (audio_only_mode) return {get_audio_only_stream_url(info)};
+	if (use_both_stream(info, quality)) return {info.both_stream_url};
+	auto itr = info.video_stream_urls.find(quality);
+	if (itr == info.video_stream_urls.end()) itr = info.video_stream_urls.find(360); // load_video_page() falls back to 360p
+	if (itr == info.video_stream_urls.end() || itr->second == "" || info.audio_stream_url == "") return {};
+	return {itr->second, get_audio_stream_url(info)};
+}
+// should be called while `small_resource_lock` is locked
+// run after the app is resumed from a sleep or the HOME menu : the downloader finds its hosts connected again
+static void prewarm_current_streams() {
+	if (!vid_already_init) return;
+	std::vector<std::string> urls;
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	if (vid_play_request && cur_video_info.is_playable() && !offline_video_exists(get_video_id(cur_video_info.url)))
+		urls = get_stream_urls_to_play(cur_video_info, video_p_value);
+	svcReleaseMutex(small_resource_lock);
+	if (urls.size()) stream_prefetcher_prewarm(urls);
+}
+static void request_prefetch_wo_lock(const std::string &url) {
+	if (var_data_saver) return; // it may never be watched
+	if (url == "" || url == vid_url || url == prefetch_target_url) return;
+	prefetch_target_url = url;
+	remove_all_async_tasks_with_type(prefetch_video_page);
+	queue_async_task(prefetch_video_page, &prefetch_target_url, AsyncTaskPriority::PREFETCH, 0, PREFETCH_TASK_DEADLINE_MS);
+}
+// the video the playlist moves on to at the end of the current one, empty if none
+static std::string get_next_playlist_video_url() {
+	auto &playlist = cur_video_info.playlist;
+	if (playlist.selected_index >= 0 && playlist.selected_index + 1 < (int) playlist.videos.size()) return playlist.videos[playlist.selected_index + 1].url;
+	return "";
+}
+// the likely next video : the next one in the playlist, or the first suggestion
+static std::string get_next_video_url() {
+	if (cur_video_info.playlist.videos.size()) return get_next_playlist_video_url();
+	for (auto &suggestion : cur_video_info.suggestions) if (suggestion.type == YouTubeSuccinctItem::VIDEO) return suggestion.video.url;
+	return "";
+}
+// opens the streams of the next video of the playlist (already parsed by prefetch_video_page()) ahead with NetworkMultipleDecoder::preopen()
+// so that moving on to it at the end only has to set up the output
+static void preopen_next_video(void *arg) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	std::string url = *(const std::string *) arg;
+	std::shared_ptr<const YouTubeVideoDetail> cached;
+	bool found = url != "" && video_info_cache.get(url, cached) != ResultCache<YouTubeVideoDetail>::State::MISSING;
+	int quality = video_p_value;
+	svcReleaseMutex(small_resource_lock);
+	if (!found) {
+		Util_log_save("player/preopen", "not parsed yet : " + url);
+		return;
+	}
+	const YouTubeVideoDetail &info = *cached;
+	if (!info.is_playable() || info.is_livestream || offline_video_exists(get_video_id(url))) return;
+	
+	auto urls = get_stream_urls_to_play(info, quality);
+	if (!urls.size()) return;
+	// the same choices as decode_thread() makes
+	bool request_hw_decoder = !audio_only_mode && (use_both_stream(info, quality) || quality == 360 || quality == 480);
+	std::string disk_cache_id = var_stream_disk_cache_enabled ? get_video_id(info.url) : "";
+	Result_with_string result = network_decoder.preopen(urls[0], urls.size() >= 2 ? urls[1] : urls[0], stream_downloader, request_hw_decoder,
+		disk_cache_id, audio_only_mode && var_audio_only_low_power);
+	Util_log_save("player/preopen", "preopen()..." + result.string + result.error_description, result.code);
+}
+// should be called while `small_resource_lock` is locked
+static void request_preopen_wo_lock(const std::string &url) {
+	if (var_data_saver) return;
+	if (url == "" || url == vid_url || url == preopen_target_url) return;
+	preopen_target_url = url;
+	queue_async_task(preopen_next_video, &preopen_target_url, AsyncTaskPriority::PREFETCH, 0);
+}
+// while the playback is paused, the downloading is capped to var_paused_forward_buffer_seconds ahead and the decoding threads
+// give up their priority, and the next pages of the suggestions and comments and more of their thumbnails are loaded meanwhile
+// everything goes back as soon as the playback resumes or anything (seek etc...) is requested
+// should be called every frame while `small_resource_lock` is locked
+static void update_pause_policy() {
+	bool paused = vid_play_request && vid_pausing && !vid_pausing_seek && !vid_seek_request && !vid_change_video_request &&
+		!vid_switch_video_request && !eof_reached && !cur_video_info.is_livestream && network_decoder.ready;
+	if (paused == pause_policy_active) return;
+	pause_policy_active = paused;
+	
+	stream_downloader.set_paused_forward_seconds(paused ? var_paused_forward_buffer_seconds : 0);
+	svcSetThreadPriority(threadGetHandle(vid_decode_thread), paused ? DEF_THREAD_PRIORITY_LOW : DEF_THREAD_PRIORITY_HIGH);
+	if (vid_audio_decode_thread) svcSetThreadPriority(threadGetHandle(vid_audio_decode_thread), paused ? DEF_THREAD_PRIORITY_LOW : DEF_THREAD_PRIORITY_HIGH);
+	if (paused) vid_resume_event.clear();
+	else vid_resume_event.signal();
+	
+	bool load_ahead = paused && !var_data_saver; // nothing is loaded speculatively in the data saver mode
+	suggestion_thumbnail_requester.set_max_request_num(load_ahead ? MAX_THUMBNAIL_LOAD_REQUEST_PAUSED : MAX_THUMBNAIL_LOAD_REQUEST);
+	playlist_thumbnail_requester.set_max_request_num(load_ahead ? MAX_THUMBNAIL_LOAD_REQUEST_PAUSED : MAX_THUMBNAIL_LOAD_REQUEST);
+	// one more page each, the same conditions as when the bottom of the list is reached
+	if (load_ahead && cur_video_info.error == "" && !is_async_task_running(load_video_page)) {
+		if (cur_video_info.has_more_suggestions() && suggestion_main_view->views.size() == cur_video_info.suggestions.size() &&
+			!is_async_task_running(load_more_suggestions)) queue_async_task(load_more_suggestions, &cur_video_info, AsyncTaskPriority::PREFETCH, video_page_token);
+		if (cur_video_info.has_more_comments() && comments_main_view->views.size() == cur_video_info.comments.size() &&
+			!is_async_task_running(load_more_comments)) queue_async_task(load_more_comments, &cur_video_info, AsyncTaskPriority::PREFETCH, video_page_token);
+	}
+}
+// parses the page on the async task thread (without adding it to the history) and passes the first blocks of its streams to the prefetcher
+static void prefetch_video_page(void *arg) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	std::string url = *(const std::string *) arg;
+	std::shared_ptr<const YouTubeVideoDetail> cached;
+	bool need_loading = video_info_cache.get(url, cached) == ResultCache<YouTubeVideoDetail>::State::MISSING;
+	svcReleaseMutex(small_resource_lock);
+	if (url == "") return;
+	
+	std::shared_ptr<YouTubeVideoDetail> loaded;
+	if (need_loading) {
+		Util_log_save("player/prefetch", "request : " + url);
+		loaded = std::make_shared<YouTubeVideoDetail>(youtube_parse_video_page(url, false));
+		cached = loaded;
+	}
+	const YouTubeVideoDetail &info = *cached;
+	
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	if (need_loading && info.error == "" && video_info_cache.peek(url) == ResultCache<YouTubeVideoDetail>::State::MISSING) {
+		video_info_cache.put(url, loaded);
+		prefetched_page_urls.insert(url);
+	}
+	// the user might have navigated somewhere else while parsing
+	bool still_wanted = url == prefetch_target_url;
+	svcReleaseMutex(small_resource_lock);
+	
+	if (still_wanted && info.is_playable() && !info.is_livestream && !offline_video_exists(get_video_id(url))) {
+		auto urls = get_stream_urls_to_play(info, video_p_value);
+		if (urls.size()) stream_prefetcher_request(urls);
+	}
+}
+// parses the pages of the next PLAYLIST_PREFETCH_NUM entries of the playlist one after another in a single task, without adding them to the history,
+// so that moving on to any of them finds the page in video_info_cache (the streams are still warmed by prefetch_video_page() near the end)
+static void prefetch_playlist_pages(void *) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	std::vector<std::string> urls = playlist_prefetch_urls;
+	int generation = playlist_prefetch_generation;
+	svcReleaseMutex(small_resource_lock);
+	
+	for (auto &url : urls) {
+		svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+		// the playlist might have been left, or moved on to another entry, meanwhile
+		bool still_wanted = generation == playlist_prefetch_generation && !var_data_saver;
+		bool need_loading = still_wanted && video_info_cache.peek(url) == ResultCache<YouTubeVideoDetail>::State::MISSING;
+		svcReleaseMutex(small_resource_lock);
+		if (!still_wanted) break;
+		if (!need_loading) continue;
+		
+		Util_log_save("player/prefetch", "playlist entry : " + url);
+		auto loaded = std::make_shared<YouTubeVideoDetail>(youtube_parse_video_page(url, false));
+		
+		svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+		if (loaded->error == "" && video_info_cache.peek(url) == ResultCache<YouTubeVideoDetail>::State::MISSING) {
+			video_info_cache.put(url, loaded);
+			prefetched_page_urls.insert(url);
+		}
+		svcReleaseMutex(small_resource_lock);
+	}
+}
+// should be called while `small_resource_lock` is locked, after cur_video_info has been set to a newly loaded page
+static void request_playlist_prefetch_wo_lock() {
+	if (var_data_saver) return; // they may never be watched
+	auto &playlist = cur_video_info.playlist;
+	std::vector<std::string> urls;
+	if (playlist.selected_index >= 0) for (int i = playlist.selected_index + 1; i < (int) playlist.videos.size() && urls.size() < PLAYLIST_PREFETCH_NUM; i++)
+		urls.push_back(playlist.videos[i].url);
+	if (playlist.id == playlist_prefetch_id && urls == playlist_prefetch_urls) return;
+	
+	remove_all_async_tasks_with_type(prefetch_playlist_pages);
+	playlist_prefetch_id = playlist.id;
+	playlist_prefetch_urls = urls;
+	playlist_prefetch_generation++; // stops the one already running
+	if (urls.size()) queue_async_task(prefetch_playlist_pages, NULL, AsyncTaskPriority::PREFETCH, 0);
+}
+// the qualities of `info` that can be played on this console and what network/abr.hpp needs to choose among them
+static AbrStreamSet get_abr_streams(const YouTubeVideoDetail &info) {
+	bool new_3ds = false;
+	APT_CheckNew3DS(&new_3ds);
+	AbrStreamSet res;
+	res.max_quality = new_3ds ? 480 : 360;
+	if (var_data_saver) res.max_quality = DATA_SAVER_MAX_QUALITY;
+	// 480p is only decoded fast enough by the hardware decoder of New 3DS
+	for (auto &i : info.video_stream_urls) if (i.first <= res.max_quality) res.qualities.push_back(i.first);
+	res.video_bitrates = info.video_stream_bitrates;
+	res.audio_bitrate = info.audio_stream_bitrate;
+	return res;
+}
+static std::string get_stream_itag(const std::string &stream_url) {
+	auto pos = stream_url.find("?itag=");
+	if (pos == std::string::npos) pos = stream_url.find("&itag=");
+	if (pos == std::string::npos) return "";
+	pos += 6;
+	std::string res;
+	while (pos < stream_url.size() && isdigit(stream_url[pos])) res.push_back(stream_url[pos++]);
+	return res;
+}
+// stream urls expire after several hours : parses the page again and swaps the urls of the same formats into the expired streams,
+// which keep their blocks so that the playback goes on without reinitializing the decoder
+static void refresh_expired_stream_urls(void *) {
+	auto expired_urls = stream_downloader.get_expired_urls();
+	if (!expired_urls.size()) return;
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	std::string url = cur_video_info.url;
+	svcReleaseMutex(small_resource_lock);
+	
+	Util_log_save("player/refresh", "refreshing " + std::to_string(expired_urls.size()) + " expired stream url(s)");
+	YouTubeVideoDetail info = youtube_parse_video_page(url, false);
+	std::vector<std::string> fresh_urls;
+	if (info.error == "") {
+		fresh_urls = {info.audio_stream_url, info.smallest_audio_stream_url, info.cheapest_audio_stream_url, info.both_stream_url};
+		for (auto &i : info.video_stream_urls) fresh_urls.push_back(i.second);
+	} else Util_log_save("player/refresh", "failed to parse the page : " + info.error);
+	for (auto &expired_url : expired_urls) {
+		std::string itag = get_stream_itag(expired_url);
+		std::string new_url;
+		for (auto &fresh_url : fresh_urls) if (itag != "" && fresh_url != "" && get_stream_itag(fresh_url) == itag) new_url = fresh_url;
+		if (new_url == "") Util_log_save("player/refresh", "no fresh url for itag " + itag);
+		stream_downloader.replace_expired_url(expired_url, new_url); // an empty one errors the stream out as before
+	}
+	
+	// later quality switches need the fresh urls too
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	if (info.error == "" && cur_video_info.url == url) {
+		cur_video_info.audio_stream_url = info.audio_stream_url;
+		cur_video_info.smallest_audio_stream_url = info.smallest_audio_stream_url;
+		cur_video_info.cheapest_audio_stream_url = info.cheapest_audio_stream_url;
+		cur_video_info.audio_stream_codec = info.audio_stream_codec;
+		cur_video_info.smallest_audio_stream_codec = info.smallest_audio_stream_codec;
+		cur_video_info.cheapest_audio_stream_codec = info.cheapest_audio_stream_codec;
+		cur_video_info.both_stream_url = info.both_stream_url;
+		cur_video_info.video_stream_urls = info.video_stream_urls;
+	}
+	svcReleaseMutex(small_resource_lock);
+}
+// the page restored from the saved session comes without the suggestions and comments, and its stream urls were only checked by their expiry time
+static void refresh_restored_video_page(void *) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	std::string url = cur_video_info.url;
+	svcReleaseMutex(small_resource_lock);
+	
+	YouTubeVideoDetail info = youtube_parse_video_page(url, false);
+	if (info.error != "" || !info.is_playable()) {
+		Util_log_save("player/refresh", "failed to parse the restored page : " + info.error);
+		return;
+	}
+	auto new_cache_entry = std::make_shared<YouTubeVideoDetail>(info);
+	
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	if (cur_video_info.url == url) {
+		cur_video_info.audio_stream_url = info.audio_stream_url;
+		cur_video_info.smallest_audio_stream_url = info.smallest_audio_stream_url;
+		cur_video_info.cheapest_audio_stream_url = info.cheapest_audio_stream_url;
+		cur_video_info.audio_stream_codec = info.audio_stream_codec;
+		cur_video_info.smallest_audio_stream_codec = info.smallest_audio_stream_codec;
+		cur_video_info.cheapest_audio_stream_codec = info.cheapest_audio_stream_codec;
+		cur_video_info.both_stream_url = info.both_stream_url;
+		cur_video_info.video_stream_urls = info.video_stream_urls;
+		cur_video_info.video_stream_bitrates = info.video_stream_bitrates;
+		if (!cur_video_info.suggestions.size()) {
+			cur_video_info.suggestions = info.suggestions;
+			cur_video_info.continue_key = info.continue_key;
+			cur_video_info.suggestions_continue_token = info.suggestions_continue_token;
+			update_suggestion_bottom_view();
+		}
+		if (!cur_video_info.comments.size()) {
+			cur_video_info.comment_continue_token = info.comment_continue_token;
+			cur_video_info.comment_continue_type = info.comment_continue_type;
+			cur_video_info.comments_disabled = info.comments_disabled;
+			update_comment_bottom_view();
+		}
+		var_need_reflesh = true;
+	}
+	video_info_cache.put(url, new_cache_entry);
+	svcReleaseMutex(small_resource_lock);
+}
 static void load_video_page(void *arg) {
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
 	std::string url = *(const std::string *) arg;
-	YouTubeVideoDetail tmp_video_info;
+	std::shared_ptr<const YouTubeVideoDetail> cached;
 	bool need_loading = false;
-	if (video_info_cache.count(url)) tmp_video_info = video_info_cache[url];
-	else need_loading = true;
+	bool prefetched = false;
+	if (video_info_cache.get(url, cached) != ResultCache<YouTubeVideoDetail>::State::MISSING) prefetched = prefetched_page_urls.erase(url);
+	else {
+		need_loading = true;
+		prefetched_page_urls.erase(url); // dropped from the cache before being watched
+	}
 	svcReleaseMutex(small_resource_lock);
+	// copied outside of the lock, the snapshot isn't changed by anyone while we hold it
+	YouTubeVideoDetail tmp_video_info;
+	if (cached) tmp_video_info = *cached;
+	cached.reset();
+	// the history entry was skipped when it was parsed in advance
+	if (prefetched) youtube_video_page_add_to_history(tmp_video_info);
 	
 	if (need_loading) {
 		Util_log_save("player/load-v", "request : " + url);
 		add_cpu_limit(25);
-		tmp_video_info = youtube_parse_video_page(url);
+		tmp_video_info = youtube_parse_video_page(url, true, [&] (const YouTubeVideoDetail &streams) {
+			// the metadata, suggestions and so on are still being parsed : start downloading the first blocks of what will be played meanwhile
+			if (!streams.is_playable() || offline_video_exists(get_video_id(url))) return;
+			AbrStreamSet abr_streams = get_abr_streams(streams);
+			int quality = !audio_only_mode && auto_quality_mode && abr_streams.qualities.size() ? abr_choose_initial_quality(abr_streams) : (int) video_p_value;
+			auto urls = get_stream_urls_to_play(streams, quality);
+			// the handshake with the stream host is done by the time the decoder makes its first request, even for livestreams
+			stream_prefetcher_prewarm(urls);
+			if (urls.size() && !streams.is_livestream) stream_prefetcher_request(urls);
+		});
 		remove_cpu_limit(25);
 	}
+	// the page couldn't be loaded (e.g. no connection) : fall back to the copy saved for offline playback
+	OfflineVideo offline_video;
+	bool use_offline_copy = !tmp_video_info.is_playable() && offline_get_video(get_video_id(url), &offline_video);
+	if (use_offline_copy) {
+		Util_log_save("player/load-v", "using offline copy : " + offline_video.id);
+		tmp_video_info.error = "";
+		tmp_video_info.url = url;
+		tmp_video_info.title = offline_video.title;
+		tmp_video_info.author.name = offline_video.author_name;
+		tmp_video_info.duration_ms = offline_video.duration_ms;
+		tmp_video_info.is_livestream = false;
+		tmp_video_info.playability_status = "OK";
+		tmp_video_info.playability_reason = "";
+		tmp_video_info.both_stream_url = offline_get_video_path(offline_video.id);
+	}
 	
 	Util_log_save("player/load-v", "truncate/view creation start");
 	// wrap main title
@@ -301,26 +820,7 @@ static void load_video_page(void *arg) {
 		title_lines_tmp = truncate_str(tmp_video_info.title, TITLE_MAX_WIDTH, 2, 0.5, 0.5);
 		title_font_size_tmp = 0.5;
 	} else title_font_size_tmp = MIDDLE_FONT_SIZE;
-	// wrap description
-	std::vector<std::string> description_lines_tmp;
-	{
-		auto &description = tmp_video_info.description;
-		auto itr = description.begin();
-		while (itr != description.end()) {
-			auto next_itr = std::find(itr, description.end(), '\n');
-			auto cur_lines = truncate_str(std::string(itr, next_itr), DESC_MAX_WIDTH, 100, 0.5, 0.5);
-			description_lines_tmp.insert(description_lines_tmp.end(), cur_lines.begin(), cur_lines.end());
-			if (next_itr != description.end()) itr = std::next(next_itr);
-			else break;
-		}
-	}
-	// prepare suggestion view
-	std::vector<View *> new_suggestion_views;
-	for (size_t i = 0; i < tmp_video_info.suggestions.size(); i++) new_suggestion_views.push_back(suggestion_to_view(tmp_video_info.suggestions[i]));
-	
-	// prepare comment views (comments exist from the first if it's loaded from cache)
-	std::vector<View *> new_comment_views;
-	for (size_t i = 0; i < tmp_video_info.comments.size(); i++) new_comment_views.push_back(comment_to_view(tmp_video_info.comments[i], i));
+	// the description, suggestions and comments (they exist from the first if it's loaded from cache) are wrapped later by build_pending_views()
 	
 	// prepare captions view
 	static std::string selected_base_lang = "";
@@ -339,7 +839,7 @@ static void load_video_page(void *arg) {
 			->set_x_centered(true)
 			->set_text_offset(0, -2.0)
 			->set_background_color(COLOR_GRAY(0x80))
-			->set_on_view_released([] (View &view) { queue_async_task(load_caption, &load_caption_arg); })
+			->set_on_view_released([] (View &view) { queue_async_task(load_caption, &load_caption_arg, AsyncTaskPriority::VISIBLE, video_page_token); })
 		}
 	)->set_draw_order({1, 0});
 	
@@ -424,11 +924,20 @@ static void load_video_page(void *arg) {
 	
 	Util_log_save("player/load-v", "truncate/view creation end");
 	
+	// the snapshot for the cache is made before locking, the cached entry is kept as it is unless it was replaced by the offline copy
+	std::shared_ptr<YouTubeVideoDetail> new_cache_entry;
+	if ((need_loading && tmp_video_info.error == "") || (!need_loading && use_offline_copy))
+		new_cache_entry = std::make_shared<YouTubeVideoDetail>(tmp_video_info);
+	
 	// acquire lock and perform actual replacements
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
-	cur_video_info = tmp_video_info;
-	video_info_cache[url] = tmp_video_info;
-	description_lines = description_lines_tmp;
+	cur_video_info = std::move(tmp_video_info);
+	if (new_cache_entry) {
+		if (need_loading) video_info_cache.put(url, new_cache_entry);
+		else video_info_cache.update(url, new_cache_entry);
+	}
+	description_lines.clear();
+	description_wrap_pos = 0;
 	title_lines = title_lines_tmp;
 	title_font_size = title_font_size_tmp;
 	TAB_NUM = 5;
@@ -436,9 +945,8 @@ static void load_video_page(void *arg) {
 	else if (selected_tab == TAB_PLAYLIST) selected_tab = TAB_GENERAL;
 	
 	for (auto view : suggestion_main_view->views) thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(view)->thumbnail_handle);
-	suggestion_thumbnail_request_l = suggestion_thumbnail_request_r = 0;
+	suggestion_thumbnail_requester.reset();
 	suggestion_main_view->recursive_delete_subviews();
-	suggestion_main_view->views = new_suggestion_views;
 	suggestion_view->reset();
 	update_suggestion_bottom_view();
 	
@@ -449,7 +957,7 @@ static void load_video_page(void *arg) {
 	}
 	comment_thumbnail_loaded_list.clear();
 	comments_main_view->recursive_delete_subviews();
-	comments_main_view->views = new_comment_views;
+	comments_last_page_begin = 0;
 	comment_all_view->reset();
 	update_comment_bottom_view();
 	
@@ -461,45 +969,77 @@ static void load_video_page(void *arg) {
 	caption_language_select_view->set_draw_order({1, 0});
 	captions_tab_view = caption_language_select_view;
 	
-	playlist_title_view->set_text(tmp_video_info.playlist.title);
-	playlist_author_view->set_text(tmp_video_info.playlist.author_name);
+	playlist_title_view->set_text(cur_video_info.playlist.title);
+	playlist_author_view->set_text(cur_video_info.playlist.author_name);
 	for (auto view : playlist_list_view->views) thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(view)->thumbnail_handle);
 	playlist_list_view->recursive_delete_subviews();
 	playlist_list_view->views = new_playlist_views;
 	playlist_list_view->set_offset(playlist_view_scroll);
-	playlist_thumbnail_request_l = playlist_thumbnail_request_r = 0;
+	playlist_thumbnail_requester.reset();
 	
 	thumbnail_cancel_request(icon_thumbnail_handle);
-	icon_thumbnail_handle = thumbnail_request(cur_video_info.author.icon_url, SceneType::VIDEO_PLAYER, 1000, ThumbnailType::ICON);
+	icon_thumbnail_handle = thumbnail_request(cur_video_info.author.icon_url, SceneType::VIDEO_PLAYER, 1000, ThumbnailType::ICON, ICON_SIZE);
 	
 	for (int i = 0; i < TAB_MAX_NUM; i++) scroller[i].reset();
 	var_need_reflesh = true;
 	
+	playback_benchmark_on_page_loaded();
+	if (!use_offline_copy) request_playlist_prefetch_wo_lock();
+	if (url == restored_page_url) {
+		restored_page_url = "";
+		if (!use_offline_copy) queue_async_task(refresh_restored_video_page, NULL, AsyncTaskPriority::PREFETCH, video_page_token);
+	}
 	if (cur_video_info.is_playable()) {
 		vid_change_video_request = true;
 		if (network_decoder.ready) network_decoder.interrupt = true;
-		std::vector<int> available_qualities;
-		for (auto &i : cur_video_info.video_stream_urls) available_qualities.push_back(i.first);
-		if (!std::count(available_qualities.begin(), available_qualities.end(), 360))
+		AbrStreamSet abr_streams = get_abr_streams(cur_video_info);
+		std::vector<int> available_qualities = abr_streams.qualities;
+		if (var_data_saver && !available_qualities.size() && cur_video_info.video_stream_urls.size())
+			available_qualities.push_back(cur_video_info.video_stream_urls.begin()->first);
+		if (!var_data_saver && !std::count(available_qualities.begin(), available_qualities.end(), 360))
 			available_qualities.insert(std::lower_bound(available_qualities.begin(), available_qualities.end(), 360), 360);
 		
-		video_quality_selector_view->button_texts = { (std::function<std::string ()>) []() { return LOCALIZED(OFF); } };
+		// off, auto, and then the qualities
+		video_quality_selector_view->button_texts = {
+			(std::function<std::string ()>) []() { return LOCALIZED(OFF); },
+			(std::function<std::string ()>) []() { return LOCALIZED(AUTO_QUALITY); }
+		};
 		for (auto i : available_qualities) video_quality_selector_view->button_texts.push_back(std::to_string(i) + "p");
 		video_quality_selector_view->button_num = video_quality_selector_view->button_texts.size();
 		
-		if (!audio_only_mode && !cur_video_info.video_stream_urls.count((int) video_p_value)) {
+		if (!audio_only_mode && auto_quality_mode && abr_streams.qualities.size()) video_p_value = abr_choose_initial_quality(abr_streams);
+		if (!audio_only_mode && var_data_saver && available_qualities.size() && video_p_value > available_qualities.back()) video_p_value = available_qualities.back();
+		if (!audio_only_mode && (!cur_video_info.video_stream_urls.count((int) video_p_value) ||
+			!std::count(available_qualities.begin(), available_qualities.end(), (int) video_p_value))) {
 			video_p_value = 360;
 			if (!cur_video_info.video_stream_urls.count((int) video_p_value)) audio_only_mode = true;
 		}
-		video_quality_selector_view->selected_button = audio_only_mode ? 0 : 1 + std::find(available_qualities.begin(), available_qualities.end(), (int) video_p_value) - available_qualities.begin();
-		video_quality_selector_view->set_on_change([available_qualities] (const SelectorView &view) {
+		video_quality_selector_view->selected_button = audio_only_mode ? 0 : auto_quality_mode ? 1 :
+			2 + std::find(available_qualities.begin(), available_qualities.end(), (int) video_p_value) - available_qualities.begin();
+		video_quality_selector_view->set_on_change([available_qualities, abr_streams] (const SelectorView &view) {
 			bool changed = false;
 			if (view.selected_button == 0) {
 				if (!audio_only_mode) changed = true;
 				audio_only_mode = true;
+				auto_quality_mode = false;
+			} else if (view.selected_button == 1) {
+				int new_p_value = abr_streams.qualities.size() ? abr_choose_initial_quality(abr_streams) : 360;
+				auto_quality_mode = true;
+				if (!audio_only_mode) {
+					if (video_p_value != new_p_value) send_quality_change_request_wo_lock(new_p_value);
+					return;
+				}
+				changed = true;
+				audio_only_mode = false;
+				video_p_value = new_p_value;
 			} else {
-				int new_p_value = available_qualities[view.selected_button - 1];
-				if (audio_only_mode || video_p_value != new_p_value) changed = true;
+				int new_p_value = available_qualities[view.selected_button - 2];
+				auto_quality_mode = false;
+				if (!audio_only_mode) {
+					if (video_p_value != new_p_value) send_quality_change_request_wo_lock(new_p_value);
+					return;
+				}
+				changed = true;
 				audio_only_mode = false;
 				video_p_value = new_p_value;
 			}
@@ -526,17 +1066,28 @@ static void load_more_suggestions(void *arg_) {
 	// wrap suggestion titles
 	Util_log_save("player/load-s", "truncate/view creation start");
 	std::vector<View *> new_suggestion_views;
-	for (size_t i = arg->suggestions.size(); i < new_result.suggestions.size(); i++) new_suggestion_views.push_back(suggestion_to_view(new_result.suggestions[i]));
+	for (auto &suggestion : new_result.suggestions) new_suggestion_views.push_back(suggestion_to_view(suggestion));
 	Util_log_save("player/load-s", "truncate/view creation end");
 	
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	// another video has been requested in the meantime
+	if (async_task_cancel_requested()) {
+		svcReleaseMutex(small_resource_lock);
+		for (auto view : new_suggestion_views) delete view;
+		return;
+	}
 	if (new_result.error != "") cur_video_info.error = new_result.error;
 	else {
-		cur_video_info = new_result;
-		suggestion_main_view->views.insert(suggestion_main_view->views.end(), new_suggestion_views.begin(), new_suggestion_views.end());
+		video_info_cache.modify(cur_video_info.url, [&] (YouTubeVideoDetail &cached) { cached.append_suggestions(YouTubeVideoDetail(new_result)); });
+		// the views of the suggestions we had are not all built yet : build_pending_views() makes these too in order
+		if (suggestion_main_view->views.size() == cur_video_info.suggestions.size()) {
+			suggestion_main_view->views.insert(suggestion_main_view->views.end(), new_suggestion_views.begin(), new_suggestion_views.end());
+			new_suggestion_views.clear();
+		}
+		cur_video_info.append_suggestions(std::move(new_result));
 		update_suggestion_bottom_view();
-		video_info_cache[cur_video_info.url] = new_result;
 	}
+	for (auto view : new_suggestion_views) delete view;
 	var_need_reflesh = true;
 	svcReleaseMutex(small_resource_lock);
 }
@@ -551,13 +1102,27 @@ static void load_more_comments(void *arg_) {
 	std::vector<View *> new_comment_views;
 	// wrap comments
 	Util_log_save("player/load-c", "truncate/views creation start");
-	for (size_t i = arg->comments.size(); i < new_result.comments.size(); i++) new_comment_views.push_back(comment_to_view(new_result.comments[i], i));
+	size_t prev_comment_num = arg->comments.size();
+	for (size_t i = 0; i < new_result.comments.size(); i++) new_comment_views.push_back(comment_to_view(new_result.comments[i], prev_comment_num + i));
 	Util_log_save("player/load-c", "truncate/views creation end");
 	
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
-	cur_video_info = new_result;
-	video_info_cache[cur_video_info.url] = new_result;
-	comments_main_view->views.insert(comments_main_view->views.end(), new_comment_views.begin(), new_comment_views.end());
+	if (async_task_cancel_requested()) {
+		svcReleaseMutex(small_resource_lock);
+		for (auto view : new_comment_views) delete view;
+		return;
+	}
+	if (new_result.error != "") cur_video_info.error = new_result.error;
+	else {
+		video_info_cache.modify(cur_video_info.url, [&] (YouTubeVideoDetail &cached) { cached.append_comments(YouTubeVideoDetail(new_result)); });
+		if (comments_main_view->views.size() == cur_video_info.comments.size()) {
+			comments_last_page_begin = comments_main_view->views.size();
+			comments_main_view->views.insert(comments_main_view->views.end(), new_comment_views.begin(), new_comment_views.end());
+			new_comment_views.clear();
+		}
+		cur_video_info.append_comments(std::move(new_result));
+	}
+	for (auto view : new_comment_views) delete view;
 	update_comment_bottom_view();
 	var_need_reflesh = true;
 	svcReleaseMutex(small_resource_lock);
@@ -565,8 +1130,11 @@ static void load_more_comments(void *arg_) {
 
 static void load_more_replies(void *arg_) {
 	CommentView *comment_view = (CommentView *) arg_;
-	// only load_more_comments() can invalidate this reference, so it's safe
-	YouTubeVideoDetail::Comment &comment = comment_view->get_yt_comment_object();
+	// load_more_comments() may run meanwhile and move the comments, so a copy is loaded from
+	// the view stays valid until the page changes, which cancels this task first
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	YouTubeVideoDetail::Comment comment = comment_view->get_yt_comment_object();
+	svcReleaseMutex(small_resource_lock);
 	
 	add_cpu_limit(25);
 	auto new_comment = youtube_video_page_load_more_replies(comment);
@@ -576,33 +1144,28 @@ static void load_more_replies(void *arg_) {
 	// wrap comments
 	Util_log_save("player/load-r", "truncate start");
 	for (size_t i = comment.replies.size(); i < new_comment.replies.size(); i++) {
-		auto &cur_reply = new_comment.replies[i];
-		auto &cur_content = cur_reply.content;
-		std::vector<std::string> cur_lines;
-		auto itr = cur_content.begin();
-		while (itr != cur_content.end()) {
-			if (cur_lines.size() >= COMMENT_MAX_LINE_NUM) break;
-			auto next_itr = std::find(itr, cur_content.end(), '\n');
-			auto tmp = truncate_str(std::string(itr, next_itr), REPLY_MAX_WIDTH, COMMENT_MAX_LINE_NUM - cur_lines.size(), 0.5, 0.5);
-			cur_lines.insert(cur_lines.end(), tmp.begin(), tmp.end());
-			
-			if (next_itr != cur_content.end()) itr = std::next(next_itr);
-			else break;
-		}
 		new_reply_views.push_back((new CommentView(REPLY_INDENT, 0, 320 - REPLY_INDENT))
-			->set_content_lines(cur_lines)
+			->set_content_lines(wrap_comment_content(new_comment.replies[i].content, REPLY_MAX_WIDTH))
+			->set_wrap_content([] (const CommentView &view) { return wrap_comment_content(view.get_yt_comment_object().content, REPLY_MAX_WIDTH); })
 			->set_get_yt_comment_object([comment_view, i](const CommentView &) -> YouTubeVideoDetail::Comment & { return comment_view->get_yt_comment_object().replies[i]; })
 			->set_on_author_icon_pressed([] (const CommentView &view) { channel_url_pressed = view.get_yt_comment_object().author.url; })
 			->set_is_reply(true)
+			->set_parent(comment_view)
 		);
 	}
 	Util_log_save("player/load-r", "truncate end");
 	
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
-	comment = new_comment; // do not apply to the cache because it's a mess to also save the folding status
+	if (async_task_cancel_requested()) {
+		svcReleaseMutex(small_resource_lock);
+		for (auto view : new_reply_views) delete view;
+		return;
+	}
+	comment_view->get_yt_comment_object() = new_comment; // do not apply to the cache because it's a mess to also save the folding status
 	comment_view->replies.insert(comment_view->replies.end(), new_reply_views.begin(), new_reply_views.end());
 	comment_view->replies_shown = comment_view->replies.size();
 	comment_view->is_loading_replies = false;
+	comment_view->invalidate_height();
 	svcReleaseMutex(small_resource_lock);
 	var_need_reflesh = true;
 }
@@ -615,6 +1178,15 @@ static void load_caption(void *arg_) {
 	auto new_video_info = youtube_video_page_load_caption(cur_video_info, base_lang_id, translation_lang_id);
 	remove_cpu_limit(25);
 	
+	// caption overlay : its layout is lazy, so show it before wrapping the whole caption list below
+	CaptionOverlayView *new_caption_overlay_view = (new CaptionOverlayView(0, 0, 400, 240))
+		->set_caption_data(new_video_info.caption_data[{base_lang_id, translation_lang_id}]);
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	delete caption_overlay_view;
+	caption_overlay_view = new_caption_overlay_view;
+	caption_overlay_view->set_is_visible(true);
+	svcReleaseMutex(small_resource_lock);
+	
 	std::vector<View *> caption_main_views;
 	
 	int top_button_height = DEFAULT_FONT_INTERVAL * 1.5;
@@ -681,21 +1253,11 @@ static void load_caption(void *arg_) {
 	}
 	caption_main_views.push_back(new EmptyView(0, 0, 320, SMALL_MARGIN));
 	
-	// caption overlay
-	CaptionOverlayView *new_caption_overlay_view = (new CaptionOverlayView(0, 0, 400, 240))
-		->set_caption_data(new_video_info.caption_data[{base_lang_id, translation_lang_id}]);
-	
-	
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
 	caption_main_view->recursive_delete_subviews();
 	caption_main_view->reset();
 	caption_main_view->set_views(caption_main_views);
 	captions_tab_view = caption_main_view;
-	
-	delete caption_overlay_view;
-	caption_overlay_view = new_caption_overlay_view;
-	caption_overlay_view->set_is_visible(true);
-	
 	svcReleaseMutex(small_resource_lock);
 }
 
@@ -705,26 +1267,71 @@ static void load_caption(void *arg_) {
 // END : functions called from async_task.cpp
 
 
+#define PENDING_VIEWS_BUDGET_MS 3 // per frame, a suggestion takes ~0.5 ms and a long comment a few ms
+// should be called while `small_resource_lock` is locked
+static void build_pending_views() {
+	if (is_async_task_running(load_video_page)) return;
+	u64 start = svcGetSystemTick();
+	auto has_time = [&] () { return (svcGetSystemTick() - start) / CPU_TICKS_PER_MSEC < PENDING_VIEWS_BUDGET_MS; };
+	
+	if (selected_tab == TAB_GENERAL) {
+		auto &description = cur_video_info.description;
+		while (description_wrap_pos != std::string::npos && has_time()) {
+			if (description_wrap_pos >= description.size()) {
+				description_wrap_pos = std::string::npos;
+				break;
+			}
+			size_t next_pos = description.find('\n', description_wrap_pos);
+			auto cur_lines = truncate_str(description.substr(description_wrap_pos, next_pos == std::string::npos ? std::string::npos : next_pos - description_wrap_pos),
+				DESC_MAX_WIDTH, 100, 0.5, 0.5);
+			description_lines.insert(description_lines.end(), cur_lines.begin(), cur_lines.end());
+			description_wrap_pos = next_pos == std::string::npos ? std::string::npos : next_pos + 1;
+			var_need_reflesh = true;
+		}
+	} else if (selected_tab == TAB_SUGGESTIONS) {
+		auto &views = suggestion_main_view->views;
+		while (views.size() < cur_video_info.suggestions.size() && has_time()) {
+			views.push_back(suggestion_to_view(cur_video_info.suggestions[views.size()]));
+			var_need_reflesh = true;
+		}
+	} else if (selected_tab == TAB_COMMENTS) {
+		auto &views = comments_main_view->views;
+		while (views.size() < cur_video_info.comments.size() && has_time()) {
+			views.push_back(comment_to_view(cur_video_info.comments[views.size()], views.size()));
+			var_need_reflesh = true;
+		}
+	}
+}
+
 static bool send_load_more_suggestions_request() {
 	if (is_async_task_running(load_video_page) || is_async_task_running(load_more_suggestions)) return false;
-	queue_async_task(load_more_suggestions, &cur_video_info);
+	queue_async_task(load_more_suggestions, &cur_video_info, AsyncTaskPriority::INTERACTIVE, video_page_token);
 	return true;
 }
 
 // should be called while `small_resource_lock` is locked
 static void send_change_video_request_wo_lock(std::string url, bool force_load) {
-	remove_all_async_tasks_with_type(load_video_page);
-	remove_all_async_tasks_with_type(load_more_suggestions);
-	remove_all_async_tasks_with_type(load_more_comments);
-	
-	if (force_load) video_info_cache.erase(url);
+	// whatever was going to be loaded for the previous video is useless now
+	async_task_cancel(video_page_token);
+	
+	// stop warming the streams right away, but let the page parsing of the video we are going to finish
+	stream_prefetcher_cancel();
+	if (url != prefetch_target_url) remove_all_async_tasks_with_type(prefetch_video_page);
+	prefetch_target_url = "";
+	remove_all_async_tasks_with_type(preopen_next_video);
+	preopen_target_url = "";
+	
+	if (force_load) {
+		video_info_cache.erase(url);
+		prefetched_page_urls.erase(url);
+	}
 	
 	vid_play_request = false;
 	if (vid_url != url) {
 		vid_url = url;
 		if (selected_tab != TAB_PLAYLIST) selected_tab = TAB_GENERAL;
 	}
-	queue_async_task(load_video_page, &vid_url);
+	queue_async_task(load_video_page, &vid_url, AsyncTaskPriority::INTERACTIVE, video_page_token);
 	var_need_reflesh = true;
 }
 static void send_change_video_request(std::string url, bool force_load) {
@@ -736,16 +1343,96 @@ static void send_change_video_request(std::string url, bool force_load) {
 static void send_seek_request_wo_lock(double pos) {
 	vid_seek_pos = pos;
 	vid_current_pos = pos;
+	vid_seek_request_time = osGetTime();
 	vid_seek_request = true;
 	if (network_decoder.ready) // avoid locking while initing
 		network_decoder.interrupt = true;
 }
+#define LIVE_TARGET_LAG_FRAGMENTS 2 // played at the normal speed up to this many fragments behind the latest one
+#define LIVE_SKIP_LAG_FRAGMENTS 5 // jumps back to the target lag if it gets this far behind
+#define LIVE_CATCH_UP_SPEED 1.05 // in between, the audio (and so the video following it) is played this much faster
+// low latency livestreams, should be called while `small_resource_lock` is locked
+static void keep_up_with_live_edge() {
+	int lag = network_decoder.get_live_edge_lag();
+	if (lag >= LIVE_SKIP_LAG_FRAGMENTS) {
+		Util_log_save(DEF_SAPP0_MAIN_STR, "live : " + std::to_string(lag) + " fragments behind, skipping");
+		send_seek_request_wo_lock(network_decoder.get_live_edge_pos(LIVE_TARGET_LAG_FRAGMENTS));
+		return;
+	}
+	double speed = lag > LIVE_TARGET_LAG_FRAGMENTS ? LIVE_CATCH_UP_SPEED : 1.0;
+	if (speed != vid_live_speed) {
+		vid_live_speed = speed;
+		Util_speaker_set_speed(0, vid_sample_rate, speed);
+	}
+}
+// changes the video quality, without stopping the audio if the video is a separate stream
+static void send_quality_change_request_wo_lock(int new_p_value) {
+	video_p_value = new_p_value;
+	if (vid_play_request && network_decoder.ready && network_decoder.can_decode_concurrently() && !vid_change_video_request) {
+		vid_switch_video_request = true;
+		return;
+	}
+	seek_at_init_request = vid_current_pos;
+	vid_change_video_request = true;
+	if (network_decoder.ready) network_decoder.interrupt = true;
+}
 static void send_seek_request(double pos) {
 	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
 	send_seek_request_wo_lock(pos);
 	svcReleaseMutex(small_resource_lock);
 }
 
+// the metrics of system/util/telemetry.hpp sampled here, the frame ones come from the convert thread
+static void update_telemetry() {
+	if (!telemetry_is_enabled()) return;
+	bool playing = vid_play_request && network_decoder.ready;
+	telemetry_set(TelemetryMetric::BUFFER_AHEAD, playing ? network_decoder.get_buffered_seconds_ahead() : -1);
+	telemetry_set(TelemetryMetric::BANDWIDTH, playing ? stream_downloader.get_bandwidth_estimate() : -1); // bytes per ms = KB/s
+}
+
+#define BENCHMARK_FIRST_FRAME_TIMEOUT 30 // seconds
+#define BENCHMARK_SEEK_TIMEOUT 20
+// drives the scenario of system/util/playback_benchmark.hpp, should be called every frame while `small_resource_lock` is locked
+static void update_playback_benchmark() {
+	const PlaybackBenchmarkScenario *scenario = playback_benchmark_current();
+	if (!scenario) {
+		benchmark_scenario_started = false;
+		return;
+	}
+	playback_benchmark_sample_memory();
+	if (!benchmark_scenario_started) {
+		benchmark_scenario_started = true;
+		benchmark_next_seek = 0;
+		audio_only_mode = false;
+		auto_quality_mode = false;
+		video_p_value = scenario->quality;
+		playback_benchmark_on_scenario_started();
+		send_change_video_request_wo_lock(scenario->url, true); // always from the network, so that the startup is measured
+		return;
+	}
+	
+	std::string error;
+	bool finished = false;
+	double played = playback_benchmark_time_since_first_frame();
+	if (playback_benchmark_is_page_loaded() && !cur_video_info.is_playable()) error = "not playable", finished = true;
+	else if (played < 0) {
+		if (playback_benchmark_time_since_start() > BENCHMARK_FIRST_FRAME_TIMEOUT) error = "no frame shown", finished = true;
+	} else if (playback_benchmark_is_seek_pending()) {
+		if (playback_benchmark_time_since_seek() > BENCHMARK_SEEK_TIMEOUT) error = "seek timed out", finished = true;
+	} else if (benchmark_next_seek < scenario->seek_positions.size() &&
+		played >= scenario->play_seconds * (benchmark_next_seek + 1) / (scenario->seek_positions.size() + 1)) { // seeks are spread evenly
+		send_seek_request_wo_lock(scenario->seek_positions[benchmark_next_seek++]);
+		playback_benchmark_on_seek_requested();
+	} else if (played >= scenario->play_seconds) finished = true;
+	
+	if (finished) {
+		playback_benchmark_finish_scenario(error);
+		benchmark_scenario_started = false;
+		if (!playback_benchmark_is_running()) vid_play_request = false;
+	}
+	var_need_reflesh = true; // for the status on the top screen
+}
+
 
 bool video_is_playing() {
 	if (!vid_play_request && vid_pausing_seek) {
@@ -767,6 +1454,46 @@ namespace Bar {
 	constexpr int MAXIMIZE_ICON_WIDTH = 28;
 	constexpr int TIME_STR_RIGHT_MARGIN = 2;
 	constexpr int TIME_STR_LEFT_MARGIN = 3;
+	
+	// storyboard (seek preview) : only the sprite sheet containing the frame under the finger is requested, and only while the bar is grabbed
+	constexpr int STORYBOARD_PREVIEW_WIDTH = 128;
+	constexpr int STORYBOARD_PREVIEW_MARGIN = 4;
+	constexpr int STORYBOARD_SHEET_PRIORITY = 2000000; // above anything of the active scene
+	std::string storyboard_sheet_url;
+	int storyboard_sheet_handle = -1;
+	int storyboard_src_x, storyboard_src_y, storyboard_src_w, storyboard_src_h;
+	// must be called with `small_resource_lock` locked as it reads cur_video_info
+	void update_storyboard_request() {
+		const auto &storyboard = cur_video_info.storyboard;
+		std::string next_sheet_url;
+		if (bar_grabbed && storyboard.is_valid()) {
+			int frame = std::max(0, std::min(storyboard.frame_num - 1, (int) (last_grab_timestamp * 1000 / storyboard.interval_ms)));
+			int frames_per_sheet = storyboard.cols * storyboard.rows;
+			int sheet_index = std::min<int>(frame / frames_per_sheet, storyboard.sheet_urls.size() - 1);
+			frame -= sheet_index * frames_per_sheet;
+			next_sheet_url = storyboard.sheet_urls[sheet_index];
+			storyboard_src_x = frame % storyboard.cols * storyboard.width;
+			storyboard_src_y = frame / storyboard.cols * storyboard.height;
+			storyboard_src_w = storyboard.width;
+			storyboard_src_h = storyboard.height;
+		}
+		if (next_sheet_url != storyboard_sheet_url) {
+			thumbnail_cancel_request(storyboard_sheet_handle);
+			storyboard_sheet_handle = next_sheet_url != "" ? thumbnail_request(next_sheet_url, SceneType::VIDEO_PLAYER, STORYBOARD_SHEET_PRIORITY) : -1;
+			storyboard_sheet_url = next_sheet_url;
+		}
+	}
+	void draw_storyboard_preview(float y_bottom) {
+		if (!bar_grabbed || storyboard_sheet_handle == -1 || vid_duration == 0) return;
+		float width = STORYBOARD_PREVIEW_WIDTH;
+		float height = width * storyboard_src_h / storyboard_src_w;
+		float x_center = bar_x_l + (bar_x_r - bar_x_l) * network_decoder.get_bar_pos_from_timestamp(last_grab_timestamp);
+		float x_l = std::max<float>(1, std::min<float>(320 - 1 - width, x_center - width / 2));
+		float y_t = y_bottom - STORYBOARD_PREVIEW_MARGIN - height;
+		Draw_texture(var_square_image[0], DEF_DRAW_WHITE, x_l - 1, y_t - 1, width + 2, height + 2);
+		if (!thumbnail_draw_part(storyboard_sheet_handle, x_l, y_t, width, height, storyboard_src_x, storyboard_src_y, storyboard_src_w, storyboard_src_h))
+			Draw_texture(var_square_image[0], DEF_DRAW_DARK_GRAY, x_l, y_t, width, height); // still loading
+	}
 	void video_draw_playing_bar() {
 		// draw
 		float y_l = 240 - VIDEO_PLAYING_BAR_HEIGHT;
@@ -819,6 +1546,7 @@ namespace Bar {
 			Draw_texture(var_square_image[0], 0xFF3333D0, bar_x_l, y_center - 2, (bar_x_r - bar_x_l) * vid_progress, 4);
 			C2D_DrawCircleSolid(bar_x_l + (bar_x_r - bar_x_l) * vid_progress, y_center, 0, bar_grabbed ? 6 : 4, 0xFF3333D0);
 		}
+		draw_storyboard_preview(y_l);
 	}
 	void video_update_playing_bar(Hid_info key, Intent *intent) {
 		float y_l = 240 - VIDEO_PLAYING_BAR_HEIGHT;
@@ -845,6 +1573,7 @@ namespace Bar {
 		if (!vid_pausing_seek && bar_grabbed && !vid_pausing) Util_speaker_pause(0);
 		if (vid_pausing_seek && !bar_grabbed && !vid_pausing) Util_speaker_resume(0);
 		vid_pausing_seek = bar_grabbed;
+		update_storyboard_request();
 		
 		// start/stop
 		if (!get_network_waiting_status() && !vid_pausing_seek && key.p_touch && key.touch_x < 22 && y_l <= key.touch_y) {
@@ -868,34 +1597,319 @@ namespace Bar {
 		last_touch_y = key.touch_y;
 	}
 }
-void video_update_playing_bar(Hid_info key, Intent *intent) { Bar::video_update_playing_bar(key, intent); }
+// saves the position every now and then so that the next launch can continue from it, even after a crash
+static void update_player_session() {
+	if (!vid_play_request || !network_decoder.ready) return;
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	bool resumable = cur_video_info.is_playable() && !cur_video_info.is_livestream && !eof_reached && cur_video_info.url == vid_url;
+	if (!resumable && player_session_saved) {
+		player_session_clear();
+		player_session_saved = false;
+	} else if (resumable && osGetTime() - player_session_save_time >= PLAYER_SESSION_SAVE_INTERVAL_MS && vid_current_pos != player_session_saved_pos) {
+		player_session_update(vid_url, vid_current_pos, video_p_value, audio_only_mode, auto_quality_mode, cur_video_info);
+		player_session_saved = true;
+		player_session_save_time = osGetTime();
+		player_session_saved_pos = vid_current_pos;
+	}
+	svcReleaseMutex(small_resource_lock);
+}
+static void update_mini_player();
+void video_update_playing_bar(Hid_info key, Intent *intent) {
+	Bar::video_update_playing_bar(key, intent);
+	update_mini_player();
+	update_player_session();
+}
 void video_draw_playing_bar() { Bar::video_draw_playing_bar(); }
 
 
 void video_set_linear_filter_enabled(bool enabled) {
 	if (vid_already_init) {
-		for(int i = 0; i < 8; i++)
-			Draw_c2d_image_set_filter(&vid_image[i], enabled);
+		for(int i = 0; i < VIDEO_TEX_SLOT_NUM * 4; i++)
+			if (vid_image[i].subtex) Draw_c2d_image_set_filter(&vid_image[i], enabled);
+		for(int i = 0; i < VIDEO_TEX_SLOT_NUM; i++)
+			Draw_yuv_image_set_filter(&vid_yuv_image[i], enabled);
 	}
 }
 
+// presentation queue of the video texture slots (vid_image[slot * 4 + 0..3] or vid_yuv_image[slot])
+// the convert thread writes a free slot and queues it with its pts, the drawing thread presents the latest queued one that is due by the audio clock
+// queued frames overtaken by a later due frame are dropped without being drawn
+namespace FrameQueue {
+	enum class SlotState {
+		FREE,
+		WRITING, // acquired by the convert thread
+		QUEUED,
+		PRESENTED
+	};
+	SlotState state[VIDEO_TEX_SLOT_NUM];
+	double slot_pts[VIDEO_TEX_SLOT_NUM];
+	int presented = -1;
+	int dropped_num = 0; // for the debug info
+	double last_present_time = 0;
+	Handle free_event;
+	Handle lock_handle;
+	bool lock_initialized = false;
+	
+	void lock() {
+		if (!lock_initialized) {
+			svcCreateMutex(&lock_handle, false);
+			svcCreateEvent(&free_event, RESET_ONESHOT);
+			for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++) state[i] = SlotState::FREE;
+			lock_initialized = true;
+		}
+		svcWaitSynchronization(lock_handle, std::numeric_limits<s64>::max());
+	}
+	void release() { svcReleaseMutex(lock_handle); }
+	
+	double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+	// the queued slot to be presented at the audio position clock (-1 if the audio isn't playing), -1 if none is due
+	int find_due_wo_lock(double clock) {
+		int res = -1;
+		for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++) {
+			if (state[i] != SlotState::QUEUED) continue;
+			if (clock < 0) { // nothing to sync with, show them in order as soon as possible
+				if (res < 0 || slot_pts[i] < slot_pts[res]) res = i;
+			} else if (slot_pts[i] <= clock + PRESENT_EARLY_MARGIN) {
+				if (res < 0 || slot_pts[i] > slot_pts[res]) res = i;
+			}
+		}
+		return res;
+	}
+	
+	// convert thread, returns a slot to write the next frame to, or -1 if all of them are in use
+	int acquire() {
+		lock();
+		int res = -1;
+		for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++) if (state[i] == SlotState::FREE) {
+			state[i] = SlotState::WRITING;
+			res = i;
+			break;
+		}
+		release();
+		return res;
+	}
+	// convert thread, the frame with the pts is in the slot
+	void queue(int slot, double pts) {
+		lock();
+		state[slot] = SlotState::QUEUED;
+		slot_pts[slot] = pts;
+		release();
+	}
+	// convert thread, the slot was not written after all
+	void cancel(int slot) {
+		lock();
+		if (state[slot] == SlotState::WRITING) state[slot] = SlotState::FREE;
+		release();
+		svcSignalEvent(free_event);
+	}
+	// drawing thread, returns the slot to draw (-1 if no frame has been presented yet)
+	// the previously presented one is freed, which is safe as the drawing thread has waited for the previous frame in Draw_frame_ready()
+	int present(double clock) {
+		lock();
+		last_present_time = get_time_ms();
+		int next = find_due_wo_lock(clock);
+		if (next >= 0) {
+			for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++) {
+				if (i == next) continue;
+				if (state[i] == SlotState::PRESENTED) state[i] = SlotState::FREE;
+				if (state[i] == SlotState::QUEUED && slot_pts[i] < slot_pts[next]) {
+					state[i] = SlotState::FREE;
+					dropped_num++;
+				}
+			}
+			state[next] = SlotState::PRESENTED;
+			presented = next;
+			vid_current_pos = slot_pts[next];
+		}
+		int res = presented;
+		release();
+		if (next >= 0) svcSignalEvent(free_event);
+		return res;
+	}
+	// drawing thread, whether present() would show another frame (in the eco mode, nothing is drawn otherwise)
+	bool has_due_frame(double clock) {
+		lock();
+		bool res = find_due_wo_lock(clock) >= 0;
+		release();
+		return res;
+	}
+	// convert thread, called while acquire() fails
+	void wait_for_free_slot() {
+		lock();
+		bool drawing_stopped = get_time_ms() - last_present_time > PRESENT_TIMEOUT_MS;
+		release();
+		if (drawing_stopped) present(Util_speaker_clock_now(0)); // nobody else presents, keep the decoder going
+		svcWaitSynchronization(free_event, 5000000);
+	}
+	// frees the queued slots and the presented one too if including_presented is set
+	// the convert thread must not be writing any slot (it's holding network_decoder_critical_lock otherwise)
+	void clear(bool including_presented) {
+		lock();
+		for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++)
+			if (state[i] != SlotState::PRESENTED || including_presented) state[i] = SlotState::FREE;
+		if (including_presented) {
+			presented = -1;
+			dropped_num = 0;
+		}
+		release();
+		svcSignalEvent(free_event);
+	}
+	int get_dropped_num() {
+		lock();
+		int res = dropped_num;
+		release();
+		return res;
+	}
+}
+
+struct DecodedAudio {
+	u8 *data = NULL; // given by network_decoder.decode_audio(), to be returned with free_audio_buffer()
+	int size = 0;
+	double pts = 0;
+};
+// the speaker plays the decoded buffers as they are and gives them back here once played (in the decoding thread)
+static void release_audio_buffer(u8 *buffer, void *) { network_decoder.free_audio_buffer(buffer); }
+// decoded audio is set aside here so that video packets can still be decoded while the speaker queue is full
+// only touched by the thread decoding the audio : the decode thread, or audio_decode_thread with audio_decode_lock held while audio_split_active
+static network_decoder_::output_buffer<DecodedAudio> decoded_audio;
+static int decoded_audio_clear_cnt = 0;
+static void feed_speaker() {
+	while (DecodedAudio *cur = decoded_audio.get_next_poped()) {
+		if (Util_speaker_add_buffer(0, cur->data, cur->size, cur->pts, release_audio_buffer, NULL).code != 0) break; // still full
+		decoded_audio.pop();
+	}
+}
+static void clear_decoded_audio() {
+	decoded_audio_clear_cnt++;
+	while (DecodedAudio *cur = decoded_audio.get_next_poped()) {
+		network_decoder.free_audio_buffer(cur->data);
+		decoded_audio.pop();
+	}
+}
+static void lock_audio_decode() { svcWaitSynchronization(audio_decode_lock, std::numeric_limits<s64>::max()); }
+static void release_audio_decode() { svcReleaseMutex(audio_decode_lock); }
+// decodes the audio packet read last and queues the result for the speaker
+// `split` : called from audio_decode_thread, audio_decode_lock is given up while waiting for the queue to have space
+static void decode_audio_packet(bool split) {
+	TickCounter counter;
+	osTickCounterStart(&counter);
+	int audio_size = 0;
+	u8 *audio = NULL;
+	double pos = 0;
+	Result_with_string result = network_decoder.decode_audio(&audio_size, &audio, &pos);
+	osTickCounterUpdate(&counter);
+	vid_audio_time = osTickCounterRead(&counter);
+	
+	if (result.code == 0) {
+		double duration = vid_sample_rate ? audio_size / 2.0 / vid_sample_rate : 0; // s16 samples
+		vid_audio_total_time += vid_audio_time;
+		vid_audio_total_packets++;
+		vid_audio_total_duration += duration;
+		{
+			LightMutexGuard guard(audio_codec_costs_lock);
+			if (vid_audio_codec != "") {
+				AudioCodecCost &cost = audio_codec_costs[vid_audio_codec];
+				cost.decode_ms += vid_audio_time;
+				cost.duration += duration;
+			}
+		}
+		int clear_cnt = decoded_audio_clear_cnt;
+		feed_speaker();
+		while (decoded_audio.full() && vid_play_request && !vid_seek_request && !vid_change_video_request) {
+			// Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "audio queue full");
+			if (split) release_audio_decode();
+			vid_resume_event.wait(PAUSED_WAIT_TIMEOUT_NS); // returns right away unless paused
+			usleep(10000);
+			if (split) lock_audio_decode();
+			feed_speaker();
+		}
+		// the queue may have been cleared by a seek meanwhile, and the decoded audio would belong before it
+		DecodedAudio *slot = clear_cnt != decoded_audio_clear_cnt ? NULL : decoded_audio.get_next_pushed();
+		if (slot) {
+			slot->data = audio;
+			slot->size = audio_size;
+			slot->pts = pos;
+			decoded_audio.push();
+			audio = NULL;
+			feed_speaker();
+		}
+	} else Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Util_audio_decoder_decode()..." + result.string + result.error_description, result.code);
+	
+	network_decoder.free_audio_buffer(audio);
+}
+static void audio_decode_thread(void *arg) {
+	Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Audio thread started.");
+	
+	while (vid_thread_run) {
+		if (!audio_split_active) {
+			usleep(vid_thread_suspend ? DEF_INACTIVE_THREAD_SLEEP_TIME : DEF_ACTIVE_THREAD_SLEEP_TIME);
+			continue;
+		}
+		lock_audio_decode();
+		if (!audio_split_active || vid_buffering_ahead || vid_seek_request || vid_change_video_request || !vid_play_request) {
+			release_audio_decode();
+			usleep(10000);
+			continue;
+		}
+		if (network_decoder.prepare_packet(NetworkMultipleDecoder::DecodeType::AUDIO)) {
+			audio_eof = false;
+			decode_audio_packet(true);
+		} else {
+			if (!network_decoder.interrupt) audio_eof = true;
+			feed_speaker();
+		}
+		bool idle = audio_eof;
+		release_audio_decode();
+		if (idle) usleep(10000);
+	}
+	
+	Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Audio thread exit.");
+	threadExit(0);
+}
+// separate streams : reads the video packets ahead so that the decode thread (and the audio decoding) don't wait for the video data
+static void demux_thread(void *arg) {
+	Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Demux thread started.");
+	
+	while (vid_thread_run) {
+		if (network_decoder.demux_video_ahead()) continue;
+		if (vid_thread_suspend && !vid_play_request) usleep(DEF_INACTIVE_THREAD_SLEEP_TIME);
+		else network_decoder.wait_for_video_demux_space(DEMUX_IDLE_WAIT_NS);
+	}
+	
+	Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Demux thread exit.");
+	threadExit(0);
+}
+static void load_video_info() {
+	auto tmp = network_decoder.get_video_info();
+	vid_width = vid_width_org = tmp.width;
+	vid_height = vid_height_org = tmp.height;
+	vid_framerate = tmp.framerate;
+	vid_video_format = tmp.format_name;
+	vid_duration = tmp.duration;
+	vid_frametime = 1000.0 / vid_framerate;;
+
+	if(vid_width % 16 != 0)
+		vid_width += 16 - vid_width % 16;
+	if(vid_height % 16 != 0)
+		vid_height += 16 - vid_height % 16;
+}
 static void decode_thread(void* arg)
 {
 	Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Thread started.");
 
 	Result_with_string result;
 	int ch = 0;
-	int audio_size = 0;
 	int w = 0;
 	int h = 0;
 	double pos = 0;
 	bool key = false;
-	u8* audio = NULL;
 	std::string format = "";
 	std::string type = (char*)arg;
 	TickCounter counter0, counter1;
 	osTickCounterStart(&counter0);
 	osTickCounterStart(&counter1);
+	
+	decoded_audio.init(std::vector<DecodedAudio>(DECODED_AUDIO_QUEUE_SIZE + 1));
 
 	while (vid_thread_run)
 	{
@@ -910,15 +1924,21 @@ static void decode_thread(void* arg)
 			vid_zoom = 1;
 			vid_width = 0;
 			vid_height = 0;
-			vid_mvd_image_num = 0;
+			FrameQueue::clear(true);
 			vid_video_format = "n/a";
 			vid_audio_format = "n/a";
 			vid_change_video_request = false;
+			vid_switch_video_request = false;
 			vid_seek_request = false;
 			eof_reached = false;
 			vid_play_request = true;
 			vid_total_time = 0;
 			vid_total_frames = 0;
+			vid_decode_total_time = 0;
+			vid_decode_total_frames = 0;
+			vid_audio_total_time = 0;
+			vid_audio_total_packets = 0;
+			vid_audio_total_duration = 0;
 			vid_min_time = 99999999;
 			vid_max_time = 0;
 			vid_recent_total_time = 0;
@@ -942,19 +1962,36 @@ static void decode_thread(void* arg)
 			vid_copy_time[0] = 0;
 			vid_copy_time[1] = 0;
 			vid_convert_time = 0;
+			vid_av_drift = 0;
+			network_decoder.playback_pos = -1;
 			
 			// video page parsing sometimes randomly fails, so try several times
 			network_waiting_status = "Reading Stream";
-			if (audio_only_mode) {
-				result = network_decoder.init(cur_video_info.audio_stream_url, stream_downloader,
-					cur_video_info.is_livestream ? cur_video_info.stream_fragment_len : -1, cur_video_info.needs_timestamp_adjusting(), true);
-			} else if (video_p_value == 360 && cur_video_info.duration_ms <= 60 * 60 * 1000 && cur_video_info.both_stream_url != "") {
-				// itag 18 (both_stream) of a long video takes too much time and sometimes leads to a crash 
+			// from before the first request of the streams, so that the startup is in the trace too
+			if (var_network_trace) network_trace_start(get_video_id(cur_video_info.url));
+			network_decoder.disk_cache_id = "";
+			network_decoder.burst_download = audio_only_mode && var_audio_only_low_power;
+			network_decoder.low_latency = var_livestream_low_latency;
+			if (var_stream_disk_cache_enabled && !cur_video_info.is_livestream) network_decoder.disk_cache_id = get_video_id(cur_video_info.url);
+			OfflineVideo offline_video;
+			bool playing_offline = false;
+			std::pair<std::string, std::string> audio_stream; // {url, codec} when the audio has its own stream
+			if (!cur_video_info.is_livestream && offline_get_video(get_video_id(cur_video_info.url), &offline_video)) {
+				// saved for offline playback : no network access at all
+				playing_offline = true;
+				result = network_decoder.init(offline_get_video_path(offline_video.id), stream_downloader, -1, false, offline_video.quality == 360);
+			} else if (audio_only_mode) {
+				// no need for the hardware decoder and its work buffer
+				audio_stream = pick_audio_only_stream(cur_video_info);
+				result = network_decoder.init(audio_stream.first, stream_downloader,
+					cur_video_info.is_livestream ? cur_video_info.stream_fragment_len : -1, cur_video_info.needs_timestamp_adjusting(), false);
+			} else if (use_both_stream(cur_video_info, video_p_value)) {
 				result = network_decoder.init(cur_video_info.both_stream_url, stream_downloader,
 					cur_video_info.is_livestream ? cur_video_info.stream_fragment_len : -1, cur_video_info.needs_timestamp_adjusting(), true);
 			} else if (cur_video_info.video_stream_urls[(int) video_p_value] != "" && cur_video_info.audio_stream_url != "") {
-				result = network_decoder.init(cur_video_info.video_stream_urls[(int) video_p_value], cur_video_info.audio_stream_url, stream_downloader,
-					cur_video_info.is_livestream ? cur_video_info.stream_fragment_len : -1, cur_video_info.needs_timestamp_adjusting(), video_p_value == 360);
+				audio_stream = pick_separate_audio_stream(cur_video_info);
+				result = network_decoder.init(cur_video_info.video_stream_urls[(int) video_p_value], audio_stream.first, stream_downloader,
+					cur_video_info.is_livestream ? cur_video_info.stream_fragment_len : -1, cur_video_info.needs_timestamp_adjusting(), video_p_value == 360 || video_p_value == 480);
 			} else {
 				result.code = -1;
 				result.string = "YouTube parser error";
@@ -962,7 +1999,17 @@ static void decode_thread(void* arg)
 			}
 			
 			Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "network_decoder.init()..." + result.string + result.error_description, result.code);
+			{
+				LightMutexGuard guard(audio_codec_costs_lock);
+				vid_audio_codec = result.code == 0 ? audio_stream.second : "";
+			}
+			if (result.code == 0 && audio_stream.second != "") Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "audio codec : " + audio_stream.second);
 			if(result.code != 0) {
+				// the retry plays the usual audio stream
+				if (audio_stream.first != "" && audio_stream.first == cur_video_info.cheapest_audio_stream_url) {
+					Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "the cheapest audio stream failed, falling back");
+					cheapest_audio_failed_url = cur_video_info.url;
+				}
 				if (video_retry_left > 0) {
 					video_retry_left--;
 					Util_log_save("dec", "failed, retrying. retry cnt left:" + std::to_string(video_retry_left));
@@ -980,26 +2027,23 @@ static void decode_thread(void* arg)
 				{
 					auto tmp = network_decoder.get_audio_info();
 					// bitrate = tmp.bitrate;
-					vid_sample_rate = tmp.sample_rate;
-					ch = tmp.ch;
+					vid_sample_rate = tmp.output_sample_rate;
+					ch = tmp.output_ch;
 					vid_audio_format = tmp.format_name;
+					if (tmp.output_sample_rate != tmp.sample_rate || tmp.output_ch != tmp.ch)
+						vid_audio_format += " (" + std::to_string(tmp.sample_rate) + "Hz " + std::to_string(tmp.ch) + "ch -> " + std::to_string(vid_sample_rate) + "Hz " + std::to_string(ch) + "ch)";
 					vid_duration = tmp.duration;
 				}
+				Util_speaker_set_target_latency(0, AUDIO_TARGET_LATENCY_S);
 				Util_speaker_init(0, ch, vid_sample_rate);
-				{
-					auto tmp = network_decoder.get_video_info();
-					vid_width = vid_width_org = tmp.width;
-					vid_height = vid_height_org = tmp.height;
-					vid_framerate = tmp.framerate;
-					vid_video_format = tmp.format_name;
-					vid_duration = tmp.duration;
-					vid_frametime = 1000.0 / vid_framerate;;
-
-					if(vid_width % 16 != 0)
-						vid_width += 16 - vid_width % 16;
-					if(vid_height % 16 != 0)
-						vid_height += 16 - vid_height % 16;
-				}
+				vid_live_speed = 1.0;
+				load_video_info();
+				network_decoder.set_video_demux_enabled(true);
+			}
+			
+			if (vid_play_request && var_video_frame_profiling) {
+				frame_profiler_start(get_video_id(cur_video_info.url));
+				trace_start();
 			}
 			
 			if (seek_at_init_request >= 0) {
@@ -1008,13 +2052,50 @@ static void decode_thread(void* arg)
 				seek_at_init_request = -1;
 			}
 			
+			// 480p mode : the playback waits for some data to be buffered ahead, the audio is decoded on its own thread if possible
+			// and the video falls back to 360p if the decoding can't keep up
+			bool mode_480p = vid_play_request && !audio_only_mode && video_p_value == 480 && network_decoder.hw_decoder_enabled && vid_height_org > 360;
+			bool need_buffer_ahead = mode_480p;
+			bool end_notified = false; // vid_playback_ended has been set for the current end of the video
+			double decode_time_avg = 0;
+			int decode_time_frames = 0;
+			vid_buffering_ahead = need_buffer_ahead;
+			if (mode_480p && vid_audio_decode_thread && network_decoder.can_decode_concurrently()) {
+				lock_audio_decode();
+				audio_eof = false;
+				audio_split_active = true;
+				release_audio_decode();
+			}
+			if (mode_480p) Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, std::string("480p mode, audio on ") + (audio_split_active ? "its own thread" : "the decode thread"));
+			
+			// the quality is only switched among separate video streams, the playback restarting at a key frame
+			bool abr_enabled = vid_play_request && auto_quality_mode && !audio_only_mode && !playing_offline && !cur_video_info.is_livestream;
+			AbrStreamSet abr_streams;
+			if (abr_enabled) {
+				svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+				abr_streams = get_abr_streams(cur_video_info);
+				svcReleaseMutex(small_resource_lock);
+				abr_start_playback();
+			}
+			
 			osTickCounterUpdate(&counter1);
 			while (vid_play_request)
 			{
 				if (vid_seek_request && !vid_change_video_request) {
+					// repeated seeks (e.g. pressing the d-pad several times) : the playback goes on until the last one
+					if (osGetTime() < vid_last_seek_time + SEEK_COALESCE_MS) {
+						while (vid_seek_request && !vid_change_video_request && vid_play_request && osGetTime() < vid_seek_request_time + SEEK_COALESCE_MS) {
+							if (!audio_split_active) feed_speaker();
+							usleep(10000);
+						}
+					}
 					network_waiting_status = "Seeking";
+					bool audio_locked = audio_split_active;
+					if (audio_locked) lock_audio_decode(); // the audio decoding thread is now suspended
 					Util_speaker_clear_buffer(0);
+					clear_decoded_audio();
 					svcWaitSynchronization(network_decoder_critical_lock, std::numeric_limits<s64>::max()); // the converter thread is now suspended
+					FrameQueue::clear(false); // the frame before the seek stays on the screen until the first one after it is due
 					vid_current_pos = vid_seek_pos;
 					while (vid_seek_request && !vid_change_video_request && vid_play_request) {
 						svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
@@ -1034,53 +2115,111 @@ static void decode_thread(void* arg)
 						break;
 					}
 					svcReleaseMutex(network_decoder_critical_lock);
+					vid_last_seek_time = osGetTime();
+					need_buffer_ahead = vid_buffering_ahead = mode_480p;
+					if (audio_locked) release_audio_decode();
 					if (eof_reached) vid_pausing = false;
 					network_waiting_status = NULL;
 					var_need_reflesh = true;
 				}
+				if (vid_switch_video_request && !vid_seek_request && !vid_change_video_request) {
+					// only the video stream is replaced, the audio keeps playing from what's already decoded meanwhile
+					vid_switch_video_request = false;
+					network_waiting_status = "Switching quality";
+					svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+					int new_p_value = video_p_value;
+					std::string new_url = cur_video_info.video_stream_urls.count(new_p_value) ? cur_video_info.video_stream_urls[new_p_value] : "";
+					svcReleaseMutex(small_resource_lock);
+					
+					bool audio_locked = audio_split_active;
+					if (audio_locked) lock_audio_decode();
+					svcWaitSynchronization(network_decoder_critical_lock, std::numeric_limits<s64>::max()); // the converter thread is now suspended
+					FrameQueue::clear(false); // the last frame of the previous video stays until the new one catches up
+					if (new_url != "") {
+						// start from a key frame a bit ahead as the audio moves on while the new stream is being opened
+						result = network_decoder.change_video(new_url, new_p_value == 360 || new_p_value == 480, vid_current_pos + VIDEO_SWITCH_LEAD_SECONDS);
+						if (result.code == 0) load_video_info();
+					} else {
+						result.code = DEF_ERR_OTHER;
+						result.string = DEF_ERR_OTHER_STR;
+						result.error_description = "no video stream of " + std::to_string(new_p_value) + "p";
+					}
+					svcReleaseMutex(network_decoder_critical_lock);
+					if (audio_locked) release_audio_decode();
+					network_waiting_status = NULL;
+					Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "network_decoder.change_video(" + std::to_string(new_p_value) + "p)..." + result.string + result.error_description, result.code);
+					
+					if (result.code != 0) {
+						// reinit everything instead
+						metrics_add(Metric::DECODER_REINITS);
+						seek_at_init_request = vid_current_pos;
+						vid_change_video_request = true;
+					} else {
+						mode_480p = !audio_only_mode && new_p_value == 480 && network_decoder.hw_decoder_enabled && vid_height_org > 360;
+						if (mode_480p && !audio_split_active && vid_audio_decode_thread) {
+							lock_audio_decode();
+							audio_eof = false;
+							audio_split_active = true;
+							release_audio_decode();
+						}
+						decode_time_frames = 0;
+						if (abr_enabled) abr_start_playback();
+					}
+					var_need_reflesh = true;
+				}
 				if (vid_change_video_request || !vid_play_request) break;
 				vid_duration = network_decoder.get_duration();
 				
-				auto type = network_decoder.next_decode_type();
+				if (need_buffer_ahead) {
+					need_buffer_ahead = false;
+					network_waiting_status = "Buffering";
+					TickCounter buffering_counter;
+					osTickCounterStart(&buffering_counter);
+					while (!network_decoder.is_buffered_ahead(BUFFER_AHEAD_480P_SECONDS) && vid_play_request && !vid_seek_request && !vid_change_video_request) {
+						osTickCounterUpdate(&buffering_counter);
+						if (osTickCounterRead(&buffering_counter) > BUFFER_AHEAD_TIMEOUT_MS) break;
+						usleep(50000);
+					}
+					vid_buffering_ahead = false;
+					network_waiting_status = NULL;
+					continue;
+				}
+				
+				NetworkMultipleDecoder::DecodeType type;
+				if (audio_split_active) {
+					if (network_decoder.prepare_packet(NetworkMultipleDecoder::DecodeType::VIDEO)) type = NetworkMultipleDecoder::DecodeType::VIDEO;
+					else if (network_decoder.interrupt) type = NetworkMultipleDecoder::DecodeType::INTERRUPTED;
+					else if (audio_eof) type = NetworkMultipleDecoder::DecodeType::EoF;
+					else {
+						usleep(10000); // the rest of the audio is still being decoded
+						continue;
+					}
+				} else type = network_decoder.next_decode_type();
 				
 				if (type == NetworkMultipleDecoder::DecodeType::EoF) {
 					vid_pausing = true;
 					eof_reached = true;
+					if (!audio_split_active) feed_speaker();
+					if (!end_notified && decoded_audio.empty() && !Util_speaker_is_playing(0)) {
+						end_notified = true;
+						vid_playback_ended = true;
+					}
 					usleep(10000);
 					continue;
-				} else eof_reached = false;
+				} else eof_reached = end_notified = false;
 				
 				if (type == NetworkMultipleDecoder::DecodeType::AUDIO) {
-					osTickCounterUpdate(&counter0);
-					result = network_decoder.decode_audio(&audio_size, &audio, &pos);
-					osTickCounterUpdate(&counter0);
-					vid_audio_time = osTickCounterRead(&counter0);
-					
-					if(result.code == 0)
-					{
-						while(true)
-						{
-							result = Util_speaker_add_buffer(0, ch, audio, audio_size, pos);
-							if(result.code == 0 || !vid_play_request || vid_seek_request || vid_change_video_request)
-								break;
-							// Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "audio queue full");
-							
-							usleep(10000);
-						}
-					}
-					else
-						Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Util_audio_decoder_decode()..." + result.string + result.error_description, result.code);
-
-					free(audio);
-					audio = NULL;
+					decode_audio_packet(false);
 				} else if (type == NetworkMultipleDecoder::DecodeType::VIDEO) {
 					osTickCounterUpdate(&counter0);
 					result = network_decoder.decode_video(&w, &h, &key, &pos);
 					osTickCounterUpdate(&counter0);
 					
 					// Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "decoded a video packet at " + std::to_string(pos));
+					bool output_full = result.code == DEF_ERR_NEED_MORE_OUTPUT; // the decoder is ahead of the playback
 					while (result.code == DEF_ERR_NEED_MORE_OUTPUT && vid_play_request && !vid_seek_request && !vid_change_video_request) {
-						usleep(10000);
+						if (!audio_split_active) feed_speaker();
+						network_decoder.wait_for_video_output_space(DECODER_WAIT_TIMEOUT_NS);
 						osTickCounterUpdate(&counter0);
 						result = network_decoder.decode_video(&w, &h, &key, &pos);
 						osTickCounterUpdate(&counter0);
@@ -1102,26 +2241,97 @@ static void decode_thread(void* arg)
 					vid_time[0][319] = cur_frame_internval;
 					for (int i = 1; i < 320; i++) vid_time[0][i - 1] = vid_time[0][i];
 					
+					// the time spent waiting for the output buffer to have space is not decoding
+					if (output_full) cpu_limit_report_video_frame(0, 0, vid_frametime);
+					else {
+						cpu_limit_report_video_frame(vid_video_time, cur_frame_internval, vid_frametime);
+						vid_decode_total_time += vid_video_time;
+						vid_decode_total_frames++;
+						if (abr_enabled && result.code == 0) abr_report_video_frame(vid_video_time, vid_frametime);
+						if (mode_480p && result.code == 0) {
+							decode_time_avg = decode_time_frames ? decode_time_avg * (1 - FALLBACK_DECODE_TIME_SMOOTHING) + vid_video_time * FALLBACK_DECODE_TIME_SMOOTHING : vid_video_time;
+							decode_time_frames++;
+							if (decode_time_frames >= FALLBACK_MIN_FRAMES && decode_time_avg > vid_frametime && !vid_change_video_request) {
+								Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "480p decoding too slow (avg " + std::to_string(decode_time_avg).substr(0, 5) + "ms, budget " +
+									std::to_string(vid_frametime).substr(0, 5) + "ms), falling back to 360p");
+								svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+								// the same as choosing 360p in the quality selector ("OFF" and "Auto" come first), which stays at "Auto" if chosen
+								if (!auto_quality_mode) {
+									int selected_button = 2;
+									for (auto &i : cur_video_info.video_stream_urls) if (i.first < 360) selected_button++;
+									video_quality_selector_view->selected_button = selected_button;
+								}
+								send_quality_change_request_wo_lock(360);
+								svcReleaseMutex(small_resource_lock);
+								decode_time_frames = 0;
+								var_need_reflesh = true;
+							}
+						}
+					}
+					
 					if (vid_play_request && !vid_seek_request && !vid_change_video_request) {
 						if (result.code != 0)
 							Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "Util_video_decoder_decode()..." + result.string + result.error_description, result.code);
 					}
+					if (abr_enabled && result.code == 0 && key && vid_play_request && !vid_seek_request && !vid_change_video_request && !vid_switch_video_request) {
+						abr_report_throughput(stream_downloader.get_bandwidth_estimate());
+						int next_p_value = abr_next_quality(video_p_value, abr_streams);
+						if (next_p_value != video_p_value) {
+							svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+							send_quality_change_request_wo_lock(next_p_value);
+							svcReleaseMutex(small_resource_lock);
+							var_need_reflesh = true;
+						}
+					}
 				} else if (type == NetworkMultipleDecoder::DecodeType::INTERRUPTED) continue;
 				else Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "unknown type of packet");
 			}
 			
 			network_waiting_status = NULL;
+			vid_buffering_ahead = false;
 			
-			while (Util_speaker_is_playing(0) && vid_play_request) usleep(10000);
+			if (audio_split_active) {
+				// the audio is taken back from the audio decoding thread right away : it stops feeding the speaker on a pending
+				// vid_change_video_request, so waiting for it to empty decoded_audio would never end
+				lock_audio_decode();
+				audio_split_active = false;
+				release_audio_decode();
+			}
+			// the decoded audio is played out, unless another video is waiting
+			while (!decoded_audio.empty() && vid_play_request && !vid_change_video_request) {
+				feed_speaker();
+				usleep(10000);
+			}
+			clear_decoded_audio();
+			while (Util_speaker_is_playing(0) && vid_play_request && !vid_change_video_request) usleep(10000);
 			Util_speaker_exit(0);
 			
 			if(!vid_change_video_request)
 				vid_play_request = false;
 			
+			network_decoder.set_video_demux_enabled(false);
 			// make sure the convert thread stops before closing network_decoder
 			svcWaitSynchronization(network_decoder_critical_lock, std::numeric_limits<s64>::max()); // the converter thread is now suspended
 			network_decoder.deinit();
 			svcReleaseMutex(network_decoder_critical_lock);
+			frame_profiler_stop();
+			trace_stop();
+			network_trace_stop();
+			if (vid_decode_total_frames) {
+				Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, std::string("decode avg (") + (network_decoder.hw_decoder_enabled ? "hw" : "sw x" +
+					std::to_string(network_decoder.sw_decoder_active_thread_num)) + ", " + std::to_string(vid_width_org) + "x" + std::to_string(vid_height_org) + ") : " +
+					std::to_string(vid_decode_total_time / vid_decode_total_frames).substr(0, 5) + "ms over " + std::to_string(vid_decode_total_frames) + " frames");
+			}
+			if (vid_audio_total_packets) {
+				Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "audio decode avg (" + std::to_string(vid_sample_rate) + "Hz " + std::to_string(ch) + "ch) : " +
+					std::to_string(vid_audio_total_time / vid_audio_total_packets).substr(0, 5) + "ms over " + std::to_string(vid_audio_total_packets) + " packets");
+			}
+			// for the choice of the audio stream of the next playback
+			if (vid_audio_total_duration > 0 || (vid_decode_total_frames && vid_frametime > 0)) {
+				last_decode_load = (vid_audio_total_duration > 0 ? vid_audio_total_time / vid_audio_total_duration / 1000 : 0) +
+					(vid_decode_total_frames && vid_frametime > 0 ? vid_decode_total_time / vid_decode_total_frames / vid_frametime : 0);
+				Util_log_save(DEF_SAPP0_DECODE_THREAD_STR, "decode load : " + std::to_string((int) (last_decode_load * 100)) + "%");
+			}
 			
 			var_need_reflesh = true;
 			vid_pausing = false;
@@ -1139,6 +2349,227 @@ static void decode_thread(void* arg)
 	threadExit(0);
 }
 
+// MVD output tiling : the hardware decoder renders linear BGR565 frames, which the GX transfer engine tiles into vid_image instead of the CPU
+// GX commands go through the command queue of citro3d, so only the drawing thread may issue them :
+// the convert thread hands a frame over and must not let the decoder reuse it until the transfers are done (mvd_tiling_wait())
+#define MVD_TILING_PICKUP_TIMEOUT_MS 100 // the drawing thread stopped drawing the player, the frame is dropped
+#define MVD_TILING_TRANSFER_FLAGS (GX_TRANSFER_FLIP_VERT(1) | GX_TRANSFER_OUT_TILED(1) | GX_TRANSFER_RAW_COPY(0) | \
+	GX_TRANSFER_IN_FORMAT(GX_TRANSFER_FMT_RGB565) | GX_TRANSFER_OUT_FORMAT(GX_TRANSFER_FMT_RGB565) | GX_TRANSFER_SCALING(GX_TRANSFER_SCALE_NO))
+namespace MvdTiling {
+	enum class State {
+		IDLE,
+		PENDING, // handed over to the drawing thread
+		IN_FLIGHT // queued in the current frame of the drawing thread, done when the next frame begins
+	};
+	State state = State::IDLE;
+	u8 *source = NULL;
+	int width, height, height_org, slot;
+	double pts;
+	double request_time = 0;
+	u8 *buffer = NULL; // the tiled frame before it's copied into the texture with the row pitch of the texture
+	size_t buffer_size = 0;
+	Handle done_event;
+	Handle lock_handle;
+	bool lock_initialized = false;
+	
+	void lock() {
+		if (!lock_initialized) {
+			svcCreateMutex(&lock_handle, false);
+			svcCreateEvent(&done_event, RESET_ONESHOT);
+			lock_initialized = true;
+		}
+		svcWaitSynchronization(lock_handle, std::numeric_limits<s64>::max());
+	}
+	void release() { svcReleaseMutex(lock_handle); }
+	
+	// convert thread, the previous request must be done (wait() must have been called)
+	// slot is given by FrameQueue::acquire() and is queued once it's tiled
+	bool request(u8 *frame, int slot, double pts, int width, int height, int height_org) {
+		if (!video_frames_visible() || width > 1024 || height > 1024 || !osConvertVirtToPhys(frame)) return false;
+		size_t size = width * height * 2;
+		if (buffer_size < size) {
+			linearFree_concurrent(buffer, MemoryTag::DECODER);
+			buffer = (u8 *) linearAlloc_concurrent(size, MemoryTag::DECODER);
+			buffer_size = buffer ? size : 0;
+			if (!buffer) return false;
+		}
+		lock();
+		state = State::PENDING;
+		source = frame;
+		MvdTiling::width = width;
+		MvdTiling::height = height;
+		MvdTiling::height_org = height_org;
+		MvdTiling::slot = slot;
+		MvdTiling::pts = pts;
+		request_time = svcGetSystemTick() / CPU_TICKS_PER_MSEC;
+		release();
+		var_need_reflesh = true;
+		return true;
+	}
+	// convert thread, returns after the handed frame is no longer used (or the request is cancelled)
+	void wait() {
+		while (true) {
+			lock();
+			if (state == State::PENDING && svcGetSystemTick() / CPU_TICKS_PER_MSEC - request_time > MVD_TILING_PICKUP_TIMEOUT_MS) {
+				state = State::IDLE;
+				FrameQueue::cancel(slot);
+			}
+			State cur_state = state;
+			release();
+			if (cur_state == State::IDLE) break;
+			var_need_reflesh = true; // an in-flight request completes only when the next frame begins
+			svcWaitSynchronization(done_event, 5000000);
+		}
+	}
+	// drawing thread, right after Draw_frame_ready() (which waited for the previous frame, including its transfers)
+	void process() {
+		if (!lock_initialized) return;
+		lock();
+		if (state == State::IN_FLIGHT) {
+			state = State::IDLE;
+			svcSignalEvent(done_event);
+		}
+		if (state == State::PENDING) {
+			Image_data *image = &vid_image[slot * 4 + 0];
+			GX_DisplayTransfer((u32 *) source, GX_BUFFER_DIM(width, height), (u32 *) buffer, GX_BUFFER_DIM(width, height), MVD_TILING_TRANSFER_FLAGS);
+			// a row of 8x8 tiles is width * 8 pixels, the rest of the tile row of the texture is skipped (in units of 16 bytes)
+			GX_TextureCopy((u32 *) buffer, GX_BUFFER_DIM(width * 8 * 2 / 16, 0), (u32 *) image->c2d.tex->data,
+				GX_BUFFER_DIM(width * 8 * 2 / 16, (image->c2d.tex->width - width) * 8 * 2 / 16), width * height * 2, GX_TRANSFER_RAW_COPY(1));
+			Draw_c2d_image_set_area(image, width, height_org);
+			vid_image_is_yuv[slot] = false;
+			FrameQueue::queue(slot, pts);
+			state = State::IN_FLIGHT;
+		}
+		release();
+	}
+	void free_buffer() {
+		linearFree_concurrent(buffer, MemoryTag::DECODER);
+		buffer = NULL;
+		buffer_size = 0;
+	}
+}
+
+// draws the slot given by FrameQueue::present() with its top left corner at (x, y)
+static void draw_video_frame(int image_num, float x, float y, double zoom) {
+	if (vid_image_is_yuv[image_num]) {
+		Draw_yuv_texture(&vid_yuv_image[image_num], x, y, vid_width_org * zoom, vid_height_org * zoom);
+		return;
+	}
+	Draw_texture(vid_image[image_num * 4 + 0].c2d, x, y, vid_tex_width[image_num * 4 + 0] * zoom, vid_tex_height[image_num * 4 + 0] * zoom);
+	if(vid_width > 1024)
+		Draw_texture(vid_image[image_num * 4 + 1].c2d, (x + vid_tex_width[image_num * 4 + 0] * zoom), y, vid_tex_width[image_num * 4 + 1] * zoom, vid_tex_height[image_num * 4 + 1] * zoom);
+	if(vid_height > 1024)
+		Draw_texture(vid_image[image_num * 4 + 2].c2d, x, (y + vid_tex_width[image_num * 4 + 0] * zoom), vid_tex_width[image_num * 4 + 2] * zoom, vid_tex_height[image_num * 4 + 2] * zoom);
+	if(vid_width > 1024 && vid_height > 1024)
+		Draw_texture(vid_image[image_num * 4 + 3].c2d, (x + vid_tex_width[image_num * 4 + 0] * zoom), (y + vid_tex_height[image_num * 4 + 0] * zoom), vid_tex_width[image_num * 4 + 3] * zoom, vid_tex_height[image_num * 4 + 3] * zoom);
+}
+
+static bool mini_player_active() {
+	return var_video_mini_player && vid_thread_suspend && !video_skip_drawing && vid_play_request && network_decoder.ready && !audio_only_mode;
+}
+// the other scenes only redraw when something changed in the eco mode
+static void update_mini_player() {
+	if (mini_player_active() && FrameQueue::has_due_frame(Util_speaker_clock_now(0))) var_need_reflesh = true;
+}
+static double get_mini_player_zoom() {
+	return std::min((double) MINI_PLAYER_WIDTH / vid_width_org, (double) MINI_PLAYER_MAX_HEIGHT / vid_height_org);
+}
+void video_draw_mini_player() {
+	if (!mini_player_active()) return;
+	MvdTiling::process();
+	int image_num = FrameQueue::present(Util_speaker_clock_now(0));
+	if (image_num < 0 || vid_width_org <= 0 || vid_height_org <= 0) return;
+	
+	double zoom = get_mini_player_zoom();
+	float width = vid_width_org * zoom;
+	float height = vid_height_org * zoom;
+	float x = 400 - MINI_PLAYER_MARGIN - width;
+	float y = 240 - MINI_PLAYER_MARGIN - height;
+	Draw_texture(var_square_image[0], DEF_DRAW_BLACK, x - 1, y - 1, width + 2, height + 2);
+	draw_video_frame(image_num, x, y, zoom);
+}
+
+// the first tile of a slot is only as big as the video needs (a 1024x1024 one for 240p would waste 1.75 MB per slot)
+#define VIDEO_TILE_MIN_SIZE 64
+static int get_first_tile_size(int video_size) {
+	int res = VIDEO_TILE_MIN_SIZE;
+	while (res < video_size && res < 1024) res <<= 1;
+	return res;
+}
+
+// convert thread, the size the hardware decoder should render the next frames at (0 for the size of the video)
+// the frames are drawn stretched to the size of the video, so each direction only needs as many pixels as it has on the screen
+// (the top screen is 800 pixels wide in the high resolution mode), the videos bigger than a tile are left alone
+static void update_mvd_output_size() {
+	int max_width = 0, max_height = 0;
+	if (vid_width <= 1024 && vid_height <= 1024 && vid_width_org > 0 && vid_height_org > 0) {
+		double zoom = (vid_thread_suspend || !video_frames_visible()) ? get_mini_player_zoom() : vid_zoom;
+		max_width = std::ceil(vid_width * zoom * (var_high_resolution_mode ? 2 : 1));
+		max_height = std::ceil(vid_height * zoom);
+	}
+	network_decoder.mvd_output_max_width = max_width;
+	network_decoder.mvd_output_max_height = max_height;
+}
+
+// convert thread, the tiles other than the first one of the slot are needed only for videos bigger than 1024x1024
+// (the first one can also be missing, as the textures are freed during the audio-only playback)
+// the first one is allocated again when the size of the frames changed, which is safe as the GPU is done with the slots that can be acquired
+// `frame_width`, `frame_height` : the size of the frame to be written, smaller than the video if scaled down by the hardware decoder
+static Result_with_string alloc_tiles(int slot, int frame_width, int frame_height) {
+	Result_with_string result;
+	for (int i = 0; i < 4; i++) {
+		bool needed = i == 0 ? true : i == 1 ? vid_width > 1024 : i == 2 ? vid_height > 1024 : (vid_width > 1024 && vid_height > 1024);
+		int tex_width = i == 0 ? get_first_tile_size(frame_width) : 1024;
+		int tex_height = i == 0 ? get_first_tile_size(frame_height) : 1024;
+		Image_data *image = &vid_image[slot * 4 + i];
+		if (needed && image->subtex && (image->c2d.tex->width != tex_width || image->c2d.tex->height != tex_height)) {
+			Draw_c2d_image_free(*image, MemoryTag::VIDEO_TEXTURES);
+			image->subtex = NULL;
+		}
+		if (!needed || image->subtex) continue;
+		result = Draw_c2d_image_init(image, tex_width, tex_height, GPU_RGB565, MemoryTag::VIDEO_TEXTURES);
+		if (result.code != 0) {
+			Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_c2d_image_init()..." + result.string + result.error_description, result.code);
+			break;
+		}
+		Draw_c2d_image_set_filter(image, var_video_linear_filter);
+	}
+	return result;
+}
+
+// drawing thread, right after Draw_frame_ready() (the GPU is done with the textures by then), or the convert thread long after the last playback
+// the audio-only playback needs none of the video textures, alloc_tiles() allocates them again when a video is played
+static void free_video_textures() {
+	// the convert thread uses the textures only while holding the lock, which the decoder thread also holds for long while initing
+	if (svcWaitSynchronization(network_decoder_critical_lock, 0) != 0) return;
+	bool freed = false;
+	for (int i = 0; i < VIDEO_TEX_SLOT_NUM * 4; i++) {
+		if (vid_image[i].subtex) {
+			Draw_c2d_image_free(vid_image[i], MemoryTag::VIDEO_TEXTURES);
+			freed = true;
+		}
+		vid_image[i].subtex = NULL;
+	}
+	for (int i = 0; i < VIDEO_TEX_SLOT_NUM; i++) {
+		if (vid_yuv_image[i].initialized) freed = true;
+		Draw_yuv_image_free(&vid_yuv_image[i]);
+	}
+	MvdTiling::free_buffer();
+	svcReleaseMutex(network_decoder_critical_lock);
+	if (freed) Util_log_save(DEF_SAPP0_MAIN_STR, "video textures freed for the audio-only playback");
+}
+
+#define VIDEO_TEXTURE_IDLE_FREE_TIME 30000 // ms, the video textures are given back for the thumbnails after this long without playback
+// convert thread, `idle_since` : osGetTime() when the playback stopped, 0 while playing
+static void free_idle_video_textures(u64 &idle_since) {
+	if (vid_play_request || vid_change_video_request) {
+		idle_since = 0;
+		return;
+	}
+	if (!idle_since) idle_since = osGetTime();
+	else if (osGetTime() - idle_since >= VIDEO_TEXTURE_IDLE_FREE_TIME) free_video_textures(); // does nothing if already freed
+}
+
 static void convert_thread(void* arg)
 {
 	Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Thread started.");
@@ -1146,37 +2577,41 @@ static void convert_thread(void* arg)
 	u8* video = NULL;
 	TickCounter counter0, counter1;
 	Result_with_string result;
+	double last_network_wait_time = 0; // for the frame profiler
+	int consecutive_drop_num = 0;
+	u64 idle_since = 0;
 
 	osTickCounterStart(&counter0);
 	
-	y2rInit();
+	result = Util_converter_y2r_init();
+	if (result.code != 0) Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Util_converter_y2r_init()..." + result.string + result.error_description, result.code);
 
 	while (vid_thread_run)
 	{
-		if (vid_play_request && !vid_seek_request && !vid_change_video_request)
+		// nothing to convert in the audio-only mode, the position is updated by the drawing thread
+		if (vid_play_request && !vid_seek_request && !vid_change_video_request && !audio_only_mode)
 		{
 			svcWaitSynchronization(network_decoder_critical_lock, std::numeric_limits<s64>::max());
 			while(vid_play_request && !vid_seek_request && !vid_change_video_request)
 			{
 				double pts;
+				// the frame size from the hardware decoder, the textures are still drawn at the size of the video
+				int frame_width = 0, frame_height = 0;
+				MvdTiling::wait(); // the frame handed to the drawing thread is valid only until the next get_decoded_video_frame()
+				update_mvd_output_size();
 				do {
 					osTickCounterUpdate(&counter1);
 					osTickCounterUpdate(&counter0);
-					result = network_decoder.get_decoded_video_frame(vid_width, vid_height, network_decoder.hw_decoder_enabled ? &video : &yuv_video, &pts);
+					result = network_decoder.get_decoded_video_frame(vid_width, vid_height, network_decoder.hw_decoder_enabled ? &video : &yuv_video, &pts, &frame_width, &frame_height);
 					osTickCounterUpdate(&counter0);
 					if (result.code != DEF_ERR_NEED_MORE_INPUT) break;
-					if (vid_pausing || vid_pausing_seek) usleep(10000);
-					else usleep(3000);
+					if (vid_pausing || vid_pausing_seek) {
+						vid_resume_event.wait(PAUSED_WAIT_TIMEOUT_NS); // returns right away unless paused
+						usleep(10000);
+					} else network_decoder.wait_for_decoded_video_frame(DECODER_WAIT_TIMEOUT_NS);
 				} while (vid_play_request && !vid_seek_request && !vid_change_video_request && !audio_only_mode);
 				
-				if (audio_only_mode) {
-					while (audio_only_mode && vid_play_request && !vid_seek_request && !vid_change_video_request) {
-						double tmp = Util_speaker_get_current_timestamp(0, vid_sample_rate);
-						if (tmp != -1) vid_current_pos = tmp;
-						usleep(50000);
-					}
-					break;
-				}
+				if (audio_only_mode) break;
 				if (!vid_play_request || vid_seek_request || vid_change_video_request) break;
 				if (result.code != 0) { // this is an unexpected error
 					Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "failure getting decoded result" + result.string + result.error_description, result.code);
@@ -1185,108 +2620,185 @@ static void convert_thread(void* arg)
 				}
 				
 				bool video_need_free = false;
+				bool converted_to_texture = false; // y2r wrote the frame straight into vid_image, so there is nothing to copy
+				bool uploaded_yuv = false; // the planes went to vid_yuv_image and the GPU converts them while drawing
 				vid_copy_time[0] = osTickCounterRead(&counter0);
 				
+				double cur_sound_pos = Util_speaker_clock_now(0);
+				double av_drift = cur_sound_pos < 0 ? 0 : (pts - cur_sound_pos) * 1000;
+				vid_av_drift = av_drift;
+				// lets the software decoder skip frames when it falls behind
+				network_decoder.playback_pos = cur_sound_pos < 0 ? -1 : cur_sound_pos;
+				
+				// a frame already late by more than a frame is dropped before any time is spent on it
+				// (only a few in a row so that the picture keeps moving even if the decoder can't keep up at all)
+				bool late = av_drift < -vid_frametime;
+				bool visible = video_frames_visible();
+				bool drop = !visible || (late && consecutive_drop_num < MAX_CONSECUTIVE_FRAME_DROP);
+				consecutive_drop_num = late && drop ? consecutive_drop_num + 1 : 0;
+				if (!visible) {
+					// nobody presents the frames, so keep the decoding in step with the audio and update the position here
+					while (vid_play_request && !vid_seek_request && !vid_change_video_request && !audio_only_mode) {
+						if (vid_pausing || vid_pausing_seek) {
+							vid_resume_event.wait(PAUSED_WAIT_TIMEOUT_NS);
+							usleep(10000);
+							continue;
+						}
+						double clock = Util_speaker_clock_now(0);
+						if (clock < 0 || pts <= clock + PRESENT_EARLY_MARGIN) break;
+						usleep(DEF_ACTIVE_THREAD_SLEEP_TIME);
+					}
+					vid_current_pos = pts;
+				}
+				int frame_height_org = frame_height == vid_height ? vid_height_org : (vid_height_org * frame_height + vid_height - 1) / vid_height;
+				
+				// we don't want to include the time waiting for a free slot in the performance profiling
+				osTickCounterUpdate(&counter1);
+				double cur_convert_time = osTickCounterRead(&counter1);
+				int slot = -1;
+				if (!drop) {
+					while ((slot = FrameQueue::acquire()) < 0 && vid_play_request && !vid_seek_request && !vid_change_video_request)
+						FrameQueue::wait_for_free_slot();
+					if (slot < 0) break;
+				}
+				osTickCounterUpdate(&counter1);
+				
 				osTickCounterUpdate(&counter0);
-				if (!network_decoder.hw_decoder_enabled) {
-					result = Util_converter_y2r_yuv420p_to_bgr565(yuv_video, &video, vid_width, vid_height, false);
-					video_need_free = true;
+				if (!drop) result = alloc_tiles(slot, frame_width, frame_height);
+				if (!drop && result.code == 0 && !network_decoder.hw_decoder_enabled) {
+					if (var_video_yuv_converter == 1 && vid_width <= YUV_TEX_WIDTH && vid_height <= YUV_TEX_HEIGHT && !vid_yuv_image[slot].initialized) {
+						result = Draw_yuv_image_init(&vid_yuv_image[slot], YUV_TEX_WIDTH, YUV_TEX_HEIGHT);
+						if (result.code != 0) Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_yuv_image_init()..." + result.string + result.error_description, result.code);
+						else Draw_yuv_image_set_filter(&vid_yuv_image[slot], var_video_linear_filter);
+						result.code = 0; // falls back to y2r
+					}
+					if (var_video_yuv_converter == 1 && vid_width <= YUV_TEX_WIDTH && vid_height <= YUV_TEX_HEIGHT && vid_yuv_image[slot].initialized) {
+						result = Draw_yuv_set_texture_data(&vid_yuv_image[slot], yuv_video, vid_width, vid_height);
+						uploaded_yuv = true;
+					} else if (vid_width <= 1024 && vid_height <= 1024) {
+						// the slot is neither presented nor queued, so nobody draws it meanwhile
+						C3D_Tex *tex = vid_image[slot * 4 + 0].c2d.tex;
+						u8 *texture = (u8 *) tex->data;
+						if (var_video_yuv_converter == 2) {
+							result = Util_converter_yuv420p_to_texture_armv6(yuv_video, texture, vid_width, vid_height, tex->width);
+							if (result.code == 0) C3D_TexFlush(tex);
+						} else result = Util_converter_y2r_yuv420p_to_texture(yuv_video, texture, vid_width, vid_height, tex->width);
+						converted_to_texture = true;
+					} else {
+						result = Util_converter_y2r_yuv420p_to_bgr565(yuv_video, &video, vid_width, vid_height, false);
+						video_need_free = true;
+					}
+					vid_convert_on_gpu = uploaded_yuv;
 				}
 				osTickCounterUpdate(&counter0);
-				vid_convert_time = osTickCounterRead(&counter0);
-				
-				double cur_convert_time = 0;
+				if (!drop) vid_convert_time = osTickCounterRead(&counter0);
 				
 				if(result.code == 0)
 				{
-					if(vid_width > 1024 && vid_height > 1024)
+					if (drop) {
+						// nothing to draw
+					} else if(vid_width > 1024 && vid_height > 1024)
 					{
-						vid_tex_width[vid_mvd_image_num * 4 + 0] = 1024;
-						vid_tex_width[vid_mvd_image_num * 4 + 1] = vid_width_org - 1024;
-						vid_tex_width[vid_mvd_image_num * 4 + 2] = 1024;
-						vid_tex_width[vid_mvd_image_num * 4 + 3] = vid_width_org - 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 0] = 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 1] = 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 2] = vid_height_org - 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 3] = vid_height_org - 1024;
+						vid_tex_width[slot * 4 + 0] = 1024;
+						vid_tex_width[slot * 4 + 1] = vid_width_org - 1024;
+						vid_tex_width[slot * 4 + 2] = 1024;
+						vid_tex_width[slot * 4 + 3] = vid_width_org - 1024;
+						vid_tex_height[slot * 4 + 0] = 1024;
+						vid_tex_height[slot * 4 + 1] = 1024;
+						vid_tex_height[slot * 4 + 2] = vid_height_org - 1024;
+						vid_tex_height[slot * 4 + 3] = vid_height_org - 1024;
 					}
 					else if(vid_width > 1024)
 					{
-						vid_tex_width[vid_mvd_image_num * 4 + 0] = 1024;
-						vid_tex_width[vid_mvd_image_num * 4 + 1] = vid_width_org - 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 0] = vid_height_org;
-						vid_tex_height[vid_mvd_image_num * 4 + 1] = vid_height_org;
+						vid_tex_width[slot * 4 + 0] = 1024;
+						vid_tex_width[slot * 4 + 1] = vid_width_org - 1024;
+						vid_tex_height[slot * 4 + 0] = vid_height_org;
+						vid_tex_height[slot * 4 + 1] = vid_height_org;
 					}
 					else if(vid_height > 1024)
 					{
-						vid_tex_width[vid_mvd_image_num * 4 + 0] = vid_width_org;
-						vid_tex_width[vid_mvd_image_num * 4 + 1] = vid_width_org;
-						vid_tex_height[vid_mvd_image_num * 4 + 0] = 1024;
-						vid_tex_height[vid_mvd_image_num * 4 + 1] = vid_height_org - 1024;
+						vid_tex_width[slot * 4 + 0] = vid_width_org;
+						vid_tex_width[slot * 4 + 1] = vid_width_org;
+						vid_tex_height[slot * 4 + 0] = 1024;
+						vid_tex_height[slot * 4 + 1] = vid_height_org - 1024;
 					}
 					else
 					{
-						vid_tex_width[vid_mvd_image_num * 4 + 0] = vid_width_org;
-						vid_tex_height[vid_mvd_image_num * 4 + 0] = vid_height_org;
+						vid_tex_width[slot * 4 + 0] = vid_width_org;
+						vid_tex_height[slot * 4 + 0] = vid_height_org;
 					}
 					
-					// we don't want to include the sleep time in the performance profiling
 					osTickCounterUpdate(&counter0);
-					vid_copy_time[1] = osTickCounterRead(&counter0);
-					osTickCounterUpdate(&counter1);
-					cur_convert_time = osTickCounterRead(&counter1);
 					
-					// sync with sound
-					double cur_sound_pos = Util_speaker_get_current_timestamp(0, vid_sample_rate);
-					// Util_log_save("conv", "pos : " + std::to_string(pts) + " / " + std::to_string(cur_sound_pos));
-					if (cur_sound_pos < 0) { // sound is not playing, probably because the video is lagging behind, so draw immediately
-						
+					// the drawing thread presents the queued slot when the audio reaches its pts
+					if (drop) {
+						// nothing to draw
+					} else if (uploaded_yuv) {
+						Draw_yuv_image_set_area(&vid_yuv_image[slot], vid_width_org, vid_height_org);
+						vid_image_is_yuv[slot] = true;
+						FrameQueue::queue(slot, pts);
+					} else if (converted_to_texture) {
+						Draw_c2d_image_set_area(&vid_image[slot * 4 + 0], vid_width, vid_height_org);
+						vid_image_is_yuv[slot] = false;
+						FrameQueue::queue(slot, pts);
+					} else if (network_decoder.hw_decoder_enabled && MvdTiling::request(video, slot, pts, frame_width, frame_height, frame_height_org)) {
+						// the drawing thread tiles it and queues the slot
 					} else {
-						while (pts - cur_sound_pos > 0.003 && vid_play_request && !vid_seek_request && !vid_change_video_request) {
-							usleep((pts - cur_sound_pos - 0.0015) * 1000000);
-							cur_sound_pos = Util_speaker_get_current_timestamp(0, vid_sample_rate);
-							if (cur_sound_pos < 0) break;
-						}
-					}
-					vid_current_pos = pts;
-					
-					osTickCounterUpdate(&counter0);
-					osTickCounterUpdate(&counter1);
-					
-					if (!video_skip_drawing) {
-						result = Draw_set_texture_data(&vid_image[vid_mvd_image_num * 4 + 0], video, vid_width, vid_height_org, 1024, 1024, GPU_RGB565);
+						C3D_Tex *tex = vid_image[slot * 4 + 0].c2d.tex;
+						result = Draw_set_texture_data(&vid_image[slot * 4 + 0], video, frame_width, frame_height_org, tex->width, tex->height, GPU_RGB565);
 						if(result.code != 0)
 							Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_set_texture_data()..." + result.string + result.error_description, result.code);
 
 						if(vid_width > 1024)
 						{
-							result = Draw_set_texture_data(&vid_image[vid_mvd_image_num * 4 + 1], video, vid_width, vid_height_org, 1024, 0, 1024, 1024, GPU_RGB565);
+							result = Draw_set_texture_data(&vid_image[slot * 4 + 1], video, vid_width, vid_height_org, 1024, 0, 1024, 1024, GPU_RGB565);
 							if(result.code != 0)
 								Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_set_texture_data()..." + result.string + result.error_description, result.code);
 						}
 						if(vid_height > 1024)
 						{
-							result = Draw_set_texture_data(&vid_image[vid_mvd_image_num * 4 + 2], video, vid_width, vid_height_org, 0, 1024, 1024, 1024, GPU_RGB565);
+							result = Draw_set_texture_data(&vid_image[slot * 4 + 2], video, vid_width, vid_height_org, 0, 1024, 1024, 1024, GPU_RGB565);
 							if(result.code != 0)
 								Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_set_texture_data()..." + result.string + result.error_description, result.code);
 						}
 						if(vid_width > 1024 && vid_height > 1024)
 						{
-							result = Draw_set_texture_data(&vid_image[vid_mvd_image_num * 4 + 3], video, vid_width, vid_height_org, 1024, 1024, 1024, 1024, GPU_RGB565);
+							result = Draw_set_texture_data(&vid_image[slot * 4 + 3], video, vid_width, vid_height_org, 1024, 1024, 1024, 1024, GPU_RGB565);
 							if(result.code != 0)
 								Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Draw_set_texture_data()..." + result.string + result.error_description, result.code);
 						}
 
-						vid_mvd_image_num = !vid_mvd_image_num;
+						vid_image_is_yuv[slot] = false;
+						FrameQueue::queue(slot, pts);
 					}
 
 					osTickCounterUpdate(&counter0);
-					vid_copy_time[1] += osTickCounterRead(&counter0);
+					if (!drop) vid_copy_time[1] = osTickCounterRead(&counter0);
 					
-					var_need_reflesh = true;
+					if (frame_profiler_is_running()) {
+						FrameProfileRecord record;
+						record.pts = pts;
+						record.decode_time = vid_video_time;
+						record.convert_time = drop ? 0 : vid_convert_time;
+						record.copy_time = drop ? 0 : vid_copy_time[1];
+						record.av_drift = av_drift;
+						record.network_wait_time = network_decoder.network_wait_time - last_network_wait_time;
+						record.late = late;
+						record.skipped = drop;
+						frame_profiler_record(record);
+					}
+					if (playback_benchmark_is_running()) playback_benchmark_on_frame(drop, late, vid_video_time, vid_convert_time);
+					telemetry_on_frame(drop, vid_video_time, vid_convert_time);
+					if (drop) metrics_add(Metric::FRAMES_DROPPED);
+					last_network_wait_time = network_decoder.network_wait_time;
+					
+					if (!drop) var_need_reflesh = true;
 				}
 				else
+				{
 					Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Util_converter_yuv420p_to_bgr565()..." + result.string + result.error_description, result.code);
+					if (slot >= 0) FrameQueue::cancel(slot);
+				}
 
 				if (video_need_free) free(video);
 				video = NULL;
@@ -1298,19 +2810,43 @@ static void convert_thread(void* arg)
 				for(int i = 1; i < 320; i++)
 					vid_time[1][i - 1] = vid_time[1][i];
 			}
+			MvdTiling::wait();
 			svcReleaseMutex(network_decoder_critical_lock);
-		} else usleep(DEF_ACTIVE_THREAD_SLEEP_TIME);
+		} else {
+			free_idle_video_textures(idle_since);
+			usleep(audio_only_mode ? DEF_INACTIVE_THREAD_SLEEP_TIME : DEF_ACTIVE_THREAD_SLEEP_TIME);
+		}
 
-		while (vid_thread_suspend && !vid_play_request && !vid_change_video_request)
+		while (vid_thread_suspend && !vid_play_request && !vid_change_video_request) {
+			free_idle_video_textures(idle_since);
 			usleep(DEF_INACTIVE_THREAD_SLEEP_TIME);
+		}
 	}
 	
-	y2rExit();
+	Util_converter_y2r_exit();
 	
 	Util_log_save(DEF_SAPP0_CONVERT_THREAD_STR, "Thread exit.");
 	threadExit(0);
 }
 
+void VideoPlayer_restore_session(const PlayerSession &session) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	if (session.video_info.is_playable()) {
+		video_info_cache.put(session.url, session.video_info);
+		restored_page_url = session.url;
+	}
+	video_p_value = session.video_p_value;
+	audio_only_mode = session.audio_only_mode;
+	auto_quality_mode = session.auto_quality_mode;
+	seek_at_init_request = session.position;
+	// saved again only after the position is updated by the playback
+	player_session_saved = true;
+	player_session_save_time = osGetTime();
+	svcReleaseMutex(small_resource_lock);
+	Util_log_save("player/session", "restoring " + session.url + " at " + std::to_string(session.position) + "s" +
+		(session.video_info.is_playable() ? "" : " (parsing the page)"));
+}
+
 void VideoPlayer_resume(std::string arg)
 {
 	if (arg != "") {
@@ -1330,6 +2866,13 @@ void VideoPlayer_suspend(void)
 {
 	vid_thread_suspend = true;
 	vid_main_run = false;
+	var_low_power_playing = false;
+}
+
+static void shed_video_info_cache(MemoryPressure level) {
+	svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
+	video_info_cache.shed(level);
+	svcReleaseMutex(small_resource_lock);
 }
 
 void VideoPlayer_init(void)
@@ -1339,9 +2882,16 @@ void VideoPlayer_init(void)
 	Result_with_string result;
 	
 	vid_thread_run = true;
+	vid_resume_event.signal(); // LightEvent starts cleared
 	
 	svcCreateMutex(&network_decoder_critical_lock, false);
+	svcCreateMutex(&audio_decode_lock, false);
 	svcCreateMutex(&small_resource_lock, false);
+	video_page_token = async_task_create_token();
+	// replies of different comments are loaded side by side, the parser bounds the requests by its session lists
+	async_task_set_max_concurrency(load_more_replies, REPLY_LOAD_CONCURRENCY);
+	network_lifecycle_add_resume_handler(prewarm_current_streams);
+	memory_pressure_add_handler(shed_video_info_cache, MemoryShedPriority::PAGE_RESULTS);
 	
 	for (int i = 0; i < TAB_MAX_NUM; i++) scroller[i] = VerticalScroller(0, 320, 0, CONTENT_Y_HIGH);
 	tab_selector_scroller = VerticalScroller(0, 320, CONTENT_Y_HIGH, CONTENT_Y_HIGH + TAB_SELECTOR_HEIGHT);
@@ -1384,13 +2934,16 @@ void VideoPlayer_init(void)
 		->set_title([](const SelectorView &view) { return LOCALIZED(VIDEO); });
 	debug_info_view = (new VerticalListView(0, 0, 320))
 		->set_views({
-			(new TextView(SMALL_MARGIN, 0, 320, DEFAULT_FONT_INTERVAL * 7))->set_text_lines<std::function<std::string ()> >({
+			(new TextView(SMALL_MARGIN, 0, 320, DEFAULT_FONT_INTERVAL * 8))->set_text_lines<std::function<std::string ()> >({
 				[] () { return vid_video_format; },
 				[] () { return vid_audio_format; },
 				[] () {
 					return std::to_string(vid_width_org) + "x" + std::to_string(vid_height_org) + "@" + std::to_string(vid_framerate).substr(0, 5) + "fps";
 				},
-				[] () { return LOCALIZED(HW_DECODER) + " : " + LOCALIZED_ENABLED_STATUS(network_decoder.hw_decoder_enabled); },
+				[] () {
+					return LOCALIZED(HW_DECODER) + " : " + LOCALIZED_ENABLED_STATUS(network_decoder.hw_decoder_enabled) +
+						(network_decoder.hw_decoder_enabled ? "" : " (" + std::to_string(network_decoder.sw_decoder_active_thread_num) + " " + LOCALIZED(THREADS) + ")");
+				},
 				[] () {
 					const char *message = get_network_waiting_status();
 					return LOCALIZED(WAITING_STATUS) + " : " + std::string(message ? message : "");
@@ -1398,10 +2951,13 @@ void VideoPlayer_init(void)
 				[] () {
 					u32 cpu_limit;
 					APT_GetAppCpuTimeLimit(&cpu_limit);
-					return LOCALIZED(CPU_LIMIT) + " : " + std::to_string(cpu_limit) + "%";
+					return LOCALIZED(CPU_LIMIT) + " : " + std::to_string(cpu_limit) + "%" + (cpu_limit_decoder_is_demanding() ? " (decoder)" : "");
 				},
 				[] () {
 					return LOCALIZED(FORWARD_BUFFER) + " : " + (cur_video_info.is_livestream && network_decoder.ready ? std::to_string(network_decoder.get_forward_buffer()) : "N/A");
+				},
+				[] () {
+					return "A/V drift : " + std::to_string((int) vid_av_drift) + "ms, skipped frames : " + std::to_string(network_decoder.skipped_frame_num);
 				}
 			}),
 			(new HorizontalRuleView(0, 0, 320, SMALL_MARGIN * 2)),
@@ -1423,14 +2979,59 @@ void VideoPlayer_init(void)
 				}
 
 				Draw("Deadline : " + std::to_string(vid_frametime).substr(0, 5) + "ms", 0, y + 100, 0.4, 0.4, 0xFFFFFF00);
-				Draw("Video decode : " + std::to_string(vid_video_time).substr(0, 5) + "ms", 0, y + 110, 0.4, 0.4, DEF_DRAW_RED);
-				Draw("Audio decode : " + std::to_string(vid_audio_time).substr(0, 5) + "ms", 0, y + 120, 0.4, 0.4, DEF_DRAW_RED);
+				Draw("Dropped : " + std::to_string(FrameQueue::get_dropped_num()), 160, y + 100, 0.4, 0.4, 0xFFFFFF00);
+				Draw("Video decode : " + std::to_string(vid_video_time).substr(0, 5) + "ms" +
+					(vid_decode_total_frames ? " (avg " + std::to_string(vid_decode_total_time / vid_decode_total_frames).substr(0, 5) + ")" : ""), 0, y + 110, 0.4, 0.4, DEF_DRAW_RED);
+				Draw("Audio decode : " + std::to_string(vid_audio_time).substr(0, 5) + "ms" +
+					(vid_audio_total_packets ? " (avg " + std::to_string(vid_audio_total_time / vid_audio_total_packets).substr(0, 5) + ")" : "") +
+					" resample : " + std::to_string(network_decoder.audio_resample_time).substr(0, 5) + "ms", 0, y + 120, 0.4, 0.4, DEF_DRAW_RED);
 				//Draw("Data copy 0 : " + std::to_string(vid_copy_time[0]).substr(0, 5) + "ms", 160, 120, 0.4, 0.4, DEF_DRAW_BLUE);
-				Draw("Color convert : " + std::to_string(vid_convert_time).substr(0, 5) + "ms", 160, y + 110, 0.4, 0.4, DEF_DRAW_BLUE);
+				Draw(std::string(vid_convert_on_gpu ? "GPU upload : " : "Color convert : ") + std::to_string(vid_convert_time).substr(0, 5) + "ms", 160, y + 110, 0.4, 0.4, DEF_DRAW_BLUE);
 				Draw("Data copy 1 : " + std::to_string(vid_copy_time[1]).substr(0, 5) + "ms", 160, y + 120, 0.4, 0.4, DEF_DRAW_BLUE);
 				Draw("Thread 0 : " + std::to_string(vid_time[0][319]).substr(0, 6) + "ms", 0, y + 130, 0.5, 0.5, DEF_DRAW_RED);
 				Draw("Thread 1 : " + std::to_string(vid_time[1][319]).substr(0, 6) + "ms", 160, y + 130, 0.5, 0.5, DEF_DRAW_BLUE);
 				Draw("Zoom : x" + std::to_string(vid_zoom).substr(0, 5) + " X : " + std::to_string((int)vid_x) + " Y : " + std::to_string((int)vid_y), 0, y + 140, 0.5, 0.5, DEFAULT_TEXT_COLOR);
+				{
+					// share of a core per codec, the one being decoded marked with *
+					std::string costs_str;
+					LightMutexGuard guard(audio_codec_costs_lock);
+					for (auto &cost : audio_codec_costs) if (cost.second.duration > 0) {
+						costs_str += " " + cost.first + (cost.first == vid_audio_codec ? "*" : "") + " " +
+							std::to_string(cost.second.ms_per_second() / 10).substr(0, 4) + "%";
+					}
+					Draw("Audio cost :" + (costs_str.size() ? costs_str : std::string(" N/A")) +
+						(last_decode_load >= 0 ? ", last load " + std::to_string((int) (last_decode_load * 100)) + "%" : ""), 0, y + 150, 0.4, 0.4, DEF_DRAW_RED);
+				}
+			}),
+			(new HorizontalRuleView(0, 0, 320, SMALL_MARGIN * 2)),
+			(new CustomView(0, 0, 320, NETWORK_STATS_HOSTS_SHOWN * 20))->set_draw([] (const CustomView &view) {
+				auto to_ms_str = [] (double ms) { return ms < 0 ? std::string("-") : std::to_string((int) ms); };
+				int y = view.y0;
+				
+				// per host network stats of the recent requests
+				auto stats = network_stats_get();
+				if (stats.size() > NETWORK_STATS_HOSTS_SHOWN) stats.resize(NETWORK_STATS_HOSTS_SHOWN);
+				for (auto &host_stats : stats) {
+					std::string host = host_stats.host.size() > 40 ? host_stats.host.substr(0, 37) + "..." : host_stats.host;
+					Draw(host + " (" + std::to_string(host_stats.request_num) + ") p50 " + to_ms_str(host_stats.latency_p50) + "ms p95 " +
+						to_ms_str(host_stats.latency_p95) + "ms " + std::to_string((int) host_stats.throughput) + "KB/s", SMALL_MARGIN, y, 0.4, 0.4, DEFAULT_TEXT_COLOR);
+					const NetworkTiming &last = host_stats.last;
+					Draw("last : dns " + to_ms_str(last.dns) + " conn " + to_ms_str(last.connect) + " tls " + to_ms_str(last.tls) + " ttfb " +
+						to_ms_str(last.first_byte) + " total " + to_ms_str(last.total) + "ms " + std::to_string(last.bytes / 1000) + "KB",
+						SMALL_MARGIN, y + 10, 0.4, 0.4, LIGHT0_TEXT_COLOR);
+					y += 20;
+				}
+			}),
+			(new HorizontalRuleView(0, 0, 320, SMALL_MARGIN * 2)),
+			(new CustomView(0, 0, 320, ASYNC_TASK_PRIORITY_NUM * 10))->set_draw([] (const CustomView &view) {
+				const char *priority_names[ASYNC_TASK_PRIORITY_NUM] = {"interactive", "visible", "prefetch"};
+				// how long the tasks had to wait for a worker
+				for (int i = 0; i < ASYNC_TASK_PRIORITY_NUM; i++) {
+					auto stats = async_task_get_wait_stats((AsyncTaskPriority) i);
+					Draw(std::string(priority_names[i]) + " tasks (" + std::to_string(stats.started_num) + ") wait avg " + std::to_string((int) stats.wait_avg_ms) +
+						"ms max " + std::to_string((int) stats.wait_max_ms) + "ms last " + std::to_string((int) stats.wait_last_ms) + "ms expired " +
+						std::to_string(stats.expired_num), SMALL_MARGIN, view.y0 + i * 10, 0.4, 0.4, DEFAULT_TEXT_COLOR);
+				}
 			})
 		});
 	playback_tab_view = (new ScrollView(0, 0, 320, CONTENT_Y_HIGH))
@@ -1455,6 +3056,22 @@ void VideoPlayer_init(void)
 						video_retry_left = MAX_RETRY_CNT;
 					}
 				}),
+			(new TextView(SMALL_MARGIN * 2, 0, 160, CONTROL_BUTTON_HEIGHT))
+				->set_text((std::function<std::string ()>) [] () {
+					std::string id = get_video_id(cur_video_info.url);
+					if (offline_video_exists(id)) return LOCALIZED(SAVED_OFFLINE);
+					auto status = offline_download_get_status();
+					if (status.downloading_id != "" && status.downloading_id == id)
+						return LOCALIZED(SAVING_OFFLINE) + " " + std::to_string((int) status.progress) + "%";
+					if (offline_download_is_queued(id)) return LOCALIZED(OFFLINE_QUEUED);
+					return LOCALIZED(SAVE_OFFLINE);
+				})
+				->set_x_centered(true)
+				->set_get_background_color([] (const View &) {
+					std::string id = get_video_id(cur_video_info.url);
+					return !can_save_offline() || offline_video_exists(id) || offline_download_is_queued(id) ? DEF_DRAW_LIGHT_GRAY : DEF_DRAW_WEAK_AQUA;
+				})
+				->set_on_view_released([] (View &view) { save_offline(); }),
 			(new HorizontalRuleView(0, 0, 320, SMALL_MARGIN)),
 			debug_info_view
 		});
@@ -1472,16 +3089,21 @@ void VideoPlayer_init(void)
 	APT_CheckNew3DS(&new_3ds);
 	if (new_3ds) {
 		add_cpu_limit(NEW_3DS_CPU_LIMIT);
-		vid_decode_thread = threadCreate(decode_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_HIGH, 2, false);
-		vid_convert_thread = threadCreate(convert_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
+		vid_decode_thread = thread_placement_create_thread(ThreadRole::VIDEO_DECODE, decode_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_HIGH, false);
+		vid_convert_thread = thread_placement_create_thread(ThreadRole::VIDEO_CONVERT, convert_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+		vid_audio_decode_thread = thread_placement_create_thread(ThreadRole::AUDIO_DECODE, audio_decode_thread, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_HIGH, false);
 	} else {
 		add_cpu_limit(OLD_3DS_CPU_LIMIT);
-		vid_decode_thread = threadCreate(decode_thread, (void*)("1"), DEF_STACKSIZE, DEF_THREAD_PRIORITY_HIGH, 1, false);
-		vid_convert_thread = threadCreate(convert_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
+		vid_decode_thread = thread_placement_create_thread(ThreadRole::VIDEO_DECODE, decode_thread, (void*)("1"), DEF_STACKSIZE, DEF_THREAD_PRIORITY_HIGH, false);
+		vid_convert_thread = thread_placement_create_thread(ThreadRole::VIDEO_CONVERT, convert_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
 	}
 	stream_downloader = NetworkStreamDownloader();
-	stream_downloader_thread = threadCreate(network_downloader_thread, &stream_downloader, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 0, false);
-	livestream_initer_thread = threadCreate(livestream_initer_thread_func, &network_decoder, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, 2, false);
+	stream_downloader.set_url_expired_handler([] () { queue_async_task(refresh_expired_stream_urls, NULL, AsyncTaskPriority::INTERACTIVE, video_page_token); });
+	for (int i = 0; i < NetworkStreamDownloader::WORKER_NUM; i++)
+		stream_downloader_thread[i] = thread_placement_create_thread(ThreadRole::STREAM_DOWNLOADER, network_downloader_thread, &stream_downloader, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	livestream_initer_thread = thread_placement_create_thread(ThreadRole::LIVESTREAM_INITER, livestream_initer_thread_func, &network_decoder, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+	stream_prefetcher_thread = thread_placement_create_thread(ThreadRole::STREAM_PREFETCHER, stream_prefetcher_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, false);
+	vid_demux_thread = thread_placement_create_thread(ThreadRole::VIDEO_DEMUX, demux_thread, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
 
 	vid_total_time = 0;
 	vid_total_frames = 0;
@@ -1509,17 +3131,7 @@ void VideoPlayer_init(void)
 	vid_copy_time[1] = 0;
 	vid_convert_time = 0;
 
-	for(int i = 0 ; i < 8; i++)
-	{
-		result = Draw_c2d_image_init(&vid_image[i], 1024, 1024, GPU_RGB565);
-		if(result.code != 0)
-		{
-			Util_err_set_error_message(DEF_ERR_OUT_OF_LINEAR_MEMORY_STR, "", DEF_SAPP0_INIT_STR, DEF_ERR_OUT_OF_LINEAR_MEMORY);
-			Util_err_set_error_show_flag(true);
-			vid_thread_run = false;
-		}
-		Draw_c2d_image_set_filter(&vid_image[i], var_video_linear_filter);
-	}
+	// the video textures are allocated by alloc_tiles() when the first frame is converted
 
 	result = Draw_load_texture("romfs:/gfx/draw/video_player/banner.t3x", 61, vid_banner, 0, 2);
 	Util_log_save(DEF_SAPP0_INIT_STR, "Draw_load_texture()..." + result.string + result.error_description, result.code);
@@ -1570,19 +3182,39 @@ void VideoPlayer_exit(void)
 	vid_thread_suspend = false;
 	vid_thread_run = false;
 	vid_play_request = false;
+	vid_resume_event.signal();
+	pause_policy_active = false;
 	
 	stream_downloader.request_thread_exit();
 	network_decoder.interrupt = true;
 	network_decoder.request_thread_exit();
+	stream_prefetcher_thread_exit_request();
+	// the streams being opened by preopen() are read until it notices the cancellation, which must be before the downloader deletes them
+	remove_all_async_tasks_with_type(preopen_next_video);
+	do network_decoder.cancel_preopen();
+	while (is_async_task_running(preopen_next_video) == 2 && (usleep(10000), true));
 	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(vid_decode_thread, time_out));
 	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(vid_convert_thread, time_out));
-	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(stream_downloader_thread, time_out));
+	if (vid_audio_decode_thread) Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(vid_audio_decode_thread, time_out));
+	for (int i = 0; i < NetworkStreamDownloader::WORKER_NUM; i++)
+		Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(stream_downloader_thread[i], time_out));
 	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(livestream_initer_thread, time_out));
+	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(stream_prefetcher_thread, time_out));
+	Util_log_save(DEF_SAPP0_EXIT_STR, "threadJoin()...", threadJoin(vid_demux_thread, time_out));
 	threadFree(vid_decode_thread);
 	threadFree(vid_convert_thread);
-	threadFree(stream_downloader_thread);
+	if (vid_audio_decode_thread) threadFree(vid_audio_decode_thread);
+	vid_audio_decode_thread = NULL;
+	for (int i = 0; i < NetworkStreamDownloader::WORKER_NUM; i++)
+		threadFree(stream_downloader_thread[i]);
 	threadFree(livestream_initer_thread);
+	threadFree(stream_prefetcher_thread);
+	threadFree(vid_demux_thread);
 	stream_downloader.delete_all();
+	network_stream_prefetch_cache_clear();
+	thumbnail_cancel_request(Bar::storyboard_sheet_handle);
+	Bar::storyboard_sheet_handle = -1;
+	Bar::storyboard_sheet_url = "";
 	
 	// clean up views
 	suggestion_view->recursive_delete_subviews();
@@ -1624,8 +3256,13 @@ void VideoPlayer_exit(void)
 	Draw_free_texture(61);
 	Draw_free_texture(62);
 
-	for(int i = 0; i < 8; i++)
-		Draw_c2d_image_free(vid_image[i]);
+	for(int i = 0; i < VIDEO_TEX_SLOT_NUM * 4; i++) {
+		if (vid_image[i].subtex) Draw_c2d_image_free(vid_image[i], MemoryTag::VIDEO_TEXTURES);
+		vid_image[i].subtex = NULL;
+	}
+	for(int i = 0; i < VIDEO_TEX_SLOT_NUM; i++)
+		Draw_yuv_image_free(&vid_yuv_image[i]);
+	MvdTiling::free_buffer();
 	
 	Util_log_save(DEF_SAPP0_EXIT_STR, "Exited.");
 }
@@ -1708,8 +3345,6 @@ Intent VideoPlayer_draw(void)
 	Util_hid_query_key_state(&key);
 	Util_hid_key_flag_reset();
 	
-	int image_num = !vid_mvd_image_num;
-
 	thumbnail_set_active_scene(SceneType::VIDEO_PLAYER);
 	
 	//fit to screen size
@@ -1720,23 +3355,30 @@ Intent VideoPlayer_draw(void)
 	if (!var_full_screen_mode) vid_y += 15;
 	
 	bool video_playing_bar_show = video_is_playing();
+	if (vid_play_request && network_decoder.ready && !audio_only_mode && FrameQueue::has_due_frame(Util_speaker_clock_now(0)))
+		var_need_reflesh = true;
+	bool audio_only_playing = vid_play_request && network_decoder.ready && audio_only_mode;
+	if (audio_only_playing) {
+		double tmp = Util_speaker_clock_now(0);
+		if (tmp != -1) vid_current_pos = tmp;
+	}
+	var_low_power_playing = audio_only_playing && var_audio_only_low_power;
 	
-	if(var_need_reflesh || !var_eco_mode)
+	// nobody sees the drawing of the audio-only playback while the screens are off
+	if((var_need_reflesh || !var_eco_mode) && !(audio_only_playing && var_screens_off))
 	{
 		bool video_playing = vid_play_request && network_decoder.ready && !audio_only_mode;
 		var_need_reflesh = false;
 		Draw_frame_ready();
+		MvdTiling::process();
+		if (audio_only_playing) free_video_textures();
+		int image_num = video_playing ? FrameQueue::present(Util_speaker_clock_now(0)) : -1;
 		Draw_screen_ready(0, video_playing ? DEF_DRAW_BLACK : DEFAULT_BACK_COLOR);
 
-		if (video_playing) {
-			//video
-			Draw_texture(vid_image[image_num * 4 + 0].c2d, vid_x, vid_y, vid_tex_width[image_num * 4 + 0] * vid_zoom, vid_tex_height[image_num * 4 + 0] * vid_zoom);
-			if(vid_width > 1024)
-				Draw_texture(vid_image[image_num * 4 + 1].c2d, (vid_x + vid_tex_width[image_num * 4 + 0] * vid_zoom), vid_y, vid_tex_width[image_num * 4 + 1] * vid_zoom, vid_tex_height[image_num * 4 + 1] * vid_zoom);
-			if(vid_height > 1024)
-				Draw_texture(vid_image[image_num * 4 + 2].c2d, vid_x, (vid_y + vid_tex_width[image_num * 4 + 0] * vid_zoom), vid_tex_width[image_num * 4 + 2] * vid_zoom, vid_tex_height[image_num * 4 + 2] * vid_zoom);
-			if(vid_width > 1024 && vid_height > 1024)
-				Draw_texture(vid_image[image_num * 4 + 3].c2d, (vid_x + vid_tex_width[image_num * 4 + 0] * vid_zoom), (vid_y + vid_tex_height[image_num * 4 + 0] * vid_zoom), vid_tex_width[image_num * 4 + 3] * vid_zoom, vid_tex_height[image_num * 4 + 3] * vid_zoom);
+		if (video_playing && image_num < 0) {
+			// the first frame isn't due yet
+		} else if (video_playing) {
+			draw_video_frame(image_num, vid_x, vid_y, vid_zoom);
 		} else Draw_texture(vid_banner[var_night_mode], 0, 15, 400, 225);
 
 		if(Util_log_query_log_show_flag())
@@ -1745,6 +3387,7 @@ Intent VideoPlayer_draw(void)
 		if (!var_full_screen_mode || !network_decoder.ready) Draw_top_ui();
 		caption_overlay_view->cur_timestamp = vid_current_pos;
 		caption_overlay_view->draw();
+		if (playback_benchmark_is_running()) Draw(playback_benchmark_get_status(), 0, 15, 0.45, 0.45, DEF_LOG_COLOR);
 
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 
@@ -1786,7 +3429,7 @@ Intent VideoPlayer_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 
 	if(Util_err_query_error_show_flag())
 		Util_err_main(key);
@@ -1797,48 +3440,31 @@ Intent VideoPlayer_draw(void)
 		/* ****************************** LOCK START ******************************  */
 		svcWaitSynchronization(small_resource_lock, std::numeric_limits<s64>::max());
 		
+		build_pending_views();
+		
 		// thumbnail request update (this should be done while `small_resource_lock` is locked)
-		// YES, this section needs refactoring, seriously
-		if (cur_video_info.suggestions.size()) { // suggestions
-			int suggestion_num = cur_video_info.suggestions.size();
+		if (suggestion_main_view->views.size()) { // suggestions
+			int suggestion_num = suggestion_main_view->views.size();
 			int displayed_l = std::min(suggestion_num, std::max(0, suggestion_view->get_offset() / SUGGESTIONS_VERTICAL_INTERVAL));
 			int displayed_r = std::min(suggestion_num, std::max(0, (suggestion_view->get_offset() + CONTENT_Y_HIGH - 1) / SUGGESTIONS_VERTICAL_INTERVAL + 1));
-			int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-			int request_target_r = std::min(suggestion_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-			// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-			std::set<int> new_indexes, cancelling_indexes;
-			for (int i = suggestion_thumbnail_request_l; i < suggestion_thumbnail_request_r; i++) cancelling_indexes.insert(i);
-			for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-			for (int i = suggestion_thumbnail_request_l; i < suggestion_thumbnail_request_r; i++) new_indexes.erase(i);
-			for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-			
-			for (auto i : cancelling_indexes) {
-				SuccinctVideoView *cur_view = dynamic_cast<SuccinctVideoView *>(suggestion_main_view->views[i]);
-				thumbnail_cancel_request(cur_view->thumbnail_handle);
-				cur_view->thumbnail_handle = -1;
-			}
-			for (auto i : new_indexes) {
-				SuccinctVideoView *cur_view = dynamic_cast<SuccinctVideoView *>(suggestion_main_view->views[i]);
-				cur_view->thumbnail_handle = thumbnail_request(cur_view->thumbnail_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::VIDEO_THUMBNAIL);
-			}
-			
-			suggestion_thumbnail_request_l = request_target_l;
-			suggestion_thumbnail_request_r = request_target_r;
-			
-			std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-			auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-			for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] = {
-				dynamic_cast<SuccinctVideoView *>(suggestion_main_view->views[i])->thumbnail_handle, 500 - dist(i)};
-			thumbnail_set_priorities(priority_list);
+			auto view_at = [&] (int i) { return dynamic_cast<SuccinctVideoView *>(suggestion_main_view->views[i]); };
+			suggestion_thumbnail_requester.update(suggestion_num, displayed_l, displayed_r, suggestion_view->get_scroll_velocity() / SUGGESTIONS_VERTICAL_INTERVAL,
+				[&] (int i) -> int & { return view_at(i)->thumbnail_handle; },
+				[&] (int i) { return thumbnail_request(view_at(i)->thumbnail_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::VIDEO_THUMBNAIL, VIDEO_LIST_THUMBNAIL_WIDTH); });
 		}
-		if (cur_video_info.comments.size()) { // comments
+		if (comments_main_view->views.size()) { // comments
 			std::vector<std::pair<float, CommentView *> > comments_list; // list of comment views whose author's thumbnails should be loaded
 			{
 				constexpr int LOW = -1000;
 				constexpr int HIGH = 1240;
 				float cur_y = -comment_all_view->get_offset();
+				size_t last_visible_comment = 0;
 				for (size_t i = 0; i < comments_main_view->views.size(); i++) {
 					float cur_height = comments_main_view->views[i]->get_height();
+					if (cur_y < 240) last_visible_comment = i;
+					// drop the wrapped lines of comments far from the viewport, they are re-wrapped from cur_video_info when drawn again
+					if (cur_y >= COMMENT_CONTENT_KEEP_HIGH || cur_y + cur_height < COMMENT_CONTENT_KEEP_LOW)
+						dynamic_cast<CommentView *>(comments_main_view->views[i])->unload_content();
 					if (cur_y < HIGH && cur_y + cur_height >= LOW) {
 						auto parent_comment_view = dynamic_cast<CommentView *>(comments_main_view->views[i]);
 						if (cur_y + parent_comment_view->get_self_height() >= LOW) comments_list.push_back({cur_y, parent_comment_view});
@@ -1850,6 +3476,11 @@ Intent VideoPlayer_draw(void)
 					}
 					cur_y += cur_height;
 				}
+				// the next page is requested once half of the last one has been scrolled through, not when its bottom is reached
+				if (!var_data_saver && last_visible_comment >= (comments_last_page_begin + comments_main_view->views.size()) / 2 &&
+					cur_video_info.has_more_comments() && cur_video_info.error == "" && comments_main_view->views.size() == cur_video_info.comments.size() &&
+					!is_async_task_running(load_video_page) && !is_async_task_running(load_more_comments))
+					queue_async_task(load_more_comments, &cur_video_info, AsyncTaskPriority::PREFETCH, video_page_token);
 				if (comments_list.size() > MAX_THUMBNAIL_LOAD_REQUEST) {
 					int leftover = comments_list.size() - MAX_THUMBNAIL_LOAD_REQUEST;
 					comments_list.erase(comments_list.begin(), comments_list.begin() + leftover / 2);
@@ -1869,7 +3500,7 @@ Intent VideoPlayer_draw(void)
 				comment_thumbnail_loaded_list.erase(i);
 			}
 			for (auto i : newly_loading_views) {
-				i->author_icon_handle = thumbnail_request(i->get_yt_comment_object().author.icon_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::ICON);
+				i->author_icon_handle = thumbnail_request(i->get_yt_comment_object().author.icon_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::ICON, COMMENT_ICON_SIZE);
 				comment_thumbnail_loaded_list.insert(i);
 			}
 			
@@ -1882,33 +3513,10 @@ Intent VideoPlayer_draw(void)
 			int item_num = cur_video_info.playlist.videos.size();
 			int displayed_l = std::min(item_num, std::max(0, playlist_list_view->get_offset() / SUGGESTIONS_VERTICAL_INTERVAL));
 			int displayed_r = std::min(item_num, std::max(0, (playlist_list_view->get_offset() + (CONTENT_Y_HIGH - PLAYLIST_TOP_HEIGHT) - 1) / SUGGESTIONS_VERTICAL_INTERVAL + 1));
-			int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-			int request_target_r = std::min(item_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-			// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-			std::set<int> new_indexes, cancelling_indexes;
-			for (int i = playlist_thumbnail_request_l; i < playlist_thumbnail_request_r; i++) cancelling_indexes.insert(i);
-			for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-			for (int i = playlist_thumbnail_request_l; i < playlist_thumbnail_request_r; i++) new_indexes.erase(i);
-			for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-			
-			for (auto i : cancelling_indexes) {
-				SuccinctVideoView *cur_view = dynamic_cast<SuccinctVideoView *>(playlist_list_view->views[i]);
-				thumbnail_cancel_request(cur_view->thumbnail_handle);
-				cur_view->thumbnail_handle = -1;
-			}
-			for (auto i : new_indexes) {
-				SuccinctVideoView *cur_view = dynamic_cast<SuccinctVideoView *>(playlist_list_view->views[i]);
-				cur_view->thumbnail_handle = thumbnail_request(cur_view->thumbnail_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::VIDEO_THUMBNAIL);
-			}
-			
-			playlist_thumbnail_request_l = request_target_l;
-			playlist_thumbnail_request_r = request_target_r;
-			
-			std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-			auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-			for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] = {
-				dynamic_cast<SuccinctVideoView *>(playlist_list_view->views[i])->thumbnail_handle, 500 - dist(i)};
-			thumbnail_set_priorities(priority_list);
+			auto view_at = [&] (int i) { return dynamic_cast<SuccinctVideoView *>(playlist_list_view->views[i]); };
+			playlist_thumbnail_requester.update(item_num, displayed_l, displayed_r, playlist_list_view->get_scroll_velocity() / SUGGESTIONS_VERTICAL_INTERVAL,
+				[&] (int i) -> int & { return view_at(i)->thumbnail_handle; },
+				[&] (int i) { return thumbnail_request(view_at(i)->thumbnail_url, SceneType::VIDEO_PLAYER, 0, ThumbnailType::VIDEO_THUMBNAIL, VIDEO_LIST_THUMBNAIL_WIDTH); });
 		}
 		
 		update_overlay_menu(&key, &intent, SceneType::VIDEO_PLAYER);
@@ -1974,7 +3582,31 @@ Intent VideoPlayer_draw(void)
 			}
 		}
 		
+		// warm up the next video shortly before the current one ends
+		if (vid_play_request && !cur_video_info.is_livestream && vid_duration > 0 && vid_duration - vid_current_pos < PREFETCH_BEFORE_END_SECONDS)
+			request_prefetch_wo_lock(get_next_video_url());
+		if (vid_play_request && !cur_video_info.is_livestream && !auto_quality_mode && vid_duration > 0 && vid_duration - vid_current_pos < PREOPEN_BEFORE_END_SECONDS)
+			request_preopen_wo_lock(get_next_playlist_video_url());
+		// a playlist moves on to its next video once the current one has been played to the end
+		update_pause_policy();
+		if (vid_playback_ended) {
+			vid_playback_ended = false;
+			std::string next_url = get_next_playlist_video_url();
+			if (next_url != "" && vid_play_request && eof_reached) {
+				intent.next_scene = SceneType::VIDEO_PLAYER;
+				intent.arg = next_url;
+			}
+		}
+		if (vid_play_request && network_decoder.ready && cur_video_info.is_livestream && var_livestream_low_latency && !vid_pausing && !vid_seek_request)
+			keep_up_with_live_edge();
+		
 		if (video_playing_bar_show) video_update_playing_bar(key, &intent);
+		if (key.h_l && key.h_r && key.p_start) {
+			if (playback_benchmark_is_running()) playback_benchmark_stop();
+			else playback_benchmark_start();
+		}
+		update_playback_benchmark();
+		update_telemetry();
 		if (key.p_a) {
 			if(vid_play_request) {
 				if (vid_pausing) {
@@ -1993,6 +3625,9 @@ Intent VideoPlayer_draw(void)
 			var_need_reflesh = true;
 		} else if ((key.h_x && key.p_b) || (key.h_b && key.p_x)) {
 			vid_play_request = false;
+			// stopped on purpose, nothing to continue on the next launch
+			if (player_session_saved) player_session_clear();
+			player_session_saved = false;
 			var_need_reflesh = true;
 		} else if (key.p_b) {
 			intent.next_scene = SceneType::BACK;
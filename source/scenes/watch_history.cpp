@@ -13,6 +13,7 @@
 #include "network/thumbnail_loader.hpp"
 #include "system/util/history.hpp"
 #include "system/util/misc_tasks.hpp"
+#include "system/util/memory_pressure.hpp"
 
 #define MAX_THUMBNAIL_LOAD_REQUEST 30
 
@@ -24,11 +25,13 @@ namespace WatchHistory {
 	std::vector<HistoryVideo> watch_history;
 	std::string clicked_url;
 	std::string erase_request;
-	int thumbnail_request_l = 0;
-	int thumbnail_request_r = 0;
+	ThumbnailListRequester thumbnail_requester(MAX_THUMBNAIL_LOAD_REQUEST);
 	
 	int cur_sort_type = 0;
 	int sort_request = -1;
+	int saved_offset = 0; // the views are deleted while another scene is shown under memory pressure, and built again at this scroll position
+	
+	std::string view_count_format; // the texts of the views kept by update_watch_history() are built again when the language changes
 	
 	int CONTENT_Y_HIGHT = 240; // changes according to whether the video playing bar is drawn or not
 	
@@ -42,98 +45,147 @@ bool History_query_init_flag(void) {
 	return already_init;
 }
 
-static void update_watch_history(const std::vector<HistoryVideo> &new_watch_history) {
-	watch_history = new_watch_history;
-	
-	// clean up previous views and thumbnail requests
-	if (video_list_view) for (auto view : video_list_view->views)
+static std::vector<HistoryVideo> sort_watch_history(std::vector<HistoryVideo> history, int sort_type) {
+	std::sort(history.begin(), history.end(), [sort_type] (const HistoryVideo &i, const HistoryVideo &j) {
+		if (sort_type == 0) return i.last_watch_time > j.last_watch_time;
+		if (sort_type == 1) return i.my_view_count > j.my_view_count;
+		// should not reach here
+		return false;
+	});
+	return history;
+}
+
+static void release_views() {
+	if (!main_view) return;
+	saved_offset = main_view->get_offset();
+	for (auto view : video_list_view->views)
 		thumbnail_cancel_request(dynamic_cast<SuccinctVideoView *>(view)->thumbnail_handle);
-	thumbnail_request_l = thumbnail_request_r = 0;
-	
-	if (main_view) main_view->recursive_delete_subviews();
+	thumbnail_requester.reset();
+	main_view->recursive_delete_subviews();
 	delete main_view;
-	
-	// prepare new views
-	video_list_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN);
-	for (auto i : watch_history) {
-		std::string view_count_str;
-		{
-			std::string view_count_str_tmp = LOCALIZED(MY_VIEW_COUNT_WITH_NUMBER);
-			for (size_t j = 0; j < view_count_str_tmp.size(); ) {
-				if (j + 1 < view_count_str_tmp.size() && view_count_str_tmp[j] == '%' && view_count_str_tmp[j + 1] == '0')
-					view_count_str += std::to_string(i.my_view_count), j += 2;
-				else view_count_str.push_back(view_count_str_tmp[j]), j++;
-			}
-		}
-		std::string last_watch_time_str;
-		{
-			char tmp[100];
-			strftime(tmp, 100, "%Y/%m/%d %H:%M", gmtime(&i.last_watch_time));
-			last_watch_time_str = tmp;
+	main_view = NULL;
+	video_list_view = NULL;
+	std::vector<HistoryVideo>().swap(watch_history); // read again from the history on resume
+}
+
+static void set_video_view_texts(SuccinctVideoView *view, const HistoryVideo &video) {
+	std::string view_count_str;
+	{
+		std::string view_count_str_tmp = LOCALIZED(MY_VIEW_COUNT_WITH_NUMBER);
+		for (size_t j = 0; j < view_count_str_tmp.size(); ) {
+			if (j + 1 < view_count_str_tmp.size() && view_count_str_tmp[j] == '%' && view_count_str_tmp[j + 1] == '0')
+				view_count_str += std::to_string(video.my_view_count), j += 2;
+			else view_count_str.push_back(view_count_str_tmp[j]), j++;
 		}
-		
-		SuccinctVideoView *cur_view = (new SuccinctVideoView(0, 0, 320, VIDEO_LIST_THUMBNAIL_HEIGHT))
-			->set_title_lines(i.title_lines)
-			->set_auxiliary_lines({i.author_name, view_count_str + " " + last_watch_time_str})
-			->set_bottom_right_overlay(i.length_text)
-			->set_thumbnail_url(youtube_get_video_thumbnail_url_by_id(i.id));
-		
-		cur_view->set_get_background_color([] (const View &view) {
-			int darkness = std::min<int>(0xFF, 0xD0 + 0x30 * (1 - view.touch_darkness));
-			if (var_night_mode) darkness = 0xFF - darkness;
-			return COLOR_GRAY(darkness);
-		})->set_on_view_released([i] (View &view) {
-			clicked_url = youtube_get_video_url_by_id(i.id);
-		})->add_on_long_hold(40, [i] (View &view) {
-			on_long_tap_dialog->recursive_delete_subviews();
-			on_long_tap_dialog
-				->set_subview((new TextView(0, 0, 160, DEFAULT_FONT_INTERVAL + SMALL_MARGIN * 2))
-					->set_text((std::function<std::string ()>) [] () { return LOCALIZED(REMOVE_HISTORY_ITEM); })
-					->set_x_centered(true)
-					->set_y_centered(true)
-					->set_text_offset(0, -1)
-					->set_on_view_released([i] (View &view) {
-						erase_request = i.id;
-						main_view->reset_holding_status();
-						on_long_tap_dialog->set_is_visible(false);
-						var_need_reflesh = true;
-					})
-					->set_get_background_color([] (const View &view) {
-						int darkness = std::min<int>(0xFF, 0xD0 + 0x30 * (1 - view.touch_darkness));
-						if (var_night_mode) darkness = 0xFF - darkness;
-						return COLOR_GRAY(darkness);
-					})
-				)
-				->set_on_cancel([] (OverlayView &view) {
+	}
+	std::string last_watch_time_str;
+	{
+		char tmp[100];
+		strftime(tmp, 100, "%Y/%m/%d %H:%M", gmtime(&video.last_watch_time));
+		last_watch_time_str = tmp;
+	}
+	view->set_title_lines(video.title_lines)
+		->set_auxiliary_lines({video.author_name, view_count_str + " " + last_watch_time_str})
+		->set_bottom_right_overlay(video.length_text);
+}
+static SuccinctVideoView *make_video_view(const HistoryVideo &video) {
+	SuccinctVideoView *cur_view = (new SuccinctVideoView(0, 0, 320, VIDEO_LIST_THUMBNAIL_HEIGHT))
+		->set_thumbnail_url(youtube_get_video_thumbnail_url_by_id(video.id));
+	set_video_view_texts(cur_view, video);
+	
+	std::string id = video.id;
+	cur_view->set_get_background_color([] (const View &view) {
+		int darkness = std::min<int>(0xFF, 0xD0 + 0x30 * (1 - view.touch_darkness));
+		if (var_night_mode) darkness = 0xFF - darkness;
+		return COLOR_GRAY(darkness);
+	})->set_on_view_released([id] (View &view) {
+		clicked_url = youtube_get_video_url_by_id(id);
+	})->add_on_long_hold(40, [id] (View &view) {
+		on_long_tap_dialog->recursive_delete_subviews();
+		on_long_tap_dialog
+			->set_subview((new TextView(0, 0, 160, DEFAULT_FONT_INTERVAL + SMALL_MARGIN * 2))
+				->set_text((std::function<std::string ()>) [] () { return LOCALIZED(REMOVE_HISTORY_ITEM); })
+				->set_x_centered(true)
+				->set_y_centered(true)
+				->set_text_offset(0, -1)
+				->set_on_view_released([id] (View &view) {
+					erase_request = id;
 					main_view->reset_holding_status();
-					view.set_is_visible(false);
+					on_long_tap_dialog->set_is_visible(false);
 					var_need_reflesh = true;
 				})
-				->set_is_visible(true);
-			var_need_reflesh = true;
-		});
-		
-		
-		video_list_view->views.push_back(cur_view);
+				->set_get_background_color([] (const View &view) {
+					int darkness = std::min<int>(0xFF, 0xD0 + 0x30 * (1 - view.touch_darkness));
+					if (var_night_mode) darkness = 0xFF - darkness;
+					return COLOR_GRAY(darkness);
+				})
+			)
+			->set_on_cancel([] (OverlayView &view) {
+				main_view->reset_holding_status();
+				view.set_is_visible(false);
+				var_need_reflesh = true;
+			})
+			->set_is_visible(true);
+		var_need_reflesh = true;
+	});
+	return cur_view;
+}
+
+// the views are keyed by the video id : the ones of the videos still in the history are kept with their thumbnails,
+// so that watching a video, erasing one or changing the order only creates, deletes or moves the views that changed
+static void update_watch_history(const std::vector<HistoryVideo> &new_watch_history) {
+	if (!main_view) {
+		video_list_view = (new VerticalListView(0, 0, 320))->set_margin(SMALL_MARGIN)->set_is_virtualized(true);
+		constexpr int selector_width = 180;
+		main_view = (new ScrollView(0, 0, 320, 240))
+			->set_views({
+				(new HorizontalListView(0, 0, MIDDLE_FONT_INTERVAL))
+					->set_views({
+						(new TextView(0, 0, 320 - selector_width, MIDDLE_FONT_INTERVAL))
+							->set_text((std::function<std::string()>) [] () { return LOCALIZED(WATCH_HISTORY); })
+							->set_font_size(MIDDLE_FONT_SIZE, MIDDLE_FONT_INTERVAL),
+						(new SelectorView(0, 0, selector_width, MIDDLE_FONT_INTERVAL))
+							->set_texts({
+								(std::function<std::string ()>) [] () { return LOCALIZED(BY_LAST_WATCH_TIME); },
+								(std::function<std::string ()>) [] () { return LOCALIZED(BY_MY_VIEW_COUNT); }
+							}, cur_sort_type)
+							->set_on_change([](const SelectorView &view) { sort_request = cur_sort_type = view.selected_button; })
+					}),
+				(new HorizontalRuleView(0, 0, 320, 3)),
+				video_list_view
+			});
+	}
+	
+	bool language_changed = view_count_format != LOCALIZED(MY_VIEW_COUNT_WITH_NUMBER);
+	view_count_format = LOCALIZED(MY_VIEW_COUNT_WITH_NUMBER);
+	
+	std::map<std::string, size_t> old_index; // watch_history[i] is shown by video_list_view->views[i]
+	for (size_t i = 0; i < watch_history.size(); i++) old_index[watch_history[i].id] = i;
+	std::vector<View *> views;
+	for (auto &video : new_watch_history) {
+		auto itr = old_index.find(video.id);
+		if (itr == old_index.end()) { // new, or the same video listed twice
+			views.push_back(make_video_view(video));
+			continue;
+		}
+		const HistoryVideo &old_video = watch_history[itr->second];
+		SuccinctVideoView *view = dynamic_cast<SuccinctVideoView *>(video_list_view->views[itr->second]);
+		if (language_changed || old_video.my_view_count != video.my_view_count || old_video.last_watch_time != video.last_watch_time ||
+			old_video.title_lines != video.title_lines || old_video.author_name != video.author_name || old_video.length_text != video.length_text)
+			set_video_view_texts(view, video);
+		views.push_back(view);
+		old_index.erase(itr);
+	}
+	for (auto &i : old_index) { // removed from the history
+		SuccinctVideoView *view = dynamic_cast<SuccinctVideoView *>(video_list_view->views[i.second]);
+		thumbnail_cancel_request(view->thumbnail_handle);
+		delete view;
 	}
-	constexpr int selector_width = 180;
-	main_view = (new ScrollView(0, 0, 320, 240))
-		->set_views({
-			(new HorizontalListView(0, 0, MIDDLE_FONT_INTERVAL))
-				->set_views({
-					(new TextView(0, 0, 320 - selector_width, MIDDLE_FONT_INTERVAL))
-						->set_text((std::function<std::string()>) [] () { return LOCALIZED(WATCH_HISTORY); })
-						->set_font_size(MIDDLE_FONT_SIZE, MIDDLE_FONT_INTERVAL),
-					(new SelectorView(0, 0, selector_width, MIDDLE_FONT_INTERVAL))
-						->set_texts({
-							(std::function<std::string ()>) [] () { return LOCALIZED(BY_LAST_WATCH_TIME); },
-							(std::function<std::string ()>) [] () { return LOCALIZED(BY_MY_VIEW_COUNT); }
-						}, cur_sort_type)
-						->set_on_change([](const SelectorView &view) { sort_request = cur_sort_type = view.selected_button; })
-				}),
-			(new HorizontalRuleView(0, 0, 320, 3)),
-			video_list_view
-		});
+	video_list_view->views = views;
+	video_list_view->invalidate_layout();
+	thumbnail_requester.on_items_changed(views.size(),
+		[&] (int i) -> int & { return dynamic_cast<SuccinctVideoView *>(views[i])->thumbnail_handle; });
+	watch_history = new_watch_history;
 }
 
 
@@ -141,17 +193,21 @@ void History_resume(std::string arg)
 {
 	(void) arg;
 	
-	if (main_view) main_view->on_resume();
+	bool rebuild = !main_view;
+	update_watch_history(sort_watch_history(get_watch_history(), cur_sort_type));
+	if (rebuild) main_view->set_offset(saved_offset);
+	main_view->on_resume();
 	overlay_menu_on_resume();
 	thread_suspend = false;
 	var_need_reflesh = true;
-	
-	update_watch_history(get_watch_history());
 }
 
 void History_suspend(void)
 {
 	thread_suspend = true;
+	// the views are kept for the next resume unless the memory is running out
+	// (the thumbnails of a scene in the background are shed by thumbnail_shed_textures() anyway)
+	if (memory_pressure_get_level() != MemoryPressure::NONE) release_views();
 }
 
 void History_init(void)
@@ -195,34 +251,10 @@ Intent History_draw(void)
 		int item_interval = VIDEO_LIST_THUMBNAIL_HEIGHT + SMALL_MARGIN;
 		int displayed_l = std::min(result_num, main_view->get_offset() / item_interval);
 		int displayed_r = std::min(result_num, (main_view->get_offset() + CONTENT_Y_HIGHT - 1) / item_interval + 1);
-		int request_target_l = std::max(0, displayed_l - (MAX_THUMBNAIL_LOAD_REQUEST - (displayed_r - displayed_l)) / 2);
-		int request_target_r = std::min(result_num, request_target_l + MAX_THUMBNAIL_LOAD_REQUEST);
-		// transition from [thumbnail_request_l, thumbnail_request_r) to [request_target_l, request_target_r)
-		std::set<int> new_indexes, cancelling_indexes;
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) cancelling_indexes.insert(i);
-		for (int i = request_target_l; i < request_target_r; i++) new_indexes.insert(i);
-		for (int i = thumbnail_request_l; i < thumbnail_request_r; i++) new_indexes.erase(i);
-		for (int i = request_target_l; i < request_target_r; i++) cancelling_indexes.erase(i);
-		
-		for (auto i : cancelling_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctVideoView *>(video_list_view->views[i]);
-			thumbnail_cancel_request(cur_view->thumbnail_handle);
-			cur_view->thumbnail_handle = -1;
-		}
-		for (auto i : new_indexes) {
-			auto *cur_view = dynamic_cast<SuccinctVideoView *>(video_list_view->views[i]);
-			cur_view->thumbnail_handle = thumbnail_request(cur_view->thumbnail_url,
-				SceneType::HISTORY, 0, ThumbnailType::VIDEO_THUMBNAIL);
-		}
-		
-		thumbnail_request_l = request_target_l;
-		thumbnail_request_r = request_target_r;
-		
-		std::vector<std::pair<int, int> > priority_list(request_target_r - request_target_l);
-		auto dist = [&] (int i) { return i < displayed_l ? displayed_l - i : i - displayed_r + 1; };
-		for (int i = request_target_l; i < request_target_r; i++) priority_list[i - request_target_l] =
-			{dynamic_cast<SuccinctVideoView *>(video_list_view->views[i])->thumbnail_handle, 500 - dist(i)};
-		thumbnail_set_priorities(priority_list);
+		auto view_at = [&] (int i) { return dynamic_cast<SuccinctVideoView *>(video_list_view->views[i]); };
+		thumbnail_requester.update(result_num, displayed_l, displayed_r, main_view->get_scroll_velocity() / item_interval,
+			[&] (int i) -> int & { return view_at(i)->thumbnail_handle; },
+			[&] (int i) { return thumbnail_request(view_at(i)->thumbnail_url, SceneType::HISTORY, 0, ThumbnailType::VIDEO_THUMBNAIL, VIDEO_LIST_THUMBNAIL_WIDTH); });
 	}
 
 	if(var_need_reflesh || !var_eco_mode)
@@ -235,6 +267,7 @@ Intent History_draw(void)
 			Util_log_draw();
 
 		Draw_top_ui();
+		video_draw_mini_player();
 		
 		Draw_screen_ready(1, DEFAULT_BACK_COLOR);
 		
@@ -255,7 +288,7 @@ Intent History_draw(void)
 		Draw_apply_draw();
 	}
 	else
-		gspWaitForVBlank();
+		Draw_skip_frame();
 	
 
 	if (Util_err_query_error_show_flag()) {
@@ -274,14 +307,7 @@ Intent History_draw(void)
 				clicked_url = "";
 			}
 			if (sort_request != -1) {
-				auto tmp_watch_history = watch_history;
-				std::sort(tmp_watch_history.begin(), tmp_watch_history.end(), [] (const HistoryVideo &i, const HistoryVideo &j) {
-					if (sort_request == 0) return i.last_watch_time > j.last_watch_time;
-					if (sort_request == 1) return i.my_view_count > j.my_view_count;
-					// should not reach here
-					return false;
-				});
-				update_watch_history(tmp_watch_history);
+				update_watch_history(sort_watch_history(watch_history, sort_request));
 				
 				sort_request = -1;
 			}
@@ -311,7 +337,7 @@ Intent History_draw(void)
 			var_need_reflesh = true;
 		} else consecutive_scroll = 0;
 		
-		if(key.h_touch || key.p_touch)
+		if(Draw_is_touch_pos_outdated())
 			var_need_reflesh = true;
 		
 		if (key.p_b) intent.next_scene = SceneType::BACK;
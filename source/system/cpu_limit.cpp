@@ -1,29 +1,110 @@
 #include "headers.hpp"
 #include <set>
 
-static bool cpu_limits_lock_inited = false;
-static Handle cpu_limits_lock;
-static std::multiset<int> cpu_limits;
-
-void add_cpu_limit(int limit) {
-	if (!cpu_limits_lock_inited) {
-		svcCreateMutex(&cpu_limits_lock, false);
-		cpu_limits_lock_inited = true;
+#define DEFAULT_LIMIT 30 // same as the one set at startup, used when nothing is requested
+#define PRESSURE_SMOOTHING 0.1 // weight of the latest frame in the moving average
+#define PRESSURE_ENTER_THRESHOLD 0.3 // the ratio of late frames above which the decoder is considered to be short of cpu time
+#define PRESSURE_LEAVE_THRESHOLD 0.1
+#define MIN_STATE_DURATION_MS 1000 // hysteresis : the state is kept at least this long after it changes
+#define FRAME_REPORT_TIMEOUT_MS 1000 // the playback is considered to have stopped if no frame comes for this long
+
+static LightMutex cpu_limits_lock;
+static std::multiset<int> cpu_limits[3]; // indexed by CpuLimitReason
+static int applied_limit = -1;
+
+static double decoder_pressure = 0;
+static bool decoder_demanding = false;
+static double demanding_state_changed_time = 0;
+static double last_frame_report_time = 0;
+static int network_wait_count = 0; // incremented every time the decoder starts waiting for the network
+static int network_wait_count_at_last_frame = 0;
+
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+static void lock() {
+	cpu_limits_lock.lock();
+}
+static void release() {
+	cpu_limits_lock.unlock();
+}
+
+// must be called with the lock held
+static void update_demanding_state_wo_lock(double cur_time) {
+	bool next_state = decoder_demanding;
+	if (cur_time - last_frame_report_time > FRAME_REPORT_TIMEOUT_MS) next_state = false; // stopped or paused, no hysteresis needed
+	else if (cur_time - demanding_state_changed_time >= MIN_STATE_DURATION_MS) {
+		if (!decoder_demanding && decoder_pressure > PRESSURE_ENTER_THRESHOLD) next_state = true;
+		if (decoder_demanding && decoder_pressure < PRESSURE_LEAVE_THRESHOLD) next_state = false;
+	}
+	if (next_state != decoder_demanding) {
+		decoder_demanding = next_state;
+		demanding_state_changed_time = cur_time;
 	}
-	svcWaitSynchronization(cpu_limits_lock, std::numeric_limits<s64>::max());
-	cpu_limits.insert(limit);
-	APT_SetAppCpuTimeLimit(*cpu_limits.begin());
-	svcReleaseMutex(cpu_limits_lock);
 }
-void remove_cpu_limit(int limit) {
-	svcWaitSynchronization(cpu_limits_lock, std::numeric_limits<s64>::max());
-	cpu_limits.erase(cpu_limits.find(limit));
-	APT_SetAppCpuTimeLimit(*cpu_limits.begin());
-	svcReleaseMutex(cpu_limits_lock);
+// must be called with the lock held
+static void apply_limit_wo_lock() {
+	auto &default_limits = cpu_limits[(int) CpuLimitReason::DEFAULT];
+	auto &network_limits = cpu_limits[(int) CpuLimitReason::NETWORK_WAIT];
+	auto &applet_limits = cpu_limits[(int) CpuLimitReason::SYSTEM_APPLET];
+
+	int limit = -1;
+	if (default_limits.size()) limit = decoder_demanding ? *default_limits.rbegin() : *default_limits.begin();
+	if (network_limits.size()) limit = limit < 0 ? *network_limits.begin() : std::min(limit, *network_limits.begin());
+	if (applet_limits.size()) limit = limit < 0 ? *applet_limits.begin() : std::min(limit, *applet_limits.begin());
+	if (limit < 0) limit = DEFAULT_LIMIT;
+
+	// a service call, so don't make it for every frame
+	if (limit != applied_limit) {
+		applied_limit = limit;
+		APT_SetAppCpuTimeLimit(limit);
+	}
 }
+
+void add_cpu_limit(int limit, CpuLimitReason reason) {
+	lock();
+	cpu_limits[(int) reason].insert(limit);
+	if (reason == CpuLimitReason::NETWORK_WAIT) network_wait_count++;
+	update_demanding_state_wo_lock(get_time_ms());
+	apply_limit_wo_lock();
+	release();
+}
+void remove_cpu_limit(int limit, CpuLimitReason reason) {
+	lock();
+	auto &limits = cpu_limits[(int) reason];
+	auto itr = limits.find(limit);
+	if (itr != limits.end()) limits.erase(itr);
+	update_demanding_state_wo_lock(get_time_ms());
+	apply_limit_wo_lock();
+	release();
+}
+
+void cpu_limit_report_video_frame(double decode_time, double interval, double frame_time) {
+	if (frame_time <= 0) return;
+	double cur_time = get_time_ms();
+	lock();
+	// a late frame caused by waiting for the stream says nothing about the cpu time
+	bool waited_network = network_wait_count != network_wait_count_at_last_frame;
+	network_wait_count_at_last_frame = network_wait_count;
+	if (!waited_network) {
+		// either the frame itself is late or the decoding can't keep up with the frame rate (the buffered frames are being used up)
+		bool late = interval > frame_time * 1.5 || decode_time > frame_time;
+		decoder_pressure = decoder_pressure * (1 - PRESSURE_SMOOTHING) + (late ? PRESSURE_SMOOTHING : 0);
+	}
+	last_frame_report_time = cur_time;
+	update_demanding_state_wo_lock(cur_time);
+	apply_limit_wo_lock();
+	release();
+}
+bool cpu_limit_decoder_is_demanding() {
+	lock();
+	update_demanding_state_wo_lock(get_time_ms());
+	bool res = decoder_demanding;
+	release();
+	return res;
+}
+
 int get_cpu_limit() {
 	u32 res;
 	APT_GetAppCpuTimeLimit(&res);
 	return res;
 }
-
@@ -1,8 +1,13 @@
+#include <unordered_map>
+#include <bitset>
+#include <list>
 #include "headers.hpp"
 #include "ui/colors.hpp"
+#include "system/util/frame_pacer.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/memory_pressure.hpp"
 
 double draw_frametime[20] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
-std::string draw_part_text[2][1024];
 C2D_Font system_fonts[4];
 C3D_RenderTarget* screen[2];
 C2D_SpriteSheet sheet_texture[128];
@@ -13,6 +18,20 @@ C2D_Image eco_image[2];
 std::string draw_japanese_kanji[3000];
 std::string draw_simple_chinese[6300];
 TickCounter draw_frame_time_timer;
+// widths of single characters at size 1.0 (they are linear in the size) in pages of 256 codepoints
+// read without any lock from any thread : a width missing in a page is measured and stored by whoever needs it
+// (racing threads store the same value), and the pages of an old fonts generation are replaced rather than cleared
+// because someone may still be reading them, they are freed in Draw_exit()
+#define DRAW_WIDTH_TABLE_END 0x110000
+namespace {
+	struct DrawWidthPage {
+		u32 generation;
+		float widths[256]; // negative : not measured yet
+	};
+}
+static DrawWidthPage *draw_width_table[DRAW_WIDTH_TABLE_END >> 8];
+static std::vector<DrawWidthPage *> draw_width_retired_pages;
+static LightMutex draw_width_retired_pages_lock;
 
 double Draw_query_frametime(void)
 {
@@ -28,16 +47,67 @@ double Draw_query_fps(void)
 	return 1000.0 / (cache / 20);
 }
 
-extern "C" void memcpy_asm_4b(u8*, u8*);
+// texture data is stored in 8x8 tiles, the texels of a tile in morton order and the tiles of a row one after another
+// a 2x2 block of texels is contiguous in a tile : block (p, r) (the texels x = 2p, 2p + 1 and y = 2r, 2r + 1) is the BLOCK_INDEX[r][p]-th one
+static constexpr int BLOCK_INDEX[4][4] = {
+	{0, 1, 4, 5},
+	{2, 3, 6, 7},
+	{8, 9, 12, 13},
+	{10, 11, 14, 15},
+};
+
+static inline int Draw_morton_index(int x, int y)
+{
+	return (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2 | (x & 4) << 2 | (y & 4) << 3;
+}
+
+// a whole tile : two source lines (16 bytes each for RGB565) are read at a time and the tile is filled block by block
+template <int pixel_size>
+static inline void Draw_swizzle_full_tile(u8* tile, const u8* src, int src_pitch)
+{
+	for (int r = 0; r < 4; r++)
+	{
+		const u8* line0 = src + (r * 2) * src_pitch;
+		const u8* line1 = line0 + src_pitch;
+		for (int p = 0; p < 4; p++)
+		{
+			u8* block = tile + BLOCK_INDEX[r][p] * 4 * pixel_size;
+			// constant sizes, so these are plain (unaligned) loads and stores
+			memcpy(block, line0 + p * 2 * pixel_size, 2 * pixel_size);
+			memcpy(block + 2 * pixel_size, line1 + p * 2 * pixel_size, 2 * pixel_size);
+		}
+	}
+}
 
-int Draw_convert_to_pos(int height, int width, int img_height, int img_width, int pixel_size)
+// the right and bottom edges : only the texels inside `width` x `height` are written
+template <int pixel_size>
+static void Draw_swizzle_partial_tile(u8* tile, const u8* src, int src_pitch, int width, int height)
 {
-	int pos = img_width * height;
-	if(pos == 0)
-		pos = img_width;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+			memcpy(tile + Draw_morton_index(x, y) * pixel_size, src + y * src_pitch + x * pixel_size, pixel_size);
+	}
+}
 
-	pos -= (img_width - width) - img_width;
-	return pos * pixel_size;
+template <int pixel_size>
+static void Draw_swizzle(u8* tex, int tex_size_x, const u8* src, int src_pitch, int width, int height)
+{
+	for (int tile_y = 0; tile_y < height; tile_y += 8)
+	{
+		u8* tile = tex + tile_y * tex_size_x * pixel_size; // a row of tiles is tex_size_x * 8 texels
+		const u8* src_line = src + tile_y * src_pitch;
+		int tile_h = std::min(8, height - tile_y);
+		for (int tile_x = 0; tile_x < width; tile_x += 8)
+		{
+			int tile_w = std::min(8, width - tile_x);
+			if (tile_w == 8 && tile_h == 8)
+				Draw_swizzle_full_tile<pixel_size>(tile, src_line + tile_x * pixel_size, src_pitch);
+			else
+				Draw_swizzle_partial_tile<pixel_size>(tile, src_line + tile_x * pixel_size, src_pitch, tile_w, tile_h);
+			tile += 64 * pixel_size;
+		}
+	}
 }
 
 Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic_width, int pic_height, int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format)
@@ -47,13 +117,9 @@ Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic
 
 Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic_width, int pic_height, int parse_start_width, int parse_start_height, int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format)
 {
+	TRACE_ZONE("Draw_set_texture_data");
 	int x_max = 0;
 	int y_max = 0;
-	int increase_list_x[tex_size_x + 8]; //= { 4, 12, 4, 44, }
-	int increase_list_y[tex_size_y + 8]; //= { 2, 6, 2, 22, 2, 6, 2, tex_size_x * 8 - 42, };
-	int count[2] = { 0, 0, };
-	int c3d_pos = 0;
-	int c3d_offset = 0;
 	int pixel_size = 0;
 	Result_with_string result;
 
@@ -68,25 +134,6 @@ Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic
 		return result;
 	}
 
-	for(int i = 0; i <= tex_size_x; i+=4)
-	{
-		increase_list_x[i] = 4 * pixel_size;
-		increase_list_x[i + 1] = 12 * pixel_size;
-		increase_list_x[i + 2] = 4 * pixel_size;
-		increase_list_x[i + 3] = 44 * pixel_size;
-	}
-	for(int i = 0; i <= tex_size_y; i+=8)
-	{
-		increase_list_y[i] = 2 * pixel_size;
-		increase_list_y[i + 1] = 6 * pixel_size;
-		increase_list_y[i + 2] = 2 * pixel_size;
-		increase_list_y[i + 3] = 22 * pixel_size;
-		increase_list_y[i + 4] = 2 * pixel_size;
-		increase_list_y[i + 5] = 6 * pixel_size;
-		increase_list_y[i + 6] = 2 * pixel_size;
-		increase_list_y[i + 7] = (tex_size_x * 8 - 42) * pixel_size;
-	}
-
 	if (parse_start_width > pic_width || parse_start_height > pic_height)
 	{
 		result.code = DEF_ERR_INVALID_ARG;
@@ -109,45 +156,33 @@ Result_with_string Draw_set_texture_data(Image_data* c2d_image, u8* buf, int pic
 	c2d_image->subtex->bottom = 1.0 - y_max / (float)tex_size_y;
 	c2d_image->c2d.subtex = c2d_image->subtex;
 
+	u8* src = buf + (parse_start_height * pic_width + parse_start_width) * pixel_size;
 	if(pixel_size == 2)
-	{
-		for(int k = 0; k < y_max; k++)
-		{
-			for(int i = 0; i < x_max; i += 2)
-			{
-				memcpy_asm_4b(&(((u8*)c2d_image->c2d.tex->data)[c3d_pos + c3d_offset]), &(((u8*)buf)[Draw_convert_to_pos(k + parse_start_height, i + parse_start_width, pic_height, pic_width, pixel_size)]));
-				c3d_pos += increase_list_x[count[0]];
-				count[0]++;
-			}
-			count[0] = 0;
-			c3d_pos = 0;
-			c3d_offset += increase_list_y[count[1]];
-			count[1]++;
-		}
-	}
-	else if(pixel_size == 3)
-	{
-		for(int k = 0; k < y_max; k++)
-		{
-			for(int i = 0; i < x_max; i += 2)
-			{
-				memcpy_asm_4b(&(((u8*)c2d_image->c2d.tex->data)[c3d_pos + c3d_offset]), &(((u8*)buf)[Draw_convert_to_pos(k + parse_start_height, i + parse_start_width, pic_height, pic_width, pixel_size)]));
-				memcpy(&(((u8*)c2d_image->c2d.tex->data)[c3d_pos + c3d_offset + 4]), &(((u8*)buf)[Draw_convert_to_pos(k + parse_start_height, i + parse_start_width, pic_height, pic_width, pixel_size) + 4]), 2);
-				c3d_pos += increase_list_x[count[0]];
-				count[0]++;
-			}
-			count[0] = 0;
-			c3d_pos = 0;
-			c3d_offset += increase_list_y[count[1]];
-			count[1]++;
-		}
-	}
+		Draw_swizzle<2>((u8*)c2d_image->c2d.tex->data, tex_size_x, src, pic_width * 2, x_max, y_max);
+	else
+		Draw_swizzle<3>((u8*)c2d_image->c2d.tex->data, tex_size_x, src, pic_width * 3, x_max, y_max);
 
 	C3D_TexFlush(c2d_image->c2d.tex);
 
 	return result;
 }
 
+void Draw_c2d_image_set_area(Image_data* c2d_image, int pic_width, int pic_height)
+{
+	int tex_size_x = c2d_image->c2d.tex->width;
+	int tex_size_y = c2d_image->c2d.tex->height;
+	pic_width = std::min(pic_width, tex_size_x);
+	pic_height = std::min(pic_height, tex_size_y);
+
+	c2d_image->subtex->width = (u16)pic_width;
+	c2d_image->subtex->height = (u16)pic_height;
+	c2d_image->subtex->left = 0.0;
+	c2d_image->subtex->top = 1.0;
+	c2d_image->subtex->right = pic_width / (float)tex_size_x;
+	c2d_image->subtex->bottom = 1.0 - pic_height / (float)tex_size_y;
+	c2d_image->c2d.subtex = c2d_image->subtex;
+}
+
 void Draw_c2d_image_set_filter(Image_data* c2d_image, bool filter)
 {
 	if(filter)
@@ -156,7 +191,7 @@ void Draw_c2d_image_set_filter(Image_data* c2d_image, bool filter)
 		C3D_TexSetFilter(c2d_image->c2d.tex, GPU_NEAREST, GPU_NEAREST);
 }
 
-Result_with_string Draw_c2d_image_init(Image_data* c2d_image, int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format)
+Result_with_string Draw_c2d_image_init(Image_data* c2d_image, int tex_size_x, int tex_size_y, GPU_TEXCOLOR color_format, MemoryTag mem_tag)
 {
 	Result_with_string result;
 
@@ -175,10 +210,12 @@ Result_with_string Draw_c2d_image_init(Image_data* c2d_image, int tex_size_x, in
 
 	if (!C3D_TexInit(c2d_image->c2d.tex, (u16)tex_size_x, (u16)tex_size_y, color_format))
 	{
+		memory_pressure_report(MemoryPressure::CRITICAL);
 		result.code = DEF_ERR_OUT_OF_LINEAR_MEMORY;
 		result.string = DEF_ERR_OUT_OF_LINEAR_MEMORY_STR;
 		return result;
 	}
+	memory_stats_add_linear(mem_tag, c2d_image->c2d.tex->size);
 
 	C3D_TexSetFilter(c2d_image->c2d.tex, GPU_LINEAR, GPU_LINEAR);
 	c2d_image->c2d.tex->border = 0xFFFFFF;
@@ -188,8 +225,10 @@ Result_with_string Draw_c2d_image_init(Image_data* c2d_image, int tex_size_x, in
 	return result;
 }
 
-void Draw_c2d_image_free(Image_data c2d_image)
+void Draw_c2d_image_free(Image_data c2d_image, MemoryTag mem_tag)
 {
+	if (c2d_image.c2d.tex->data)
+		memory_stats_add_linear(mem_tag, -(s64)c2d_image.c2d.tex->size);
 	linearFree_concurrent(c2d_image.c2d.tex->data);
 	linearFree_concurrent(c2d_image.c2d.tex);
 	linearFree_concurrent(c2d_image.subtex);
@@ -199,361 +238,250 @@ void Draw_c2d_image_free(Image_data c2d_image)
 	c2d_image.subtex = NULL;
 }
 
-void Draw(std::string text, float x, float y, float text_size_x, float text_size_y, int abgr8888)
+// a text split into runs drawn with the same font, parsed once and drawn as many times as needed
+namespace {
+	struct DrawTextLayout {
+		struct Run {
+			int font_num; // -1 : line break, 0-3 : system font, 4 : external font
+			bool use_system_font; // external font runs are also drawn with the system font while the external fonts are not loaded
+			std::string text; // external font runs only
+			C2D_Text c2d_text; // system font runs only
+		};
+		std::vector<Run> runs;
+		C2D_TextBuf c2d_buf = NULL;
+		size_t c2d_buf_bytes = 0; // accounted to MemoryTag::TEXT
+		
+		DrawTextLayout () = default;
+		DrawTextLayout (const DrawTextLayout &) = delete;
+		DrawTextLayout &operator = (const DrawTextLayout &) = delete;
+		~DrawTextLayout ()
+		{
+			if (c2d_buf)
+			{
+				C2D_TextBufDelete(c2d_buf);
+				memory_stats_add_heap(MemoryTag::TEXT, -(s64)c2d_buf_bytes);
+			}
+		}
+	};
+}
+#define DRAW_TEXT_CACHE_MAX_NUM 256 // most labels are drawn every frame without changing, so their layouts are kept
+#define DRAW_TEXT_GLYPH_BYTES 40 // size of a glyph in a C2D_TextBuf (the struct is internal to citro2d)
+#define DRAW_TEXT_CACHE_MAX_LEN 256 // longer texts are usually drawn only for a while (descriptions, comments) and not worth the memory
+static std::list<std::pair<std::string, DrawTextLayout> > draw_text_cache; // most recently used first
+static std::unordered_map<std::string, std::list<std::pair<std::string, DrawTextLayout> >::iterator> draw_text_cache_index;
+static u32 draw_text_cache_generation = 0;
+
+static void Draw_clear_text_cache(void)
+{
+	draw_text_cache_index.clear();
+	draw_text_cache.clear();
+}
+
+// system fonts : which CJK unified ideographs the JPN and CHN fonts have, built from the sample lists in Draw_load_kanji_samples()
+#define DRAW_CJK_BEGIN 0x4E00
+#define DRAW_CJK_END 0xA000
+static std::bitset<DRAW_CJK_END - DRAW_CJK_BEGIN> draw_cjk_in_font[2]; // JPN, CHN
+
+// -1 : line break, 0 - 3 : system font (JPN, CHN, KOR, TWN), 4 : external font
+static int Draw_get_font_num(u32 code, const bool font_loaded[2])
+{
+	if (code == '\n')
+		return -1;
+
+	if (code >= DRAW_CJK_BEGIN && code < DRAW_CJK_END)
+	{
+		if (font_loaded[0] && draw_cjk_in_font[0][code - DRAW_CJK_BEGIN])
+			return 0; //JPN
+		if (font_loaded[1] && draw_cjk_in_font[1][code - DRAW_CJK_BEGIN])
+			return 1; //CHN
+		return 3; //TWN
+	}
+	if ((code >= 0x3130 && code < 0x3190) || (code >= 0xAC00 && code < 0xD7B0))
+		return 2; //KOR
+	return 4;
+}
+
+static void Draw_build_text_layout(const std::string &text, DrawTextLayout &layout)
 {
-	bool reverse = false;
-	bool found = false;
 	bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
-	float width = 0, height = 0, original_x, y_offset;
 	int previous_num = -3;
-	int memcmp_result = -1;
-	int count = 0;
-	int characters = 0;
-	int font_num_list[2][1024];
-	std::string sample[8] = { "\u0000", "\u000A", "\u4DFF", "\uA000", "\u312F", "\u3190", "\uABFF", "\uD7B0", };
-	C2D_Text c2d_text;
-	C2D_TextBuf c2d_buf;
-	original_x = x;
-	c2d_buf = C2D_TextBufNew(4096);
-
-	Exfont_text_parse(text, draw_part_text[0], 1023, &characters);
-	Exfont_text_sort(draw_part_text[0], characters);
+	std::vector<Exfont_char> draw_chars(std::min<size_t>(text.size(), 1023) + 1);
+	int characters = Exfont_text_decode(text.c_str(), text.size(), draw_chars.data(), draw_chars.size() - 1);
+	Exfont_text_sort_chars(draw_chars.data(), characters);
 
+	// split into runs of the same font
 	for (int i = 0; i < characters; i++)
 	{
-		reverse = false;
-		if (memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[0].c_str(), 0x1) == 0)
+		int font_num = Draw_get_font_num(draw_chars[i].code, font_loaded);
+		if (!i || previous_num != font_num || font_num == -1)
 		{
-			font_num_list[0][i] = -2;
-			break;
+			DrawTextLayout::Run run;
+			run.font_num = font_num;
+			run.use_system_font = font_num >= 0 && (font_num <= 3 || !Exfont_is_loaded_external_font(0));
+			if (font_num >= 0 && font_num <= 3 && !Exfont_is_loaded_external_font(0))
+				system_fonts[font_num] = 0;
+			layout.runs.push_back(run);
 		}
-		else if (memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[1].c_str(), 0x1) == 0)
-		{
-			font_num_list[0][i] = -1;
-			continue;
-		}
-
-		if((memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[2].c_str(), 0x3) > 0 && memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[3].c_str(), 0x3) < 0)
-		|| (memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[4].c_str(), 0x3) > 0 && memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[5].c_str(), 0x3) < 0)
-		|| (memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[6].c_str(), 0x3) > 0 && memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[7].c_str(), 0x3) < 0))
-		{
-			if(memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[2].c_str(), 0x3) > 0 && memcmp((void*)draw_part_text[0][i].c_str(), (void*)sample[3].c_str(), 0x3) < 0)
-			{
-				found = false;
-				reverse = false;
-				memcmp_result = 1;
-
-				if(font_loaded[0])
-				{
-					for(int s = 0;;)
-					{
-						if(!reverse)
-							s += 100;
-						else
-							s--;
-
-						if((s < 0 || s > 3000) && reverse)
-							break;
-						else if(s > 3000)
-						{
-							reverse = true;
-							s = 3000;
-						}
-						else
-							memcmp_result = memcmp((void*)draw_part_text[0][i].c_str(), (void*)draw_japanese_kanji[s].c_str(), 3);
-
-						if(memcmp_result == 0)
-						{
-							font_num_list[0][i] = 0; //JPN
-							found = true;
-							break;
-						}
-						else if(memcmp_result < 0)
-							reverse = true;
-					}
-				}
-
-				if(!found)
-				{
-					reverse = false;
-					memcmp_result = 1;
-
-					if(font_loaded[1])
-					{
-						for(int s = 0;;)
-						{
-							if(!reverse)
-								s += 100;
-							else
-								s--;
-
-							if((s < 0 || s > 6300) && reverse)
-								break;
-							else if(s > 6300)
-							{
-								reverse = true;
-								s = 6300;
-							}
-							else
-								memcmp_result = memcmp((void*)draw_part_text[0][i].c_str(), (void*)draw_simple_chinese[s].c_str(), 3);
-
-							if(memcmp_result == 0)
-							{
-								font_num_list[0][i] = 1; //CHN
-								found = true;
-								break;
-							}
-							else if(memcmp_result < 0)
-								reverse = true;
-						}
-					}
-				}
-
-				if(!found)
-				  font_num_list[0][i] = 3; //TWN
-			}
-			else
-				font_num_list[0][i] = 2; //KOR
-		}
-		else
-			font_num_list[0][i] = 4;
+		if (font_num >= 0)
+			layout.runs.back().text.append(text, draw_chars[i].offset, draw_chars[i].size);
+		previous_num = font_num;
 	}
-
-	draw_part_text[1][0] = "";
-	previous_num = font_num_list[0][0];
-	for (int i = 0; i < characters; i++)
+	size_t system_font_bytes = 0;
+	for (auto &run : layout.runs) if (run.use_system_font)
+		system_font_bytes += run.text.size();
+	if (system_font_bytes)
 	{
-		if(font_num_list[0][i] == -2)
+		// a glyph takes at least one byte
+		layout.c2d_buf = C2D_TextBufNew(system_font_bytes + 1);
+		if (layout.c2d_buf)
 		{
-			font_num_list[1][count + 1] = font_num_list[0][i];
-			break;
+			layout.c2d_buf_bytes = (system_font_bytes + 1) * DRAW_TEXT_GLYPH_BYTES;
+			memory_stats_add_heap(MemoryTag::TEXT, layout.c2d_buf_bytes);
 		}
-		else if(previous_num != font_num_list[0][i] || font_num_list[0][i] == -1)
+		for (auto &run : layout.runs) if (run.use_system_font)
 		{
-			count++;
-			draw_part_text[1][count] = "";
+			C2D_TextFontParse(&run.c2d_text, run.font_num <= 3 ? system_fonts[run.font_num] : NULL, layout.c2d_buf, run.text.c_str());
+			C2D_TextOptimize(&run.c2d_text);
+			run.text.clear();
 		}
+	}
+}
 
-		draw_part_text[1][count] += draw_part_text[0][i];
-		font_num_list[1][count] = font_num_list[0][i];
-		previous_num = font_num_list[0][i];
+static const DrawTextLayout &Draw_get_text_layout(const std::string &text, DrawTextLayout &uncached_layout)
+{
+	if (text.size() > DRAW_TEXT_CACHE_MAX_LEN)
+	{
+		Draw_build_text_layout(text, uncached_layout);
+		return uncached_layout;
+	}
+	u32 generation = Exfont_get_loaded_fonts_generation();
+	if (generation != draw_text_cache_generation)
+	{
+		Draw_clear_text_cache();
+		draw_text_cache_generation = generation;
+	}
+	auto itr = draw_text_cache_index.find(text);
+	if (itr != draw_text_cache_index.end())
+	{
+		draw_text_cache.splice(draw_text_cache.begin(), draw_text_cache, itr->second);
+		return itr->second->second;
+	}
+	if (draw_text_cache.size() >= DRAW_TEXT_CACHE_MAX_NUM)
+	{
+		draw_text_cache_index.erase(draw_text_cache.back().first);
+		draw_text_cache.pop_back();
 	}
+	draw_text_cache.emplace_front();
+	draw_text_cache.front().first = text;
+	Draw_build_text_layout(text, draw_text_cache.front().second);
+	draw_text_cache_index[text] = draw_text_cache.begin();
+	return draw_text_cache.front().second;
+}
+
+void Draw(const std::string &text, float x, float y, float text_size_x, float text_size_y, int abgr8888)
+{
+	float width = 0, height = 0, original_x = x, y_offset;
+	DrawTextLayout uncached_layout;
+	const DrawTextLayout &layout = Draw_get_text_layout(text, uncached_layout);
 
-	for (int i = 0; i <= count; i++)
+	for (auto &run : layout.runs)
 	{
-		if (font_num_list[1][i] == -2)
-			break;
-		else if (font_num_list[1][i] == -1)
+		if (run.font_num == -1)
 		{
 			y += 20.0 * text_size_y;
 			x = original_x;
 			continue;
 		}
 
-		if(!Exfont_is_loaded_external_font(0) || (font_num_list[1][i] >= 0 && font_num_list[1][i] <= 3))
+		if (run.use_system_font)
 		{
-			if(!Exfont_is_loaded_external_font(0))
-				system_fonts[font_num_list[1][i]] = 0;
-
-			C2D_TextBufClear(c2d_buf);
-			if(font_num_list[1][i] == 1)
+			if(run.font_num == 1)
 				y_offset = 3 * text_size_y;
-			else if(font_num_list[1][i] == 3)
+			else if(run.font_num == 3)
 				y_offset = 5 * text_size_y;
 			else
 				y_offset = 0;
 
-			C2D_TextFontParse(&c2d_text, system_fonts[font_num_list[1][i]], c2d_buf, draw_part_text[1][i].c_str());
-			C2D_TextOptimize(&c2d_text);
-			C2D_TextGetDimensions(&c2d_text, text_size_x, text_size_y, &width, &height);
-			C2D_DrawText(&c2d_text, C2D_WithColor, x, y + y_offset, 0.0, text_size_x, text_size_y, abgr8888);
+			C2D_TextGetDimensions(&run.c2d_text, text_size_x, text_size_y, &width, &height);
+			C2D_DrawText(&run.c2d_text, C2D_WithColor, x, y + y_offset, 0.0, text_size_x, text_size_y, abgr8888);
 			x += width;
 		}
-		else if(font_num_list[1][i] == 4)
+		else if (run.font_num == 4)
 		{
-			Exfont_draw_external_fonts(draw_part_text[1][i], x, y, text_size_x * 1.56, text_size_y * 1.56, abgr8888, &width, &height);
+			Exfont_draw_external_fonts(run.text, x, y, text_size_x * 1.56, text_size_y * 1.56, abgr8888, &width, &height);
 			x += width;
 		}
 	}
-	C2D_TextBufDelete(c2d_buf);
 }
 
 float Draw_get_height(std::string text, float text_size_x, float text_size_y) {
 	if (text == "") return 0;
-	int characters;
-	std::vector<std::string> part_text(text.size() + 1);
-	Exfont_text_parse(text, &part_text[0], text.size(), &characters);
 	int lines = 1;
-	for (int i = 0; i < characters; i++) if (part_text[i] == "\n") lines++;
+	for (auto c : text) {
+		if (!c) break;
+		if (c == '\n') lines++;
+	}
 	return lines * 20.0 * text_size_y;
 }
 
-float Draw_get_width(std::string text, float text_size_x, float text_size_y)
+// the width of a character at size 1.0, only reads the fonts so that it can be called from any thread
+static float Draw_get_width_code(u32 code, const bool font_loaded[2])
 {
-	float x = 0, x_max = 0;
-	bool reverse = false;
-	bool found = false;
-	bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
-	int previous_num = -3;
-	int memcmp_result = -1;
-	int count = 0;
-	int characters = 0;
-	static const std::string sample[8] = { "\u0000", "\u000A", "\u4DFF", "\uA000", "\u312F", "\u3190", "\uABFF", "\uD7B0", };
-	
-	std::vector<std::string> part_text[2];
-	for (int i = 0; i < 2; i++) part_text[i].resize(text.size() + 1);
-	Exfont_text_parse(text, &part_text[0][0], text.size(), &characters);
-	Exfont_text_sort(&part_text[0][0], characters);
-	
-	
-	std::vector<int> font_num_list[2];
-	for (int i = 0; i < 2; i++) font_num_list[i].resize(characters + 1);
-	
-	for (int i = 0; i < characters; i++) {
-		reverse = false;
-		if (memcmp((void*)part_text[0][i].c_str(), (void*)sample[0].c_str(), 0x1) == 0) {
-			font_num_list[0][i] = -2;
-			break;
-		} else if (memcmp((void*)part_text[0][i].c_str(), (void*)sample[1].c_str(), 0x1) == 0) {
-			font_num_list[0][i] = -1;
-			continue;
-		}
+	int font_index = Draw_get_font_num(code, font_loaded);
+	if (font_index == -1) return 0;
+	if(!Exfont_is_loaded_external_font(0) || font_index <= 3) {
+		fontGlyphPos_s glyphData;
+		// drawn with the default system font while the external fonts are not loaded (see Draw_build_text_layout())
+		C2D_Font font = font_index <= 3 && Exfont_is_loaded_external_font(0) ? system_fonts[font_index] : NULL;
+		C2D_FontCalcGlyphPos(font, &glyphData, C2D_FontGlyphIndexFromCodePoint(font, code), 0, 1.0f, 1.0f);
+		return glyphData.xAdvance;
+	} else return Exfont_get_width_code(code, 1.56);
+}
 
-		if((memcmp((void*)part_text[0][i].c_str(), (void*)sample[2].c_str(), 0x3) > 0 && memcmp((void*)part_text[0][i].c_str(), (void*)sample[3].c_str(), 0x3) < 0)
-		|| (memcmp((void*)part_text[0][i].c_str(), (void*)sample[4].c_str(), 0x3) > 0 && memcmp((void*)part_text[0][i].c_str(), (void*)sample[5].c_str(), 0x3) < 0)
-		|| (memcmp((void*)part_text[0][i].c_str(), (void*)sample[6].c_str(), 0x3) > 0 && memcmp((void*)part_text[0][i].c_str(), (void*)sample[7].c_str(), 0x3) < 0))
-		{
-			if(memcmp((void*)part_text[0][i].c_str(), (void*)sample[2].c_str(), 0x3) > 0 && memcmp((void*)part_text[0][i].c_str(), (void*)sample[3].c_str(), 0x3) < 0)
-			{
-				found = false;
-				reverse = false;
-				memcmp_result = 1;
-
-				if(font_loaded[0])
-				{
-					for(int s = 0;;)
-					{
-						if(!reverse)
-							s += 100;
-						else
-							s--;
-
-						if((s < 0 || s > 3000) && reverse)
-							break;
-						else if(s > 3000)
-						{
-							reverse = true;
-							s = 3000;
-						}
-						else
-							memcmp_result = memcmp((void*)part_text[0][i].c_str(), (void*)draw_japanese_kanji[s].c_str(), 3);
-
-						if(memcmp_result == 0)
-						{
-							font_num_list[0][i] = 0; //JPN
-							found = true;
-							break;
-						}
-						else if(memcmp_result < 0)
-							reverse = true;
-					}
-				}
-
-				if(!found)
-				{
-					reverse = false;
-					memcmp_result = 1;
-
-					if(font_loaded[1])
-					{
-						for(int s = 0;;)
-						{
-							if(!reverse)
-								s += 100;
-							else
-								s--;
-
-							if((s < 0 || s > 6300) && reverse)
-								break;
-							else if(s > 6300)
-							{
-								reverse = true;
-								s = 6300;
-							}
-							else
-								memcmp_result = memcmp((void*)part_text[0][i].c_str(), (void*)draw_simple_chinese[s].c_str(), 3);
-
-							if(memcmp_result == 0)
-							{
-								font_num_list[0][i] = 1; //CHN
-								found = true;
-								break;
-							}
-							else if(memcmp_result < 0)
-								reverse = true;
-						}
-					}
-				}
-
-				if(!found)
-				  font_num_list[0][i] = 3; //TWN
+static float Draw_get_cached_width(u32 code, const bool font_loaded[2])
+{
+	if (code >= DRAW_WIDTH_TABLE_END) return Draw_get_width_code(code, font_loaded);
+	u32 generation = Exfont_get_loaded_fonts_generation();
+	DrawWidthPage **page_ptr = &draw_width_table[code >> 8];
+	DrawWidthPage *page = __atomic_load_n(page_ptr, __ATOMIC_ACQUIRE);
+	if (!page || page->generation != generation) {
+		DrawWidthPage *new_page = (DrawWidthPage *) malloc(sizeof(DrawWidthPage));
+		if (!new_page) return Draw_get_width_code(code, font_loaded);
+		new_page->generation = generation;
+		for (auto &width : new_page->widths) width = -1;
+		if (__atomic_compare_exchange_n(page_ptr, &page, new_page, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			if (page) {
+				LightMutexGuard guard(draw_width_retired_pages_lock);
+				draw_width_retired_pages.push_back(page);
 			}
-			else
-				font_num_list[0][i] = 2; //KOR
-		}
-		else
-			font_num_list[0][i] = 4;
+			page = new_page;
+		} else free(new_page); // someone else replaced it first, `page` is theirs now
 	}
-
-	part_text[1][0] = "";
-	previous_num = font_num_list[0][0];
-	for (int i = 0; i < characters; i++)
-	{
-		if(font_num_list[0][i] == -2)
-		{
-			font_num_list[1][count + 1] = font_num_list[0][i];
-			break;
-		}
-		else if(previous_num != font_num_list[0][i] || font_num_list[0][i] == -1)
-		{
-			count++;
-			part_text[1][count] = "";
-		}
-
-		part_text[1][count] += part_text[0][i];
-		font_num_list[1][count] = font_num_list[0][i];
-		previous_num = font_num_list[0][i];
+	float width;
+	__atomic_load(&page->widths[code & 0xFF], &width, __ATOMIC_RELAXED);
+	if (width < 0) {
+		width = Draw_get_width_code(code, font_loaded);
+		__atomic_store(&page->widths[code & 0xFF], &width, __ATOMIC_RELAXED);
 	}
+	return width;
+}
 
-	for (int i = 0; i <= count; i++)
-	{
-		if (font_num_list[1][i] == -2) break;
-		else if (font_num_list[1][i] == -1) {
-			x = 0;
-			continue;
-		}
-
-		if (!Exfont_is_loaded_external_font(0) || (font_num_list[1][i] >= 0 && font_num_list[1][i] <= 3)) {
-			if(!Exfont_is_loaded_external_font(0))
-				system_fonts[font_num_list[1][i]] = 0;
-			
-			fontGlyphPos_s glyphData;
-			auto &font = system_fonts[font_num_list[1][i]];
-			uint8_t *head = (uint8_t *) part_text[1][i].c_str();
-			while (*head != '\n' && *head) {
-				u32 code;
-				ssize_t units = decode_utf8(&code, head);
-				
-				if (units == -1) {
-					code = 0xFFFD;
-					units = 1;
-				}
-				head += units;
-				C2D_FontCalcGlyphPos(font, &glyphData, C2D_FontGlyphIndexFromCodePoint(font, code), 0, 1.0f, 1.0f);
-				x += glyphData.xAdvance * text_size_x;
-			}
-		} else if(font_num_list[1][i] == 4) x += Exfont_get_width(part_text[1][i], text_size_x * 1.56);
-		
+float Draw_get_width(const std::string &text, float text_size_x, float text_size_y)
+{
+	bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
+	Exfont_char chars_buf[64];
+	std::vector<Exfont_char> chars_long;
+	Exfont_char *chars = chars_buf;
+	if (text.size() > 64) {
+		chars_long.resize(text.size());
+		chars = chars_long.data();
+	}
+	int characters = Exfont_text_decode(text.c_str(), text.size(), chars, std::max<int>(text.size(), 64));
+	
+	float x = 0, x_max = 0;
+	for (int i = 0; i < characters; i++) {
+		if (chars[i].code == '\n') x = 0;
+		else x += Draw_get_cached_width(chars[i].code, font_loaded) * text_size_x;
 		x_max = std::max(x_max, x);
 	}
 	
@@ -562,116 +490,17 @@ float Draw_get_width(std::string text, float text_size_x, float text_size_y)
 
 float Draw_get_width_one(const std::string &character, float text_size_x)
 {
-	if (!character.size() || !character[0] || character[0] == '\n') return 0;
-	int font_index;
-	{
-		static const std::string sample[8] = { "\u0000", "\u000A", "\u4DFF", "\uA000", "\u312F", "\u3190", "\uABFF", "\uD7B0", };
-		static_assert(strlen("\u4DFF") == 3);
-		static_assert(strlen("\uA000") == 3);
-		static_assert(strlen("\u312F") == 3);
-		static_assert(strlen("\u3190") == 3);
-		static_assert(strlen("\uABFF") == 3);
-		static_assert(strlen("\uD7B0") == 3);
-		bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
-		
-		if ((character.c_str() > sample[2] && character < sample[3])
-		||  (character.c_str() > sample[4] && character < sample[5])
-		||  (character.c_str() > sample[6] && character < sample[7])
-		) {
-			if(memcmp((void*)character.c_str(), (void*)sample[2].c_str(), 0x3) > 0 && memcmp((void*)character.c_str(), (void*)sample[3].c_str(), 0x3) < 0)
-			{
-				bool found = false;
-				bool reverse = false;
-				int memcmp_result = 1;
-
-				if(font_loaded[0])
-				{
-					for(int s = 0;;)
-					{
-						if(!reverse)
-							s += 100;
-						else
-							s--;
-
-						if((s < 0 || s > 3000) && reverse)
-							break;
-						else if(s > 3000)
-						{
-							reverse = true;
-							s = 3000;
-						}
-						else
-							memcmp_result = memcmp((void*)character.c_str(), (void*)draw_japanese_kanji[s].c_str(), 3);
-
-						if(memcmp_result == 0)
-						{
-							font_index = 0; //JPN
-							found = true;
-							break;
-						}
-						else if(memcmp_result < 0)
-							reverse = true;
-					}
-				}
-
-				if(!found)
-				{
-					reverse = false;
-					memcmp_result = 1;
-
-					if(font_loaded[1])
-					{
-						for(int s = 0;;)
-						{
-							if(!reverse)
-								s += 100;
-							else
-								s--;
-
-							if((s < 0 || s > 6300) && reverse)
-								break;
-							else if(s > 6300)
-							{
-								reverse = true;
-								s = 6300;
-							}
-							else
-								memcmp_result = memcmp((void*)character.c_str(), (void*)draw_simple_chinese[s].c_str(), 3);
-
-							if(memcmp_result == 0)
-							{
-								font_index = 1; //CHN
-								found = true;
-								break;
-							}
-							else if(memcmp_result < 0)
-								reverse = true;
-						}
-					}
-				}
-
-				if(!found)
-				  font_index = 3; //TWN
-			}
-			else
-				font_index = 2; //KOR
-		}
-		else
-			font_index = 4;
-	}
-	float res = 0;
-	if(!Exfont_is_loaded_external_font(0) || (font_index >= 0 && font_index <= 3)) {
-		if(!Exfont_is_loaded_external_font(0))
-			system_fonts[font_index] = 0;
-		
-		fontGlyphPos_s glyphData;
-		auto font = system_fonts[font_index];
-		u32 code;
-		if (decode_utf8(&code, (u8 *) character.c_str()) == -1) code = 0xFFFD;
-		C2D_FontCalcGlyphPos(font, &glyphData, C2D_FontGlyphIndexFromCodePoint(font, code), 0, 1.0f, 1.0f);
-		res += glyphData.xAdvance * text_size_x;
-	} else if (font_index == 4) res += Exfont_get_width_one(character, text_size_x * 1.56);
-	return res;
+	bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
+	u32 code;
+	if (!character.size() || !character[0]) return 0;
+	if (decode_utf8(&code, (u8 *) character.c_str()) == -1) code = 0xFFFD;
+	return Draw_get_width_code(code, font_loaded) * text_size_x;
+}
+
+void Draw_get_widths(const Exfont_char *chars, int num, float text_size_x, float *out_widths)
+{
+	bool font_loaded[2] = { Exfont_is_loaded_system_font(0), Exfont_is_loaded_system_font(1), };//JPN, CHN
+	for (int i = 0; i < num; i++) out_widths[i] = Draw_get_cached_width(chars[i].code, font_loaded) * text_size_x;
 }
 
 
@@ -725,11 +554,28 @@ Result_with_string Draw_load_texture(std::string file_name, int sheet_map_num, C
 	return load_texture_result;
 }
 
+static bool draw_touch_pos_shown = false;
+static int draw_touch_pos_x = -1;
+static int draw_touch_pos_y = -1;
+
 void Draw_touch_pos(void)
 {
 	Hid_info key;
 	Util_hid_query_key_state(&key);
-	if(key.p_touch || key.h_touch) Draw_texture(var_square_image[0], DEF_DRAW_RED, key.touch_x - 1, key.touch_y - 1, 3, 3);
+	draw_touch_pos_shown = key.p_touch || key.h_touch;
+	draw_touch_pos_x = key.touch_x;
+	draw_touch_pos_y = key.touch_y;
+	if(draw_touch_pos_shown) Draw_texture(var_square_image[0], DEF_DRAW_RED, key.touch_x - 1, key.touch_y - 1, 3, 3);
+}
+
+bool Draw_is_touch_pos_outdated(void)
+{
+	Hid_info key;
+	Util_hid_query_key_state(&key);
+	bool shown = key.p_touch || key.h_touch;
+	if(shown != draw_touch_pos_shown)
+		return true;
+	return shown && (key.touch_x != draw_touch_pos_x || key.touch_y != draw_touch_pos_y);
 }
 
 void Draw_top_ui(void)
@@ -779,7 +625,11 @@ void Draw_texture(C2D_Image image, int abgr8888, float x, float y, float x_size,
 
 	if (!(image.tex == NULL))
 	{
-		if(abgr8888 == DEF_DRAW_NO_COLOR)
+		// citro2d batches vertices until the texture changes, and solid rectangles don't need one,
+		// so colored squares (backgrounds, separators...) drawn this way don't split the batches of thumbnails and glyphs
+		if(image.tex == var_square_image[0].tex && abgr8888 != DEF_DRAW_NO_COLOR)
+			C2D_DrawRectSolid(x, y, 0.0f, x_size, y_size, abgr8888);
+		else if(abgr8888 == DEF_DRAW_NO_COLOR)
 			C2D_DrawImage(image, &c2d_parameter, NULL);
 		else
 		{
@@ -831,6 +681,30 @@ void Draw_debug_info(void)
 	Draw("Frametime: " + std::to_string(draw_frametime[19]).substr(0, 6) + "ms", 0.0, 190.0, 0.4, 0.4, color);
 	Draw("RAM: " + std::to_string(var_free_ram / 1000.0).substr(0, 5) + " MB", 0.0, 200.0, 0.4, 0.4, color);
 	Draw("linear RAM: " + std::to_string(var_free_linear_ram / 1000.0 / 1000.0).substr(0, 5) +" MB", 0.0, 210.0, 0.4, 0.4, color);
+
+	// per tag usage / high-water mark in KB
+	Draw_texture(var_square_image[0], DEF_DRAW_WEAK_BLUE, 220.0, 20.0, 180.0, 100.0);
+	Draw("KB      heap (peak)   linear (peak)", 220.0, 20.0, 0.4, 0.4, color);
+	for (int i = 0; i < (int)MemoryTag::NUM; i++)
+	{
+		MemoryTagUsage usage = memory_stats_get((MemoryTag)i);
+		Draw(memory_stats_get_tag_name((MemoryTag)i), 220.0, 30.0 + i * 10, 0.4, 0.4, color);
+		Draw(std::to_string(usage.heap / 1024) + " (" + std::to_string(usage.heap_peak / 1024) + ")", 270.0, 30.0 + i * 10, 0.4, 0.4, color);
+		Draw(std::to_string(usage.linear / 1024) + " (" + std::to_string(usage.linear_peak / 1024) + ")", 335.0, 30.0 + i * 10, 0.4, 0.4, color);
+	}
+	Draw("untagged", 220.0, 30.0 + (int)MemoryTag::NUM * 10, 0.4, 0.4, color);
+	Draw(std::to_string(memory_stats_get_untagged_heap() / 1024), 270.0, 30.0 + (int)MemoryTag::NUM * 10, 0.4, 0.4, color);
+}
+
+static void Draw_set_cjk_in_font(const std::string *samples, int num, std::bitset<DRAW_CJK_END - DRAW_CJK_BEGIN> &res)
+{
+	res.reset();
+	for (int i = 0; i < num; i++)
+	{
+		u32 code;
+		if (decode_utf8(&code, (const u8 *) samples[i].c_str()) > 0 && code >= DRAW_CJK_BEGIN && code < DRAW_CJK_END)
+			res[code - DRAW_CJK_BEGIN] = true;
+	}
 }
 
 Result_with_string Draw_load_kanji_samples(void)
@@ -844,11 +718,13 @@ Result_with_string Draw_load_kanji_samples(void)
 	result = Util_file_load_from_rom("kanji.txt", "romfs:/gfx/font/sample/", fs_buffer, 0x8000, &read_size);
 	if(result.code == 0)
 		Exfont_text_parse((char*)fs_buffer, draw_japanese_kanji, 3000, &characters);
+	Draw_set_cjk_in_font(draw_japanese_kanji, characters, draw_cjk_in_font[0]);
 
 	memset((void*)fs_buffer, 0x0, 0x8000);
 	result = Util_file_load_from_rom("hanyu_s.txt", "romfs:/gfx/font/sample/", fs_buffer, 0x8000, &read_size);
 	if(result.code == 0)
 		Exfont_text_parse((char*)fs_buffer, draw_simple_chinese, 6300, &characters);
+	Draw_set_cjk_in_font(draw_simple_chinese, characters, draw_cjk_in_font[1]);
 
 	free(fs_buffer);
 	return result;
@@ -959,17 +835,42 @@ void Draw_exit(void)
 {
 	for (int i = 0; i < 128; i++)
 		Draw_free_texture(i);
+	Draw_clear_text_cache();
+	for (auto &page : draw_width_table)
+	{
+		free(page);
+		page = NULL;
+	}
+	for (auto page : draw_width_retired_pages)
+		free(page);
+	draw_width_retired_pages.clear();
 	for (int i = 0; i < 4; i++)
 		Draw_free_system_font(i);
+	Draw_yuv_exit();
 
 	C2D_Fini();
 	C3D_Fini();
 	gfxExit();
 }
 
+static u64 draw_frame_start_tick = 0; // for the "frame" trace zone, which spans from Draw_frame_ready() to Draw_apply_draw()
+
 void Draw_frame_ready(void)
 {
-	C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+	frame_pacer_ui_done();
+	{
+		TRACE_ZONE("C3D_FrameBegin");
+		C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+	}
+	frame_pacer_frame_start();
+	draw_frame_start_tick = svcGetSystemTick();
+}
+
+void Draw_skip_frame(void)
+{
+	frame_pacer_ui_done();
+	gspWaitForVBlank();
+	frame_pacer_frame_start();
 }
 
 void Draw_screen_ready(int screen_num, int abgr8888)
@@ -984,6 +885,8 @@ void Draw_screen_ready(int screen_num, int abgr8888)
 void Draw_apply_draw(void)
 {
 	C3D_FrameEnd(0);
+	if (trace_capturing)
+		trace_record("frame", draw_frame_start_tick, svcGetSystemTick());
 	osTickCounterUpdate(&draw_frame_time_timer);
 	draw_frametime[19] = osTickCounterRead(&draw_frame_time_timer);
 	for(int i = 0; i < 19; i++)
@@ -0,0 +1,177 @@
+#include "headers.hpp"
+#include "system/draw/etc1.hpp"
+
+// indexed by the pixel index value (msb << 1 | lsb)
+static const int etc1_modifiers[8][4] = {
+	{ 2, 8, -2, -8 }, { 5, 17, -5, -17 }, { 9, 29, -9, -29 }, { 13, 42, -13, -42 },
+	{ 18, 60, -18, -60 }, { 24, 80, -24, -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 },
+};
+
+namespace {
+	struct Etc1SubBlock {
+		int base[3]; // the base color expanded to 8 bits
+		int table;
+		int indices[8];
+		int error;
+	};
+	struct Etc1Candidate {
+		bool diff;
+		int quantized[2][3]; // the base colors as they are written (4 bits each in the individual mode, 5 bits in the differential mode)
+		Etc1SubBlock sub[2];
+		int error;
+	};
+}
+
+// the pixels of subblock `sub` (0 or 1) in the order of Draw_etc1_encode_block(), as indices into the 16 pixels of the block
+static inline int Draw_etc1_subblock_pixel(bool flip, int sub, int i)
+{
+	// not flipped : 2x4 left and right halves, flipped : 4x2 top and bottom halves
+	int x = flip ? (i & 3) : sub * 2 + (i >> 2);
+	int y = flip ? sub * 2 + (i >> 2) : (i & 3);
+	return y * 4 + x;
+}
+
+// chooses the codeword table and the modifier of each pixel for `subblock.base`
+// error(m) = sum over the channels of (base + m - pixel)^2 = const + 3m^2 - 2m * d where d = sum(pixel - base)
+static void Draw_etc1_choose_modifiers(const int (*rgb)[3], bool flip, int sub, Etc1SubBlock* subblock)
+{
+	int d[8];
+	int base_error = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		const int* pixel = rgb[Draw_etc1_subblock_pixel(flip, sub, i)];
+		d[i] = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			int diff = pixel[c] - subblock->base[c];
+			d[i] += diff;
+			base_error += diff * diff;
+		}
+	}
+	subblock->error = std::numeric_limits<int>::max();
+	for (int table = 0; table < 8; table++)
+	{
+		int error = base_error;
+		int indices[8];
+		for (int i = 0; i < 8; i++)
+		{
+			int best = std::numeric_limits<int>::max();
+			for (int index = 0; index < 4; index++)
+			{
+				int m = etc1_modifiers[table][index];
+				int cur = 3 * m * m - 2 * m * d[i];
+				if (cur < best)
+				{
+					best = cur;
+					indices[i] = index;
+				}
+			}
+			error += best;
+		}
+		if (error < subblock->error)
+		{
+			subblock->error = error;
+			subblock->table = table;
+			memcpy(subblock->indices, indices, sizeof(indices));
+		}
+	}
+}
+
+static void Draw_etc1_try_flip(const int (*rgb)[3], bool flip, Etc1Candidate* candidate)
+{
+	int avg[2][3];
+	for (int sub = 0; sub < 2; sub++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int sum = 0;
+			for (int i = 0; i < 8; i++)
+				sum += rgb[Draw_etc1_subblock_pixel(flip, sub, i)][c];
+			avg[sub][c] = (sum + 4) / 8;
+		}
+	}
+
+	// the differential mode has more precision, but the second color must be within -4 - +3 of the first
+	candidate->diff = true;
+	for (int sub = 0; sub < 2; sub++)
+		for (int c = 0; c < 3; c++)
+			candidate->quantized[sub][c] = (avg[sub][c] * 31 + 127) / 255;
+	for (int c = 0; c < 3; c++)
+	{
+		int delta = candidate->quantized[1][c] - candidate->quantized[0][c];
+		if (delta < -4 || delta > 3)
+			candidate->diff = false;
+	}
+	if (!candidate->diff)
+	{
+		for (int sub = 0; sub < 2; sub++)
+			for (int c = 0; c < 3; c++)
+				candidate->quantized[sub][c] = (avg[sub][c] * 15 + 127) / 255;
+	}
+
+	candidate->error = 0;
+	for (int sub = 0; sub < 2; sub++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int q = candidate->quantized[sub][c];
+			candidate->sub[sub].base[c] = candidate->diff ? (q << 3 | q >> 2) : (q << 4 | q);
+		}
+		Draw_etc1_choose_modifiers(rgb, flip, sub, &candidate->sub[sub]);
+		candidate->error += candidate->sub[sub].error;
+	}
+}
+
+void Draw_etc1_encode_block(const u16* pixels, u8* out)
+{
+	int rgb[16][3];
+	for (int i = 0; i < 16; i++)
+	{
+		int r = pixels[i] >> 11;
+		int g = pixels[i] >> 5 & 0x3F;
+		int b = pixels[i] & 0x1F;
+		rgb[i][0] = r << 3 | r >> 2;
+		rgb[i][1] = g << 2 | g >> 4;
+		rgb[i][2] = b << 3 | b >> 2;
+	}
+
+	Etc1Candidate candidates[2];
+	Draw_etc1_try_flip(rgb, false, &candidates[0]);
+	Draw_etc1_try_flip(rgb, true, &candidates[1]);
+	bool flip = candidates[1].error < candidates[0].error;
+	const Etc1Candidate &best = candidates[flip];
+
+	u64 block = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		int shift = 59 - c * 8; // R : bits 63 - 56, G : 55 - 48, B : 47 - 40
+		if (best.diff)
+		{
+			int delta = best.quantized[1][c] - best.quantized[0][c];
+			block |= (u64) best.quantized[0][c] << shift;
+			block |= (u64) (delta & 7) << (shift - 3);
+		}
+		else
+		{
+			block |= (u64) best.quantized[0][c] << (shift + 1);
+			block |= (u64) best.quantized[1][c] << (shift - 3);
+		}
+	}
+	block |= (u64) best.sub[0].table << 37;
+	block |= (u64) best.sub[1].table << 34;
+	block |= (u64) best.diff << 33;
+	block |= (u64) flip << 32;
+	// the pixel at (x, y) is the bit x * 4 + y of the lsb and msb halves
+	for (int sub = 0; sub < 2; sub++)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			int pixel = Draw_etc1_subblock_pixel(flip, sub, i);
+			int bit = (pixel & 3) * 4 + (pixel >> 2);
+			int index = best.sub[sub].indices[i];
+			block |= (u64) (index & 1) << bit;
+			block |= (u64) (index >> 1) << (bit + 16);
+		}
+	}
+	memcpy(out, &block, ETC1_BLOCK_SIZE);
+}
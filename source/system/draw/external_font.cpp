@@ -1,4 +1,5 @@
-﻿#include "headers.hpp"
+﻿#include <bitset>
+#include "headers.hpp"
 
 bool exfont_loaded_external_font[DEF_EXFONT_NUM_OF_FONT_NAME];
 bool exfont_request_external_font_state[DEF_EXFONT_NUM_OF_FONT_NAME];
@@ -9,6 +10,13 @@ bool exfont_load_external_font_request = false;
 bool exfont_unload_external_font_request = false;
 bool exfont_load_system_font_request = false;
 bool exfont_unload_system_font_request = false;
+volatile u32 exfont_loaded_fonts_generation = 0;
+// blocks that aren't requested explicitly are loaded when a character of them is looked up and unloaded when unused for a while
+#define EXFONT_BLOCK_UNLOAD_TIME 60000 // ms since the last lookup
+#define EXFONT_BLOCK_UNLOAD_GRACE_TIME 100000 // us between hiding a block and freeing its textures (frames in flight may still use them)
+volatile bool exfont_wanted_external_font[DEF_EXFONT_NUM_OF_FONT_NAME];
+volatile u32 exfont_last_used_external_font[DEF_EXFONT_NUM_OF_FONT_NAME]; // osGetTime() of the last lookup, truncated
+bool exfont_failed_external_font[DEF_EXFONT_NUM_OF_FONT_NAME];
 double exfont_font_interval[10240] =
 {
   //#0000~#007F (128) Basic latin
@@ -608,7 +616,6 @@ double exfont_font_interval[10240] =
   17, 14, 14, 14, 15, 14, 16, 14, 16, 14, 14, 14, 14, 14, 14, 14,
 };
 
-std::string exfont_part_string[1024];
 std::string exfont_font_samples[10241];
 std::string exfont_font_right_to_left_samples[257];
 std::string exfont_font_name[DEF_EXFONT_NUM_OF_FONT_NAME];
@@ -671,6 +678,86 @@ int exfont_font_characters[DEF_EXFONT_NUM_OF_FONT_NAME] = {
 int exfont_num_of_right_left_charcters = 0;
 int exfont_font_start_num[DEF_EXFONT_NUM_OF_FONT_NAME];
 Thread exfont_load_font_thread;
+// codepoint -> glyph (an index of exfont_font_samples and exfont_font_images), built from the samples in Exfont_init()
+#define EXFONT_GLYPH_TABLE_END 0x20000 // no external font has a character beyond this
+#define EXFONT_GLYPH_NONE 0xFFFF
+#define EXFONT_GLYPH_IGNORED 0xFFFE
+u16 *exfont_glyph_table[EXFONT_GLYPH_TABLE_END >> 8]; // pages of 256 codepoints, NULL if none of them has a glyph
+u8 exfont_glyph_block[10240]; // which external font each glyph belongs to
+
+static u16 *Exfont_get_glyph_table_page(u32 code)
+{
+    u16 *&page = exfont_glyph_table[code >> 8];
+    if (!page)
+    {
+        page = (u16*)malloc(256 * sizeof(u16));
+        if (page)
+            for (int i = 0; i < 256; i++) page[i] = EXFONT_GLYPH_NONE;
+    }
+    return page;
+}
+
+#define EXFONT_RTL_BEGIN 0x05BE
+#define EXFONT_RTL_END 0x0700
+std::bitset<EXFONT_RTL_END - EXFONT_RTL_BEGIN> exfont_is_right_to_left; // built from exfont_font_right_to_left_samples in Exfont_init()
+u32 exfont_right_to_left_special = 0; // exfont_font_right_to_left_samples[201], outside of the range above
+
+static bool Exfont_is_right_to_left(u32 code)
+{
+    if (code == exfont_right_to_left_special)
+        return true;
+    return code >= EXFONT_RTL_BEGIN && code < EXFONT_RTL_END && exfont_is_right_to_left[code - EXFONT_RTL_BEGIN];
+}
+
+static void Exfont_build_glyph_table(void)
+{
+    for (int block = 0; block < DEF_EXFONT_NUM_OF_FONT_NAME; block++)
+    {
+        for (int i = exfont_font_start_num[block]; i < exfont_font_start_num[block] + exfont_font_characters[block]; i++)
+        {
+            exfont_glyph_block[i] = block;
+            u32 code;
+            if (decode_utf8(&code, (const u8*)exfont_font_samples[i].c_str()) <= 0 || !code || code >= EXFONT_GLYPH_TABLE_END)
+                continue;
+            u16 *page = Exfont_get_glyph_table_page(code);
+            if (page && page[code & 0xFF] == EXFONT_GLYPH_NONE)
+                page[code & 0xFF] = i;
+        }
+    }
+    // zero width characters
+    const u8 *head = (const u8*)exfont_ignore_chars.c_str();
+    while (*head)
+    {
+        u32 code;
+        ssize_t units = decode_utf8(&code, head);
+        if (units <= 0)
+            break;
+        head += units;
+        u16 *page = code < EXFONT_GLYPH_TABLE_END ? Exfont_get_glyph_table_page(code) : NULL;
+        if (page)
+            page[code & 0xFF] = EXFONT_GLYPH_IGNORED;
+    }
+}
+
+// the glyph to draw `code` with, -1 if no loaded font has it (the unknown glyph is drawn instead), -2 if it's drawn as nothing
+static int Exfont_find_glyph(u32 code)
+{
+    if (code >= EXFONT_GLYPH_TABLE_END)
+        return -1;
+    u16 *page = exfont_glyph_table[code >> 8];
+    if (!page || page[code & 0xFF] == EXFONT_GLYPH_NONE)
+        return -1;
+    if (page[code & 0xFF] == EXFONT_GLYPH_IGNORED)
+        return -2;
+    int glyph = page[code & 0xFF];
+    int block = exfont_glyph_block[glyph];
+    exfont_last_used_external_font[block] = (u32) osGetTime();
+    if (exfont_loaded_external_font[block])
+        return glyph;
+    // drawn as the unknown glyph until the loader thread has loaded the block
+    exfont_wanted_external_font[block] = true;
+    return -1;
+}
 
 void Exfont_load_font_thread(void* arg)
 {
@@ -710,6 +797,7 @@ void Exfont_load_font_thread(void* arg)
 					Util_log_save(DEF_EXFONT_LOAD_FONT_THREAD_STR, "Draw_load_system_font()..." + result.string + result.error_description, result.code);
                     if(result.code == 0 || i == var_system_region)
                         exfont_loaded_system_font[i] = true;
+                    exfont_loaded_fonts_generation++;
                 }
             }
             exfont_load_system_font_request = false;
@@ -722,12 +810,36 @@ void Exfont_load_font_thread(void* arg)
                 {
 					Draw_free_system_font(i);
                     exfont_loaded_system_font[i] = false;
+                    exfont_loaded_fonts_generation++;
                 }
             }
             exfont_unload_system_font_request = false;
         }
         else
+        {
+            u32 now = (u32) osGetTime();
+            for(int i = 0; i < DEF_EXFONT_NUM_OF_FONT_NAME; i++)
+            {
+                if(exfont_wanted_external_font[i] && !exfont_loaded_external_font[i] && !exfont_failed_external_font[i])
+                {
+                    result = Exfont_load_exfont(i);
+                    Util_log_save(DEF_EXFONT_LOAD_FONT_THREAD_STR, "Exfont_load_exfont() (on demand)..." + result.string + result.error_description, result.code);
+                    if(result.code != 0)
+                        exfont_failed_external_font[i] = true;
+                }
+                exfont_wanted_external_font[i] = false;
+
+                if(i != 0 && exfont_loaded_external_font[i] && !exfont_request_external_font_state[i] &&
+                    now - exfont_last_used_external_font[i] >= EXFONT_BLOCK_UNLOAD_TIME)
+                {
+                    exfont_loaded_external_font[i] = false;
+                    exfont_loaded_fonts_generation++;
+                    usleep(EXFONT_BLOCK_UNLOAD_GRACE_TIME);
+                    Exfont_unload_exfont(i);
+                }
+            }
             usleep(DEF_ACTIVE_THREAD_SLEEP_TIME);
+        }
     }
 	Util_log_save(DEF_EXFONT_LOAD_FONT_THREAD_STR, "Thread exit.");
 }
@@ -764,16 +876,30 @@ void Exfont_init(void)
         Exfont_text_parse((char*)fs_buffer, exfont_font_right_to_left_samples, 256, &characters);
 
     exfont_num_of_right_left_charcters = characters;
+    // the last sample is not used
+    for (int i = 0; i < exfont_num_of_right_left_charcters - 1; i++)
+    {
+        u32 code;
+        if (exfont_font_right_to_left_samples[i].length() == 2 && decode_utf8(&code, (const u8*)exfont_font_right_to_left_samples[i].c_str()) == 2
+            && code >= EXFONT_RTL_BEGIN && code < EXFONT_RTL_END)
+            exfont_is_right_to_left[code - EXFONT_RTL_BEGIN] = true;
+    }
+    if (decode_utf8(&exfont_right_to_left_special, (const u8*)exfont_font_right_to_left_samples[201].c_str()) <= 0)
+        exfont_right_to_left_special = 0;
 
     exfont_font_samples[0] = "\u0000";
     exfont_font_start_num[0] = 0;
     for (int i = 1; i < DEF_EXFONT_NUM_OF_FONT_NAME; i++)
         exfont_font_start_num[i] = exfont_font_start_num[i - 1] + exfont_font_characters[i - 1];
+    Exfont_build_glyph_table();
     
     for (int i = 0; i < DEF_EXFONT_NUM_OF_FONT_NAME; i++)
     {
         exfont_loaded_external_font[i] = false;
         exfont_request_external_font_state[i] = false;
+        exfont_wanted_external_font[i] = false;
+        exfont_last_used_external_font[i] = 0;
+        exfont_failed_external_font[i] = false;
     }
 
     free(fs_buffer);
@@ -790,6 +916,11 @@ void Exfont_exit(void)
     exfont_thread_run = false;
 	Util_log_save(DEF_EXFONT_EXIT_STR, "threadJoin()...", threadJoin(exfont_load_font_thread, 10000000000));
 	threadFree(exfont_load_font_thread);
+    for (int i = 0; i < (EXFONT_GLYPH_TABLE_END >> 8); i++)
+    {
+        free(exfont_glyph_table[i]);
+        exfont_glyph_table[i] = NULL;
+    }
 
 	Util_log_save(DEF_EXFONT_EXIT_STR, "Exited.");
 }
@@ -820,6 +951,11 @@ bool Exfont_is_unloading_external_font(void)
     return exfont_unload_external_font_request;
 }
 
+u32 Exfont_get_loaded_fonts_generation(void)
+{
+    return exfont_loaded_fonts_generation;
+}
+
 bool Exfont_is_loaded_system_font(int system_font_num)
 {
     if (system_font_num >= 0 && system_font_num < 4)
@@ -870,26 +1006,48 @@ void Exfont_request_unload_system_font(void)
     exfont_unload_system_font_request = true;
 }
 
+int Exfont_text_decode(const char *text, size_t size, Exfont_char *out_chars, int max_chars)
+{
+    int num = 0;
+    size_t i = 0;
+    while (i < size && num < max_chars && text[i])
+    {
+        u32 code;
+        ssize_t units = decode_utf8(&code, (const u8*)text + i);
+        if (units <= 0 || i + units > size)
+        {
+            i++; // invalid byte
+            continue;
+        }
+        out_chars[num].code = code;
+        out_chars[num].offset = i;
+        out_chars[num].size = units;
+        num++;
+        i += units;
+    }
+    return num;
+}
+
+void Exfont_text_sort_chars(Exfont_char *chars, int num)
+{
+	int reverse_start = -1;
+	for (int i = 0; i < num; i++) {
+		bool is_right_to_left = Exfont_is_right_to_left(chars[i].code);
+		
+		if (is_right_to_left && reverse_start == -1) reverse_start = i;
+		if (!is_right_to_left && reverse_start != -1) {
+			std::reverse(chars + reverse_start, chars + i);
+			reverse_start = -1;
+		}
+	}
+	if (reverse_start != -1) std::reverse(chars + reverse_start, chars + num);
+}
+
 void Exfont_text_sort(std::string *source_part_string, int characters) {
-    static std::string right_to_left_sample[2] = { "\u05BD", "\u0700", };
-	
 	int reverse_start = -1;
 	for (int i = 0; i < characters; i++) {
-		bool is_right_to_left = false;
-		
-        if (exfont_font_right_to_left_samples[201] == source_part_string[i]) is_right_to_left = true;
-        else if (source_part_string[i].length() == 2 && memcmp((void*)source_part_string[i].c_str(), (void*)right_to_left_sample[0].c_str(), 0x2) > 0
-            && memcmp((void*)source_part_string[i].c_str(), (void*)right_to_left_sample[1].c_str(), 0x2) < 0)
-        {
-            for (int j = 0; j < exfont_num_of_right_left_charcters - 1; j++)
-            {
-                if (memcmp((void*)source_part_string[i].c_str(), (void*)exfont_font_right_to_left_samples[j].c_str(), 0x2) == 0)
-                {
-                    is_right_to_left = true;
-                    break;
-                }
-            }
-        }
+		u32 code = 0;
+		bool is_right_to_left = decode_utf8(&code, (const u8*)source_part_string[i].c_str()) > 0 && Exfont_is_right_to_left(code);
 		
 		if (is_right_to_left && reverse_start == -1) reverse_start = i;
 		if (!is_right_to_left && reverse_start != -1) {
@@ -903,34 +1061,12 @@ void Exfont_text_sort(std::string *source_part_string, int characters) {
 
 void Exfont_text_parse(std::string sorce_string, std::string part_string[], int max_loop, int* out_element)
 {
-    int sorce_string_length = sorce_string.length();
-    int std_num = 0;
-    int parse_string_length = 0;
-    int i = 0;
-    *out_element = 0;
-    char* sorce_string_char = (char*)malloc(sorce_string.length() + 10);
-
-    memset(sorce_string_char, 0x0, sorce_string.length() + 10);
-    strcpy(sorce_string_char, (char*)sorce_string.c_str());
-
-    for (int k = 0; k < max_loop; k++)
-    {
-        parse_string_length = mblen(&sorce_string_char[i], 4);
-
-        if (i >= sorce_string_length)
-            break;
-        else if (parse_string_length >= 1)
-        {
-            part_string[std_num] = sorce_string.substr(i, parse_string_length);
-            i += parse_string_length;
-            std_num++;
-        }
-        else
-            i++;
-    }
-    part_string[std_num] = "\u0000";
-    free(sorce_string_char);
-    *out_element = std_num;
+    std::vector<Exfont_char> chars(std::min<size_t>(sorce_string.size(), std::max(max_loop, 0)));
+    int num = Exfont_text_decode(sorce_string.c_str(), sorce_string.size(), chars.data(), chars.size());
+    for (int i = 0; i < num; i++)
+        part_string[i].assign(sorce_string, chars[i].offset, chars[i].size);
+    part_string[num] = "\u0000";
+    *out_element = num;
 }
 
 void Exfont_draw_external_fonts(std::string in_string, float texture_x, float texture_y, float texture_size_x, float texture_size_y, int abgr8888, float* out_width, float* out_height)
@@ -939,122 +1075,24 @@ void Exfont_draw_external_fonts(std::string in_string, float texture_x, float te
     double x_offset = 0.0;
     double y_offset = 0.0;
     double x_size = 0.0;
-    int block = -1;
-    int char_size = 0;
     int characters = 0;
-    int memcmp_result = 0;
-    bool reverse = false;
-    bool unknown = true;
-    std::string sample_one_byte[1] = { "\u0080", };
-    std::string samples_two_bytes[10] = { "\u0100", "\u02B0", "\u0300", "\u0370", "\u0400", "\u0500", "\u0530", "\u0590", "\u0600", "\u0700", };
-    std::string samples_three_bytes[37] = { "\u0980", "\u0A80", "\u0C00", "\u0C80", "\u0D00", "\u0E00", "\u0E80", "\u0F00",
-                                            "\u1000", "\u1100", "\u1680", "\u1D80", "\u1E00", "\u2000", "\u2070", "\u20A0",
-                                            "\u2100", "\u2200", "\u2300", "\u2400", "\u2460", "\u2500", "\u2580", "\u25A0",
-                                            "\u2600", "\u2700", "\u27C0", "\u2980", "\u2C00", "\u3040", "\u30A0", "\u3100",
-                                            "\u3400", "\uA490", "\uA4D0", "\uFE50", "\uFFF0", };
-    std::string samples_four_bytes[2] = { "\U0001F600", "\U0001F650", };
     *out_width = 0;
     *out_height = 0;
 
-    Exfont_text_parse(in_string, exfont_part_string, 1023, &characters);
+    std::vector<Exfont_char> exfont_chars(std::min<size_t>(in_string.size(), 1023) + 1);
+    characters = Exfont_text_decode(in_string.c_str(), in_string.size(), exfont_chars.data(), exfont_chars.size() - 1);
 
     for (int s = 0; s < characters; s++)
     {
-        block = -1;
-        unknown = true;
-        if (memcmp((void*)exfont_part_string[s].c_str(), (void*)exfont_font_samples[0].c_str(), 0x1) == 0)
-            break;
-
-        if (exfont_part_string[s].length() == 1)
-        {
-            char_size = 1;
-            if (memcmp((void*)exfont_part_string[s].c_str(), (void*)sample_one_byte[0].c_str(), 0x1) < 0)
-                block = 0;
-        }
-        else if (exfont_part_string[s].length() == 2)
-        {
-            char_size = 2;
-            for (int i = 0; i < 10; i++)
-            {
-                if (memcmp((void*)exfont_part_string[s].c_str(), (void*)samples_two_bytes[i].c_str(), 0x2) < 0)
-                {
-                    block = i + 1;
-                    break;
-                }
-            }
-        }
-        else if (exfont_part_string[s].length() == 3)
-        {
-            char_size = 3;
-            for (int i = 0; i < 37; i++)
-            {
-                if (memcmp((void*)exfont_part_string[s].c_str(), (void*)samples_three_bytes[i].c_str(), 0x3) < 0)
-                {
-                    block = i + 11;
-                    break;
-                }
-            }
-        }
-        else if (exfont_part_string[s].length() == 4)
-        {
-            char_size = 4;
-            for (int i = 0; i < 2; i++)
-            {
-                if (memcmp((void*)exfont_part_string[s].c_str(), (void*)samples_four_bytes[i].c_str(), 0x4) < 0)
-                {
-                    block = i + 48;
-                    break;
-                }
-            }
-        }
-
-        if (block == 25 || block == 46)
-        {
-            if (!(exfont_ignore_chars.find(exfont_part_string[s]) == std::string::npos))
-            {
-                unknown = false;
-                block = -1;
-            }
-        }
-
-        if (block != -1 && exfont_loaded_external_font[block] && char_size >= 1 && char_size <= 4)
-        {
-            reverse = false;
-            for (int k = 0;;)
-            {
-                if (!reverse)
-                    k += 20;
-                else
-                    k--;
-
-                if ((k < 0 || k > exfont_font_characters[block]) && reverse)
-                    break;
-                else
-                    memcmp_result = memcmp((void*)exfont_part_string[s].c_str(), (void*)exfont_font_samples[exfont_font_start_num[block] + k].c_str(), char_size);
+        int glyph = Exfont_find_glyph(exfont_chars[s].code);
+        if (glyph == -2)
+            continue;
+        if (glyph == -1)
+            glyph = 0; // unknown
 
-                if (memcmp_result == 0)
-                {
-                    unknown = false;
-                    x_size = (exfont_font_interval[exfont_font_start_num[block] + k] + interval_offset) * texture_size_x;
-                    Draw_texture(exfont_font_images[exfont_font_start_num[block] + k], abgr8888, (texture_x + x_offset), (texture_y + y_offset), x_size, 20.0 * texture_size_y);
-                    x_offset += x_size;
-                    break;
-                }
-                else if (memcmp_result < 0 || k >= exfont_font_characters[block])
-                {
-                    reverse = true;
-                    if (k >= exfont_font_characters[block])
-                        k = exfont_font_characters[block];
-                }
-            }
-        }
-
-        if (unknown)
-        {
-            x_size = (exfont_font_interval[0] + interval_offset) * texture_size_x;
-            Draw_texture(exfont_font_images[0], abgr8888, (texture_x + x_offset), (texture_y + y_offset), x_size, 20.0 * texture_size_y);
-            x_offset += x_size;
-        }
+        x_size = (exfont_font_interval[glyph] + interval_offset) * texture_size_x;
+        Draw_texture(exfont_font_images[glyph], abgr8888, (texture_x + x_offset), (texture_y + y_offset), x_size, 20.0 * texture_size_y);
+        x_offset += x_size;
     }
     *out_width = x_offset;
     *out_height = y_offset;
@@ -1063,86 +1101,28 @@ void Exfont_draw_external_fonts(std::string in_string, float texture_x, float te
 
 float Exfont_get_width_one(const std::string &character, float texture_size_x)
 {
-    const double interval_offset = 0.5;
-    int char_size = 0;
-    static const std::string sample_one_byte[1] = { "\u0080", };
-    static const std::string samples_two_bytes[10] = { "\u0100", "\u02B0", "\u0300", "\u0370", "\u0400", "\u0500", "\u0530", "\u0590", "\u0600", "\u0700", };
-    static const std::string samples_three_bytes[37] = { "\u0980", "\u0A80", "\u0C00", "\u0C80", "\u0D00", "\u0E00", "\u0E80", "\u0F00",
-                                            "\u1000", "\u1100", "\u1680", "\u1D80", "\u1E00", "\u2000", "\u2070", "\u20A0",
-                                            "\u2100", "\u2200", "\u2300", "\u2400", "\u2460", "\u2500", "\u2580", "\u25A0",
-                                            "\u2600", "\u2700", "\u27C0", "\u2980", "\u2C00", "\u3040", "\u30A0", "\u3100",
-                                            "\u3400", "\uA490", "\uA4D0", "\uFE50", "\uFFF0", };
-    static const std::string samples_four_bytes[2] = { "\U0001F600", "\U0001F650", };
-
-	int block = -1;
-	
-	if (character.length() == 1)
-	{
-		char_size = 1;
-		if (memcmp((void*)character.c_str(), (void*)sample_one_byte[0].c_str(), 0x1) < 0)
-			block = 0;
-	}
-	else if (character.length() == 2)
-	{
-		char_size = 2;
-		for (int i = 0; i < 10; i++)
-		{
-			if (memcmp((void*)character.c_str(), (void*)samples_two_bytes[i].c_str(), 0x2) < 0)
-			{
-				block = i + 1;
-				break;
-			}
-		}
-	}
-	else if (character.length() == 3)
-	{
-		char_size = 3;
-		int l = -1;
-		int r = 37;
-		while (r - l > 1) {
-			int m = l + ((r - l) >> 1);
-			if (memcmp((void*)character.c_str(), (void*)samples_three_bytes[m].c_str(), 0x3) >= 0)
-				l = m;
-			else r = m;
-		}
-		if (r < 37) block = r + 11;
-	}
-	else if (character.length() == 4)
-	{
-		char_size = 4;
-		for (int i = 0; i < 2; i++)
-		{
-			if (memcmp((void*)character.c_str(), (void*)samples_four_bytes[i].c_str(), 0x4) < 0)
-			{
-				block = i + 48;
-				break;
-			}
-		}
-	}
-
-	if ((block == 25 || block == 46) && exfont_ignore_chars.find(character) != std::string::npos) return 0;
+    u32 code;
+    if (!character.size() || decode_utf8(&code, (const u8*)character.c_str()) != (ssize_t)character.size())
+        code = (u32)-1; // unknown
+    return Exfont_get_width_code(code, texture_size_x);
+}
 
-	if (block != -1 && exfont_loaded_external_font[block] && char_size >= 1 && char_size <= 4)
-	{
-		int l = -1;
-		int r = exfont_font_characters[block];
-		while (r - l > 1) {
-			int m = l + ((r - l) >> 1);
-			int memcmp_result = memcmp((void*)character.c_str(), (void*)exfont_font_samples[exfont_font_start_num[block] + m].c_str(), char_size);
-			if (memcmp_result == 0) return (exfont_font_interval[exfont_font_start_num[block] + m] + interval_offset) * texture_size_x;
-			if (memcmp_result > 0) l = m;
-			else r = m;
-		}
-	}
-	return (exfont_font_interval[0] + interval_offset) * texture_size_x;
+float Exfont_get_width_code(u32 code, float texture_size_x)
+{
+    const double interval_offset = 0.5;
+    int glyph = Exfont_find_glyph(code);
+    if (glyph == -2)
+        return 0;
+    if (glyph == -1)
+        glyph = 0; // unknown
+    return (exfont_font_interval[glyph] + interval_offset) * texture_size_x;
 }
 float Exfont_get_width(std::string in_string, float texture_size_x)
 {
-	int characters = 0;
-	std::vector<std::string> part_strings(in_string.size() + 1);
-	Exfont_text_parse(in_string, &part_strings[0], in_string.size(), &characters);
+	std::vector<Exfont_char> chars(in_string.size());
+	int characters = Exfont_text_decode(in_string.c_str(), in_string.size(), chars.data(), chars.size());
 	float res = 0;
-	for (int s = 0; s < characters; s++) res += Exfont_get_width_one(part_strings[s], texture_size_x);
+	for (int s = 0; s < characters; s++) res += Exfont_get_width_code(chars[s].code, texture_size_x);
 	return res;
 }
 
@@ -1161,6 +1141,7 @@ Result_with_string Exfont_load_exfont(int exfont_num)
                 C3D_TexSetWrap(exfont_font_images[exfont_font_start_num[exfont_num] + i].tex, GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
             }
             exfont_loaded_external_font[exfont_num] = true;
+            exfont_loaded_fonts_generation++;
         }
 
         if (result.code != 0)
@@ -1183,9 +1164,10 @@ void Exfont_unload_exfont(int exfont_num)
     if (exfont_num >= 0 && exfont_num < DEF_EXFONT_NUM_OF_FONT_NAME)
     {
         Draw_free_texture(5 + exfont_num);
-        for (int j = exfont_font_start_num[exfont_num]; j < exfont_font_characters[exfont_num]; j++)
+        for (int j = exfont_font_start_num[exfont_num]; j < exfont_font_start_num[exfont_num] + exfont_font_characters[exfont_num]; j++)
             exfont_font_images[j].tex = NULL;
 
         exfont_loaded_external_font[exfont_num] = false;
+        exfont_loaded_fonts_generation++;
     }
 }
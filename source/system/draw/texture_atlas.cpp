@@ -0,0 +1,271 @@
+#include "headers.hpp"
+#include "system/draw/texture_atlas.hpp"
+#include "system/draw/etc1.hpp"
+#include <vector>
+#include <map>
+
+#define ATLAS_PAGE_SIZE 512
+#define ATLAS_MAX_SLOT_SIZE 256 // larger images get their own texture
+#define ATLAS_BORDER 1 // the edge pixels are repeated around each image so that the linear filter doesn't pick the neighboring slots
+
+namespace {
+	struct Shelf {
+		int y;
+		int slot_width;
+		int slot_height;
+		std::vector<bool> used;
+	};
+	struct Page {
+		C3D_Tex *tex = NULL;
+		GPU_TEXCOLOR format = GPU_RGB565;
+		int shelf_bottom = 0; // where the next shelf goes
+		std::vector<Shelf> shelves;
+		int used_num = 0;
+	};
+	struct Slot {
+		Page *page;
+		int shelf;
+		int index;
+	};
+	std::vector<Page *> pages;
+	std::map<Tex3DS_SubTexture *, Slot> slots;
+
+	LightMutex resource_lock;
+}
+
+static void lock()
+{
+	resource_lock.lock();
+}
+static void release()
+{
+	resource_lock.unlock();
+}
+
+static int Draw_atlas_round_slot_size(int size)
+{
+	return (size + ATLAS_BORDER * 2 + 7) / 8 * 8;
+}
+
+bool Draw_atlas_fits(int pic_width, int pic_height)
+{
+	return pic_width > 0 && pic_height > 0 && Draw_atlas_round_slot_size(pic_width) <= ATLAS_MAX_SLOT_SIZE && Draw_atlas_round_slot_size(pic_height) <= ATLAS_MAX_SLOT_SIZE;
+}
+
+// the position of the pixel (x, y) in the 8x8 tiled (morton) order
+static inline int Draw_atlas_tiled_pos(int x, int y)
+{
+	int morton = (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2 | (x & 4) << 2 | (y & 4) << 3;
+	return ((y >> 3) * (ATLAS_PAGE_SIZE >> 3) + (x >> 3)) * 64 + morton;
+}
+
+// resource_lock must be held
+static bool Draw_atlas_find_slot(int slot_width, int slot_height, GPU_TEXCOLOR format, Slot *slot)
+{
+	for (auto page : pages)
+	{
+		if (page->format != format)
+			continue;
+		for (size_t i = 0; i < page->shelves.size(); i++)
+		{
+			Shelf &shelf = page->shelves[i];
+			if (shelf.slot_width != slot_width || shelf.slot_height != slot_height)
+				continue;
+			for (size_t j = 0; j < shelf.used.size(); j++)
+			{
+				if (!shelf.used[j])
+				{
+					*slot = {page, (int) i, (int) j};
+					return true;
+				}
+			}
+		}
+	}
+	for (auto page : pages)
+	{
+		if (page->format == format && page->shelf_bottom + slot_height <= ATLAS_PAGE_SIZE)
+		{
+			page->shelves.push_back({page->shelf_bottom, slot_width, slot_height, std::vector<bool>(ATLAS_PAGE_SIZE / slot_width, false)});
+			page->shelf_bottom += slot_height;
+			*slot = {page, (int) page->shelves.size() - 1, 0};
+			return true;
+		}
+	}
+
+	Page *page = new Page();
+	page->format = format;
+	page->tex = (C3D_Tex*)malloc(sizeof(C3D_Tex));
+	if (!page->tex || !C3D_TexInit(page->tex, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, format))
+	{
+		free(page->tex);
+		delete page;
+		return false;
+	}
+	C3D_TexSetFilter(page->tex, GPU_LINEAR, GPU_LINEAR);
+	memory_stats_add_linear(MemoryTag::THUMBNAILS, page->tex->size);
+	pages.push_back(page);
+	page->shelves.push_back({0, slot_width, slot_height, std::vector<bool>(ATLAS_PAGE_SIZE / slot_width, false)});
+	page->shelf_bottom = slot_height;
+	*slot = {page, 0, 0};
+	return true;
+}
+
+// reserves a slot for the image, `*x0` and `*y0` are set to the top left corner of the slot (not of the image inside the border)
+static Result_with_string Draw_atlas_reserve(Image_data* c2d_image, int pic_width, int pic_height, GPU_TEXCOLOR format, int* x0, int* y0)
+{
+	Result_with_string result;
+	if (!Draw_atlas_fits(pic_width, pic_height))
+	{
+		result.code = DEF_ERR_INVALID_ARG;
+		result.string = DEF_ERR_INVALID_ARG_STR;
+		return result;
+	}
+	Tex3DS_SubTexture *subtex = (Tex3DS_SubTexture*)malloc(sizeof(Tex3DS_SubTexture));
+	if (!subtex)
+	{
+		result.code = DEF_ERR_OUT_OF_MEMORY;
+		result.string = DEF_ERR_OUT_OF_MEMORY_STR;
+		return result;
+	}
+
+	lock();
+	Slot slot;
+	if (!Draw_atlas_find_slot(Draw_atlas_round_slot_size(pic_width), Draw_atlas_round_slot_size(pic_height), format, &slot))
+	{
+		release();
+		free(subtex);
+		result.code = DEF_ERR_OUT_OF_LINEAR_MEMORY;
+		result.string = DEF_ERR_OUT_OF_LINEAR_MEMORY_STR;
+		return result;
+	}
+	Shelf &shelf = slot.page->shelves[slot.shelf];
+	shelf.used[slot.index] = true;
+	slot.page->used_num++;
+	slots[subtex] = slot;
+	*x0 = slot.index * shelf.slot_width;
+	*y0 = shelf.y;
+	C3D_Tex *tex = slot.page->tex;
+	release();
+
+	subtex->width = (u16)pic_width;
+	subtex->height = (u16)pic_height;
+	subtex->left = (*x0 + ATLAS_BORDER) / (float)ATLAS_PAGE_SIZE;
+	subtex->top = 1.0 - (*y0 + ATLAS_BORDER) / (float)ATLAS_PAGE_SIZE;
+	subtex->right = (*x0 + ATLAS_BORDER + pic_width) / (float)ATLAS_PAGE_SIZE;
+	subtex->bottom = 1.0 - (*y0 + ATLAS_BORDER + pic_height) / (float)ATLAS_PAGE_SIZE;
+	c2d_image->subtex = subtex;
+	c2d_image->c2d.tex = tex;
+	c2d_image->c2d.subtex = subtex;
+	return result;
+}
+
+Result_with_string Draw_atlas_add(Image_data* c2d_image, u8* buf, int pic_width, int pic_height)
+{
+	int x0, y0;
+	Result_with_string result = Draw_atlas_reserve(c2d_image, pic_width, pic_height, GPU_RGB565, &x0, &y0);
+	if (result.code != 0)
+		return result;
+	x0 += ATLAS_BORDER;
+	y0 += ATLAS_BORDER;
+
+	// only this slot is written, so the other images of the page can be drawn meanwhile
+	u16 *src = (u16*)buf;
+	u16 *dst = (u16*)c2d_image->c2d.tex->data;
+	for (int y = -ATLAS_BORDER; y < pic_height + ATLAS_BORDER; y++)
+	{
+		int src_y = std::max(0, std::min(pic_height - 1, y));
+		for (int x = -ATLAS_BORDER; x < pic_width + ATLAS_BORDER; x++)
+		{
+			int src_x = std::max(0, std::min(pic_width - 1, x));
+			dst[Draw_atlas_tiled_pos(x0 + x, y0 + y)] = src[src_y * pic_width + src_x];
+		}
+	}
+	C3D_TexFlush(c2d_image->c2d.tex);
+	return result;
+}
+
+// an ETC1 texture is made of 8x8 tiles of four blocks (top left, top right, bottom left, bottom right), the same tiles as the other formats
+// so a slot (aligned to the tiles) is a run of whole tiles in each of its tile rows
+#define ATLAS_ETC1_TILE_SIZE (ETC1_BLOCK_SIZE * 4)
+
+u32 Draw_atlas_etc1_size(int pic_width, int pic_height)
+{
+	return Draw_atlas_round_slot_size(pic_width) / 8 * Draw_atlas_round_slot_size(pic_height) / 8 * ATLAS_ETC1_TILE_SIZE;
+}
+
+u8* Draw_atlas_encode_etc1(u8* buf, int pic_width, int pic_height)
+{
+	if (!Draw_atlas_fits(pic_width, pic_height))
+		return NULL;
+	int slot_width = Draw_atlas_round_slot_size(pic_width);
+	int slot_height = Draw_atlas_round_slot_size(pic_height);
+	u8 *res = (u8*)malloc(Draw_atlas_etc1_size(pic_width, pic_height));
+	if (!res)
+		return NULL;
+
+	// the whole slot is encoded, the edge pixels of the image are repeated into its border and the padding
+	u16 *src = (u16*)buf;
+	u8 *dst = res;
+	u16 pixels[16];
+	for (int tile_y = 0; tile_y < slot_height; tile_y += 8)
+	{
+		for (int tile_x = 0; tile_x < slot_width; tile_x += 8)
+		{
+			for (int block = 0; block < 4; block++)
+			{
+				int block_x = tile_x + (block & 1) * 4;
+				int block_y = tile_y + (block >> 1) * 4;
+				for (int i = 0; i < 16; i++)
+				{
+					int src_x = std::max(0, std::min(pic_width - 1, block_x + (i & 3) - ATLAS_BORDER));
+					int src_y = std::max(0, std::min(pic_height - 1, block_y + (i >> 2) - ATLAS_BORDER));
+					pixels[i] = src[src_y * pic_width + src_x];
+				}
+				Draw_etc1_encode_block(pixels, dst);
+				dst += ETC1_BLOCK_SIZE;
+			}
+		}
+	}
+	return res;
+}
+
+Result_with_string Draw_atlas_add_etc1(Image_data* c2d_image, const u8* etc1_data, int pic_width, int pic_height)
+{
+	int x0, y0;
+	Result_with_string result = Draw_atlas_reserve(c2d_image, pic_width, pic_height, GPU_ETC1, &x0, &y0);
+	if (result.code != 0)
+		return result;
+
+	int row_size = Draw_atlas_round_slot_size(pic_width) / 8 * ATLAS_ETC1_TILE_SIZE;
+	int tile_rows = Draw_atlas_round_slot_size(pic_height) / 8;
+	u8 *dst = (u8*)c2d_image->c2d.tex->data;
+	for (int i = 0; i < tile_rows; i++)
+		memcpy(dst + ((y0 / 8 + i) * (ATLAS_PAGE_SIZE / 8) + x0 / 8) * ATLAS_ETC1_TILE_SIZE, etc1_data + i * row_size, row_size);
+	C3D_TexFlush(c2d_image->c2d.tex);
+	return result;
+}
+
+void Draw_atlas_free(Image_data c2d_image)
+{
+	lock();
+	auto itr = slots.find(c2d_image.subtex);
+	if (itr == slots.end())
+	{
+		release();
+		Util_log_save("draw/atlas", "freeing an image not in the atlas");
+		return;
+	}
+	Page *page = itr->second.page;
+	page->shelves[itr->second.shelf].used[itr->second.index] = false;
+	slots.erase(itr);
+	if (!--page->used_num) // release the linear memory as soon as the page is empty
+	{
+		memory_stats_add_linear(MemoryTag::THUMBNAILS, -(s64) page->tex->size);
+		C3D_TexDelete(page->tex);
+		free(page->tex);
+		pages.erase(std::find(pages.begin(), pages.end(), page));
+		delete page;
+	}
+	release();
+	free(c2d_image.subtex);
+}
@@ -0,0 +1,237 @@
+#include "headers.hpp"
+#include "yuv_texture_shbin.h"
+
+static bool yuv_shader_initialized = false;
+static bool yuv_shader_failed = false;
+static DVLB_s* yuv_shader_dvlb = NULL;
+static shaderProgram_s yuv_shader_program;
+static int yuv_shader_projection_location = -1;
+
+static bool Draw_yuv_shader_init(void)
+{
+	if (yuv_shader_initialized || yuv_shader_failed)
+		return yuv_shader_initialized;
+
+	yuv_shader_dvlb = DVLB_ParseFile((u32*)yuv_texture_shbin, yuv_texture_shbin_size);
+	if (!yuv_shader_dvlb || shaderProgramInit(&yuv_shader_program) != 0 || shaderProgramSetVsh(&yuv_shader_program, &yuv_shader_dvlb->DVLE[0]) != 0)
+	{
+		Util_log_save("draw/yuv", "failed to load the shader");
+		yuv_shader_failed = true;
+		return false;
+	}
+	yuv_shader_projection_location = shaderInstanceGetUniformLocation(yuv_shader_program.vertexShader, "projection");
+	yuv_shader_initialized = true;
+	return true;
+}
+
+void Draw_yuv_exit(void)
+{
+	if (yuv_shader_initialized)
+	{
+		shaderProgramFree(&yuv_shader_program);
+		DVLB_Free(yuv_shader_dvlb);
+	}
+	yuv_shader_dvlb = NULL;
+	yuv_shader_initialized = false;
+}
+
+Result_with_string Draw_yuv_image_init(Yuv_image_data* yuv_image, int tex_size_x, int tex_size_y)
+{
+	Result_with_string result;
+
+	for (int i = 0; i < 3; i++)
+	{
+		int plane_size_x = i == 0 ? tex_size_x : tex_size_x / 2;
+		int plane_size_y = i == 0 ? tex_size_y : tex_size_y / 2;
+		if (!C3D_TexInit(&yuv_image->planes[i], (u16)plane_size_x, (u16)plane_size_y, GPU_L8))
+		{
+			for (int j = 0; j < i; j++)
+				C3D_TexDelete(&yuv_image->planes[j]);
+			result.code = DEF_ERR_OUT_OF_LINEAR_MEMORY;
+			result.string = DEF_ERR_OUT_OF_LINEAR_MEMORY_STR;
+			return result;
+		}
+		C3D_TexSetFilter(&yuv_image->planes[i], GPU_LINEAR, GPU_LINEAR);
+		C3D_TexSetWrap(&yuv_image->planes[i], GPU_CLAMP_TO_EDGE, GPU_CLAMP_TO_EDGE);
+	}
+	for (int i = 0; i < 3; i++)
+		memory_stats_add_linear(MemoryTag::VIDEO_TEXTURES, yuv_image->planes[i].size);
+	yuv_image->width = yuv_image->height = 0;
+	yuv_image->initialized = true;
+	return result;
+}
+
+void Draw_yuv_image_free(Yuv_image_data* yuv_image)
+{
+	if (!yuv_image->initialized)
+		return;
+	for (int i = 0; i < 3; i++)
+	{
+		memory_stats_add_linear(MemoryTag::VIDEO_TEXTURES, -(s64)yuv_image->planes[i].size);
+		C3D_TexDelete(&yuv_image->planes[i]);
+	}
+	yuv_image->initialized = false;
+}
+
+void Draw_yuv_image_set_filter(Yuv_image_data* yuv_image, bool filter)
+{
+	if (!yuv_image->initialized)
+		return;
+	for (int i = 0; i < 3; i++)
+	{
+		if (filter)
+			C3D_TexSetFilter(&yuv_image->planes[i], GPU_LINEAR, GPU_LINEAR);
+		else
+			C3D_TexSetFilter(&yuv_image->planes[i], GPU_NEAREST, GPU_NEAREST);
+	}
+}
+
+// writes an L8 plane in the 8x8 tiled (morton order) layout, two lines at a time so that four texels go in one store
+static void Draw_yuv_swizzle_plane(u8* tiled, u8* plane, int width, int height, int tex_size_x)
+{
+	for (int tile_y = 0; tile_y < height; tile_y += 8)
+	{
+		u8* tile_row = tiled + tile_y * tex_size_x; // a row of tiles is tex_size_x * 8 texels
+		for (int y = 0; y < 8; y += 2)
+		{
+			u8* line0 = plane + (tile_y + y) * width;
+			u8* line1 = line0 + width;
+			for (int tile_x = 0; tile_x < width; tile_x += 8)
+			{
+				u32* tile = (u32*)(tile_row + tile_x * 8);
+				for (int x = 0; x < 8; x += 2)
+				{
+					// morton index of (x, y) with x and y even, in units of 4 texels
+					int index = ((x & 2) >> 1) | (y & 2) | (x & 4) | ((y & 4) << 1);
+					tile[index] = line0[tile_x + x] | line0[tile_x + x + 1] << 8 | line1[tile_x + x] << 16 | line1[tile_x + x + 1] << 24;
+				}
+			}
+		}
+	}
+}
+
+Result_with_string Draw_yuv_set_texture_data(Yuv_image_data* yuv_image, u8* yuv420p, int width, int height)
+{
+	Result_with_string result;
+
+	if (!yuv_image->initialized || width % 16 != 0 || height % 16 != 0 || width > yuv_image->planes[0].width || height > yuv_image->planes[0].height)
+	{
+		result.code = DEF_ERR_INVALID_ARG;
+		result.string = DEF_ERR_INVALID_ARG_STR;
+		return result;
+	}
+
+	Draw_yuv_swizzle_plane((u8*)yuv_image->planes[0].data, yuv420p, width, height, yuv_image->planes[0].width);
+	Draw_yuv_swizzle_plane((u8*)yuv_image->planes[1].data, yuv420p + width * height, width / 2, height / 2, yuv_image->planes[1].width);
+	Draw_yuv_swizzle_plane((u8*)yuv_image->planes[2].data, yuv420p + width * height + width * height / 4, width / 2, height / 2, yuv_image->planes[2].width);
+	for (int i = 0; i < 3; i++)
+		C3D_TexFlush(&yuv_image->planes[i]);
+
+	yuv_image->width = width;
+	yuv_image->height = height;
+	return result;
+}
+
+void Draw_yuv_image_set_area(Yuv_image_data* yuv_image, int pic_width, int pic_height)
+{
+	yuv_image->width = pic_width;
+	yuv_image->height = pic_height;
+}
+
+// RGB = 1.164 Y + a U + b V - offset, computed at a quarter of the scale as the combiner constants must be in [0, 1]
+// G has negative coefficients for U and V, which are written as positive ones for (1 - U) and (1 - V) with the offset adjusted accordingly
+static void Draw_yuv_set_tex_env(void)
+{
+	C3D_TexEnv* env;
+
+	// 0.528 (2.112 / 4) U for B
+	env = C3D_GetTexEnv(0);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE1, GPU_CONSTANT, GPU_PRIMARY_COLOR);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_MODULATE);
+	C3D_TexEnvColor(env, 0xFF870000);
+
+	// + 0.053 (0.213 / 4) (1 - U) for G
+	env = C3D_GetTexEnv(1);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE1, GPU_CONSTANT, GPU_PREVIOUS);
+	C3D_TexEnvOpRgb(env, GPU_TEVOP_RGB_ONE_MINUS_SRC_COLOR, GPU_TEVOP_RGB_SRC_COLOR, GPU_TEVOP_RGB_SRC_COLOR);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_MULTIPLY_ADD);
+	C3D_TexEnvColor(env, 0xFF000E00);
+
+	// + 0.448 (1.793 / 4) V for R
+	env = C3D_GetTexEnv(2);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE2, GPU_CONSTANT, GPU_PREVIOUS);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_MULTIPLY_ADD);
+	C3D_TexEnvColor(env, 0xFF000072);
+
+	// + 0.133 (0.533 / 4) (1 - V) for G
+	env = C3D_GetTexEnv(3);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE2, GPU_CONSTANT, GPU_PREVIOUS);
+	C3D_TexEnvOpRgb(env, GPU_TEVOP_RGB_ONE_MINUS_SRC_COLOR, GPU_TEVOP_RGB_SRC_COLOR, GPU_TEVOP_RGB_SRC_COLOR);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_MULTIPLY_ADD);
+	C3D_TexEnvColor(env, 0xFF002200);
+
+	// + 0.291 (1.164 / 4) Y
+	env = C3D_GetTexEnv(4);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_TEXTURE0, GPU_CONSTANT, GPU_PREVIOUS);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_MULTIPLY_ADD);
+	C3D_TexEnvColor(env, 0xFF4A4A4A);
+
+	// - (0.973, 0.445, 1.133) / 4, then scaled back by 4
+	env = C3D_GetTexEnv(5);
+	C3D_TexEnvInit(env);
+	C3D_TexEnvSrc(env, C3D_RGB, GPU_PREVIOUS, GPU_CONSTANT, GPU_PRIMARY_COLOR);
+	C3D_TexEnvFunc(env, C3D_RGB, GPU_SUBTRACT);
+	C3D_TexEnvScale(env, C3D_RGB, GPU_TEVSCALE_4);
+	C3D_TexEnvSrc(env, C3D_Alpha, GPU_CONSTANT, GPU_PRIMARY_COLOR, GPU_PRIMARY_COLOR);
+	C3D_TexEnvFunc(env, C3D_Alpha, GPU_REPLACE);
+	C3D_TexEnvColor(env, 0xFF481C3E);
+}
+
+void Draw_yuv_texture(Yuv_image_data* yuv_image, float x, float y, float x_size, float y_size)
+{
+	if (!yuv_image->initialized || !yuv_image->width || !Draw_yuv_shader_init())
+		return;
+
+	C2D_Flush(); // draw what citro2d has batched so far before changing the state
+
+	C3D_BindProgram(&yuv_shader_program);
+	C3D_AttrInfo* attr_info = C3D_GetAttrInfo();
+	AttrInfo_Init(attr_info);
+	AttrInfo_AddLoader(attr_info, 0, GPU_FLOAT, 3); // position
+	AttrInfo_AddLoader(attr_info, 1, GPU_FLOAT, 2); // texcoord
+
+	// the same projection as citro2d uses for the current target
+	C3D_FrameBuf* frame_buf = C3D_GetFrameBuf();
+	C3D_Mtx projection;
+	Mtx_OrthoTilt(&projection, 0.0, frame_buf->height, frame_buf->width, 0.0, 1.0, -1.0, true);
+	C3D_FVUnifMtx4x4(GPU_VERTEX_SHADER, yuv_shader_projection_location, &projection);
+
+	C3D_DepthTest(false, GPU_ALWAYS, GPU_WRITE_COLOR);
+	C3D_CullFace(GPU_CULL_NONE);
+	for (int i = 0; i < 3; i++)
+		C3D_TexBind(i, &yuv_image->planes[i]);
+	Draw_yuv_set_tex_env();
+
+	// the image starts at the top of the textures (t = 1.0) as with Draw_set_texture_data()
+	float right = (float)yuv_image->width / yuv_image->planes[0].width;
+	float bottom = 1.0 - (float)yuv_image->height / yuv_image->planes[0].height;
+	C3D_ImmDrawBegin(GPU_TRIANGLE_STRIP);
+	C3D_ImmSendAttrib(x, y, 0.5, 0.0);
+	C3D_ImmSendAttrib(0.0, 1.0, 0.0, 0.0);
+	C3D_ImmSendAttrib(x, y + y_size, 0.5, 0.0);
+	C3D_ImmSendAttrib(0.0, bottom, 0.0, 0.0);
+	C3D_ImmSendAttrib(x + x_size, y, 0.5, 0.0);
+	C3D_ImmSendAttrib(right, 1.0, 0.0, 0.0);
+	C3D_ImmSendAttrib(x + x_size, y + y_size, 0.5, 0.0);
+	C3D_ImmSendAttrib(right, bottom, 0.0, 0.0);
+	C3D_ImmDrawEnd();
+
+	C3D_TexBind(1, NULL);
+	C3D_TexBind(2, NULL);
+	C2D_Prepare(); // back to the citro2d shader, attributes, combiner and so on
+}
@@ -0,0 +1,44 @@
+#include "headers.hpp"
+#include "system/thread_placement.hpp"
+
+#define LOG_STR "thread-placement"
+
+// indexed by [is New 3DS][placement][role], in the order of ThreadRole
+// Old 3DS only has core 0 (the app core) and core 1 (the system core, shared with the OS)
+// New 3DS additionally has core 2, which is dedicated to the app
+static const s8 placement_tables[2][THREAD_PLACEMENT_NUM][(int) ThreadRole::NUM] = {
+	{ // Old 3DS
+		// menu(worker, connectivity, update, app info), thumbnail, async task(first, others), misc, offline(main, downloader), net async,
+		// decode, convert, stream downloader, livestream initer, prefetcher, audio decode, page parser, video demux, telemetry
+		{ 1, 1, 1, 1,  0,  0, 1,  0,  0, 0,  0,  1, 0, 0, 0, 0, 0, 1, 0, 1 }, // THREAD_PLACEMENT_DEFAULT
+		{ 0, 0, 0, 0,  0,  0, 0,  0,  0, 0,  0,  1, 0, 0, 0, 0, 0, 0, 0, 0 }, // THREAD_PLACEMENT_DECODER_ISOLATED
+		{ 1, 1, 1, 1,  1,  0, 0,  1,  1, 1,  1,  1, 0, 1, 1, 1, 1, 1, 0, 1 }, // THREAD_PLACEMENT_BACKGROUND_ON_SYS_CORE
+	},
+	{ // New 3DS
+		{ 1, 1, 1, 1,  0,  0, 2,  0,  0, 0,  0,  2, 0, 0, 2, 0, 1, 1, 0, 1 }, // THREAD_PLACEMENT_DEFAULT
+		{ 1, 1, 1, 1,  0,  0, 1,  0,  0, 0,  0,  2, 0, 0, 1, 0, 1, 1, 0, 1 }, // THREAD_PLACEMENT_DECODER_ISOLATED
+		{ 1, 1, 1, 1,  1,  0, 2,  1,  1, 1,  1,  2, 0, 1, 1, 1, 1, 1, 0, 1 }, // THREAD_PLACEMENT_BACKGROUND_ON_SYS_CORE
+	}
+};
+
+int thread_placement_get_core(ThreadRole role) {
+	static bool new_3ds_checked = false;
+	static bool new_3ds = false;
+	if (!new_3ds_checked) {
+		new_3ds_checked = true;
+		APT_CheckNew3DS(&new_3ds);
+	}
+	int placement = var_thread_placement;
+	if (placement < 0 || placement >= THREAD_PLACEMENT_NUM) placement = THREAD_PLACEMENT_DEFAULT;
+	return placement_tables[new_3ds][placement][(int) role];
+}
+
+Thread thread_placement_create_thread(ThreadRole role, ThreadFunc entry_point, void *arg, size_t stack_size, int prio, bool detached) {
+	int core = thread_placement_get_core(role);
+	Thread res = threadCreate(entry_point, arg, stack_size, prio, core, detached);
+	if (!res && core != 0) {
+		Util_log_save(LOG_STR, "failed to create thread " + std::to_string((int) role) + " on core " + std::to_string(core) + ", falling back to core 0");
+		res = threadCreate(entry_point, arg, stack_size, prio, 0, detached);
+	}
+	return res;
+}
@@ -1,75 +1,312 @@
 #include "system/util/async_task.hpp"
 #include "headers.hpp"
+#include "system/thread_placement.hpp"
+#include "system/util/metrics.hpp"
 #include <deque>
-#include <utility>
+#include <vector>
 
+#define IDLE_WAIT_TIMEOUT_NS 100000000 // 100 ms, only matters for the exit request
+#define LONG_WAIT_LOG_THRESHOLD_MS 1000
+#define LOG_STR "async-task"
 
-static Handle resource_lock;
+namespace {
+	struct Task {
+		AsyncTaskFuncType func = NULL;
+		void *arg = NULL;
+		AsyncTaskToken token = 0;
+		AsyncTaskPriority priority = AsyncTaskPriority::VISIBLE;
+		double queued_time = 0;
+		double deadline = 0; // in the same unit as queued_time, 0 for none
+	};
+	struct Worker {
+		std::deque<Task> queues[ASYNC_TASK_PRIORITY_NUM];
+		Task running;
+		bool is_running = false;
+		bool cancel_requested = false;
+		Thread thread = NULL;
+		Handle wakeup_event;
+	};
+	Worker workers[ASYNC_TASK_WORKER_NUM];
+	AsyncTaskWaitStats wait_stats[ASYNC_TASK_PRIORITY_NUM];
+	double wait_total_ms[ASYNC_TASK_PRIORITY_NUM];
+	std::vector<std::pair<AsyncTaskFuncType, int> > max_concurrency; // only the functions allowing more than one
+	int next_worker = 0;
+	AsyncTaskToken next_token = 1;
+	volatile bool should_be_running = true;
+}
+
+static LightMutex resource_lock;
 static bool resource_lock_initialized = false;
-static std::deque<std::pair<AsyncTaskFuncType, void *> > task_queue; // task_queue.front() is the task currently running
 
 static void lock() {
 	if (!resource_lock_initialized) {
-		svcCreateMutex(&resource_lock, false);
+		for (auto &worker : workers) svcCreateEvent(&worker.wakeup_event, RESET_STICKY);
 		resource_lock_initialized = true;
 	}
-	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	resource_lock.lock();
 }
 static void release() {
-	svcReleaseMutex(resource_lock);
+	resource_lock.unlock();
+}
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+// must be called with the lock held
+static void wakeup_all_wo_lock() {
+	for (auto &worker : workers) svcSignalEvent(worker.wakeup_event);
+}
+// must be called with the lock held, after the queues have changed
+static void update_pending_metric_wo_lock() {
+	size_t pending = 0;
+	for (auto &worker : workers) for (auto &queue : worker.queues) pending += queue.size();
+	metrics_set(Metric::ASYNC_TASKS_PENDING, pending);
+}
+
+
+AsyncTaskToken async_task_create_token() {
+	lock();
+	AsyncTaskToken res = next_token++;
+	release();
+	return res;
 }
 
+void async_task_set_max_concurrency(AsyncTaskFuncType func, int max_running) {
+	lock();
+	for (auto itr = max_concurrency.begin(); itr != max_concurrency.end(); itr++) if (itr->first == func) {
+		max_concurrency.erase(itr);
+		break;
+	}
+	if (max_running > 1) max_concurrency.push_back({func, max_running});
+	wakeup_all_wo_lock(); // some might have become runnable
+	release();
+}
 
 void remove_all_async_tasks_with_type(AsyncTaskFuncType func) {
 	lock();
-	for (auto itr = task_queue.begin(); itr != task_queue.end(); ) {
-		if (itr != task_queue.begin() && itr->first == func) itr = task_queue.erase(itr);
-		else itr++;
+	for (auto &worker : workers) for (auto &queue : worker.queues) {
+		for (auto itr = queue.begin(); itr != queue.end(); ) {
+			if (itr->func == func) itr = queue.erase(itr);
+			else itr++;
+		}
 	}
+	update_pending_metric_wo_lock();
+	release();
+}
+
+void queue_async_task(AsyncTaskFuncType func, void *arg, AsyncTaskPriority priority, AsyncTaskToken token, int deadline_ms) {
+	Task task;
+	task.func = func;
+	task.arg = arg;
+	task.token = token;
+	task.priority = priority;
+	task.queued_time = get_time_ms();
+	if (deadline_ms > 0) task.deadline = task.queued_time + deadline_ms;
+
+	lock();
+	// all the tasks of a token are queued to the same worker so that the order can be kept even when they get stolen
+	int worker_index;
+	if (token) worker_index = token % ASYNC_TASK_WORKER_NUM;
+	else worker_index = next_worker = (next_worker + 1) % ASYNC_TASK_WORKER_NUM;
+	workers[worker_index].queues[(int) priority].push_back(task);
+	update_pending_metric_wo_lock();
+	wakeup_all_wo_lock(); // the others might steal it
 	release();
 }
 
-void queue_async_task(AsyncTaskFuncType func, void *arg) {
+void async_task_cancel(AsyncTaskToken token) {
+	if (!token) return;
 	lock();
-	task_queue.push_back({func, arg});
+	for (auto &worker : workers) {
+		for (auto &queue : worker.queues) {
+			for (auto itr = queue.begin(); itr != queue.end(); ) {
+				if (itr->token == token) itr = queue.erase(itr);
+				else itr++;
+			}
+		}
+		if (worker.is_running && worker.running.token == token) worker.cancel_requested = true;
+	}
+	update_pending_metric_wo_lock();
 	release();
 }
+bool async_task_cancel_requested() {
+	Thread cur_thread = threadGetCurrent();
+	bool res = false;
+	lock();
+	for (auto &worker : workers) if (worker.thread == cur_thread) res = worker.is_running && worker.cancel_requested;
+	release();
+	return res;
+}
+
+// must be called with the lock held
+static void drop_expired_tasks_wo_lock() {
+	double cur_time = get_time_ms();
+	for (auto &worker : workers) for (int priority = 0; priority < ASYNC_TASK_PRIORITY_NUM; priority++) {
+		auto &queue = worker.queues[priority];
+		for (auto itr = queue.begin(); itr != queue.end(); ) {
+			if (itr->deadline && itr->deadline < cur_time) {
+				wait_stats[priority].expired_num++;
+				itr = queue.erase(itr);
+			} else itr++;
+		}
+	}
+}
 
 int is_async_task_running(AsyncTaskFuncType func) {
 	int res = 0;
 	lock();
-	for (int i = 0; i < (int) task_queue.size(); i++) if (task_queue[i].first == func) {
-		res = i ? 1 : 2;
-		break;
+	drop_expired_tasks_wo_lock();
+	for (auto &worker : workers) {
+		if (worker.is_running && worker.running.func == func) {
+			res = 2;
+			break;
+		}
+		for (auto &queue : worker.queues) for (auto &task : queue) if (task.func == func) res = 1;
 	}
 	release();
 	return res;
 }
 
-static bool should_be_running = true;
-void async_task_thread_exit_request() { should_be_running = false; }
-void async_task_thread_func(void *arg) {
-	(void) arg;
-	
+
+AsyncTaskWaitStats async_task_get_wait_stats(AsyncTaskPriority priority) {
+	lock();
+	AsyncTaskWaitStats res = wait_stats[(int) priority];
+	release();
+	return res;
+}
+
+
+// the lock must be held for all the functions below
+static int get_max_concurrency_wo_lock(AsyncTaskFuncType func) {
+	for (auto &i : max_concurrency) if (i.first == func) return i.second;
+	return 1;
+}
+static int get_func_running_num_wo_lock(AsyncTaskFuncType func) {
+	int res = 0;
+	for (auto &worker : workers) if (worker.is_running && worker.running.func == func) res++;
+	return res;
+}
+// only the tasks kept in order within their token count
+static bool is_token_running_wo_lock(AsyncTaskToken token) {
+	for (auto &worker : workers) if (worker.is_running && worker.running.token == token && get_max_concurrency_wo_lock(worker.running.func) == 1) return true;
+	return false;
+}
+// `itr` points to a task in `queue`
+static bool is_runnable_wo_lock(const std::deque<Task> &queue, std::deque<Task>::const_iterator itr) {
+	int max_running = get_max_concurrency_wo_lock(itr->func);
+	if (get_func_running_num_wo_lock(itr->func) >= max_running) return false;
+	if (max_running > 1) return true;
+	if (itr->token) {
+		if (is_token_running_wo_lock(itr->token)) return false;
+		// keep the order within the token
+		for (auto i = queue.begin(); i != itr; i++) if (i->token == itr->token && get_max_concurrency_wo_lock(i->func) == 1) return false;
+	}
+	return true;
+}
+// takes the oldest runnable task of its own queues, or steals the newest runnable one from the other workers
+// higher priorities are always preferred, even if it means stealing
+static bool pop_task_wo_lock(int worker_index, Task &task) {
+	drop_expired_tasks_wo_lock();
+
+	int other_idle_worker_num = 0;
+	for (int i = 0; i < ASYNC_TASK_WORKER_NUM; i++) if (i != worker_index && !workers[i].is_running) other_idle_worker_num++;
+
+	for (int priority = 0; priority < ASYNC_TASK_PRIORITY_NUM; priority++) {
+		// leave at least one worker for what the user is waiting for
+		if (priority == (int) AsyncTaskPriority::PREFETCH && !other_idle_worker_num) break;
+
+		auto &own_queue = workers[worker_index].queues[priority];
+		for (auto itr = own_queue.begin(); itr != own_queue.end(); itr++) if (is_runnable_wo_lock(own_queue, itr)) {
+			task = *itr;
+			own_queue.erase(itr);
+			return true;
+		}
+		for (int i = 1; i < ASYNC_TASK_WORKER_NUM; i++) {
+			auto &queue = workers[(worker_index + i) % ASYNC_TASK_WORKER_NUM].queues[priority];
+			for (auto itr = queue.end(); itr != queue.begin(); ) {
+				itr--;
+				if (is_runnable_wo_lock(queue, itr)) {
+					task = *itr;
+					queue.erase(itr);
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+static void record_wait_time_wo_lock(const Task &task) {
+	int priority = (int) task.priority;
+	double wait_ms = get_time_ms() - task.queued_time;
+	auto &stats = wait_stats[priority];
+	stats.started_num++;
+	wait_total_ms[priority] += wait_ms;
+	stats.wait_avg_ms = wait_total_ms[priority] / stats.started_num;
+	stats.wait_max_ms = std::max(stats.wait_max_ms, wait_ms);
+	stats.wait_last_ms = wait_ms;
+	if (wait_ms >= LONG_WAIT_LOG_THRESHOLD_MS) Util_log_save(LOG_STR, "task (priority " + std::to_string(priority) + ") waited " + std::to_string((int) wait_ms) + "ms");
+}
+static void worker_thread_func(void *arg) {
+	int worker_index = (int) (intptr_t) arg;
+	Worker &worker = workers[worker_index];
+
 	while (should_be_running) {
-		AsyncTaskFuncType func = NULL;
-		void *arg = NULL;
-		
+		Task task;
 		lock();
-		if (task_queue.size()) {
-			func = task_queue.front().first;
-			arg = task_queue.front().second;
+		svcClearEvent(worker.wakeup_event);
+		bool found = pop_task_wo_lock(worker_index, task);
+		update_pending_metric_wo_lock(); // the expired ones may have been dropped as well
+		if (found) {
+			record_wait_time_wo_lock(task);
+			worker.running = task;
+			worker.is_running = true;
+			worker.cancel_requested = false;
 		}
 		release();
-		
-		if (func) {
-			func(arg);
-			
-			lock();
-			task_queue.pop_front();
-			release();
-		} else usleep(50000);
+
+		if (!found) {
+			svcWaitSynchronization(worker.wakeup_event, IDLE_WAIT_TIMEOUT_NS);
+			continue;
+		}
+
+		task.func(task.arg);
+
+		lock();
+		worker.is_running = false;
+		worker.running = Task();
+		// the tasks of the same function might be waiting for this one
+		wakeup_all_wo_lock();
+		release();
 	}
-	
+
+	if (worker_index) threadExit(0);
+}
+
+void async_task_thread_exit_request() {
+	should_be_running = false;
+	lock();
+	wakeup_all_wo_lock();
+	release();
+}
+void async_task_thread_func(void *arg) {
+	(void) arg;
+
+	lock(); // makes sure the events are created
+	workers[0].thread = threadGetCurrent();
+	release();
+
+	for (int i = 1; i < ASYNC_TASK_WORKER_NUM; i++) {
+		Thread thread = thread_placement_create_thread(ThreadRole::ASYNC_TASK_WORKER, worker_thread_func, (void *) (intptr_t) i, DEF_STACKSIZE,
+			DEF_THREAD_PRIORITY_NORMAL, false);
+		lock();
+		workers[i].thread = thread;
+		release();
+	}
+
+	worker_thread_func((void *) (intptr_t) 0);
+
+	for (int i = 1; i < ASYNC_TASK_WORKER_NUM; i++) if (workers[i].thread) {
+		threadJoin(workers[i].thread, std::numeric_limits<s64>::max());
+		threadFree(workers[i].thread);
+	}
+
 	threadExit(0);
 }
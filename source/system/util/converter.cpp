@@ -1,8 +1,10 @@
 #include "headers.hpp"
+#include "system/util/trace.hpp"
 
 extern "C" void memcpy_asm(u8*, u8*, int);
 extern "C" void yuv420p_to_bgr565_asm(u8* yuv420p, u8* bgr565, int width, int height);
 extern "C" void yuv420p_to_bgr888_asm(u8* yuv420p, u8* bgr888, int width, int height);
+extern "C" void yuv420p_to_rgb565_tiled_rows_armv6(u8* y, u8* u, u8* v, u8* texture, int width);
 
 extern "C" {
 #include "libswscale/swscale.h"
@@ -295,27 +297,73 @@ Result_with_string Util_converter_bgr888_to_yuv420p(u8* bgr888, u8** yuv420p, in
 	return result;
 }
 
-Result_with_string Util_converter_y2r_yuv420p_to_bgr565(u8* yuv420p, u8** bgr565, int width, int height, bool texture_format)
+#define Y2R_TIMEOUT_NS 100000000 // 100 ms, far longer than a conversion takes
+
+static bool y2r_initialized = false;
+static Handle y2r_end_event = 0;
+static Handle y2r_lock; // the kernel benchmark may use y2r from another thread than the video player
+static bool y2r_lock_initialized = false;
+
+static void y2r_lock_acquire() {
+	if (!y2r_lock_initialized) {
+		y2r_lock_initialized = true;
+		svcCreateMutex(&y2r_lock, false);
+	}
+	svcWaitSynchronization(y2r_lock, std::numeric_limits<s64>::max());
+}
+static void y2r_lock_release() {
+	svcReleaseMutex(y2r_lock);
+}
+
+bool Util_converter_y2r_is_initialized(void)
+{
+	return y2r_initialized;
+}
+
+Result_with_string Util_converter_y2r_init(void)
 {
-	bool finished = false;
-	Y2RU_ConversionParams y2r_parameters;
 	Result_with_string result;
 
-	*bgr565 = (u8*)malloc(width * height * 2);
-	if(*bgr565 == NULL)
+	result.code = y2rInit();
+	if(result.code != 0)
 	{
-		result.code = DEF_ERR_OUT_OF_MEMORY;
-		result.string = DEF_ERR_OUT_OF_MEMORY_STR;
+		result.string = "[Error] y2rInit() failed. ";
 		return result;
 	}
+	y2r_initialized = true;
+
+	result.code = Y2RU_SetTransferEndInterrupt(true);
+	if(result.code == 0)
+		result.code = Y2RU_GetTransferEndEvent(&y2r_end_event);
+	if(result.code != 0)
+	{
+		y2r_end_event = 0; // poll instead
+		result.string = "[Error] Y2RU_GetTransferEndEvent() failed. ";
+	}
+	return result;
+}
+
+void Util_converter_y2r_exit(void)
+{
+	if(y2r_end_event)
+		svcCloseHandle(y2r_end_event);
+	y2r_end_event = 0;
+	if(y2r_initialized)
+		y2rExit();
+	y2r_initialized = false;
+}
+
+// output is received in units of transfer_unit bytes with transfer_gap bytes skipped after each of them
+static Result_with_string Util_converter_y2r_convert_wo_lock(u8* yuv420p, u8* output, int width, int height, Y2RU_BlockAlignment block_alignment, int transfer_unit, int transfer_gap)
+{
+	bool finished = false;
+	Y2RU_ConversionParams y2r_parameters;
+	Result_with_string result;
 
 	y2r_parameters.input_format = INPUT_YUV420_INDIV_8;
 	y2r_parameters.output_format = OUTPUT_RGB_16_565;
 	y2r_parameters.rotation = ROTATION_NONE;
-	if(texture_format)
-		y2r_parameters.block_alignment = BLOCK_8_BY_8;
-	else
-		y2r_parameters.block_alignment = BLOCK_LINE;
+	y2r_parameters.block_alignment = block_alignment;
 	y2r_parameters.input_line_width = width;
 	y2r_parameters.input_lines = height;
 	y2r_parameters.standard_coefficient = COEFFICIENT_ITU_R_BT_709_SCALING;
@@ -349,13 +397,16 @@ Result_with_string Util_converter_y2r_yuv420p_to_bgr565(u8* yuv420p, u8** bgr565
 		return result;
 	}
 
-	result.code = Y2RU_SetReceiving(*bgr565, width * height * 2, width * 2 * 4, 0);
+	result.code = Y2RU_SetReceiving(output, width * height * 2, transfer_unit, transfer_gap);
 	if(result.code != 0)
 	{
 		result.string = "[Error] Y2RU_SetReceiving() failed. ";
 		return result;
 	}
 
+	if(y2r_end_event)
+		svcClearEvent(y2r_end_event);
+
 	result.code = Y2RU_StartConversion();
 	if(result.code != 0)
 	{
@@ -363,11 +414,85 @@ Result_with_string Util_converter_y2r_yuv420p_to_bgr565(u8* yuv420p, u8** bgr565
 		return result;
 	}
 
-	while(!finished)
+	if(y2r_end_event)
+	{
+		if(svcWaitSynchronization(y2r_end_event, Y2R_TIMEOUT_NS) != 0)
+		{
+			Y2RU_StopConversion();
+			result.code = DEF_ERR_OTHER;
+			result.string = "[Error] Y2R conversion timed out. ";
+		}
+	}
+	else
 	{
-		Y2RU_IsDoneReceiving(&finished);
-		usleep(1000);
+		while(!finished)
+		{
+			Y2RU_IsDoneReceiving(&finished);
+			usleep(1000);
+		}
 	}
 
 	return result;
 }
+
+static Result_with_string Util_converter_y2r_convert(u8* yuv420p, u8* output, int width, int height, Y2RU_BlockAlignment block_alignment, int transfer_unit, int transfer_gap)
+{
+	TRACE_ZONE("Util_converter_y2r_convert");
+	y2r_lock_acquire();
+	Result_with_string result = Util_converter_y2r_convert_wo_lock(yuv420p, output, width, height, block_alignment, transfer_unit, transfer_gap);
+	y2r_lock_release();
+	return result;
+}
+
+Result_with_string Util_converter_y2r_yuv420p_to_bgr565(u8* yuv420p, u8** bgr565, int width, int height, bool texture_format)
+{
+	Result_with_string result;
+
+	*bgr565 = (u8*)malloc(width * height * 2);
+	if(*bgr565 == NULL)
+	{
+		result.code = DEF_ERR_OUT_OF_MEMORY;
+		result.string = DEF_ERR_OUT_OF_MEMORY_STR;
+		return result;
+	}
+
+	return Util_converter_y2r_convert(yuv420p, *bgr565, width, height, texture_format ? BLOCK_8_BY_8 : BLOCK_LINE, width * 2 * 4, 0);
+}
+
+Result_with_string Util_converter_y2r_yuv420p_to_texture(u8* yuv420p, u8* texture, int width, int height, int texture_width)
+{
+	Result_with_string result;
+
+	if(width % 8 != 0 || height % 8 != 0 || width > texture_width)
+	{
+		result.code = DEF_ERR_INVALID_ARG;
+		result.string = DEF_ERR_INVALID_ARG_STR;
+		return result;
+	}
+
+	// a row of 8x8 tiles is width * 8 pixels of output, and the rest of the tile row of the texture is skipped
+	return Util_converter_y2r_convert(yuv420p, texture, width, height, BLOCK_8_BY_8, width * 8 * 2, (texture_width - width) * 8 * 2);
+}
+
+Result_with_string Util_converter_yuv420p_to_texture_armv6(u8* yuv420p, u8* texture, int width, int height, int texture_width)
+{
+	Result_with_string result;
+
+	if(width % 8 != 0 || height % 8 != 0 || width > texture_width || ((uintptr_t) yuv420p) % 4 != 0)
+	{
+		result.code = DEF_ERR_INVALID_ARG;
+		result.string = DEF_ERR_INVALID_ARG_STR;
+		return result;
+	}
+
+	u8* ybase = yuv420p;
+	u8* ubase = yuv420p + width * height;
+	u8* vbase = yuv420p + width * height + width * height / 4;
+	for(int y = 0; y < height; y += 2)
+	{
+		// a row of 8x8 tiles is texture_width * 8 pixels, and y bit 1 and 2 are bit 3 and 5 of the morton index
+		int offset = (y / 8) * texture_width * 8 + ((y & 2) << 2) + ((y & 4) << 3);
+		yuv420p_to_rgb565_tiled_rows_armv6(ybase + y * width, ubase + y / 2 * width / 2, vbase + y / 2 * width / 2, texture + offset * 2, width);
+	}
+	return result;
+}
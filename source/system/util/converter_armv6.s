@@ -0,0 +1,128 @@
+.arm
+.global yuv420p_to_rgb565_tiled_rows_armv6
+.type yuv420p_to_rgb565_tiled_rows_armv6, "function"
+
+// BT.709 limited range (the same as Y2R is configured for) in 6 bit fixed point
+// R = 75 (Y - 16) + 115 (V - 128)
+// G = 75 (Y - 16) - 14 (U - 128) - 34 (V - 128)
+// B = 75 (Y - 16) + 135 (U - 128)
+// every term fits in a signed halfword, so two pixels are computed at once with the ARMv6 SIMD instructions
+// the constant terms, including 75 * 16, are folded into the chroma terms
+.equ R_OFFSET, 0x3E303E30 // 115 * 128 + 75 * 16 = 15920
+.equ G_OFFSET, 0x13501350 // 48 * 128 - 75 * 16 = 4944
+.equ B_OFFSET, 0x48304830 // 135 * 128 + 75 * 16 = 18480
+
+// registers while converting
+// r0 : y, r1 : u, r2 : v, r3 : out, r4 : width, r5 : end of the y row, r6 : 75
+// r9, r10, r11 : the R, G and B chroma terms of the 4x2 block (the left half in the lower halfword, the right half in the upper one)
+// r7, r8, r12, lr : temporary
+
+// four Y in r7 -> RGB565 of x0 x1 in r12 and x2 x3 in lr
+.macro yuv_tiled_row
+    uxtb16 r8, r7
+    uxtb16 r7, r7, ror #8
+    mul r8, r8, r6
+    mul r7, r7, r6
+
+    // (x0, x2) in r8
+    // R and B are halved (5 bit fixed point) so that their top 5 bits are in the second byte of each halfword after the saturation
+    shadd16 r12, r8, r9
+    usat16 r12, #13, r12
+    uxtb16 r12, r12, ror #8
+    qsub16 lr, r8, r10
+    usat16 lr, #14, lr
+    uxtb16 lr, lr, ror #8
+    shadd16 r8, r8, r11
+    usat16 r8, #13, r8
+    uxtb16 r8, r8, ror #8
+    orr r8, r8, lr, lsl #5
+    orr r8, r8, r12, lsl #11
+
+    // (x1, x3) in r7
+    shadd16 r12, r7, r9
+    usat16 r12, #13, r12
+    uxtb16 r12, r12, ror #8
+    qsub16 lr, r7, r10
+    usat16 lr, #14, lr
+    uxtb16 lr, lr, ror #8
+    shadd16 r7, r7, r11
+    usat16 r7, #13, r7
+    uxtb16 r7, r7, ror #8
+    orr r7, r7, lr, lsl #5
+    orr r7, r7, r12, lsl #11
+
+    pkhbt r12, r8, r7, lsl #16
+    pkhtb lr, r7, r8, asr #16
+.endm
+
+// the 4x2 block at r0 -> out + offset, advances r0, r1 and r2
+.macro yuv_tiled_block offset
+    // (U0, U1) and (V0, V1) in halfwords
+    ldrh r7, [r1], #2
+    ldrh r8, [r2], #2
+    orr r7, r7, r7, lsl #8
+    uxtb16 r7, r7
+    orr r8, r8, r8, lsl #8
+    uxtb16 r8, r8
+
+    // G : 14 U + 34 V - G_OFFSET
+    mov r10, r7, lsl #4
+    sub r10, r10, r7, lsl #1
+    add r10, r10, r8, lsl #5
+    add r10, r10, r8, lsl #1
+    ldr r12, =G_OFFSET
+    ssub16 r10, r10, r12
+
+    // B : 135 U - B_OFFSET
+    add r11, r7, r7, lsl #3
+    add r11, r11, r11, lsl #1
+    add r11, r11, r11, lsl #2
+    ldr r12, =B_OFFSET
+    ssub16 r11, r11, r12
+
+    // R : 115 V - R_OFFSET
+    add r12, r8, r8, lsl #2
+    add r12, r12, r8, lsl #3
+    rsb r9, r12, r8, lsl #7
+    ldr r12, =R_OFFSET
+    ssub16 r9, r9, r12
+
+    // upper row : x0 x1 at + 0, x2 x3 at + 8 (x bit 1 is bit 2 of the morton index)
+    ldr r7, [r0]
+    yuv_tiled_row
+    str r12, [r3, #(\offset + 0)]
+    str lr, [r3, #(\offset + 8)]
+
+    // lower row : x0 x1 at + 4, x2 x3 at + 12 (y bit 0 is bit 1 of the morton index)
+    ldr r7, [r0, r4]
+    yuv_tiled_row
+    str r12, [r3, #(\offset + 4)]
+    str lr, [r3, #(\offset + 12)]
+
+    add r0, r0, #4
+.endm
+
+.text
+
+// yuv420p_to_rgb565_tiled_rows_armv6(u8 *y, u8 *u, u8 *v, u8 *out, int width)
+// converts two rows (y and y + width) of yuv420p into an RGB565 texture in the 8x8 tiled (morton) order, 8x2 pixels at a time
+// out is where the pixel (0, row) of the tile row is, for an even row (see Util_converter_yuv420p_to_texture_armv6())
+// width must be a multiple of 8 and y must be 4 byte aligned
+yuv420p_to_rgb565_tiled_rows_armv6:
+    push { r4-r11, lr }
+    ldr r4, [sp, #36]
+    add r5, r0, r4
+    mov r6, #75
+
+    yuv_tiled_loop:
+    // the left half of the tile at + 0, the right half at + 32 (x bit 2 is bit 4 of the morton index)
+    yuv_tiled_block 0
+    yuv_tiled_block 32
+    add r3, r3, #128
+    cmp r0, r5
+    blt yuv_tiled_loop
+
+    pop { r4-r11, lr }
+    bx lr
+
+.ltorg
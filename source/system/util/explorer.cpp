@@ -7,12 +7,13 @@ bool expl_thread_run = false;
 bool expl_read_dir_request = false;
 bool expl_show_flag = false;
 int expl_num_of_file = 0;
-int expl_size[256];
 double expl_view_offset_y = 0.0;
 double expl_selected_file_num = 0.0;
 std::string expl_current_patch = "/";
-std::string expl_files[256];
-std::string expl_type[256];
+// the parent directory entry first (except at the root), then the hidden ones, directories, files, read only ones and the rest, each sorted by name
+// filled page by page by the read dir thread while it's shown
+std::vector<FileDirEntry> expl_entries;
+LightMutex expl_entries_lock;
 Thread expl_read_dir_thread;
 
 std::string Util_expl_query_current_patch(void)
@@ -22,8 +23,9 @@ std::string Util_expl_query_current_patch(void)
 
 std::string Util_expl_query_file_name(int file_num)
 {
-	if (file_num >= 0 && file_num <= 255)
-		return expl_files[file_num];
+	LightMutexGuard guard(expl_entries_lock);
+	if (file_num >= 0 && file_num < (int)expl_entries.size())
+		return expl_entries[file_num].name;
 	else
 		return "";
 }
@@ -35,16 +37,18 @@ int Util_expl_query_num_of_file(void)
 
 int Util_expl_query_size(int file_num)
 {
-	if (file_num >= 0 && file_num <= 255)
-		return expl_size[file_num];
+	LightMutexGuard guard(expl_entries_lock);
+	if (file_num >= 0 && file_num < (int)expl_entries.size())
+		return (int)expl_entries[file_num].size;
 	else
 		return -1;
 }
 
 std::string Util_expl_query_type(int file_num)
 {
-	if (file_num >= 0 && file_num <= 255)
-		return expl_type[file_num];
+	LightMutexGuard guard(expl_entries_lock);
+	if (file_num >= 0 && file_num < (int)expl_entries.size())
+		return expl_entries[file_num].type;
 	else
 		return "";
 }
@@ -104,14 +108,16 @@ void Util_expl_draw(void)
 	Draw_texture(var_square_image[0], DEF_DRAW_AQUA, 10.0, 20.0, 300.0, 190.0);
 	Draw("A : OK, B : Back, Y : Close, ↑↓→← : Move", 12.5, 185.0, 0.4, 0.4, DEF_DRAW_BLACK);
 	Draw(expl_current_patch, 12.5, 195.0, 0.45, 0.45, DEF_DRAW_BLACK);
-	for (int i = 0; i < 16; i++)
+	LightMutexGuard guard(expl_entries_lock);
+	for (int i = 0; i < 16 && i + (int)expl_view_offset_y < (int)expl_entries.size(); i++)
 	{
 		if (i == (int)expl_selected_file_num)
 			color = DEF_DRAW_RED;
 		else
 			color = DEF_DRAW_BLACK;
 
-		Draw(expl_files[i + (int)expl_view_offset_y] + "(" + std::to_string(expl_size[i + (int)expl_view_offset_y] / 1024.0 / 1024.0).substr(0, 4) + "MB) (" + expl_type[i + (int)expl_view_offset_y] + ")", 12.5, 20.0 + (i * 10.0), 0.4, 0.4, color);
+		const FileDirEntry& entry = expl_entries[i + (int)expl_view_offset_y];
+		Draw(entry.name + "(" + std::to_string(entry.size / 1024.0 / 1024.0).substr(0, 4) + "MB) (" + entry.type + ")", 12.5, 20.0 + (i * 10.0), 0.4, 0.4, color);
 	}
 }
 
@@ -144,9 +150,9 @@ void Util_expl_main(Hid_info key)
 						expl_selected_file_num = 0.0;
 						expl_read_dir_request = true;
 					}
-					else if (expl_type[(int)expl_view_offset_y + (int)expl_selected_file_num] == "dir")
+					else if (Util_expl_query_type((int)expl_view_offset_y + (int)expl_selected_file_num) == "dir")
 					{
-						expl_current_patch = expl_current_patch + expl_files[(int)expl_selected_file_num + (int)expl_view_offset_y] + "/";
+						expl_current_patch = expl_current_patch + Util_expl_query_file_name((int)expl_selected_file_num + (int)expl_view_offset_y) + "/";
 						expl_view_offset_y = 0.0;
 						expl_selected_file_num = 0.0;
 						expl_read_dir_request = true;
@@ -233,166 +239,77 @@ void Util_expl_main(Hid_info key)
 	}
 }
 
+// the order the entries are listed in
+static int Util_expl_type_rank(const std::string& type)
+{
+	if (type == "hidden")
+		return 0;
+	else if (type == "dir")
+		return 1;
+	else if (type == "file")
+		return 2;
+	else if (type == "read only")
+		return 3;
+	else
+		return 4;
+}
+
+static bool Util_expl_entry_less(const FileDirEntry& a, const FileDirEntry& b)
+{
+	int a_rank = Util_expl_type_rank(a.type);
+	int b_rank = Util_expl_type_rank(b.type);
+	return a_rank != b_rank ? a_rank < b_rank : a.name < b.name;
+}
+
 void Util_expl_read_dir_thread(void* arg)
 {
 	Util_log_save(DEF_EXPL_READ_DIR_THREAD_STR, "Thread started.");
 	int log_num;
-	int num_of_hidden = 0;
-	int num_of_dir = 0;
-	int num_of_file = 0;
-	int num_of_read_only = 0;
-	int num_of_unknown = 0;
-	int num_offset = 0;
-	int index = 0;
-	u64 file_size;
-	std::string name_of_hidden[256];
-	std::string name_of_dir[256];
-	std::string name_of_file[256];
-	std::string name_of_read_only[256];
-	std::string name_of_unknown[256];
-	std::string sort_cache[256];
+	DirectoryReader reader;
+	std::vector<FileDirEntry> page;
 	Result_with_string result;
 
-	for (int i = 0; i < 256; i++)
-	{
-		expl_files[i] = "";
-		expl_type[i] = "";
-		expl_size[i] = 0;
-	}
-
 	while (expl_thread_run)
 	{
 		if (expl_read_dir_request)
 		{
-			var_need_reflesh = true;
-			for (int i = 0; i < 256; i++)
-			{
-				expl_files[i] = "";
-				expl_type[i] = "";
-				expl_size[i] = 0;
-			}
-
-			log_num = Util_log_save(DEF_EXPL_READ_DIR_THREAD_STR, "Util_file_read_dir()...");
-			result = Util_file_read_dir(expl_current_patch, &expl_num_of_file, expl_files, 256, expl_type, 256);
-			Util_log_add(log_num, result.string, result.code);
-
-			if (result.code == 0)
+			std::string dir_path = expl_current_patch;
+			expl_read_dir_request = false;
 			{
-				num_of_hidden = 0;
-				num_of_dir = 0;
-				num_of_file = 0;
-				num_of_read_only = 0;
-				num_of_unknown = 0;
-				for (int i = 0; i < 256; i++)
-				{
-					name_of_hidden[i] = "";
-					name_of_dir[i] = "";
-					name_of_file[i] = "";
-					name_of_read_only[i] = "";
-					name_of_unknown[i] = "";
-					sort_cache[i] = "";
-				}
-
-				for (int i = 0; i < expl_num_of_file; i++)
-				{
-					if (expl_type[i] == "hidden")
-					{
-						name_of_hidden[num_of_hidden] = expl_files[i];
-						num_of_hidden++;
-					}
-					else if (expl_type[i] == "dir")
-					{
-						name_of_dir[num_of_dir] = expl_files[i];
-						num_of_dir++;
-					}
-					else if (expl_type[i] == "file")
-					{
-						name_of_file[num_of_file] = expl_files[i];
-						num_of_file++;
-					}
-					else if (expl_type[i] == "read only")
-					{
-						name_of_read_only[num_of_read_only] = expl_files[i];
-						num_of_read_only++;
-					}
-					else if (expl_type[i] == "unknown")
-					{
-						name_of_unknown[num_of_unknown] = expl_files[i];
-						num_of_unknown++;
-					}
-				}
-
-				std::sort(begin(name_of_hidden), begin(name_of_hidden) + num_of_hidden);
-				std::sort(begin(name_of_dir), begin(name_of_dir) + num_of_dir);
-				std::sort(begin(name_of_file), begin(name_of_file) + num_of_file);
-				std::sort(begin(name_of_read_only), begin(name_of_read_only) + num_of_read_only);
-				std::sort(begin(name_of_unknown), begin(name_of_unknown) + num_of_unknown);
-
-				for (int i = 0; i < 256; i++)
-				{
-					expl_files[i] = "";
-					expl_type[i] = "";
-				}
-				index = 0;
-
-				if (!(expl_current_patch == "/"))
-				{
-					num_offset = 1;
-					expl_num_of_file += 1;
-					if (var_lang == "jp")
-						expl_files[0] = "親ディレクトリへ移動";
-					else
-						expl_files[0] = "Move to parent directory";
-				}
-				else
-					num_offset = 0;
-
-				for (int i = 0; i < num_of_hidden; i++)
-				{
-					index = i + num_offset;
-					expl_type[index] = "hidden";
-					expl_files[index] = name_of_hidden[i];
-				}
-				for (int i = 0; i < num_of_dir; i++)
+				LightMutexGuard guard(expl_entries_lock);
+				expl_entries.clear();
+				if (dir_path != "/")
 				{
-					index = i + num_of_hidden + num_offset;
-					expl_type[index] = "dir";
-					expl_files[index] = name_of_dir[i];
-				}
-				for (int i = 0; i < num_of_file; i++)
-				{
-					index = i + num_of_hidden + num_of_dir + num_offset;
-					expl_type[index] = "file";
-					expl_files[index] = name_of_file[i];
-				}
-				for (int i = 0; i < num_of_read_only; i++)
-				{
-					index = i + num_of_hidden + num_of_dir + num_of_file + num_offset;
-					expl_type[index] = "read only";
-					expl_files[index] = name_of_read_only[i];
-				}
-				for (int i = 0; i < num_of_unknown; i++)
-				{
-					index = i + num_of_hidden + num_of_dir + num_of_file + num_of_read_only + num_offset;
-					expl_type[index] = "unknown";
-					expl_files[index] = name_of_unknown[i];
+					FileDirEntry parent;
+					parent.name = var_lang == "jp" ? "親ディレクトリへ移動" : "Move to parent directory";
+					expl_entries.push_back(parent);
 				}
+				expl_num_of_file = expl_entries.size();
 			}
 			var_need_reflesh = true;
-			expl_read_dir_request = false;
 
-			for (int i = 0; i <= index; i++)
+			log_num = Util_log_save(DEF_EXPL_READ_DIR_THREAD_STR, "DirectoryReader::open()...");
+			result = reader.open(dir_path);
+			Util_log_add(log_num, result.string, result.code);
+
+			// each page is merged into the sorted list as it's read, so the first entries show up at once even in a huge directory
+			// a new request (the user went elsewhere) abandons the rest
+			while (result.code == 0 && !expl_read_dir_request && expl_thread_run)
 			{
-				if (expl_read_dir_request)
+				page.clear();
+				if (!reader.read(page))
 					break;
-
-				result = Util_file_check_file_size(expl_files[i], expl_current_patch, &file_size);
-				if (result.code == 0)
-				{
-					expl_size[i] = (int)file_size;
-					var_need_reflesh = true;
-				}
+				std::sort(page.begin(), page.end(), Util_expl_entry_less);
+
+				LightMutexGuard guard(expl_entries_lock);
+				size_t old_num = expl_entries.size();
+				size_t sorted_begin = dir_path != "/" ? 1 : 0;
+				expl_entries.insert(expl_entries.end(), std::make_move_iterator(page.begin()), std::make_move_iterator(page.end()));
+				std::inplace_merge(expl_entries.begin() + sorted_begin, expl_entries.begin() + old_num, expl_entries.end(), Util_expl_entry_less);
+				expl_num_of_file = expl_entries.size();
+				var_need_reflesh = true;
 			}
+			reader.close();
 		}
 		else
 			usleep(DEF_ACTIVE_THREAD_SLEEP_TIME);
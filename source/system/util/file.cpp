@@ -1,90 +1,271 @@
 #include "headers.hpp"
 #include "unicodetochar/unicodetochar.h"
 
-Result_with_string Util_file_save_to_file(std::string file_name, std::string dir_path, u8* write_data, int size, bool delete_old_file)
+#include <list>
+#include <set>
+
+#define FILE_HANDLE_CACHE_NUM 4 // files kept open for reading, most of the SD reads are many pieces of a few files
+#define FILE_TMP_SUFFIX ".tmp" // being written, may be incomplete
+#define FILE_DONE_SUFFIX ".new" // written completely, waiting to replace the old file
+#define FILE_ERR_ALREADY_EXISTS 0xC82044BE
+
+namespace
 {
-	u32 written_size = 0;
-	u64 file_size = 0;
-	bool failed = false;
-	std::string file_path = dir_path + file_name;
-	Handle fs_handle = 0;
-	FS_Archive fs_archive = 0;
-	TickCounter write_time;
-	Result_with_string save_file_result;
+	Handle file_lock;
+	bool lock_initialized = false;
+	FS_Archive sd_archive = 0;
+	bool sd_archive_opened = false;
+	std::set<std::string> created_dirs;
 
-	save_file_result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
-	if(save_file_result.code != 0)
+	struct OpenFile
 	{
-		save_file_result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
+		std::string path;
+		Handle handle;
+		int users;
+		bool stale; // closed when the last user releases it
+	};
+	std::list<OpenFile> open_files; // most recently used first
+}
+
+static void lock()
+{
+	if (!lock_initialized)
+	{
+		lock_initialized = true;
+		svcCreateMutex(&file_lock, false);
 	}
+	svcWaitSynchronization(file_lock, std::numeric_limits<s64>::max());
+}
+static void release()
+{
+	svcReleaseMutex(file_lock);
+}
 
-	if (!failed)
+static Result_with_string Util_file_get_archive(FS_Archive* archive)
+{
+	Result_with_string result;
+	lock();
+	if (!sd_archive_opened)
 	{
-		save_file_result.code = FSUSER_CreateDirectory(fs_archive, fsMakePath(PATH_ASCII, dir_path.c_str()), FS_ATTRIBUTE_DIRECTORY);
-		if (save_file_result.code != 0 && save_file_result.code != 0xC82044BE)//#0xC82044BE directory already exist
-		{
-			save_file_result.string = "[Error] FSUSER_CreateDirectory failed. ";
-			failed = true;
-		}
+		result.code = FSUSER_OpenArchive(&sd_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
+		if (result.code == 0)
+			sd_archive_opened = true;
+		else
+			result.string = "[Error] FSUSER_OpenArchive failed. ";
 	}
+	*archive = sd_archive;
+	release();
+	return result;
+}
 
-	if (!failed)
+static Result_with_string Util_file_make_dir(FS_Archive archive, const std::string& dir_path)
+{
+	Result_with_string result;
+	lock();
+	bool created = created_dirs.count(dir_path);
+	release();
+	if (created)
+		return result;
+
+	result.code = FSUSER_CreateDirectory(archive, fsMakePath(PATH_ASCII, dir_path.c_str()), FS_ATTRIBUTE_DIRECTORY);
+	if (result.code != 0 && result.code != FILE_ERR_ALREADY_EXISTS)
 	{
-		if (delete_old_file)
-			FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()));
+		result.string = "[Error] FSUSER_CreateDirectory failed. ";
+		return result;
 	}
+	result.code = 0;
+	lock();
+	created_dirs.insert(dir_path);
+	release();
+	return result;
+}
 
-	if (!failed)
+// the cached read handles of `file_path` must not be used anymore (the file is about to be written, renamed or deleted)
+static void Util_file_invalidate(const std::string& file_path)
+{
+	lock();
+	for (auto itr = open_files.begin(); itr != open_files.end(); )
 	{
-		save_file_result.code = FSUSER_CreateFile(fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_ATTRIBUTE_ARCHIVE, 0);
-		if (save_file_result.code != 0 && save_file_result.code != 0xC82044BE)//#0xC82044BE file already exist
+		if (itr->path != file_path)
+			itr++;
+		else if (itr->users)
 		{
-			save_file_result.string = "[Error] FSUSER_CreateFile failed. ";
-			failed = true;
+			itr->stale = true;
+			itr++;
+		}
+		else
+		{
+			FSFILE_Close(itr->handle);
+			itr = open_files.erase(itr);
 		}
 	}
+	release();
+}
 
-	if (!failed)
+// a read handle of `file_path`, opened or taken from the cache, to be given back with Util_file_release_read_handle()
+static Result_with_string Util_file_acquire_read_handle(const std::string& file_path, OpenFile** res)
+{
+	Result_with_string result;
+	lock();
+	for (auto itr = open_files.begin(); itr != open_files.end(); itr++)
 	{
-		save_file_result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_WRITE, FS_ATTRIBUTE_ARCHIVE);
-		if (save_file_result.code != 0)
+		if (itr->path == file_path && !itr->stale)
 		{
-			save_file_result.string = "[Error] FSUSER_OpenFile failed. ";
-			failed = true;
+			itr->users++;
+			open_files.splice(open_files.begin(), open_files, itr);
+			*res = &open_files.front();
+			release();
+			return result;
 		}
 	}
+	release();
 
-	if (!failed)
+	FS_Archive archive;
+	result = Util_file_get_archive(&archive);
+	if (result.code != 0)
+		return result;
+
+	Handle handle = 0;
+	result.code = FSUSER_OpenFile(&handle, archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_READ, FS_ATTRIBUTE_ARCHIVE);
+	if (result.code != 0)
+	{
+		// the app stopped between deleting the old file and renaming the new one into its place,
+		// a file still being written when it stopped is never used
+		std::string tmp_path = file_path + FILE_TMP_SUFFIX;
+		std::string done_path = file_path + FILE_DONE_SUFFIX;
+		FSUSER_DeleteFile(archive, fsMakePath(PATH_ASCII, tmp_path.c_str()));
+		if (FSUSER_RenameFile(archive, fsMakePath(PATH_ASCII, done_path.c_str()), archive, fsMakePath(PATH_ASCII, file_path.c_str())) == 0)
+			result.code = FSUSER_OpenFile(&handle, archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_READ, FS_ATTRIBUTE_ARCHIVE);
+	}
+	if (result.code != 0)
 	{
-		if (!(delete_old_file))
+		result.string = "[Error] FSUSER_OpenFile failed. ";
+		return result;
+	}
+
+	lock();
+	open_files.push_front({file_path, handle, 1, false});
+	*res = &open_files.front();
+	for (auto itr = std::prev(open_files.end()); open_files.size() > FILE_HANDLE_CACHE_NUM && itr != open_files.begin(); )
+	{
+		auto cur = itr--;
+		if (!cur->users)
 		{
-			save_file_result.code = FSFILE_GetSize(fs_handle, &file_size);
-			if (save_file_result.code != 0)
+			FSFILE_Close(cur->handle);
+			open_files.erase(cur);
+		}
+	}
+	release();
+	return result;
+}
+static void Util_file_release_read_handle(OpenFile* file)
+{
+	lock();
+	file->users--;
+	if (!file->users && file->stale)
+	{
+		for (auto itr = open_files.begin(); itr != open_files.end(); itr++)
+		{
+			if (&*itr == file)
 			{
-				save_file_result.string = "[Error] FSFILE_GetSize failed. ";
-				failed = true;
+				FSFILE_Close(itr->handle);
+				open_files.erase(itr);
+				break;
 			}
 		}
 	}
+	release();
+}
 
-	if (!failed)
+static Result_with_string Util_file_write(Handle handle, u64 offset, const u8* write_data, u32 size)
+{
+	Result_with_string result;
+	u32 written_size = 0;
+	TickCounter write_time;
+	osTickCounterStart(&write_time);
+	result.code = FSFILE_Write(handle, &written_size, offset, write_data, size, FS_WRITE_FLUSH);
+	osTickCounterUpdate(&write_time);
+	if (result.code == 0 && written_size == size)
+		result.string += std::to_string(written_size / 1024) + "KB " + std::to_string(((double)written_size / (osTickCounterRead(&write_time) / 1000.0)) / 1024.0 / 1024.0) + "MB/s ";
+	else
 	{
-		osTickCounterStart(&write_time);
-		save_file_result.code = FSFILE_Write(fs_handle, &written_size, file_size, write_data, size, FS_WRITE_FLUSH);
-		osTickCounterUpdate(&write_time);
+		if (result.code == 0)
+			result.code = DEF_ERR_OTHER;
+		result.string = "[Error] FSFILE_Write failed. ";
+	}
+	return result;
+}
+
+Result_with_string Util_file_save_to_file(std::string file_name, std::string dir_path, u8* write_data, int size, bool delete_old_file)
+{
+	std::string file_path = dir_path + file_name;
+	Handle fs_handle = 0;
+	FS_Archive fs_archive = 0;
+	Result_with_string save_file_result;
+
+	save_file_result = Util_file_get_archive(&fs_archive);
+	if (save_file_result.code == 0)
+		save_file_result = Util_file_make_dir(fs_archive, dir_path);
+	if (save_file_result.code != 0)
+	{
+		save_file_result.error_description = "sdmc:" + file_path;
+		return save_file_result;
+	}
+	Util_file_invalidate(file_path);
+
+	if (delete_old_file)
+	{
+		// written completely into the temporary file, which is marked done by renaming it and then replaces the old one
+		std::string tmp_path = file_path + FILE_TMP_SUFFIX;
+		std::string done_path = file_path + FILE_DONE_SUFFIX;
+		FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, tmp_path.c_str()));
+		FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, done_path.c_str()));
+		save_file_result.code = FSUSER_CreateFile(fs_archive, fsMakePath(PATH_ASCII, tmp_path.c_str()), FS_ATTRIBUTE_ARCHIVE, size);
+		if (save_file_result.code != 0)
+			save_file_result.string = "[Error] FSUSER_CreateFile failed. ";
+		else
+		{
+			save_file_result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, tmp_path.c_str()), FS_OPEN_WRITE, FS_ATTRIBUTE_ARCHIVE);
+			if (save_file_result.code != 0)
+				save_file_result.string = "[Error] FSUSER_OpenFile failed. ";
+			else
+			{
+				save_file_result = Util_file_write(fs_handle, 0, write_data, size);
+				FSFILE_Close(fs_handle);
+			}
+		}
 		if (save_file_result.code == 0)
-			save_file_result.string += std::to_string(written_size / 1024) + "KB " + std::to_string(((double)written_size / (osTickCounterRead(&write_time) / 1000.0)) / 1024.0 / 1024.0) + "MB/s ";
+		{
+			save_file_result.code = FSUSER_RenameFile(fs_archive, fsMakePath(PATH_ASCII, tmp_path.c_str()), fs_archive, fsMakePath(PATH_ASCII, done_path.c_str()));
+			if (save_file_result.code == 0)
+			{
+				FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()));
+				save_file_result.code = FSUSER_RenameFile(fs_archive, fsMakePath(PATH_ASCII, done_path.c_str()), fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()));
+			}
+			if (save_file_result.code != 0)
+				save_file_result.string = "[Error] FSUSER_RenameFile failed. ";
+		}
+		else
+			FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, tmp_path.c_str()));
+	}
+	else
+	{
+		u64 file_size = 0;
+		save_file_result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_WRITE | FS_OPEN_CREATE, FS_ATTRIBUTE_ARCHIVE);
+		if (save_file_result.code != 0)
+			save_file_result.string = "[Error] FSUSER_OpenFile failed. ";
 		else
 		{
-			save_file_result.string = "[Error] FSFILE_Write failed. ";
-			failed = true;
+			save_file_result.code = FSFILE_GetSize(fs_handle, &file_size);
+			if (save_file_result.code != 0)
+				save_file_result.string = "[Error] FSFILE_GetSize failed. ";
+			else
+				save_file_result = Util_file_write(fs_handle, file_size, write_data, size);
+			FSFILE_Close(fs_handle);
 		}
 	}
 
-	FSFILE_Close(fs_handle);
-	FSUSER_CloseArchive(fs_archive);
-	if(failed)
+	if (save_file_result.code != 0)
 		save_file_result.error_description = "sdmc:" + file_path;
 
 	return save_file_result;
@@ -146,49 +327,27 @@ Result_with_string Util_file_load_from_rom(std::string file_name, std::string di
 
 Result_with_string Util_file_load_from_file_with_range(std::string file_name, std::string dir_path, u8* read_data, int read_length, u64 read_offset, u32* read_size)
 {
-	bool failed = false;
 	u32 read_size_calc;
 	std::string file_path = dir_path + file_name;
-	Handle fs_handle = 0;
-	FS_Archive fs_archive = 0;
+	OpenFile* file = NULL;
 	TickCounter read_time;
 	Result_with_string result;
 
-	result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
-	if (result.code != 0)
-	{
-		result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
-	}
-
-	if (!failed)
-	{
-		result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_READ, FS_ATTRIBUTE_ARCHIVE);
-		if (result.code != 0)
-		{
-			result.string = "[Error] FSUSER_OpenFile failed. ";
-			failed = true;
-		}
-	}
-
-	if (!failed)
+	result = Util_file_acquire_read_handle(file_path, &file);
+	if (result.code == 0)
 	{
 		osTickCounterStart(&read_time);
-		result.code = FSFILE_Read(fs_handle, &read_size_calc, read_offset, read_data, read_length);
+		result.code = FSFILE_Read(file->handle, &read_size_calc, read_offset, read_data, read_length);
 		osTickCounterUpdate(&read_time);
 		*read_size = read_size_calc;
 		if (result.code == 0)
 			result.string += std::to_string(read_size_calc / 1024) + "KB " + std::to_string(((double)read_size_calc / (osTickCounterRead(&read_time) / 1000.0)) / 1024.0 / 1024.0) + "MB/s ";
-		if (result.code != 0)
-		{
+		else
 			result.string = "[Error] FSFILE_Read failed. ";
-			failed = true;
-		}
+		Util_file_release_read_handle(file);
 	}
 
-	FSFILE_Close(fs_handle);
-	FSUSER_CloseArchive(fs_archive);
-	if(failed)
+	if (result.code != 0)
 		result.error_description = "sdmc:" + file_path;
 
 	return result;
@@ -196,30 +355,20 @@ Result_with_string Util_file_load_from_file_with_range(std::string file_name, st
 
 Result_with_string Util_file_delete_file(std::string file_name, std::string dir_path)
 {
-	bool failed = false;
 	std::string file_path = dir_path + file_name;
 	FS_Archive fs_archive = 0;
 	Result_with_string result;
 
-	result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
-	if (result.code != 0)
-	{
-		result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
-	}
-
-	if (!failed)
+	result = Util_file_get_archive(&fs_archive);
+	if (result.code == 0)
 	{
+		Util_file_invalidate(file_path);
 		result.code = FSUSER_DeleteFile(fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()));
 		if (result.code != 0)
-		{
 			result.string = "[Error] FSUSER_DeleteFile failed. ";
-			failed = true;
-		}
 	}
 
-	FSUSER_CloseArchive(fs_archive);
-	if(failed)
+	if (result.code != 0)
 		result.error_description = "sdmc:" + file_path;
 
 	return result;
@@ -227,42 +376,20 @@ Result_with_string Util_file_delete_file(std::string file_name, std::string dir_
 
 Result_with_string Util_file_check_file_size(std::string file_name, std::string dir_path, u64* file_size)
 {
-	bool failed = false;
 	std::string file_path = dir_path + file_name;
-	Handle fs_handle = 0;
-	FS_Archive fs_archive = 0;
+	OpenFile* file = NULL;
 	Result_with_string result;
 
-	result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
-	if (result.code != 0)
-	{
-		result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
-	}
-
-	if (!failed)
-	{
-		result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_READ, FS_ATTRIBUTE_ARCHIVE);
-		if (result.code != 0)
-		{
-			result.string = "[Error] FSUSER_OpenFile failed. ";
-			failed = true;
-		}
-	}
-
-	if (!failed)
+	result = Util_file_acquire_read_handle(file_path, &file);
+	if (result.code == 0)
 	{
-		result.code = FSFILE_GetSize(fs_handle, file_size);
+		result.code = FSFILE_GetSize(file->handle, file_size);
 		if (result.code != 0)
-		{
 			result.string = "[Error] FSFILE_GetSize failed. ";
-			failed = true;
-		}
+		Util_file_release_read_handle(file);
 	}
 
-	FSFILE_Close(fs_handle);
-	FSUSER_CloseArchive(fs_archive);
-	if(failed)
+	if (result.code != 0)
 		result.error_description = "sdmc:" + file_path;
 
 	return result;
@@ -270,102 +397,202 @@ Result_with_string Util_file_check_file_size(std::string file_name, std::string
 
 Result_with_string Util_file_check_file_exist(std::string file_name, std::string dir_path)
 {
-	bool failed = false;
 	std::string file_path = dir_path + file_name;
-	Handle fs_handle = 0;
-	FS_Archive fs_archive = 0;
+	OpenFile* file = NULL;
 	Result_with_string result;
 
-	result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
+	result = Util_file_acquire_read_handle(file_path, &file);
+	if (result.code == 0)
+		Util_file_release_read_handle(file);
+	else
+		result.error_description = "sdmc:" + file_path;
+
+	return result;
+}
+
+Result_with_string Util_file_read_dir(std::string dir_path, int* num_of_detected, std::string file_dir_name[], int name_num_of_array, std::string type[], int type_num_of_array)
+{
+	DirectoryReader reader;
+	std::vector<FileDirEntry> entries;
+	int max_num = std::min(name_num_of_array, type_num_of_array);
+	Result_with_string result = reader.open(dir_path);
 	if (result.code != 0)
+		return result;
+
+	while ((int)entries.size() < max_num && reader.read(entries, std::min(FILE_DIR_READ_BATCH, max_num - (int)entries.size())))
+		;
+	if ((int)entries.size() >= max_num && reader.read(entries, 1))
+		result.string = "[Error] array size is too small. ";
+
+	*num_of_detected = std::min((int)entries.size(), max_num);
+	for (int i = 0; i < *num_of_detected; i++)
 	{
-		result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
+		file_dir_name[i] = entries[i].name;
+		type[i] = entries[i].type;
 	}
+	return result;
+}
 
-	if (!failed)
+Result_with_string DirectoryReader::open(const std::string& dir_path)
+{
+	Result_with_string result;
+	FS_Archive fs_archive = 0;
+	close();
+
+	result = Util_file_get_archive(&fs_archive);
+	if (result.code == 0)
 	{
-		result.code = FSUSER_OpenFile(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, file_path.c_str()), FS_OPEN_READ, FS_ATTRIBUTE_ARCHIVE);
+		result.code = FSUSER_OpenDirectory(&handle, fs_archive, fsMakePath(PATH_ASCII, dir_path.c_str()));
 		if (result.code != 0)
 		{
-			result.string = "[Error] FSUSER_OpenFile failed. ";
-			failed = true;
+			handle = 0;
+			result.string = "[Error] FSUSER_OpenDirectory failed. ";
+			result.error_description = "sdmc:" + dir_path;
 		}
 	}
-
-	FSFILE_Close(fs_handle);
-	FSUSER_CloseArchive(fs_archive);
-	if(failed)
-		result.error_description = "sdmc:" + file_path;
-
 	return result;
 }
 
-Result_with_string Util_file_read_dir(std::string dir_path, int* num_of_detected, std::string file_dir_name[], int name_num_of_array, std::string type[], int type_num_of_array)
+int DirectoryReader::read(std::vector<FileDirEntry>& entries, int max_num)
 {
-	int count = 0;
-	u32 read_entry = 0;
-	u32 read_entry_count = 1;
-	bool failed = false;
-	char* cache;
-	FS_DirectoryEntry fs_entry;
-	Handle fs_handle;
-	FS_Archive fs_archive;
-	Result_with_string result;
-	cache = (char*)malloc(1024);
+	if (!handle || max_num <= 0)
+		return 0;
 
-	result.code = FSUSER_OpenArchive(&fs_archive, ARCHIVE_SDMC, fsMakePath(PATH_EMPTY, ""));
-	if (result.code != 0)
+	char name[512];
+	u32 read_num = 0;
+	batch.resize(std::min(max_num, FILE_DIR_READ_BATCH));
+	if (FSDIR_Read(handle, &read_num, batch.size(), batch.data()) != 0 || read_num == 0)
 	{
-		result.string = "[Error] FSUSER_OpenArchive failed. ";
-		failed = true;
+		close();
+		return 0;
+	}
+	for (u32 i = 0; i < read_num; i++)
+	{
+		FileDirEntry entry;
+		unicodeToChar(name, batch[i].name, 512);
+		entry.name = name;
+		entry.size = batch[i].fileSize;
+		if (batch[i].attributes == FS_ATTRIBUTE_HIDDEN)
+			entry.type = "hidden";
+		else if (batch[i].attributes == FS_ATTRIBUTE_DIRECTORY)
+			entry.type = "dir";
+		else if (batch[i].attributes == FS_ATTRIBUTE_ARCHIVE)
+			entry.type = "file";
+		else if (batch[i].attributes == FS_ATTRIBUTE_READ_ONLY)
+			entry.type = "read only";
+		else
+			entry.type = "unknown";
+		entries.push_back(std::move(entry));
 	}
+	return read_num;
+}
 
-	if (!failed)
+void DirectoryReader::close()
+{
+	if (handle)
+		FSDIR_Close(handle);
+	handle = 0;
+}
+
+Result_with_string BufferedFileWriter::open(const std::string& file_name, const std::string& dir_path, bool append)
+{
+	Result_with_string result;
+	FS_Archive fs_archive = 0;
+	close();
+	path = dir_path + file_name;
+
+	result = Util_file_get_archive(&fs_archive);
+	if (result.code == 0)
+		result = Util_file_make_dir(fs_archive, dir_path);
+	if (result.code == 0)
 	{
-		result.code = FSUSER_OpenDirectory(&fs_handle, fs_archive, fsMakePath(PATH_ASCII, dir_path.c_str()));
+		Util_file_invalidate(path);
+		result.code = FSUSER_OpenFile(&handle, fs_archive, fsMakePath(PATH_ASCII, path.c_str()), FS_OPEN_WRITE | FS_OPEN_CREATE, FS_ATTRIBUTE_ARCHIVE);
 		if (result.code != 0)
 		{
-			result.string = "[Error] FSUSER_OpenDirectory failed. ";
-			failed = true;
+			handle = 0;
+			result.string = "[Error] FSUSER_OpenFile failed. ";
 		}
 	}
-
-	if (!failed)
+	if (result.code == 0)
 	{
-		while (true)
+		u64 file_size = 0;
+		if (append)
+			result.code = FSFILE_GetSize(handle, &file_size);
+		else
+			result.code = FSFILE_SetSize(handle, 0);
+		pos = file_size;
+		if (result.code != 0)
 		{
-			if (count >= name_num_of_array || count >= type_num_of_array)
-			{
-				result.string = "[Error] array size is too small. ";
-				break;
-			}
-			result.code = FSDIR_Read(fs_handle, &read_entry, read_entry_count, (FS_DirectoryEntry*)&fs_entry);
-			if (read_entry == 0)
-				break;
+			result.string = append ? "[Error] FSFILE_GetSize failed. " : "[Error] FSFILE_SetSize failed. ";
+			FSFILE_Close(handle);
+			handle = 0;
+		}
+	}
+	if (result.code == 0)
+		buffer.reserve(FILE_WRITE_BUFFER_SIZE);
+	else
+		result.error_description = "sdmc:" + path;
 
-			unicodeToChar(cache, fs_entry.name, 512);
-			file_dir_name[count] = cache;
-
-			if (fs_entry.attributes == FS_ATTRIBUTE_HIDDEN)
-				type[count] = "hidden";
-			else if (fs_entry.attributes == FS_ATTRIBUTE_DIRECTORY)
-				type[count] = "dir";
-			else if (fs_entry.attributes == FS_ATTRIBUTE_ARCHIVE)
-				type[count] = "file";
-			else if (fs_entry.attributes == FS_ATTRIBUTE_READ_ONLY)
-				type[count] = "read only";
-			else
-				type[count] = "unknown";
+	return result;
+}
 
-			memset(cache, 0x0, 1024);
-			count++;
-		}
-		*num_of_detected = count;
+Result_with_string BufferedFileWriter::write(const u8* data, u32 size)
+{
+	Result_with_string result;
+	if (!handle)
+	{
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] file is not opened. ";
+		return result;
+	}
+	if (buffer.size() + size > FILE_WRITE_BUFFER_SIZE)
+	{
+		result = flush();
+		if (result.code != 0)
+			return result;
+	}
+	if (size >= FILE_WRITE_BUFFER_SIZE) // no point in copying it
+	{
+		result = Util_file_write(handle, pos, data, size);
+		if (result.code == 0)
+			pos += size;
+		else
+			result.error_description = "sdmc:" + path;
 	}
+	else
+		buffer.insert(buffer.end(), data, data + size);
+
+	return result;
+}
+
+Result_with_string BufferedFileWriter::flush()
+{
+	Result_with_string result;
+	if (!handle || !buffer.size())
+		return result;
+
+	result = Util_file_write(handle, pos, buffer.data(), buffer.size());
+	if (result.code == 0)
+		pos += buffer.size();
+	else
+		result.error_description = "sdmc:" + path;
+	buffer.clear();
+
+	return result;
+}
+
+Result_with_string BufferedFileWriter::close()
+{
+	Result_with_string result;
+	if (!handle)
+		return result;
+
+	result = flush();
+	FSFILE_Close(handle);
+	handle = 0;
+	pos = 0;
+	std::vector<u8>().swap(buffer);
 
-	FSDIR_Close(fs_handle);
-	FSUSER_CloseArchive(fs_archive);
-	free(cache);
 	return result;
 }
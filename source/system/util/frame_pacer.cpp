@@ -0,0 +1,58 @@
+#include "headers.hpp"
+#include "system/util/frame_pacer.hpp"
+
+#define FRAME_TIME_MS (1000.0 / 59.83) // the refresh rate of the screens
+
+namespace {
+	Handle ui_idle_event; // signaled while the UI thread is waiting for the next frame
+	bool initialized = false;
+	volatile bool ui_busy = false;
+	volatile u64 frame_start_tick = 0;
+}
+
+static double get_time_ms() { return svcGetSystemTick() / CPU_TICKS_PER_MSEC; }
+
+void frame_pacer_init() {
+	if (initialized) return;
+	svcCreateEvent(&ui_idle_event, RESET_STICKY);
+	svcSignalEvent(ui_idle_event);
+	frame_start_tick = svcGetSystemTick();
+	initialized = true;
+}
+
+void frame_pacer_frame_start() {
+	if (!initialized) return;
+	frame_start_tick = svcGetSystemTick();
+	ui_busy = true;
+	svcClearEvent(ui_idle_event);
+}
+void frame_pacer_ui_done() {
+	if (!initialized) return;
+	ui_busy = false;
+	svcSignalEvent(ui_idle_event);
+}
+
+bool frame_pacer_is_ui_busy() { return ui_busy; }
+
+double frame_pacer_get_remaining_time() {
+	double elapsed = get_time_ms() - frame_start_tick / CPU_TICKS_PER_MSEC;
+	// frames skipped by the UI thread still pass at the same rate
+	return FRAME_TIME_MS - std::fmod(std::max(0.0, elapsed), FRAME_TIME_MS);
+}
+
+bool frame_pacer_wait_for_budget(double needed_ms, s64 timeout_ns) {
+	if (!initialized) return true;
+	double deadline = get_time_ms() + timeout_ns / 1000000.0;
+	while (true) {
+		double timeout_left = deadline - get_time_ms();
+		if (timeout_left <= 0) return false;
+		if (ui_busy) {
+			if (svcWaitSynchronization(ui_idle_event, (s64) (timeout_left * 1000000)) != 0) return false;
+			continue;
+		}
+		double remaining = frame_pacer_get_remaining_time();
+		if (remaining >= needed_ms) return true;
+		// too late in this frame, wait for the UI thread to be done with the next one
+		svcSleepThread((s64) (std::min(remaining, timeout_left) * 1000000) + 1000000);
+	}
+}
@@ -0,0 +1,107 @@
+#include "headers.hpp"
+#include "system/util/frame_profiler.hpp"
+#include "system/util/misc_tasks.hpp"
+#include <vector>
+
+#define PROFILE_DIR (DEF_MAIN_DIR + "profile/")
+#define FLUSH_RECORD_NUM 60 // about every two seconds at 30 fps
+#define MAX_BUFFERED_RECORD_NUM 1200 // records are dropped (and counted) if the sd card can't keep up
+#define LOG_STR "frame-profiler"
+
+namespace {
+	struct PendingFile {
+		std::string file_name;
+		std::vector<FrameProfileRecord> records;
+		bool header_written = false;
+	};
+	bool running = false;
+	int file_cnt = 0;
+	PendingFile cur_file;
+	std::vector<PendingFile> closed_files; // stopped but not completely written yet
+	int dropped_record_num = 0;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+void frame_profiler_start(const std::string &video_id) {
+	lock();
+	if (running) closed_files.push_back(cur_file);
+	cur_file = PendingFile();
+	cur_file.file_name = video_id + "_" + std::to_string(var_num_of_app_start) + "_" + std::to_string(file_cnt++) + ".csv";
+	running = true;
+	release();
+	Util_log_save(LOG_STR, "start : " + cur_file.file_name);
+}
+void frame_profiler_stop() {
+	lock();
+	if (running) {
+		closed_files.push_back(cur_file);
+		cur_file = PendingFile();
+		running = false;
+	}
+	release();
+	misc_tasks_request(TASK_FLUSH_FRAME_PROFILE);
+}
+bool frame_profiler_is_running() {
+	lock();
+	bool res = running;
+	release();
+	return res;
+}
+void frame_profiler_record(const FrameProfileRecord &record) {
+	bool need_flush = false;
+	lock();
+	if (running) {
+		if (cur_file.records.size() >= MAX_BUFFERED_RECORD_NUM) dropped_record_num++;
+		else cur_file.records.push_back(record);
+		need_flush = cur_file.records.size() >= FLUSH_RECORD_NUM;
+	}
+	release();
+	if (need_flush) misc_tasks_request(TASK_FLUSH_FRAME_PROFILE);
+}
+
+static std::string to_csv_line(const FrameProfileRecord &record) {
+	char buf[160];
+	snprintf(buf, sizeof(buf), "%.3f,%.2f,%.2f,%.2f,%.2f,%.2f,%d,%d\n", record.pts, record.decode_time, record.convert_time, record.copy_time,
+		record.av_drift, record.network_wait_time, (int) record.late, (int) record.skipped);
+	return buf;
+}
+static void write_file(PendingFile &file) {
+	std::string data;
+	if (!file.header_written) data += "pts,decode_ms,convert_ms,copy_ms,av_drift_ms,network_wait_ms,late,skipped\n";
+	for (auto &record : file.records) data += to_csv_line(record);
+	if (!data.size()) return;
+
+	Result_with_string result = Util_file_save_to_file(file.file_name, PROFILE_DIR, (u8 *) data.c_str(), data.size(), !file.header_written);
+	if (result.code != 0) Util_log_save(LOG_STR, "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+	file.header_written = true;
+}
+void frame_profiler_flush() {
+	// take the records out so that the recording isn't blocked while writing
+	lock();
+	std::vector<PendingFile> files = closed_files;
+	closed_files.clear();
+	if (running) {
+		files.push_back(cur_file);
+		cur_file.records.clear();
+		cur_file.header_written = true; // written just below
+	}
+	int dropped = dropped_record_num;
+	dropped_record_num = 0;
+	release();
+
+	for (auto &file : files) write_file(file);
+	if (dropped) Util_log_save(LOG_STR, "dropped " + std::to_string(dropped) + " records");
+}
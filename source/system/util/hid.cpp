@@ -1,29 +1,6 @@
 #include "headers.hpp"
 
 bool hid_scan_hid_thread_run = false;
-bool hid_key_A_press = false;
-bool hid_key_B_press = false;
-bool hid_key_X_press = false;
-bool hid_key_Y_press = false;
-bool hid_key_C_UP_press = false;
-bool hid_key_C_RIGHT_press = false;
-bool hid_key_C_DOWN_press = false;
-bool hid_key_C_LEFT_press = false;
-bool hid_key_D_UP_press = false;
-bool hid_key_D_RIGHT_press = false;
-bool hid_key_D_DOWN_press = false;
-bool hid_key_D_LEFT_press = false;
-bool hid_key_L_press = false;
-bool hid_key_R_press = false;
-bool hid_key_ZL_press = false;
-bool hid_key_ZR_press = false;
-bool hid_key_START_press = false;
-bool hid_key_SELECT_press = false;
-bool hid_key_CS_UP_press = false;
-bool hid_key_CS_DOWN_press = false;
-bool hid_key_CS_RIGHT_press = false;
-bool hid_key_CS_LEFT_press = false;
-bool hid_key_touch_press = false;
 bool hid_key_A_held = false;
 bool hid_key_B_held = false;
 bool hid_key_X_held = false;
@@ -59,9 +36,35 @@ int hid_held_time = 0;
 int hid_count = 0;
 std::string hid_scan_hid_thread_string = "Hid/Scan hid thread";
 Thread hid_scan_hid_thread;
+// the touch positions of every scan (the scenes may run at a lower frame rate than the scan), only of the current touch
+#define HID_TOUCH_SAMPLE_NUM 16
+struct Hid_touch_sample {
+	u64 tick;
+	int y;
+};
+Hid_touch_sample hid_touch_samples[HID_TOUCH_SAMPLE_NUM];
+int hid_touch_sample_head = 0; // the index the next sample is written to
+int hid_touch_sample_num = 0;
+Handle hid_touch_sample_lock = 0;
+// the keys pressed in every scan are queued with the time, so that no press is lost even if a scene frame spans several scans
+// single producer (the scan thread), single consumer (the scene thread)
+#define HID_EVENT_QUEUE_SIZE 64
+#define HID_EVENT_KEYS (KEY_A | KEY_B | KEY_X | KEY_Y | KEY_DUP | KEY_DDOWN | KEY_DLEFT | KEY_DRIGHT | KEY_CPAD_UP | KEY_CPAD_DOWN \
+	| KEY_CPAD_LEFT | KEY_CPAD_RIGHT | KEY_L | KEY_R | KEY_ZL | KEY_ZR | KEY_START | KEY_SELECT | KEY_TOUCH)
+struct Hid_event {
+	u64 tick;
+	u32 keys_down;
+	int touch_x; // where the touch started if KEY_TOUCH is in `keys_down`
+	int touch_y;
+};
+Hid_event hid_events[HID_EVENT_QUEUE_SIZE];
+u32 hid_event_write_num = 0; // written by the scan thread only
+u32 hid_event_read_num = 0; // the events before it have been consumed by Util_hid_key_flag_reset()
+u32 hid_event_query_num = 0; // the events before it were reported by the last Util_hid_query_key_state()
 
 void Util_hid_init(void)
 {
+	svcCreateMutex(&hid_touch_sample_lock, false);
 	hid_scan_hid_thread_run = true;
 	hid_scan_hid_thread = threadCreate(Util_hid_scan_hid_thread, (void*)(""), DEF_STACKSIZE, DEF_THREAD_PRIORITY_REALTIME, -1, false);
 }
@@ -71,33 +74,69 @@ void Util_hid_exit(void)
 	hid_scan_hid_thread_run = false;
 	threadJoin(hid_scan_hid_thread, 10000000000);
 	threadFree(hid_scan_hid_thread);
+	svcCloseHandle(hid_touch_sample_lock);
+}
+
+double Util_hid_get_touch_velocity_y(double window_ms)
+{
+	double res = 0;
+	svcWaitSynchronization(hid_touch_sample_lock, std::numeric_limits<s64>::max());
+	if (hid_touch_sample_num >= 2)
+	{
+		const Hid_touch_sample &last = hid_touch_samples[(hid_touch_sample_head + HID_TOUCH_SAMPLE_NUM - 1) % HID_TOUCH_SAMPLE_NUM];
+		// the oldest sample still in the window
+		const Hid_touch_sample *first = &last;
+		for (int i = 2; i <= hid_touch_sample_num; i++)
+		{
+			const Hid_touch_sample &cur = hid_touch_samples[(hid_touch_sample_head + HID_TOUCH_SAMPLE_NUM - i) % HID_TOUCH_SAMPLE_NUM];
+			if ((last.tick - cur.tick) / CPU_TICKS_PER_MSEC > window_ms) break;
+			first = &cur;
+		}
+		double elapsed = (last.tick - first->tick) / CPU_TICKS_PER_MSEC;
+		if (elapsed > 0) res = (last.y - first->y) / elapsed;
+	}
+	svcReleaseMutex(hid_touch_sample_lock);
+	return res;
 }
 
 void Util_hid_query_key_state(Hid_info* out_key_state)
 {
-	out_key_state->p_a = hid_key_A_press;
-	out_key_state->p_b = hid_key_B_press;
-	out_key_state->p_x = hid_key_X_press;
-	out_key_state->p_y = hid_key_Y_press;
-	out_key_state->p_c_up = hid_key_C_UP_press;
-	out_key_state->p_c_down = hid_key_C_DOWN_press;
-	out_key_state->p_c_left = hid_key_C_LEFT_press;
-	out_key_state->p_c_right = hid_key_C_RIGHT_press;
-	out_key_state->p_d_up = hid_key_D_UP_press;
-	out_key_state->p_d_down = hid_key_D_DOWN_press;
-	out_key_state->p_d_left = hid_key_D_LEFT_press;
-	out_key_state->p_d_right = hid_key_D_RIGHT_press;
-	out_key_state->p_l = hid_key_L_press;
-	out_key_state->p_r = hid_key_R_press;
-	out_key_state->p_zl = hid_key_ZL_press;
-	out_key_state->p_zr = hid_key_ZR_press;
-	out_key_state->p_start = hid_key_START_press;
-	out_key_state->p_select = hid_key_SELECT_press;
-	out_key_state->p_cs_up = hid_key_CS_UP_press;
-	out_key_state->p_cs_down = hid_key_CS_DOWN_press;
-	out_key_state->p_cs_left = hid_key_CS_LEFT_press;
-	out_key_state->p_cs_right = hid_key_CS_RIGHT_press;
-	out_key_state->p_touch = hid_key_touch_press;
+	// every press since the last reset, not only the ones of the latest scan
+	u32 end = __atomic_load_n(&hid_event_write_num, __ATOMIC_ACQUIRE);
+	// the slot of `end` may be being written, and the counters wrap so compare distances, not the counters
+	u32 begin = end - hid_event_read_num > HID_EVENT_QUEUE_SIZE - 1 ? end - (HID_EVENT_QUEUE_SIZE - 1) : hid_event_read_num;
+	u32 pressed = 0;
+	int touch_down_x = -1, touch_down_y = -1;
+	for (u32 i = begin; i != end; i++) {
+		const Hid_event &event = hid_events[i % HID_EVENT_QUEUE_SIZE];
+		pressed |= event.keys_down;
+		if (event.keys_down & KEY_TOUCH) touch_down_x = event.touch_x, touch_down_y = event.touch_y;
+	}
+	hid_event_query_num = end;
+
+	out_key_state->p_a = pressed & KEY_A;
+	out_key_state->p_b = pressed & KEY_B;
+	out_key_state->p_x = pressed & KEY_X;
+	out_key_state->p_y = pressed & KEY_Y;
+	out_key_state->p_c_up = pressed & KEY_CPAD_UP;
+	out_key_state->p_c_down = pressed & KEY_CPAD_DOWN;
+	out_key_state->p_c_left = pressed & KEY_CPAD_LEFT;
+	out_key_state->p_c_right = pressed & KEY_CPAD_RIGHT;
+	out_key_state->p_d_up = pressed & KEY_DUP;
+	out_key_state->p_d_down = pressed & KEY_DDOWN;
+	out_key_state->p_d_left = pressed & KEY_DLEFT;
+	out_key_state->p_d_right = pressed & KEY_DRIGHT;
+	out_key_state->p_l = pressed & KEY_L;
+	out_key_state->p_r = pressed & KEY_R;
+	out_key_state->p_zl = pressed & KEY_ZL;
+	out_key_state->p_zr = pressed & KEY_ZR;
+	out_key_state->p_start = pressed & KEY_START;
+	out_key_state->p_select = pressed & KEY_SELECT;
+	out_key_state->p_cs_up = false;
+	out_key_state->p_cs_down = false;
+	out_key_state->p_cs_left = false;
+	out_key_state->p_cs_right = false;
+	out_key_state->p_touch = pressed & KEY_TOUCH;
 	out_key_state->h_a = hid_key_A_held;
 	out_key_state->h_b = hid_key_B_held;
 	out_key_state->h_x = hid_key_X_held;
@@ -123,8 +162,9 @@ void Util_hid_query_key_state(Hid_info* out_key_state)
 	out_key_state->h_touch = hid_key_touch_held;
 	out_key_state->cpad_x = hid_cpad_pos_x;
 	out_key_state->cpad_y = hid_cpad_pos_y;
-	out_key_state->touch_x = hid_touch_pos_x;
-	out_key_state->touch_y = hid_touch_pos_y;
+	// the press is reported where it happened, even if the touch moved or was released before this frame
+	out_key_state->touch_x = (pressed & KEY_TOUCH) ? touch_down_x : hid_touch_pos_x;
+	out_key_state->touch_y = (pressed & KEY_TOUCH) ? touch_down_y : hid_touch_pos_y;
 	out_key_state->touch_x_move = hid_touch_pos_x_moved;
 	out_key_state->touch_y_move = hid_touch_pos_y_moved;
 	out_key_state->held_time = hid_held_time;
@@ -133,29 +173,7 @@ void Util_hid_query_key_state(Hid_info* out_key_state)
 
 void Util_hid_key_flag_reset(void)
 {
-	hid_key_A_press = false;
-	hid_key_B_press = false;
-	hid_key_X_press = false;
-	hid_key_Y_press = false;
-	hid_key_C_UP_press = false;
-	hid_key_C_DOWN_press = false;
-	hid_key_C_RIGHT_press = false;
-	hid_key_C_LEFT_press = false;
-	hid_key_D_UP_press = false;
-	hid_key_D_DOWN_press = false;
-	hid_key_D_RIGHT_press = false;
-	hid_key_D_LEFT_press = false;
-	hid_key_L_press = false;
-	hid_key_R_press = false;
-	hid_key_ZL_press = false;
-	hid_key_ZR_press = false;
-	hid_key_START_press = false;
-	hid_key_SELECT_press = false;
-	hid_key_CS_UP_press = false;
-	hid_key_CS_DOWN_press = false;
-	hid_key_CS_RIGHT_press = false;
-	hid_key_CS_LEFT_press = false;
-	hid_key_touch_press = false;
+	hid_event_read_num = hid_event_query_num;
 	hid_key_A_held = false;
 	hid_key_B_held = false;
 	hid_key_X_held = false;
@@ -184,33 +202,6 @@ void Util_hid_key_flag_reset(void)
 	hid_count = 0;
 }
 
-static void Util_hid_key_pressed_flag_reset() {
-	hid_key_A_press = false;
-	hid_key_B_press = false;
-	hid_key_X_press = false;
-	hid_key_Y_press = false;
-	hid_key_C_UP_press = false;
-	hid_key_C_DOWN_press = false;
-	hid_key_C_RIGHT_press = false;
-	hid_key_C_LEFT_press = false;
-	hid_key_D_UP_press = false;
-	hid_key_D_DOWN_press = false;
-	hid_key_D_RIGHT_press = false;
-	hid_key_D_LEFT_press = false;
-	hid_key_L_press = false;
-	hid_key_R_press = false;
-	hid_key_ZL_press = false;
-	hid_key_ZR_press = false;
-	hid_key_START_press = false;
-	hid_key_SELECT_press = false;
-	hid_key_CS_UP_press = false;
-	hid_key_CS_DOWN_press = false;
-	hid_key_CS_RIGHT_press = false;
-	hid_key_CS_LEFT_press = false;
-	hid_key_touch_press = false;
-}
-
-
 void Util_hid_scan_hid_thread(void* arg)
 {
 	Util_log_save(hid_scan_hid_thread_string, "Thread started.");
@@ -229,96 +220,6 @@ void Util_hid_scan_hid_thread(void* arg)
 		kHeld = hidKeysHeld();
 		kDown = hidKeysDown();
 
-		if (kDown & KEY_A)
-			hid_key_A_press = true;
-		else
-			hid_key_A_press = false;
-
-		if (kDown & KEY_B)
-			hid_key_B_press = true;
-		else
-			hid_key_B_press = false;
-
-		if (kDown & KEY_X)
-			hid_key_X_press = true;
-		else
-			hid_key_X_press = false;
-
-		if (kDown & KEY_Y)
-			hid_key_Y_press = true;
-		else
-			hid_key_Y_press = false;
-
-		if (kDown & KEY_DUP)
-			hid_key_D_UP_press = true;
-		else
-			hid_key_D_UP_press = false;
-
-		if (kDown & KEY_DDOWN)
-			hid_key_D_DOWN_press = true;
-		else
-			hid_key_D_DOWN_press = false;
-
-		if (kDown & KEY_DRIGHT)
-			hid_key_D_RIGHT_press = true;
-		else
-			hid_key_D_RIGHT_press = false;
-
-		if (kDown & KEY_DLEFT)
-			hid_key_D_LEFT_press = true;
-		else
-			hid_key_D_LEFT_press = false;
-
-		if (kDown & KEY_CPAD_UP)
-			hid_key_C_UP_press = true;
-		else
-			hid_key_C_UP_press = false;
-
-		if (kDown & KEY_CPAD_DOWN)
-			hid_key_C_DOWN_press = true;
-		else
-			hid_key_C_DOWN_press = false;
-
-		if (kDown & KEY_CPAD_RIGHT)
-			hid_key_C_RIGHT_press = true;
-		else
-			hid_key_C_RIGHT_press = false;
-
-		if (kDown & KEY_CPAD_LEFT)
-			hid_key_C_LEFT_press = true;
-		else
-			hid_key_C_LEFT_press = false;
-
-		if (kDown & KEY_SELECT)
-			hid_key_SELECT_press = true;
-		else
-			hid_key_SELECT_press = false;
-
-		if (kDown & KEY_START)
-			hid_key_START_press = true;
-		else
-			hid_key_START_press = false;
-
-		if (kDown & KEY_L)
-			hid_key_L_press = true;
-		else
-			hid_key_L_press = false;
-
-		if (kDown & KEY_R)
-			hid_key_R_press = true;
-		else
-			hid_key_R_press = false;
-
-		if (kDown & KEY_ZL)
-			hid_key_ZL_press = true;
-		else
-			hid_key_ZL_press = false;
-
-		if (kDown & KEY_ZR)
-			hid_key_ZR_press = true;
-		else
-			hid_key_ZR_press = false;
-
 		if (kHeld & KEY_DRIGHT)
 			hid_key_D_RIGHT_held = true;
 		else
@@ -399,11 +300,20 @@ void Util_hid_scan_hid_thread(void* arg)
 		else
 			hid_key_ZR_held = false;
 
+		svcWaitSynchronization(hid_touch_sample_lock, std::numeric_limits<s64>::max());
+		if (kDown & KEY_TOUCH) hid_touch_sample_num = 0;
+		if (kDown & KEY_TOUCH || kHeld & KEY_TOUCH)
+		{
+			hid_touch_samples[hid_touch_sample_head] = { svcGetSystemTick(), touch_pos.py };
+			hid_touch_sample_head = (hid_touch_sample_head + 1) % HID_TOUCH_SAMPLE_NUM;
+			hid_touch_sample_num = std::min(hid_touch_sample_num + 1, HID_TOUCH_SAMPLE_NUM);
+		}
+		svcReleaseMutex(hid_touch_sample_lock);
+		
 		if (kDown & KEY_TOUCH || kHeld & KEY_TOUCH)
 		{
 			if (kDown & KEY_TOUCH)
 			{
-				hid_key_touch_press = true;
 				hid_key_touch_held = false;
 				hid_pre_touch_pos_x = touch_pos.px;
 				hid_pre_touch_pos_y = touch_pos.py;
@@ -413,7 +323,6 @@ void Util_hid_scan_hid_thread(void* arg)
 			else if (kHeld & KEY_TOUCH)
 			{
 				hid_key_touch_held = true;
-				hid_key_touch_press = false;
 				hid_touch_pos_x = touch_pos.px;
 				hid_touch_pos_y = touch_pos.py;
 				hid_touch_pos_x_moved = hid_pre_touch_pos_x - hid_touch_pos_x;
@@ -424,7 +333,6 @@ void Util_hid_scan_hid_thread(void* arg)
 		}
 		else
 		{
-			hid_key_touch_press = false;
 			hid_key_touch_held = false;
 			hid_touch_pos_x = -1;
 			hid_touch_pos_y = -1;
@@ -437,17 +345,22 @@ void Util_hid_scan_hid_thread(void* arg)
 		hid_cpad_pos_x = circle_pos.dx;
 		hid_cpad_pos_y = circle_pos.dy;
 
-		if (hid_key_A_press || hid_key_B_press || hid_key_X_press || hid_key_Y_press || hid_key_D_RIGHT_press
-			|| hid_key_D_LEFT_press || hid_key_ZL_press || hid_key_ZR_press || hid_key_L_press || hid_key_R_press
-			|| hid_key_START_press || hid_key_SELECT_press || hid_key_touch_press || hid_key_A_held || hid_key_B_held
+		u32 pressed = kDown & HID_EVENT_KEYS;
+		if (pressed || hid_key_A_held || hid_key_B_held
 			|| hid_key_X_held || hid_key_Y_held || hid_key_D_DOWN_held || hid_key_D_RIGHT_held
 			|| hid_key_D_LEFT_held || hid_key_C_UP_held || hid_key_C_DOWN_held || hid_key_C_RIGHT_held
 			|| hid_key_C_LEFT_held || hid_key_D_UP_held || hid_key_touch_held || hid_key_ZL_held
 			|| hid_key_ZR_held || hid_key_L_held || hid_key_R_held) {
 			
-			if (var_afk_time > var_time_to_turn_off_lcd) Util_hid_key_pressed_flag_reset(); // the tap to awake the lcd should not be caught in most cases
+			if (var_afk_time > var_time_to_turn_off_lcd) pressed = 0; // the tap to awake the lcd should not be caught in most cases
 			var_afk_time = 0;
 		}
+		if (pressed)
+		{
+			u32 write_num = hid_event_write_num;
+			hid_events[write_num % HID_EVENT_QUEUE_SIZE] = { svcGetSystemTick(), pressed, touch_pos.px, touch_pos.py };
+			__atomic_store_n(&hid_event_write_num, write_num + 1, __ATOMIC_RELEASE);
+		}
 
 		if (hid_key_D_UP_held || hid_key_D_DOWN_held || hid_key_D_RIGHT_held || hid_key_D_LEFT_held
 			|| hid_key_C_UP_held || hid_key_C_DOWN_held || hid_key_C_RIGHT_held || hid_key_C_LEFT_held
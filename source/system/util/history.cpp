@@ -3,6 +3,7 @@
 #include "system/util/util.hpp"
 #include "ui/ui.hpp"
 #include "json11/json11.hpp"
+#include <unordered_map>
 
 using namespace json11;
 
@@ -21,9 +22,109 @@ static void release() {
 	svcReleaseMutex(resource_lock);
 }
 
-#define HISTORY_VERSION 0
+#define HISTORY_VERSION 1
+#define HISTORY_LOG_FILE "watch_history.log"
+#define HISTORY_LOG_COMPACT_SIZE (64 * 1024) // the log is folded into watch_history.json once it grows past this
+#define HISTORY_TITLE_WIDTH (320 - VIDEO_LIST_THUMBNAIL_WIDTH - 6)
 
-void load_watch_history() {
+// log records : [u32 payload size][u8 type][payload]
+#define HISTORY_RECORD_PUT 0 // payload : the whole entry, replaces the one with the same id
+#define HISTORY_RECORD_ERASE 1 // payload : id
+
+// kept in no particular order, get_watch_history() sorts lazily
+static std::unordered_map<std::string, size_t> watch_history_index;
+static bool watch_history_sorted = true;
+static std::string pending_log; // records not yet appended to the log file
+static bool compact_requested = false;
+static u64 log_file_size = 0;
+
+static void history_put(const HistoryVideo &video) {
+	auto itr = watch_history_index.find(video.id);
+	if (itr != watch_history_index.end()) watch_history[itr->second] = video;
+	else {
+		watch_history_index[video.id] = watch_history.size();
+		watch_history.push_back(video);
+	}
+	watch_history_sorted = false;
+}
+static void history_erase(const std::string &id) {
+	auto itr = watch_history_index.find(id);
+	if (itr == watch_history_index.end()) return;
+	size_t index = itr->second;
+	watch_history_index.erase(itr);
+	if (index + 1 != watch_history.size()) {
+		watch_history[index] = watch_history.back();
+		watch_history_index[watch_history[index].id] = index;
+	}
+	watch_history.pop_back();
+	watch_history_sorted = false;
+}
+static void history_clear() {
+	watch_history.clear();
+	watch_history_index.clear();
+	watch_history_sorted = true;
+}
+
+static void append_u32(std::string &buf, u32 value) { buf.append((const char *) &value, sizeof(value)); }
+static void append_str(std::string &buf, const std::string &str) {
+	append_u32(buf, str.size());
+	buf += str;
+}
+static void append_record(u8 type, const std::string &payload) {
+	append_u32(pending_log, payload.size());
+	pending_log.push_back((char) type);
+	pending_log += payload;
+}
+static std::string encode_video(const HistoryVideo &video) {
+	std::string res;
+	append_str(res, video.id);
+	append_str(res, video.title);
+	append_u32(res, video.title_lines.size());
+	for (auto &line : video.title_lines) append_str(res, line);
+	append_str(res, video.author_name);
+	append_str(res, video.length_text);
+	append_u32(res, video.my_view_count);
+	append_u32(res, (u32) video.last_watch_time);
+	return res;
+}
+
+struct RecordReader {
+	const char *cur;
+	const char *end;
+	bool fail = false;
+	RecordReader (const char *cur, const char *end) : cur(cur), end(end) {}
+	
+	u32 read_u32() {
+		u32 res = 0;
+		if (end - cur < (ptrdiff_t) sizeof(res)) fail = true;
+		else memcpy(&res, cur, sizeof(res)), cur += sizeof(res);
+		return res;
+	}
+	std::string read_str() {
+		u32 size = read_u32();
+		if (fail || (u32) (end - cur) < size) {
+			fail = true;
+			return "";
+		}
+		std::string res(cur, size);
+		cur += size;
+		return res;
+	}
+};
+static bool decode_video(RecordReader &reader, HistoryVideo &video) {
+	video.id = reader.read_str();
+	video.title = reader.read_str();
+	u32 line_num = reader.read_u32();
+	video.title_lines.clear();
+	for (u32 i = 0; i < line_num && !reader.fail; i++) video.title_lines.push_back(reader.read_str());
+	video.author_name = reader.read_str();
+	video.length_text = reader.read_str();
+	video.my_view_count = reader.read_u32();
+	video.last_watch_time = reader.read_u32();
+	return !reader.fail;
+}
+
+static void load_snapshot() {
 	u64 file_size;
 	Result_with_string result = Util_file_check_file_size("watch_history.json", DEF_MAIN_DIR, &file_size);
 	if (result.code != 0) {
@@ -43,12 +144,12 @@ void load_watch_history() {
 		Json data = Json::parse(buf, error);
 		int version = data["version"] == Json() ? -1 : data["version"].int_value();
 		if (version >= 0) {
-			std::vector<HistoryVideo> loaded_watch_history;
 			for (auto video : data["history"].array_items()) {
 				HistoryVideo cur_video;
 				cur_video.id = video["id"].string_value();
 				cur_video.title = video["title"].string_value();
-				cur_video.title_lines = truncate_str(cur_video.title, 320 - VIDEO_LIST_THUMBNAIL_WIDTH - 6, 2, 0.5, 0.5);
+				for (auto line : video["title_lines"].array_items()) cur_video.title_lines.push_back(line.string_value());
+				if (!cur_video.title_lines.size()) cur_video.title_lines = truncate_str(cur_video.title, HISTORY_TITLE_WIDTH, 2, 0.5, 0.5);
 				cur_video.author_name = video["author_name"].string_value();
 				cur_video.length_text = video["length"].string_value();
 				cur_video.my_view_count = video["my_view_count"].int_value();
@@ -60,26 +161,63 @@ void load_watch_history() {
 				// validation
 				bool valid = youtube_is_valid_video_id(cur_video.id);
 				if (!valid) Util_log_save("history/load", "invalid history item, ignoring...");
-				else loaded_watch_history.push_back(cur_video);
+				else history_put(cur_video);
 			}
-			std::sort(loaded_watch_history.begin(), loaded_watch_history.end(), [] (const HistoryVideo &i, const HistoryVideo &j) {
-				return i.last_watch_time > j.last_watch_time;
-			});
-			lock();
-			watch_history = loaded_watch_history;
-			release();
-			Util_log_save("history/load" , "loaded history(" + std::to_string(loaded_watch_history.size()) + " items)");
 		} else {
 			Util_log_save("history/load" , "failed to load history, json err:" + error);
 		}
 	}
 	free(buf);
 }
-void save_watch_history() {
+static void replay_log() {
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(HISTORY_LOG_FILE, DEF_MAIN_DIR, &file_size);
+	if (result.code != 0) return; // no changes since the last compaction
+	
+	char *buf = (char *) malloc(file_size);
+	u32 read_size = 0;
+	result = Util_file_load_from_file(HISTORY_LOG_FILE, DEF_MAIN_DIR, (u8 *) buf, file_size, &read_size);
+	Util_log_save("history/load" , "Util_file_load_from_file() (log)..." + result.string + result.error_description, result.code);
+	if (result.code == 0) {
+		RecordReader reader(buf, buf + read_size);
+		int record_num = 0;
+		while (reader.cur < reader.end) {
+			u32 payload_size = reader.read_u32();
+			if (reader.fail || reader.end - reader.cur < 1 + (ptrdiff_t) payload_size) break; // torn write at the tail
+			u8 type = *reader.cur++;
+			RecordReader payload(reader.cur, reader.cur + payload_size);
+			reader.cur += payload_size;
+			
+			if (type == HISTORY_RECORD_PUT) {
+				HistoryVideo video;
+				if (decode_video(payload, video) && youtube_is_valid_video_id(video.id)) history_put(video);
+			} else if (type == HISTORY_RECORD_ERASE) {
+				std::string id = payload.read_str();
+				if (!payload.fail) history_erase(id);
+			}
+			record_num++;
+		}
+		log_file_size = reader.cur - buf;
+		// rewrite everything on the next save if the log had garbage at the end so that new records stay parsable
+		if (log_file_size != read_size) compact_requested = true;
+		Util_log_save("history/load" , "replayed " + std::to_string(record_num) + " log records");
+	}
+	free(buf);
+}
+
+void load_watch_history() {
 	lock();
-	auto backup = watch_history;
+	history_clear();
+	log_file_size = 0;
+	load_snapshot();
+	replay_log();
+	Util_log_save("history/load" , "loaded history(" + std::to_string(watch_history.size()) + " items)");
 	release();
-	
+}
+
+static std::string json_str(const std::string &str) { return Json(str).dump(); }
+
+static void compact_watch_history(const std::vector<HistoryVideo> &backup) {
 	std::string data = 
 		std::string() +
 		"{\n" + 
@@ -87,16 +225,19 @@ void save_watch_history() {
 			"\t\"history\": [\n";
 	
 	bool first = true;
-	for (auto video : backup) {
+	for (auto &video : backup) {
 		if (first) first = false;
 		else data += ",";
+		std::string title_lines;
+		for (auto &line : video.title_lines) title_lines += (title_lines.size() ? ", " : "") + json_str(line);
 		data += 
 			std::string() +
 			"\t\t{\n" +
-				"\t\t\t\"id\": \"" + video.id + "\",\n" +
-				"\t\t\t\"title\": \"" + video.title + "\",\n" +
-				"\t\t\t\"author_name\": \"" + video.author_name + "\",\n" +
-				"\t\t\t\"length\": \"" + video.length_text + "\",\n" +
+				"\t\t\t\"id\": " + json_str(video.id) + ",\n" +
+				"\t\t\t\"title\": " + json_str(video.title) + ",\n" +
+				"\t\t\t\"title_lines\": [" + title_lines + "],\n" +
+				"\t\t\t\"author_name\": " + json_str(video.author_name) + ",\n" +
+				"\t\t\t\"length\": " + json_str(video.length_text) + ",\n" +
 				"\t\t\t\"my_view_count\": " + std::to_string(video.my_view_count) + ",\n" +
 				"\t\t\t\"last_watch_time\": \"" + std::to_string(video.last_watch_time) + "\"\n" + // string value because we have to deal with u32 value which json11 doesn't support loading
 			"\t\t}";
@@ -107,43 +248,76 @@ void save_watch_history() {
 	
 	Result_with_string result = Util_file_save_to_file("watch_history.json", DEF_MAIN_DIR, (u8 *) data.c_str(), data.size(), true);
 	Util_log_save("history/save", "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+	// only drop the log once the snapshot containing it is safely written
+	if (result.code == 0) Util_file_delete_file(HISTORY_LOG_FILE, DEF_MAIN_DIR);
+}
+void save_watch_history() {
+	lock();
+	std::string records;
+	records.swap(pending_log);
+	bool compact = compact_requested || log_file_size + records.size() > HISTORY_LOG_COMPACT_SIZE;
+	std::vector<HistoryVideo> backup;
+	if (compact) {
+		backup = watch_history;
+		compact_requested = false;
+		log_file_size = 0;
+	} else log_file_size += records.size();
+	release();
+	
+	if (compact) compact_watch_history(backup);
+	else if (records.size()) {
+		Result_with_string result = Util_file_save_to_file(HISTORY_LOG_FILE, DEF_MAIN_DIR, (u8 *) records.c_str(), records.size(), false);
+		Util_log_save("history/save", "Util_file_save_to_file() (log)..." + result.string + result.error_description, result.code);
+		if (result.code != 0) {
+			lock();
+			compact_requested = true;
+			release();
+		}
+	}
 }
 void add_watched_video(HistoryVideo video) {
 	if (var_history_enabled) {
 		lock();
-		bool found = false;
-		for (auto &i : watch_history) if (i.id == video.id) {
-			i.my_view_count++;
-			i.last_watch_time = video.last_watch_time;
-			found = true;
-		}
-		if (!found) {
-			video.title_lines = truncate_str(video.title, 320 - VIDEO_LIST_THUMBNAIL_WIDTH - 6, 2, 0.5, 0.5);
-			watch_history.push_back(video);
+		auto itr = watch_history_index.find(video.id);
+		if (itr != watch_history_index.end()) {
+			HistoryVideo &cur = watch_history[itr->second];
+			cur.my_view_count++;
+			cur.last_watch_time = video.last_watch_time;
+			watch_history_sorted = false;
+			append_record(HISTORY_RECORD_PUT, encode_video(cur));
+		} else {
+			video.title_lines = truncate_str(video.title, HISTORY_TITLE_WIDTH, 2, 0.5, 0.5);
+			history_put(video);
+			append_record(HISTORY_RECORD_PUT, encode_video(video));
 		}
-		std::sort(watch_history.begin(), watch_history.end(), [] (const HistoryVideo &i, const HistoryVideo &j) {
-			return i.last_watch_time > j.last_watch_time;
-		});
 		release();
 	}
 }
 void history_erase_by_id(const std::string &id) {
 	lock();
-	std::vector<HistoryVideo> tmp_watch_history;
-	for (auto video : watch_history) if (video.id != id) tmp_watch_history.push_back(video);
-	watch_history = tmp_watch_history;
+	history_erase(id);
+	std::string payload;
+	append_str(payload, id);
+	append_record(HISTORY_RECORD_ERASE, payload);
 	release();
 }
 void history_erase_all() {
 	lock();
-	watch_history.clear();
+	history_clear();
+	pending_log.clear();
+	compact_requested = true; // an empty snapshot is smaller than any log
 	release();
 }
 std::vector<HistoryVideo> get_watch_history() {
 	lock();
+	if (!watch_history_sorted) {
+		std::sort(watch_history.begin(), watch_history.end(), [] (const HistoryVideo &i, const HistoryVideo &j) {
+			return i.last_watch_time > j.last_watch_time;
+		});
+		for (size_t i = 0; i < watch_history.size(); i++) watch_history_index[watch_history[i].id] = i;
+		watch_history_sorted = true;
+	}
 	std::vector<HistoryVideo> res = watch_history;
 	release();
 	return res;
 }
-
-
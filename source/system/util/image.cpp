@@ -1,34 +1,38 @@
 #include "headers.hpp"
+#include "system/util/trace.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image/stb_image.h"
 
 // returns in BGR565 format, should be freed
-u8 *Image_decode(u8 *input, size_t input_len, int* width, int* height)
+u8 *Image_decode(u8 *input, size_t input_len, int* width, int* height, int max_width, double max_aspect)
 {
+	TRACE_ZONE("Image_decode");
 	int image_ch = 0;
-	u8 *rgb_image = stbi_load_from_memory(input, input_len, width, height, &image_ch, STBI_rgb);
+	int src_width, src_height;
+	u8 *rgb_image = stbi_load_from_memory(input, input_len, &src_width, &src_height, &image_ch, STBI_rgb);
 	if (!rgb_image) {
 		Util_log_save("image-dec", "stbi load failed : " + std::string(stbi_failure_reason()));
 		return NULL;
 	}
-	u8 *bgr_image = (u8 *) malloc(*width * *height * 2);
-	if (!bgr_image) {
-		stbi_image_free(rgb_image);
-		return NULL;
-	}
-	for (int i = 0; i < *width * *height; i++) {
-		u8 r = rgb_image[i * 3 + 0];
-		u8 g = rgb_image[i * 3 + 1];
-		u8 b = rgb_image[i * 3 + 2];
-		r >>= 3;
-		g >>= 2;
-		b >>= 3;
-		bgr_image[i * 2 + 0] = b | g << 5;
-		bgr_image[i * 2 + 1] = g >> 3 | r << 3;
-	}
+	*width = src_width;
+	*height = src_height;
+	if (max_width > 0 && *width > max_width) *width = max_width;
+	if (max_aspect > 0 && *height > *width * max_aspect + 1) *height = *width * max_aspect;
+	int left = (src_width - *width) / 2;
+	int top = (src_height - *height) / 2;
 	
+	// converted in place (the output pixel never goes past the input one), so no second buffer is needed
+	// stb_image allocates with malloc(), so the caller can free() it as it is
+	u16 *dst = (u16 *) rgb_image;
+	for (int i = 0; i < *height; i++) {
+		u8 *src = rgb_image + ((top + i) * src_width + left) * 3;
+		for (int j = 0; j < *width; j++) {
+			*dst++ = (src[0] >> 3) << 11 | (src[1] >> 2) << 5 | src[2] >> 3;
+			src += 3;
+		}
+	}
 	
-	stbi_image_free(rgb_image);
-	return bgr_image;
+	u8 *bgr_image = (u8 *) realloc(rgb_image, *width * *height * 2); // give back the rest
+	return bgr_image ? bgr_image : rgb_image;
 }
@@ -0,0 +1,277 @@
+#include "headers.hpp"
+#include "system/util/kernel_benchmark.hpp"
+#include "system/util/misc_tasks.hpp"
+#include "json11/json11.hpp"
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#define INPUT_DIR "romfs:/benchmark/"
+#define REPORT_DIR (DEF_MAIN_DIR + "profile/")
+#define MAX_INPUT_SIZE 0x40000
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 368 // 360p padded by the decoder
+#define TEXTURE_WIDTH 1024
+#define TEXTURE_HEIGHT 512
+#define TITLE_WIDTH 200 // the width of the titles of the video lists
+#define TITLE_MAX_LINES 2
+// the transforms take a few microseconds, so one sample is this many calls
+#define TRANSFORM_CALLS_PER_RUN 100
+#define LOG_STR "kernel-bench"
+
+namespace {
+	LightMutex resource_lock;
+	volatile bool running = false;
+	KernelBenchmarkResult results[(int) BenchmarkKernel::NUM];
+	int report_cnt = 0;
+}
+
+static const char *names[(int) BenchmarkKernel::NUM] = {
+#define KERNEL_BENCHMARK_NAME(id, name) name,
+	KERNEL_BENCHMARK_LIST(KERNEL_BENCHMARK_NAME)
+#undef KERNEL_BENCHMARK_NAME
+};
+
+void kernel_benchmark_request() {
+	if (running) return;
+	running = true;
+	{
+		LightMutexGuard guard(resource_lock);
+		for (auto &result : results) result = KernelBenchmarkResult();
+	}
+	misc_tasks_request(TASK_KERNEL_BENCHMARK);
+}
+bool kernel_benchmark_is_running() { return running; }
+const char *kernel_benchmark_get_name(BenchmarkKernel kernel) { return names[(int) kernel]; }
+KernelBenchmarkResult kernel_benchmark_get_result(BenchmarkKernel kernel) {
+	LightMutexGuard guard(resource_lock);
+	return results[(int) kernel];
+}
+static std::string format_us(u64 ticks) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f", ticks / CPU_TICKS_PER_USEC);
+	return buf;
+}
+std::string kernel_benchmark_format_result(BenchmarkKernel kernel) {
+	KernelBenchmarkResult result = kernel_benchmark_get_result(kernel);
+	if (result.state == KernelBenchmarkResult::State::SKIPPED) return "n/a";
+	if (result.state == KernelBenchmarkResult::State::NOT_RUN) return running ? "..." : "-";
+	return format_us(result.min_ticks) + " / " + format_us(result.median_ticks) + " / " + format_us(result.max_ticks) + " us";
+}
+
+static void set_result(BenchmarkKernel kernel, const KernelBenchmarkResult &result) {
+	LightMutexGuard guard(resource_lock);
+	results[(int) kernel] = result;
+}
+static void skip(BenchmarkKernel kernel, const std::string &reason) {
+	Util_log_save(LOG_STR, std::string(names[(int) kernel]) + " skipped : " + reason);
+	KernelBenchmarkResult result;
+	result.state = KernelBenchmarkResult::State::SKIPPED;
+	set_result(kernel, result);
+}
+// `run` performs `calls_per_run` calls of the kernel, and returns false if it failed
+static void measure(BenchmarkKernel kernel, int calls_per_run, const std::function<bool ()> &run) {
+	if (!run()) { // warm-up, also fills the caches the kernel relies on
+		skip(kernel, "failed");
+		return;
+	}
+	std::vector<u64> ticks;
+	for (int i = 0; i < KERNEL_BENCHMARK_RUNS; i++) {
+		u64 start = svcGetSystemTick();
+		bool ok = run();
+		u64 end = svcGetSystemTick();
+		if (!ok) {
+			skip(kernel, "failed");
+			return;
+		}
+		ticks.push_back((end - start) / calls_per_run);
+	}
+	std::sort(ticks.begin(), ticks.end());
+	KernelBenchmarkResult result;
+	result.state = KernelBenchmarkResult::State::DONE;
+	result.min_ticks = ticks.front();
+	result.median_ticks = ticks[ticks.size() / 2];
+	result.max_ticks = ticks.back();
+	set_result(kernel, result);
+}
+
+static bool load_input(const std::string &file_name, std::string &data) {
+	data.resize(MAX_INPUT_SIZE);
+	u32 read_size = 0;
+	Result_with_string result = Util_file_load_from_rom(file_name, INPUT_DIR, (u8 *) &data[0], data.size(), &read_size);
+	if (result.code != 0) {
+		Util_log_save(LOG_STR, "Util_file_load_from_rom(" + file_name + ")..." + result.string + result.error_description, result.code);
+		data = "";
+		return false;
+	}
+	data.resize(read_size);
+	return true;
+}
+
+static void run_converter_kernels() {
+	u8 *yuv420p = (u8 *) memalign(4, FRAME_WIDTH * FRAME_HEIGHT * 3 / 2);
+	u8 *texture = (u8 *) linearAlloc_concurrent(TEXTURE_WIDTH * TEXTURE_HEIGHT * 2);
+	if (!yuv420p || !texture) {
+		for (auto kernel : {BenchmarkKernel::Y2R_BGR565, BenchmarkKernel::Y2R_TEXTURE, BenchmarkKernel::C_BGR565, BenchmarkKernel::ASM_BGR565,
+			BenchmarkKernel::ASM_BGR888, BenchmarkKernel::ARMV6_TEXTURE, BenchmarkKernel::SET_TEXTURE_DATA}) skip(kernel, "out of memory");
+		free(yuv420p);
+		linearFree_concurrent(texture);
+		return;
+	}
+	u32 seed = 1;
+	for (int i = 0; i < FRAME_WIDTH * FRAME_HEIGHT * 3 / 2; i++) {
+		seed = seed * 1103515245 + 12345;
+		yuv420p[i] = seed >> 24;
+	}
+
+	// the convert thread of the video player keeps y2r initialized while it's running, the conversions are serialized with it
+	bool temporary_y2r = !Util_converter_y2r_is_initialized();
+	if (temporary_y2r && Util_converter_y2r_init().code != 0) {
+		skip(BenchmarkKernel::Y2R_BGR565, "Util_converter_y2r_init() failed");
+		skip(BenchmarkKernel::Y2R_TEXTURE, "Util_converter_y2r_init() failed");
+	} else {
+		measure(BenchmarkKernel::Y2R_BGR565, 1, [&] () {
+			u8 *bgr565 = NULL;
+			bool ok = Util_converter_y2r_yuv420p_to_bgr565(yuv420p, &bgr565, FRAME_WIDTH, FRAME_HEIGHT, false).code == 0;
+			free(bgr565);
+			return ok;
+		});
+		measure(BenchmarkKernel::Y2R_TEXTURE, 1, [&] () {
+			return Util_converter_y2r_yuv420p_to_texture(yuv420p, texture, FRAME_WIDTH, FRAME_HEIGHT, TEXTURE_WIDTH).code == 0;
+		});
+		if (temporary_y2r) Util_converter_y2r_exit();
+	}
+
+	auto measure_converter = [&] (BenchmarkKernel kernel, Result_with_string (*converter)(u8 *, u8 **, int, int)) {
+		measure(kernel, 1, [&] () {
+			u8 *out = NULL;
+			bool ok = converter(yuv420p, &out, FRAME_WIDTH, FRAME_HEIGHT).code == 0;
+			free(out);
+			return ok;
+		});
+	};
+	measure_converter(BenchmarkKernel::C_BGR565, Util_converter_yuv420p_to_bgr565);
+	measure_converter(BenchmarkKernel::ASM_BGR565, Util_converter_yuv420p_to_bgr565_asm);
+	measure_converter(BenchmarkKernel::ASM_BGR888, Util_converter_yuv420p_to_bgr888_asm);
+	measure(BenchmarkKernel::ARMV6_TEXTURE, 1, [&] () {
+		return Util_converter_yuv420p_to_texture_armv6(yuv420p, texture, FRAME_WIDTH, FRAME_HEIGHT, TEXTURE_WIDTH).code == 0;
+	});
+
+	u8 *bgr565 = NULL;
+	Image_data image;
+	if (Util_converter_yuv420p_to_bgr565(yuv420p, &bgr565, FRAME_WIDTH, FRAME_HEIGHT).code != 0) skip(BenchmarkKernel::SET_TEXTURE_DATA, "no input");
+	else if (Draw_c2d_image_init(&image, TEXTURE_WIDTH, TEXTURE_HEIGHT, GPU_RGB565).code != 0) skip(BenchmarkKernel::SET_TEXTURE_DATA, "out of memory");
+	else {
+		measure(BenchmarkKernel::SET_TEXTURE_DATA, 1, [&] () {
+			return Draw_set_texture_data(&image, bgr565, FRAME_WIDTH, FRAME_HEIGHT, TEXTURE_WIDTH, TEXTURE_HEIGHT, GPU_RGB565).code == 0;
+		});
+		Draw_c2d_image_free(image);
+	}
+	free(bgr565);
+	free(yuv420p);
+	linearFree_concurrent(texture);
+}
+
+static void run_text_kernels() {
+	std::string data;
+	std::vector<std::string> titles;
+	if (load_input("titles.txt", data)) {
+		size_t head = 0;
+		while (head < data.size()) {
+			size_t end = data.find('\n', head);
+			if (end == std::string::npos) end = data.size();
+			if (end > head) titles.push_back(data.substr(head, end - head));
+			head = end + 1;
+		}
+	}
+	if (!titles.size()) {
+		skip(BenchmarkKernel::TRUNCATE_STR, "no input");
+		skip(BenchmarkKernel::DRAW_GET_WIDTH, "no input");
+		return;
+	}
+	measure(BenchmarkKernel::TRUNCATE_STR, titles.size(), [&] () {
+		size_t line_num = 0;
+		for (auto &title : titles) line_num += truncate_str(title, TITLE_WIDTH, TITLE_MAX_LINES, 0.5, 0.5).size();
+		return line_num > 0;
+	});
+	measure(BenchmarkKernel::DRAW_GET_WIDTH, titles.size(), [&] () {
+		float width_sum = 0;
+		for (auto &title : titles) width_sum += Draw_get_width(title, 0.5, 0.5);
+		return width_sum > 0;
+	});
+}
+
+static void run_parser_kernels() {
+	std::string data;
+	if (!load_input("thumbnail.jpg", data)) skip(BenchmarkKernel::IMAGE_DECODE, "no input");
+	else {
+		measure(BenchmarkKernel::IMAGE_DECODE, 1, [&] () {
+			int width, height;
+			u8 *decoded = Image_decode((u8 *) &data[0], data.size(), &width, &height);
+			free(decoded);
+			return decoded != NULL;
+		});
+	}
+
+	if (!load_input("watch_page.json", data)) skip(BenchmarkKernel::JSON_PARSE, "no input");
+	else {
+		measure(BenchmarkKernel::JSON_PARSE, 1, [&] () {
+			// the same way the parser does it
+			json11::JsonArena json_arena;
+			std::string error;
+			json11::Json json = json11::Json::parse(data, error);
+			return error == "";
+		});
+	}
+
+	YouTubeTransformPlans *plans = load_input("plans.bin", data) ? youtube_load_transform_plans(data) : NULL;
+	if (!plans) {
+		skip(BenchmarkKernel::DEOBFUSCATE_SIGNATURE, "no input");
+		skip(BenchmarkKernel::MODIFY_NPARAM, "no input");
+		return;
+	}
+	// shaped like the real ones
+	const std::string signature = "AOq0QJ8wRQIhAKJ4gpY5nFZ0mT2Q1xQwXh3vNc6S8rD_bLkE7uGfPzYAiA2t9Wq1UeRjK5oVd3sHnC8mBlXy4ZiG0aFhT7pNkQwEw==";
+	const std::string n_param = "Ab3dEfGh1jKlMn0pQ";
+	measure(BenchmarkKernel::DEOBFUSCATE_SIGNATURE, TRANSFORM_CALLS_PER_RUN, [&] () {
+		bool ok = true;
+		for (int i = 0; i < TRANSFORM_CALLS_PER_RUN; i++) ok &= youtube_deobfuscate_signature(plans, signature) != "";
+		return ok;
+	});
+	measure(BenchmarkKernel::MODIFY_NPARAM, TRANSFORM_CALLS_PER_RUN, [&] () {
+		bool ok = true;
+		for (int i = 0; i < TRANSFORM_CALLS_PER_RUN; i++) ok &= youtube_modify_nparam(plans, n_param) != "";
+		return ok;
+	});
+	youtube_free_transform_plans(plans);
+}
+
+static void save_report() {
+	bool new_3ds = false;
+	APT_CheckNew3DS(&new_3ds);
+	std::string data;
+	data += "# ThirdTube " + DEF_CURRENT_APP_VER + ", " + var_model + (new_3ds ? " (New 3DS)" : " (Old 3DS)") + ", " +
+		std::to_string(KERNEL_BENCHMARK_RUNS) + " runs, system ticks per call\n";
+	data += "kernel,min_ticks,median_ticks,max_ticks\n";
+	for (int i = 0; i < (int) BenchmarkKernel::NUM; i++) {
+		KernelBenchmarkResult result = kernel_benchmark_get_result((BenchmarkKernel) i);
+		data += names[i];
+		if (result.state == KernelBenchmarkResult::State::DONE)
+			data += "," + std::to_string(result.min_ticks) + "," + std::to_string(result.median_ticks) + "," + std::to_string(result.max_ticks) + "\n";
+		else data += ",,,\n";
+	}
+	std::string file_name = "kernels_" + std::to_string(var_num_of_app_start) + "_" + std::to_string(report_cnt++) + ".csv";
+	Result_with_string result = Util_file_save_to_file(file_name, REPORT_DIR, (u8 *) data.c_str(), data.size(), true);
+	Util_log_save(LOG_STR, "report " + file_name + " : Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+}
+
+void kernel_benchmark_run() {
+	Util_log_save(LOG_STR, "start");
+	run_converter_kernels();
+	run_text_kernels();
+	run_parser_kernels();
+	for (int i = 0; i < (int) BenchmarkKernel::NUM; i++)
+		Util_log_save(LOG_STR, std::string(names[i]) + " : " + kernel_benchmark_format_result((BenchmarkKernel) i));
+	save_report();
+	running = false;
+}
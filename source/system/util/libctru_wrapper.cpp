@@ -1,27 +1,136 @@
 #include "headers.hpp"
+#include "system/util/memory_pressure.hpp"
 
-static bool lock_initialized = false;
-static Handle resource_lock;
+static LightMutex resource_lock;
 
 static void lock() {
-	if (!lock_initialized) {
-		svcCreateMutex(&resource_lock, false);
-		lock_initialized = true;
-	}
-	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+	resource_lock.lock();
 }
 static void release() {
-	svcReleaseMutex(resource_lock);
+	resource_lock.unlock();
+}
+
+// the small blocks (the C3D_Tex and Tex3DS_SubTexture of every image...) come from slabs of POOL_SLOTS same-sized slots instead of linearAlloc() :
+// thousands of them scattered between the textures fragment the linear heap, and linearAlloc() searches its free list under the lock
+// the free slots of a slab are a bitmap taken and returned with atomic operations only, the lock is taken just to add a slab
+// slabs are kept until the app exits
+#define POOL_MIN_BLOCK 0x80 // the alignment of linearAlloc(), kept by the slots
+#define POOL_CLASS_NUM 3 // 0x80, 0x100 and 0x200 bytes
+#define POOL_SLOTS 32
+#define POOL_MAX_SLABS 8 // per class, larger numbers of blocks fall back to linearAlloc()
+
+namespace {
+	struct PoolSlab {
+		u8 *base;
+		u32 free_slots; // bit i : slot i is free
+	};
+	struct PoolClass {
+		PoolSlab slabs[POOL_MAX_SLABS];
+		int slab_num; // slabs[0, slab_num) are ready
+	};
+	PoolClass pool_classes[POOL_CLASS_NUM];
+}
+
+static size_t pool_block_size(int class_index) { return (size_t) POOL_MIN_BLOCK << class_index; }
+
+// takes a free block from the slabs of `pool_class`, NULL if they're all full
+static void *pool_take_free_block(PoolClass &pool_class, size_t block_size) {
+	int slab_num = __atomic_load_n(&pool_class.slab_num, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < slab_num; i++) {
+		PoolSlab &slab = pool_class.slabs[i];
+		u32 free_slots = __atomic_load_n(&slab.free_slots, __ATOMIC_RELAXED);
+		while (free_slots) {
+			int slot = __builtin_ctz(free_slots);
+			if (__atomic_compare_exchange_n(&slab.free_slots, &free_slots, free_slots & ~(1U << slot), true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return slab.base + slot * block_size;
+		}
+	}
+	return NULL;
+}
+// NULL if `size` is too large for the pool or it's used up
+static void *pool_alloc(size_t size, size_t *block_size_out) {
+	int class_index = 0;
+	while (class_index < POOL_CLASS_NUM && pool_block_size(class_index) < size) class_index++;
+	if (class_index == POOL_CLASS_NUM) return NULL;
+	PoolClass &pool_class = pool_classes[class_index];
+	size_t block_size = pool_block_size(class_index);
+	*block_size_out = block_size;
+	
+	void *res = pool_take_free_block(pool_class, block_size);
+	if (res) return res;
+	
+	// every slab is full
+	lock();
+	// another thread may have added a slab or freed a block while this one was waiting for the lock
+	res = pool_take_free_block(pool_class, block_size);
+	int slab_num = pool_class.slab_num;
+	if (!res && slab_num < POOL_MAX_SLABS) {
+		PoolSlab &slab = pool_class.slabs[slab_num];
+		slab.base = (u8 *) linearAlloc(block_size * POOL_SLOTS);
+		if (slab.base) {
+			slab.free_slots = ~1U; // slot 0 is returned
+			__atomic_store_n(&pool_class.slab_num, slab_num + 1, __ATOMIC_RELEASE);
+			res = slab.base;
+		}
+	}
+	release();
+	return res;
+}
+// 0 if `ptr` is not a block of the pool
+static size_t pool_free(void *ptr) {
+	for (int class_index = 0; class_index < POOL_CLASS_NUM; class_index++) {
+		PoolClass &pool_class = pool_classes[class_index];
+		size_t block_size = pool_block_size(class_index);
+		int slab_num = __atomic_load_n(&pool_class.slab_num, __ATOMIC_ACQUIRE);
+		for (int i = 0; i < slab_num; i++) {
+			PoolSlab &slab = pool_class.slabs[i];
+			if ((u8 *) ptr >= slab.base && (u8 *) ptr < slab.base + block_size * POOL_SLOTS) {
+				int slot = ((u8 *) ptr - slab.base) / block_size;
+				__atomic_fetch_or(&slab.free_slots, 1U << slot, __ATOMIC_RELEASE);
+				return block_size;
+			}
+		}
+	}
+	return 0;
 }
 
 void *linearAlloc_concurrent(size_t size) {
+	size_t allocated;
+	void *res = pool_alloc(size, &allocated);
+	if (res) return res;
 	lock();
-	void *res = linearAlloc(size);
+	res = linearAlloc(size);
 	release();
+	if (!res) memory_pressure_report(MemoryPressure::CRITICAL);
 	return res;
 }
 void linearFree_concurrent(void *ptr) {
+	if (!ptr || pool_free(ptr)) return;
 	lock();
 	linearFree(ptr);
 	release();
 }
+void *linearAlloc_concurrent(size_t size, MemoryTag tag) {
+	size_t allocated;
+	void *res = pool_alloc(size, &allocated);
+	if (!res) {
+		lock();
+		res = linearAlloc(size);
+		allocated = res ? linearGetSize(res) : 0;
+		release();
+		if (!res) memory_pressure_report(MemoryPressure::CRITICAL);
+	}
+	if (allocated) memory_stats_add_linear(tag, allocated);
+	return res;
+}
+void linearFree_concurrent(void *ptr, MemoryTag tag) {
+	if (!ptr) return;
+	size_t allocated = pool_free(ptr);
+	if (!allocated) {
+		lock();
+		allocated = linearGetSize(ptr);
+		linearFree(ptr);
+		release();
+	}
+	memory_stats_add_linear(tag, -(s64) allocated);
+}
@@ -1,16 +1,39 @@
 ﻿#include "headers.hpp"
 
+#include <atomic>
+
 #define LOG_BUFFER_LINES 512
 #define LOG_DISPLAYED_LINES 23
+#define LOG_TYPE_MAX_LEN 31
+#define LOG_TEXT_MAX_LEN 130
+#define LOG_NO_RESULT 1234567890
+
+// Util_log_save() only copies its arguments into a fixed record, the text is formatted when the line is actually drawn
+// a writer claims a slot with a single atomic increment, and seq tells readers whether the slot holds a complete record
+struct LogRecord
+{
+	std::atomic<u32> seq; // (line number + 1) once written, 0 while being written
+	u64 tick;
+	int result;
+	u8 type_len;
+	u8 text_len;
+	char type[LOG_TYPE_MAX_LEN];
+	char text[LOG_TEXT_MAX_LEN];
+};
 
 bool log_show_logs = false;
-int log_current_log_num = 0;
 int log_y = 0;
 double log_x = 0.0;
-double log_up_time_ms = 0.0;
-double log_spend_time[LOG_BUFFER_LINES];
-std::string log_logs[LOG_BUFFER_LINES];
-TickCounter log_up_time_stopwatch;
+static u64 log_start_tick = 0;
+static std::atomic<u32> log_written_num{0};
+static LogRecord log_records[LOG_BUFFER_LINES];
+// only touched by the thread calling Util_log_draw()
+static std::string log_formatted[LOG_BUFFER_LINES];
+static u32 log_formatted_seq[LOG_BUFFER_LINES];
+static size_t log_formatted_addition_len[LOG_BUFFER_LINES];
+// Util_log_add() is rare, so it's simply kept under the lock
+static std::string log_additions[LOG_BUFFER_LINES];
+static u32 log_additions_seq[LOG_BUFFER_LINES];
 
 static Handle log_lock;
 
@@ -21,14 +44,21 @@ static void unlock() {
 	svcReleaseMutex(log_lock);
 }
 
+static double tick_to_ms(u64 tick)
+{
+	return (tick - log_start_tick) / CPU_TICKS_PER_MSEC;
+}
+
 void Util_log_init(void)
 {
-	osTickCounterStart(&log_up_time_stopwatch);
-	log_up_time_ms = 0;
+	log_start_tick = svcGetSystemTick();
 	for(int i = 0; i < LOG_BUFFER_LINES; i++)
 	{
-		log_spend_time[i] = 0;
-		log_logs[i] = "";
+		log_records[i].seq = 0;
+		log_formatted[i] = "";
+		log_formatted_seq[i] = 0;
+		log_formatted_addition_len[i] = 0;
+		log_additions_seq[i] = 0;
 	}
 	svcCreateMutex(&log_lock, false);
 }
@@ -44,72 +74,101 @@ void Util_log_set_log_show_flag(bool flag)
 	var_need_reflesh = true;
 }
 
-int Util_log_save(std::string type, std::string text)
+int Util_log_save(const std::string &type, const std::string &text)
 {
-	return Util_log_save(type, text, 1234567890);
+	return Util_log_save(type, text, LOG_NO_RESULT);
 }
 
-int Util_log_save(std::string type, std::string text, int result)
+int Util_log_save(const std::string &type, const std::string &text, int result)
 {
-	lock();
+	u32 num = log_written_num.fetch_add(1, std::memory_order_relaxed);
+	int slot = num % LOG_BUFFER_LINES;
+	LogRecord &record = log_records[slot];
 	
-	const int LOG_MAX_LEN = 130;
-	int return_log_num = 0;
-	char app_log_cache[LOG_MAX_LEN + 1];
-	memset(app_log_cache, 0x0, LOG_MAX_LEN + 1);
-
-	osTickCounterUpdate(&log_up_time_stopwatch);
-	log_up_time_ms += osTickCounterRead(&log_up_time_stopwatch);
-	log_spend_time[log_current_log_num] = log_up_time_ms;
-
-	if (result == 1234567890)
-		snprintf(app_log_cache, LOG_MAX_LEN + 1, "[%.5f][%s] %s", log_up_time_ms / 1000, type.c_str(), text.c_str());
-	else
-		snprintf(app_log_cache, LOG_MAX_LEN + 1, "[%.5f][%s] %s 0x%x", log_up_time_ms / 1000, type.c_str(), text.c_str(), result);
-
-	log_logs[log_current_log_num] = app_log_cache;
-	log_current_log_num++;
-	return_log_num = log_current_log_num;
-	if (log_current_log_num >= LOG_BUFFER_LINES)
-		log_current_log_num = 0;
-
-	if (log_current_log_num < LOG_DISPLAYED_LINES)
+	record.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	record.tick = svcGetSystemTick();
+	record.result = result;
+	record.type_len = std::min<size_t>(type.size(), LOG_TYPE_MAX_LEN);
+	memcpy(record.type, type.c_str(), record.type_len);
+	record.text_len = std::min<size_t>(text.size(), LOG_TEXT_MAX_LEN);
+	memcpy(record.text, text.c_str(), record.text_len);
+	record.seq.store(num + 1, std::memory_order_release);
+
+	if (slot + 1 < LOG_DISPLAYED_LINES)
 		log_y = 0;
 	else
-		log_y = log_current_log_num - LOG_DISPLAYED_LINES;
+		log_y = slot + 1 - LOG_DISPLAYED_LINES;
 	
 	if(log_show_logs)
 		var_need_reflesh = true;
 	
-	unlock();
-	return (return_log_num - 1);
+	return slot;
 }
 
-void Util_log_add(int add_log_num, std::string add_text)
+void Util_log_add(int add_log_num, const std::string &add_text)
 {
-	Util_log_add(add_log_num, add_text, 1234567890);
+	Util_log_add(add_log_num, add_text, LOG_NO_RESULT);
 }
 
-void Util_log_add(int add_log_num, std::string add_text, int result)
+void Util_log_add(int add_log_num, const std::string &add_text, int result)
 {
-	lock();
-	
 	char app_log_add_cache[2048];
 	memset(app_log_add_cache, 0x0, 2048);
 
-	osTickCounterUpdate(&log_up_time_stopwatch);
-	log_up_time_ms += osTickCounterRead(&log_up_time_stopwatch);
+	LogRecord &record = log_records[add_log_num];
+	u32 seq = record.seq.load(std::memory_order_acquire);
+	if (!seq)
+		return;
+	double spend_time = tick_to_ms(svcGetSystemTick()) - tick_to_ms(record.tick);
 
-	if (result != 1234567890)
-		snprintf(app_log_add_cache, 2048, "%s0x%x (%.2fms)", add_text.c_str(), result, (log_up_time_ms - log_spend_time[add_log_num]));
+	if (result != LOG_NO_RESULT)
+		snprintf(app_log_add_cache, 2048, "%s0x%x (%.2fms)", add_text.c_str(), result, spend_time);
 	else
-		snprintf(app_log_add_cache, 2048, "%s (%.2fms)", add_text.c_str(), (log_up_time_ms - log_spend_time[add_log_num]));
+		snprintf(app_log_add_cache, 2048, "%s (%.2fms)", add_text.c_str(), spend_time);
 
-	log_logs[add_log_num] += app_log_add_cache;
+	lock();
+	if (log_additions_seq[add_log_num] != seq)
+		log_additions[add_log_num] = "";
+	log_additions[add_log_num] += app_log_add_cache;
+	log_additions_seq[add_log_num] = seq;
+	unlock();
+	
 	if(log_show_logs)
 		var_need_reflesh = true;
-	
+}
+
+static const std::string &get_formatted_line(int slot)
+{
+	LogRecord &record = log_records[slot];
+	u32 seq = record.seq.load(std::memory_order_acquire);
+	if (!seq)
+		return log_formatted[slot];
+	lock();
+	std::string addition = log_additions_seq[slot] == seq ? log_additions[slot] : "";
 	unlock();
+	if (log_formatted_seq[slot] == seq && log_formatted_addition_len[slot] == addition.size())
+		return log_formatted[slot];
+	
+	// copy the record first so that a writer reusing the slot meanwhile can be detected
+	u64 tick = record.tick;
+	int result = record.result;
+	std::string type(record.type, std::min<int>(record.type_len, LOG_TYPE_MAX_LEN));
+	std::string text(record.text, std::min<int>(record.text_len, LOG_TEXT_MAX_LEN));
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (record.seq.load(std::memory_order_relaxed) != seq)
+		return log_formatted[slot]; // being overwritten, try again next frame
+	
+	const int LOG_MAX_LEN = LOG_TYPE_MAX_LEN + LOG_TEXT_MAX_LEN + 32;
+	char app_log_cache[LOG_MAX_LEN + 1];
+	if (result == LOG_NO_RESULT)
+		snprintf(app_log_cache, LOG_MAX_LEN + 1, "[%.5f][%s] %s", tick_to_ms(tick) / 1000, type.c_str(), text.c_str());
+	else
+		snprintf(app_log_cache, LOG_MAX_LEN + 1, "[%.5f][%s] %s 0x%x", tick_to_ms(tick) / 1000, type.c_str(), text.c_str(), result);
+	log_formatted[slot] = app_log_cache + addition;
+	log_formatted_seq[slot] = seq;
+	log_formatted_addition_len[slot] = addition.size();
+	return log_formatted[slot];
 }
 
 void Util_log_main(Hid_info key)
@@ -152,8 +211,6 @@ void Util_log_main(Hid_info key)
 
 void Util_log_draw(void)
 {
-	lock();
 	for (int i = 0; i < LOG_DISPLAYED_LINES; i++)
-		Draw(log_logs[log_y + i], log_x, 10.0 + (i * 10), 0.4, 0.4, DEF_LOG_COLOR);
-	unlock();
+		Draw(get_formatted_line(log_y + i), log_x, 10.0 + (i * 10), 0.4, 0.4, DEF_LOG_COLOR);
 }
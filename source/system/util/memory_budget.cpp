@@ -0,0 +1,80 @@
+#include "headers.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/memory_stats.hpp"
+
+#define BUDGET_OLD_3DS ((u64) 28 * 1000 * 1000)
+#define BUDGET_NEW_3DS ((u64) 40 * 1000 * 1000)
+
+namespace {
+	u64 usage[(int) MemoryBudgetUser::NUM] = {0};
+	u64 total_usage = 0;
+	u64 limit = 0;
+	MemoryPressure pressure = MemoryPressure::NONE;
+	const MemoryTag user_tags[(int) MemoryBudgetUser::NUM] = {
+		MemoryTag::STREAM_BLOCKS, MemoryTag::STREAM_BLOCKS, MemoryTag::THUMBNAILS, MemoryTag::PAGE_RESULTS
+	};
+
+	LightMutex resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		bool new_3ds = false;
+		APT_CheckNew3DS(&new_3ds);
+		limit = new_3ds ? BUDGET_NEW_3DS : BUDGET_OLD_3DS;
+	}
+	resource_lock.lock();
+}
+static void release() {
+	resource_lock.unlock();
+}
+// resource_lock must be held
+static u64 get_limit() {
+	if (pressure == MemoryPressure::CRITICAL) return 0;
+	if (pressure == MemoryPressure::MODERATE) return limit / 2;
+	return limit;
+}
+
+void memory_budget_add(MemoryBudgetUser user, s64 bytes) {
+	lock();
+	u64 &cur_usage = usage[(int) user];
+	if (bytes < 0 && (u64) -bytes > cur_usage) {
+		Util_log_save("mem-budget", "released more than used : " + std::to_string((int) user));
+		bytes = -(s64) cur_usage;
+	}
+	cur_usage += bytes;
+	total_usage += bytes;
+	release();
+	memory_stats_add_heap(user_tags[(int) user], bytes);
+}
+u64 memory_budget_get_usage(MemoryBudgetUser user) {
+	lock();
+	u64 res = usage[(int) user];
+	release();
+	return res;
+}
+u64 memory_budget_get_total_usage() {
+	lock();
+	u64 res = total_usage;
+	release();
+	return res;
+}
+u64 memory_budget_get_limit() {
+	lock();
+	u64 res = get_limit();
+	release();
+	return res;
+}
+bool memory_budget_is_over(u64 extra) {
+	lock();
+	bool res = total_usage + extra > get_limit();
+	release();
+	return res;
+}
+void memory_budget_shed(MemoryPressure level) {
+	lock();
+	pressure = level;
+	release();
+}
@@ -0,0 +1,104 @@
+#include "headers.hpp"
+#include "system/util/memory_pressure.hpp"
+#include "system/util/async_task.hpp"
+#include <malloc.h>
+
+#define MAX_HANDLERS 16
+#define HEAP_MODERATE_FREE (4 * 1000 * 1000)
+#define HEAP_CRITICAL_FREE (1500 * 1000)
+#define LINEAR_MODERATE_FREE (3 * 1000 * 1000)
+#define LINEAR_CRITICAL_FREE (1000 * 1000)
+#define RESHED_INTERVAL_MS 2000 // while the level stays high, the handlers are run again at most this often
+#define LOG_STR "mem-pressure"
+
+namespace {
+	struct Handler {
+		MemoryShedHandler func;
+		MemoryShedPriority priority;
+	};
+	Handler handlers[MAX_HANDLERS];
+	int handler_num = 0;
+	
+	MemoryPressure level = MemoryPressure::NONE; // the last level the handlers were run for
+	MemoryPressure reported_level = MemoryPressure::NONE; // raised by memory_pressure_report() until the next shed
+	u64 last_shed_time = 0;
+	
+	LightMutex resource_lock;
+}
+
+static void lock() {
+	resource_lock.lock();
+}
+static void release() {
+	resource_lock.unlock();
+}
+
+void memory_pressure_add_handler(MemoryShedHandler handler, MemoryShedPriority priority) {
+	lock();
+	if (handler_num < MAX_HANDLERS) {
+		// kept sorted by the priority, the ones with the same priority in the order they are added
+		int pos = handler_num++;
+		while (pos > 0 && (int) handlers[pos - 1].priority > (int) priority) {
+			handlers[pos] = handlers[pos - 1];
+			pos--;
+		}
+		handlers[pos] = {handler, priority};
+	} else Util_log_save(LOG_STR, "too many handlers");
+	release();
+}
+
+static MemoryPressure read_level() {
+	u32 heap_used = mallinfo().uordblks;
+	u32 heap_free = envGetHeapSize() > heap_used ? envGetHeapSize() - heap_used : 0;
+	u32 linear_free = linearSpaceFree();
+	if (heap_free < HEAP_CRITICAL_FREE || linear_free < LINEAR_CRITICAL_FREE) return MemoryPressure::CRITICAL;
+	if (heap_free < HEAP_MODERATE_FREE || linear_free < LINEAR_MODERATE_FREE) return MemoryPressure::MODERATE;
+	return MemoryPressure::NONE;
+}
+
+static void shed_task(void *) {
+	lock();
+	MemoryPressure cur_level = std::max(read_level(), reported_level);
+	reported_level = MemoryPressure::NONE;
+	bool changed = cur_level != level;
+	if (changed) Util_log_save(LOG_STR, "level " + std::to_string((int) level) + " -> " + std::to_string((int) cur_level));
+	level = cur_level;
+	last_shed_time = osGetTime();
+	Handler cur_handlers[MAX_HANDLERS];
+	int cur_handler_num = handler_num;
+	std::copy(handlers, handlers + handler_num, cur_handlers);
+	release();
+	
+	if (cur_level == MemoryPressure::NONE) {
+		if (changed) for (int i = 0; i < cur_handler_num; i++) cur_handlers[i].func(MemoryPressure::NONE);
+		return;
+	}
+	for (int i = 0; i < cur_handler_num; i++) {
+		cur_handlers[i].func(cur_level);
+		if (cur_level == MemoryPressure::MODERATE && read_level() == MemoryPressure::NONE) break;
+	}
+}
+static void request_shed() {
+	if (!is_async_task_running(shed_task)) queue_async_task(shed_task, NULL, AsyncTaskPriority::INTERACTIVE);
+}
+
+void memory_pressure_report(MemoryPressure level) {
+	lock();
+	bool raised = (int) level > (int) reported_level;
+	if (raised) reported_level = level;
+	release();
+	if (raised) request_shed();
+}
+void memory_pressure_check() {
+	MemoryPressure cur_level = read_level();
+	lock();
+	bool need_shed = cur_level != level || (cur_level != MemoryPressure::NONE && osGetTime() - last_shed_time >= RESHED_INTERVAL_MS);
+	release();
+	if (need_shed) request_shed();
+}
+MemoryPressure memory_pressure_get_level() {
+	lock();
+	MemoryPressure res = level;
+	release();
+	return res;
+}
@@ -0,0 +1,65 @@
+#include "headers.hpp"
+#include "system/util/memory_stats.hpp"
+
+namespace {
+	MemoryTagUsage usage[(int) MemoryTag::NUM];
+
+	LightMutex resource_lock;
+
+	const char *tag_names[(int) MemoryTag::NUM] = {
+		"thumbnails", "video_tex", "stream", "decoder", "pages", "text", "other"
+	};
+}
+
+static void lock() {
+	resource_lock.lock();
+}
+static void release() {
+	resource_lock.unlock();
+}
+
+static void add(MemoryTag tag, u64 &cur, u64 &peak, s64 bytes) {
+	if (bytes < 0 && (u64) -bytes > cur) {
+		Util_log_save("mem-stats", "released more than used : " + std::string(tag_names[(int) tag]));
+		bytes = -(s64) cur;
+	}
+	cur += bytes;
+	peak = std::max(peak, cur);
+}
+
+void memory_stats_add_heap(MemoryTag tag, s64 bytes) {
+	lock();
+	add(tag, usage[(int) tag].heap, usage[(int) tag].heap_peak, bytes);
+	release();
+}
+void memory_stats_add_linear(MemoryTag tag, s64 bytes) {
+	lock();
+	add(tag, usage[(int) tag].linear, usage[(int) tag].linear_peak, bytes);
+	release();
+}
+MemoryTagUsage memory_stats_get(MemoryTag tag) {
+	lock();
+	MemoryTagUsage res = usage[(int) tag];
+	release();
+	return res;
+}
+u64 memory_stats_get_untagged_heap() {
+	u64 used = mallinfo().uordblks;
+	lock();
+	u64 tagged = 0;
+	for (int i = 0; i < (int) MemoryTag::NUM; i++) tagged += usage[i].heap;
+	release();
+	// the page cache estimate can be a bit above what it really holds
+	return used > tagged ? used - tagged : 0;
+}
+void memory_stats_reset_peaks() {
+	lock();
+	for (int i = 0; i < (int) MemoryTag::NUM; i++) {
+		usage[i].heap_peak = usage[i].heap;
+		usage[i].linear_peak = usage[i].linear;
+	}
+	release();
+}
+const char *memory_stats_get_tag_name(MemoryTag tag) {
+	return tag_names[(int) tag];
+}
@@ -0,0 +1,33 @@
+#include "headers.hpp"
+#include "system/util/metrics.hpp"
+
+#define LOG_STR "metrics"
+
+s64 metrics_values[(int) Metric::NUM];
+
+static const char *names[(int) Metric::NUM] = {
+#define METRICS_NAME(id, is_gauge, name) name,
+	METRICS_LIST(METRICS_NAME)
+#undef METRICS_NAME
+};
+static const bool is_gauges[(int) Metric::NUM] = {
+#define METRICS_IS_GAUGE(id, is_gauge, name) is_gauge,
+	METRICS_LIST(METRICS_IS_GAUGE)
+#undef METRICS_IS_GAUGE
+};
+
+const char *metrics_get_name(Metric metric) { return names[(int) metric]; }
+bool metrics_is_gauge(Metric metric) { return is_gauges[(int) metric]; }
+
+std::string metrics_format_value(Metric metric) {
+	s64 value = metrics_get(metric);
+	char buf[32];
+	if (metric == Metric::STREAM_BYTES || metric == Metric::THUMBNAIL_BYTES || metric == Metric::PAGE_BYTES)
+		snprintf(buf, sizeof(buf), "%.1f MB", value / 1000000.0);
+	else snprintf(buf, sizeof(buf), "%lld", (long long) value);
+	return buf;
+}
+
+void metrics_dump_to_log() {
+	for (int i = 0; i < (int) Metric::NUM; i++) Util_log_save(LOG_STR, std::string(names[i]) + " : " + std::to_string((long long) metrics_get((Metric) i)));
+}
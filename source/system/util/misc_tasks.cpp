@@ -4,36 +4,100 @@
 #include "system/util/subscription_util.hpp"
 #include "system/util/change_setting.hpp"
 #include "system/util/string_resource.hpp"
+#include "system/util/frame_profiler.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/playback_benchmark.hpp"
+#include "system/util/player_session.hpp"
+#include "system/util/kernel_benchmark.hpp"
+#include "network/network_trace.hpp"
 #include "headers.hpp"
 
+#define SAVE_COALESCE_WINDOW_MS 1000 // saves of the same file requested within this window are written once
+
 static bool should_be_running = true;
 static bool request[100];
+static u64 save_deadline[100]; // 0 : no write pending
+static Handle save_lock;
+static bool save_lock_initialized = false;
+
+static void save_lock_acquire() {
+	if (!save_lock_initialized) {
+		save_lock_initialized = true;
+		svcCreateMutex(&save_lock, false);
+	}
+	svcWaitSynchronization(save_lock, std::numeric_limits<s64>::max());
+}
+static void save_lock_release() { svcReleaseMutex(save_lock); }
+
+static bool is_save_task(int type) {
+	return type == TASK_SAVE_SETTINGS || type == TASK_SAVE_HISTORY || type == TASK_SAVE_SUBSCRIPTION || type == TASK_SAVE_SUBSCRIPTION_FEED || type == TASK_SAVE_PLAYER_SESSION;
+}
 
-void misc_tasks_request(int type) { request[type] = true; }
+void misc_tasks_request(int type) {
+	if (is_save_task(type)) {
+		// the first request opens the window, the ones after it are covered by the same write
+		save_lock_acquire();
+		if (!save_deadline[type]) save_deadline[type] = osGetTime() + SAVE_COALESCE_WINDOW_MS;
+		save_lock_release();
+	} else request[type] = true;
+}
+
+// returns the save task whose window has passed (any pending one if `force`), or -1
+static int take_pending_save(bool force) {
+	int res = -1;
+	u64 now = osGetTime();
+	save_lock_acquire();
+	for (int i = 0; i < 100; i++) if (save_deadline[i] && (force || save_deadline[i] <= now)) {
+		save_deadline[i] = 0;
+		res = i;
+		break;
+	}
+	save_lock_release();
+	return res;
+}
+static void run_save_task(int type) {
+	if (type == TASK_SAVE_SETTINGS) save_settings();
+	else if (type == TASK_SAVE_HISTORY) save_watch_history();
+	else if (type == TASK_SAVE_SUBSCRIPTION) save_subscription();
+	else if (type == TASK_SAVE_SUBSCRIPTION_FEED) save_subscription_feed();
+	else if (type == TASK_SAVE_PLAYER_SESSION) save_player_session();
+}
 
 void misc_tasks_thread_func(void *arg) {
 	(void) arg;
 	
 	load_watch_history();
 	load_subscription();
+	load_subscription_feed();
 	while (should_be_running) {
-		if (request[TASK_SAVE_SETTINGS]) {
-			request[TASK_SAVE_SETTINGS] = false;
-			save_settings();
-		} else if (request[TASK_CHANGE_BRIGHTNESS]) {
+		int save_task;
+		if (request[TASK_CHANGE_BRIGHTNESS]) {
 			request[TASK_CHANGE_BRIGHTNESS] = false;
 			Util_cset_set_screen_brightness(true, true, var_lcd_brightness);
 		} else if (request[TASK_RELOAD_STRING_RESOURCE]) {
 			request[TASK_RELOAD_STRING_RESOURCE] = false;
 			load_string_resources(var_lang);
-		} else if (request[TASK_SAVE_HISTORY]) {
-			request[TASK_SAVE_HISTORY] = false;
-			save_watch_history();
-		} else if (request[TASK_SAVE_SUBSCRIPTION]) {
-			request[TASK_SAVE_SUBSCRIPTION] = false;
-			save_subscription();
+		} else if (request[TASK_FLUSH_FRAME_PROFILE]) {
+			request[TASK_FLUSH_FRAME_PROFILE] = false;
+			frame_profiler_flush();
+		} else if (request[TASK_FLUSH_NETWORK_TRACE]) {
+			request[TASK_FLUSH_NETWORK_TRACE] = false;
+			network_trace_flush();
+		} else if (request[TASK_DUMP_TRACE]) {
+			request[TASK_DUMP_TRACE] = false;
+			trace_dump();
+		} else if (request[TASK_SAVE_BENCHMARK_REPORT]) {
+			request[TASK_SAVE_BENCHMARK_REPORT] = false;
+			playback_benchmark_save_report();
+		} else if (request[TASK_KERNEL_BENCHMARK]) {
+			request[TASK_KERNEL_BENCHMARK] = false;
+			kernel_benchmark_run();
+		} else if ((save_task = take_pending_save(false)) != -1) {
+			run_save_task(save_task);
 		} else usleep(50000);
 	}
+	// nothing requested before the exit is lost
+	for (int save_task; (save_task = take_pending_save(true)) != -1; ) run_save_task(save_task);
 	
 	Util_log_save("misc-task", "Thread exit.");
 	threadExit(0);
@@ -8,23 +8,36 @@ extern "C" {
 int util_audio_muxer_stream_num[2] = { -1, -1, };
 AVPacket* util_audio_muxer_packet[2] = { NULL, NULL, };
 AVFormatContext* util_audio_muxer_format_context[2] = { NULL, NULL, };
-AVCodecContext* util_audio_muxer_context[2] = { NULL, NULL, };
-const AVCodec* util_audio_muxer_codec[2] = { NULL, NULL, };
 AVStream* util_audio_muxer_format_stream[2] = { NULL, NULL, };
 
 int util_video_muxer_stream_num[2] = { -1, -1, };
 AVPacket* util_video_muxer_packet[2] = { NULL, NULL, };
 AVFormatContext* util_video_muxer_format_context[2] = { NULL, NULL, };
-AVCodecContext* util_video_muxer_context[2] = { NULL, NULL, };
-const AVCodec* util_video_muxer_codec[2] = { NULL, NULL, };
 AVStream* util_video_muxer_format_stream[2] = { NULL, NULL, };
 
 AVFormatContext* util_muxer_format_context[2] = { NULL, NULL, };
 
+//reads the next packet of the stream #stream_num, returns false at the end of the file
+static bool Util_muxer_read_packet(AVFormatContext* format_context, int stream_num, AVPacket* packet)
+{
+	while(av_read_frame(format_context, packet) == 0)
+	{
+		if(packet->stream_index == stream_num)
+			return true;
+		av_packet_unref(packet);
+	}
+	return false;
+}
+
 Result_with_string Util_muxer_mux(std::string file_name, int session)
 {
 	Result_with_string result;
 	int ffmpeg_result = 0;
+	AVStream* in_stream[2] = { NULL, NULL, };
+	AVStream* out_stream[2] = { NULL, NULL, };
+	AVPacket* packet[2] = { NULL, NULL, };
+	AVFormatContext* in_format_context[2] = { NULL, NULL, };
+	bool has_packet[2] = { false, false, };
 
 	util_muxer_format_context[session] = avformat_alloc_context();
 	if(!util_muxer_format_context[session])
@@ -47,28 +60,8 @@ Result_with_string Util_muxer_mux(std::string file_name, int session)
 		goto fail;
 	}
 
+	//the packets are copied as they are (no re-encoding), so only the codec parameters are needed
 	//setup for audio
-	util_audio_muxer_codec[session] = avcodec_find_encoder(util_audio_muxer_format_context[session]->streams[util_audio_muxer_stream_num[session]]->codecpar->codec_id);
-	if(!util_audio_muxer_codec[session])
-	{
-		result.error_description = "avcodec_find_encoder() failed";
-		goto fail;
-	}
-	
-	util_audio_muxer_context[session] = avcodec_alloc_context3(util_audio_muxer_codec[session]);
-	if(!util_audio_muxer_context[session])
-	{
-		result.error_description = "avcodec_alloc_context3() failed";
-		goto fail;
-	}
-
-	ffmpeg_result = avcodec_parameters_to_context(util_audio_muxer_context[session], util_audio_muxer_format_context[session]->streams[util_audio_muxer_stream_num[session]]->codecpar);
-	if(ffmpeg_result != 0)
-	{
-		result.error_description = "avcodec_parameters_to_context() failed " + std::to_string(ffmpeg_result);
-		goto fail;
-	}
-
 	util_audio_muxer_format_stream[session] = avformat_new_stream(util_muxer_format_context[session], NULL);
 	if(!util_audio_muxer_format_stream[session])
 	{
@@ -76,35 +69,15 @@ Result_with_string Util_muxer_mux(std::string file_name, int session)
 		goto fail;
 	}
 
-	ffmpeg_result = avcodec_parameters_from_context(util_audio_muxer_format_stream[session]->codecpar, util_audio_muxer_context[session]);
-	if(ffmpeg_result != 0)
+	ffmpeg_result = avcodec_parameters_copy(util_audio_muxer_format_stream[session]->codecpar, util_audio_muxer_format_context[session]->streams[util_audio_muxer_stream_num[session]]->codecpar);
+	if(ffmpeg_result < 0)
 	{
-		result.error_description = "avcodec_parameters_from_context() failed";
+		result.error_description = "avcodec_parameters_copy() failed " + std::to_string(ffmpeg_result);
 		goto fail;
 	}
+	util_audio_muxer_format_stream[session]->codecpar->codec_tag = 0;
 
 	//setup for video
-	util_video_muxer_codec[session] = avcodec_find_encoder(util_video_muxer_format_context[session]->streams[util_video_muxer_stream_num[session]]->codecpar->codec_id);
-	if(!util_video_muxer_codec[session])
-	{
-		result.error_description = "avcodec_find_encoder() failed";
-		goto fail;
-	}
-
-	util_video_muxer_context[session] = avcodec_alloc_context3(util_video_muxer_codec[session]);
-	if(!util_video_muxer_context[session])
-	{
-		result.error_description = "avcodec_alloc_context3() failed";
-		goto fail;
-	}
-
-	ffmpeg_result = avcodec_parameters_to_context(util_video_muxer_context[session], util_video_muxer_format_context[session]->streams[util_video_muxer_stream_num[session]]->codecpar);
-	if(ffmpeg_result != 0)
-	{
-		result.error_description = "avcodec_parameters_to_context() failed " + std::to_string(ffmpeg_result);
-		goto fail;
-	}
-
 	util_video_muxer_format_stream[session] = avformat_new_stream(util_muxer_format_context[session], NULL);
 	if(!util_video_muxer_format_stream[session])
 	{
@@ -112,78 +85,70 @@ Result_with_string Util_muxer_mux(std::string file_name, int session)
 		goto fail;
 	}
 
-	ffmpeg_result = avcodec_parameters_from_context(util_video_muxer_format_stream[session]->codecpar, util_video_muxer_context[session]);
-	if(ffmpeg_result != 0)
+	ffmpeg_result = avcodec_parameters_copy(util_video_muxer_format_stream[session]->codecpar, util_video_muxer_format_context[session]->streams[util_video_muxer_stream_num[session]]->codecpar);
+	if(ffmpeg_result < 0)
 	{
-		result.error_description = "avcodec_parameters_from_context() failed";
+		result.error_description = "avcodec_parameters_copy() failed " + std::to_string(ffmpeg_result);
 		goto fail;
 	}
-
-	if (util_muxer_format_context[session]->oformat->flags & AVFMT_GLOBALHEADER)
-		util_muxer_format_context[session]->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	util_video_muxer_format_stream[session]->codecpar->codec_tag = 0;
 
 	ffmpeg_result = avformat_write_header(util_muxer_format_context[session], NULL);
-	if(ffmpeg_result != 0)
+	if(ffmpeg_result < 0)
 	{
 		result.error_description = "avformat_write_header() failed";
 		goto fail;
 	}
 	
 	util_audio_muxer_packet[session] = av_packet_alloc();
-	if(!util_audio_muxer_packet[session])
-	{
-		result.error_description = "av_packet_alloc() failed";
-		goto fail;
-	}
-
-	while(true)//mux audio
-	{
-		ffmpeg_result = av_read_frame(util_audio_muxer_format_context[session], util_audio_muxer_packet[session]);
-		if(ffmpeg_result != 0)
-			break;
-		
-		if(util_audio_muxer_stream_num[session] == util_audio_muxer_packet[session]->stream_index)
-		{
-			util_audio_muxer_packet[session]->stream_index = 0;
-			ffmpeg_result = av_interleaved_write_frame(util_muxer_format_context[session], util_audio_muxer_packet[session]);
-			if(ffmpeg_result != 0)
-			{
-				result.error_description = "av_interleaved_write_frame() failed " + std::to_string(ffmpeg_result);
-				goto fail;
-			}
-		}
-	}
-	av_packet_free(&util_audio_muxer_packet[session]);
-
 	util_video_muxer_packet[session] = av_packet_alloc();
-	if(!util_video_muxer_packet[session])
+	if(!util_audio_muxer_packet[session] || !util_video_muxer_packet[session])
 	{
 		result.error_description = "av_packet_alloc() failed";
 		goto fail;
 	}
 
-	while(true)//mux video
+	//index 0 : audio, index 1 : video (same as the order of the output streams)
+	in_format_context[0] = util_audio_muxer_format_context[session];
+	in_format_context[1] = util_video_muxer_format_context[session];
+	in_stream[0] = in_format_context[0]->streams[util_audio_muxer_stream_num[session]];
+	in_stream[1] = in_format_context[1]->streams[util_video_muxer_stream_num[session]];
+	out_stream[0] = util_audio_muxer_format_stream[session];
+	out_stream[1] = util_video_muxer_format_stream[session];
+	packet[0] = util_audio_muxer_packet[session];
+	packet[1] = util_video_muxer_packet[session];
+	has_packet[0] = Util_muxer_read_packet(in_format_context[0], util_audio_muxer_stream_num[session], packet[0]);
+	has_packet[1] = Util_muxer_read_packet(in_format_context[1], util_video_muxer_stream_num[session], packet[1]);
+
+	//write the packets in dts order so that the interleaving queue doesn't have to hold an entire stream
+	while(has_packet[0] || has_packet[1])
 	{
-		ffmpeg_result = av_read_frame(util_video_muxer_format_context[session], util_video_muxer_packet[session]);
+		int type;
+		if(!has_packet[0])
+			type = 1;
+		else if(!has_packet[1])
+			type = 0;
+		else
+			type = av_compare_ts(packet[0]->dts, in_stream[0]->time_base, packet[1]->dts, in_stream[1]->time_base) <= 0 ? 0 : 1;
+
+		av_packet_rescale_ts(packet[type], in_stream[type]->time_base, out_stream[type]->time_base);
+		packet[type]->stream_index = type;
+		packet[type]->pos = -1;
+		ffmpeg_result = av_interleaved_write_frame(util_muxer_format_context[session], packet[type]);
 		if(ffmpeg_result != 0)
-			break;
-		
-		if(util_video_muxer_stream_num[session] == util_video_muxer_packet[session]->stream_index)
 		{
-			util_video_muxer_packet[session]->stream_index = 1;
-			ffmpeg_result = av_interleaved_write_frame(util_muxer_format_context[session], util_video_muxer_packet[session]);
-			if(ffmpeg_result != 0)
-			{
-				result.error_description = "av_interleaved_write_frame() failed " + std::to_string(ffmpeg_result);
-				goto fail;
-			}
+			result.error_description = "av_interleaved_write_frame() failed " + std::to_string(ffmpeg_result);
+			goto fail;
 		}
+		has_packet[type] = Util_muxer_read_packet(in_format_context[type], type == 0 ? util_audio_muxer_stream_num[session] : util_video_muxer_stream_num[session], packet[type]);
 	}
+	av_packet_free(&util_audio_muxer_packet[session]);
 	av_packet_free(&util_video_muxer_packet[session]);
 
 	av_write_trailer(util_muxer_format_context[session]);
 	avio_close(util_muxer_format_context[session]->pb);
 	avformat_free_context(util_muxer_format_context[session]);
+	util_muxer_format_context[session] = NULL;
 
 	return result;
 
@@ -191,8 +156,14 @@ Result_with_string Util_muxer_mux(std::string file_name, int session)
 
 	result.code = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS;
 	result.string = DEF_ERR_FFMPEG_RETURNED_NOT_SUCCESS_STR;
-	avio_close(util_muxer_format_context[session]->pb);
-	avformat_free_context(util_muxer_format_context[session]);
+	av_packet_free(&util_audio_muxer_packet[session]);
+	av_packet_free(&util_video_muxer_packet[session]);
+	if(util_muxer_format_context[session])
+	{
+		avio_close(util_muxer_format_context[session]->pb);
+		avformat_free_context(util_muxer_format_context[session]);
+		util_muxer_format_context[session] = NULL;
+	}
 	return result;
 }
 
@@ -0,0 +1,325 @@
+#include "headers.hpp"
+#include "system/util/playback_benchmark.hpp"
+#include "system/util/misc_tasks.hpp"
+#include "network/network_stats.hpp"
+#include <malloc.h>
+
+#define REPORT_DIR (DEF_MAIN_DIR + "profile/")
+#define SCENARIO_FILE "benchmark.txt"
+#define MEMORY_SAMPLE_INTERVAL_MS 500
+#define LOG_STR "benchmark"
+
+namespace {
+	struct ScenarioResult {
+		PlaybackBenchmarkScenario scenario;
+		std::string error;
+		double page_load_time = -1; // ms from the request
+		double first_frame_time = -1; // ms from the request
+		std::vector<double> seek_latencies; // ms from the seek request to the next frame shown, -1 if it never came
+		int frames = 0; // including the dropped ones
+		int dropped_frames = 0;
+		int late_frames = 0;
+		double decode_time_sum = 0;
+		double convert_time_sum = 0;
+		double throughput = -1; // KB/s on the googlevideo hosts
+		int peak_heap_used = 0; // bytes
+		int min_linear_free = -1;
+		MemoryTagUsage tag_usage[(int) MemoryTag::NUM]; // peaks during the scenario
+	};
+	
+	bool running = false;
+	std::vector<PlaybackBenchmarkScenario> scenarios;
+	size_t cur_index = 0;
+	ScenarioResult cur_result;
+	u64 start_tick = 0;
+	u64 first_frame_tick = 0;
+	u64 seek_tick = 0;
+	bool seek_pending = false;
+	u64 last_memory_sample_tick = 0;
+	std::vector<ScenarioResult> finished_results;
+	std::vector<ScenarioResult> unsaved_results; // taken by playback_benchmark_save_report()
+	int report_cnt = 0;
+	
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+static double ms_since(u64 tick) { return (svcGetSystemTick() - tick) / CPU_TICKS_PER_MSEC; }
+
+static std::vector<PlaybackBenchmarkScenario> default_scenarios() {
+	const std::string big_buck_bunny = "https://m.youtube.com/watch?v=aqz-KE-bpKQ";
+	std::vector<PlaybackBenchmarkScenario> res(4);
+	res[0].url = big_buck_bunny, res[0].quality = 144, res[0].play_seconds = 20, res[0].seek_positions = {120};
+	res[1].url = big_buck_bunny, res[1].quality = 240, res[1].play_seconds = 20, res[1].seek_positions = {120};
+	res[2].url = big_buck_bunny, res[2].quality = 360, res[2].play_seconds = 30, res[2].seek_positions = {120, 300};
+	res[3].url = big_buck_bunny, res[3].quality = 480, res[3].play_seconds = 30, res[3].seek_positions = {120, 300};
+	return res;
+}
+static std::vector<PlaybackBenchmarkScenario> load_scenarios() {
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(SCENARIO_FILE, DEF_MAIN_DIR, &file_size);
+	if (result.code != 0) return default_scenarios();
+	
+	std::string data(file_size, '\0');
+	u32 read_size = 0;
+	result = Util_file_load_from_file(SCENARIO_FILE, DEF_MAIN_DIR, (u8 *) &data[0], file_size, &read_size);
+	if (result.code != 0) {
+		Util_log_save(LOG_STR, "Util_file_load_from_file()..." + result.string + result.error_description, result.code);
+		return default_scenarios();
+	}
+	data.resize(read_size);
+	
+	std::vector<PlaybackBenchmarkScenario> res;
+	size_t head = 0;
+	while (head < data.size()) {
+		size_t end = data.find('\n', head);
+		if (end == std::string::npos) end = data.size();
+		std::string line = data.substr(head, end - head);
+		head = end + 1;
+		
+		std::vector<std::string> tokens;
+		std::string cur;
+		for (char c : line + " ") {
+			if (isspace(c)) {
+				if (cur.size()) tokens.push_back(cur);
+				cur = "";
+			} else cur.push_back(c);
+		}
+		if (!tokens.size() || tokens[0][0] == '#') continue;
+		if (tokens.size() < 3) {
+			Util_log_save(LOG_STR, "ignoring invalid line : " + line);
+			continue;
+		}
+		PlaybackBenchmarkScenario scenario;
+		scenario.url = tokens[0];
+		scenario.quality = atoi(tokens[1].c_str());
+		scenario.play_seconds = atof(tokens[2].c_str());
+		for (size_t i = 3; i < tokens.size(); i++) scenario.seek_positions.push_back(atof(tokens[i].c_str()));
+		res.push_back(scenario);
+	}
+	return res;
+}
+
+bool playback_benchmark_start() {
+	auto loaded = load_scenarios();
+	lock();
+	if (!running && loaded.size()) {
+		running = true;
+		scenarios = loaded;
+		cur_index = 0;
+		cur_result = ScenarioResult();
+		cur_result.scenario = scenarios[0];
+		finished_results.clear();
+	}
+	bool res = running;
+	release();
+	Util_log_save(LOG_STR, res ? "start : " + std::to_string(loaded.size()) + " scenarios" : "no scenario");
+	return res;
+}
+static void finish_wo_lock() {
+	running = false;
+	unsaved_results = finished_results;
+	misc_tasks_request(TASK_SAVE_BENCHMARK_REPORT);
+}
+void playback_benchmark_stop() {
+	lock();
+	if (running) finish_wo_lock();
+	release();
+}
+bool playback_benchmark_is_running() {
+	lock();
+	bool res = running;
+	release();
+	return res;
+}
+const PlaybackBenchmarkScenario *playback_benchmark_current() {
+	lock();
+	const PlaybackBenchmarkScenario *res = running ? &scenarios[cur_index] : NULL;
+	release();
+	return res;
+}
+
+std::string playback_benchmark_get_status() {
+	lock();
+	std::string res;
+	if (running) res = "benchmark " + std::to_string(cur_index + 1) + "/" + std::to_string(scenarios.size()) + " : " +
+		std::to_string(scenarios[cur_index].quality) + "p";
+	release();
+	return res;
+}
+
+void playback_benchmark_on_scenario_started() {
+	lock();
+	start_tick = svcGetSystemTick();
+	first_frame_tick = 0;
+	seek_pending = false;
+	last_memory_sample_tick = 0;
+	release();
+	memory_stats_reset_peaks();
+}
+void playback_benchmark_on_page_loaded() {
+	lock();
+	if (running && cur_result.page_load_time < 0) cur_result.page_load_time = ms_since(start_tick);
+	release();
+}
+void playback_benchmark_on_seek_requested() {
+	lock();
+	seek_tick = svcGetSystemTick();
+	seek_pending = true;
+	release();
+}
+void playback_benchmark_on_frame(bool dropped, bool late, double decode_time, double convert_time) {
+	lock();
+	if (running && start_tick) {
+		cur_result.frames++;
+		cur_result.decode_time_sum += decode_time;
+		if (dropped) cur_result.dropped_frames++;
+		else {
+			cur_result.convert_time_sum += convert_time;
+			if (late) cur_result.late_frames++;
+			if (!first_frame_tick) {
+				first_frame_tick = svcGetSystemTick();
+				cur_result.first_frame_time = ms_since(start_tick);
+			}
+			if (seek_pending) {
+				cur_result.seek_latencies.push_back(ms_since(seek_tick));
+				seek_pending = false;
+			}
+		}
+	}
+	release();
+}
+void playback_benchmark_sample_memory() {
+	lock();
+	bool sample = running && (!last_memory_sample_tick || ms_since(last_memory_sample_tick) >= MEMORY_SAMPLE_INTERVAL_MS);
+	if (sample) last_memory_sample_tick = svcGetSystemTick();
+	release();
+	if (!sample) return;
+	
+	int heap_used = mallinfo().uordblks;
+	int linear_free = linearSpaceFree();
+	lock();
+	cur_result.peak_heap_used = std::max(cur_result.peak_heap_used, heap_used);
+	if (cur_result.min_linear_free < 0 || linear_free < cur_result.min_linear_free) cur_result.min_linear_free = linear_free;
+	release();
+}
+
+bool playback_benchmark_is_page_loaded() {
+	lock();
+	bool res = cur_result.page_load_time >= 0;
+	release();
+	return res;
+}
+bool playback_benchmark_is_seek_pending() {
+	lock();
+	bool res = seek_pending;
+	release();
+	return res;
+}
+double playback_benchmark_time_since_start() {
+	lock();
+	double res = ms_since(start_tick) / 1000;
+	release();
+	return res;
+}
+double playback_benchmark_time_since_first_frame() {
+	lock();
+	double res = first_frame_tick ? ms_since(first_frame_tick) / 1000 : -1;
+	release();
+	return res;
+}
+double playback_benchmark_time_since_seek() {
+	lock();
+	double res = seek_pending ? ms_since(seek_tick) / 1000 : 0;
+	release();
+	return res;
+}
+
+void playback_benchmark_finish_scenario(const std::string &error) {
+	double throughput = -1;
+	for (auto &host : network_stats_get()) if (host.host.find("googlevideo") != std::string::npos)
+		throughput = std::max(throughput, host.throughput * 1000 / 1024);
+	MemoryTagUsage tag_usage[(int) MemoryTag::NUM];
+	for (int i = 0; i < (int) MemoryTag::NUM; i++) tag_usage[i] = memory_stats_get((MemoryTag) i);
+	
+	lock();
+	if (running) {
+		cur_result.error = error;
+		cur_result.throughput = throughput;
+		for (int i = 0; i < (int) MemoryTag::NUM; i++) cur_result.tag_usage[i] = tag_usage[i];
+		if (seek_pending) cur_result.seek_latencies.push_back(-1);
+		finished_results.push_back(cur_result);
+		Util_log_save(LOG_STR, "scenario " + std::to_string(cur_index) + " done" + (error != "" ? " : " + error : ""));
+		
+		start_tick = 0;
+		seek_pending = false;
+		if (++cur_index >= scenarios.size()) finish_wo_lock();
+		else {
+			cur_result = ScenarioResult();
+			cur_result.scenario = scenarios[cur_index];
+		}
+	}
+	release();
+}
+
+static std::string format_double(double value, int precision) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.*f", precision, value);
+	return buf;
+}
+void playback_benchmark_save_report() {
+	lock();
+	std::vector<ScenarioResult> results;
+	results.swap(unsaved_results);
+	release();
+	if (!results.size()) return;
+	
+	bool new_3ds = false;
+	APT_CheckNew3DS(&new_3ds);
+	const char *framework_names[] = {"httpc", "sslc", "libcurl"};
+	std::string data;
+	data += "# ThirdTube " + DEF_CURRENT_APP_VER + ", " + var_model + (new_3ds ? " (New 3DS)" : " (Old 3DS)") + ", network framework : " +
+		(var_network_framework >= 0 && var_network_framework < 3 ? framework_names[var_network_framework] : std::to_string(var_network_framework)) + "\n";
+	data += "url,quality,play_s,error,page_load_ms,first_frame_ms,seek_ms_avg,seek_ms_max,seek_failed,frames,dropped,late,decode_ms_avg,convert_ms_avg,"
+		"throughput_kbps,peak_heap_kb,min_linear_free_kb";
+	for (int i = 0; i < (int) MemoryTag::NUM; i++) {
+		std::string name = memory_stats_get_tag_name((MemoryTag) i);
+		data += "," + name + "_heap_peak_kb," + name + "_linear_peak_kb";
+	}
+	data += "\n";
+	for (auto &result : results) {
+		double seek_sum = 0, seek_max = 0;
+		int seek_num = 0, seek_failed = 0;
+		for (auto latency : result.seek_latencies) {
+			if (latency < 0) seek_failed++;
+			else seek_sum += latency, seek_max = std::max(seek_max, latency), seek_num++;
+		}
+		int shown_frames = result.frames - result.dropped_frames;
+		std::string error = result.error;
+		for (auto &c : error) if (c == ',' || c == '\n') c = ' ';
+		data += result.scenario.url + "," + std::to_string(result.scenario.quality) + "," + format_double(result.scenario.play_seconds, 0) + "," +
+			error + "," + format_double(result.page_load_time, 0) + "," + format_double(result.first_frame_time, 0) + "," +
+			format_double(seek_num ? seek_sum / seek_num : -1, 0) + "," + format_double(seek_num ? seek_max : -1, 0) + "," + std::to_string(seek_failed) + "," +
+			std::to_string(result.frames) + "," + std::to_string(result.dropped_frames) + "," + std::to_string(result.late_frames) + "," +
+			format_double(result.frames ? result.decode_time_sum / result.frames : -1, 2) + "," +
+			format_double(shown_frames ? result.convert_time_sum / shown_frames : -1, 2) + "," +
+			format_double(result.throughput, 0) + "," + std::to_string(result.peak_heap_used / 1024) + "," + std::to_string(result.min_linear_free / 1024);
+		for (auto &usage : result.tag_usage) data += "," + std::to_string(usage.heap_peak / 1024) + "," + std::to_string(usage.linear_peak / 1024);
+		data += "\n";
+	}
+	
+	std::string file_name = "benchmark_" + std::to_string(var_num_of_app_start) + "_" + std::to_string(report_cnt++) + ".csv";
+	Result_with_string result = Util_file_save_to_file(file_name, REPORT_DIR, (u8 *) data.c_str(), data.size(), true);
+	Util_log_save(LOG_STR, "report " + file_name + " : Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+}
@@ -0,0 +1,280 @@
+#include "headers.hpp"
+#include "system/util/player_session.hpp"
+#include "system/util/misc_tasks.hpp"
+#include "json11/json11.hpp"
+#include <time.h>
+
+using namespace json11;
+
+#define SESSION_FILE_NAME "player_session.json"
+#define SESSION_VERSION 0
+#define SESSION_MAX_AGE_S (7 * 24 * 60 * 60) // older sessions are not continued anymore
+#define STREAM_URL_MIN_LIFETIME_S (30 * 60) // the saved stream urls are used only if they are going to work for at least this long
+#define LOG_STR "player/session"
+
+namespace {
+	PlayerSession pending_session;
+	bool session_exists = false;
+
+	Handle resource_lock;
+	bool lock_initialized = false;
+}
+
+static void lock() {
+	if (!lock_initialized) {
+		lock_initialized = true;
+		svcCreateMutex(&resource_lock, false);
+	}
+	svcWaitSynchronization(resource_lock, std::numeric_limits<s64>::max());
+}
+static void release() {
+	svcReleaseMutex(resource_lock);
+}
+
+void player_session_update(const std::string &url, double position, int video_p_value, bool audio_only_mode, bool auto_quality_mode,
+	const YouTubeVideoDetail &info) {
+	PlayerSession session;
+	session.url = url;
+	session.position = position;
+	session.video_p_value = video_p_value;
+	session.audio_only_mode = audio_only_mode;
+	session.auto_quality_mode = auto_quality_mode;
+
+	YouTubeVideoDetail &res = session.video_info;
+	res.url = info.url;
+	res.title = info.title;
+	res.description = info.description;
+	res.author = info.author;
+	res.audio_stream_url = info.audio_stream_url;
+	res.smallest_audio_stream_url = info.smallest_audio_stream_url;
+	res.cheapest_audio_stream_url = info.cheapest_audio_stream_url;
+	res.audio_stream_codec = info.audio_stream_codec;
+	res.smallest_audio_stream_codec = info.smallest_audio_stream_codec;
+	res.cheapest_audio_stream_codec = info.cheapest_audio_stream_codec;
+	res.video_stream_urls = info.video_stream_urls;
+	res.video_stream_bitrates = info.video_stream_bitrates;
+	res.audio_stream_bitrate = info.audio_stream_bitrate;
+	res.both_stream_url = info.both_stream_url;
+	res.duration_ms = info.duration_ms;
+	res.like_count_str = info.like_count_str;
+	res.dislike_count_str = info.dislike_count_str;
+	res.publish_date = info.publish_date;
+	res.views_str = info.views_str;
+	res.playlist = info.playlist;
+	res.storyboard = info.storyboard;
+
+	lock();
+	pending_session = std::move(session);
+	session_exists = true;
+	release();
+	misc_tasks_request(TASK_SAVE_PLAYER_SESSION);
+}
+void player_session_clear() {
+	lock();
+	session_exists = false;
+	release();
+	misc_tasks_request(TASK_SAVE_PLAYER_SESSION);
+}
+
+static Json encode_video(const YouTubeVideoSuccinct &video) {
+	return Json::object{
+		{"url", video.url},
+		{"title", video.title},
+		{"duration_text", video.duration_text},
+		{"author", video.author},
+		{"thumbnail_url", video.thumbnail_url}
+	};
+}
+void save_player_session() {
+	lock();
+	bool exists = session_exists;
+	PlayerSession session;
+	if (exists) session = pending_session;
+	release();
+
+	if (!exists) {
+		Util_file_delete_file(SESSION_FILE_NAME, DEF_MAIN_DIR);
+		return;
+	}
+	const YouTubeVideoDetail &info = session.video_info;
+	Json::array video_streams;
+	for (auto &stream : info.video_stream_urls) {
+		int bitrate = info.video_stream_bitrates.count(stream.first) ? info.video_stream_bitrates.at(stream.first) : 0;
+		video_streams.push_back(Json::object{{"quality", stream.first}, {"url", stream.second}, {"bitrate", bitrate}});
+	}
+	Json::array playlist_videos;
+	for (auto &video : info.playlist.videos) playlist_videos.push_back(encode_video(video));
+
+	Json::object video = {
+		{"title", info.title},
+		{"description", info.description},
+		{"author_name", info.author.name},
+		{"author_url", info.author.url},
+		{"author_icon_url", info.author.icon_url},
+		{"author_subscribers", info.author.subscribers},
+		{"audio_stream_url", info.audio_stream_url},
+		{"smallest_audio_stream_url", info.smallest_audio_stream_url},
+		{"cheapest_audio_stream_url", info.cheapest_audio_stream_url},
+		{"audio_stream_codec", info.audio_stream_codec},
+		{"smallest_audio_stream_codec", info.smallest_audio_stream_codec},
+		{"cheapest_audio_stream_codec", info.cheapest_audio_stream_codec},
+		{"audio_stream_bitrate", info.audio_stream_bitrate},
+		{"video_streams", video_streams},
+		{"both_stream_url", info.both_stream_url},
+		{"duration_ms", info.duration_ms},
+		{"like_count", info.like_count_str},
+		{"dislike_count", info.dislike_count_str},
+		{"publish_date", info.publish_date},
+		{"views", info.views_str},
+		{"playlist", Json::object{
+			{"id", info.playlist.id},
+			{"title", info.playlist.title},
+			{"author_name", info.playlist.author_name},
+			{"total_videos", info.playlist.total_videos},
+			{"selected_index", info.playlist.selected_index},
+			{"videos", playlist_videos}
+		}},
+		{"storyboard", Json::object{
+			{"width", info.storyboard.width},
+			{"height", info.storyboard.height},
+			{"frame_num", info.storyboard.frame_num},
+			{"cols", info.storyboard.cols},
+			{"rows", info.storyboard.rows},
+			{"interval_ms", info.storyboard.interval_ms},
+			{"sheet_urls", Json(info.storyboard.sheet_urls)}
+		}}
+	};
+	std::string data = Json(Json::object{
+		{"version", SESSION_VERSION},
+		{"url", session.url},
+		{"position", session.position},
+		{"video_p_value", session.video_p_value},
+		{"audio_only", session.audio_only_mode},
+		{"auto_quality", session.auto_quality_mode},
+		{"saved_time", std::to_string((long long) time(NULL))}, // string value because json11 can't handle 64-bit integers
+		{"video", video}
+	}).dump();
+
+	Result_with_string result = Util_file_save_to_file(SESSION_FILE_NAME, DEF_MAIN_DIR, (u8 *) data.c_str(), data.size(), true);
+	if (result.code != 0) Util_log_save(LOG_STR, "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+}
+
+// googlevideo urls have the unix time they stop working at in the `expire` parameter
+static bool is_stream_url_usable(const std::string &url, time_t now) {
+	if (url == "" || url.compare(0, 4, "http")) return true; // unused, or a file saved for the offline playback
+	auto pos = url.find("?expire=");
+	if (pos == std::string::npos) pos = url.find("&expire=");
+	if (pos == std::string::npos) return false; // can't tell
+	long long expire = strtoll(url.c_str() + pos + 8, NULL, 10);
+	return expire - (long long) now >= STREAM_URL_MIN_LIFETIME_S;
+}
+bool load_player_session(PlayerSession &session) {
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size(SESSION_FILE_NAME, DEF_MAIN_DIR, &file_size);
+	if (result.code != 0) return false; // the last playback ended normally
+
+	char *buf = (char *) malloc(file_size + 1);
+	if (!buf) return false;
+	u32 read_size;
+	result = Util_file_load_from_file(SESSION_FILE_NAME, DEF_MAIN_DIR, (u8 *) buf, file_size, &read_size);
+	Util_log_save(LOG_STR, "Util_file_load_from_file()..." + result.string + result.error_description, result.code);
+	if (result.code != 0) {
+		free(buf);
+		return false;
+	}
+	buf[read_size] = '\0';
+	std::string error;
+	Json data = Json::parse(buf, error);
+	free(buf);
+
+	int version = data["version"] == Json() ? -1 : data["version"].int_value();
+	if (version < 0) {
+		Util_log_save(LOG_STR, "failed to load the session, json err:" + error);
+		return false;
+	}
+	time_t now = time(NULL);
+	long long saved_time = strtoll(data["saved_time"].string_value().c_str(), NULL, 10);
+	session.url = data["url"].string_value();
+	auto id_pos = session.url.find("v=");
+	std::string id = id_pos == std::string::npos ? "" : session.url.substr(id_pos + 2, 11);
+	if (!youtube_is_valid_video_id(id) || now - saved_time > SESSION_MAX_AGE_S) {
+		Util_log_save(LOG_STR, "ignoring the old or invalid session");
+		return false;
+	}
+	session.position = std::max(0.0, data["position"].number_value());
+	session.video_p_value = data["video_p_value"].int_value();
+	session.audio_only_mode = data["audio_only"].bool_value();
+	session.auto_quality_mode = data["auto_quality"].bool_value();
+
+	const Json &video = data["video"];
+	YouTubeVideoDetail &info = session.video_info;
+	info.url = session.url;
+	info.title = video["title"].string_value();
+	info.description = video["description"].string_value();
+	info.author.name = video["author_name"].string_value();
+	info.author.url = video["author_url"].string_value();
+	info.author.icon_url = video["author_icon_url"].string_value();
+	info.author.subscribers = video["author_subscribers"].string_value();
+	info.audio_stream_url = video["audio_stream_url"].string_value();
+	info.smallest_audio_stream_url = video["smallest_audio_stream_url"].string_value();
+	info.cheapest_audio_stream_url = video["cheapest_audio_stream_url"].string_value();
+	info.audio_stream_codec = video["audio_stream_codec"].string_value();
+	info.smallest_audio_stream_codec = video["smallest_audio_stream_codec"].string_value();
+	info.cheapest_audio_stream_codec = video["cheapest_audio_stream_codec"].string_value();
+	info.audio_stream_bitrate = video["audio_stream_bitrate"].int_value();
+	for (auto &stream : video["video_streams"].array_items()) {
+		info.video_stream_urls[stream["quality"].int_value()] = stream["url"].string_value();
+		info.video_stream_bitrates[stream["quality"].int_value()] = stream["bitrate"].int_value();
+	}
+	info.both_stream_url = video["both_stream_url"].string_value();
+	info.duration_ms = video["duration_ms"].int_value();
+	info.is_livestream = false; // livestreams are not saved
+	info.is_upcoming = false;
+	info.stream_fragment_len = -1;
+	info.like_count_str = video["like_count"].string_value();
+	info.dislike_count_str = video["dislike_count"].string_value();
+	info.publish_date = video["publish_date"].string_value();
+	info.views_str = video["views"].string_value();
+
+	const Json &playlist = video["playlist"];
+	info.playlist.id = playlist["id"].string_value();
+	info.playlist.title = playlist["title"].string_value();
+	info.playlist.author_name = playlist["author_name"].string_value();
+	info.playlist.total_videos = playlist["total_videos"].int_value();
+	info.playlist.selected_index = playlist["selected_index"].int_value();
+	for (auto &item : playlist["videos"].array_items()) {
+		YouTubeVideoSuccinct cur_video;
+		cur_video.url = item["url"].string_value();
+		cur_video.title = item["title"].string_value();
+		cur_video.duration_text = item["duration_text"].string_value();
+		cur_video.author = item["author"].string_value();
+		cur_video.thumbnail_url = item["thumbnail_url"].string_value();
+		info.playlist.videos.push_back(cur_video);
+	}
+
+	const Json &storyboard = video["storyboard"];
+	info.storyboard.width = storyboard["width"].int_value();
+	info.storyboard.height = storyboard["height"].int_value();
+	info.storyboard.frame_num = storyboard["frame_num"].int_value();
+	info.storyboard.cols = storyboard["cols"].int_value();
+	info.storyboard.rows = storyboard["rows"].int_value();
+	info.storyboard.interval_ms = storyboard["interval_ms"].int_value();
+	for (auto &url : storyboard["sheet_urls"].array_items()) info.storyboard.sheet_urls.push_back(url.string_value());
+
+	// the suggestions and comments come with the page parsed again in the background
+	info.comment_continue_type = -1;
+	info.comments_disabled = false;
+
+	bool urls_usable = is_stream_url_usable(info.audio_stream_url, now) && is_stream_url_usable(info.smallest_audio_stream_url, now) &&
+		is_stream_url_usable(info.cheapest_audio_stream_url, now) && is_stream_url_usable(info.both_stream_url, now);
+	for (auto &stream : info.video_stream_urls) urls_usable = urls_usable && is_stream_url_usable(stream.second, now);
+	info.playability_status = urls_usable ? "OK" : "";
+	info.playability_reason = "";
+	if (!urls_usable) Util_log_save(LOG_STR, "the stream urls have expired, the page is going to be parsed");
+
+	lock();
+	pending_session = session;
+	session_exists = true;
+	release();
+	return true;
+}
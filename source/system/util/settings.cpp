@@ -1,6 +1,7 @@
 #include "headers.hpp"
 #include "youtube_parser/parser.hpp"
 #include "scenes/video_player.hpp"
+#include "system/thread_placement.hpp"
 
 void load_settings() {
 	char buf[0x1001] = { 0 };
@@ -33,14 +34,35 @@ void load_settings() {
 	if (var_time_to_turn_off_lcd < 10) var_time_to_turn_off_lcd = 150;
 	var_eco_mode = load_int("eco_mode", 1);
 	var_full_screen_mode = load_int("full_screen_mode", 0);
+	var_video_mini_player = load_int("video_mini_player", 1);
 	var_night_mode = load_int("dark_theme", 0);
 	var_flash_mode = load_int("dark_theme_flash", 0);
 	var_network_framework = var_network_framework_changed = load_int("use_experimental_sslc", -1); // for back compability
 	if (var_network_framework < 0 || var_network_framework >= 3) var_network_framework = var_network_framework_changed = load_int("network_framework", -1);
 	if (var_network_framework < 0 || var_network_framework >= 3) var_network_framework = var_network_framework_changed = 2;
+	var_thread_placement = var_thread_placement_changed = load_int("thread_placement", 0);
+	if (var_thread_placement < 0 || var_thread_placement >= THREAD_PLACEMENT_NUM) var_thread_placement = var_thread_placement_changed = 0;
 	var_history_enabled = load_int("history_enabled", 1);
+	var_stream_disk_cache_enabled = load_int("stream_disk_cache", 0);
 	var_video_show_debug_info = load_int("video_show_debug_info", 0);
+	var_video_frame_profiling = load_int("video_frame_profiling", 0);
+	var_network_trace = load_int("network_trace", 0);
+	var_video_sw_decoder_threads = load_int("video_sw_decoder_threads", 1);
+	if (var_video_sw_decoder_threads < 1 || var_video_sw_decoder_threads > 3) var_video_sw_decoder_threads = 1;
+	var_video_yuv_converter = load_int("video_yuv_converter", 0);
+	if (var_video_yuv_converter < 0 || var_video_yuv_converter > 2) var_video_yuv_converter = 0;
 	var_video_linear_filter = load_int("linear_filter", 1);
+	var_audio_output_mode = load_int("audio_output_mode", 0);
+	if (var_audio_output_mode < 0 || var_audio_output_mode > 2) var_audio_output_mode = 0;
+	var_audio_only_low_power = load_int("audio_only_low_power", 0);
+	var_livestream_low_latency = load_int("livestream_low_latency", 0);
+	var_paused_forward_buffer_seconds = load_int("paused_forward_buffer", 30);
+	if (var_paused_forward_buffer_seconds < 0 || var_paused_forward_buffer_seconds > 600) var_paused_forward_buffer_seconds = 30;
+	var_data_saver = load_int("data_saver", 0);
+	var_thumbnail_etc1 = load_int("thumbnail_etc1", 0);
+	var_telemetry_host = load_string("telemetry_host", "");
+	var_telemetry_port = load_int("telemetry_port", 5140);
+	if (var_telemetry_port <= 0 || var_telemetry_port > 65535) var_telemetry_port = 5140;
 	
 	Util_cset_set_wifi_state(true);
 	Util_cset_set_screen_brightness(true, true, var_lcd_brightness);
@@ -56,12 +78,27 @@ void save_settings() {
 		"<time_to_turn_off_lcd>" + std::to_string(var_time_to_turn_off_lcd) + "</time_to_turn_off_lcd>\n" +
 		"<eco_mode>" + std::to_string(var_eco_mode) + "</eco_mode>\n" + 
 		"<full_screen_mode>" + std::to_string(var_full_screen_mode) + "</full_screen_mode>\n" +
+		"<video_mini_player>" + std::to_string(var_video_mini_player) + "</video_mini_player>\n" +
 		"<dark_theme>" + std::to_string(var_night_mode) + "</dark_theme>\n" + 
 		"<dark_theme_flash>" + std::to_string(var_flash_mode) + "</dark_theme_flash>\n" + 
 		"<network_framework>" + std::to_string(var_network_framework_changed) + "</network_framework>\n" +
+		"<thread_placement>" + std::to_string(var_thread_placement_changed) + "</thread_placement>\n" +
 		"<history_enabled>" + std::to_string(var_history_enabled) + "</history_enabled>\n" +
+		"<stream_disk_cache>" + std::to_string(var_stream_disk_cache_enabled) + "</stream_disk_cache>\n" +
 		"<video_show_debug_info>" + std::to_string(var_video_show_debug_info) + "</video_show_debug_info>\n" +
-		"<linear_filter>" + std::to_string(var_video_linear_filter) + "</linear_filter>\n";
+		"<video_frame_profiling>" + std::to_string(var_video_frame_profiling) + "</video_frame_profiling>\n" +
+		"<network_trace>" + std::to_string(var_network_trace) + "</network_trace>\n" +
+		"<video_sw_decoder_threads>" + std::to_string(var_video_sw_decoder_threads) + "</video_sw_decoder_threads>\n" +
+		"<video_yuv_converter>" + std::to_string(var_video_yuv_converter) + "</video_yuv_converter>\n" +
+		"<linear_filter>" + std::to_string(var_video_linear_filter) + "</linear_filter>\n" +
+		"<audio_output_mode>" + std::to_string(var_audio_output_mode) + "</audio_output_mode>\n" +
+		"<audio_only_low_power>" + std::to_string(var_audio_only_low_power) + "</audio_only_low_power>\n" +
+		"<livestream_low_latency>" + std::to_string(var_livestream_low_latency) + "</livestream_low_latency>\n" +
+		"<paused_forward_buffer>" + std::to_string(var_paused_forward_buffer_seconds) + "</paused_forward_buffer>\n" +
+		"<data_saver>" + std::to_string(var_data_saver) + "</data_saver>\n" +
+		"<thumbnail_etc1>" + std::to_string(var_thumbnail_etc1) + "</thumbnail_etc1>\n" +
+		"<telemetry_host>" + var_telemetry_host + "</telemetry_host>\n" +
+		"<telemetry_port>" + std::to_string(var_telemetry_port) + "</telemetry_port>\n";
 	
 	Result_with_string result = Util_file_save_to_file("settings.txt", DEF_MAIN_DIR, (u8 *) data.c_str(), data.size(), true);
 	Util_log_save("settings/save", "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
@@ -1,7 +1,136 @@
 #include "headers.hpp"
 
-ndspWaveBuf util_ndsp_buffer[24][60];
-double util_ndsp_buffer_timestamp[24][60]; // {pts, sample rate}
+#define SPEAKER_QUEUE_NUM 60
+
+ndspWaveBuf util_ndsp_buffer[24][SPEAKER_QUEUE_NUM];
+double util_ndsp_buffer_timestamp[24][SPEAKER_QUEUE_NUM]; // pts
+// buffers are played in the order they are queued, so the slots are used as a ring :
+// the util_ndsp_buffer_used_num[ch] slots from util_ndsp_buffer_oldest[ch] hold buffers that are not given back yet
+static Util_speaker_release_func util_ndsp_buffer_release[24][SPEAKER_QUEUE_NUM];
+static void *util_ndsp_buffer_release_arg[24][SPEAKER_QUEUE_NUM];
+static int util_ndsp_buffer_oldest[24];
+static int util_ndsp_buffer_used_num[24];
+// the number of buffers queued since all of them were given back the last time (written after ndspChnWaveBufAdd()),
+// the ring starts at slot 0 then so that the buffer queued in the n-th place is always in the slot n % SPEAKER_QUEUE_NUM
+static u32 util_ndsp_buffer_queued_total[24];
+
+// the audio clock : the ndsp callback (once per ndsp frame, ~5 ms) follows the playing buffer and records where it is,
+// Util_speaker_clock_now() only interpolates from that record with the system tick
+#define CLOCK_MAX_EXTRAPOLATION_S 0.02 // a few ndsp frames, the clock stops there if the callback doesn't come (underrun, ndsp stalled)
+// the queue takes buffers only up to the target latency ahead of the playback, the target grows each time the queue runs dry
+#define DEFAULT_TARGET_LATENCY_S 0.2
+#define MAX_TARGET_LATENCY_S 1.0
+#define TARGET_LATENCY_GROWTH 1.5
+namespace {
+	struct SpeakerClock {
+		int sample_rate = 1;
+		double speed = 1.0;
+		u32 current = 0; // the index (in the queued order) of the buffer the ndsp is on or is going to start with
+		bool valid = false; // something is playing or queued
+		bool running = false; // the position advances (playing and not paused)
+		double pts = 0; // the position at `tick`
+		u64 tick = 0;
+		double last_returned = -1; // for the monotonicity, cleared when the position jumps (clear, init)
+		
+		u64 queued_samples = 0; // in all the buffers queued since the reset
+		u64 done_samples = 0; // in the buffers before `current`
+		u64 played_samples = 0; // done_samples and the position in the playing buffer, as of `tick`
+		bool underrun = false; // ran dry while playing, the target grows with the next buffer
+		double base_latency = DEFAULT_TARGET_LATENCY_S;
+		double target_latency = DEFAULT_TARGET_LATENCY_S;
+	};
+	SpeakerClock clocks[24];
+	LightMutex clock_lock;
+	u32 tracked_channels = 0;
+	bool callback_set = false;
+}
+
+// only once all the buffers are given back, with `clock_lock` held
+static void Util_speaker_clock_reset(int play_ch)
+{
+	util_ndsp_buffer_oldest[play_ch] = 0;
+	__atomic_store_n(&util_ndsp_buffer_queued_total[play_ch], 0, __ATOMIC_RELEASE);
+	SpeakerClock &clock = clocks[play_ch];
+	clock.current = 0;
+	clock.valid = clock.running = false;
+	clock.last_returned = -1;
+	clock.queued_samples = clock.done_samples = clock.played_samples = 0;
+	clock.underrun = false;
+}
+
+// called from the ndsp thread right after it updated the buffer status
+static void Util_speaker_clock_update(void *)
+{
+	u64 tick = svcGetSystemTick();
+	LightMutexGuard guard(clock_lock);
+	u32 channels = __atomic_load_n(&tracked_channels, __ATOMIC_ACQUIRE);
+	for (int ch = 0; channels; ch++, channels >>= 1) {
+		if (!(channels & 1)) continue;
+		SpeakerClock &clock = clocks[ch];
+		u32 queued_total = __atomic_load_n(&util_ndsp_buffer_queued_total[ch], __ATOMIC_ACQUIRE);
+		// buffers are played in order, so the ones before the playing one are done (or even given back already)
+		int status = -1;
+		while (clock.current != queued_total) {
+			status = util_ndsp_buffer[ch][clock.current % SPEAKER_QUEUE_NUM].status;
+			if (status == NDSP_WBUF_PLAYING || status == NDSP_WBUF_QUEUED) break;
+			clock.done_samples += util_ndsp_buffer[ch][clock.current % SPEAKER_QUEUE_NUM].nsamples;
+			clock.current++;
+		}
+		if (clock.current == queued_total) { // ran out of buffers, nothing is playing
+			if (clock.running) clock.underrun = true;
+			clock.valid = clock.running = false;
+			clock.played_samples = clock.done_samples;
+			continue;
+		}
+		int slot = clock.current % SPEAKER_QUEUE_NUM;
+		clock.valid = true;
+		clock.tick = tick;
+		if (status == NDSP_WBUF_PLAYING) {
+			u32 sample_pos = ndspChnGetSamplePos(ch);
+			clock.played_samples = clock.done_samples + sample_pos;
+			clock.pts = util_ndsp_buffer_timestamp[ch][slot] + (double) sample_pos / clock.sample_rate;
+			clock.running = !ndspChnIsPaused(ch);
+		} else {
+			clock.played_samples = clock.done_samples;
+			clock.pts = util_ndsp_buffer_timestamp[ch][slot];
+			clock.running = false;
+		}
+	}
+}
+
+double Util_speaker_clock_now(int play_ch)
+{
+	u64 tick = svcGetSystemTick();
+	LightMutexGuard guard(clock_lock);
+	SpeakerClock &clock = clocks[play_ch];
+	if (!clock.valid) return -1;
+	double res = clock.pts;
+	if (clock.running) res += std::min((double) (tick - clock.tick) / SYSCLOCK_ARM11, CLOCK_MAX_EXTRAPOLATION_S) * clock.speed;
+	// the record from the callback can be slightly behind what was extrapolated before it
+	res = std::max(res, clock.last_returned);
+	clock.last_returned = res;
+	return res;
+}
+
+// gives the buffers back to their owners, only the played ones unless `all` is set (ndsp must not be using them then)
+static void Util_speaker_release_buffers(int play_ch, bool all)
+{
+	while (util_ndsp_buffer_used_num[play_ch])
+	{
+		int slot = util_ndsp_buffer_oldest[play_ch];
+		ndspWaveBuf &wave_buf = util_ndsp_buffer[play_ch][slot];
+		if (!all && wave_buf.status != NDSP_WBUF_DONE)
+			break;
+
+		if (util_ndsp_buffer_release[play_ch][slot])
+			util_ndsp_buffer_release[play_ch][slot]((u8 *) wave_buf.data_vaddr, util_ndsp_buffer_release_arg[play_ch][slot]);
+		util_ndsp_buffer_release[play_ch][slot] = NULL;
+		wave_buf.data_vaddr = NULL;
+		wave_buf.status = NDSP_WBUF_FREE;
+		util_ndsp_buffer_oldest[play_ch] = (slot + 1) % SPEAKER_QUEUE_NUM;
+		util_ndsp_buffer_used_num[play_ch]--;
+	}
+}
 
 void Util_speaker_init(int play_ch, int music_ch, int sample_rate)
 {
@@ -9,6 +138,19 @@ void Util_speaker_init(int play_ch, int music_ch, int sample_rate)
 
 	ndspChnReset(play_ch);
 	ndspChnWaveBufClear(play_ch);
+	Util_speaker_release_buffers(play_ch, true);
+	{
+		LightMutexGuard guard(clock_lock);
+		Util_speaker_clock_reset(play_ch);
+		clocks[play_ch].sample_rate = sample_rate;
+		clocks[play_ch].speed = 1.0;
+		clocks[play_ch].target_latency = clocks[play_ch].base_latency;
+		__atomic_or_fetch(&tracked_channels, 1u << play_ch, __ATOMIC_RELEASE);
+		if (!callback_set) {
+			callback_set = true;
+			ndspSetCallback(Util_speaker_clock_update, NULL);
+		}
+	}
 	ndspChnSetMix(play_ch, mix);
 	if(music_ch == 2)
 	{
@@ -24,73 +166,87 @@ void Util_speaker_init(int play_ch, int music_ch, int sample_rate)
 	ndspChnSetInterp(play_ch, NDSP_INTERP_LINEAR);
 	ndspChnSetRate(play_ch, sample_rate);
 	memset(util_ndsp_buffer[play_ch], 0, sizeof(util_ndsp_buffer[play_ch]));
-	for(int i = 0; i < 60; i++)
+	for(int i = 0; i < SPEAKER_QUEUE_NUM; i++)
 		util_ndsp_buffer[play_ch][i].data_vaddr = NULL;
 }
 
-Result_with_string Util_speaker_add_buffer(int play_ch, int music_ch, u8* buffer, int size, double pts)
+Result_with_string Util_speaker_add_buffer(int play_ch, u8* buffer, int size, double pts, Util_speaker_release_func release, void *release_arg)
 {
 	Result_with_string result;
-	int free_queue = -1;
 
-	for(int i = 0; i < 60; i++)
-	{
-		if(util_ndsp_buffer[play_ch][i].status == NDSP_WBUF_FREE || util_ndsp_buffer[play_ch][i].status == NDSP_WBUF_DONE)
+	Util_speaker_release_buffers(play_ch, false);
+	{ // not held while calling ndsp, whose thread takes it in the callback
+		LightMutexGuard guard(clock_lock);
+		SpeakerClock &clock = clocks[play_ch];
+		if (clock.underrun) {
+			clock.underrun = false;
+			double next_latency = std::min(clock.target_latency * TARGET_LATENCY_GROWTH, MAX_TARGET_LATENCY_S);
+			if (next_latency > clock.target_latency) {
+				clock.target_latency = next_latency;
+				Util_log_save("speaker", "underrun, target latency : " + std::to_string((int) (next_latency * 1000)) + "ms");
+			}
+		}
+		// the speed is taken into account because the target is in real time
+		u64 ahead_samples = clock.queued_samples - std::min(clock.played_samples, clock.queued_samples);
+		if(util_ndsp_buffer_used_num[play_ch] == SPEAKER_QUEUE_NUM || ahead_samples >= clock.target_latency * clock.sample_rate * clock.speed)
 		{
-			free_queue = i;
-			break;
+			result.code = DEF_ERR_OTHER;
+			result.string = "[Error] Queues are full ";
+			return result;
 		}
+		clock.queued_samples += size / 2;
 	}
 
-	if(free_queue == -1)
-	{
-		result.code = DEF_ERR_OTHER;
-		result.string = "[Error] Queues are full ";
-		return result;
-	}
-
-	linearFree_concurrent((void*)util_ndsp_buffer[play_ch][free_queue].data_vaddr);
-	util_ndsp_buffer[play_ch][free_queue].data_vaddr = NULL;
-	util_ndsp_buffer[play_ch][free_queue].data_vaddr = (u8*)linearAlloc_concurrent(size * music_ch);
-	if(util_ndsp_buffer[play_ch][free_queue].data_vaddr == NULL)
-	{
-		result.code = DEF_ERR_OUT_OF_LINEAR_MEMORY;
-		result.string = DEF_ERR_OUT_OF_LINEAR_MEMORY_STR;
-		return result;
-	}
-
-	memcpy((void*)util_ndsp_buffer[play_ch][free_queue].data_vaddr, buffer, size * music_ch);
+	int free_queue = (util_ndsp_buffer_oldest[play_ch] + util_ndsp_buffer_used_num[play_ch]) % SPEAKER_QUEUE_NUM;
+	util_ndsp_buffer_used_num[play_ch]++;
+	util_ndsp_buffer_release[play_ch][free_queue] = release;
+	util_ndsp_buffer_release_arg[play_ch][free_queue] = release_arg;
+	util_ndsp_buffer_timestamp[play_ch][free_queue] = pts;
 
+	util_ndsp_buffer[play_ch][free_queue].data_vaddr = buffer;
 	util_ndsp_buffer[play_ch][free_queue].nsamples = size / 2;
 	ndspChnWaveBufAdd(play_ch, &util_ndsp_buffer[play_ch][free_queue]);
+	__atomic_add_fetch(&util_ndsp_buffer_queued_total[play_ch], 1, __ATOMIC_RELEASE);
 	
-	util_ndsp_buffer_timestamp[play_ch][free_queue] = pts;
 	return result;
 }
 
 double Util_speaker_get_current_timestamp(int play_ch, int sample_rate)
 {
-	if (!Util_speaker_is_playing(play_ch)) return -1;
-	double queued_min = INFINITY;
-	for (int i = 0; i < 60; i++) {
-		if (util_ndsp_buffer[play_ch][i].status == NDSP_WBUF_PLAYING)
-			return util_ndsp_buffer_timestamp[play_ch][i] + (double) ndspChnGetSamplePos(play_ch) / sample_rate;
-		if (util_ndsp_buffer[play_ch][i].status == NDSP_WBUF_QUEUED)
-			queued_min = std::min(queued_min, util_ndsp_buffer_timestamp[play_ch][i]);
+	(void) sample_rate; // the one given to Util_speaker_init() is used
+	return Util_speaker_clock_now(play_ch);
+}
+
+void Util_speaker_set_speed(int play_ch, int sample_rate, double speed)
+{
+	ndspChnSetRate(play_ch, sample_rate * speed);
+	LightMutexGuard guard(clock_lock);
+	// the current record is re-based so that the interpolation from it uses the new speed only from now on
+	SpeakerClock &clock = clocks[play_ch];
+	if (clock.running) {
+		u64 tick = svcGetSystemTick();
+		clock.pts += std::min((double) (tick - clock.tick) / SYSCLOCK_ARM11, CLOCK_MAX_EXTRAPOLATION_S) * clock.speed;
+		clock.tick = tick;
 	}
-	if (queued_min != INFINITY) return queued_min;
-	// weired...
-	if (!Util_speaker_is_playing(play_ch)) return -1;
-	// really weired...
-	Util_log_save("speaker", "unexpected behavior in get_current_timestamp");
-	return -1;
+	clock.speed = speed;
+}
+
+void Util_speaker_set_target_latency(int play_ch, double latency_s)
+{
+	LightMutexGuard guard(clock_lock);
+	clocks[play_ch].base_latency = clocks[play_ch].target_latency = std::min(latency_s, MAX_TARGET_LATENCY_S);
 }
 
 void Util_speaker_clear_buffer(int play_ch)
 {
 	ndspChnWaveBufClear(play_ch);
 	while (Util_speaker_is_playing(play_ch)) usleep(10000);
-	for (int i = 0; i < 60; i++) {
+	Util_speaker_release_buffers(play_ch, true);
+	{
+		LightMutexGuard guard(clock_lock);
+		Util_speaker_clock_reset(play_ch);
+	}
+	for (int i = 0; i < SPEAKER_QUEUE_NUM; i++) {
 		util_ndsp_buffer[play_ch][i].status = NDSP_WBUF_FREE;
 		util_ndsp_buffer_timestamp[play_ch][i] = 0.0;
 	}
@@ -120,9 +276,9 @@ void Util_speaker_exit(int play_ch)
 {
 	ndspChnWaveBufClear(play_ch);
 	ndspChnSetPaused(play_ch, false);
-	for(int i = 0; i < 60; i++)
-	{
-		linearFree_concurrent((void*)util_ndsp_buffer[play_ch][i].data_vaddr);
-		util_ndsp_buffer[play_ch][i].data_vaddr = NULL;
-	}
+	while (Util_speaker_is_playing(play_ch)) usleep(10000);
+	Util_speaker_release_buffers(play_ch, true);
+	LightMutexGuard guard(clock_lock);
+	__atomic_and_fetch(&tracked_channels, ~(1u << play_ch), __ATOMIC_RELEASE);
+	Util_speaker_clock_reset(play_ch);
 }
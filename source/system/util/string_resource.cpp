@@ -1,13 +1,23 @@
 #include "headers.hpp"
 
-static std::map<std::string, std::string> *string_resources = NULL;
-static std::map<std::string, std::string> *string_resources_alt = NULL;
+namespace {
+	struct StringTable {
+		std::string strings[(int) StringResourceId::NUM];
+	};
+	const char * const string_resource_names[] = {
+#define STRING_RESOURCE_NAME(id) #id,
+		STRING_RESOURCE_IDS(STRING_RESOURCE_NAME)
+#undef STRING_RESOURCE_NAME
+	};
+}
+static StringTable *string_resources = NULL;
+static StringTable *string_resources_alt = NULL;
 
 
-std::string get_string_resource(std::string id) {
-	if (!string_resources) return "[SR Null Err]";
-	if (!string_resources->count(id)) return "[SR Not Found]";
-	return (*string_resources)[id];
+const std::string &get_string_resource(StringResourceId id) {
+	static const std::string null_err = "[SR Null Err]";
+	if (!string_resources) return null_err;
+	return string_resources->strings[(int) id];
 }
 
 Result_with_string load_string_resources(std::string lang) {
@@ -24,21 +34,28 @@ Result_with_string load_string_resources(std::string lang) {
 		return result;
 	}
 	
-	std::map<std::string, std::string> *new_resources = new std::map<std::string, std::string>(parse_xml_like_text(buffer));
+	StringTable *new_resources = new StringTable();
 	if (!new_resources) {
 		result.code = DEF_ERR_OUT_OF_MEMORY;
 		result.string = DEF_ERR_OUT_OF_MEMORY_STR;
 		return result;
 	}
-	for (auto &item : *new_resources) {
-		std::string tmp_value;
-		for (size_t i = 0; i < item.second.size(); ) {
-			if (i + 1 < item.second.size() && item.second[i] == '\\' && item.second[i + 1] == 'n') tmp_value.push_back('\n'), i += 2;
-			else tmp_value.push_back(item.second[i]), i++;
+	// the text is parsed once here, the lookups are plain indexing
+	std::map<std::string, std::string> parsed = parse_xml_like_text(buffer);
+	for (int i = 0; i < (int) StringResourceId::NUM; i++) {
+		auto itr = parsed.find(string_resource_names[i]);
+		if (itr == parsed.end()) {
+			new_resources->strings[i] = "[SR Not Found]";
+			continue;
+		}
+		const std::string &value = itr->second;
+		std::string &tmp_value = new_resources->strings[i];
+		for (size_t j = 0; j < value.size(); ) {
+			if (j + 1 < value.size() && value[j] == '\\' && value[j + 1] == 'n') tmp_value.push_back('\n'), j += 2;
+			else tmp_value.push_back(value[j]), j++;
 		}
-		item.second = tmp_value;
 	}
-	// it's safe unless two load_string_resources() calls occur while the same call of get_string_resource() is running, which is highly unlikely
+	// it's safe unless two load_string_resources() calls occur while a string returned by get_string_resource() is still being used, which is highly unlikely
 	delete(string_resources_alt);
 	string_resources_alt = string_resources;
 	string_resources = new_resources;
@@ -47,5 +64,3 @@ Result_with_string load_string_resources(std::string lang) {
 	
 	return result;
 }
-
-
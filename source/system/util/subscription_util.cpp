@@ -3,10 +3,12 @@
 #include "system/util/util.hpp"
 #include "ui/ui.hpp"
 #include "json11/json11.hpp"
+#include <unordered_map>
 
 using namespace json11;
 
 static std::vector<SubscriptionChannel> subscribed_channels;
+static std::unordered_map<std::string, size_t> subscribed_index; // id -> index in subscribed_channels
 static bool lock_initialized = false;
 static Handle resource_lock;
 
@@ -23,6 +25,11 @@ static void release() {
 
 #define SUBSCRIPTION_VERSION 0
 
+static void rebuild_index() {
+	subscribed_index.clear();
+	for (size_t i = 0; i < subscribed_channels.size(); i++) subscribed_index[subscribed_channels[i].id] = i;
+}
+
 void load_subscription() {
 	u64 file_size;
 	Result_with_string result = Util_file_check_file_size("subscription.json", DEF_MAIN_DIR, &file_size);
@@ -58,6 +65,7 @@ void load_subscription() {
 			}
 			lock();
 			subscribed_channels = loaded_channels;
+			rebuild_index();
 			release();
 			Util_log_save("subsc/load" , "loaded subsc(" + std::to_string(subscribed_channels.size()) + " items)");
 		} else {
@@ -102,30 +110,26 @@ void save_subscription() {
 
 bool subscription_is_subscribed(const std::string &id) {
 	lock();
-	bool found = false;
-	for (auto channel : subscribed_channels) if (channel.id == id) {
-		found = true;
-		break;
-	}
+	bool found = subscribed_index.count(id);
 	release();
 	return found;
 }
 
 void subscription_subscribe(const SubscriptionChannel &new_channel) {
 	lock();
-	bool found = false;
-	for (auto channel : subscribed_channels) if (channel.id == new_channel.id) {
-		found = true;
-		break;
+	if (!subscribed_index.count(new_channel.id)) {
+		subscribed_index[new_channel.id] = subscribed_channels.size();
+		subscribed_channels.push_back(new_channel);
 	}
-	if (!found) subscribed_channels.push_back(new_channel);
 	release();
 }
 void subscription_unsubscribe(const std::string &id) {
 	lock();
-	std::vector<SubscriptionChannel> new_subscribed_channels;
-	for (auto channel : subscribed_channels) if (channel.id != id) new_subscribed_channels.push_back(channel);
-	subscribed_channels = new_subscribed_channels;
+	auto itr = subscribed_index.find(id);
+	if (itr != subscribed_index.end()) {
+		subscribed_channels.erase(subscribed_channels.begin() + itr->second);
+		rebuild_index();
+	}
 	release();
 }
 
@@ -136,3 +140,168 @@ std::vector<SubscriptionChannel> get_subscribed_channels() {
 	return res;
 }
 
+
+
+#define SUBSCRIPTION_FEED_VERSION 0
+#define SUBSCRIPTION_FEED_MAX_AGE (60 * 60 * 24 * 61) // videos older than about 2 months are dropped from the feed
+
+struct FeedChannel {
+	std::string etag;
+	std::vector<SubscriptionFeedVideo> videos;
+};
+static std::unordered_map<std::string, FeedChannel> feed_channels;
+
+// "3 days ago" -> 3 * 24 * 60 * 60, -1 on failure
+static s64 parse_relative_date(const std::string &date) {
+	std::string date_number_str;
+	for (auto c : date) if (isdigit(c)) date_number_str.push_back(c);
+	
+	char *end;
+	s64 number = strtoll(date_number_str.c_str(), &end, 10);
+	if (!date_number_str.size() || *end) return -1;
+	
+	static const std::vector<std::pair<std::vector<std::string>, s64> > unit_list = {
+		{{"second", "秒"}, 1},
+		{{"minute", "分"}, 60},
+		{{"hour", "時間"}, 60 * 60},
+		{{"day", "日"}, 60 * 60 * 24},
+		{{"week", "週間"}, 60 * 60 * 24 * 7},
+		{{"month", "月"}, 60 * 60 * 24 * 30},
+		{{"year", "年"}, 60 * 60 * 24 * 365}
+	};
+	for (auto &unit : unit_list) for (auto &pattern : unit.first)
+		if (date.find(pattern) != std::string::npos) return number * unit.second;
+	return -1;
+}
+
+void load_subscription_feed() {
+	u64 file_size;
+	Result_with_string result = Util_file_check_file_size("subscription_feed.json", DEF_MAIN_DIR, &file_size);
+	if (result.code != 0) {
+		Util_log_save("subsc/load" , "Util_file_check_file_size() (feed)..." + result.string + result.error_description, result.code);
+		return;
+	}
+	
+	char *buf = (char *) malloc(file_size + 1);
+	
+	u32 read_size;
+	result = Util_file_load_from_file("subscription_feed.json", DEF_MAIN_DIR, (u8 *) buf, file_size, &read_size);
+	Util_log_save("subsc/load" , "Util_file_load_from_file() (feed)..." + result.string + result.error_description, result.code);
+	if (result.code == 0) {
+		buf[read_size] = '\0';
+		
+		std::string error;
+		Json data = Json::parse(buf, error);
+		int version = data["version"] == Json() ? -1 : data["version"].int_value();
+		if (version >= 0) {
+			std::unordered_map<std::string, FeedChannel> loaded_channels;
+			for (auto channel : data["channels"].array_items()) {
+				FeedChannel &cur_channel = loaded_channels[channel["id"].string_value()];
+				cur_channel.etag = channel["etag"].string_value();
+				for (auto video : channel["videos"].array_items()) {
+					SubscriptionFeedVideo cur_video;
+					cur_video.channel_id = channel["id"].string_value();
+					cur_video.video.url = video["url"].string_value();
+					cur_video.video.title = video["title"].string_value();
+					cur_video.video.author = video["author"].string_value();
+					cur_video.video.duration_text = video["duration"].string_value();
+					cur_video.video.publish_date = video["publish_date"].string_value();
+					cur_video.video.views_str = video["views"].string_value();
+					cur_video.video.thumbnail_url = video["thumbnail_url"].string_value();
+					{
+						auto str = video["publish_time"].string_value();
+						char *end;
+						cur_video.publish_time = strtoll(str.c_str(), &end, 10);
+					}
+					bool valid = is_youtube_url(cur_video.video.url) && is_youtube_thumbnail_url(cur_video.video.thumbnail_url);
+					if (valid) cur_channel.videos.push_back(cur_video);
+				}
+			}
+			lock();
+			feed_channels = loaded_channels;
+			release();
+			Util_log_save("subsc/load" , "loaded feed(" + std::to_string(loaded_channels.size()) + " channels)");
+		} else {
+			Util_log_save("subsc/load" , "failed to load feed, json err:" + error);
+		}
+	}
+	free(buf);
+}
+void save_subscription_feed() {
+	lock();
+	auto channels_backup = feed_channels;
+	auto index_backup = subscribed_index;
+	release();
+	
+	Json::array channels;
+	for (auto &channel : channels_backup) {
+		if (!index_backup.count(channel.first)) continue; // unsubscribed
+		Json::array videos;
+		for (auto &video : channel.second.videos) videos.push_back(Json::object{
+			{"url", video.video.url},
+			{"title", video.video.title},
+			{"author", video.video.author},
+			{"duration", video.video.duration_text},
+			{"publish_date", video.video.publish_date},
+			{"views", video.video.views_str},
+			{"thumbnail_url", video.video.thumbnail_url},
+			{"publish_time", std::to_string(video.publish_time)} // string for the same reason as last_watch_time in watch_history.json
+		});
+		channels.push_back(Json::object{{"id", channel.first}, {"etag", channel.second.etag}, {"videos", videos}});
+	}
+	std::string data = Json(Json::object{{"version", SUBSCRIPTION_FEED_VERSION}, {"channels", channels}}).dump();
+	
+	Result_with_string result = Util_file_save_to_file("subscription_feed.json", DEF_MAIN_DIR, (u8 *) data.c_str(), data.size(), true);
+	Util_log_save("subsc/save", "Util_file_save_to_file() (feed)..." + result.string + result.error_description, result.code);
+}
+
+std::string subscription_feed_get_etag(const std::string &channel_id) {
+	lock();
+	std::string res;
+	auto itr = feed_channels.find(channel_id);
+	if (itr != feed_channels.end()) res = itr->second.etag;
+	release();
+	return res;
+}
+void subscription_feed_merge(const std::string &channel_id, const std::string &etag, const std::vector<YouTubeVideoSuccinct> &videos, time_t fetch_time) {
+	std::vector<SubscriptionFeedVideo> new_videos;
+	for (auto &video : videos) {
+		s64 age = parse_relative_date(video.publish_date);
+		if (age < 0) {
+			Util_log_save("subsc", "failed to parse the date : " + video.publish_date);
+			continue;
+		}
+		new_videos.push_back({channel_id, video, (time_t) (fetch_time - age)});
+	}
+	
+	lock();
+	FeedChannel &channel = feed_channels[channel_id];
+	channel.etag = etag;
+	// keep the cached videos that have been pushed out of the first page
+	for (auto &video : channel.videos) {
+		bool found = false;
+		for (auto &new_video : new_videos) if (new_video.video.url == video.video.url) {
+			found = true;
+			// the relative date gets coarser as the video gets older, so the first estimate is the most accurate one
+			new_video.publish_time = video.publish_time;
+			break;
+		}
+		if (!found) new_videos.push_back(video);
+	}
+	channel.videos.clear();
+	for (auto &video : new_videos) if (fetch_time - video.publish_time <= SUBSCRIPTION_FEED_MAX_AGE) channel.videos.push_back(video);
+	release();
+}
+std::vector<SubscriptionFeedVideo> subscription_feed_get() {
+	std::vector<SubscriptionFeedVideo> res;
+	lock();
+	for (auto &channel : subscribed_channels) {
+		auto itr = feed_channels.find(channel.id);
+		if (itr != feed_channels.end()) res.insert(res.end(), itr->second.videos.begin(), itr->second.videos.end());
+	}
+	release();
+	std::stable_sort(res.begin(), res.end(), [] (const SubscriptionFeedVideo &i, const SubscriptionFeedVideo &j) {
+		return i.publish_time > j.publish_time;
+	});
+	return res;
+}
@@ -0,0 +1,145 @@
+#include "headers.hpp"
+#include "system/util/telemetry.hpp"
+#include "system/util/light_lock.hpp"
+#include "system/thread_placement.hpp"
+#include <malloc.h>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#define HEADER_SIZE 16
+#define PACKET_SIZE (HEADER_SIZE + 4 * (int) TelemetryMetric::NUM)
+#define LOG_STR "telemetry"
+
+namespace {
+	volatile bool should_be_running = false;
+	Thread exporter_thread = NULL;
+
+	LightMutex values_lock;
+	float values[(int) TelemetryMetric::NUM];
+	// accumulated by telemetry_on_frame() until the next datagram
+	int frames = 0;
+	int dropped_frames = 0;
+	int shown_frames = 0;
+	double decode_time_sum = 0;
+	double convert_time_sum = 0;
+
+	u8 packet[PACKET_SIZE]; // only touched by the exporter thread
+}
+
+static void put_u16(u8 *dst, u16 value) { memcpy(dst, &value, 2); }
+static void put_u32(u8 *dst, u32 value) { memcpy(dst, &value, 4); }
+
+// fills `packet` with the latest values and resets the per interval ones
+static void build_packet(u32 seq, u32 time_ms) {
+	float cur_values[(int) TelemetryMetric::NUM];
+	{
+		LightMutexGuard guard(values_lock);
+		values[(int) TelemetryMetric::FRAMES] = frames;
+		values[(int) TelemetryMetric::DROPPED_FRAMES] = dropped_frames;
+		values[(int) TelemetryMetric::DECODE_TIME] = frames ? decode_time_sum / frames : -1;
+		values[(int) TelemetryMetric::CONVERT_TIME] = shown_frames ? convert_time_sum / shown_frames : -1;
+		frames = dropped_frames = shown_frames = 0;
+		decode_time_sum = convert_time_sum = 0;
+		memcpy(cur_values, values, sizeof(values));
+	}
+	u32 cpu_limit = 0;
+	cur_values[(int) TelemetryMetric::CPU_LIMIT] = R_SUCCEEDED(APT_GetAppCpuTimeLimit(&cpu_limit)) ? cpu_limit : -1;
+	cur_values[(int) TelemetryMetric::HEAP_USED] = mallinfo().uordblks / 1000.0;
+	cur_values[(int) TelemetryMetric::LINEAR_FREE] = linearSpaceFree() / 1000.0;
+
+	memcpy(packet, "YTM", 3);
+	packet[3] = TELEMETRY_VERSION;
+	put_u32(packet + 4, seq);
+	put_u32(packet + 8, time_ms);
+	put_u16(packet + 12, (u16) TelemetryMetric::NUM);
+	put_u16(packet + 14, 0);
+	memcpy(packet + HEADER_SIZE, cur_values, sizeof(cur_values));
+}
+
+static bool resolve_host(const std::string &host, int port, sockaddr_in *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	if (inet_aton(host.c_str(), &addr->sin_addr)) return true;
+	hostent *entry = gethostbyname(host.c_str());
+	if (!entry || entry->h_addrtype != AF_INET || !entry->h_addr_list[0]) return false;
+	memcpy(&addr->sin_addr, entry->h_addr_list[0], sizeof(addr->sin_addr));
+	return true;
+}
+
+static void exporter_thread_func(void *) {
+	Util_log_save(LOG_STR, "Thread started.");
+
+	sockaddr_in addr;
+	bool resolved = false;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) Util_log_save(LOG_STR, "socket()...", errno);
+
+	u64 start_time = osGetTime();
+	u64 next_time = start_time;
+	u32 seq = 0;
+	bool send_failed = false; // logged once per failure streak
+	while (should_be_running && sock >= 0) {
+		next_time += TELEMETRY_INTERVAL_MS;
+		u64 now = osGetTime();
+		if (next_time > now) svcSleepThread((next_time - now) * 1000000);
+		else next_time = now; // fell behind (e.g. the app was suspended), skip the missed ones
+		if (!should_be_running) break;
+
+		// retried every interval because the wifi may not be connected yet
+		if (!resolved) {
+			resolved = resolve_host(var_telemetry_host, var_telemetry_port, &addr);
+			if (!resolved) continue;
+			Util_log_save(LOG_STR, "sending to " + var_telemetry_host + ":" + std::to_string(var_telemetry_port));
+		}
+		build_packet(seq++, (u32) (osGetTime() - start_time));
+		bool ok = sendto(sock, packet, PACKET_SIZE, 0, (sockaddr *) &addr, sizeof(addr)) == PACKET_SIZE;
+		if (!ok && !send_failed) Util_log_save(LOG_STR, "sendto()...", errno);
+		send_failed = !ok;
+	}
+	if (sock >= 0) closesocket(sock);
+
+	Util_log_save(LOG_STR, "Thread exit.");
+	threadExit(0);
+}
+
+void telemetry_init() {
+	for (auto &value : values) value = -1;
+	if (var_telemetry_host == "" || var_telemetry_port <= 0 || var_telemetry_port > 65535) return;
+	should_be_running = true;
+	exporter_thread = thread_placement_create_thread(ThreadRole::TELEMETRY, exporter_thread_func, NULL, DEF_STACKSIZE, DEF_THREAD_PRIORITY_LOW, false);
+	if (!exporter_thread) {
+		Util_log_save(LOG_STR, "failed to create the thread");
+		should_be_running = false;
+	}
+}
+void telemetry_exit() {
+	if (!exporter_thread) return;
+	should_be_running = false;
+	Util_log_save(LOG_STR, "threadJoin()...", threadJoin(exporter_thread, 10000000000));
+	threadFree(exporter_thread);
+	exporter_thread = NULL;
+}
+bool telemetry_is_enabled() { return should_be_running; }
+
+void telemetry_set(TelemetryMetric metric, float value) {
+	if (!should_be_running) return;
+	LightMutexGuard guard(values_lock);
+	values[(int) metric] = value;
+}
+void telemetry_on_frame(bool dropped, double decode_time, double convert_time) {
+	if (!should_be_running) return;
+	LightMutexGuard guard(values_lock);
+	frames++;
+	decode_time_sum += decode_time;
+	if (dropped) dropped_frames++;
+	else {
+		shown_frames++;
+		convert_time_sum += convert_time;
+	}
+}
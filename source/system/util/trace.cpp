@@ -0,0 +1,128 @@
+#include "headers.hpp"
+#include "system/util/trace.hpp"
+#include "system/util/misc_tasks.hpp"
+#include <atomic>
+
+#define TRACE_DIR (DEF_MAIN_DIR + "profile/")
+#define TRACE_MAX_THREADS 16 // threads beyond this are not recorded
+#define TRACE_RING_SIZE 1024
+#define LOG_STR "trace"
+
+namespace {
+	struct TraceRecord {
+		const char *name;
+		u64 start_tick;
+		u32 duration; // in ticks
+	};
+	// written only by its owner thread
+	struct TraceRing {
+		u32 thread_id;
+		s32 core;
+		std::atomic<u32> written;
+		TraceRecord records[TRACE_RING_SIZE];
+	};
+	// allocated on the first capture and kept afterwards so that a thread in the middle of a zone never writes to freed memory
+	TraceRing *rings[TRACE_MAX_THREADS];
+	std::atomic<int> ring_num{0};
+	std::atomic<u32> generation{0}; // bumped by trace_start() to hand out the rings again
+	u64 capture_start_tick = 0;
+	int file_cnt = 0;
+	
+	__thread int thread_ring = -1;
+	__thread u32 thread_ring_generation = 0;
+}
+bool trace_capturing = false;
+
+void trace_start() {
+	if (trace_capturing) return;
+	ring_num = 0;
+	generation++;
+	capture_start_tick = svcGetSystemTick();
+	trace_capturing = true;
+	Util_log_save(LOG_STR, "start");
+}
+void trace_stop() {
+	if (!trace_capturing) return;
+	trace_capturing = false;
+	misc_tasks_request(TASK_DUMP_TRACE);
+}
+
+static TraceRing *get_thread_ring() {
+	if (thread_ring_generation != generation) {
+		thread_ring_generation = generation;
+		thread_ring = ring_num.fetch_add(1);
+		if (thread_ring >= TRACE_MAX_THREADS) thread_ring = -1;
+		else {
+			if (!rings[thread_ring]) rings[thread_ring] = (TraceRing *) malloc(sizeof(TraceRing));
+			if (!rings[thread_ring]) thread_ring = -1;
+			else {
+				TraceRing *ring = rings[thread_ring];
+				svcGetThreadId(&ring->thread_id, CUR_THREAD_HANDLE);
+				ring->core = svcGetProcessorID();
+				ring->written = 0;
+			}
+		}
+	}
+	return thread_ring >= 0 ? rings[thread_ring] : NULL;
+}
+void trace_record(const char *name, u64 start_tick, u64 end_tick) {
+	TraceRing *ring = get_thread_ring();
+	if (!ring) return;
+	u32 index = ring->written.load(std::memory_order_relaxed);
+	TraceRecord &record = ring->records[index % TRACE_RING_SIZE];
+	record.name = name;
+	record.start_tick = start_tick;
+	record.duration = end_tick - start_tick;
+	ring->written.store(index + 1, std::memory_order_release);
+}
+
+static std::string json_escape(const char *str) {
+	std::string res;
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') res.push_back('\\');
+		res.push_back(*str);
+	}
+	return res;
+}
+void trace_dump() {
+	if (trace_capturing) return;
+	std::string file_name = "trace_" + std::to_string(var_num_of_app_start) + "_" + std::to_string(file_cnt++) + ".json";
+	int cur_ring_num = std::min<int>(ring_num, TRACE_MAX_THREADS);
+	
+	// written ring by ring so that the whole json never has to be in memory
+	bool first_file_write = true;
+	auto write = [&] (const std::string &data) {
+		Result_with_string result = Util_file_save_to_file(file_name, TRACE_DIR, (u8 *) data.c_str(), data.size(), first_file_write);
+		if (result.code != 0) Util_log_save(LOG_STR, "Util_file_save_to_file()..." + result.string + result.error_description, result.code);
+		first_file_write = false;
+	};
+	std::string data = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	bool first = true;
+	for (int core = 0; core < 3; core++) {
+		data += std::string(first ? "" : ",\n") + "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " + std::to_string(core) +
+			", \"args\": {\"name\": \"core " + std::to_string(core) + "\"}}";
+		first = false;
+	}
+	int event_num = 0;
+	for (int i = 0; i < cur_ring_num; i++) {
+		TraceRing *ring = rings[i];
+		if (!ring) continue;
+		u32 written = ring->written.load(std::memory_order_acquire);
+		u32 begin = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+		std::string pid_tid = "\"pid\": " + std::to_string(ring->core) + ", \"tid\": " + std::to_string(ring->thread_id);
+		for (u32 j = begin; j < written; j++) {
+			const TraceRecord &record = ring->records[j % TRACE_RING_SIZE];
+			if (record.start_tick < capture_start_tick) continue;
+			char buf[64];
+			snprintf(buf, sizeof(buf), "\"ts\": %.1f, \"dur\": %.1f, ", (record.start_tick - capture_start_tick) / CPU_TICKS_PER_USEC,
+				record.duration / CPU_TICKS_PER_USEC);
+			data += ",\n{\"name\": \"" + json_escape(record.name) + "\", \"ph\": \"X\", " + buf + pid_tid + "}";
+			event_num++;
+		}
+		write(data);
+		data = "";
+	}
+	data += "\n]}\n";
+	write(data);
+	Util_log_save(LOG_STR, "dumped " + std::to_string(event_num) + " zones of " + std::to_string(cur_ring_num) + " threads to " + file_name);
+}
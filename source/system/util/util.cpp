@@ -123,58 +123,55 @@ std::map<std::string, std::string> parse_xml_like_text(std::string data) {
 
 // truncate and wrap into at most `max_lines` lines so that each line fit in `max_width` if drawn with the size of `x_size` x `y_size`
 std::vector<std::string> truncate_str(std::string input_str, int max_width, int max_lines, double x_size, double y_size) {
-	static std::string input[1024 + 1];
-	int n;
-	Exfont_text_parse(input_str, &input[0], 1024, &n);
+	std::vector<Exfont_char> input(std::min<size_t>(input_str.size(), 1024) + 1);
+	int n = Exfont_text_decode(input_str.c_str(), input_str.size(), &input[0], input.size() - 1);
 	
-	std::vector<std::vector<std::string> > words; // each word is considered not separable
+	std::vector<float> widths(n + 1);
+	Draw_get_widths(&input[0], n, x_size, &widths[0]);
+	float ellipsis_width;
+	{
+		Exfont_char dot = {'.', 0, 1};
+		Draw_get_widths(&dot, 1, x_size, &ellipsis_width);
+		ellipsis_width *= 3;
+	}
+	
+	// each word is considered not separable : a run of single-byte non-space characters, or any other single character
+	std::vector<int> word_head; // word i is [word_head[i], word_head[i + 1])
 	for (int i = 0; i < n; i++) {
-		bool seperate;
-		if (!i) seperate = true;
-		else {
-			std::string last_char = words.back().back();
-			seperate = last_char.size() != 1 || input[i].size() != 1 || last_char == " " || input[i] == " ";
-		}
-		if (seperate) words.push_back({input[i]});
-		else words.back().push_back(input[i]);
+		bool seperate = !i || input[i - 1].size != 1 || input[i].size != 1 || input[i - 1].code == ' ' || input[i].code == ' ';
+		if (seperate) word_head.push_back(i);
 	}
+	int m = word_head.size();
+	word_head.push_back(n);
 	
-	int m = words.size();
+	// characters are not reordered, so a range of them is a substring
+	auto append_chars = [&] (std::string &str, int l, int r) { if (l < r) str.append(input_str, input[l].offset, input[r - 1].offset + input[r - 1].size - input[l].offset); };
 	int head = 0;
 	std::vector<std::string> res;
 	for (int line = 0; line < max_lines; line++) {
 		if (head >= m) break;
 		
+		// greedily take as many words as fit in the line
 		int fit_word_num = 0;
-		{ // binary search the number of words that fit in the line
-			int l = 0;
-			int r = std::min(50, m - head + 1);
-			while (r - l > 1) {
-				int m = l + ((r - l) >> 1);
-				std::string query_text;
-				for (int i = head; i < head + m; i++) for (auto j : words[i]) query_text += j;
-				if (Draw_get_width(query_text, x_size, y_size) <= max_width) l = m;
-				else r = m;
-			}
-			fit_word_num = l;
+		float cur_width = 0;
+		while (head + fit_word_num < m) {
+			float word_width = 0;
+			for (int i = word_head[head + fit_word_num]; i < word_head[head + fit_word_num + 1]; i++) word_width += widths[i];
+			if (cur_width + word_width > max_width) break;
+			cur_width += word_width;
+			fit_word_num++;
 		}
 		
 		std::string cur_line;
-		for (int i = head; i < head + fit_word_num; i++) for (auto j : words[i]) cur_line += j;
+		append_chars(cur_line, word_head[head], word_head[head + fit_word_num]);
 		bool force_fit = !fit_word_num || (line == max_lines - 1 && fit_word_num < m - head);
 		if (force_fit) {
-			std::vector<std::string> cur_word = words[head + fit_word_num];
-			int l = 0;
-			int r = cur_word.size();
-			while (r - l > 1) { // binary search the number of characters that fit in the first line
-				int m = l + ((r - l) >> 1);
-				std::string query_text = cur_line;
-				for (int i = 0; i < m; i++) query_text += cur_word[i];
-				query_text += "...";
-				if (Draw_get_width(query_text, x_size, y_size) <= max_width) l = m;
-				else r = m;
-			}
-			for (int i = 0; i < l; i++) cur_line += cur_word[i];
+			// the number of characters of the next word that fit in the line with "..." (at least one character is left out)
+			int word_l = word_head[head + fit_word_num];
+			int word_r = word_head[head + fit_word_num + 1];
+			int l = word_l;
+			while (l + 1 < word_r && cur_width + widths[l] + ellipsis_width <= max_width) cur_width += widths[l++];
+			append_chars(cur_line, word_l, l);
 			cur_line += "...";
 			res.push_back(cur_line);
 			head += fit_word_num + 1;
@@ -4,6 +4,7 @@
 #include "ui/colors.hpp"
 #include "variables.hpp"
 #include "headers.hpp"
+#include "ui/ui_common.hpp"
 
 std::pair<int, int> VerticalScroller::update(Hid_info key, int content_y_len) {
 	if (this->content_height != content_y_len) {
@@ -22,29 +23,38 @@ std::pair<int, int> VerticalScroller::update(Hid_info key, int content_y_len) {
 	} else if (scrolling && key.touch_y != -1) {
 		offset += last_touch_y - key.touch_y;
 	}
-	offset += inertia;
+	u64 now = svcGetSystemTick();
+	double elapsed = last_update_tick ? std::min<double>(SCROLL_MAX_STEP_MS, (now - last_update_tick) / CPU_TICKS_PER_MSEC) : SCROLL_FRAME_MS;
+	last_update_tick = now;
+	if (key.touch_y != -1) touch_velocity = Util_hid_get_touch_velocity_y(SCROLL_VELOCITY_WINDOW_MS);
+	
+	float inertia_move = inertia * elapsed + inertia_remainder;
+	offset += (int) inertia_move;
+	inertia_remainder = inertia_move - (int) inertia_move;
 	if (inertia) var_need_reflesh = true;
 	if (offset < 0) {
 		offset = 0;
-		inertia = 0;
+		inertia = inertia_remainder = 0;
 	}
 	if (offset > scroll_max) {
 		offset = scroll_max;
-		inertia = 0;
+		inertia = inertia_remainder = 0;
 	}
 	
+	float prev_selected_darkness = selected_darkness;
 	if (grabbed && !scrolling) selected_darkness = std::min(1.0, selected_darkness + 0.15);
 	else selected_darkness = std::max(0.0, selected_darkness - 0.15);
 	if (key.touch_x == -1) selected_darkness = 0;
+	if (selected_darkness != prev_selected_darkness) var_need_reflesh = true;
 	
-	if (key.touch_x != -1) inertia = 0;
-	else if (inertia > 0) inertia = std::max(0.0, inertia - 0.1);
-	else inertia = std::min(0.0, inertia + 0.1);
+	if (key.touch_x != -1) inertia = inertia_remainder = 0;
+	else if (inertia > 0) inertia = std::max<double>(0, inertia - SCROLL_INERTIA_FRICTION * elapsed);
+	else inertia = std::min<double>(0, inertia + SCROLL_INERTIA_FRICTION * elapsed);
 	if (scrolling && key.touch_x == -1 && touch_frames >= 4) {
-		int sample = std::min<int>(3, touch_moves.size());
-		float amount = std::accumulate(touch_moves.end() - sample, touch_moves.end(), 0.0f) / sample;
-		// Util_log_save("scroller", "inertia start : " + std::to_string(amount));
-		if (std::fabs(amount) >= 8) inertia = -amount;
+		// from the samples of every hid scan, which may be more frequent than the frames while the app is busy
+		float velocity = Util_hid_get_touch_velocity_y(SCROLL_VELOCITY_WINDOW_MS);
+		// Util_log_save("scroller", "inertia start : " + std::to_string(velocity));
+		if (std::fabs(velocity) >= SCROLL_INERTIA_MIN_START) inertia = -velocity;
 	}
 	
 	std::pair<int, int> res = {-1, -1};
@@ -54,10 +64,7 @@ std::pair<int, int> VerticalScroller::update(Hid_info key, int content_y_len) {
 		}
 	}
 	
-	if (key.touch_y != -1 && last_touch_y != -1) {
-		touch_moves.push_back(key.touch_y - last_touch_y);
-		if (touch_moves.size() > 10) touch_moves.pop_front();
-	} else touch_moves.clear();
+	if (key.touch_y == -1 || last_touch_y == -1) touch_velocity = 0;
 	if (key.touch_y == -1) {
 		scrolling = grabbed = false;
 		touch_frames = 0;
@@ -78,7 +85,8 @@ void VerticalScroller::on_resume() {
 	last_touch_x = last_touch_y = -1;
 	first_touch_x = first_touch_y = -1;
 	touch_frames = 0;
-	touch_moves.clear();
+	touch_velocity = 0;
+	last_update_tick = 0;
 	selected_darkness = 0;
 	scrolling = false;
 	grabbed = false;
@@ -2,9 +2,12 @@
 #include <numeric>
 #include "ui/views/scroll.hpp"
 #include "ui/ui_common.hpp"
+#include "system/util/hid.hpp"
 #include "variables.hpp"
 
 void ScrollView::update_scroller(Hid_info key) {
+	int prev_offset = offset;
+	float prev_selected_darkness = selected_darkness;
 	content_height = 0;
 	for (auto view : views) content_height += view->get_height();
 	content_height += std::max((int) views.size() - 1, 0) * margin;
@@ -21,41 +24,46 @@ void ScrollView::update_scroller(Hid_info key) {
 	} else if (scrolling && key.touch_y != -1) {
 		offset += last_touch_y - key.touch_y;
 	}
-	offset += inertia;
+	u64 now = svcGetSystemTick();
+	double elapsed = last_update_tick ? std::min<double>(SCROLL_MAX_STEP_MS, (now - last_update_tick) / CPU_TICKS_PER_MSEC) : SCROLL_FRAME_MS;
+	last_update_tick = now;
+	if (key.touch_y != -1) touch_velocity = Util_hid_get_touch_velocity_y(SCROLL_VELOCITY_WINDOW_MS);
+	
+	float inertia_move = inertia * elapsed + inertia_remainder;
+	offset += (int) inertia_move;
+	inertia_remainder = inertia_move - (int) inertia_move;
 	if (inertia) var_need_reflesh = true;
 	if (offset < 0) {
 		offset = 0;
-		inertia = 0;
+		inertia = inertia_remainder = 0;
 	}
 	if (offset > scroll_max) {
 		offset = scroll_max;
-		inertia = 0;
+		inertia = inertia_remainder = 0;
 	}
 	
 	if (grabbed && !scrolling) selected_darkness = std::min(1.0, selected_darkness + 0.15);
 	else selected_darkness = std::max(0.0, selected_darkness - 0.15);
 	if (key.touch_x == -1) selected_darkness = 0;
 	
-	if (key.touch_x != -1) inertia = 0;
-	else if (inertia > 0) inertia = std::max(0.0, inertia - 0.1);
-	else inertia = std::min(0.0, inertia + 0.1);
+	if (key.touch_x != -1) inertia = inertia_remainder = 0;
+	else if (inertia > 0) inertia = std::max<double>(0, inertia - SCROLL_INERTIA_FRICTION * elapsed);
+	else inertia = std::min<double>(0, inertia + SCROLL_INERTIA_FRICTION * elapsed);
 	if (scrolling && key.touch_x == -1 && touch_frames >= 4) {
-		int sample = std::min<int>(3, touch_moves.size());
-		float amount = std::accumulate(touch_moves.end() - sample, touch_moves.end(), 0.0f) / sample;
-		// Util_log_save("scroller", "inertia start : " + std::to_string(amount));
-		if (std::fabs(amount) >= 8) inertia = -amount;
+		// from the samples of every hid scan, which may be more frequent than the frames while the app is busy
+		float velocity = Util_hid_get_touch_velocity_y(SCROLL_VELOCITY_WINDOW_MS);
+		// Util_log_save("scroller", "inertia start : " + std::to_string(velocity));
+		if (std::fabs(velocity) >= SCROLL_INERTIA_MIN_START) inertia = -velocity;
 	}
 	
-	if (key.touch_y != -1 && last_touch_y != -1) {
-		touch_moves.push_back(key.touch_y - last_touch_y);
-		if (touch_moves.size() > 10) touch_moves.pop_front();
-	} else touch_moves.clear();
+	if (key.touch_y == -1 || last_touch_y == -1) touch_velocity = 0;
 	if (key.touch_y == -1) {
 		scrolling = grabbed = false;
 		touch_frames = 0;
 	} else touch_frames++;
 	last_touch_x = key.touch_x;
 	last_touch_y = key.touch_y;
+	if (offset != prev_offset || selected_darkness != prev_selected_darkness) set_needs_redraw();
 }
 void ScrollView::draw_slider_bar() const {
 	float displayed_height = y1 - y0;
@@ -69,7 +77,8 @@ void ScrollView::on_resume() {
 	last_touch_x = last_touch_y = -1;
 	first_touch_x = first_touch_y = -1;
 	touch_frames = 0;
-	touch_moves.clear();
+	touch_velocity = 0;
+	last_update_tick = 0;
 	selected_darkness = 0;
 	scrolling = false;
 	grabbed = false;
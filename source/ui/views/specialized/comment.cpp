@@ -5,6 +5,7 @@
 
 void CommentView::draw_() const {
 	auto &comment = get_yt_comment_object();
+	load_content();
 	
 	int cur_y = y0;
 	if (cur_y < 240 && cur_y + DEFAULT_FONT_INTERVAL > 0) Draw(comment.author.name, x0 + SMALL_MARGIN * 2 + get_icon_size(), cur_y - 3, 0.5, 0.5, DEF_DRAW_GRAY);
@@ -16,7 +17,7 @@ void CommentView::draw_() const {
 			Draw(content_lines[line], content_x_pos(), cur_y - 2, 0.5, 0.5, DEFAULT_TEXT_COLOR);
 		cur_y += DEFAULT_FONT_INTERVAL;
 	}
-	if (lines_shown < content_lines.size()) {
+	if (lines_shown < content_line_num) {
 		cur_y += SMALL_MARGIN;
 		if (cur_y < 240 && cur_y + DEFAULT_FONT_INTERVAL > 0) {
 			Draw(LOCALIZED(SHOW_MORE), content_x_pos(), cur_y - 2, 0.5, 0.5, DEF_DRAW_GRAY);
@@ -49,6 +50,7 @@ void CommentView::draw_() const {
 }
 void CommentView::update_(Hid_info key) {
 	auto &comment = get_yt_comment_object();
+	load_content();
 	
 	int cur_y = y0;
 	bool inside_author_icon = in_range(key.touch_x, x0, std::min<float>(x1, x0 + get_icon_size() + SMALL_MARGIN)) && in_range(key.touch_y, cur_y, cur_y + get_icon_size());
@@ -59,14 +61,15 @@ void CommentView::update_(Hid_info key) {
 	
 	cur_y += (lines_shown + 1) * DEFAULT_FONT_INTERVAL;
 	
-	if (lines_shown < content_lines.size()) {
+	if (lines_shown < content_line_num) {
 		cur_y += SMALL_MARGIN;
 		bool inside_show_more = in_range(key.touch_x, content_x_pos(), std::min<float>(x1, content_x_pos() + Draw_get_width(LOCALIZED(SHOW_MORE), 0.5, 0.5))) &&
 			in_range(key.touch_y, cur_y, cur_y + DEFAULT_FONT_INTERVAL);
 		
 		if (key.p_touch && inside_show_more) show_more_holding = true;
 		if (key.touch_x == -1 && show_more_holding) {
-			lines_shown = std::min<size_t>(lines_shown + 50, content_lines.size());
+			lines_shown = std::min<size_t>(lines_shown + 50, content_line_num);
+			invalidate_height();
 			var_need_reflesh = true;
 		}
 		if (!inside_show_more) show_more_holding = false;
@@ -83,6 +86,7 @@ void CommentView::update_(Hid_info key) {
 		if (key.p_touch && inside_fold_replies) fold_replies_holding = true;
 		if (key.touch_x == -1 && fold_replies_holding) {
 			replies_shown = 0;
+			invalidate_height();
 			var_need_reflesh = true;
 		}
 		if (!inside_fold_replies) fold_replies_holding = false;
@@ -105,6 +109,7 @@ void CommentView::update_(Hid_info key) {
 		if (key.touch_x == -1 && show_more_replies_holding) {
 			if (replies_shown < replies.size()) {
 				replies_shown = replies.size();
+				invalidate_height();
 				var_need_reflesh = true;
 			} else if (on_load_more_replies_pressed_func) on_load_more_replies_pressed_func(*this);
 		}
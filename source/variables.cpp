@@ -10,12 +10,30 @@ bool var_flash_mode = false;
 bool var_wifi_enabled = false;
 bool var_high_resolution_mode = true;
 bool var_history_enabled = true;
+bool var_stream_disk_cache_enabled = false;
 int var_network_framework = 1;
 int var_network_framework_changed = 1;
+int var_thread_placement = 0;
+int var_thread_placement_changed = 0;
 bool var_show_fps = false;
 bool var_full_screen_mode = false;
+bool var_video_mini_player = true;
 bool var_video_show_debug_info = false;
+bool var_video_frame_profiling = false;
+bool var_network_trace = false;
+int var_video_sw_decoder_threads = 1;
+int var_video_yuv_converter = 0;
 bool var_video_linear_filter = true;
+int var_audio_output_mode = 0;
+bool var_audio_only_low_power = false;
+bool var_livestream_low_latency = false;
+int var_paused_forward_buffer_seconds = 30;
+bool var_data_saver = false;
+bool var_thumbnail_etc1 = false;
+std::string var_telemetry_host = "";
+int var_telemetry_port = 5140;
+bool var_low_power_playing = false;
+bool var_screens_off = false;
 u8 var_wifi_state = 0;
 u8 var_wifi_signal = 0;
 u8 var_battery_charge = 0;
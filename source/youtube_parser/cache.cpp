@@ -1,122 +1,175 @@
-#include <sstream>
 #include <string>
+#include <cstring>
+#include <cstdint>
 #include "cache.hpp"
 #include "internal_common.hpp"
 
+// all integers are little endian
+// header  : "YTPC", u32 version, u32 payload size, u32 FNV-1a hash of the payload
+// payload : u32 number of cipher ops, {i32, i32} each
+//           u32 number of elements of nparam c, each is u8 type followed by
+//               i64 (INTEGER), u32 length + chars (STRING), nothing (N, SELF) or u8 function + (u32 length + chars if CIPHER) (FUNCTION)
+//           u32 number of nparam ops, {i32, i32, i32} each
+//           u32 signature timestamp (0 if unknown)
+#define CACHE_MAGIC "YTPC"
+#define CACHE_VERSION 3
+#define CACHE_HEADER_SIZE 16
 
-#define CACHE_VERSION 1
+static uint32_t fnv1a(const uint8_t *data, size_t size) {
+	uint32_t res = 2166136261u;
+	for (size_t i = 0; i < size; i++) res = (res ^ data[i]) * 16777619u;
+	return res;
+}
 
-std::string yt_procs_to_string(const yt_cipher_transform_procedure &cipher_proc, const yt_nparam_transform_procedure &nparam_proc) {
-	std::ostringstream stream;
-	
-	stream << "version " << CACHE_VERSION << std::endl;
+static void put_u8(std::string &out, uint8_t val) { out.push_back((char) val); }
+static void put_u32(std::string &out, uint32_t val) {
+	for (int i = 0; i < 4; i++) out.push_back((char) (val >> (i * 8)));
+}
+static void put_u64(std::string &out, uint64_t val) {
+	for (int i = 0; i < 8; i++) out.push_back((char) (val >> (i * 8)));
+}
+template<typename T> static void put_chars(std::string &out, const T &chars) {
+	put_u32(out, chars.size());
+	out.append(chars.begin(), chars.end());
+}
+
+namespace {
+	struct BinaryReader {
+		const uint8_t *cur;
+		const uint8_t *end;
+		bool failed = false;
+		
+		BinaryReader (const uint8_t *data, size_t size) : cur(data), end(data + size) {}
+		bool has(size_t size) {
+			if ((size_t) (end - cur) < size) failed = true;
+			return !failed;
+		}
+		uint8_t u8() {
+			if (!has(1)) return 0;
+			return *cur++;
+		}
+		uint32_t u32() {
+			if (!has(4)) return 0;
+			uint32_t res = 0;
+			for (int i = 0; i < 4; i++) res |= (uint32_t) *cur++ << (i * 8);
+			return res;
+		}
+		uint64_t u64() {
+			if (!has(8)) return 0;
+			uint64_t res = 0;
+			for (int i = 0; i < 8; i++) res |= (uint64_t) *cur++ << (i * 8);
+			return res;
+		}
+		template<typename T> void chars(T &res) {
+			uint32_t size = u32();
+			if (!has(size)) return;
+			res.assign((const char *) cur, (const char *) cur + size);
+			cur += size;
+		}
+	};
+}
+
+std::string yt_procs_to_binary(const yt_cipher_transform_procedure &cipher_proc, const yt_nparam_transform_procedure &nparam_proc, int signature_timestamp) {
+	std::string payload;
 	
-	for (auto proc : cipher_proc) stream << "cipher_proc " << proc.first << " " << proc.second << std::endl;
+	put_u32(payload, cipher_proc.size());
+	for (auto proc : cipher_proc) {
+		put_u32(payload, proc.first);
+		put_u32(payload, proc.second);
+	}
 	
-	for (auto element : nparam_proc.c) {
-		stream << "nparam_c ";
-		if (element.type == NParamCArrayContent::Type::INTEGER ) stream << "int " << element.integer;
-		if (element.type == NParamCArrayContent::Type::STRING  ) stream << "str " << std::string(element.string.begin(), element.string.end());
-		if (element.type == NParamCArrayContent::Type::N       ) stream << "n   ";
-		if (element.type == NParamCArrayContent::Type::SELF    ) stream << "self";
+	put_u32(payload, nparam_proc.c.size());
+	for (auto &element : nparam_proc.c) {
+		put_u8(payload, (uint8_t) element.type);
+		if (element.type == NParamCArrayContent::Type::INTEGER) put_u64(payload, element.integer);
+		if (element.type == NParamCArrayContent::Type::STRING) put_chars(payload, element.string);
 		if (element.type == NParamCArrayContent::Type::FUNCTION) {
-			stream << "function " << (int) element.function;
-			if (element.function == NParamFunctionType::CIPHER) stream << " " << element.function_internal_arg;
+			put_u8(payload, (uint8_t) element.function);
+			if (element.function == NParamFunctionType::CIPHER) put_chars(payload, element.function_internal_arg);
 		}
-		stream << std::endl;
 	}
 	
-	for (auto op : nparam_proc.ops) stream << "nparam_op " << op.first << " " << op.second.first << " " << op.second.second << std::endl;
+	put_u32(payload, nparam_proc.ops.size());
+	for (auto op : nparam_proc.ops) {
+		put_u32(payload, op.first);
+		put_u32(payload, op.second.first);
+		put_u32(payload, op.second.second);
+	}
 	
-	stream << "end" << std::endl;
+	put_u32(payload, signature_timestamp);
 	
-	return stream.str();
+	std::string res = CACHE_MAGIC;
+	put_u32(res, CACHE_VERSION);
+	put_u32(res, payload.size());
+	put_u32(res, fnv1a((const uint8_t *) payload.data(), payload.size()));
+	return res + payload;
 }
-bool yt_procs_from_string(const std::string &str, yt_cipher_transform_procedure &cipher_proc, yt_nparam_transform_procedure &nparam_proc) {
+bool yt_procs_from_binary(const uint8_t *data, size_t size, yt_cipher_transform_procedure &cipher_proc, yt_nparam_transform_procedure &nparam_proc, int &signature_timestamp) {
 	cipher_proc = yt_cipher_transform_procedure();
 	nparam_proc = yt_nparam_transform_procedure();
+	signature_timestamp = 0;
 	
-	std::istringstream stream(str);
-	int version = -1;
-	std::string command;
-	if (!(stream >> command)) {
-		debug("[cache] Empty cache");
+	if (size < CACHE_HEADER_SIZE || memcmp(data, CACHE_MAGIC, 4)) {
+		debug("[cache] " + std::string(size >= 8 && !memcmp(data, "version ", 8) ? "cache made by an outdated version of the app, ignoring..." : "Invalid cache"));
 		return false;
 	}
-	if (command != "version" || !(stream >> version)) {
-		debug("[cache] Cache version expected");
+	BinaryReader header(data + 4, CACHE_HEADER_SIZE - 4);
+	uint32_t version = header.u32();
+	uint32_t payload_size = header.u32();
+	uint32_t hash = header.u32();
+	if (version != CACHE_VERSION) {
+		debug("[cache] " + std::string(version < CACHE_VERSION ? "cache made by an outdated version of the app, ignoring..." : "Unsupported version"));
 		return false;
 	}
-	if (version < 0 || version > CACHE_VERSION) {
-		debug("[cache] " + std::string(version < 0 ? "Invalid cache version" : "Unsupported version"));
+	if (payload_size != size - CACHE_HEADER_SIZE || fnv1a(data + CACHE_HEADER_SIZE, payload_size) != hash) {
+		debug("[cache] Corrupted cache");
 		return false;
 	}
-	if (version < CACHE_VERSION) {
-		debug("[cache] cache made by an outdated version of the app, ignoring...");
-		return false;
+	
+	BinaryReader reader(data + CACHE_HEADER_SIZE, payload_size);
+	uint32_t cipher_proc_num = reader.u32();
+	for (uint32_t i = 0; i < cipher_proc_num && !reader.failed; i++) {
+		int first = reader.u32();
+		int second = reader.u32();
+		cipher_proc.push_back({first, second});
 	}
 	
-	int command_cnt = 1;
-	while (stream >> command) {
-		std::string log_prefix = "[cache] " + std::to_string(command_cnt) + " ";
-		
-		if (command == "cipher_proc") {
-			int first, second;
-			if (!(stream >> first >> second)) {
-				debug(log_prefix + "cipher_proc : two integers expected");
-				return false;
-			}
-			cipher_proc.push_back({first, second});
-		} else if (command == "nparam_c") {
-			std::string type;
-			if (!(stream >> type)) {
-				debug(log_prefix + "nparam_c : type expected");
-				return false;
-			}
-			NParamCArrayContent element;
-			bool read_fail = false;
-			bool invalid_value = false;
-			if (type == "int") {
-				element.type = NParamCArrayContent::Type::INTEGER;
-				if (!(stream >> element.integer)) read_fail = true;
-			} else if (type == "str") {
-				element.type = NParamCArrayContent::Type::STRING;
-				std::string tmp;
-				if (!(stream >> tmp)) read_fail = true;
-				else element.string = std::vector<char>(tmp.begin(), tmp.end());
-			} else if (type == "n") {
-				element.type = NParamCArrayContent::Type::N;
-			} else if (type == "self") {
-				element.type = NParamCArrayContent::Type::SELF;
-			} else if (type == "function") {
-				element.type = NParamCArrayContent::Type::FUNCTION;
-				int function_type;
-				if (!(stream >> function_type)) read_fail = true;
-				else if (function_type < 0 || function_type >= 6) invalid_value = true;
-				else {
-					element.function = (NParamFunctionType) function_type;
-					if (element.function == NParamFunctionType::CIPHER && !(stream >> element.function_internal_arg)) read_fail = true;
-				}
-			} else {
-				debug(log_prefix + "nparam_c : invalid type : " + type);
-				return false;
-			}
-			if (read_fail || invalid_value) {
-				debug(log_prefix + "nparam_c : " + std::string(read_fail ? "Invalid line" : "Invalid value"));
-				return false;
-			} else nparam_proc.c.push_back(element);
-		} else if (command == "nparam_op") {
-			int func, arg0, arg1;
-			if (!(stream >> func >> arg0 >> arg1)) {
-				debug(log_prefix + "nparam_op : three integers expected");
+	uint32_t nparam_c_num = reader.u32();
+	for (uint32_t i = 0; i < nparam_c_num && !reader.failed; i++) {
+		NParamCArrayContent element;
+		int type = reader.u8();
+		if (type > (int) NParamCArrayContent::Type::FUNCTION) {
+			debug("[cache] nparam_c : invalid type : " + std::to_string(type));
+			return false;
+		}
+		element.type = (NParamCArrayContent::Type) type;
+		if (element.type == NParamCArrayContent::Type::INTEGER) element.integer = reader.u64();
+		if (element.type == NParamCArrayContent::Type::STRING) reader.chars(element.string);
+		if (element.type == NParamCArrayContent::Type::FUNCTION) {
+			int function_type = reader.u8();
+			if (function_type > (int) NParamFunctionType::SPLICE) {
+				debug("[cache] nparam_c : invalid function : " + std::to_string(function_type));
 				return false;
 			}
-			nparam_proc.ops.push_back({func, {arg0, arg1}});
-		} else if (command == "end") return true;
-		command_cnt++;
+			element.function = (NParamFunctionType) function_type;
+			if (element.function == NParamFunctionType::CIPHER) reader.chars(element.function_internal_arg);
+		}
+		nparam_proc.c.push_back(element);
+	}
+	
+	uint32_t nparam_op_num = reader.u32();
+	for (uint32_t i = 0; i < nparam_op_num && !reader.failed; i++) {
+		int func = reader.u32();
+		int arg0 = reader.u32();
+		int arg1 = reader.u32();
+		nparam_proc.ops.push_back({func, {arg0, arg1}});
 	}
+	signature_timestamp = reader.u32();
 	
-	debug("[cache] No end");
-	return false;
+	if (reader.failed || reader.cur != reader.end) {
+		debug("[cache] " + std::string(reader.failed ? "Unexpected end of cache" : "Trailing data in cache"));
+		return false;
+	}
+	yt_nparam_compile_transform_plan(nparam_proc);
+	return true;
 }
-
@@ -1,7 +1,9 @@
 #pragma once
+#include <cstdint>
 #include "n_param.hpp"
 #include "cipher.hpp"
 
-std::string yt_procs_to_string(const yt_cipher_transform_procedure &cipher_proc, const yt_nparam_transform_procedure &nparam_proc);
-bool yt_procs_from_string(const std::string &str, yt_cipher_transform_procedure &cipher_proc, yt_nparam_transform_procedure &nparam_proc);
-
+// the binary form of the plans stored in js_cache/ (versioned and checksummed, see cache.cpp)
+std::string yt_procs_to_binary(const yt_cipher_transform_procedure &cipher_proc, const yt_nparam_transform_procedure &nparam_proc, int signature_timestamp);
+// `data` is the whole file, it is read in place
+bool yt_procs_from_binary(const uint8_t *data, size_t size, yt_cipher_transform_procedure &cipher_proc, yt_nparam_transform_procedure &nparam_proc, int &signature_timestamp);
@@ -1,48 +1,53 @@
-#include <regex>
+#include <algorithm>
 #include "internal_common.hpp"
 #include "parser.hpp"
 
 static Json get_initial_data(const std::string &html) {
 	Json res;
 	if (fast_extract_initial(html, "ytInitialData", res)) return res;
-	res = get_succeeding_json_regexes(html, {
-		"window\\[['\\\"]ytInitialData['\\\"]]\\s*=\\s*['\\{]",
-		"ytInitialData\\s*=\\s*['\\{]"
-	});
-	if (res == Json()) return Json::object{{{"Error", "did not match any of the ytInitialData regexes"}}};
-	return res;
+	if (fast_extract_window_initial(html, "ytInitialData", res)) return res;
+	return Json::object{{{"Error", "did not match any of the ytInitialData patterns"}}};
 }
 
-YouTubeChannelDetail youtube_parse_channel_page(std::string url) {
-	YouTubeChannelDetail res;
-	
-	res.url_original = url;
-	
+std::string youtube_get_channel_page_url(std::string url) {
 	url = convert_url_to_mobile(url);
 	
 	// append "/videos" at the end of the url
-	{
-		bool ok = false;
-		for (auto pattern : std::vector<std::string>{"https://m.youtube.com/channel/", "https://m.youtube.com/c/"}) {
-			if (url.substr(0, pattern.size()) == pattern) {
-				url = url.substr(pattern.size(), url.size());
-				auto next_slash = std::find(url.begin(), url.end(), '/');
-				url = pattern + std::string(url.begin(), next_slash) + "/videos";
-				ok = true;
-				break;
-			}
-		}
-		if (!ok) {
-			res.error = "invalid URL : " + url;
-			return res;
+	for (auto pattern : std::vector<std::string>{"https://m.youtube.com/channel/", "https://m.youtube.com/c/"}) {
+		if (url.substr(0, pattern.size()) == pattern) {
+			url = url.substr(pattern.size(), url.size());
+			auto next_slash = std::find(url.begin(), url.end(), '/');
+			return pattern + std::string(url.begin(), next_slash) + "/videos";
 		}
 	}
+	return "";
+}
+
+YouTubeChannelDetail youtube_parse_channel_page(std::string url) {
+	std::string page_url = youtube_get_channel_page_url(url);
+	if (page_url == "") {
+		YouTubeChannelDetail res;
+		res.url_original = url;
+		res.error = "invalid URL : " + convert_url_to_mobile(url);
+		return res;
+	}
 	
-	std::string html = http_get(url);
+	std::string html = http_get(page_url);
 	if (!html.size()) {
+		YouTubeChannelDetail res;
+		res.url_original = url;
 		res.error = "failed to download video page";
 		return res;
 	}
+	return youtube_parse_channel_page_html(url, html);
+}
+
+YouTubeChannelDetail youtube_parse_channel_page_html(const std::string &url_original, const std::string &html) {
+	TRACE_ZONE("youtube_parse_channel_page_html");
+	JsonArena json_arena;
+	YouTubeChannelDetail res;
+	
+	res.url_original = url_original;
 	
 	std::string channel_name = "stub channel name";
 	
@@ -126,7 +131,11 @@ YouTubeChannelDetail youtube_parse_channel_page(std::string url) {
 }
 
 YouTubeChannelDetail youtube_channel_page_continue(const YouTubeChannelDetail &prev_result) {
-	YouTubeChannelDetail new_result = prev_result;
+	JsonArena json_arena;
+	YouTubeChannelDetail new_result; // only the new videos
+	new_result.name = prev_result.name;
+	new_result.continue_token = prev_result.continue_token;
+	new_result.continue_key = prev_result.continue_key;
 	
 	if (prev_result.continue_key == "") {
 		new_result.error = "continue key empty";
@@ -141,8 +150,8 @@ YouTubeChannelDetail youtube_channel_page_continue(const YouTubeChannelDetail &p
 	{
 		std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "continuation": ")"
 			+ prev_result.continue_token + "\"}";
-		post_content = std::regex_replace(post_content, std::regex("%0"), language_code);
-		post_content = std::regex_replace(post_content, std::regex("%1"), country_code);
+		post_content = replace_all(post_content, "%0", language_code);
+		post_content = replace_all(post_content, "%1", country_code);
 		
 		std::string post_url = "https://m.youtube.com/youtubei/v1/browse?key=" + prev_result.continue_key;
 		
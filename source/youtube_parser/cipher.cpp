@@ -53,7 +53,7 @@ static std::string get_initial_function_name_precise(const std::string &js) {
 			2. swap(b) : std::swap(a[0], a[b % a.size()])
 		second : the argument 'b' (if first == 0, this should be ignored)
 */
-yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js) {
+yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js, bool full_detection) {
 	// get initial function name
 	std::string initial_func_content;
 	{
@@ -109,6 +109,7 @@ yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js
 			}
 		}
 		
+		if (!fast_detect_ok && !full_detection) return {};
 		if (!fast_detect_ok) {
 			debug("simple detection failed, conducting full detection");
 			std::string initial_func_name = get_initial_function_name_precise(js);
@@ -230,6 +231,21 @@ yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js
 	return res;
 }
 
+int yt_get_signature_timestamp(const std::string &js) {
+	// signatureTimestamp:19xxx or sts:19xxx
+	for (std::string prefix : {"signatureTimestamp:", "sts:"}) {
+		size_t pos = 0;
+		while ((pos = js.find(prefix, pos)) != std::string::npos) {
+			pos += prefix.size();
+			int res = 0;
+			size_t digits = 0;
+			while (pos < js.size() && isdigit(js[pos]) && digits < 9) res = res * 10 + (js[pos++] - '0'), digits++;
+			if (digits >= 4) return res;
+		}
+	}
+	debug("[cipher] signature timestamp not found");
+	return 0;
+}
 
 std::string yt_deobfuscate_signature(std::string sig, const yt_cipher_transform_procedure &transform_plan) {
 	for (auto i : transform_plan) {
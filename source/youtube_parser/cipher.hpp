@@ -2,5 +2,8 @@
 
 using yt_cipher_transform_procedure = std::vector<std::pair<int, int> >;
 
-yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js);
+// `full_detection` : whether to fall back to the slow regex-based detection, false for a js still being downloaded (it would be run over and over)
+yt_cipher_transform_procedure yt_cipher_get_transform_plan(const std::string &js, bool full_detection = true);
 std::string yt_deobfuscate_signature(std::string sig, const yt_cipher_transform_procedure &transform_plan);
+// the `signatureTimestamp` to send with innertube player requests so that the returned signatures match this js, 0 if not found
+int yt_get_signature_timestamp(const std::string &js);
@@ -1,7 +1,10 @@
-#include <regex>
 #include "internal_common.hpp"
+#include <algorithm>
+#include <cstring>
 
 #ifndef _WIN32
+#include <limits>
+#include <unistd.h>
 #include "network/network_io.hpp"
 #endif
 
@@ -9,13 +12,21 @@ void youtube_change_content_language(std::string language_code) {
 	youtube_parser::language_code = language_code;
 	youtube_parser::country_code = language_code == "en" ? "US" : "JP";
 }
+std::map<std::string, std::string> youtube_get_request_headers() {
+	return {{"Accept-Language", youtube_parser::language_code + ";q=0.9"}};
+}
 
 namespace youtube_parser {
 	std::string language_code = "en";
 	std::string country_code = "US";
 	
 #ifdef _WIN32
+	std::function<bool (const std::string &url, const std::string *post_body, std::string &res)> host_http_hook;
+	
 	std::string http_get(const std::string &url, std::map<std::string, std::string> header) {
+		std::string hooked_res;
+		if (host_http_hook && host_http_hook(url, NULL, hooked_res)) return hooked_res;
+		
 		static int cnt = 0;
 		static const std::string user_agent = "Mozilla/5.0 (Linux; Android 11; Pixel 3a) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/83.0.4103.101 Mobile Safari/537.36";
 		if (!header.count("User-Agent")) header["User-Agent"] = user_agent;
@@ -37,6 +48,9 @@ namespace youtube_parser {
 		return sstream.str();
 	}
 	std::string http_post_json(const std::string &url, const std::string &json) {
+		std::string hooked_res;
+		if (host_http_hook && host_http_hook(url, &json, hooked_res)) return hooked_res;
+		
 		{
 			std::ofstream file("post_tmp.txt");
 			file << json;
@@ -48,82 +62,216 @@ namespace youtube_parser {
 		sstream << file.rdbuf();
 		return sstream.str();
 	}
+	std::string http_get_progressive(const std::string &url, const std::function<bool (const std::string &received)> &on_progress,
+		std::map<std::string, std::string> header) {
+		std::string res = http_get(url, header);
+		on_progress(res);
+		return res;
+	}
 #else
-	static bool thread_network_session_list_inited = false;
-	static NetworkSessionList thread_network_session_list;
-	static void confirm_thread_network_session_list_inited() {
-		if (!thread_network_session_list_inited) {
-			thread_network_session_list_inited = true;
-			thread_network_session_list.init();
+	// the parser is called from several threads at once (e.g. the async task workers), so each call borrows its own session list
+#	define SESSION_LIST_NUM 4
+	static NetworkSessionList session_lists[SESSION_LIST_NUM];
+	static bool session_list_in_use[SESSION_LIST_NUM];
+	static Handle session_lists_lock;
+	static bool session_lists_lock_initialized = false;
+	static NetworkSessionList *borrow_session_list() {
+		while (true) {
+			if (!session_lists_lock_initialized) {
+				session_lists_lock_initialized = true;
+				svcCreateMutex(&session_lists_lock, false);
+			}
+			svcWaitSynchronization(session_lists_lock, std::numeric_limits<s64>::max());
+			NetworkSessionList *res = NULL;
+			for (int i = 0; i < SESSION_LIST_NUM; i++) if (!session_list_in_use[i]) {
+				session_list_in_use[i] = true;
+				if (!session_lists[i].inited) session_lists[i].init();
+				res = &session_lists[i];
+				break;
+			}
+			svcReleaseMutex(session_lists_lock);
+			if (res) return res;
+			usleep(10000);
 		}
 	}
+	static void give_back_session_list(NetworkSessionList *session_list) {
+		svcWaitSynchronization(session_lists_lock, std::numeric_limits<s64>::max());
+		session_list_in_use[session_list - session_lists] = false;
+		svcReleaseMutex(session_lists_lock);
+	}
 	
+	// receive directly into the string so that large pages (watch page html, base.js) are neither reallocated repeatedly nor copied
+	// the string is what the extraction works on afterwards : to_json() parses over it in place, so the body exists only once
+	static NetworkDataSink string_sink(std::string &res) {
+		return [&res] (const u8 *data, size_t size, s64 content_length) {
+			if (content_length > 0 && res.capacity() < (size_t) content_length) res.reserve(content_length);
+			res.append((const char *) data, size);
+			return true;
+		};
+	}
 	std::string http_get(const std::string &url, std::map<std::string, std::string> header) {
-		confirm_thread_network_session_list_inited();
-		if (!header.count("Accept-Language")) header["Accept-Language"] = language_code + ";q=0.9";
+		for (auto i : youtube_get_request_headers()) if (!header.count(i.first)) header[i.first] = i.second;
 		
 		debug("accessing...");
-		auto result = Access_http_get(thread_network_session_list, url, header);
+		std::string res;
+		NetworkSessionList *session_list = borrow_session_list();
+		auto result = Access_http_get_streaming(*session_list, url, header, string_sink(res));
+		give_back_session_list(session_list);
 		if (result.fail) debug("fail : " + result.error);
 		else debug("ok");
 		result.finalize();
-		return std::string(result.data.begin(), result.data.end());
+		return res;
 	}
 	std::string http_post_json(const std::string &url, const std::string &json) {
-		confirm_thread_network_session_list_inited();
 		debug("accessing(POST)...");
-		auto result = Access_http_post(thread_network_session_list, url, {{"Content-Type", "application/json"}}, json);
+		std::string res;
+		NetworkSessionList *session_list = borrow_session_list();
+		auto result = Access_http_post_streaming(*session_list, url, {{"Content-Type", "application/json"}}, json, string_sink(res));
+		give_back_session_list(session_list);
 		if (result.fail) debug("fail : " + result.error);
 		else debug("ok");
 		result.finalize();
-		return std::string(result.data.begin(), result.data.end());
+		return res;
+	}
+	std::string http_get_progressive(const std::string &url, const std::function<bool (const std::string &received)> &on_progress,
+		std::map<std::string, std::string> header) {
+		for (auto i : youtube_get_request_headers()) if (!header.count(i.first)) header[i.first] = i.second;
+		
+		debug("accessing...");
+		std::string res;
+		bool stopped = false;
+		NetworkDataSink sink = string_sink(res);
+		NetworkSessionList *session_list = borrow_session_list();
+		auto result = Access_http_get_streaming(*session_list, url, header, [&] (const u8 *data, size_t size, s64 content_length) {
+			sink(data, size, content_length);
+			if (on_progress(res)) return true;
+			stopped = true;
+			return false;
+		});
+		give_back_session_list(session_list);
+		if (stopped) debug("stopped after " + std::to_string(res.size()) + " bytes");
+		else if (result.fail) debug("fail : " + result.error);
+		else debug("ok");
+		result.finalize();
+		return res;
 	}
 #endif
 	
+	bool starts_with(const std::string &str, const char *pattern, size_t offset) {
+		size_t len = strlen(pattern);
+		return offset <= str.size() && str.size() - offset >= len && !memcmp(str.data() + offset, pattern, len);
+	}
 	bool starts_with(const std::string &str, const std::string &pattern, size_t offset) {
-		return str.substr(offset, pattern.size()) == pattern;
+		return offset <= str.size() && !str.compare(offset, pattern.size(), pattern);
 	}
 	
-	std::string url_decode(std::string input) {
-		std::string res;
-		for (size_t i = 0; i < input.size(); i++) {
-			if (input[i] == '%') {
-				res.push_back((char) stoi(input.substr(i + 1, 2), nullptr, 16));
+	static int hex_value(char c) {
+		if ('0' <= c && c <= '9') return c - '0';
+		if ('a' <= c && c <= 'f') return c - 'a' + 10;
+		if ('A' <= c && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+	// the character of the %XX sequence at str[pos], -1 if it's not a valid one
+	static int percent_decoded(const std::string &str, size_t pos, size_t end) {
+		if (str[pos] != '%' || pos + 2 >= end) return -1;
+		int high = hex_value(str[pos + 1]), low = hex_value(str[pos + 2]);
+		return high < 0 || low < 0 ? -1 : high << 4 | low;
+	}
+	size_t url_decode_in_place(std::string &str, size_t start, size_t end) {
+		end = std::min(end, str.size());
+		size_t out = start;
+		for (size_t i = start; i < end; i++) {
+			int decoded = percent_decoded(str, i, end);
+			if (decoded >= 0) {
+				str[out++] = (char) decoded;
 				i += 2;
-			} else res.push_back(input[i]);
+			} else str[out++] = str[i];
 		}
-		return res;
+		str.erase(out, end - out);
+		return out;
+	}
+	std::string url_decode(std::string input) {
+		url_decode_in_place(input);
+		return input;
 	}
 	
-	// parse something like 'abc=def&ghi=jkl&lmn=opq'
-	std::map<std::string, std::string> parse_parameters(std::string input) {
-		size_t start = 0;
-		std::map<std::string, std::string> res;
-		for (size_t i = 0; i <= input.size(); i++) {
-			if (i == input.size() || input[i] == '&') {
-				std::string first;
-				std::string second;
-				bool is_second = false;
-				for (size_t j = start; j < i; j++) {
-					if (input[j] == '=') is_second = true;
-					else if (is_second) second.push_back(input[j]);
-					else first.push_back(input[j]);
-				}
-				first = url_decode(first);
-				second = url_decode(second);
-				res[first] = second;
-				start = i + 1;
+	UrlParameters::UrlParameters (const std::string &str, size_t start, size_t end) {
+		end = std::min(end, str.size());
+		buffer.reserve(end - start);
+		Entry entry = {0, 0, 0, 0};
+		bool in_value = false;
+		for (size_t i = start; i <= end; i++) {
+			if (i == end || str[i] == '&') {
+				if (in_value) entry.value_len = buffer.size() - entry.value;
+				else entry.key_len = buffer.size() - entry.key, entry.value = buffer.size(), entry.value_len = 0;
+				entries.push_back(entry);
+				entry.key = buffer.size();
+				in_value = false;
+			} else if (str[i] == '=' && !in_value) {
+				entry.key_len = buffer.size() - entry.key;
+				entry.value = buffer.size();
+				in_value = true;
+			} else {
+				int decoded = percent_decoded(str, i, end);
+				if (decoded >= 0) {
+					buffer.push_back((char) decoded);
+					i += 2;
+				} else buffer.push_back(str[i]);
 			}
 		}
-		return res;
+	}
+	const UrlParameters::Entry *UrlParameters::find(const char *name) const {
+		size_t len = strlen(name);
+		for (size_t i = entries.size(); i--; )
+			if (entries[i].key_len == len && !memcmp(buffer.data() + entries[i].key, name, len)) return &entries[i];
+		return NULL;
+	}
+	std::string UrlParameters::get(const char *name) const {
+		const Entry *entry = find(name);
+		return entry ? buffer.substr(entry->value, entry->value_len) : "";
 	}
 
-	std::string get_text_from_object(Json json) {
-		if (json["simpleText"] != Json()) return json["simpleText"].string_value();
-		if (json["runs"] != Json()) {
-			std::string res;
-			for (auto i : json["runs"].array_items()) res += i["text"].string_value();
-			return res;
+	JsonPath::JsonPath (const char *path) {
+		std::string cur_path = path;
+		size_t start = 0;
+		while (start <= cur_path.size()) {
+			size_t end = std::min(cur_path.find('.', start), cur_path.size());
+			std::string cur_key = cur_path.substr(start, end - start);
+			bool is_index = cur_key.size() && std::all_of(cur_key.begin(), cur_key.end(), [] (char c) { return isdigit(c); });
+			keys.push_back(is_index ? "" : cur_key);
+			indexes.push_back(is_index ? atoi(cur_key.c_str()) : -1);
+			start = end + 1;
+		}
+	}
+	const Json *JsonPath::find(const Json &json) const {
+		const Json *cur = &json;
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (indexes[i] >= 0) {
+				auto &array = cur->array_items();
+				if ((size_t) indexes[i] >= array.size()) return nullptr;
+				cur = &array[indexes[i]];
+			} else {
+				auto &object = cur->object_items();
+				auto itr = object.find(keys[i]);
+				if (itr == object.end()) return nullptr;
+				cur = &itr->second;
+			}
+		}
+		return cur;
+	}
+	const Json &JsonPath::operator () (const Json &json) const {
+		static const Json null_json;
+		const Json *res = find(json);
+		return res ? *res : null_json;
+	}
+	
+	std::string get_text_from_object(const Json &json) {
+		static const JsonPath simple_text("simpleText"), runs("runs"), text("text");
+		if (auto res = simple_text.find(json)) return res->string_value();
+		if (auto res = runs.find(json)) {
+			std::string res_str;
+			for (auto &i : res->array_items()) res_str += text(i).string_value();
+			return res_str;
 		}
 		return "";
 	}
@@ -200,9 +348,15 @@ namespace youtube_parser {
 		auto error_json = [&] (std::string error) {
 			return Json::object{{{"Error", error}}};
 		};
-		auto content = remove_garbage(html, start);
 		std::string error;
-		auto res = Json::parse(content, error);
+		Json res;
+		if (start < html.size() && (html[start] == '{' || html[start] == '[')) {
+			// parse directly over `html` : json11 stops at the end of the value, so the garbage doesn't have to be cut off beforehand
+			res = Json::parse_at(html, start, error);
+		} else {
+			auto content = remove_garbage(html, start);
+			res = Json::parse(content, error);
+		}
 		if (error != "") return error_json(error);
 		return res;
 	}
@@ -226,17 +380,48 @@ namespace youtube_parser {
 		}
 		return false;
 	}
-	Json get_succeeding_json_regexes(const std::string &html, std::vector<const char *> patterns) {
-		for (auto pattern_str : patterns) {
-			std::regex pattern = std::regex(std::string(pattern_str));
-			std::smatch match_res;
-			if (std::regex_search(html, match_res, pattern)) {
-				size_t start = match_res.suffix().first - html.begin() - 1;
-				auto res = to_json(html, start);
-				if (res["Error"] == Json()) return res;
+	// search for window['`var_name`'] = ' or window["`var_name`"] = {
+	bool fast_extract_window_initial(const std::string &html, const std::string &var_name, Json &res) {
+		const std::string prefix = "window[";
+		size_t head = 0;
+		while (head < html.size()) {
+			auto pos = html.find(var_name, head);
+			if (pos == std::string::npos) break;
+			head = pos + var_name.size();
+			if (pos < prefix.size() + 1 || (html[pos - 1] != '\'' && html[pos - 1] != '"')) continue;
+			if (html.compare(pos - 1 - prefix.size(), prefix.size(), prefix)) continue;
+			char quote = html[pos - 1];
+			pos = head;
+			if (pos + 1 >= html.size() || html[pos] != quote || html[pos + 1] != ']') continue;
+			pos += 2;
+			while (pos < html.size() && isspace(html[pos])) pos++;
+			if (pos >= html.size() || html[pos] != '=') continue;
+			pos++;
+			while (pos < html.size() && isspace(html[pos])) pos++;
+			if (pos < html.size() && (html[pos] == '\'' || html[pos] == '{')) {
+				res = to_json(html, pos);
+				if (res["Error"] == Json()) return true;
+			}
+		}
+		return false;
+	}
+	
+	std::string replace_all(std::string str, const std::string &from, const std::string &to) {
+		if (!from.size()) return str;
+		for (size_t pos = str.find(from); pos != std::string::npos; pos = str.find(from, pos + to.size())) str.replace(pos, from.size(), to);
+		return str;
+	}
+	std::pair<size_t, size_t> find_url_parameter(const std::string &url, const std::string &name) {
+		size_t query_start = url.find('?');
+		if (query_start == std::string::npos) return {std::string::npos, std::string::npos};
+		for (size_t pos = query_start; pos != std::string::npos; pos = url.find('&', pos + 1)) {
+			if (!url.compare(pos + 1, name.size(), name) && pos + 1 + name.size() < url.size() && url[pos + 1 + name.size()] == '=') {
+				size_t start = pos + 1 + name.size() + 1;
+				size_t end = std::min(url.find('&', start), url.size());
+				if (end > start) return {start, end};
 			}
 		}
-		return Json();
+		return {std::string::npos, std::string::npos};
 	}
 
 	std::string convert_url_to_mobile(std::string url) {
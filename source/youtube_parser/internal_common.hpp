@@ -1,6 +1,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <functional>
 #include "json11/json11.hpp"
 
 #ifdef _WIN32
@@ -18,6 +19,8 @@
 	typedef int64_t s64;
 
 #	define debug(s) std::cerr << (s) << std::endl
+#	define TRACE_ZONE(name)
+#	define METRICS_ADD(metric)
 #else // if it's a 3ds...
 #	include "types.hpp"
 #	include "system/util/log.hpp"
@@ -26,8 +29,11 @@
 #	include "system/util/history.hpp"
 #	include "system/util/misc_tasks.hpp"
 #	include "system/cpu_limit.hpp"
+#	include "system/util/trace.hpp"
+#	include "system/util/metrics.hpp"
 #	include "definitions.hpp"
 #	define debug(s) Util_log_save("yt-parser", (s))
+#	define METRICS_ADD(metric) metrics_add(Metric::metric)
 #endif
 
 
@@ -39,16 +45,62 @@ namespace youtube_parser {
 	
 	std::string http_get(const std::string &url, std::map<std::string, std::string> header = {});
 	std::string http_post_json(const std::string &url, const std::string &json);
+	// same as http_get(), but `on_progress` is given the body received so far after each piece of it, and returning false stops the download
+	// (what has been received until then is returned), on the host it's called once with the whole body
+	std::string http_get_progressive(const std::string &url, const std::function<bool (const std::string &received)> &on_progress,
+		std::map<std::string, std::string> header = {});
+#ifdef _WIN32
+	// if set, asked first by http_get() (post_body == NULL) and http_post_json(), returns false to fall back to the real network
+	// used by tools/parser_bench to replay saved pages
+	extern std::function<bool (const std::string &url, const std::string *post_body, std::string &res)> host_http_hook;
+#endif
 	
+	// the helpers below are called for every url and format of a page, so they compare and decode in place instead of cutting out substrings
+	bool starts_with(const std::string &str, const char *pattern, size_t offset = 0);
 	bool starts_with(const std::string &str, const std::string &pattern, size_t offset = 0);
 	
+	// decodes the %XX sequences of str[start, end) in place (a malformed one is kept as it is) and returns the new end
+	size_t url_decode_in_place(std::string &str, size_t start = 0, size_t end = std::string::npos);
 	std::string url_decode(std::string input);
 	
-	// parse something like 'abc=def&ghi=jkl&lmn=opq'
-	std::map<std::string, std::string> parse_parameters(std::string input);
+	// the parameters of something like 'abc=def&ghi=jkl&lmn=opq', decoded into one buffer and looked up linearly
+	// (there are only a handful of them, a map would allocate a node and two strings for each)
+	class UrlParameters {
+		struct Entry {
+			size_t key;
+			size_t key_len;
+			size_t value;
+			size_t value_len;
+		};
+		std::string buffer;
+		std::vector<Entry> entries;
+		const Entry *find(const char *name) const;
+	public :
+		// parses str[start, end)
+		UrlParameters (const std::string &str, size_t start = 0, size_t end = std::string::npos);
+		bool has(const char *name) const { return find(name); }
+		// the value of the last parameter named `name`, "" if there's no such parameter
+		std::string get(const char *name) const;
+	};
 
-	std::string get_text_from_object(Json json);
+	// a chain of object keys and array indexes like "continuationEndpoint.continuationCommand.token" or "contents.0.title"
+	// it is split once, so hold it in a static variable : a chained operator[] with literals constructs (and, for long keys, allocates) a std::string for every key on every call
+	class JsonPath {
+		std::vector<std::string> keys;
+		std::vector<int> indexes; // -1 where the element is an object key
+	public :
+		JsonPath (const char *path);
+		// the value at the path, or nullptr if any part of it is missing
+		const Json *find(const Json &json) const;
+		// the value at the path, or a null Json if any part of it is missing (the same as the chained operator[])
+		const Json &operator () (const Json &json) const;
+	};
+	
+	std::string get_text_from_object(const Json &json);
 
+	// the youtube_parse_* and continuation functions declare a JsonArena first thing, so that the DOMs of a call are freed at once
+	// (see json11.hpp) : a Json must never be kept past the call that parsed it, only the strings etc. copied out of it
+	
 	// str[0] must be '(', '[', '{', or '\''
 	// returns the prefix of str until the corresponding parenthesis or quote of str[0]
 	std::string remove_garbage(const std::string &str, size_t start);
@@ -58,7 +110,12 @@ namespace youtube_parser {
 	// search for `var_name` = ' or `var_name` = {
 	bool fast_extract_initial(const std::string &html, const std::string &var_name, Json &res);
 	
-	Json get_succeeding_json_regexes(const std::string &html, std::vector<const char *> patterns);
+	// search for window['`var_name`'] = ' or window["`var_name`"] = {
+	bool fast_extract_window_initial(const std::string &html, const std::string &var_name, Json &res);
+	
+	std::string replace_all(std::string str, const std::string &from, const std::string &to);
+	// returns the range of the value of the query parameter `name` in `url` ({npos, npos} if it's not there or empty)
+	std::pair<size_t, size_t> find_url_parameter(const std::string &url, const std::string &name);
 
 	std::string convert_url_to_mobile(std::string url);
 	std::string convert_url_to_desktop(std::string url);
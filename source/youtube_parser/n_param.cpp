@@ -315,7 +315,11 @@ yt_nparam_transform_procedure yt_nparam_get_transform_plan(const std::string &js
 	auto ops = get_ops(func_content);
 	if (!c.size() || !ops.size()) return {};
 	
-	return {c, ops};
+	yt_nparam_transform_procedure res;
+	res.c = c;
+	res.ops = ops;
+	yt_nparam_compile_transform_plan(res);
+	return res;
 }
 
 
@@ -372,99 +376,155 @@ template<typename T> static void op_cipher(const std::string &internal_arg, std:
 		f--;
 	}
 }
-std::string yt_modify_nparam(std::string n_param_org, const yt_nparam_transform_procedure &transform_plan) {
-	std::vector<char> n_param(n_param_org.begin(), n_param_org.end());
+// the ops only ever move the elements of `c` around by the constants in it and modify its strings with each other, none of which depends on 'n'
+// so they can be run once here, leaving only the ones modifying 'n' (with their arguments resolved) for yt_modify_nparam()
+void yt_nparam_compile_transform_plan(yt_nparam_transform_procedure &transform_plan) {
+	transform_plan.compiled = true;
+	transform_plan.valid = false;
+	transform_plan.n_ops.clear();
+	auto &n_ops = transform_plan.n_ops;
 	auto c = transform_plan.c;
+	auto emit = [&] (FunctionType function, int64_t arg) {
+		NParamOp op;
+		op.function = function;
+		op.arg = arg;
+		n_ops.push_back(op);
+	};
 	for (auto op : transform_plan.ops) {
 		int func_index = op.first;
 		int arg0_index = op.second.first;
 		int arg1_index = op.second.second;
 		if (func_index < 0 || func_index >= (int) c.size()) {
 			debug("[nparam] func index out of bound");
-			return n_param_org;
+			return;
 		}
 		if (arg0_index < 0 || arg0_index >= (int) c.size()) {
 			debug("[nparam] arg0 index out of bound");
-			return n_param_org;
+			return;
 		}
 		if (arg1_index != -1 && (arg1_index < 0 || arg1_index >= (int) c.size())) {
 			debug("[nparam] arg1 index out of bound");
-			return n_param_org;
+			return;
 		}
 		if (c[func_index].type != CArrayContent::Type::FUNCTION) {
 			debug("function expected");
-			return n_param_org;
+			return;
 		}
 		if (c[func_index].function == FunctionType::ROTATE_RIGHT) {
 			if (arg1_index == -1 || c[arg1_index].type != CArrayContent::Type::INTEGER) {
 				debug("rotate_right : integer expected as arg1");
-				return n_param_org;
+				return;
 			}
 			int64_t arg1 = c[arg1_index].integer;
 			if (c[arg0_index].type == CArrayContent::Type::SELF) op_rotate_right(c, arg1);
-			else if (c[arg0_index].type == CArrayContent::Type::N) op_rotate_right(n_param, arg1);
+			else if (c[arg0_index].type == CArrayContent::Type::N) emit(FunctionType::ROTATE_RIGHT, arg1);
 			else if (c[arg0_index].type == CArrayContent::Type::STRING) op_rotate_right(c[arg0_index].string, arg1);
 			else {
 				debug("rotate_right : unknown arg0 type : " + c[arg0_index].to_string());
-				return n_param_org;
+				return;
 			}
 		} else if (c[func_index].function == FunctionType::REVERSE) {
 			if (c[arg0_index].type == CArrayContent::Type::SELF) op_reverse(c);
-			else if (c[arg0_index].type == CArrayContent::Type::N) op_reverse(n_param);
+			else if (c[arg0_index].type == CArrayContent::Type::N) emit(FunctionType::REVERSE, 0);
 			else if (c[arg0_index].type == CArrayContent::Type::STRING) op_reverse(c[arg0_index].string);
 			else {
 				debug("reverse : unknown arg0 type : " + c[arg0_index].to_string());
-				return n_param_org;
+				return;
 			}
 		} else if (c[func_index].function == FunctionType::PUSH) {
 			if (arg1_index == -1) {
 				debug("push : arg1 expected");
-				return n_param_org;
+				return;
 			}
 			if (c[arg0_index].type == CArrayContent::Type::SELF) c.push_back((CArrayContent) c[arg1_index]);
 			else {
 				debug("reverse : unknown arg0 type : " + c[arg0_index].to_string());
-				return n_param_org;
+				return;
 			}
 		} else if (c[func_index].function == FunctionType::SWAP) {
 			if (arg1_index == -1 || c[arg1_index].type != CArrayContent::Type::INTEGER) {
 				debug("swap : integer expected as arg1");
-				return n_param_org;
+				return;
 			}
 			int64_t arg1 = c[arg1_index].integer;
 			if (c[arg0_index].type == CArrayContent::Type::SELF) op_swap(c, arg1);
-			else if (c[arg0_index].type == CArrayContent::Type::N) op_swap(n_param, arg1);
+			else if (c[arg0_index].type == CArrayContent::Type::N) emit(FunctionType::SWAP, arg1);
 			else if (c[arg0_index].type == CArrayContent::Type::STRING) op_swap(c[arg0_index].string, arg1);
 			else {
 				debug("swap : unknown arg0 type : " + c[arg0_index].to_string());
-				return n_param_org;
+				return;
 			}
 		} else if (c[func_index].function == FunctionType::CIPHER) {
 			if (arg1_index == -1 || c[arg1_index].type != CArrayContent::Type::STRING) {
 				debug("cipher : string expected as arg1");
-				return n_param_org;
+				return;
 			}
-			if (c[arg0_index].type == CArrayContent::Type::N) op_cipher(c[func_index].function_internal_arg, n_param, c[arg1_index].string);
-			else if (c[arg0_index].type == CArrayContent::Type::STRING) op_cipher(c[func_index].function_internal_arg, c[arg0_index].string, c[arg1_index].string);
+			if (c[arg0_index].type == CArrayContent::Type::N) {
+				emit(FunctionType::CIPHER, 0);
+				auto &cur_op = n_ops.back();
+				cur_op.cipher_chars = c[func_index].function_internal_arg;
+				cur_op.cipher_key = c[arg1_index].string;
+				for (int i = 0; i < 256; i++) cur_op.cipher_char_index[i] = cur_op.cipher_chars.size();
+				for (int i = cur_op.cipher_chars.size() - 1; i >= 0; i--) cur_op.cipher_char_index[(unsigned char) cur_op.cipher_chars[i]] = i;
+			} else if (c[arg0_index].type == CArrayContent::Type::STRING) op_cipher(c[func_index].function_internal_arg, c[arg0_index].string, c[arg1_index].string);
 			else debug("cipher : unknown arg0 type : " + c[arg0_index].to_string());
 		} else if (c[func_index].function == FunctionType::SPLICE) {
 			if (arg1_index == -1 || c[arg1_index].type != CArrayContent::Type::INTEGER) {
 				debug("splice : integer expected as arg1");
-				return n_param_org;
+				return;
 			}
 			int64_t arg1 = c[arg1_index].integer;
 			if (c[arg0_index].type == CArrayContent::Type::SELF) op_splice(c, arg1, 1);
-			else if (c[arg0_index].type == CArrayContent::Type::N) op_splice(n_param, arg1, 1);
+			else if (c[arg0_index].type == CArrayContent::Type::N) emit(FunctionType::SPLICE, arg1);
 			else if (c[arg0_index].type == CArrayContent::Type::STRING) op_splice(c[arg0_index].string, arg1, 1);
 			else {
 				debug("splice : unknown arg0 type : " + c[arg0_index].to_string());
-				return n_param_org;
+				return;
 			}
 		} else {
 			debug("[nparam] : unknown function : " + c[arg0_index].to_string());
-			return n_param_org;
+			return;
 		}
 	}
+	transform_plan.valid = true;
+}
+
+// the same as op_cipher() on `n` in place : the key grows by the characters produced, which are the ones already written back to `n`
+static void run_cipher(const NParamOp &op, std::string &n) {
+	if (!op.cipher_chars.size()) return;
+	int key_size = op.cipher_key.size();
+	int f = 96;
+	for (int i = 0; i < (int) n.size(); i++) {
+		char key_char = i < key_size ? op.cipher_key[i] : n[i - key_size];
+		int bracket_val = op.cipher_char_index[(unsigned char) n[i]] - op.cipher_char_index[(unsigned char) key_char] + i - 32 + f;
+		bracket_val %= op.cipher_chars.size();
+		if (bracket_val < 0) {
+			debug("[nparam] unexpected OoB error in op_cipher()");
+			return;
+		}
+		n[i] = op.cipher_chars[bracket_val];
+		f--;
+	}
+}
+std::string yt_modify_nparam(std::string n_param, const yt_nparam_transform_procedure &transform_plan) {
+	if (!transform_plan.compiled) {
+		yt_nparam_transform_procedure compiled_plan = transform_plan;
+		yt_nparam_compile_transform_plan(compiled_plan);
+		return yt_modify_nparam(n_param, compiled_plan);
+	}
+	if (!transform_plan.valid) return n_param;
 	
-	return std::string(n_param.begin(), n_param.end());
+	for (auto &op : transform_plan.n_ops) {
+		if (!n_param.size()) {
+			if (op.function != FunctionType::REVERSE) debug("[nparam] n_param.size() == 0");
+			continue;
+		}
+		int64_t arg = normalize(n_param.size(), op.arg);
+		if (op.function == FunctionType::ROTATE_RIGHT) std::rotate(n_param.begin(), n_param.end() - arg, n_param.end());
+		else if (op.function == FunctionType::REVERSE) std::reverse(n_param.begin(), n_param.end());
+		else if (op.function == FunctionType::SWAP) std::swap(n_param[0], n_param[arg]);
+		else if (op.function == FunctionType::SPLICE) n_param.erase(n_param.begin() + arg);
+		else if (op.function == FunctionType::CIPHER) run_cipher(op, n_param);
+	}
+	return n_param;
 }
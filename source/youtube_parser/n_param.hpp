@@ -33,10 +33,26 @@ struct NParamCArrayContent {
 		return "unknown";
 	}
 };
+// an op of a compiled plan, which always applies to 'n'
+struct NParamOp {
+	NParamFunctionType function; // anything but PUSH
+	int64_t arg; // for ROTATE_RIGHT, SWAP and SPLICE
+	// for CIPHER
+	std::string cipher_chars;
+	std::vector<char> cipher_key;
+	int cipher_char_index[256]; // the first position of each character in cipher_chars, cipher_chars.size() if not found
+};
 struct yt_nparam_transform_procedure {
 	std::vector<NParamCArrayContent> c;
 	std::vector<std::pair<int, std::pair<int, int> > > ops; // {func, {arg0, arg1}}
+	
+	// filled by yt_nparam_compile_transform_plan()
+	bool compiled = false;
+	bool valid = false; // false if the plan fails regardless of 'n', in which case 'n' is left as it is
+	std::vector<NParamOp> n_ops;
 };
 
-yt_nparam_transform_procedure yt_nparam_get_transform_plan(const std::string &js);
+yt_nparam_transform_procedure yt_nparam_get_transform_plan(const std::string &js); // the result is already compiled
+// resolves everything in `c` and `ops` that doesn't depend on 'n' into `n_ops`, should be called whenever `c` or `ops` is changed
+void yt_nparam_compile_transform_plan(yt_nparam_transform_procedure &transform_plan);
 std::string yt_modify_nparam(std::string n_param, const yt_nparam_transform_procedure &transform_plan);
@@ -1,4 +1,4 @@
-#include <regex>
+#include <cstring>
 #include "internal_common.hpp"
 #include "parser.hpp"
 
@@ -23,25 +23,26 @@ static Json get_initial_data(const std::string &html) {
 		}
 	}
 	if (res != Json()) return res;
-	res = get_succeeding_json_regexes(html, {
-		"ytInitialData\\s*=\\s*['\\{]",
-		"window\\[['\\\"]ytInitialData['\\\"]]\\s*=\\s*['\\{]"
-	});
-	if (res == Json()) return Json::object{{{"Error", "did not match any of the ytInitialData regexes"}}};
-	return res;
+	if (fast_extract_window_initial(html, "ytInitialData", res)) return res;
+	return Json::object{{{"Error", "did not match any of the ytInitialData patterns"}}};
 }
 
-static bool parse_searched_item(Json content, std::vector<YouTubeSuccinctItem> &res) {
-	if (content["compactVideoRenderer"] != Json()) {
-		auto video_renderer = content["compactVideoRenderer"];
+static bool parse_searched_item(const Json &content, std::vector<YouTubeSuccinctItem> &res) {
+	static const JsonPath compact_video_renderer("compactVideoRenderer"), compact_channel_renderer("compactChannelRenderer"),
+		compact_radio_renderer("compactRadioRenderer"), compact_playlist_renderer("compactPlaylistRenderer");
+	const Json *playlist_renderer_ptr = nullptr;
+	if (auto video_renderer_ptr = compact_video_renderer.find(content)) {
+		static const JsonPath video_id_path("videoId"), title("title"), length_text("lengthText"), published_time_text("publishedTimeText"),
+			short_view_count_text("shortViewCountText"), short_byline_text("shortBylineText");
+		const Json &video_renderer = *video_renderer_ptr;
 		YouTubeVideoSuccinct cur_result;
-		std::string video_id = video_renderer["videoId"].string_value();
+		std::string video_id = video_id_path(video_renderer).string_value();
 		cur_result.url = "https://m.youtube.com/watch?v=" + video_id;
-		cur_result.title = get_text_from_object(video_renderer["title"]);
-		cur_result.duration_text = get_text_from_object(video_renderer["lengthText"]);
-		cur_result.publish_date = get_text_from_object(video_renderer["publishedTimeText"]);
-		cur_result.views_str = get_text_from_object(video_renderer["shortViewCountText"]);
-		cur_result.author = get_text_from_object(video_renderer["shortBylineText"]);
+		cur_result.title = get_text_from_object(title(video_renderer));
+		cur_result.duration_text = get_text_from_object(length_text(video_renderer));
+		cur_result.publish_date = get_text_from_object(published_time_text(video_renderer));
+		cur_result.views_str = get_text_from_object(short_view_count_text(video_renderer));
+		cur_result.author = get_text_from_object(short_byline_text(video_renderer));
 		cur_result.thumbnail_url = "https://i.ytimg.com/vi/" + video_id + "/default.jpg";
 		/*
 		{ // extract thumbnail url
@@ -58,24 +59,26 @@ static bool parse_searched_item(Json content, std::vector<YouTubeSuccinctItem> &
 		}*/
 		res.push_back(YouTubeSuccinctItem(cur_result));
 		return true;
-	} else if (content["compactChannelRenderer"] != Json()) {
-		auto channel_renderer = content["compactChannelRenderer"];
+	} else if (auto channel_renderer_ptr = compact_channel_renderer.find(content)) {
+		static const JsonPath display_name("displayName"), channel_id("channelId"), subscriber_count_text("subscriberCountText"),
+			video_count_text("videoCountText"), thumbnails("thumbnail.thumbnails"), height("height"), url("url");
+		const Json &channel_renderer = *channel_renderer_ptr;
 		YouTubeChannelSuccinct cur_result;
-		cur_result.name = get_text_from_object(channel_renderer["displayName"]);
-		cur_result.url = "https://m.youtube.com/channel/" + channel_renderer["channelId"].string_value();
-		cur_result.subscribers = get_text_from_object(channel_renderer["subscriberCountText"]);
-		cur_result.video_num = get_text_from_object(channel_renderer["videoCountText"]);
+		cur_result.name = get_text_from_object(display_name(channel_renderer));
+		cur_result.url = "https://m.youtube.com/channel/" + channel_id(channel_renderer).string_value();
+		cur_result.subscribers = get_text_from_object(subscriber_count_text(channel_renderer));
+		cur_result.video_num = get_text_from_object(video_count_text(channel_renderer));
 		
 		{
 			constexpr int target_height = 70;
 			int min_distance = 100000;
 			std::string best_icon;
-			for (auto icon : channel_renderer["thumbnail"]["thumbnails"].array_items()) {
-				int cur_height = icon["height"].int_value();
+			for (auto &icon : thumbnails(channel_renderer).array_items()) {
+				int cur_height = height(icon).int_value();
 				if (cur_height >= 256) continue; // too large
 				if (min_distance > std::abs(target_height - cur_height)) {
 					min_distance = std::abs(target_height - cur_height);
-					best_icon = icon["url"].string_value();
+					best_icon = url(icon).string_value();
 				}
 			}
 			cur_result.icon_url = best_icon;
@@ -85,21 +88,23 @@ static bool parse_searched_item(Json content, std::vector<YouTubeSuccinctItem> &
 		
 		res.push_back(YouTubeSuccinctItem(cur_result));
 		return true;
-	} else if (content["compactRadioRenderer"] != Json() || content["compactPlaylistRenderer"] != Json()) {
-		auto playlist_renderer = content["compactRadioRenderer"];
-		if (playlist_renderer == Json()) playlist_renderer = content["compactPlaylistRenderer"];
+	} else if ((playlist_renderer_ptr = compact_radio_renderer.find(content)) || compact_playlist_renderer.find(content)) {
+		static const JsonPath title("title"), video_count_text("videoCountText"), thumbnails("thumbnail.thumbnails"), url("url"), share_url("shareUrl");
+		const Json &playlist_renderer = playlist_renderer_ptr ? *playlist_renderer_ptr : compact_playlist_renderer(content);
 		
 		YouTubePlaylistSuccinct cur_list;
-		cur_list.title = get_text_from_object(playlist_renderer["title"]);
-		cur_list.video_count_str = get_text_from_object(playlist_renderer["videoCountText"]);
-		for (auto thumbnail : playlist_renderer["thumbnail"]["thumbnails"].array_items())
-			if (thumbnail["url"].string_value().find("/default.jpg") != std::string::npos) cur_list.thumbnail_url = thumbnail["url"].string_value();
+		cur_list.title = get_text_from_object(title(playlist_renderer));
+		cur_list.video_count_str = get_text_from_object(video_count_text(playlist_renderer));
+		for (auto &thumbnail : thumbnails(playlist_renderer).array_items()) {
+			const std::string &cur_url = url(thumbnail).string_value();
+			if (cur_url.find("/default.jpg") != std::string::npos) cur_list.thumbnail_url = cur_url;
+		}
 		
-		cur_list.url = convert_url_to_mobile(playlist_renderer["shareUrl"].string_value());
+		cur_list.url = convert_url_to_mobile(share_url(playlist_renderer).string_value());
 		if (!starts_with(cur_list.url, "https://m.youtube.com/watch", 0)) {
 			if (starts_with(cur_list.url, "https://m.youtube.com/playlist?", 0)) {
-				auto params = parse_parameters(cur_list.url.substr(std::string("https://m.youtube.com/playlist?").size(), cur_list.url.size()));
-				auto playlist_id = params["list"];
+				UrlParameters params(cur_list.url, strlen("https://m.youtube.com/playlist?"));
+				auto playlist_id = params.get("list");
 				auto video_id = get_video_id_from_thumbnail_url(cur_list.thumbnail_url);
 				cur_list.url = "https://m.youtube.com/watch?v=" + video_id + "&list=" + playlist_id;
 			} else {
@@ -114,6 +119,8 @@ static bool parse_searched_item(Json content, std::vector<YouTubeSuccinctItem> &
 }
 
 YouTubeSearchResult youtube_parse_search(std::string url) {
+	TRACE_ZONE("youtube_parse_search");
+	JsonArena json_arena;
 	YouTubeSearchResult res;
 	
 	url = convert_url_to_mobile(url);
@@ -138,10 +145,17 @@ YouTubeSearchResult youtube_parse_search(std::string url) {
 		}
 	}
 	{
-		std::regex pattern(std::string(R"***("INNERTUBE_API_KEY":"([\w-]+)")***"));
-		std::smatch match_result;
-		if (std::regex_search(html, match_result, pattern)) {
-			res.continue_key = match_result[1].str();
+		// "INNERTUBE_API_KEY":"([\w-]+)"
+		const std::string key_prefix = "\"INNERTUBE_API_KEY\":\"";
+		size_t start = html.find(key_prefix);
+		size_t end = start;
+		if (start != std::string::npos) {
+			start += key_prefix.size();
+			end = start;
+			while (end < html.size() && (isalnum(html[end]) || html[end] == '_' || html[end] == '-')) end++;
+		}
+		if (start != std::string::npos && end > start && end < html.size() && html[end] == '"') {
+			res.continue_key = html.substr(start, end - start);
 		} else {
 			debug("INNERTUBE_API_KEY not found");
 			res.error = "INNERTUBE_API_KEY not found";
@@ -157,7 +171,11 @@ YouTubeSearchResult youtube_parse_search(std::string url) {
 	return res;
 }
 YouTubeSearchResult youtube_continue_search(const YouTubeSearchResult &prev_result) {
-	YouTubeSearchResult new_result = prev_result;
+	JsonArena json_arena;
+	YouTubeSearchResult new_result; // only the new items
+	new_result.estimated_result_num = prev_result.estimated_result_num;
+	new_result.continue_token = prev_result.continue_token;
+	new_result.continue_key = prev_result.continue_key;
 	
 	if (prev_result.continue_key == "") {
 		new_result.error = "continue key empty";
@@ -173,8 +191,8 @@ YouTubeSearchResult youtube_continue_search(const YouTubeSearchResult &prev_resu
 	{
 		std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "continuation": ")"
 			+ prev_result.continue_token + "\"}";
-		post_content = std::regex_replace(post_content, std::regex("%0"), language_code);
-		post_content = std::regex_replace(post_content, std::regex("%1"), country_code);
+		post_content = replace_all(post_content, "%0", language_code);
+		post_content = replace_all(post_content, "%1", country_code);
 		
 		std::string post_url = "https://m.youtube.com/youtubei/v1/search?key=" + prev_result.continue_key;
 		
@@ -211,3 +229,26 @@ YouTubeSearchResult youtube_continue_search(const YouTubeSearchResult &prev_resu
 	if (new_result.continue_token == "") debug("failed to get next continue token");
 	return new_result;
 }
+
+std::string youtube_get_search_suggestions_url(const std::string &query) {
+	std::string res = "https://suggestqueries.google.com/complete/search?client=firefox&ds=yt&ie=utf-8&oe=utf-8&hl=" + language_code + "&gl=" + country_code + "&q=";
+	for (auto c : query) {
+		if (isalnum((u8) c)) res.push_back(c);
+		else {
+			res.push_back('%');
+			res.push_back("0123456789ABCDEF"[(u8) c / 16]);
+			res.push_back("0123456789ABCDEF"[(u8) c % 16]);
+		}
+	}
+	return res;
+}
+// ["query", ["suggestion 0", "suggestion 1", ...], ...]
+std::vector<std::string> youtube_parse_search_suggestions(const std::string &response) {
+	JsonArena json_arena;
+	std::vector<std::string> res;
+	std::string json_err;
+	Json json = Json::parse(response, json_err);
+	if (json_err != "" || !json.is_array()) return res;
+	for (auto &item : json[1].array_items()) if (item.is_string() && item.string_value() != "") res.push_back(item.string_value());
+	return res;
+}
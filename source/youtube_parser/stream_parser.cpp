@@ -1,53 +1,140 @@
-#include <regex>
+#include <limits>
+#include <list>
+#include <cstring>
 #include "internal_common.hpp"
 #include "parser.hpp"
 #include "cipher.hpp"
 #include "n_param.hpp"
 #include "cache.hpp"
+#ifndef _WIN32
+#include "system/thread_placement.hpp"
+#endif
 
 
 static Json get_initial_data(const std::string &html) {
 	Json res;
 	if (fast_extract_initial(html, "ytInitialData", res)) return res;
-	res = get_succeeding_json_regexes(html, {
-		"ytInitialData\\s*=\\s*['\\{]",
-		"window\\[['\\\"]ytInitialData['\\\"]]\\s*=\\s*['\\{]"
-	});
-	if (res == Json()) return Json::object{{{"Error", "did not match any of the ytInitialData regexes"}}};
-	return res;
+	if (fast_extract_window_initial(html, "ytInitialData", res)) return res;
+	return Json::object{{{"Error", "did not match any of the ytInitialData patterns"}}};
 }
 static Json initial_player_response(const std::string &html) {
 	Json res;
 	if (fast_extract_initial(html, "ytInitialPlayerResponse", res)) return res;
-	res = get_succeeding_json_regexes(html, {
-		"window\\[['\\\"]ytInitialPlayerResponse['\\\"]]\\s*=\\s*['\\{]",
-		"ytInitialPlayerResponse\\s*=\\s*['\\{]"
-	});
-	if (res == Json()) return Json::object{{{"Error", "did not match any of the ytInitialPlayerResponse regexes"}}};
-	return res;
+	if (fast_extract_window_initial(html, "ytInitialPlayerResponse", res)) return res;
+	return Json::object{{{"Error", "did not match any of the ytInitialPlayerResponse patterns"}}};
+}
+
+#define MAX_CACHED_PLAYER_JS 4
+#define MAX_JS_CACHE_FILE_SIZE 0x4000
+// the plans are looked for in the part of the js received so far every this many bytes, and the download stops once
+// two looks in a row find the same ones (so that a function cut off at the end of the first look isn't taken as it is)
+#define JS_PROBE_INTERVAL (256 * 1024)
+struct PlayerJsPlans {
+	std::string js_url;
+	yt_cipher_transform_procedure cipher_proc;
+	yt_nparam_transform_procedure nparam_proc;
+	int signature_timestamp = 0;
+	std::map<std::string, std::string> nparam_results;
+};
+// the plans of the last few player js, most recently used first, so that going back and forth between videos never reads the sd card
+static std::list<PlayerJsPlans> player_js_plans_cache;
+// the cache above is shared by all the threads calling the parser
+struct TransformCacheLock {
+#ifndef _WIN32
+	static Handle handle;
+	static bool initialized;
+	TransformCacheLock() {
+		if (!initialized) {
+			initialized = true;
+			svcCreateMutex(&handle, false);
+		}
+		svcWaitSynchronization(handle, std::numeric_limits<s64>::max());
+	}
+	~TransformCacheLock() { svcReleaseMutex(handle); }
+#else
+	~TransformCacheLock() {} // the host build is single threaded, but the guards must not count as unused variables
+#endif
+};
+#ifndef _WIN32
+Handle TransformCacheLock::handle;
+bool TransformCacheLock::initialized = false;
+#endif
+// what an innertube player request needs but can only be learned from a scraped page, "" until then (TransformCacheLock must be held)
+static std::string latest_js_url;
+static std::string innertube_api_key;
+
+static PlayerJsPlans *find_player_js_plans(const std::string &js_url) {
+	for (auto itr = player_js_plans_cache.begin(); itr != player_js_plans_cache.end(); itr++) if (itr->js_url == js_url) {
+		player_js_plans_cache.splice(player_js_plans_cache.begin(), player_js_plans_cache, itr);
+		return &player_js_plans_cache.front();
+	}
+	return nullptr;
+}
+static PlayerJsPlans *add_player_js_plans(PlayerJsPlans &&plans) {
+	player_js_plans_cache.push_front(std::move(plans));
+	while (player_js_plans_cache.size() > MAX_CACHED_PLAYER_JS) player_js_plans_cache.pop_back();
+	return &player_js_plans_cache.front();
 }
 
-static std::map<std::string, yt_cipher_transform_procedure> cipher_transform_proc_cache;
-static std::map<std::string, yt_nparam_transform_procedure> nparam_transform_proc_cache;
-static std::map<std::pair<std::string, std::string>, std::string> nparam_transform_results_cache;
-static bool extract_stream(YouTubeVideoDetail &res, const std::string &html) {
-	Json player_response = initial_player_response(html);
+#define STORYBOARD_MAX_FRAME_WIDTH 160 // the preview is drawn 128 px wide, so a larger level would only cost memory
+
+static std::vector<std::string> split_string(const std::string &str, char delimiter) {
+	std::vector<std::string> res;
+	size_t start = 0;
+	while (true) {
+		size_t end = str.find(delimiter, start);
+		if (end == std::string::npos) {
+			res.push_back(str.substr(start));
+			return res;
+		}
+		res.push_back(str.substr(start, end - start));
+		start = end + 1;
+	}
+}
+// spec : "url_template|level0|level1|..." where each level is "width#height#frame_num#cols#rows#interval_ms#name#sigh"
+// in the url template, $L is replaced by the level index and $N by the name, in which $M is the sheet index
+static void extract_storyboard(Json player_response, YouTubeVideoDetail &res) {
+	std::string spec = player_response["storyboards"]["playerStoryboardSpecRenderer"]["spec"].string_value();
+	if (spec == "") return;
+	auto parts = split_string(spec, '|');
 	
-	res.playability_status = player_response["playabilityStatus"]["status"].string_value();
-	res.playability_reason = player_response["playabilityStatus"]["reason"].string_value();
-	res.is_upcoming = player_response["videoDetails"]["isUpcoming"].bool_value();
-	res.livestream_type = player_response["videoDetails"]["isLiveContent"].bool_value() ?
-		YouTubeVideoDetail::LivestreamType::LIVESTREAM : YouTubeVideoDetail::LivestreamType::PREMIERE;
+	int selected_level = -1;
+	std::vector<std::string> selected_params;
+	for (size_t level = 1; level < parts.size(); level++) {
+		auto params = split_string(parts[level], '#');
+		if (params.size() < 8) continue;
+		int width = atoi(params[0].c_str());
+		if (width <= 0 || width > STORYBOARD_MAX_FRAME_WIDTH) continue;
+		if (selected_level == -1 || width > atoi(selected_params[0].c_str())) {
+			selected_level = level - 1;
+			selected_params = params;
+		}
+	}
+	if (selected_level == -1) return;
 	
-	// extract stream formats
-	std::vector<Json> formats;
-	for (auto i : player_response["streamingData"]["formats"].array_items()) formats.push_back(i);
-	for (auto i : player_response["streamingData"]["adaptiveFormats"].array_items()) formats.push_back(i);
+	YouTubeVideoDetail::Storyboard storyboard;
+	storyboard.width = atoi(selected_params[0].c_str());
+	storyboard.height = atoi(selected_params[1].c_str());
+	storyboard.frame_num = atoi(selected_params[2].c_str());
+	storyboard.cols = atoi(selected_params[3].c_str());
+	storyboard.rows = atoi(selected_params[4].c_str());
+	storyboard.interval_ms = atoi(selected_params[5].c_str());
+	if (storyboard.interval_ms <= 0 && storyboard.frame_num > 0) storyboard.interval_ms = res.duration_ms / storyboard.frame_num; // evenly spaced
+	if (storyboard.cols <= 0 || storyboard.rows <= 0) return;
 	
-	// for obfuscated signatures & n parameter modification
+	int sheet_num = (storyboard.frame_num + storyboard.cols * storyboard.rows - 1) / (storyboard.cols * storyboard.rows);
+	std::string url_template = replace_all(parts[0], "$L", std::to_string(selected_level));
+	for (int i = 0; i < sheet_num; i++) {
+		std::string name = replace_all(selected_params[6], "$M", std::to_string(i));
+		storyboard.sheet_urls.push_back(replace_all(url_template, "$N", name) + "&sigh=" + selected_params[7]);
+	}
+	if (storyboard.is_valid()) res.storyboard = storyboard;
+}
+
+// the url of the player js referred to in `html` (a watch page or any other m.youtube.com page), "" if not found
+static std::string get_base_js_url(const Json &player_response, const std::string &html) {
 	std::string js_url;
-	// get base js url
-	if (player_response["assets"]["js"] != Json()) js_url = player_response["assets"]["js"] != Json();
+	if (player_response["assets"]["js"] != Json()) js_url = player_response["assets"]["js"].string_value();
 	else {
 		auto pos = html.find("base.js\"");
 		if (pos != std::string::npos) {
@@ -55,81 +142,139 @@ static bool extract_stream(YouTubeVideoDetail &res, const std::string &html) {
 			while (pos && html[pos] != '"') pos--;
 			if (html[pos] == '"') js_url = html.substr(pos + 1, end - (pos + 1));
 		}
-		if (js_url == "") {
-			debug("could not find base js url");
-			return false;
-		}
+		if (js_url == "") return "";
 	}
-	js_url = "https://m.youtube.com" + js_url;
-	if (!cipher_transform_proc_cache.count(js_url) || !nparam_transform_proc_cache.count(js_url)) {
-		std::string js_id;
-		std::regex pattern = std::regex(std::string("(/s/player/[\\w]+/[\\w-\\.]+/base\\.js)"));
-		std::smatch match_res;
-		if (std::regex_search(js_url, match_res, std::regex("/s/player/([\\w]+)/"))) js_id = match_res[1].str();
-		if (js_url == "") {
-			debug("failed to extract js id");
-			return false;
+	return "https://m.youtube.com" + js_url;
+}
+// the plans for `js_url` from memory, js_cache/ or the js itself (in which case js_cache/ is updated), nullptr on failure
+// TransformCacheLock must be held
+static PlayerJsPlans *get_player_js_plans(const std::string &js_url) {
+	PlayerJsPlans *plans = find_player_js_plans(js_url);
+	if (plans) {
+		METRICS_ADD(JS_CACHE_HITS);
+		return plans;
+	}
+	
+	PlayerJsPlans new_plans;
+	new_plans.js_url = js_url;
+	std::string js_id;
+	{ // /s/player/(\w+)/
+		const std::string js_id_prefix = "/s/player/";
+		size_t start = js_url.find(js_id_prefix);
+		if (start != std::string::npos) {
+			start += js_id_prefix.size();
+			size_t end = start;
+			while (end < js_url.size() && (isalnum(js_url[end]) || js_url[end] == '_')) end++;
+			if (end > start && end < js_url.size() && js_url[end] == '/') js_id = js_url.substr(start, end - start);
 		}
-		bool cache_used = false;
+	}
+	if (js_id == "") {
+		debug("failed to extract js id");
+		return nullptr;
+	}
+	bool cache_used = false;
 #ifndef _WIN32
-		char *buf = (char *) malloc(0x4000);
-		u32 read_size;
-		if (buf && Util_file_load_from_file(js_id, DEF_MAIN_DIR + "js_cache/", (u8 *) buf, 0x4000 - 1, &read_size).code == 0) {
-			debug("cache found (" + js_id + ") size:" + std::to_string(read_size) + " found, using...");
-			buf[read_size] = '\0';
-			if (yt_procs_from_string(buf, cipher_transform_proc_cache[js_url], nparam_transform_proc_cache[js_url])) cache_used = true;
-			else debug("failed to load cache");
-		}
-		free(buf);
+	u8 *buf = (u8 *) malloc(MAX_JS_CACHE_FILE_SIZE);
+	u32 read_size;
+	if (buf && Util_file_load_from_file(js_id, DEF_MAIN_DIR + "js_cache/", buf, MAX_JS_CACHE_FILE_SIZE, &read_size).code == 0) {
+		debug("cache found (" + js_id + ") size:" + std::to_string(read_size) + " found, using...");
+		if (yt_procs_from_binary(buf, read_size, new_plans.cipher_proc, new_plans.nparam_proc, new_plans.signature_timestamp)) {
+			cache_used = true;
+			METRICS_ADD(JS_CACHE_HITS);
+		}
+		else debug("failed to load cache");
+	}
+	free(buf);
 #endif
-		if (!cache_used) {
-			std::string js_content = http_get(js_url);
-			if (!js_content.size()) {
-				debug("base js download failed");
-				return false;
+	if (!cache_used) {
+		METRICS_ADD(JS_CACHE_MISSES);
+		size_t next_probe_size = JS_PROBE_INTERVAL;
+		std::string prev_probe_plans; // the binary form of what the previous look found, empty if something was missing
+		bool found_early = false;
+		std::string js_content = http_get_progressive(js_url, [&] (const std::string &received) {
+			if (received.size() < next_probe_size) return true;
+			next_probe_size = received.size() + JS_PROBE_INTERVAL;
+			auto cipher_proc = yt_cipher_get_transform_plan(received, false);
+			auto nparam_proc = yt_nparam_get_transform_plan(received);
+			int signature_timestamp = yt_get_signature_timestamp(received);
+			if (!cipher_proc.size() || !nparam_proc.ops.size() || !signature_timestamp) {
+				prev_probe_plans = "";
+				return true;
+			}
+			std::string cur_probe_plans = yt_procs_to_binary(cipher_proc, nparam_proc, signature_timestamp);
+			if (cur_probe_plans != prev_probe_plans) {
+				prev_probe_plans = cur_probe_plans;
+				return true;
 			}
-			cipher_transform_proc_cache[js_url] = yt_cipher_get_transform_plan(js_content);
-			nparam_transform_proc_cache[js_url] = yt_nparam_get_transform_plan(js_content);
+			new_plans.cipher_proc = cipher_proc;
+			new_plans.nparam_proc = nparam_proc;
+			new_plans.signature_timestamp = signature_timestamp;
+			found_early = true;
+			return false;
+		});
+		if (!js_content.size()) {
+			debug("base js download failed");
+			return nullptr;
+		}
+		if (found_early) debug("plans found in the first " + std::to_string(js_content.size()) + " bytes of the js");
+		else {
+			new_plans.cipher_proc = yt_cipher_get_transform_plan(js_content);
+			new_plans.nparam_proc = yt_nparam_get_transform_plan(js_content);
+			new_plans.signature_timestamp = yt_get_signature_timestamp(js_content);
+		}
+		std::string().swap(js_content);
 #ifndef _WIN32
-			auto cache_str = yt_procs_to_string(cipher_transform_proc_cache[js_url], nparam_transform_proc_cache[js_url]);
-			Result_with_string result = Util_file_save_to_file(js_id, DEF_MAIN_DIR + "js_cache/", (u8 *) cache_str.c_str(), cache_str.size(), true);
-			if (result.code != 0) debug("cache write failed : " + result.error_description);
+		auto cache_str = yt_procs_to_binary(new_plans.cipher_proc, new_plans.nparam_proc, new_plans.signature_timestamp);
+		Result_with_string result = Util_file_save_to_file(js_id, DEF_MAIN_DIR + "js_cache/", (u8 *) cache_str.c_str(), cache_str.size(), true);
+		if (result.code != 0) debug("cache write failed : " + result.error_description);
 #endif
-		}
 	}
+	return add_player_js_plans(std::move(new_plans));
+}
+
+// "audio/mp4; codecs=\"mp4a.40.2\"" -> "mp4a.40.2"
+static std::string get_mime_codecs(const std::string &mime_type) {
+	auto pos = mime_type.find("codecs=\"");
+	if (pos == std::string::npos) return "";
+	pos += 8;
+	return mime_type.substr(pos, mime_type.find('"', pos) - pos);
+}
+// the lower the cheaper to decode : HE-AAC decodes the AAC-LC core at half the rate and adds SBR on top of it, v2 adds PS to that
+static int get_audio_decode_complexity(const std::string &codecs) {
+	if (codecs == "mp4a.40.2") return 0;
+	if (codecs == "mp4a.40.5") return 1;
+	if (codecs == "mp4a.40.29") return 2;
+	return 3;
+}
+
+// `js_url` is the player js `player_response` was made for
+static bool extract_stream(YouTubeVideoDetail &res, const Json &player_response, const std::string &js_url) {
+	res.playability_status = player_response["playabilityStatus"]["status"].string_value();
+	res.playability_reason = player_response["playabilityStatus"]["reason"].string_value();
+	res.is_upcoming = player_response["videoDetails"]["isUpcoming"].bool_value();
+	res.livestream_type = player_response["videoDetails"]["isLiveContent"].bool_value() ?
+		YouTubeVideoDetail::LivestreamType::LIVESTREAM : YouTubeVideoDetail::LivestreamType::PREMIERE;
 	
-	for (auto &i : formats) { // handle decipher
-		if (i["url"] != Json()) continue;
-		
-		auto transform_procedure = cipher_transform_proc_cache[js_url];
-		auto cipher_params = parse_parameters(i["cipher"] != Json() ? i["cipher"].string_value() : i["signatureCipher"].string_value());
-		auto tmp = i.object_items();
-		tmp["url"] = Json(cipher_params["url"] + "&" + cipher_params["sp"] + "=" + yt_deobfuscate_signature(cipher_params["s"], transform_procedure));
-		i = Json(tmp);
-	}
-	for (auto &i : formats) { // modify the `n` parameter
-		std::string url = i["url"].string_value();
-		std::smatch match_result;
-		if (std::regex_search(url, match_result, std::regex(std::string("[\?&]n=([^&]+)")))) {
-			auto cur_n = match_result[1].str();
-			std::string next_n;
-			if (!nparam_transform_results_cache.count({js_url, cur_n})) {
-				next_n = yt_modify_nparam(match_result[1].str(), nparam_transform_proc_cache[js_url]);
-				nparam_transform_results_cache[{js_url, cur_n}] = next_n;
-			} else next_n = nparam_transform_results_cache[{js_url, cur_n}];
-			url = std::string(url.cbegin(), match_result[1].first) + next_n + std::string(match_result[1].second, url.cend());
-		} else debug("failed to detect `n` parameter");
-		if (url.find("ratebypass") == std::string::npos) url += "&ratebypass=yes";
-		
-		auto tmp = i.object_items();
-		tmp["url"] = url;
-		i = Json(tmp);
+	// extract stream formats
+	std::vector<Json> formats;
+	for (auto i : player_response["streamingData"]["formats"].array_items()) formats.push_back(i);
+	for (auto i : player_response["streamingData"]["adaptiveFormats"].array_items()) formats.push_back(i);
+	
+	// for obfuscated signatures & n parameter modification
+	if (js_url == "") {
+		debug("could not find base js url");
+		return false;
 	}
+	// held until the end so that another thread downloading the same base js waits for this one instead of downloading it again
+	TransformCacheLock cache_lock;
+	PlayerJsPlans *plans = get_player_js_plans(js_url);
+	if (!plans) return false;
+	latest_js_url = js_url;
 	
 	res.stream_fragment_len = -1;
 	res.is_livestream = false;
 	std::vector<Json> audio_formats, video_formats;
-	for (auto i : formats) {
+	for (auto &i : formats) {
 		// std::cerr << i["itag"].int_value() << " : " << (i["contentLength"].string_value().size() ? "Yes" : "No") << std::endl;
 		// if (i["contentLength"].string_value() == "") continue;
 		if (i["targetDurationSec"] != Json()) {
@@ -151,15 +296,44 @@ static bool extract_stream(YouTubeVideoDetail &res, const std::string &html) {
 			if (mime_type.find("mp4a") != std::string::npos) audio_formats.push_back(i);
 		} else {} // ???
 	}
+	// pick the formats to play first so that only their urls are deciphered
+	std::vector<std::pair<const Json *, std::string *> > used_formats; // {format, where its url goes}
 	// audio
 	{
 		int max_bitrate = -1;
-		for (auto i : audio_formats) {
+		int min_bitrate = std::numeric_limits<int>::max();
+		std::pair<int, int> min_cost = {std::numeric_limits<int>::max(), 0}; // {complexity, bitrate}
+		const Json *max_format = nullptr;
+		const Json *min_format = nullptr;
+		const Json *cheapest_format = nullptr;
+		for (auto &i : audio_formats) {
 			int cur_bitrate = i["bitrate"].int_value();
+			std::pair<int, int> cur_cost = {get_audio_decode_complexity(get_mime_codecs(i["mimeType"].string_value())), cur_bitrate};
 			if (max_bitrate < cur_bitrate) {
 				max_bitrate = cur_bitrate;
-				res.audio_stream_url = i["url"].string_value();
+				max_format = &i;
+				res.audio_stream_bitrate = std::max(cur_bitrate, 0);
 			}
+			if (min_bitrate > cur_bitrate) {
+				min_bitrate = cur_bitrate;
+				min_format = &i;
+			}
+			if (min_cost > cur_cost) {
+				min_cost = cur_cost;
+				cheapest_format = &i;
+			}
+		}
+		if (max_format) {
+			used_formats.push_back({max_format, &res.audio_stream_url});
+			res.audio_stream_codec = get_mime_codecs((*max_format)["mimeType"].string_value());
+		}
+		if (min_format) {
+			used_formats.push_back({min_format, &res.smallest_audio_stream_url});
+			res.smallest_audio_stream_codec = get_mime_codecs((*min_format)["mimeType"].string_value());
+		}
+		if (cheapest_format) {
+			used_formats.push_back({cheapest_format, &res.cheapest_audio_stream_url});
+			res.cheapest_audio_stream_codec = get_mime_codecs((*cheapest_format)["mimeType"].string_value());
 		}
 	}
 	// video
@@ -167,19 +341,49 @@ static bool extract_stream(YouTubeVideoDetail &res, const std::string &html) {
 		std::map<int, int> itag_to_p = {
 			{160, 144},
 			{133, 240},
-			{134, 360}
+			{134, 360},
+			{135, 480}
 		};
-		for (auto i : video_formats) {
+		std::map<int, const Json *> p_to_format;
+		const Json *both_format = nullptr;
+		for (auto &i : video_formats) {
 			int cur_itag = i["itag"].int_value();
 			if (itag_to_p.count(cur_itag)) {
 				int p_value = itag_to_p[cur_itag];
-				res.video_stream_urls[p_value] = i["url"].string_value();
+				p_to_format[p_value] = &i;
+				res.video_stream_bitrates[p_value] = std::max(i["bitrate"].int_value(), 0);
 			}
+			// both_stream_url : search for itag 18
+			if (cur_itag == 18) both_format = &i;
 		}
-		// both_stream_url : search for itag 18
-		for (auto i : video_formats) if (i["itag"].int_value() == 18) {
-			res.both_stream_url = i["url"].string_value();
+		for (auto i : p_to_format) used_formats.push_back({i.second, &res.video_stream_urls[i.first]});
+		if (both_format) used_formats.push_back({both_format, &res.both_stream_url});
+	}
+	
+	// decipher the urls, the formats mostly share their `n` (and sometimes their signatures) so each distinct value is transformed once
+	std::map<std::string, std::string> signature_results;
+	for (auto used_format : used_formats) {
+		const Json &format = *used_format.first;
+		std::string url;
+		if (format["url"] != Json()) url = format["url"].string_value();
+		else { // handle decipher
+			UrlParameters cipher_params(format["cipher"] != Json() ? format["cipher"].string_value() : format["signatureCipher"].string_value());
+			std::string sig = cipher_params.get("s");
+			auto sig_itr = signature_results.find(sig);
+			if (sig_itr == signature_results.end()) sig_itr = signature_results.insert({sig, yt_deobfuscate_signature(sig, plans->cipher_proc)}).first;
+			url = cipher_params.get("url") + "&" + cipher_params.get("sp") + "=" + sig_itr->second;
 		}
+		// modify the `n` parameter
+		auto n_range = find_url_parameter(url, "n");
+		if (n_range.first != std::string::npos) {
+			std::string cur_n = url.substr(n_range.first, n_range.second - n_range.first);
+			auto n_itr = plans->nparam_results.find(cur_n);
+			if (n_itr == plans->nparam_results.end()) n_itr = plans->nparam_results.insert({cur_n, yt_modify_nparam(cur_n, plans->nparam_proc)}).first;
+			url.replace(n_range.first, n_range.second - n_range.first, n_itr->second);
+		} else debug("failed to detect `n` parameter");
+		if (url.find("ratebypass") == std::string::npos) url += "&ratebypass=yes";
+		
+		*used_format.second = url;
 	}
 	
 	// extract caption data
@@ -198,6 +402,8 @@ static bool extract_stream(YouTubeVideoDetail &res, const std::string &html) {
 		res.caption_translation_languages.push_back(cur_lang);
 	}
 	
+	if (!res.is_livestream) extract_storyboard(player_response, res);
+	
 	return true;
 }
 
@@ -231,48 +437,59 @@ static void extract_owner(Json slimOwnerRenderer, YouTubeVideoDetail &res) {
 	if (res.author.icon_url.substr(0, 2) == "//") res.author.icon_url = "https:" + res.author.icon_url;
 }
 
-static void extract_item(Json content, YouTubeVideoDetail &res) {
-	auto get_video_from_renderer = [&] (Json video_renderer) {
+static void extract_item(const Json &content, YouTubeVideoDetail &res) {
+	static const JsonPath slim_video_metadata_renderer("slimVideoMetadataRenderer"), compact_autoplay_contents("compactAutoplayRenderer.contents"),
+		video_with_context_renderer("videoWithContextRenderer"), continuation_token("continuationItemRenderer.continuationEndpoint.continuationCommand.token"),
+		compact_radio_renderer("compactRadioRenderer"), compact_playlist_renderer("compactPlaylistRenderer");
+	auto get_video_from_renderer = [&] (const Json &video_renderer) {
+		static const JsonPath video_id_path("videoId"), headline("headline"), length_text("lengthText"),
+			short_view_count_text("shortViewCountText"), short_byline_text("shortBylineText");
 		YouTubeVideoSuccinct cur_video;
-		std::string video_id = video_renderer["videoId"].string_value();
+		std::string video_id = video_id_path(video_renderer).string_value();
 		cur_video.url = youtube_get_video_url_by_id(video_id);
-		cur_video.title = get_text_from_object(video_renderer["headline"]);
-		cur_video.duration_text = get_text_from_object(video_renderer["lengthText"]);
-		cur_video.views_str = get_text_from_object(video_renderer["shortViewCountText"]);
-		cur_video.author = get_text_from_object(video_renderer["shortBylineText"]);
+		cur_video.title = get_text_from_object(headline(video_renderer));
+		cur_video.duration_text = get_text_from_object(length_text(video_renderer));
+		cur_video.views_str = get_text_from_object(short_view_count_text(video_renderer));
+		cur_video.author = get_text_from_object(short_byline_text(video_renderer));
 		cur_video.thumbnail_url = youtube_get_video_thumbnail_url_by_id(video_id);
 		return cur_video;
 	};
-	if (content["slimVideoMetadataRenderer"] != Json()) {
-		Json metadata_renderer = content["slimVideoMetadataRenderer"];
-		res.title = get_text_from_object(metadata_renderer["title"]);
-		res.description = get_text_from_object(metadata_renderer["description"]);
-		res.views_str = get_text_from_object(metadata_renderer["expandedSubtitle"]);
-		res.publish_date = get_text_from_object(metadata_renderer["dateText"]);
-		extract_like_dislike_counts(metadata_renderer["buttons"], res);
-		extract_owner(metadata_renderer["owner"]["slimOwnerRenderer"], res);
-	} else if (content["compactAutoplayRenderer"] != Json()) {
-		for (auto j : content["compactAutoplayRenderer"]["contents"].array_items()) if (j["videoWithContextRenderer"] != Json())
-			res.suggestions.push_back(get_video_from_renderer(j["videoWithContextRenderer"]));
-	} else if (content["videoWithContextRenderer"] != Json())
-		res.suggestions.push_back(get_video_from_renderer(content["videoWithContextRenderer"]));
-	else if (content["continuationItemRenderer"] != Json())
-		res.suggestions_continue_token = content["continuationItemRenderer"]["continuationEndpoint"]["continuationCommand"]["token"].string_value();
-	else if (content["compactRadioRenderer"] != Json() || content["compactPlaylistRenderer"] != Json()) {
-		auto playlist_renderer = content["compactRadioRenderer"];
-		if (playlist_renderer == Json()) playlist_renderer = content["compactPlaylistRenderer"];
+	const Json *found = nullptr;
+	const Json *playlist_renderer_ptr = nullptr;
+	if ((found = slim_video_metadata_renderer.find(content))) {
+		static const JsonPath title("title"), description("description"), expanded_subtitle("expandedSubtitle"), date_text("dateText"),
+			buttons("buttons"), slim_owner_renderer("owner.slimOwnerRenderer");
+		const Json &metadata_renderer = *found;
+		res.title = get_text_from_object(title(metadata_renderer));
+		res.description = get_text_from_object(description(metadata_renderer));
+		res.views_str = get_text_from_object(expanded_subtitle(metadata_renderer));
+		res.publish_date = get_text_from_object(date_text(metadata_renderer));
+		extract_like_dislike_counts(buttons(metadata_renderer), res);
+		extract_owner(slim_owner_renderer(metadata_renderer), res);
+	} else if ((found = compact_autoplay_contents.find(content))) {
+		for (auto &j : found->array_items()) if (auto video_renderer = video_with_context_renderer.find(j))
+			res.suggestions.push_back(get_video_from_renderer(*video_renderer));
+	} else if ((found = video_with_context_renderer.find(content)))
+		res.suggestions.push_back(get_video_from_renderer(*found));
+	else if ((found = continuation_token.find(content)))
+		res.suggestions_continue_token = found->string_value();
+	else if ((playlist_renderer_ptr = compact_radio_renderer.find(content)) || compact_playlist_renderer.find(content)) {
+		static const JsonPath title("title"), video_count_text("videoCountText"), thumbnails("thumbnail.thumbnails"), url("url"), share_url("shareUrl");
+		const Json &playlist_renderer = playlist_renderer_ptr ? *playlist_renderer_ptr : compact_playlist_renderer(content);
 		
 		YouTubePlaylistSuccinct cur_list;
-		cur_list.title = get_text_from_object(playlist_renderer["title"]);
-		cur_list.video_count_str = get_text_from_object(playlist_renderer["videoCountText"]);
-		for (auto thumbnail : playlist_renderer["thumbnail"]["thumbnails"].array_items())
-			if (thumbnail["url"].string_value().find("/default.jpg") != std::string::npos) cur_list.thumbnail_url = thumbnail["url"].string_value();
+		cur_list.title = get_text_from_object(title(playlist_renderer));
+		cur_list.video_count_str = get_text_from_object(video_count_text(playlist_renderer));
+		for (auto &thumbnail : thumbnails(playlist_renderer).array_items()) {
+			const std::string &cur_url = url(thumbnail).string_value();
+			if (cur_url.find("/default.jpg") != std::string::npos) cur_list.thumbnail_url = cur_url;
+		}
 		
-		cur_list.url = convert_url_to_mobile(playlist_renderer["shareUrl"].string_value());
+		cur_list.url = convert_url_to_mobile(share_url(playlist_renderer).string_value());
 		if (!starts_with(cur_list.url, "https://m.youtube.com/watch", 0)) {
 			if (starts_with(cur_list.url, "https://m.youtube.com/playlist?", 0)) {
-				auto params = parse_parameters(cur_list.url.substr(std::string("https://m.youtube.com/playlist?").size(), cur_list.url.size()));
-				auto playlist_id = params["list"];
+				UrlParameters params(cur_list.url, strlen("https://m.youtube.com/playlist?"));
+				auto playlist_id = params.get("list");
 				auto video_id = get_video_id_from_thumbnail_url(cur_list.thumbnail_url);
 				cur_list.url = "https://m.youtube.com/watch?v=" + video_id + "&list=" + playlist_id;
 			} else {
@@ -285,9 +502,18 @@ static void extract_item(Json content, YouTubeVideoDetail &res) {
 	}
 }
 
-static void extract_metadata(YouTubeVideoDetail &res, const std::string &html) {
-	Json initial_data = get_initial_data(html);
-	
+static std::string get_innertube_api_key(const std::string &html) {
+	const std::string prefix = "\"INNERTUBE_API_KEY\":\"";
+	std::string res;
+	auto pos = html.find(prefix);
+	if (pos != std::string::npos) {
+		pos += prefix.size();
+		while (pos < html.size() && html[pos] != '"') res.push_back(html[pos++]);
+	}
+	return res;
+}
+// `initial_data` is the response of innertube next (which is what a watch page embeds as ytInitialData)
+static void extract_metadata(YouTubeVideoDetail &res, const Json &initial_data, const std::string &api_key) {
 	{
 		auto contents = initial_data["contents"]["singleColumnWatchNextResults"]["results"]["results"]["contents"];
 		for (auto content : contents.array_items()) {
@@ -324,17 +550,10 @@ static void extract_metadata(YouTubeVideoDetail &res, const std::string &html) {
 			}
 		}
 	}
-	{
-		const std::string prefix = "\"INNERTUBE_API_KEY\":\"";
-		auto pos = html.find(prefix);
-		if (pos != std::string::npos) {
-			pos += prefix.size();
-			while (pos < html.size() && html[pos] != '"') res.continue_key.push_back(html[pos++]);
-		}
-		if (res.continue_key == "") {
-			debug("INNERTUBE_API_KEY not found");
-			res.error = "INNERTUBE_API_KEY not found";
-		}
+	res.continue_key = api_key;
+	if (res.continue_key == "") {
+		debug("INNERTUBE_API_KEY not found");
+		res.error = "INNERTUBE_API_KEY not found";
 	}
 	res.comment_continue_type = -1;
 	res.comments_disabled = true;
@@ -362,48 +581,257 @@ static void extract_metadata(YouTubeVideoDetail &res, const std::string &html) {
 	}
 }
 
-YouTubeVideoDetail youtube_parse_video_page(std::string url) {
-	YouTubeVideoDetail res;
-	
-	url = convert_url_to_mobile(url);
-	
-	res.url = url;
-	std::string html = http_get(url);
-	if (!html.size()) {
-		res.error = "failed to download video page";
-		return res;
-	}
-	
-	extract_stream(res, html);
-	extract_metadata(res, html);
-	
-	
+void youtube_video_page_add_to_history(const YouTubeVideoDetail &detail) {
 #	ifndef _WIN32
-	if (res.title != "") {
+	if (detail.title != "") {
 		std::string video_id;
-		auto pos = url.find("?v=");
-		if (pos == std::string::npos) pos = url.find("&v=");
+		auto pos = detail.url.find("?v=");
+		if (pos == std::string::npos) pos = detail.url.find("&v=");
 		if (pos != std::string::npos) {
-			video_id = url.substr(pos + 3, 11);
+			video_id = detail.url.substr(pos + 3, 11);
 			HistoryVideo video;
 			video.id = video_id;
-			video.title = res.title;
-			video.author_name = res.author.name;
-			video.length_text = Util_convert_seconds_to_time((double) res.duration_ms / 1000);
+			video.title = detail.title;
+			video.author_name = detail.author.name;
+			video.length_text = Util_convert_seconds_to_time((double) detail.duration_ms / 1000);
 			video.my_view_count = 1;
 			video.last_watch_time = time(NULL);
 			add_watched_video(video);
 			misc_tasks_request(TASK_SAVE_HISTORY);
 		}
 	}
+#	else
+	(void) detail;
 #	endif
+}
+
+#ifndef _WIN32
+// moves what extract_metadata() fills in from `metadata` to `res`
+static void merge_metadata(YouTubeVideoDetail &res, YouTubeVideoDetail &metadata) {
+	if (metadata.error != "") res.error = metadata.error;
+	res.title = metadata.title;
+	res.description = metadata.description;
+	res.author = metadata.author;
+	res.like_count_str = metadata.like_count_str;
+	res.dislike_count_str = metadata.dislike_count_str;
+	res.publish_date = metadata.publish_date;
+	res.views_str = metadata.views_str;
+	res.suggestions.swap(metadata.suggestions);
+	res.suggestions_continue_token = metadata.suggestions_continue_token;
+	res.playlist = std::move(metadata.playlist);
+	res.continue_key = metadata.continue_key;
+	res.comment_continue_token = metadata.comment_continue_token;
+	res.comment_continue_type = metadata.comment_continue_type;
+	res.comments_disabled = metadata.comments_disabled;
+}
+#endif
+namespace {
+	// where the player response and the initial data of a watch page come from
+	struct VideoPageSource {
+		std::string video_id;
+		std::string playlist_id;
+		std::string api_key;
+		std::string html; // "" if the innertube path is used
+	};
+}
+static bool is_valid_id_chars(const std::string &id) {
+	for (auto c : id) if (!isalnum(c) && c != '-' && c != '_') return false;
+	return id.size();
+}
+// the json at innertube `endpoint` for the video, a null Json on failure
+// `params` is appended to the request body and must start with a comma if not empty
+static Json innertube_video_request(const std::string &endpoint, const VideoPageSource &source, const std::string &params) {
+	std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "videoId": ")"
+		+ source.video_id + "\"";
+	if (source.playlist_id != "") post_content += ", \"playlistId\": \"" + source.playlist_id + "\"";
+	post_content += params + "}";
+	post_content = replace_all(post_content, "%0", language_code);
+	post_content = replace_all(post_content, "%1", country_code);
+	
+	std::string received_str = http_post_json("https://m.youtube.com/youtubei/v1/" + endpoint + "?key=" + source.api_key, post_content);
+	if (received_str == "") return Json();
+	std::string json_err;
+	Json res = Json::parse(received_str, json_err);
+	if (json_err != "") {
+		debug("[innertube " + endpoint + "] json parsing failed : " + json_err);
+		return Json();
+	}
+	return res;
+}
+// the player response via innertube, a null Json if it's not available (the watch page should be scraped instead)
+static Json innertube_player_response(const VideoPageSource &source, std::string &js_url) {
+	int signature_timestamp = 0;
+	{
+		TransformCacheLock cache_lock;
+		if (latest_js_url == "") return Json();
+		js_url = latest_js_url;
+		PlayerJsPlans *plans = get_player_js_plans(js_url);
+		if (plans) signature_timestamp = plans->signature_timestamp;
+	}
+	// without it, the returned signatures may not match the js
+	if (!signature_timestamp) return Json();
+	
+	Json res = innertube_video_request("player", source,
+		", \"playbackContext\": {\"contentPlaybackContext\": {\"signatureTimestamp\": " + std::to_string(signature_timestamp) + "}}, \"racyCheckOk\": true, \"contentCheckOk\": true");
+	if (res["playabilityStatus"]["status"].string_value() != "OK" || res["streamingData"] == Json()) {
+		debug("[innertube player] " + (res == Json() ? std::string("request failed") : "status : " + res["playabilityStatus"]["status"].string_value()));
+		return Json();
+	}
+	if (res["videoDetails"]["videoId"].string_value() != source.video_id) {
+		debug("[innertube player] video id mismatch");
+		return Json();
+	}
+	return res;
+}
+static void load_metadata(YouTubeVideoDetail &res, const VideoPageSource &source, const std::string &url) {
+	if (source.html != "") {
+		extract_metadata(res, get_initial_data(source.html), source.api_key);
+		return;
+	}
+	Json initial_data = innertube_video_request("next", source, "");
+	if (initial_data["contents"]["singleColumnWatchNextResults"] != Json()) {
+		extract_metadata(res, initial_data, source.api_key);
+		return;
+	}
+	debug("[innertube next] failed, falling back to the watch page");
+	std::string html = http_get(url);
+	if (!html.size()) {
+		res.error = "failed to download video page";
+		return;
+	}
+	extract_metadata(res, get_initial_data(html), source.api_key);
+}
+#ifndef _WIN32
+namespace {
+	struct MetadataTask {
+		const VideoPageSource *source;
+		const std::string *url;
+		YouTubeVideoDetail res;
+	};
+}
+static void extract_metadata_thread_func(void *arg) {
+	MetadataTask *task = (MetadataTask *) arg;
+	{
+		JsonArena json_arena; // this thread's own, arenas are not shared between threads
+		load_metadata(task->res, *task->source, *task->url);
+	}
+	threadExit(0);
+}
+#endif
+
+YouTubeVideoDetail youtube_parse_video_page(std::string url, bool add_to_history, std::function<void (const YouTubeVideoDetail &)> on_streams_extracted) {
+	TRACE_ZONE("youtube_parse_video_page");
+	JsonArena json_arena;
+	YouTubeVideoDetail res;
+	
+	url = convert_url_to_mobile(url);
+	
+	res.url = url;
+	
+	// innertube returns only the two json blobs we need instead of the whole watch page, but needs a key and a player js learned from a page
+	VideoPageSource source;
+	{
+		auto query_pos = url.find('?');
+		if (query_pos != std::string::npos) {
+			UrlParameters params(url, query_pos + 1);
+			source.video_id = params.get("v");
+			source.playlist_id = params.get("list");
+		}
+		if (!is_valid_id_chars(source.playlist_id)) source.playlist_id = "";
+		TransformCacheLock cache_lock;
+		source.api_key = innertube_api_key;
+	}
+	Json player_response;
+	std::string js_url;
+	if (source.api_key != "" && youtube_is_valid_video_id(source.video_id)) player_response = innertube_player_response(source, js_url);
+	if (player_response == Json()) {
+		source.html = http_get(url);
+		if (!source.html.size()) {
+			res.error = "failed to download video page";
+			return res;
+		}
+		player_response = initial_player_response(source.html);
+		js_url = get_base_js_url(player_response, source.html);
+		source.api_key = get_innertube_api_key(source.html);
+		if (source.api_key != "") {
+			TransformCacheLock cache_lock;
+			innertube_api_key = source.api_key;
+		}
+	}
+	
+	// the player response and the initial data are independent, so the latter is obtained on another core if one is available
+	// (extract_stream() may also have to download the base js meanwhile)
+	bool parsed = false;
+#ifndef _WIN32
+	if (thread_placement_get_core(ThreadRole::PAGE_PARSER) != svcGetProcessorID()) {
+		MetadataTask task;
+		task.source = &source;
+		task.url = &url;
+		Thread thread = thread_placement_create_thread(ThreadRole::PAGE_PARSER, extract_metadata_thread_func, &task, DEF_STACKSIZE, DEF_THREAD_PRIORITY_NORMAL, false);
+		if (thread) {
+			extract_stream(res, player_response, js_url);
+			if (on_streams_extracted) on_streams_extracted(res);
+			threadJoin(thread, std::numeric_limits<s64>::max());
+			threadFree(thread);
+			merge_metadata(res, task.res);
+			parsed = true;
+		}
+	}
+#endif
+	if (!parsed) {
+		extract_stream(res, player_response, js_url);
+		if (on_streams_extracted) on_streams_extracted(res);
+		load_metadata(res, source, url);
+	}
+	
+	if (add_to_history) youtube_video_page_add_to_history(res);
 	
 	debug(res.title);
 	return res;
 }
 
+bool youtube_prepare_player_js() {
+	// the top page refers to the current player js as well, and is much lighter than a watch page
+	std::string html = http_get("https://m.youtube.com/");
+	std::string js_url = get_base_js_url(Json(), html);
+	if (js_url == "") {
+		debug("could not find base js url in the top page");
+		return false;
+	}
+	std::string api_key = get_innertube_api_key(html);
+	TransformCacheLock cache_lock;
+	if (api_key != "") innertube_api_key = api_key;
+	if (!get_player_js_plans(js_url)) return false;
+	latest_js_url = js_url;
+	return true;
+}
+
+struct YouTubeTransformPlans {
+	yt_cipher_transform_procedure cipher_proc;
+	yt_nparam_transform_procedure nparam_proc;
+	int signature_timestamp;
+};
+YouTubeTransformPlans *youtube_load_transform_plans(const std::string &plans) {
+	YouTubeTransformPlans *res = new YouTubeTransformPlans();
+	if (!yt_procs_from_binary((const uint8_t *) plans.data(), plans.size(), res->cipher_proc, res->nparam_proc, res->signature_timestamp)) {
+		delete res;
+		return NULL;
+	}
+	return res;
+}
+void youtube_free_transform_plans(YouTubeTransformPlans *plans) { delete plans; }
+std::string youtube_deobfuscate_signature(const YouTubeTransformPlans *plans, const std::string &signature) {
+	return yt_deobfuscate_signature(signature, plans->cipher_proc);
+}
+std::string youtube_modify_nparam(const YouTubeTransformPlans *plans, const std::string &n_param) {
+	return yt_modify_nparam(n_param, plans->nparam_proc);
+}
+
 YouTubeVideoDetail youtube_video_page_load_more_suggestions(const YouTubeVideoDetail &prev_result) {
-	YouTubeVideoDetail new_result = prev_result;
+	JsonArena json_arena;
+	YouTubeVideoDetail new_result; // only the new suggestions
+	new_result.continue_key = prev_result.continue_key;
+	new_result.suggestions_continue_token = prev_result.suggestions_continue_token;
 	
 	if (prev_result.continue_key == "") {
 		new_result.error = "continue key empty";
@@ -419,8 +847,8 @@ YouTubeVideoDetail youtube_video_page_load_more_suggestions(const YouTubeVideoDe
 	{
 		std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "continuation": ")"
 			+ prev_result.suggestions_continue_token + "\"}";
-		post_content = std::regex_replace(post_content, std::regex("%0"), language_code);
-		post_content = std::regex_replace(post_content, std::regex("%1"), country_code);
+		post_content = replace_all(post_content, "%0", language_code);
+		post_content = replace_all(post_content, "%1", country_code);
 		
 		std::string post_url = "https://m.youtube.com/youtubei/v1/next?key=" + prev_result.continue_key;
 		
@@ -450,24 +878,26 @@ YouTubeVideoDetail youtube_video_page_load_more_suggestions(const YouTubeVideoDe
 	return new_result;
 }
 
-YouTubeVideoDetail::Comment extract_comment_from_comment_renderer(Json comment_renderer) {
+YouTubeVideoDetail::Comment extract_comment_from_comment_renderer(const Json &comment_renderer) {
+	static const JsonPath comment_id("commentId"), content_text("contentText"), reply_count("replyCount"), author_text("authorText"),
+		author_url("authorEndpoint.browseEndpoint.canonicalBaseUrl"), author_thumbnails("authorThumbnail.thumbnails"), height("height"), url("url");
 	YouTubeVideoDetail::Comment cur_comment;
 	// get the icon of the author with minimum size
-	cur_comment.id = comment_renderer["commentId"].string_value();
-	cur_comment.content = get_text_from_object(comment_renderer["contentText"]);
-	cur_comment.reply_num = comment_renderer["replyCount"].int_value(); // Json.int_value() defaults to zero, so... it works
-	cur_comment.author.name = get_text_from_object(comment_renderer["authorText"]);
-	cur_comment.author.url = "https://m.youtube.com" + comment_renderer["authorEndpoint"]["browseEndpoint"]["canonicalBaseUrl"].string_value();
+	cur_comment.id = comment_id(comment_renderer).string_value();
+	cur_comment.content = get_text_from_object(content_text(comment_renderer));
+	cur_comment.reply_num = reply_count(comment_renderer).int_value(); // Json.int_value() defaults to zero, so... it works
+	cur_comment.author.name = get_text_from_object(author_text(comment_renderer));
+	cur_comment.author.url = "https://m.youtube.com" + author_url(comment_renderer).string_value();
 	{
 		constexpr int target_height = 70;
 		int min_distance = 100000;
 		std::string best_icon;
-		for (auto icon : comment_renderer["authorThumbnail"]["thumbnails"].array_items()) {
-			int cur_height = icon["height"].int_value();
+		for (auto &icon : author_thumbnails(comment_renderer).array_items()) {
+			int cur_height = height(icon).int_value();
 			if (cur_height >= 256) continue; // too large
 			if (min_distance > std::abs(target_height - cur_height)) {
 				min_distance = std::abs(target_height - cur_height);
-				best_icon = icon["url"].string_value();
+				best_icon = url(icon).string_value();
 			}
 		}
 		cur_comment.author.icon_url = best_icon;
@@ -476,7 +906,11 @@ YouTubeVideoDetail::Comment extract_comment_from_comment_renderer(Json comment_r
 	
 }
 YouTubeVideoDetail youtube_video_page_load_more_comments(const YouTubeVideoDetail &prev_result) {
-	YouTubeVideoDetail new_result = prev_result;
+	JsonArena json_arena;
+	YouTubeVideoDetail new_result; // only the new comments
+	new_result.continue_key = prev_result.continue_key;
+	new_result.comment_continue_token = prev_result.comment_continue_token;
+	new_result.comment_continue_type = prev_result.comment_continue_type;
 	
 	if (prev_result.comment_continue_type == -1) {
 		new_result.error = "No more comments available";
@@ -521,8 +955,8 @@ YouTubeVideoDetail youtube_video_page_load_more_comments(const YouTubeVideoDetai
 		{
 			std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "continuation": ")"
 				+ prev_result.comment_continue_token + "\"}";
-			post_content = std::regex_replace(post_content, std::regex("%0"), language_code);
-			post_content = std::regex_replace(post_content, std::regex("%1"), country_code);
+			post_content = replace_all(post_content, "%0", language_code);
+			post_content = replace_all(post_content, "%1", country_code);
 			
 			std::string received_str = http_post_json("https://m.youtube.com/youtubei/v1/next?key=" + prev_result.continue_key, post_content);
 			if (received_str != "") {
@@ -555,6 +989,7 @@ YouTubeVideoDetail youtube_video_page_load_more_comments(const YouTubeVideoDetai
 }
 
 YouTubeVideoDetail::Comment youtube_video_page_load_more_replies(const YouTubeVideoDetail::Comment &comment) {
+	JsonArena json_arena;
 	YouTubeVideoDetail::Comment res = comment;
 	res.replies_continue_token = "";
 	
@@ -567,8 +1002,8 @@ YouTubeVideoDetail::Comment youtube_video_page_load_more_replies(const YouTubeVi
 	{
 		std::string post_content = R"({"context": {"client": {"hl": "%0", "gl": "%1", "clientName": "MWEB", "clientVersion": "2.20210711.08.00", "utcOffsetMinutes": 0}, "request": {}, "user": {}}, "continuation": ")"
 			+ comment.replies_continue_token + "\"}";
-		post_content = std::regex_replace(post_content, std::regex("%0"), language_code);
-		post_content = std::regex_replace(post_content, std::regex("%1"), country_code);
+		post_content = replace_all(post_content, "%0", language_code);
+		post_content = replace_all(post_content, "%1", country_code);
 		
 		std::string received_str = http_post_json("https://m.youtube.com/youtubei/v1/next?key=" + comment.continue_key, post_content);
 		if (received_str != "") {
@@ -592,6 +1027,7 @@ YouTubeVideoDetail::Comment youtube_video_page_load_more_replies(const YouTubeVi
 }
 
 YouTubeVideoDetail youtube_video_page_load_caption(const YouTubeVideoDetail &prev_result, const std::string &base_lang_id, const std::string &translation_lang_id) {
+	JsonArena json_arena;
 	YouTubeVideoDetail res = prev_result;
 	
 	int base_lang_index = -1;
@@ -664,7 +1100,7 @@ bool youtube_is_valid_video_id(const std::string &id) {
 	return true;
 }
 bool is_youtube_url(const std::string &url) {
-	std::vector<std::string> patterns = {
+	static const char *patterns[] = {
 		"https://m.youtube.com/",
 		"https://www.youtube.com/"
 	};
@@ -672,7 +1108,7 @@ bool is_youtube_url(const std::string &url) {
 	return false;
 }
 bool is_youtube_thumbnail_url(const std::string &url) {
-	std::vector<std::string> patterns = {
+	static const char *patterns[] = {
 		"https://i.ytimg.com/vi/",
 		"https://yt3.ggpht.com/"
 	};
@@ -0,0 +1,91 @@
+// the host side of what the decoding path takes from the rest of the app (see system/platform.hpp) :
+// the log goes to stderr, linear memory is the heap, the cpu limit, the memory budget and the disk cache do nothing,
+// and the trace zones are summed up per name for the report of main.cpp
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include "system/platform.hpp"
+#include "definitions.hpp"
+#include "types.hpp"
+#include "system/util/log.hpp"
+#include "system/util/file.hpp"
+#include "system/util/libctru_wrapper.hpp"
+#include "system/util/metrics.hpp"
+#include "system/util/memory_budget.hpp"
+#include "system/util/trace.hpp"
+#include "system/cpu_limit.hpp"
+#include "network/stream_disk_cache.hpp"
+#include "host_platform.hpp"
+
+bool host_log_verbose = false;
+
+int Util_log_save(const std::string &type, const std::string &text) {
+	if (host_log_verbose) fprintf(stderr, "[%s] %s\n", type.c_str(), text.c_str());
+	return 0;
+}
+int Util_log_save(const std::string &type, const std::string &text, int result) {
+	if (host_log_verbose) fprintf(stderr, "[%s] %s 0x%x\n", type.c_str(), text.c_str(), (unsigned) result);
+	return 0;
+}
+bool Util_log_query_log_show_flag(void) { return host_log_verbose; }
+
+// the files are given by their full path, split by FileStreamSource into `dir_path` and `file_name`
+Result_with_string Util_file_check_file_size(std::string file_name, std::string dir_path, u64* file_size) {
+	Result_with_string result;
+	FILE *file = fopen((dir_path + file_name).c_str(), "rb");
+	if (!file || fseek(file, 0, SEEK_END) != 0) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] can't open " + dir_path + file_name + " ";
+	} else *file_size = ftell(file);
+	if (file) fclose(file);
+	return result;
+}
+Result_with_string Util_file_load_from_file_with_range(std::string file_name, std::string dir_path, u8* read_data, int read_length, u64 read_offset, u32* read_size) {
+	Result_with_string result;
+	FILE *file = fopen((dir_path + file_name).c_str(), "rb");
+	if (!file || fseek(file, read_offset, SEEK_SET) != 0) {
+		result.code = DEF_ERR_OTHER;
+		result.string = "[Error] can't open " + dir_path + file_name + " ";
+	} else *read_size = fread(read_data, 1, read_length, file);
+	if (file) fclose(file);
+	return result;
+}
+
+void *linearAlloc_concurrent(size_t size) { return malloc(size); }
+void linearFree_concurrent(void *ptr) { free(ptr); }
+void *linearAlloc_concurrent(size_t size, MemoryTag) { return malloc(size); }
+void linearFree_concurrent(void *ptr, MemoryTag) { free(ptr); }
+
+s64 metrics_values[(int) Metric::NUM];
+
+void add_cpu_limit(int, CpuLimitReason) {}
+void remove_cpu_limit(int, CpuLimitReason) {}
+
+void memory_budget_add(MemoryBudgetUser, s64) {}
+bool memory_budget_is_over(u64) { return false; }
+MemoryPressure memory_pressure_get_level() { return MemoryPressure::NONE; }
+void memory_pressure_report(MemoryPressure) {}
+
+void stream_disk_cache_save_index() {}
+
+// trace zones
+bool trace_capturing = false;
+namespace {
+	std::mutex zone_lock;
+	std::map<std::string, HostZoneStats> zones;
+}
+void trace_record(const char *name, u64 start_tick, u64 end_tick) {
+	double time = (end_tick - start_tick) / PLATFORM_TICKS_PER_MSEC;
+	std::lock_guard<std::mutex> guard(zone_lock);
+	HostZoneStats &stats = zones[name];
+	stats.num++;
+	stats.total += time;
+	stats.max = std::max(stats.max, time);
+}
+std::map<std::string, HostZoneStats> host_get_zone_stats() {
+	std::lock_guard<std::mutex> guard(zone_lock);
+	return zones;
+}
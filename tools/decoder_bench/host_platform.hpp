@@ -0,0 +1,14 @@
+#pragma once
+#include <map>
+#include <string>
+
+// set by --verbose, the log of the decoder is dropped otherwise
+extern bool host_log_verbose;
+
+// what the TRACE_ZONE()s of the decoding path recorded while trace_capturing was set
+struct HostZoneStats {
+	int num = 0;
+	double total = 0; // milliseconds
+	double max = 0;
+};
+std::map<std::string, HostZoneStats> host_get_zone_stats();
@@ -0,0 +1,489 @@
+// host-side benchmark of the decoding path : plays local files through NetworkDecoder as fast as it can (the FFmpeg demuxing and decoding,
+// the packet queues, the video read-ahead of the demux thread, the seeks and the livestream fragment switch) and reports the throughput
+// and where the time went (the TRACE_ZONE()s of network_decoder.cpp), so that decoder changes can be profiled with desktop tools
+// (perf, valgrind...) and throughput regressions caught before trying them on the hardware
+// the software decoding path is exactly the one of the app, only the mvd service (the hardware decoder) and the Y2R conversion are 3ds only
+// the playback position is never reported to the decoder, so no frame is skipped however slow the decoding is
+//
+// usage : decoder_bench [options] <video> [<audio>]
+//   one file : a muxed stream (e.g. itag 18), two : separate DASH video and audio streams
+//   --fragments <n>     livestream : <video> (and <audio>) contain %d, replaced with the sequence number 0..n-1 of each fragment
+//                       the fragments are played one after another keeping the decoder contexts like NetworkMultipleDecoder does
+//   --seek <at>:<to>    seconds, seeks to <to> once the decoding reaches <at> (can be repeated, not for --fragments)
+//   --threads <n>       NetworkDecoder::sw_decoder_thread_num (default 1)
+//   --concurrent        separate streams : the audio is decoded on its own thread and the video read ahead by a demux thread like the video player does
+//   --rate <KB/s>       the streams are filled at this rate instead of at once, the time the decoder spent waiting shows in `network wait`
+//   --audio-rate <hz>   NetworkDecoder::audio_output_max_sample_rate, --mono : NetworkDecoder::audio_output_mono
+//   --max-seconds <s>   stops after this many seconds of video
+//   --verbose           prints the log of the decoder
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include "definitions.hpp"
+#include "network/network_decoder.hpp"
+#include "system/util/trace.hpp"
+#include "host_platform.hpp"
+
+namespace {
+	struct Seek {
+		double at;
+		double to;
+		bool done;
+	};
+	struct Options {
+		std::string video_path;
+		std::string audio_path;
+		int fragment_num = 0;
+		std::vector<Seek> seeks;
+		int thread_num = 1;
+		bool concurrent = false;
+		double rate = 0; // KB/s, 0 : the blocks are there as soon as they are asked for
+		int audio_rate = 0;
+		bool mono = false;
+		double max_seconds = 0;
+	};
+
+	// fills the streams from their files the way a worker of NetworkStreamDownloader does for local files : the first block of a new stream,
+	// then the prefetch target, then the stream with the least margin in its prefetch window (download_policy.hpp decides the window and the run length)
+	// a whole_download stream (livestream fragment) is read at once, and a stream is deleted once quit_request is made
+	class Feeder {
+		class BlockMap : public DownloadBlockMap {
+			const NetworkStream *stream;
+		public :
+			explicit BlockMap (const NetworkStream *stream) : stream(stream) {}
+			u64 find_missing_block(u64 from, u64 limit) const override { return stream->find_missing_block(from, limit); }
+			bool is_block_present(u64 block) const override { return stream->is_block_present(block); }
+			bool is_block_in_flight(u64) const override { return false; } // one worker
+		};
+		std::mutex streams_lock;
+		std::vector<NetworkStream *> streams;
+		std::thread thread;
+		std::atomic<bool> exit_request{false};
+		double rate; // bytes per millisecond (the same number as KB/s), 0 for no limit
+		std::vector<u8> buffer;
+		
+		DownloadPolicyStream get_policy_stream(NetworkStream *stream, const BlockMap &blocks) {
+			DownloadPolicyStream res;
+			res.blocks = &blocks;
+			res.len = stream->len;
+			res.block_num = stream->block_num;
+			res.read_head = stream->read_head;
+			res.bitrate = stream->bitrate;
+			res.forward_read_blocks = download_policy_forward_read_blocks(stream->bitrate, stream->sizing.bandwidth_estimate, stream->max_forward_read_blocks,
+				0, false, false);
+			res.bulk_read_end = stream->bulk_read_end;
+			res.local_file = true;
+			return res;
+		}
+		void fail(NetworkStream *stream, const std::string &error) {
+			fprintf(stderr, "%s\n", error.c_str());
+			stream->error = true;
+			stream->data_arrival_event.signal();
+		}
+		// sleeps so that `size` bytes since `start_time` don't go faster than `rate`, and feeds the throughput to the request sizing
+		void throttle(NetworkStream *stream, u64 size, double start_time) {
+			if (rate > 0) {
+				double wait_ms = size / rate - (platform_get_time_ms() - start_time);
+				if (wait_ms > 0) platform_sleep_ns((s64) (wait_ms * 1000000));
+			}
+			download_policy_on_throughput(stream->sizing, size / std::max(0.001, platform_get_time_ms() - start_time));
+		}
+		void read_whole(NetworkStream *stream) {
+			double start_time = platform_get_time_ms();
+			std::vector<u8> data;
+			FILE *file = fopen(stream->url.c_str(), "rb");
+			if (file) {
+				u8 tmp[0x10000];
+				size_t read_size;
+				while ((read_size = fread(tmp, 1, sizeof(tmp), file)) > 0) data.insert(data.end(), tmp, tmp + read_size);
+				fclose(file);
+			}
+			if (data.empty()) return fail(stream, "failed to read " + stream->url);
+			throttle(stream, data.size(), start_time);
+			stream->len = data.size();
+			stream->block_num = (stream->len + NetworkStream::BLOCK_SIZE - 1) / NetworkStream::BLOCK_SIZE;
+			stream->set_whole_data(data);
+			stream->ready = true;
+		}
+		// NetworkStreamDownloader::load_blocks_from_source()
+		void read_blocks(NetworkStream *stream, u64 block) {
+			double start_time = platform_get_time_ms();
+			if (!stream->ready) {
+				u64 len = 0;
+				Result_with_string result = stream->source->open(&len);
+				if (result.code != 0) return fail(stream, "failed to open " + stream->source->get_description() + " : " + result.string);
+				stream->len = len;
+				stream->block_num = (len + NetworkStream::BLOCK_SIZE - 1) / NetworkStream::BLOCK_SIZE;
+			}
+			BlockMap blocks(stream);
+			bool catching_up;
+			u64 block_num = download_policy_request_block_num(get_policy_stream(stream, blocks), block, stream->sizing, &catching_up);
+			block_num = std::min(block_num, stream->block_num - std::min(block, stream->block_num));
+			if (!block_num) return;
+			u64 size = std::min<u64>(block_num * NetworkStream::BLOCK_SIZE, stream->len - block * NetworkStream::BLOCK_SIZE);
+			if (buffer.size() < size) buffer.resize(size);
+			Result_with_string result = stream->source->read(block * NetworkStream::BLOCK_SIZE, buffer.data(), size);
+			if (result.code != 0) return fail(stream, "failed to read " + stream->source->get_description() + " : " + result.string);
+			throttle(stream, size, start_time);
+			for (u64 i = 0; i < block_num; i++)
+				stream->set_data(block + i, buffer.data() + i * NetworkStream::BLOCK_SIZE, std::min<u64>(NetworkStream::BLOCK_SIZE, size - i * NetworkStream::BLOCK_SIZE));
+			stream->ready = true;
+		}
+		// one iteration of the loop of NetworkStreamDownloader::downloader_thread(), false if there was nothing to read
+		bool feed_next() {
+			streams_lock.lock();
+			for (size_t i = 0; i < streams.size(); ) {
+				if (streams[i]->quit_request) {
+					delete streams[i];
+					streams.erase(streams.begin() + i);
+				} else i++;
+			}
+			NetworkStream *target = NULL;
+			u64 target_block = 0;
+			double margin_min = 1e9;
+			bool margin_in_seconds = true;
+			for (auto stream : streams) if (stream->ready && !stream->whole_download && stream->bitrate <= 0) margin_in_seconds = false;
+			for (auto stream : streams) {
+				if (stream->error) continue;
+				if (!stream->ready) {
+					target = stream;
+					target_block = stream->read_head / NetworkStream::BLOCK_SIZE;
+					break;
+				}
+				if (stream->whole_download) continue;
+				s64 prefetch_target = stream->prefetch_target;
+				if (prefetch_target >= 0) {
+					u64 block = prefetch_target / NetworkStream::BLOCK_SIZE;
+					if (block < stream->block_num && !stream->is_block_present(block) && margin_min > -1) {
+						margin_min = -1;
+						target = stream;
+						target_block = block;
+						continue;
+					}
+					stream->prefetch_target = -1;
+				}
+				BlockMap blocks(stream);
+				u64 block;
+				double margin;
+				if (!download_policy_find_next_block(get_policy_stream(stream, blocks), margin_in_seconds, &block, &margin)) continue;
+				if (margin_min > margin) {
+					margin_min = margin;
+					target = stream;
+					target_block = block;
+				}
+			}
+			streams_lock.unlock();
+			
+			if (!target) return false;
+			if (target->whole_download) read_whole(target);
+			else read_blocks(target, target_block);
+			return true;
+		}
+		void thread_func() {
+			while (!exit_request) if (!feed_next()) platform_sleep_ns(1000000);
+		}
+	public :
+		// `rate` : KB/s, 0 for no limit
+		explicit Feeder (double rate) : rate(rate) { thread = std::thread(&Feeder::thread_func, this); }
+		~Feeder () {
+			exit_request = true;
+			thread.join();
+			for (auto stream : streams) delete stream;
+		}
+		// the stream is deleted once quit_request is made, like NetworkStreamDownloader::add_stream()
+		void add_stream(NetworkStream *stream) {
+			std::lock_guard<std::mutex> guard(streams_lock);
+			streams.push_back(stream);
+		}
+	};
+
+	struct Stats {
+		int video_frames = 0; // decoded
+		int presented_frames = 0; // taken by get_decoded_video_frame()
+		double video_time = 0; // ms in decode_video(), without the waits for the output space
+		double video_max_time = 0;
+		int audio_packets = 0;
+		double audio_time = 0;
+		double audio_resample_time = 0;
+		double last_pos = 0;
+		int errors = 0;
+		int seeks = 0;
+		int seeks_within_queue = 0;
+		double seek_time = 0;
+		int fragment_switches = 0;
+		double fragment_init_time = 0;
+	};
+
+	NetworkDecoder decoder;
+	Options options;
+	Stats stats;
+	Feeder *feeder = NULL;
+	std::mutex audio_decode_lock; // held by the audio thread while it decodes a packet, and by a seek
+	std::atomic<bool> audio_eof{false};
+	std::atomic<bool> threads_running{false};
+}
+
+static std::string get_absolute_path(const std::string &path) {
+	char buf[PATH_MAX];
+	return realpath(path.c_str(), buf) ? buf : path;
+}
+static std::string get_fragment_path(const std::string &pattern, int seq) {
+	char buf[PATH_MAX];
+	snprintf(buf, sizeof(buf), pattern.c_str(), seq);
+	return get_absolute_path(buf);
+}
+static NetworkStream *open_stream(const std::string &path, bool whole_download) {
+	// a path starting with '/' gets a FileStreamSource (stream_source.cpp), read by the feeder like the downloader reads a local file
+	NetworkStream *stream = new NetworkStream(path, whole_download, NULL);
+	feeder->add_stream(stream);
+	return stream;
+}
+// `shared_codecs` : as in NetworkDecoderFFmpegData::init()
+static Result_with_string open_data(NetworkDecoderFFmpegData &data, int seq, const NetworkDecoderFFmpegData *shared_codecs) {
+	bool fragment = options.fragment_num > 0;
+	std::string video_path = fragment ? get_fragment_path(options.video_path, seq) : get_absolute_path(options.video_path);
+	if (options.audio_path == "") return data.init(open_stream(video_path, fragment), &decoder, shared_codecs);
+	std::string audio_path = fragment ? get_fragment_path(options.audio_path, seq) : get_absolute_path(options.audio_path);
+	return data.init(open_stream(video_path, fragment), open_stream(audio_path, fragment), &decoder, shared_codecs);
+}
+
+static void decode_audio_packet() {
+	int size = 0;
+	u8 *data = NULL;
+	double pos;
+	double start = platform_get_time_ms();
+	Result_with_string result = decoder.decode_audio(&size, &data, &pos);
+	stats.audio_time += platform_get_time_ms() - start;
+	stats.audio_resample_time += decoder.audio_resample_time;
+	stats.audio_packets++;
+	if (result.code != 0) stats.errors++;
+	decoder.free_audio_buffer(data);
+}
+static void decode_video_packet() {
+	int width, height;
+	bool key_frame;
+	double pos = 0;
+	double start = platform_get_time_ms();
+	Result_with_string result = decoder.decode_video(&width, &height, &key_frame, &pos);
+	double time = platform_get_time_ms() - start;
+	while (result.code == DEF_ERR_NEED_MORE_OUTPUT) { // the presenting thread is behind
+		decoder.wait_for_video_output_space(10000000);
+		start = platform_get_time_ms();
+		result = decoder.decode_video(&width, &height, &key_frame, &pos);
+		time = platform_get_time_ms() - start;
+	}
+	if (result.code == 0) {
+		stats.video_frames++;
+		stats.video_time += time;
+		stats.video_max_time = std::max(stats.video_max_time, time);
+		stats.last_pos = pos;
+	} else if (result.code != DEF_ERR_NEED_MORE_INPUT) {
+		stats.errors++;
+		if (host_log_verbose) fprintf(stderr, "decode_video() : %s%s\n", result.string.c_str(), result.error_description.c_str());
+	}
+}
+// like NetworkMultipleDecoder::seek() for a video that is not a livestream
+static void seek(const NetworkDecoderFFmpegData &data, double to) {
+	std::lock_guard<std::mutex> guard(audio_decode_lock);
+	double start = platform_get_time_ms();
+	s64 microseconds = to * 1000000;
+	decoder.pause_video_demux();
+	if (decoder.seek_within_queue(microseconds)) stats.seeks_within_queue++;
+	else {
+		decoder.clear_buffer();
+		decoder.change_ffmpeg_data(data, 0);
+		Result_with_string result = decoder.seek(microseconds);
+		if (result.code != 0) {
+			stats.errors++;
+			fprintf(stderr, "seek to %.1f failed : %s%s\n", to, result.string.c_str(), result.error_description.c_str());
+		}
+	}
+	decoder.resume_video_demux();
+	audio_eof = false;
+	stats.seek_time += platform_get_time_ms() - start;
+	stats.seeks++;
+}
+
+static void present_thread_func() {
+	auto info = decoder.get_video_info();
+	while (threads_running) {
+		if (!decoder.wait_for_decoded_video_frame(10000000)) continue;
+		u8 *data;
+		double pos;
+		if (decoder.get_decoded_video_frame(info.width, info.height, &data, &pos).code == 0) stats.presented_frames++;
+	}
+}
+static void audio_thread_func() {
+	while (threads_running) {
+		audio_decode_lock.lock();
+		bool decoded = decoder.prepare_packet(NetworkDecoder::DecodeType::AUDIO);
+		if (decoded) decode_audio_packet();
+		else if (!decoder.interrupt) audio_eof = true;
+		audio_decode_lock.unlock();
+		if (!decoded) platform_sleep_ns(1000000);
+	}
+}
+static void demux_thread_func() {
+	while (threads_running) if (!decoder.demux_video_ahead()) decoder.wait_for_video_demux_space(20000000);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage : %s [--fragments <n>] [--seek <at>:<to>]... [--threads <n>] [--concurrent] [--rate <KB/s>]\n"
+		"  [--audio-rate <hz>] [--mono] [--max-seconds <s>] [--verbose] <video> [<audio>]\n", name);
+	exit(1);
+}
+static void parse_options(int argc, char **argv) {
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--fragments" && has_value) options.fragment_num = atoi(argv[++i]);
+		else if (arg == "--seek" && has_value) {
+			Seek seek = {0, 0, false};
+			if (sscanf(argv[++i], "%lf:%lf", &seek.at, &seek.to) != 2) usage(argv[0]);
+			options.seeks.push_back(seek);
+		} else if (arg == "--threads" && has_value) options.thread_num = std::max(1, atoi(argv[++i]));
+		else if (arg == "--concurrent") options.concurrent = true;
+		else if (arg == "--rate" && has_value) options.rate = atof(argv[++i]);
+		else if (arg == "--audio-rate" && has_value) options.audio_rate = atoi(argv[++i]);
+		else if (arg == "--mono") options.mono = true;
+		else if (arg == "--max-seconds" && has_value) options.max_seconds = atof(argv[++i]);
+		else if (arg == "--verbose") host_log_verbose = true;
+		else if (arg.size() && arg[0] == '-') usage(argv[0]);
+		else files.push_back(arg);
+	}
+	if (files.size() < 1 || files.size() > 2) usage(argv[0]);
+	options.video_path = files[0];
+	if (files.size() == 2) options.audio_path = files[1];
+	if (options.fragment_num && options.seeks.size()) usage(argv[0]);
+	if (options.concurrent && (options.audio_path == "" || options.fragment_num)) {
+		fprintf(stderr, "--concurrent needs separate streams and no --fragments (see NetworkMultipleDecoder::can_decode_concurrently())\n");
+		exit(1);
+	}
+}
+
+static void print_report(double wall_time) {
+	auto video_info = decoder.get_video_info();
+	auto audio_info = decoder.get_audio_info();
+	printf("video : %dx%d %.2f fps, %s\n", video_info.width, video_info.height, video_info.framerate, video_info.format_name.c_str());
+	printf("audio : %d Hz %d ch -> %d Hz %d ch, %s\n", audio_info.sample_rate, audio_info.ch, audio_info.output_sample_rate, audio_info.output_ch,
+		audio_info.format_name.c_str());
+	printf("decoded up to %.1f s in %.1f s (%.2fx realtime)\n", stats.last_pos, wall_time / 1000, stats.last_pos / (wall_time / 1000));
+	printf("video : %d frames (%d presented), %.3f ms/frame, %.3f ms max\n", stats.video_frames, stats.presented_frames,
+		stats.video_frames ? stats.video_time / stats.video_frames : 0, stats.video_max_time);
+	printf("audio : %d packets, %.3f ms/packet (of which resampling %.3f)\n", stats.audio_packets,
+		stats.audio_packets ? stats.audio_time / stats.audio_packets : 0, stats.audio_packets ? stats.audio_resample_time / stats.audio_packets : 0);
+	printf("network wait : %.1f ms\n", (double) decoder.network_wait_time);
+	if (stats.seeks) printf("seeks : %d (%d within the queue), %.2f ms avg\n", stats.seeks, stats.seeks_within_queue, stats.seek_time / stats.seeks);
+	if (stats.fragment_switches) printf("fragment switches : %d, %.2f ms avg for the init of the next one\n", stats.fragment_switches,
+		stats.fragment_init_time / stats.fragment_switches);
+	if (stats.errors) printf("errors : %d\n", stats.errors);
+
+	printf("\n%-16s %8s %12s %10s %10s\n", "zone", "count", "total (ms)", "avg (ms)", "max (ms)");
+	for (auto &zone : host_get_zone_stats())
+		printf("%-16s %8d %12.1f %10.3f %10.3f\n", zone.first.c_str(), zone.second.num, zone.second.total, zone.second.total / zone.second.num, zone.second.max);
+}
+
+int main(int argc, char **argv) {
+	parse_options(argc, argv);
+	av_log_set_level(host_log_verbose ? AV_LOG_INFO : AV_LOG_ERROR);
+
+	feeder = new Feeder(options.rate);
+	decoder.sw_decoder_thread_num = options.thread_num;
+	decoder.audio_output_max_sample_rate = options.audio_rate;
+	decoder.audio_output_mono = options.mono;
+
+	double start = platform_get_time_ms();
+	NetworkDecoderFFmpegData data;
+	NetworkDecoderFFmpegData shared_codecs; // livestreams : owns the decoder contexts the following fragments keep using
+	Result_with_string result = open_data(data, 0, NULL);
+	if (result.code != 0) {
+		fprintf(stderr, "failed to open : %s%s\n", result.string.c_str(), result.error_description.c_str());
+		delete feeder;
+		return 1;
+	}
+	if (options.fragment_num) shared_codecs.take_codecs(data);
+	decoder.change_ffmpeg_data(data, 0);
+	result = decoder.init(false);
+	if (result.code != 0) {
+		fprintf(stderr, "NetworkDecoder::init() failed : %s%s\n", result.string.c_str(), result.error_description.c_str());
+		delete feeder;
+		return 1;
+	}
+	printf("opened in %.1f ms\n", platform_get_time_ms() - start);
+
+	trace_capturing = true;
+	start = platform_get_time_ms();
+	threads_running = true;
+	std::thread present_thread(present_thread_func);
+	std::thread audio_thread, demux_thread;
+	if (options.concurrent) {
+		decoder.video_demux_enabled = true;
+		audio_thread = std::thread(audio_thread_func);
+		demux_thread = std::thread(demux_thread_func);
+	}
+
+	int seq = 0;
+	while (true) {
+		if (options.max_seconds > 0 && stats.last_pos >= options.max_seconds) break;
+		for (auto &seek_request : options.seeks) if (!seek_request.done && stats.last_pos >= seek_request.at) {
+			seek_request.done = true;
+			seek(data, seek_request.to);
+		}
+
+		NetworkDecoder::DecodeType type;
+		if (options.concurrent) {
+			if (decoder.prepare_packet(NetworkDecoder::DecodeType::VIDEO)) type = NetworkDecoder::DecodeType::VIDEO;
+			else if (decoder.interrupt) type = NetworkDecoder::DecodeType::INTERRUPTED;
+			else if (audio_eof) type = NetworkDecoder::DecodeType::EoF;
+			else {
+				platform_sleep_ns(1000000); // the rest of the audio is still being decoded
+				continue;
+			}
+		} else type = decoder.next_decode_type();
+
+		if (type == NetworkDecoder::DecodeType::EoF && seq + 1 < options.fragment_num) {
+			// NetworkMultipleDecoder::next_decode_type() : the next fragment was inited by the initer thread meanwhile
+			double init_start = platform_get_time_ms();
+			NetworkDecoderFFmpegData next_data;
+			result = open_data(next_data, seq + 1, &shared_codecs);
+			stats.fragment_init_time += platform_get_time_ms() - init_start;
+			if (result.code != 0) {
+				fprintf(stderr, "failed to open fragment %d : %s%s\n", seq + 1, result.string.c_str(), result.error_description.c_str());
+				break;
+			}
+			decoder.change_ffmpeg_data(next_data, 0);
+			data.deinit(true);
+			data = next_data;
+			seq++;
+			stats.fragment_switches++;
+			continue;
+		}
+		if (type == NetworkDecoder::DecodeType::EoF || type == NetworkDecoder::DecodeType::INTERRUPTED) break;
+		if (type == NetworkDecoder::DecodeType::AUDIO) decode_audio_packet();
+		else decode_video_packet();
+	}
+	// let the presenting thread take what's left
+	while (decoder.wait_for_decoded_video_frame(0)) platform_sleep_ns(1000000);
+	double wall_time = platform_get_time_ms() - start;
+	trace_capturing = false;
+
+	decoder.video_demux_enabled = false;
+	threads_running = false;
+	present_thread.join();
+	if (audio_thread.joinable()) audio_thread.join();
+	if (demux_thread.joinable()) demux_thread.join();
+
+	print_report(wall_time);
+
+	decoder.deinit();
+	data.deinit(true);
+	shared_codecs.deinit(false);
+	delete feeder;
+	return stats.errors ? 2 : 0;
+}
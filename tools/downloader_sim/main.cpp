@@ -0,0 +1,516 @@
+// host-side simulator of the stream downloader : replays the link conditions of a trace recorded on the hardware (the "Network trace log" setting,
+// profile/net_*.csv) or a synthetic bandwidth/latency profile through the decisions of NetworkStreamDownloader (source/network/download_policy.cpp,
+// the very same code as on the hardware) and a model of the reads of the decoder, and reports the stalls and the buffer levels,
+// so that changes to the block size, the prefetch window, the request sizes or the number of workers can be compared under the same conditions
+//
+// usage : downloader_sim (--trace <net_*.csv> | --link <profile>) [options]
+//   --link <KB/s>,<latency ms>             a constant link
+//   --link <s>:<KB/s>,<latency ms>/...     a piecewise one, each segment starts at <s> seconds (e.g. 0:800,60/30:40,500/50:800,60)
+//   --duration <s>        length of the video (default 300)
+//   --video-kbps <n>      bitrate of the video stream (default 500)
+//   --audio-kbps <n>      bitrate of the audio stream (default 128), 0 for a single muxed stream
+//   --seek <at>:<to>      seeks to <to> seconds when the playback reaches <at> seconds, can be repeated
+//   --workers <n>         downloader workers (default 2 : NetworkStreamDownloader::WORKER_NUM)
+//   --pipelined           multi-block requests are split like with the sslc framework (the default is libcurl)
+//   --data-saver          var_data_saver
+//   --csv <file>          writes the buffer levels every 100 ms
+//   --verbose             prints every request
+//
+// the model :
+//   the link capacity is shared equally among the transfers in flight, and each request waits for the latency before its body starts arriving
+//   a trace gives the capacity and the latency over time from its playback requests (looped if the simulation runs longer than the trace)
+//   the decoder reads each stream in chunks of its avio buffer up to DEMUX_AHEAD_SECONDS ahead of the playback (constant bitrates),
+//   and the playback stalls when a stream has nothing demuxed at the playback position
+//   not modeled : the eviction (the cache is unlimited), the disk cache, failures and retries, network_scheduler.hpp and the rest of the traffic
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <set>
+#include <limits>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "network/download_policy.hpp"
+
+#define BLOCK_SIZE DownloadPolicy::BLOCK_SIZE
+#define STEP_MS 1.0
+#define IDLE_WAIT_TIMEOUT_MS 200 // NetworkStreamDownloader::IDLE_WAIT_TIMEOUT_NS
+#define MAX_PIPELINED_REQUESTS 4 // NetworkStreamDownloader::MAX_PIPELINED_REQUESTS
+#define DEMUX_AHEAD_SECONDS 2.0 // VIDEO_DEMUX_AHEAD_SECONDS of network_decoder.cpp
+// the avio buffer sizes of network_decoder.cpp
+#define MIN_NETWORK_BUFFER_SIZE 0x8000
+#define MAX_NETWORK_BUFFER_SIZE 0x40000
+#define AUDIO_NETWORK_BUFFER_SIZE 0x4000
+#define IO_BUFFER_SECONDS 0.25
+#define MIN_TRACE_SAMPLE_BYTES 65536 // smaller requests tell more about the latency than about the throughput
+#define SAMPLE_INTERVAL_MS 100
+
+// ---- link ----
+
+struct LinkState {
+	double capacity; // bytes per millisecond (= KB/s)
+	double latency; // milliseconds
+};
+struct LinkSegment {
+	double start; // milliseconds
+	LinkState state;
+};
+static std::vector<LinkSegment> link_segments; // sorted by start, the first one starts at 0
+static double link_period = 0; // the trace is looped with this period, 0 : the last segment lasts forever
+static std::string link_description;
+
+static LinkState get_link(double time) {
+	if (link_period > 0) time = fmod(time, link_period);
+	size_t i = std::upper_bound(link_segments.begin(), link_segments.end(), time, [] (double time, const LinkSegment &segment) {
+		return time < segment.start;
+	}) - link_segments.begin();
+	return link_segments[i ? i - 1 : 0].state;
+}
+
+static std::vector<std::string> split(const std::string &str, char delimiter) {
+	std::vector<std::string> res;
+	std::stringstream sstream(str);
+	std::string cur;
+	while (std::getline(sstream, cur, delimiter)) res.push_back(cur);
+	return res;
+}
+
+// "<KB/s>,<latency>" or "<s>:<KB/s>,<latency>/..."
+static bool parse_link_profile(const std::string &profile) {
+	for (auto &segment_str : split(profile, '/')) {
+		LinkSegment segment;
+		segment.start = 0;
+		std::string state_str = segment_str;
+		size_t colon = segment_str.find(':');
+		if (colon != std::string::npos) {
+			segment.start = atof(segment_str.substr(0, colon).c_str()) * 1000;
+			state_str = segment_str.substr(colon + 1);
+		}
+		auto values = split(state_str, ',');
+		if (values.size() != 2) return false;
+		segment.state.capacity = atof(values[0].c_str());
+		segment.state.latency = atof(values[1].c_str());
+		if (segment.state.capacity < 0 || segment.state.latency < 0) return false;
+		link_segments.push_back(segment);
+	}
+	if (!link_segments.size()) return false;
+	std::stable_sort(link_segments.begin(), link_segments.end(), [] (const LinkSegment &a, const LinkSegment &b) { return a.start < b.start; });
+	link_segments[0].start = 0;
+	link_description = "synthetic " + profile;
+	return true;
+}
+
+// the csv written by source/network/network_trace.cpp :
+// start_ms,host,class,status,dns_ms,connect_ms,tls_ms,first_byte_ms,total_ms,bytes
+static bool load_trace(const std::string &path) {
+	std::ifstream file(path);
+	if (!file) {
+		fprintf(stderr, "cannot open %s\n", path.c_str());
+		return false;
+	}
+	struct TraceRequest {
+		double start;
+		double first_byte;
+		double total;
+		double bytes;
+	};
+	std::vector<TraceRequest> requests;
+	std::string line;
+	bool first_byte_known = false;
+	while (std::getline(file, line)) {
+		auto values = split(line, ',');
+		if (values.size() < 10 || values[0] == "start_ms") continue;
+		if (values[2] != "playback" || atoi(values[3].c_str()) / 100 != 2) continue;
+		TraceRequest request = {atof(values[0].c_str()), atof(values[7].c_str()), atof(values[8].c_str()), atof(values[9].c_str())};
+		if (request.total <= 0) continue;
+		if (request.first_byte >= 0) first_byte_known = true;
+		requests.push_back(request);
+	}
+	// the throughput of a request was measured while sharing the link with the other requests of the streams in flight
+	for (auto &request : requests) {
+		if (request.bytes < MIN_TRACE_SAMPLE_BYTES) continue;
+		double latency = std::max(0.0, std::min(request.first_byte, request.total));
+		double middle = request.start + (latency + request.total) / 2;
+		int concurrency = 0;
+		for (auto &other : requests) if (other.start <= middle && middle < other.start + other.total) concurrency++;
+		double throughput = request.bytes / std::max(1.0, request.total - latency);
+		link_segments.push_back({request.start, {throughput * std::max(1, concurrency), latency}});
+		link_period = std::max(link_period, request.start + request.total);
+	}
+	if (!link_segments.size()) {
+		fprintf(stderr, "%s : no playback request of at least %d bytes\n", path.c_str(), MIN_TRACE_SAMPLE_BYTES);
+		return false;
+	}
+	if (!first_byte_known) fprintf(stderr, "%s : no first byte times (not measured by the network framework), the latency is taken as 0\n", path.c_str());
+	std::stable_sort(link_segments.begin(), link_segments.end(), [] (const LinkSegment &a, const LinkSegment &b) { return a.start < b.start; });
+	link_segments[0].start = 0;
+	link_description = "trace " + path + " (" + std::to_string(link_segments.size()) + " samples over " + std::to_string((int) (link_period / 1000)) + " s)";
+	return true;
+}
+
+// ---- streams ----
+
+struct SimStream : public DownloadBlockMap {
+	std::string name;
+	double bitrate = 0; // bytes per second
+	u64 len = 0;
+	u64 block_num = 0;
+	u64 io_buffer_size = 0;
+	bool ready = false;
+	std::vector<bool> present;
+	std::set<u64> in_flight;
+	DownloadRequestSizing sizing;
+	u64 read_head = 0;
+
+	u64 find_missing_block(u64 from, u64 limit) const override {
+		for (u64 block = from; block < limit; block++) if (!is_block_present(block)) return block;
+		return limit;
+	}
+	bool is_block_present(u64 block) const override { return block < present.size() && present[block]; }
+	bool is_block_in_flight(u64 block) const override { return in_flight.count(block); }
+	bool is_data_available(u64 start, u64 size) const {
+		if (!ready || start + size > len) return false;
+		if (!size) return true;
+		u64 end_block = (start + size - 1) / BLOCK_SIZE;
+		return find_missing_block(start / BLOCK_SIZE, end_block + 1) == end_block + 1;
+	}
+	u64 bytes_at(double seconds) const { return std::min<u64>(len, std::max(0.0, seconds * bitrate)); }
+	// the bitrate is set by the decoder once the container is opened
+	double known_bitrate() const { return ready ? bitrate : 0; }
+	DownloadPolicyStream get_policy_stream(u64 forward_read_blocks) const {
+		DownloadPolicyStream res;
+		res.blocks = this;
+		res.len = len;
+		res.block_num = block_num;
+		res.read_head = read_head;
+		res.bitrate = known_bitrate();
+		res.forward_read_blocks = forward_read_blocks;
+		return res;
+	}
+};
+static std::vector<SimStream> streams;
+
+// ---- downloader ----
+
+struct Request {
+	bool active = false;
+	size_t stream = 0;
+	u64 block = 0;
+	u64 block_num = 0;
+	bool catching_up = false;
+	bool first = false; // the stream was not ready yet
+	double start = 0;
+	double body_start = 0; // after the latency
+	u64 expected_len = 0;
+	double received = 0;
+	std::vector<u64> block_end; // the received bytes at which each block becomes present
+	size_t blocks_done = 0;
+};
+struct Worker {
+	Request request;
+	double next_scan = 0;
+};
+static std::vector<Worker> workers;
+static bool pipelined = false;
+static bool data_saver = false;
+static bool verbose = false;
+static bool downloader_wakeup = true; // NetworkStreamDownloader::wakeup_event
+
+struct Stats {
+	int request_num = 0;
+	int catch_up_request_num = 0;
+	double downloaded_bytes = 0;
+};
+static Stats stats;
+
+// one iteration of NetworkStreamDownloader::downloader_thread() picking the next request, returns false if there's nothing to download
+static bool start_next_request(Worker &worker, double now) {
+	bool margin_in_seconds = true;
+	for (auto &stream : streams) if (stream.ready && stream.known_bitrate() <= 0) margin_in_seconds = false;
+	std::vector<u64> forward_read_blocks(streams.size());
+
+	size_t cur_stream_index = (size_t) -1;
+	u64 block_reading = 0;
+	double margin_min = std::numeric_limits<double>::infinity();
+	for (size_t i = 0; i < streams.size(); i++) {
+		SimStream &stream = streams[i];
+		if (!stream.ready) {
+			if (stream.in_flight.size()) continue;
+			cur_stream_index = i;
+			block_reading = stream.read_head / BLOCK_SIZE;
+			break;
+		}
+		forward_read_blocks[i] = download_policy_forward_read_blocks(stream.known_bitrate(), stream.sizing.bandwidth_estimate, 0, 0, false, data_saver);
+		u64 next_block;
+		double margin;
+		if (!download_policy_find_next_block(stream.get_policy_stream(forward_read_blocks[i]), margin_in_seconds, &next_block, &margin)) continue;
+		if (margin_min > margin) {
+			margin_min = margin;
+			cur_stream_index = i;
+			block_reading = next_block;
+		}
+	}
+	if (cur_stream_index == (size_t) -1) return false;
+
+	SimStream &stream = streams[cur_stream_index];
+	Request &request = worker.request;
+	request = Request();
+	request.active = true;
+	request.stream = cur_stream_index;
+	request.block = block_reading;
+	request.block_num = 1;
+	request.first = !stream.ready;
+	if (stream.ready) request.block_num = download_policy_request_block_num(stream.get_policy_stream(forward_read_blocks[cur_stream_index]),
+		block_reading, stream.sizing, &request.catching_up);
+	request.start = now;
+	request.body_start = now + get_link(now).latency;
+	u64 start = block_reading * BLOCK_SIZE;
+	request.expected_len = std::min((block_reading + request.block_num) * BLOCK_SIZE, stream.len) - start;
+	// the one with sslc splits the blocks into MAX_PIPELINED_REQUESTS responses, each stored once complete
+	u64 blocks_per_response = request.block_num;
+	if (request.catching_up) blocks_per_response = 1; // streamed into the blocks
+	else if (pipelined && stream.ready && request.block_num > 1) {
+		u64 response_num = std::min<u64>(request.block_num, MAX_PIPELINED_REQUESTS);
+		blocks_per_response = (request.block_num + response_num - 1) / response_num;
+	}
+	for (u64 i = 0; i < request.block_num; i++) {
+		u64 response_end_block = std::min(request.block_num, (i / blocks_per_response + 1) * blocks_per_response);
+		request.block_end.push_back(std::min((block_reading + response_end_block) * BLOCK_SIZE, stream.len) - start);
+	}
+	for (u64 i = 0; i < request.block_num; i++) stream.in_flight.insert(block_reading + i);
+
+	stats.request_num++;
+	if (request.catching_up) stats.catch_up_request_num++;
+	if (verbose) printf("%9.3f s  %-5s %s%llu x%llu\n", now / 1000, stream.name.c_str(), request.catching_up ? "catch up " : "",
+		(unsigned long long) block_reading, (unsigned long long) request.block_num);
+	return true;
+}
+
+static void finish_request(Request &request, double now) {
+	SimStream &stream = streams[request.stream];
+	for (u64 i = 0; i < request.block_num; i++) stream.in_flight.erase(request.block + i);
+	if (request.first) stream.ready = true;
+	else download_policy_on_throughput(stream.sizing, request.expected_len / std::max(1.0, now - request.start));
+	request.active = false;
+	downloader_wakeup = true;
+}
+
+static void step_downloader(double now) {
+	for (auto &worker : workers) {
+		if (worker.request.active) continue;
+		if (!downloader_wakeup && now < worker.next_scan) continue;
+		if (!start_next_request(worker, now)) worker.next_scan = now + IDLE_WAIT_TIMEOUT_MS;
+	}
+	downloader_wakeup = false;
+
+	int transferring = 0;
+	for (auto &worker : workers) if (worker.request.active && now >= worker.request.body_start) transferring++;
+	if (!transferring) return;
+	double share = get_link(now).capacity * STEP_MS / transferring;
+	for (auto &worker : workers) {
+		Request &request = worker.request;
+		if (!request.active || now < request.body_start) continue;
+		double size = std::min(share, request.expected_len - request.received);
+		request.received += size;
+		stats.downloaded_bytes += size;
+		SimStream &stream = streams[request.stream];
+		while (request.blocks_done < request.block_num && request.received >= request.block_end[request.blocks_done])
+			stream.present[request.block + request.blocks_done++] = true;
+		if (request.received >= request.expected_len) finish_request(request, now + STEP_MS);
+	}
+}
+
+// ---- decoder and player ----
+
+struct Seek {
+	double at;
+	double to;
+};
+
+// reads as far as the demuxer would, returns whether every stream has data demuxed at `position`
+static bool step_decoder(double position) {
+	bool res = true;
+	for (auto &stream : streams) {
+		u64 target = stream.bytes_at(position + DEMUX_AHEAD_SECONDS);
+		while (stream.read_head < target) {
+			u64 size = std::min(stream.io_buffer_size, stream.len - stream.read_head);
+			if (!stream.is_data_available(stream.read_head, size)) break;
+			u64 prev_block = stream.read_head / BLOCK_SIZE;
+			stream.read_head += size;
+			if (stream.read_head / BLOCK_SIZE != prev_block) downloader_wakeup = true; // NetworkStream::notify_downloader()
+		}
+		if (stream.read_head < stream.len && stream.read_head < stream.bytes_at(position + STEP_MS / 1000)) res = false;
+	}
+	return res;
+}
+
+// the seconds downloaded ahead of the playback with no gap, the least among the streams
+static double get_buffer_seconds(double position) {
+	double res = std::numeric_limits<double>::infinity();
+	for (auto &stream : streams) {
+		u64 pos = stream.bytes_at(position);
+		u64 end = std::min(stream.len, stream.find_missing_block(pos / BLOCK_SIZE, stream.block_num) * BLOCK_SIZE);
+		res = std::min(res, end > pos ? (end - pos) / stream.bitrate : 0);
+	}
+	return res;
+}
+
+static void add_stream(const std::string &name, double kbps, double duration, bool audio) {
+	SimStream stream;
+	stream.name = name;
+	stream.bitrate = kbps * 1000 / 8;
+	stream.len = std::max<u64>(1, stream.bitrate * duration);
+	stream.block_num = (stream.len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	stream.present.assign(stream.block_num, false);
+	if (audio) stream.io_buffer_size = AUDIO_NETWORK_BUFFER_SIZE;
+	else {
+		u64 size = std::min<double>(stream.bitrate * IO_BUFFER_SECONDS, MAX_NETWORK_BUFFER_SIZE);
+		stream.io_buffer_size = std::max<u64>(MIN_NETWORK_BUFFER_SIZE, (size + 0xFFF) & ~0xFFF);
+	}
+	streams.push_back(stream);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage : %s (--trace <net_*.csv> | --link <KB/s>,<latency ms>[/<s>:<KB/s>,<latency ms>...]) [--duration <s>]\n"
+		"  [--video-kbps <n>] [--audio-kbps <n>] [--seek <at>:<to>]... [--workers <n>] [--pipelined] [--data-saver] [--csv <file>] [--verbose]\n", name);
+}
+
+int main(int argc, char **argv) {
+	std::string trace_path, link_profile, csv_path;
+	double duration = 300, video_kbps = 500, audio_kbps = 128;
+	int worker_num = 2;
+	std::vector<Seek> seeks;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--trace" && has_value) trace_path = argv[++i];
+		else if (arg == "--link" && has_value) link_profile = argv[++i];
+		else if (arg == "--duration" && has_value) duration = atof(argv[++i]);
+		else if (arg == "--video-kbps" && has_value) video_kbps = atof(argv[++i]);
+		else if (arg == "--audio-kbps" && has_value) audio_kbps = atof(argv[++i]);
+		else if (arg == "--workers" && has_value) worker_num = atoi(argv[++i]);
+		else if (arg == "--csv" && has_value) csv_path = argv[++i];
+		else if (arg == "--seek" && has_value) {
+			std::string value = argv[++i];
+			size_t colon = value.find(':');
+			if (colon == std::string::npos) {
+				usage(argv[0]);
+				return 1;
+			}
+			seeks.push_back({atof(value.substr(0, colon).c_str()), atof(value.substr(colon + 1).c_str())});
+		} else if (arg == "--pipelined") pipelined = true;
+		else if (arg == "--data-saver") data_saver = true;
+		else if (arg == "--verbose") verbose = true;
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if ((trace_path == "") == (link_profile == "") || duration <= 0 || video_kbps <= 0 || audio_kbps < 0 || worker_num <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (trace_path != "" ? !load_trace(trace_path) : !parse_link_profile(link_profile)) {
+		if (link_profile != "") fprintf(stderr, "invalid link profile : %s\n", link_profile.c_str());
+		return 1;
+	}
+	std::sort(seeks.begin(), seeks.end(), [] (const Seek &a, const Seek &b) { return a.at < b.at; });
+
+	if (audio_kbps > 0) {
+		add_stream("video", video_kbps, duration, false);
+		add_stream("audio", audio_kbps, duration, true);
+	} else add_stream("both", video_kbps, duration, false);
+	workers.resize(worker_num);
+
+	FILE *csv = NULL;
+	if (csv_path != "") {
+		csv = fopen(csv_path.c_str(), "w");
+		if (!csv) {
+			fprintf(stderr, "cannot open %s\n", csv_path.c_str());
+			return 1;
+		}
+		fprintf(csv, "time_s,position_s,state,buffer_s,requests_in_flight,capacity_KBps\n");
+	}
+
+	double position = 0; // of the playback, in seconds
+	bool started = false;
+	double startup_time = -1;
+	size_t next_seek = 0;
+	double seek_start = -1; // waiting for the data at the seek target since then
+	std::vector<double> seek_waits;
+	bool stalled = false;
+	double stall_start = 0;
+	std::vector<double> stalls;
+	std::vector<double> buffer_samples;
+	double time_limit = duration * 1000 * 20 + 600 * 1000; // gives up on a link too slow to ever finish
+	double now = 0;
+	for (; position < duration && now < time_limit; now += STEP_MS) {
+		step_downloader(now);
+		bool can_play = step_decoder(position);
+		if (can_play) {
+			if (!started) {
+				started = true;
+				startup_time = now;
+			}
+			if (seek_start >= 0) {
+				seek_waits.push_back(now - seek_start);
+				seek_start = -1;
+			}
+			if (stalled) {
+				stalls.push_back(now - stall_start);
+				stalled = false;
+			}
+			position += STEP_MS / 1000;
+			if (next_seek < seeks.size() && position >= seeks[next_seek].at) {
+				position = std::min(seeks[next_seek++].to, duration);
+				for (auto &stream : streams) stream.read_head = stream.bytes_at(position);
+				downloader_wakeup = true;
+				seek_start = now;
+			}
+		} else if (started && seek_start < 0 && !stalled) {
+			stalled = true;
+			stall_start = now;
+		}
+		if (fmod(now, SAMPLE_INTERVAL_MS) < STEP_MS) {
+			double buffer = get_buffer_seconds(position);
+			if (started && seek_start < 0) buffer_samples.push_back(buffer);
+			if (csv) {
+				int in_flight = 0;
+				for (auto &worker : workers) if (worker.request.active) in_flight++;
+				const char *state = !started ? "startup" : seek_start >= 0 ? "seeking" : stalled ? "stalled" : "playing";
+				fprintf(csv, "%.1f,%.3f,%s,%.2f,%d,%.1f\n", now / 1000, position, state, std::isinf(buffer) ? 0 : buffer, in_flight, get_link(now).capacity);
+			}
+		}
+	}
+	if (stalled) stalls.push_back(now - stall_start);
+	if (csv) fclose(csv);
+
+	std::string streams_str;
+	for (auto &stream : streams) streams_str += (streams_str.size() ? ", " : "") + stream.name + " " + std::to_string((int) (stream.bitrate * 8 / 1000)) + " kbps";
+	printf("link          : %s\n", link_description.c_str());
+	printf("streams       : %s, %.0f s, %d workers%s%s\n", streams_str.c_str(), duration, worker_num, pipelined ? ", pipelined" : "", data_saver ? ", data saver" : "");
+	if (position < duration) printf("[gave up at %.1f s of playback after %.0f s]\n", position, now / 1000);
+	printf("startup       : %.0f ms\n", startup_time);
+	double stall_total = 0, stall_max = 0;
+	for (auto stall : stalls) stall_total += stall, stall_max = std::max(stall_max, stall);
+	printf("stalls        : %d (total %.0f ms, longest %.0f ms)\n", (int) stalls.size(), stall_total, stall_max);
+	if (seeks.size()) {
+		double seek_total = 0;
+		for (auto wait : seek_waits) seek_total += wait;
+		printf("seek waits    : %d (avg %.0f ms)\n", (int) seek_waits.size(), seek_waits.size() ? seek_total / seek_waits.size() : 0);
+	}
+	if (buffer_samples.size()) {
+		std::vector<double> sorted = buffer_samples;
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0;
+		for (auto buffer : sorted) sum += buffer;
+		printf("buffer (s)    : min %.1f / p10 %.1f / median %.1f / avg %.1f\n", sorted.front(), sorted[sorted.size() / 10], sorted[sorted.size() / 2], sum / sorted.size());
+	}
+	printf("requests      : %d (avg %.0f KB, %d catch-up)\n", stats.request_num, stats.request_num ? stats.downloaded_bytes / stats.request_num / 1000 : 0,
+		stats.catch_up_request_num);
+	printf("downloaded    : %.1f MB in %.1f s\n", stats.downloaded_bytes / 1000 / 1000, now / 1000);
+	return 0;
+}
@@ -0,0 +1,155 @@
+// host-side benchmark of the youtube parser : replays saved pages through the parser functions and reports the time and the
+// number of heap allocations of each stage, so that parser changes can be measured on a PC before trying them on the hardware
+//
+// usage : parser_bench <fixture_dir> [iterations]
+// files looked up in <fixture_dir> (missing ones just skip the stages that need them) :
+//   watch.html     a watch page (https://m.youtube.com/watch?v=...)
+//   search.html    a search result page
+//   channel.html   the "videos" tab of a channel
+//   comments.json  the response to a comment continuation (youtubei/v1/next or watch_comment)
+//   player.json    the response to youtubei/v1/player
+//   base.js        the player js referenced by watch.html
+// every url is answered from these files, the network is never accessed
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include "internal_common.hpp"
+#include "parser.hpp"
+#include "cipher.hpp"
+#include "n_param.hpp"
+
+// the parser runs on the calling thread only, so plain counters are enough
+static size_t alloc_num = 0;
+static size_t alloc_bytes = 0;
+
+void *operator new(size_t size) {
+	alloc_num++;
+	alloc_bytes += size;
+	void *res = malloc(size ? size : 1);
+	if (!res) abort();
+	return res;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+
+static std::string fixture_dir;
+static std::vector<std::string> missing_fixtures;
+
+static bool load_fixture(const std::string &name, std::string &res) {
+	std::ifstream file(fixture_dir + "/" + name, std::ios::binary);
+	if (!file) {
+		bool reported = false;
+		for (auto &i : missing_fixtures) if (i == name) reported = true;
+		if (!reported) missing_fixtures.push_back(name);
+		return false;
+	}
+	std::stringstream sstream;
+	sstream << file.rdbuf();
+	res = sstream.str();
+	return true;
+}
+static bool has_fixture(const std::string &name) {
+	std::ifstream file(fixture_dir + "/" + name, std::ios::binary);
+	return (bool) file;
+}
+
+// url -> fixture file name
+static std::string fixture_for_url(const std::string &url, bool is_post) {
+	if (url.find("base.js") != std::string::npos) return "base.js";
+	if (url.find("/youtubei/v1/player") != std::string::npos) return "player.json";
+	if (url.find("/youtubei/v1/next") != std::string::npos || url.find("/watch_comment") != std::string::npos) return "comments.json";
+	if (is_post) return "";
+	if (url.find("/watch") != std::string::npos) return "watch.html";
+	if (url.find("/results") != std::string::npos) return "search.html";
+	if (url.find("/channel/") != std::string::npos || url.find("/c/") != std::string::npos) return "channel.html";
+	return "";
+}
+
+struct StageResult {
+	std::string name;
+	int runs = 0;
+	double total_ms = 0;
+	double min_ms = 1e18;
+	size_t total_alloc_num = 0;
+	size_t total_alloc_bytes = 0;
+};
+static std::vector<StageResult> results;
+
+// the fixtures are loaded by the hook inside the measured region, so the file reading is counted too
+// (it's small compared to the parsing, and the real network is far slower anyway)
+static void run_stage(const std::string &name, int iterations, const std::function<void ()> &func) {
+	StageResult res;
+	res.name = name;
+	for (int i = 0; i < iterations; i++) {
+		size_t alloc_num_before = alloc_num;
+		size_t alloc_bytes_before = alloc_bytes;
+		auto start = std::chrono::steady_clock::now();
+		func();
+		auto end = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		res.runs++;
+		res.total_ms += ms;
+		res.min_ms = std::min(res.min_ms, ms);
+		res.total_alloc_num += alloc_num - alloc_num_before;
+		res.total_alloc_bytes += alloc_bytes - alloc_bytes_before;
+	}
+	results.push_back(res);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage : %s <fixture_dir> [iterations]\n", argv[0]);
+		return 1;
+	}
+	fixture_dir = argv[1];
+	int iterations = argc >= 3 ? atoi(argv[2]) : 10;
+	if (iterations <= 0) iterations = 1;
+
+	youtube_parser::host_http_hook = [] (const std::string &url, const std::string *post_body, std::string &res) {
+		std::string name = fixture_for_url(url, post_body != NULL);
+		if (name == "" || !load_fixture(name, res)) res = "";
+		return true; // never fall back to wget/curl
+	};
+
+	const std::string watch_url = "https://m.youtube.com/watch?v=dQw4w9WgXcQ";
+	if (has_fixture("search.html")) run_stage("youtube_parse_search", iterations, [] () {
+		youtube_parse_search("https://m.youtube.com/results?search_query=bench");
+	});
+	if (has_fixture("channel.html")) run_stage("youtube_parse_channel_page", iterations, [] () {
+		youtube_parse_channel_page("https://m.youtube.com/channel/UCuAXFkgsw1L7xaCfnd5JJOw");
+	});
+	if (has_fixture("base.js")) {
+		std::string js;
+		load_fixture("base.js", js);
+		run_stage("yt_cipher_get_transform_plan", iterations, [&] () { yt_cipher_get_transform_plan(js); });
+		run_stage("yt_nparam_get_transform_plan", iterations, [&] () { yt_nparam_get_transform_plan(js); });
+	}
+	if (has_fixture("watch.html")) {
+		// the player js plans are cached in memory after the first run, so the first run is reported separately
+		run_stage("youtube_parse_video_page (first)", 1, [&] () { youtube_parse_video_page(watch_url, false); });
+		run_stage("youtube_parse_video_page", iterations, [&] () { youtube_parse_video_page(watch_url, false); });
+
+		YouTubeVideoDetail detail = youtube_parse_video_page(watch_url, false);
+		if (has_fixture("comments.json") && detail.has_more_comments()) run_stage("youtube_video_page_load_more_comments", iterations, [&] () {
+			youtube_video_page_load_more_comments(detail);
+		});
+	}
+
+	for (auto &name : missing_fixtures) fprintf(stderr, "[missing fixture] %s\n", name.c_str());
+
+	printf("%-40s %6s %10s %10s %12s %14s\n", "stage", "runs", "avg ms", "min ms", "allocs/run", "alloc KB/run");
+	for (auto &res : results) {
+		printf("%-40s %6d %10.2f %10.2f %12zu %14.1f\n", res.name.c_str(), res.runs, res.total_ms / res.runs, res.min_ms,
+			res.total_alloc_num / res.runs, res.total_alloc_bytes / 1024.0 / res.runs);
+	}
+	return 0;
+}